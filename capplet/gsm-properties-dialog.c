@@ -55,6 +55,7 @@ struct _GsmPropertiesDialog {
   GtkWidget *remember_toggle;
   GtkWidget *show_hidden_toggle;
   GspAppManager *manager;
+  GCancellable *cancellable;
   GSettings *settings;
 };
 
@@ -182,6 +183,23 @@ static void populate_model(GsmPropertiesDialog *dialog) {
   g_slist_free(apps);
 }
 
+static void on_manager_filled(GspAppManager *manager, GAsyncResult *result,
+                              GsmPropertiesDialog *dialog) {
+  GError *error;
+
+  error = NULL;
+  if (!gsp_app_manager_fill_finish(manager, result, &error)) {
+    /* the dialog is gone if loading got cancelled */
+    if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+      g_warning("Unable to load startup programs: %s", error->message);
+    }
+    g_error_free(error);
+    return;
+  }
+
+  gtk_tree_model_filter_refilter(GTK_TREE_MODEL_FILTER(dialog->tree_filter));
+}
+
 static void on_selection_changed(GtkTreeSelection *selection,
                                  GsmPropertiesDialog *dialog) {
   gboolean sel = gtk_tree_selection_get_selected(selection, NULL, NULL);
@@ -537,14 +555,18 @@ static void setup_dialog(GsmPropertiesDialog *dialog) {
                   "active", G_SETTINGS_BIND_DEFAULT);
 
   dialog->manager = gsp_app_manager_get();
-  gsp_app_manager_fill(dialog->manager);
   g_signal_connect_swapped(dialog->manager, "added", G_CALLBACK(_app_added),
                            dialog);
   g_signal_connect_swapped(dialog->manager, "removed", G_CALLBACK(_app_removed),
                            dialog);
 
+  /* the list fills in while the autostart dirs are read */
   populate_model(dialog);
   gtk_tree_model_filter_refilter(GTK_TREE_MODEL_FILTER(dialog->tree_filter));
+
+  dialog->cancellable = g_cancellable_new();
+  gsp_app_manager_fill_async(dialog->manager, dialog->cancellable,
+                             (GAsyncReadyCallback)on_manager_filled, dialog);
 }
 
 static GObject *gsm_properties_dialog_constructor(
@@ -569,6 +591,17 @@ static void gsm_properties_dialog_dispose(GObject *object) {
 
   dialog = GSM_PROPERTIES_DIALOG(object);
 
+  if (dialog->cancellable != NULL) {
+    g_cancellable_cancel(dialog->cancellable);
+    g_clear_object(&dialog->cancellable);
+  }
+
+  if (dialog->manager != NULL) {
+    g_signal_handlers_disconnect_by_func(dialog->manager, _app_added, dialog);
+    g_signal_handlers_disconnect_by_func(dialog->manager, _app_removed,
+                                         dialog);
+  }
+
   g_clear_object(&dialog->builder);
   g_clear_object(&dialog->settings);
 
@@ -24,10 +24,14 @@
 
 #include "gsp-app-manager.h"
 
+#include <gio/gio.h>
+#include <glib/gstdio.h>
 #include <string.h>
 
+#include "gsm-autostart-cache.h"
 #include "gsm-util.h"
 #include "gsp-app.h"
+#include "gsp-keyfile.h"
 
 typedef struct {
   char *dir;
@@ -38,8 +42,39 @@ typedef struct {
 typedef struct {
   GSList *apps;
   GSList *dirs;
+  GHashTable *save_queue; /* GspApp -> itself, holding a ref */
+  guint save_timeout;
+  GHashTable *own_writes; /* path -> OwnWrite */
 } GspAppManagerPrivate;
 
+/* Edits are written this long after the last one was queued */
+#define GSP_APP_MANAGER_SAVE_DELAY 2
+
+/* What we left on disk at a path, to recognize the monitor events of our
+ * own writes */
+typedef struct {
+  gboolean deleted;
+  gint64 mtime;
+  guint64 ino;
+  goffset size;
+} OwnWrite;
+
+/* Number of directory entries read and parsed per worker round trip */
+#define FILL_BATCH_SIZE 32
+
+typedef struct {
+  GQueue *dirs; /* GspXdgDir, in XDG order; owned by priv->dirs */
+  GspXdgDir *xdgdir;
+  GFileEnumerator *enumerator;
+} FillData;
+
+typedef struct {
+  const char *dir;
+  unsigned int index;
+  GPtrArray *paths;
+  GPtrArray *keyfiles; /* NULL entries for unreadable files */
+} FillBatch;
+
 enum { ADDED, REMOVED, LAST_SIGNAL };
 
 static guint gsp_app_manager_signals[LAST_SIGNAL] = {0};
@@ -97,6 +132,11 @@ static void gsp_app_manager_init(GspAppManager *manager) {
 
   // is needed?
   memset(priv, 0, sizeof(GspAppManagerPrivate));
+
+  priv->save_queue = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                           g_object_unref, NULL);
+  priv->own_writes = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                           g_free);
 }
 
 static void gsp_app_manager_dispose(GObject *object) {
@@ -109,6 +149,8 @@ static void gsp_app_manager_dispose(GObject *object) {
   manager = GSP_APP_MANAGER(object);
   priv = gsp_app_manager_get_instance_private(manager);
 
+  gsp_app_manager_flush_saves(manager);
+
   /* we unref GspApp objects in dispose since they might need to
    * reference us during their dispose/finalize */
   g_slist_foreach(priv->apps, (GFunc)_gsp_app_manager_app_unref, manager);
@@ -132,6 +174,9 @@ static void gsp_app_manager_finalize(GObject *object) {
   g_slist_free(priv->dirs);
   priv->dirs = NULL;
 
+  g_clear_pointer(&priv->save_queue, g_hash_table_destroy);
+  g_clear_pointer(&priv->own_writes, g_hash_table_destroy);
+
   G_OBJECT_CLASS(gsp_app_manager_parent_class)->finalize(object);
 
   manager = NULL;
@@ -288,6 +333,153 @@ static void _gsp_app_manager_handle_delete(GspAppManager *manager, GspApp *app,
   g_assert_not_reached();
 }
 
+/*
+ * Save queue
+ */
+
+static gint64 stat_mtime(const GStatBuf *st) {
+  return (gint64)st->st_mtim.tv_sec * G_USEC_PER_SEC +
+         st->st_mtim.tv_nsec / 1000;
+}
+
+static gboolean _gsp_app_manager_on_save_timeout(GspAppManager *manager) {
+  GspAppManagerPrivate *priv;
+
+  priv = gsp_app_manager_get_instance_private(manager);
+  priv->save_timeout = 0;
+
+  gsp_app_manager_flush_saves(manager);
+
+  return FALSE;
+}
+
+/* Queues @app to be written with all the other edits of the same burst */
+void gsp_app_manager_queue_save(GspAppManager *manager, GspApp *app) {
+  GspAppManagerPrivate *priv;
+
+  g_return_if_fail(GSP_IS_APP_MANAGER(manager));
+  g_return_if_fail(GSP_IS_APP(app));
+
+  priv = gsp_app_manager_get_instance_private(manager);
+
+  if (!g_hash_table_contains(priv->save_queue, app)) {
+    g_hash_table_add(priv->save_queue, g_object_ref(app));
+  }
+
+  if (priv->save_timeout) {
+    g_source_remove(priv->save_timeout);
+  }
+  priv->save_timeout = g_timeout_add_seconds(
+      GSP_APP_MANAGER_SAVE_DELAY, (GSourceFunc)_gsp_app_manager_on_save_timeout,
+      manager);
+}
+
+void gsp_app_manager_cancel_save(GspAppManager *manager, GspApp *app) {
+  GspAppManagerPrivate *priv;
+
+  g_return_if_fail(GSP_IS_APP_MANAGER(manager));
+
+  priv = gsp_app_manager_get_instance_private(manager);
+
+  g_hash_table_remove(priv->save_queue, app);
+  if (g_hash_table_size(priv->save_queue) == 0 && priv->save_timeout) {
+    g_source_remove(priv->save_timeout);
+    priv->save_timeout = 0;
+  }
+}
+
+void gsp_app_manager_flush_saves(GspAppManager *manager) {
+  GspAppManagerPrivate *priv;
+  GHashTableIter iter;
+  gpointer app;
+
+  g_return_if_fail(GSP_IS_APP_MANAGER(manager));
+
+  priv = gsp_app_manager_get_instance_private(manager);
+
+  if (priv->save_timeout) {
+    g_source_remove(priv->save_timeout);
+    priv->save_timeout = 0;
+  }
+
+  if (g_hash_table_size(priv->save_queue) == 0) {
+    return;
+  }
+
+  g_debug("GspAppManager: saving %u apps",
+          g_hash_table_size(priv->save_queue));
+
+  g_hash_table_iter_init(&iter, priv->save_queue);
+  while (g_hash_table_iter_next(&iter, &app, NULL)) {
+    gsp_app_save(GSP_APP(app));
+  }
+
+  g_hash_table_remove_all(priv->save_queue);
+}
+
+/* Remembers what we just did to @path, so that the monitor event it
+ * causes is not read back as an external change */
+void gsp_app_manager_note_write(GspAppManager *manager, const char *path) {
+  GspAppManagerPrivate *priv;
+  OwnWrite *write;
+  GStatBuf st;
+
+  g_return_if_fail(GSP_IS_APP_MANAGER(manager));
+  g_return_if_fail(path != NULL);
+
+  priv = gsp_app_manager_get_instance_private(manager);
+
+  write = g_new0(OwnWrite, 1);
+  if (g_stat(path, &st) != 0) {
+    write->deleted = TRUE;
+  } else {
+    write->mtime = stat_mtime(&st);
+    write->ino = st.st_ino;
+    write->size = st.st_size;
+  }
+
+  g_hash_table_replace(priv->own_writes, g_strdup(path), write);
+}
+
+static gboolean _gsp_app_manager_is_own_write(GspAppManager *manager,
+                                              const char *path,
+                                              GFileMonitorEvent flags) {
+  GspAppManagerPrivate *priv;
+  OwnWrite *write;
+  GStatBuf st;
+  gboolean deleted;
+
+  priv = gsp_app_manager_get_instance_private(manager);
+
+  write = g_hash_table_lookup(priv->own_writes, path);
+  if (write == NULL) {
+    return FALSE;
+  }
+
+  switch (flags) {
+    case G_FILE_MONITOR_EVENT_CHANGED:
+    case G_FILE_MONITOR_EVENT_CREATED:
+    case G_FILE_MONITOR_EVENT_DELETED:
+      break;
+    default:
+      return FALSE;
+  }
+
+  /* a write usually gives several events, so the entry stays until the
+   * file is something we did not leave there */
+  deleted = (g_stat(path, &st) != 0);
+  if (deleted == write->deleted &&
+      (deleted || (stat_mtime(&st) == write->mtime &&
+                   (guint64)st.st_ino == write->ino &&
+                   st.st_size == write->size))) {
+    return TRUE;
+  }
+
+  g_hash_table_remove(priv->own_writes, path);
+
+  return FALSE;
+}
+
 static gboolean gsp_app_manager_xdg_dir_monitor(GFileMonitor *monitor,
                                                 GFile *child, GFile *other_file,
                                                 GFileMonitorEvent flags,
@@ -324,6 +516,13 @@ static gboolean gsp_app_manager_xdg_dir_monitor(GFileMonitor *monitor,
 
   path = g_file_get_path(child);
 
+  if (_gsp_app_manager_is_own_write(manager, path, flags)) {
+    g_free(path);
+    g_free(dir);
+    g_free(basename);
+    return TRUE;
+  }
+
   switch (flags) {
     case G_FILE_MONITOR_EVENT_CHANGED:
     case G_FILE_MONITOR_EVENT_CREATED:
@@ -363,50 +562,175 @@ static gboolean gsp_app_manager_xdg_dir_monitor(GFileMonitor *monitor,
  * Initialization
  */
 
+/* Builds the keyfile of @name from what mate-session left about it in its
+ * autostart cache, if that is still up to date */
+static GKeyFile *_gsp_app_manager_load_cached(const char *dir,
+                                              const char *name) {
+  GStatBuf st;
+  char *path;
+  GVariant *info;
+  GVariant *display;
+  GKeyFile *keyfile;
+  const char *language;
+  const char *app_name;
+  const char *comment;
+  const char *exec;
+  const char *icon;
+  gboolean hidden;
+  gboolean nodisplay;
+  gboolean shows_in;
+  int delay;
+
+  path = g_build_filename(dir, name, NULL);
+  if (g_stat(path, &st) != 0) {
+    g_free(path);
+    return NULL;
+  }
+  g_free(path);
+
+  info = gsm_autostart_cache_lookup(dir, name, &st);
+  if (info == NULL) {
+    return NULL;
+  }
+
+  keyfile = NULL;
+  display = NULL;
+  if (g_variant_is_container(info) && g_variant_n_children(info) > 0) {
+    display = g_variant_get_child_value(info, g_variant_n_children(info) - 1);
+  }
+
+  if (display != NULL &&
+      g_variant_is_of_type(display,
+                           G_VARIANT_TYPE(GSM_AUTOSTART_CACHE_DISPLAY_TYPE))) {
+    g_variant_get(display, "(&sm&sm&sm&sm&sbbbi)", &language, &app_name,
+                  &comment, &exec, &icon, &hidden, &nodisplay, &shows_in,
+                  &delay);
+
+    /* the strings are only of use if they are in our language */
+    if (strcmp(language, g_get_language_names()[0]) == 0) {
+      keyfile = g_key_file_new();
+      gsp_key_file_set_string(keyfile, G_KEY_FILE_DESKTOP_KEY_TYPE,
+                              "Application");
+      if (app_name != NULL)
+        gsp_key_file_set_string(keyfile, G_KEY_FILE_DESKTOP_KEY_NAME,
+                                app_name);
+      if (comment != NULL)
+        gsp_key_file_set_string(keyfile, G_KEY_FILE_DESKTOP_KEY_COMMENT,
+                                comment);
+      if (exec != NULL)
+        gsp_key_file_set_string(keyfile, G_KEY_FILE_DESKTOP_KEY_EXEC, exec);
+      if (icon != NULL)
+        gsp_key_file_set_string(keyfile, G_KEY_FILE_DESKTOP_KEY_ICON, icon);
+      gsp_key_file_set_boolean(keyfile, G_KEY_FILE_DESKTOP_KEY_HIDDEN, hidden);
+      gsp_key_file_set_boolean(keyfile, G_KEY_FILE_DESKTOP_KEY_NO_DISPLAY,
+                               nodisplay);
+      gsp_key_file_set_delay(keyfile, delay);
+      /* let gsp_app_can_launch() skip what mate-session skips */
+      if (!shows_in)
+        gsp_key_file_set_string(keyfile, G_KEY_FILE_DESKTOP_KEY_NOT_SHOW_IN,
+                                "MATE;");
+    }
+  }
+
+  if (display != NULL) g_variant_unref(display);
+  g_variant_unref(info);
+
+  return keyfile;
+}
+
+/* Reads @name from the autostart cache or, failing that, from disk */
+static GKeyFile *_gsp_app_manager_load_keyfile(const char *dir,
+                                               const char *name) {
+  GKeyFile *keyfile;
+  char *path;
+
+  keyfile = _gsp_app_manager_load_cached(dir, name);
+  if (keyfile != NULL) {
+    return keyfile;
+  }
+
+  path = g_build_filename(dir, name, NULL);
+  keyfile = g_key_file_new();
+  if (!g_key_file_load_from_file(keyfile, path, G_KEY_FILE_NONE, NULL)) {
+    g_key_file_free(keyfile);
+    keyfile = NULL;
+  }
+  g_free(path);
+
+  return keyfile;
+}
+
+static void _gsp_app_manager_watch_dir(GspAppManager *manager,
+                                       GspXdgDir *xdgdir);
+static void _gsp_app_manager_add_path(GspAppManager *manager, const char *path,
+                                      unsigned int index, GKeyFile *keyfile);
+
 static void _gsp_app_manager_fill_from_dir(GspAppManager *manager,
                                            GspXdgDir *xdgdir) {
-  GFile *file;
-  GDir *dir;
-  const char *name;
+  GStatBuf dir_st;
+  char **names;
+  guint i;
 
-  file = g_file_new_for_path(xdgdir->dir);
-  xdgdir->monitor =
-      g_file_monitor_directory(file, G_FILE_MONITOR_NONE, NULL, NULL);
-  g_object_unref(file);
+  _gsp_app_manager_watch_dir(manager, xdgdir);
 
-  if (xdgdir->monitor) {
-    g_signal_connect(xdgdir->monitor, "changed",
-                     G_CALLBACK(gsp_app_manager_xdg_dir_monitor), manager);
+  if (g_stat(xdgdir->dir, &dir_st) != 0) {
+    return;
   }
 
-  dir = g_dir_open(xdgdir->dir, 0, NULL);
-  if (!dir) {
-    return;
+  /* an unchanged directory does not need to be read again */
+  names = gsm_autostart_cache_list_dir(xdgdir->dir, &dir_st);
+  if (names == NULL) {
+    GDir *dir;
+    const char *name;
+    GPtrArray *array;
+
+    dir = g_dir_open(xdgdir->dir, 0, NULL);
+    if (!dir) {
+      return;
+    }
+
+    array = g_ptr_array_new();
+    while ((name = g_dir_read_name(dir))) {
+      if (g_str_has_suffix(name, ".desktop")) {
+        g_ptr_array_add(array, g_strdup(name));
+      }
+    }
+    g_ptr_array_add(array, NULL);
+
+    g_dir_close(dir);
+
+    names = (char **)g_ptr_array_free(array, FALSE);
   }
 
-  while ((name = g_dir_read_name(dir))) {
-    GspApp *app;
+  for (i = 0; names[i] != NULL; i++) {
+    GspApp *old_app;
+    GKeyFile *keyfile;
     char *desktop_file_path;
 
-    if (!g_str_has_suffix(name, ".desktop")) {
-      continue;
-    }
+    desktop_file_path = g_build_filename(xdgdir->dir, names[i], NULL);
 
-    desktop_file_path = g_build_filename(xdgdir->dir, name, NULL);
-    app = gsp_app_new(desktop_file_path, xdgdir->index);
+    /* a shadowed file does not need to be read, see on_next_files() */
+    keyfile = NULL;
+    old_app = gsp_app_manager_find_app_with_basename(manager, names[i]);
+    if (old_app == NULL ||
+        gsp_app_get_xdg_position(old_app) >= xdgdir->index) {
+      keyfile = _gsp_app_manager_load_keyfile(xdgdir->dir, names[i]);
+    }
 
-    if (app != NULL) {
-      gsp_app_manager_add(manager, app);
-      g_object_unref(app);
+    if (keyfile != NULL || old_app != NULL) {
+      _gsp_app_manager_add_path(manager, desktop_file_path, xdgdir->index,
+                                keyfile);
     }
 
+    if (keyfile != NULL) g_key_file_free(keyfile);
     g_free(desktop_file_path);
   }
 
-  g_dir_close(dir);
+  g_strfreev(names);
 }
 
-void gsp_app_manager_fill(GspAppManager *manager) {
+static void _gsp_app_manager_add_dirs(GspAppManager *manager,
+                                      GQueue *queue) {
   char **autostart_dirs;
   char **it;
   GspAppManagerPrivate *priv;
@@ -414,26 +738,315 @@ void gsp_app_manager_fill(GspAppManager *manager) {
 
   priv = gsp_app_manager_get_instance_private(manager);
 
-  if (priv->apps != NULL) return;
-
   autostart_dirs = gsm_util_get_autostart_dirs();
 
   /* we always assume that the first directory is the user one */
   g_assert(g_str_has_prefix(autostart_dirs[0], g_get_user_config_dir()));
 
   for (it = autostart_dirs, i = 0; *it; it++) {
+    GspXdgDir *xdgdir;
+
     /* check that the autostart dir doesn't exist in the dirs list */
     if (gsp_app_manager_get_dir_index(manager, *it) != -1)
       continue;
 
-    GspXdgDir *xdgdir = _gsp_xdg_dir_new(*it, i++);
+    xdgdir = _gsp_xdg_dir_new(*it, i++);
     priv->dirs = g_slist_prepend(priv->dirs, xdgdir);
-    _gsp_app_manager_fill_from_dir(manager, xdgdir);
+    g_queue_push_tail(queue, xdgdir);
   }
 
   g_strfreev(autostart_dirs);
 }
 
+static void _gsp_app_manager_watch_dir(GspAppManager *manager,
+                                       GspXdgDir *xdgdir) {
+  GFile *file;
+
+  file = g_file_new_for_path(xdgdir->dir);
+  xdgdir->monitor =
+      g_file_monitor_directory(file, G_FILE_MONITOR_NONE, NULL, NULL);
+  g_object_unref(file);
+
+  if (xdgdir->monitor) {
+    g_signal_connect(xdgdir->monitor, "changed",
+                     G_CALLBACK(gsp_app_manager_xdg_dir_monitor), manager);
+  }
+}
+
+static void fill_data_free(FillData *data) {
+  g_queue_free(data->dirs);
+  g_clear_object(&data->enumerator);
+  g_slice_free(FillData, data);
+}
+
+static void fill_batch_free(FillBatch *batch) {
+  g_ptr_array_unref(batch->paths);
+  g_ptr_array_unref(batch->keyfiles);
+  g_slice_free(FillBatch, batch);
+}
+
+static void fill_next_dir(GTask *task);
+static void fill_next_batch(GTask *task);
+
+/* Runs in a worker thread: only touches the batch and, since batches are
+ * parsed one at a time, the autostart cache */
+static void parse_batch_thread(GTask *task, gpointer source_object,
+                               FillBatch *batch, GCancellable *cancellable) {
+  guint i;
+
+  for (i = 0; i < batch->paths->len; i++) {
+    GKeyFile *keyfile;
+    char *name;
+
+    if (g_cancellable_is_cancelled(cancellable)) {
+      break;
+    }
+
+    name = g_path_get_basename(batch->paths->pdata[i]);
+    keyfile = _gsp_app_manager_load_keyfile(batch->dir, name);
+    g_free(name);
+
+    g_ptr_array_add(batch->keyfiles, keyfile);
+  }
+
+  g_task_return_boolean(task, TRUE);
+}
+
+static void _gsp_app_manager_add_path(GspAppManager *manager, const char *path,
+                                      unsigned int index, GKeyFile *keyfile) {
+  GspApp *old_app;
+  GspApp *app;
+  char *basename;
+
+  basename = g_path_get_basename(path);
+  old_app = gsp_app_manager_find_app_with_basename(manager, basename);
+  g_free(basename);
+
+  app = gsp_app_new_from_keyfile(path, index, keyfile);
+
+  /* like for monitor events, GspApp took care of an app we already know */
+  if (old_app == NULL && app != NULL) {
+    gsp_app_manager_add(manager, app);
+    g_object_unref(app);
+  }
+}
+
+static void on_batch_parsed(GspAppManager *manager, GAsyncResult *result,
+                            GTask *task) {
+  FillBatch *batch;
+  guint i;
+
+  batch = g_task_get_task_data(G_TASK(result));
+
+  if (g_task_return_error_if_cancelled(task)) {
+    g_object_unref(task);
+    return;
+  }
+
+  for (i = 0; i < batch->keyfiles->len; i++) {
+    GKeyFile *keyfile = batch->keyfiles->pdata[i];
+
+    if (keyfile != NULL) {
+      _gsp_app_manager_add_path(manager, batch->paths->pdata[i], batch->index,
+                                keyfile);
+    }
+  }
+
+  fill_next_batch(task);
+}
+
+static void on_next_files(GFileEnumerator *enumerator, GAsyncResult *result,
+                          GTask *task) {
+  GspAppManager *manager;
+  FillData *data;
+  FillBatch *batch;
+  GTask *parse_task;
+  GList *infos;
+  GList *l;
+  GError *error;
+
+  manager = g_task_get_source_object(task);
+  data = g_task_get_task_data(task);
+
+  error = NULL;
+  infos = g_file_enumerator_next_files_finish(enumerator, result, &error);
+  if (error != NULL) {
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+      g_task_return_error(task, error);
+      g_object_unref(task);
+      return;
+    }
+    g_debug("GspAppManager: Unable to read %s: %s", data->xdgdir->dir,
+            error->message);
+    g_error_free(error);
+  }
+
+  if (infos == NULL) {
+    g_clear_object(&data->enumerator);
+    fill_next_dir(task);
+    return;
+  }
+
+  batch = g_slice_new(FillBatch);
+  batch->dir = data->xdgdir->dir;
+  batch->index = data->xdgdir->index;
+  batch->paths = g_ptr_array_new_with_free_func(g_free);
+  batch->keyfiles =
+      g_ptr_array_new_with_free_func((GDestroyNotify)g_key_file_free);
+
+  for (l = infos; l != NULL; l = l->next) {
+    const char *name;
+    char *path;
+    GspApp *old_app;
+
+    name = g_file_info_get_name(l->data);
+    if (!g_str_has_suffix(name, ".desktop")) {
+      continue;
+    }
+
+    path = g_build_filename(data->xdgdir->dir, name, NULL);
+
+    /* a file shadowed by one from an earlier directory does not need
+     * to be parsed: GspApp only records the system position */
+    old_app = gsp_app_manager_find_app_with_basename(manager, name);
+    if (old_app != NULL &&
+        gsp_app_get_xdg_position(old_app) < batch->index) {
+      _gsp_app_manager_add_path(manager, path, batch->index, NULL);
+      g_free(path);
+    } else {
+      g_ptr_array_add(batch->paths, path);
+    }
+  }
+  g_list_free_full(infos, g_object_unref);
+
+  if (batch->paths->len == 0) {
+    fill_batch_free(batch);
+    fill_next_batch(task);
+    return;
+  }
+
+  parse_task =
+      g_task_new(manager, g_task_get_cancellable(task),
+                 (GAsyncReadyCallback)on_batch_parsed, task);
+  g_task_set_task_data(parse_task, batch, (GDestroyNotify)fill_batch_free);
+  g_task_run_in_thread(parse_task, (GTaskThreadFunc)parse_batch_thread);
+  g_object_unref(parse_task);
+}
+
+static void fill_next_batch(GTask *task) {
+  FillData *data;
+
+  data = g_task_get_task_data(task);
+
+  g_file_enumerator_next_files_async(
+      data->enumerator, FILL_BATCH_SIZE, G_PRIORITY_DEFAULT,
+      g_task_get_cancellable(task), (GAsyncReadyCallback)on_next_files, task);
+}
+
+static void on_enumerate_children(GFile *file, GAsyncResult *result,
+                                  GTask *task) {
+  FillData *data;
+  GError *error;
+
+  data = g_task_get_task_data(task);
+
+  error = NULL;
+  data->enumerator = g_file_enumerate_children_finish(file, result, &error);
+  if (data->enumerator == NULL) {
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+      g_task_return_error(task, error);
+      g_object_unref(task);
+      return;
+    }
+    /* most autostart dirs simply do not exist */
+    g_error_free(error);
+    fill_next_dir(task);
+    return;
+  }
+
+  fill_next_batch(task);
+}
+
+/* Directories are read one after the other, in XDG order, so that the
+ * position bookkeeping in GspApp sees files in the same order as with
+ * gsp_app_manager_fill() */
+static void fill_next_dir(GTask *task) {
+  FillData *data;
+  GFile *file;
+
+  data = g_task_get_task_data(task);
+
+  data->xdgdir = g_queue_pop_head(data->dirs);
+  if (data->xdgdir == NULL) {
+    g_task_return_boolean(task, TRUE);
+    g_object_unref(task);
+    return;
+  }
+
+  _gsp_app_manager_watch_dir(g_task_get_source_object(task), data->xdgdir);
+
+  file = g_file_new_for_path(data->xdgdir->dir);
+  g_file_enumerate_children_async(
+      file, G_FILE_ATTRIBUTE_STANDARD_NAME, G_FILE_QUERY_INFO_NONE,
+      G_PRIORITY_DEFAULT, g_task_get_cancellable(task),
+      (GAsyncReadyCallback)on_enumerate_children, task);
+  g_object_unref(file);
+}
+
+/* Like gsp_app_manager_fill(), but without blocking: apps are announced
+ * with the "added" signal as their directory batches are parsed. */
+void gsp_app_manager_fill_async(GspAppManager *manager,
+                                GCancellable *cancellable,
+                                GAsyncReadyCallback callback,
+                                gpointer user_data) {
+  GspAppManagerPrivate *priv;
+  GTask *task;
+  FillData *data;
+
+  g_return_if_fail(GSP_IS_APP_MANAGER(manager));
+
+  priv = gsp_app_manager_get_instance_private(manager);
+
+  task = g_task_new(manager, cancellable, callback, user_data);
+  g_task_set_source_tag(task, gsp_app_manager_fill_async);
+
+  if (priv->dirs != NULL) {
+    g_task_return_boolean(task, TRUE);
+    g_object_unref(task);
+    return;
+  }
+
+  data = g_slice_new0(FillData);
+  data->dirs = g_queue_new();
+  g_task_set_task_data(task, data, (GDestroyNotify)fill_data_free);
+
+  _gsp_app_manager_add_dirs(manager, data->dirs);
+  fill_next_dir(task);
+}
+
+gboolean gsp_app_manager_fill_finish(GspAppManager *manager,
+                                     GAsyncResult *result, GError **error) {
+  g_return_val_if_fail(g_task_is_valid(result, manager), FALSE);
+
+  return g_task_propagate_boolean(G_TASK(result), error);
+}
+
+void gsp_app_manager_fill(GspAppManager *manager) {
+  GspAppManagerPrivate *priv;
+  GQueue queue = G_QUEUE_INIT;
+  GspXdgDir *xdgdir;
+
+  priv = gsp_app_manager_get_instance_private(manager);
+
+  if (priv->apps != NULL) return;
+
+  _gsp_app_manager_add_dirs(manager, &queue);
+
+  while ((xdgdir = g_queue_pop_head(&queue)) != NULL) {
+    _gsp_app_manager_fill_from_dir(manager, xdgdir);
+  }
+}
+
 /*
  * App handling
  */
@@ -25,6 +25,7 @@
 #ifndef __GSP_APP_MANAGER_H
 #define __GSP_APP_MANAGER_H
 
+#include <gio/gio.h>
 #include <glib-object.h>
 #include <glib.h>
 #include <gsp-app.h>
@@ -46,6 +47,13 @@ GspAppManager *gsp_app_manager_get(void);
 
 void gsp_app_manager_fill(GspAppManager *manager);
 
+void gsp_app_manager_fill_async(GspAppManager *manager,
+                                GCancellable *cancellable,
+                                GAsyncReadyCallback callback,
+                                gpointer user_data);
+gboolean gsp_app_manager_fill_finish(GspAppManager *manager,
+                                     GAsyncResult *result, GError **error);
+
 GSList *gsp_app_manager_get_apps(GspAppManager *manager);
 
 GspApp *gsp_app_manager_find_app_with_basename(GspAppManager *manager,
@@ -55,6 +63,11 @@ const char *gsp_app_manager_get_dir(GspAppManager *manager, unsigned int index);
 
 void gsp_app_manager_add(GspAppManager *manager, GspApp *app);
 
+void gsp_app_manager_queue_save(GspAppManager *manager, GspApp *app);
+void gsp_app_manager_cancel_save(GspAppManager *manager, GspApp *app);
+void gsp_app_manager_flush_saves(GspAppManager *manager);
+void gsp_app_manager_note_write(GspAppManager *manager, const char *path);
+
 G_END_DECLS
 
 #endif /* __GSP_APP_MANAGER_H */
@@ -38,8 +38,6 @@
 #include "gsp-app.h"
 #include "gsp-keyfile.h"
 
-#define GSP_APP_SAVE_DELAY 2
-
 #define GSP_ASP_SAVE_MASK_HIDDEN 0x0001
 #define GSP_ASP_SAVE_MASK_NAME 0x0002
 #define GSP_ASP_SAVE_MASK_EXEC 0x0004
@@ -69,14 +67,12 @@ typedef struct {
    * this autostart app too (G_MAXUINT means none) */
   unsigned int xdg_system_position;
 
-  unsigned int save_timeout;
+  /* queued in the GspAppManager save queue */
+  gboolean save_pending;
   /* mask of what has changed */
   unsigned int save_mask;
   /* path that contains the original file that needs to be saved */
   char *old_system_path;
-  /* after writing to file, we skip the next file monitor event of type
-   * CHANGED */
-  gboolean skip_next_monitor_event;
 } GspAppPrivate;
 
 enum { CHANGED, REMOVED, LAST_SIGNAL };
@@ -87,7 +83,7 @@ G_DEFINE_TYPE_WITH_PRIVATE(GspApp, gsp_app, G_TYPE_OBJECT)
 
 static void gsp_app_dispose(GObject *object);
 static void gsp_app_finalize(GObject *object);
-static gboolean _gsp_app_save(gpointer data);
+static void _gsp_app_save(GspApp *app);
 
 static gboolean _gsp_str_equal(const char *a, const char *b) {
   if (g_strcmp0(a, b) == 0) {
@@ -143,10 +139,7 @@ static void gsp_app_dispose(GObject *object) {
   priv = gsp_app_get_instance_private(app);
 
   /* we save in dispose since we might need to reference GspAppManager */
-  if (priv->save_timeout) {
-    g_source_remove(priv->save_timeout);
-    priv->save_timeout = 0;
-
+  if (priv->save_pending) {
     /* save now */
     _gsp_app_save(app);
   }
@@ -318,15 +311,17 @@ static inline void _gsp_app_save_done_success(GspApp *app) {
   }
 }
 
-static gboolean _gsp_app_save(gpointer data) {
-  GspApp *app;
+static void _gsp_app_save(GspApp *app) {
+  GspAppManager *manager;
   char *use_path;
   GKeyFile *keyfile;
   GError *error;
   GspAppPrivate *priv;
 
-  app = GSP_APP(data);
   priv = gsp_app_get_instance_private(app);
+  priv->save_pending = FALSE;
+
+  manager = gsp_app_manager_get();
 
   /* first check if removing the data from the user dir and using the
    * data from the system dir is enough -- this helps us keep clean the
@@ -334,6 +329,7 @@ static gboolean _gsp_app_save(gpointer data) {
   if (_gsp_app_user_equal_system(app, &use_path)) {
     if (g_file_test(priv->path, G_FILE_TEST_EXISTS)) {
       g_remove(priv->path);
+      gsp_app_manager_note_write(manager, priv->path);
     }
 
     g_free(priv->path);
@@ -342,7 +338,8 @@ static gboolean _gsp_app_save(gpointer data) {
     priv->xdg_position = priv->xdg_system_position;
 
     _gsp_app_save_done_success(app);
-    return FALSE;
+    g_object_unref(manager);
+    return;
   }
 
   if (priv->old_system_path)
@@ -389,26 +386,33 @@ static gboolean _gsp_app_save(gpointer data) {
 
   _gsp_ensure_user_autostart_dir();
   if (g_key_file_save_to_file(keyfile, priv->path, NULL)) {
-    priv->skip_next_monitor_event = TRUE;
+    gsp_app_manager_note_write(manager, priv->path);
     _gsp_app_save_done_success(app);
   } else {
     g_warning("Could not save %s file", priv->path);
   }
 
   g_key_file_free(keyfile);
+  g_object_unref(manager);
+}
 
-  priv->save_timeout = 0;
-  return FALSE;
+/* Called by GspAppManager when it flushes its save queue */
+void gsp_app_save(GspApp *app) {
+  GspAppPrivate *priv;
+
+  g_return_if_fail(GSP_IS_APP(app));
+
+  priv = gsp_app_get_instance_private(app);
+  if (priv->save_pending) {
+    _gsp_app_save(app);
+  }
 }
 
 static void _gsp_app_queue_save(GspApp *app) {
+  GspAppManager *manager;
   GspAppPrivate *priv;
 
   priv = gsp_app_get_instance_private(app);
-  if (priv->save_timeout) {
-    g_source_remove(priv->save_timeout);
-    priv->save_timeout = 0;
-  }
 
   /* if the file was not in the user directory, then we'll create a copy
    * there */
@@ -426,8 +430,11 @@ static void _gsp_app_queue_save(GspApp *app) {
                                   priv->basename, NULL);
   }
 
-  priv->save_timeout =
-      g_timeout_add_seconds(GSP_APP_SAVE_DELAY, _gsp_app_save, app);
+  priv->save_pending = TRUE;
+
+  manager = gsp_app_manager_get();
+  gsp_app_manager_queue_save(manager, app);
+  g_object_unref(manager);
 }
 
 /*
@@ -644,9 +651,13 @@ void gsp_app_delete(GspApp *app) {
   priv = gsp_app_get_instance_private(app);
   if (priv->xdg_position == 0 && priv->xdg_system_position == G_MAXUINT) {
     /* exists in user directory only */
-    if (priv->save_timeout) {
-      g_source_remove(priv->save_timeout);
-      priv->save_timeout = 0;
+    if (priv->save_pending) {
+      GspAppManager *manager;
+
+      priv->save_pending = FALSE;
+      manager = gsp_app_manager_get();
+      gsp_app_manager_cancel_save(manager, app);
+      g_object_unref(manager);
     }
 
     if (g_file_test(priv->path, G_FILE_TEST_EXISTS)) {
@@ -713,10 +724,13 @@ static gboolean gsp_app_can_launch(GKeyFile *keyfile) {
   return TRUE;
 }
 
-GspApp *gsp_app_new(const char *path, unsigned int xdg_position) {
+/* @keyfile is the already parsed content of @path, or NULL to read it here;
+ * it is not freed. */
+GspApp *gsp_app_new_from_keyfile(const char *path, unsigned int xdg_position,
+                                 GKeyFile *keyfile) {
   GspAppManager *manager;
   GspApp *app;
-  GKeyFile *keyfile;
+  GKeyFile *owned_keyfile;
   char *basename;
   gboolean new;
   GspAppPrivate *priv;
@@ -731,16 +745,11 @@ GspApp *gsp_app_new(const char *path, unsigned int xdg_position) {
   new = (app == NULL);
 
   if (!new) {
-    if (priv->xdg_position == xdg_position) {
-      if (priv->skip_next_monitor_event) {
-        priv->skip_next_monitor_event = FALSE;
-        return NULL;
-      }
-      /* else: the file got changed but not by us, we'll
-       * update our data from disk */
-    }
+    /* if the file is at our position, it got changed but not by us
+     * (GspAppManager drops the monitor events of our own writes); we'll
+     * update our data from disk */
 
-    if (priv->xdg_position < xdg_position || priv->save_timeout != 0) {
+    if (priv->xdg_position < xdg_position || priv->save_pending) {
       /* we don't really care about this file, since we
        * already have something with a higher priority, or
        * we're going to write something in the user config
@@ -751,10 +760,21 @@ GspApp *gsp_app_new(const char *path, unsigned int xdg_position) {
     }
   }
 
-  keyfile = g_key_file_new();
-  if (!g_key_file_load_from_file(keyfile, path, G_KEY_FILE_NONE, NULL) ||
-      !gsp_app_can_launch(keyfile)) {
-    g_key_file_free(keyfile);
+  owned_keyfile = NULL;
+  if (keyfile == NULL) {
+    owned_keyfile = g_key_file_new();
+    keyfile = owned_keyfile;
+    if (!g_key_file_load_from_file(keyfile, path, G_KEY_FILE_NONE, NULL)) {
+      g_key_file_free(owned_keyfile);
+      g_free(basename);
+      return NULL;
+    }
+  }
+
+  if (!gsp_app_can_launch(keyfile)) {
+    if (owned_keyfile != NULL) {
+      g_key_file_free(owned_keyfile);
+    }
     g_free(basename);
     return NULL;
   }
@@ -810,7 +830,9 @@ GspApp *gsp_app_new(const char *path, unsigned int xdg_position) {
     priv->gicon = NULL;
   }
 
-  g_key_file_free(keyfile);
+  if (owned_keyfile != NULL) {
+    g_key_file_free(owned_keyfile);
+  }
 
   _gsp_app_update_description(app);
 
@@ -821,10 +843,9 @@ GspApp *gsp_app_new(const char *path, unsigned int xdg_position) {
   /* else we keep the old value (which is G_MAXUINT if it wasn't set) */
   priv->xdg_position = xdg_position;
 
-  g_assert(!new || priv->save_timeout == 0);
-  priv->save_timeout = 0;
+  g_assert(!new || !priv->save_pending);
+  priv->save_pending = FALSE;
   priv->old_system_path = NULL;
-  priv->skip_next_monitor_event = FALSE;
 
   if (!new) {
     _gsp_app_emit_changed(app);
@@ -833,6 +854,10 @@ GspApp *gsp_app_new(const char *path, unsigned int xdg_position) {
   return app;
 }
 
+GspApp *gsp_app_new(const char *path, unsigned int xdg_position) {
+  return gsp_app_new_from_keyfile(path, xdg_position, NULL);
+}
+
 static char *_gsp_find_free_basename(const char *suggested_basename) {
   GspAppManager *manager;
   char *base_path;
@@ -932,10 +957,9 @@ void gsp_app_create(const char *name, const char *comment, const char *exec,
   priv->xdg_position = 0;
   priv->xdg_system_position = G_MAXUINT;
 
-  priv->save_timeout = 0;
+  priv->save_pending = FALSE;
   priv->save_mask |= GSP_ASP_SAVE_MASK_ALL;
   priv->old_system_path = NULL;
-  priv->skip_next_monitor_event = FALSE;
 
   _gsp_app_queue_save(app);
 
@@ -69,10 +69,14 @@ GIcon *gsp_app_get_icon(GspApp *app);
 /* private interface for GspAppManager only */
 
 GspApp *gsp_app_new(const char *path, unsigned int xdg_position);
+GspApp *gsp_app_new_from_keyfile(const char *path, unsigned int xdg_position,
+                                 GKeyFile *keyfile);
 
 void gsp_app_reload_at(GspApp *app, const char *path,
                        unsigned int xdg_position);
 
+void gsp_app_save(GspApp *app);
+
 unsigned int gsp_app_get_xdg_position(GspApp *app);
 unsigned int gsp_app_get_xdg_system_position(GspApp *app);
 void gsp_app_set_xdg_system_position(GspApp *app, unsigned int position);
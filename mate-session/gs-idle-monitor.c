@@ -37,15 +37,40 @@
 
 #include <gdk/gdk.h>
 #include <gdk/gdkx.h>
+#include <gio/gio.h>
 #include <glib.h>
 
+#ifdef HAVE_WAYLAND
+#include <gdk/gdkwayland.h>
+#include <wayland-client.h>
+
+#include "ext-idle-notify-v1-client-protocol.h"
+#endif /* HAVE_WAYLAND */
+
 #include "gs-idle-monitor.h"
 
+#define LOGIND_NAME "org.freedesktop.login1"
+#define LOGIND_SESSION_PATH "/org/freedesktop/login1/session/self"
+#define LOGIND_SESSION_INTERFACE "org.freedesktop.login1.Session"
+
+/* Where idle transitions come from, in order of preference: the compositor
+ * on Wayland, the IDLETIME counter of the X server, and the idle hint
+ * logind keeps for the session when neither is available */
+typedef enum {
+  GS_IDLE_MONITOR_BACKEND_NONE,
+  GS_IDLE_MONITOR_BACKEND_WAYLAND,
+  GS_IDLE_MONITOR_BACKEND_XSYNC,
+  GS_IDLE_MONITOR_BACKEND_LOGIND
+} GSIdleMonitorBackend;
+
 static void gs_idle_monitor_finalize(GObject *object);
 
 struct _GSIdleMonitor {
   GObject parent;
-  GHashTable *watches;
+  GSIdleMonitorBackend backend;
+  GHashTable *watches;   /* id -> GSIdleMonitorWatch */
+  GHashTable *alarms;    /* interval -> GSIdleMonitorAlarm */
+  GHashTable *alarm_ids; /* XSyncAlarm -> GSIdleMonitorAlarm */
   int sync_event_base;
   XSyncCounter counter;
 
@@ -54,15 +79,40 @@ struct _GSIdleMonitor {
   int keycode1;
   int keycode2;
   gboolean have_xtest;
+
+  /* logind backend */
+  GDBusProxy *session_proxy;
+  gboolean idle_hint;
+  gint64 idle_since; /* monotonic, in microseconds */
+
+#ifdef HAVE_WAYLAND
+  struct wl_registry *registry;
+  struct ext_idle_notifier_v1 *idle_notifier;
+  struct wl_seat *seat;
+#endif /* HAVE_WAYLAND */
 };
 
+/* One idle threshold, shared by all the watches that use the same
+ * interval: a pair of X alarms, a Wayland idle notification or a timer
+ * armed from the logind idle hint, depending on the backend */
+typedef struct {
+  GSIdleMonitor *monitor;
+  gint64 interval;
+  XSyncAlarm xalarm_positive;
+  XSyncAlarm xalarm_negative;
+#ifdef HAVE_WAYLAND
+  struct ext_idle_notification_v1 *notification;
+#endif /* HAVE_WAYLAND */
+  guint timeout_id;
+  gboolean fired;
+  GSList *watches;
+} GSIdleMonitorAlarm;
+
 typedef struct {
   guint id;
-  XSyncValue interval;
   GSIdleMonitorWatchFunc callback;
   gpointer user_data;
-  XSyncAlarm xalarm_positive;
-  XSyncAlarm xalarm_negative;
+  GSIdleMonitorAlarm *alarm;
 } GSIdleMonitorWatch;
 
 static guint32 watch_serial = 1;
@@ -82,6 +132,9 @@ static XSyncValue _int64_to_xsyncvalue(gint64 value) {
   return ret;
 }
 
+static GdkFilterReturn xevent_filter(GdkXEvent *xevent, GdkEvent *event,
+                                     GSIdleMonitor *monitor);
+
 static void gs_idle_monitor_dispose(GObject *object) {
   GSIdleMonitor *monitor;
 
@@ -89,30 +142,35 @@ static void gs_idle_monitor_dispose(GObject *object) {
 
   monitor = GS_IDLE_MONITOR(object);
 
+  if (monitor->alarm_ids != NULL) {
+    g_hash_table_destroy(monitor->alarm_ids);
+    monitor->alarm_ids = NULL;
+  }
+
+  if (monitor->alarms != NULL) {
+    g_hash_table_destroy(monitor->alarms);
+    monitor->alarms = NULL;
+  }
+
   if (monitor->watches != NULL) {
     g_hash_table_destroy(monitor->watches);
     monitor->watches = NULL;
   }
 
-  G_OBJECT_CLASS(gs_idle_monitor_parent_class)->dispose(object);
-}
-
-static gboolean _find_alarm(gpointer key, GSIdleMonitorWatch *watch,
-                            XSyncAlarm *alarm) {
-  g_debug("Searching for %d in %d,%d", (int)*alarm, (int)watch->xalarm_positive,
-          (int)watch->xalarm_negative);
-  if (watch->xalarm_positive == *alarm || watch->xalarm_negative == *alarm) {
-    return TRUE;
+  if (monitor->backend == GS_IDLE_MONITOR_BACKEND_XSYNC) {
+    gdk_window_remove_filter(NULL, (GdkFilterFunc)xevent_filter, monitor);
   }
-  return FALSE;
-}
 
-static GSIdleMonitorWatch *find_watch_for_alarm(GSIdleMonitor *monitor,
-                                                XSyncAlarm alarm) {
-  GSIdleMonitorWatch *watch;
+  g_clear_object(&monitor->session_proxy);
 
-  watch = g_hash_table_find(monitor->watches, (GHRFunc)_find_alarm, &alarm);
-  return watch;
+#ifdef HAVE_WAYLAND
+  g_clear_pointer(&monitor->idle_notifier, ext_idle_notifier_v1_destroy);
+  g_clear_pointer(&monitor->registry, wl_registry_destroy);
+#endif /* HAVE_WAYLAND */
+
+  monitor->backend = GS_IDLE_MONITOR_BACKEND_NONE;
+
+  G_OBJECT_CLASS(gs_idle_monitor_parent_class)->dispose(object);
 }
 
 #ifdef HAVE_XTEST
@@ -150,37 +208,39 @@ void gs_idle_monitor_reset(GSIdleMonitor *monitor) {
 #endif
 }
 
-static void handle_alarm_notify_event(GSIdleMonitor *monitor,
-                                      XSyncAlarmNotifyEvent *alarm_event) {
-  GSIdleMonitorWatch *watch;
+/* Runs the callbacks of the watches on @alarm. The callbacks may add or
+ * remove watches, which can free @alarm, so it is not used afterwards. */
+static void fire_alarm(GSIdleMonitor *monitor, GSIdleMonitorAlarm *alarm,
+                       gboolean condition) {
+  GArray *ids;
+  GSList *l;
   gboolean res;
-  gboolean condition;
+  guint i;
 
-  if (alarm_event->state == XSyncAlarmDestroyed) {
-    return;
-  }
-
-  watch = find_watch_for_alarm(monitor, alarm_event->alarm);
-
-  if (watch == NULL) {
-    g_debug("Unable to find watch for alarm %d", (int)alarm_event->alarm);
-    return;
-  }
+  g_debug("GSIdleMonitor: alarm for %" G_GINT64_FORMAT " ms %s",
+          alarm->interval, condition ? "fired" : "reset");
 
-  g_debug("Watch %d fired, idle time = %" G_GINT64_FORMAT, watch->id,
-          _xsyncvalue_to_int64(alarm_event->counter_value));
+  ids = g_array_new(FALSE, FALSE, sizeof(guint));
+  for (l = alarm->watches; l != NULL; l = l->next) {
+    GSIdleMonitorWatch *watch = l->data;
 
-  if (alarm_event->alarm == watch->xalarm_positive) {
-    condition = TRUE;
-  } else {
-    condition = FALSE;
+    g_array_append_val(ids, watch->id);
   }
 
   res = TRUE;
-  if (watch->callback != NULL) {
-    res = watch->callback(monitor, watch->id, condition, watch->user_data);
+  for (i = 0; i < ids->len; i++) {
+    GSIdleMonitorWatch *watch;
+
+    watch = g_hash_table_lookup(monitor->watches,
+                                GUINT_TO_POINTER(g_array_index(ids, guint, i)));
+    if (watch != NULL && watch->callback != NULL &&
+        !watch->callback(monitor, watch->id, condition, watch->user_data)) {
+      res = FALSE;
+    }
   }
 
+  g_array_free(ids, TRUE);
+
   if (!res) {
     /* reset all timers */
     g_debug("GSIdleMonitor: callback returned FALSE; resetting idle time");
@@ -188,6 +248,23 @@ static void handle_alarm_notify_event(GSIdleMonitor *monitor,
   }
 }
 
+static void handle_alarm_notify_event(GSIdleMonitor *monitor,
+                                      XSyncAlarmNotifyEvent *alarm_event) {
+  GSIdleMonitorAlarm *alarm;
+
+  if (alarm_event->state == XSyncAlarmDestroyed) {
+    return;
+  }
+
+  alarm = g_hash_table_lookup(monitor->alarm_ids,
+                              GSIZE_TO_POINTER(alarm_event->alarm));
+  if (alarm == NULL) {
+    return;
+  }
+
+  fire_alarm(monitor, alarm, alarm_event->alarm == alarm->xalarm_positive);
+}
+
 static GdkFilterReturn xevent_filter(GdkXEvent *xevent, GdkEvent *event,
                                      GSIdleMonitor *monitor) {
   XEvent *ev;
@@ -277,6 +354,229 @@ static void _init_xtest(GSIdleMonitor *monitor) {
 #endif /* HAVE_XTEST */
 }
 
+#ifdef HAVE_WAYLAND
+static void notification_idled(void *data,
+                               struct ext_idle_notification_v1 *notification) {
+  GSIdleMonitorAlarm *alarm = data;
+
+  fire_alarm(alarm->monitor, alarm, TRUE);
+}
+
+static void notification_resumed(
+    void *data, struct ext_idle_notification_v1 *notification) {
+  GSIdleMonitorAlarm *alarm = data;
+
+  fire_alarm(alarm->monitor, alarm, FALSE);
+}
+
+static const struct ext_idle_notification_v1_listener notification_listener =
+    {notification_idled, notification_resumed};
+
+static void registry_handle_global(void *data, struct wl_registry *registry,
+                                   uint32_t name, const char *interface,
+                                   uint32_t version) {
+  GSIdleMonitor *monitor = data;
+
+  if (monitor->idle_notifier == NULL &&
+      strcmp(interface, ext_idle_notifier_v1_interface.name) == 0) {
+    monitor->idle_notifier =
+        wl_registry_bind(registry, name, &ext_idle_notifier_v1_interface, 1);
+  }
+}
+
+static void registry_handle_global_remove(void *data,
+                                          struct wl_registry *registry,
+                                          uint32_t name) {}
+
+static const struct wl_registry_listener registry_listener = {
+    registry_handle_global, registry_handle_global_remove};
+
+static gboolean init_wayland(GSIdleMonitor *monitor) {
+  GdkDisplay *display;
+  struct wl_display *wl_display;
+
+  display = gdk_display_get_default();
+  wl_display = gdk_wayland_display_get_wl_display(display);
+
+  monitor->registry = wl_display_get_registry(wl_display);
+  wl_registry_add_listener(monitor->registry, &registry_listener, monitor);
+  wl_display_roundtrip(wl_display);
+
+  if (monitor->idle_notifier == NULL) {
+    g_debug("GSIdleMonitor: compositor does not support ext-idle-notify-v1");
+    g_clear_pointer(&monitor->registry, wl_registry_destroy);
+    return FALSE;
+  }
+
+  monitor->seat =
+      gdk_wayland_seat_get_wl_seat(gdk_display_get_default_seat(display));
+
+  return TRUE;
+}
+#endif /* HAVE_WAYLAND */
+
+static gboolean on_logind_alarm_timeout(GSIdleMonitorAlarm *alarm) {
+  alarm->timeout_id = 0;
+  alarm->fired = TRUE;
+
+  fire_alarm(alarm->monitor, alarm, TRUE);
+
+  return FALSE;
+}
+
+/* Arms the timer of @alarm for the moment the session will have been idle
+ * for its interval, according to the idle hint */
+static void logind_arm_alarm(GSIdleMonitor *monitor,
+                             GSIdleMonitorAlarm *alarm) {
+  gint64 remaining;
+
+  if (!monitor->idle_hint || alarm->fired || alarm->timeout_id > 0) {
+    return;
+  }
+
+  remaining = monitor->idle_since / 1000 + alarm->interval -
+              g_get_monotonic_time() / 1000;
+
+  alarm->timeout_id =
+      g_timeout_add(CLAMP(remaining, 0, G_MAXUINT),
+                    (GSourceFunc)on_logind_alarm_timeout, alarm);
+}
+
+static void logind_update(GSIdleMonitor *monitor) {
+  GVariant *value;
+  gboolean idle_hint;
+  GArray *intervals;
+  GHashTableIter iter;
+  gpointer data;
+  guint i;
+
+  idle_hint = FALSE;
+  value = g_dbus_proxy_get_cached_property(monitor->session_proxy, "IdleHint");
+  if (value != NULL) {
+    idle_hint = g_variant_get_boolean(value);
+    g_variant_unref(value);
+  }
+
+  monitor->idle_since = g_get_monotonic_time();
+  value = g_dbus_proxy_get_cached_property(monitor->session_proxy,
+                                           "IdleSinceHintMonotonic");
+  if (value != NULL) {
+    if (g_variant_get_uint64(value) > 0) {
+      monitor->idle_since = (gint64)g_variant_get_uint64(value);
+    }
+    g_variant_unref(value);
+  }
+
+  if (idle_hint == monitor->idle_hint) {
+    return;
+  }
+
+  g_debug("GSIdleMonitor: logind idle hint changed to %d", idle_hint);
+
+  monitor->idle_hint = idle_hint;
+
+  /* Alarms are looked up again after each callback since they can go
+   * away with their last watch */
+  intervals = g_array_new(FALSE, FALSE, sizeof(gint64));
+  g_hash_table_iter_init(&iter, monitor->alarms);
+  while (g_hash_table_iter_next(&iter, NULL, &data)) {
+    GSIdleMonitorAlarm *alarm = data;
+
+    g_array_append_val(intervals, alarm->interval);
+  }
+
+  for (i = 0; i < intervals->len; i++) {
+    GSIdleMonitorAlarm *alarm;
+
+    alarm = g_hash_table_lookup(monitor->alarms,
+                                &g_array_index(intervals, gint64, i));
+    if (alarm == NULL) {
+      continue;
+    }
+
+    if (idle_hint) {
+      logind_arm_alarm(monitor, alarm);
+    } else {
+      if (alarm->timeout_id > 0) {
+        g_source_remove(alarm->timeout_id);
+        alarm->timeout_id = 0;
+      }
+
+      if (alarm->fired) {
+        alarm->fired = FALSE;
+        fire_alarm(monitor, alarm, FALSE);
+      }
+    }
+  }
+
+  g_array_free(intervals, TRUE);
+}
+
+static void on_session_properties_changed(GDBusProxy *proxy,
+                                          GVariant *changed,
+                                          GStrv invalidated,
+                                          GSIdleMonitor *monitor) {
+  logind_update(monitor);
+}
+
+static gboolean init_logind(GSIdleMonitor *monitor) {
+  GError *error = NULL;
+  GVariant *value;
+
+  monitor->session_proxy = g_dbus_proxy_new_for_bus_sync(
+      G_BUS_TYPE_SYSTEM, G_DBUS_PROXY_FLAGS_DO_NOT_AUTO_START, NULL,
+      LOGIND_NAME, LOGIND_SESSION_PATH, LOGIND_SESSION_INTERFACE, NULL,
+      &error);
+  if (monitor->session_proxy == NULL) {
+    g_debug("GSIdleMonitor: Unable to reach logind: %s", error->message);
+    g_error_free(error);
+    return FALSE;
+  }
+
+  value = g_dbus_proxy_get_cached_property(monitor->session_proxy, "IdleHint");
+  if (value == NULL) {
+    g_debug("GSIdleMonitor: logind does not know about this session");
+    g_clear_object(&monitor->session_proxy);
+    return FALSE;
+  }
+  g_variant_unref(value);
+
+  g_signal_connect(monitor->session_proxy, "g-properties-changed",
+                   G_CALLBACK(on_session_properties_changed), monitor);
+  logind_update(monitor);
+
+  return TRUE;
+}
+
+static GSIdleMonitorBackend select_backend(GSIdleMonitor *monitor) {
+  GdkDisplay *display;
+
+  display = gdk_display_get_default();
+
+#ifdef HAVE_WAYLAND
+  if (display != NULL && GDK_IS_WAYLAND_DISPLAY(display) &&
+      init_wayland(monitor)) {
+    return GS_IDLE_MONITOR_BACKEND_WAYLAND;
+  }
+#endif /* HAVE_WAYLAND */
+
+  if (display != NULL && GDK_IS_X11_DISPLAY(display)) {
+    _init_xtest(monitor);
+
+    if (init_xsync(monitor)) {
+      return GS_IDLE_MONITOR_BACKEND_XSYNC;
+    }
+
+    monitor->have_xtest = FALSE;
+  }
+
+  if (init_logind(monitor)) {
+    return GS_IDLE_MONITOR_BACKEND_LOGIND;
+  }
+
+  return GS_IDLE_MONITOR_BACKEND_NONE;
+}
+
 static GObject *gs_idle_monitor_constructor(
     GType type, guint n_construct_properties,
     GObjectConstructParam *construct_properties) {
@@ -286,13 +586,18 @@ static GObject *gs_idle_monitor_constructor(
       G_OBJECT_CLASS(gs_idle_monitor_parent_class)
           ->constructor(type, n_construct_properties, construct_properties));
 
-  _init_xtest(monitor);
-
-  if (!init_xsync(monitor)) {
+  monitor->backend = select_backend(monitor);
+  if (monitor->backend == GS_IDLE_MONITOR_BACKEND_NONE) {
+    g_warning("GSIdleMonitor: No way to track idle time");
     g_object_unref(monitor);
     return NULL;
   }
 
+  g_debug("GSIdleMonitor: using the %s backend",
+          monitor->backend == GS_IDLE_MONITOR_BACKEND_WAYLAND ? "Wayland"
+          : monitor->backend == GS_IDLE_MONITOR_BACKEND_XSYNC ? "XSync"
+                                                               : "logind");
+
   return G_OBJECT(monitor);
 }
 
@@ -318,14 +623,11 @@ static guint32 get_next_watch_serial(void) {
   return serial;
 }
 
-static GSIdleMonitorWatch *idle_monitor_watch_new(guint interval) {
+static GSIdleMonitorWatch *idle_monitor_watch_new(void) {
   GSIdleMonitorWatch *watch;
 
   watch = g_slice_new0(GSIdleMonitorWatch);
-  watch->interval = _int64_to_xsyncvalue((gint64)interval);
   watch->id = get_next_watch_serial();
-  watch->xalarm_positive = None;
-  watch->xalarm_negative = None;
 
   return watch;
 }
@@ -334,20 +636,40 @@ static void idle_monitor_watch_free(GSIdleMonitorWatch *watch) {
   if (watch == NULL) {
     return;
   }
-  if (watch->xalarm_positive != None) {
+  g_slice_free(GSIdleMonitorWatch, watch);
+}
+
+static void idle_monitor_alarm_free(GSIdleMonitorAlarm *alarm) {
+  if (alarm == NULL) {
+    return;
+  }
+  if (alarm->xalarm_positive != None) {
     XSyncDestroyAlarm(GDK_DISPLAY_XDISPLAY(gdk_display_get_default()),
-                      watch->xalarm_positive);
+                      alarm->xalarm_positive);
   }
-  if (watch->xalarm_negative != None) {
+  if (alarm->xalarm_negative != None) {
     XSyncDestroyAlarm(GDK_DISPLAY_XDISPLAY(gdk_display_get_default()),
-                      watch->xalarm_negative);
+                      alarm->xalarm_negative);
   }
-  g_slice_free(GSIdleMonitorWatch, watch);
+#ifdef HAVE_WAYLAND
+  if (alarm->notification != NULL) {
+    ext_idle_notification_v1_destroy(alarm->notification);
+  }
+#endif /* HAVE_WAYLAND */
+  if (alarm->timeout_id > 0) {
+    g_source_remove(alarm->timeout_id);
+  }
+  g_slist_free(alarm->watches);
+  g_slice_free(GSIdleMonitorAlarm, alarm);
 }
 
 static void gs_idle_monitor_init(GSIdleMonitor *monitor) {
   monitor->watches = g_hash_table_new_full(
       NULL, NULL, NULL, (GDestroyNotify)idle_monitor_watch_free);
+  monitor->alarms = g_hash_table_new_full(
+      g_int64_hash, g_int64_equal, NULL,
+      (GDestroyNotify)idle_monitor_alarm_free);
+  monitor->alarm_ids = g_hash_table_new(NULL, NULL);
 
   monitor->counter = None;
 }
@@ -373,8 +695,8 @@ GSIdleMonitor *gs_idle_monitor_new(void) {
   return GS_IDLE_MONITOR(idle_monitor);
 }
 
-static gboolean _xsync_alarm_set(GSIdleMonitor *monitor,
-                                 GSIdleMonitorWatch *watch) {
+static XSyncAlarm _xsync_alarm_create(GSIdleMonitor *monitor, gint64 interval,
+                                      XSyncTestType test_type) {
   XSyncAlarmAttributes attr;
   XSyncValue delta;
   guint flags;
@@ -385,47 +707,64 @@ static gboolean _xsync_alarm_set(GSIdleMonitor *monitor,
   XSyncIntToValue(&delta, 0);
   attr.trigger.counter = monitor->counter;
   attr.trigger.value_type = XSyncAbsolute;
-  attr.trigger.wait_value = watch->interval;
+  attr.trigger.wait_value = _int64_to_xsyncvalue(interval - 1);
+  attr.trigger.test_type = test_type;
   attr.delta = delta;
   attr.events = TRUE;
 
-  attr.trigger.wait_value =
-      _int64_to_xsyncvalue(_xsyncvalue_to_int64(watch->interval) - 1);
-  attr.trigger.test_type = XSyncPositiveTransition;
-  if (watch->xalarm_positive != None) {
-    g_debug(
-        "GSIdleMonitor: updating alarm for positive transition "
-        "wait=%" G_GINT64_FORMAT,
-        _xsyncvalue_to_int64(attr.trigger.wait_value));
-    XSyncChangeAlarm(GDK_DISPLAY_XDISPLAY(gdk_display_get_default()),
-                     watch->xalarm_positive, flags, &attr);
-  } else {
-    g_debug(
-        "GSIdleMonitor: creating new alarm for positive transition "
-        "wait=%" G_GINT64_FORMAT,
-        _xsyncvalue_to_int64(attr.trigger.wait_value));
-    watch->xalarm_positive = XSyncCreateAlarm(
-        GDK_DISPLAY_XDISPLAY(gdk_display_get_default()), flags, &attr);
-  }
-
-  attr.trigger.test_type = XSyncNegativeTransition;
-  if (watch->xalarm_negative != None) {
-    g_debug(
-        "GSIdleMonitor: updating alarm for negative transition "
-        "wait=%" G_GINT64_FORMAT,
-        _xsyncvalue_to_int64(attr.trigger.wait_value));
-    XSyncChangeAlarm(GDK_DISPLAY_XDISPLAY(gdk_display_get_default()),
-                     watch->xalarm_negative, flags, &attr);
-  } else {
-    g_debug(
-        "GSIdleMonitor: creating new alarm for negative transition "
-        "wait=%" G_GINT64_FORMAT,
-        _xsyncvalue_to_int64(attr.trigger.wait_value));
-    watch->xalarm_negative = XSyncCreateAlarm(
-        GDK_DISPLAY_XDISPLAY(gdk_display_get_default()), flags, &attr);
+  g_debug("GSIdleMonitor: creating new alarm for %s transition "
+          "wait=%" G_GINT64_FORMAT,
+          test_type == XSyncPositiveTransition ? "positive" : "negative",
+          interval - 1);
+
+  return XSyncCreateAlarm(GDK_DISPLAY_XDISPLAY(gdk_display_get_default()),
+                          flags, &attr);
+}
+
+static GSIdleMonitorAlarm *get_alarm(GSIdleMonitor *monitor, gint64 interval) {
+  GSIdleMonitorAlarm *alarm;
+
+  alarm = g_hash_table_lookup(monitor->alarms, &interval);
+  if (alarm != NULL) {
+    return alarm;
   }
 
-  return TRUE;
+  alarm = g_slice_new0(GSIdleMonitorAlarm);
+  alarm->monitor = monitor;
+  alarm->interval = interval;
+  alarm->xalarm_positive = None;
+  alarm->xalarm_negative = None;
+
+  g_hash_table_insert(monitor->alarms, &alarm->interval, alarm);
+
+  switch (monitor->backend) {
+    case GS_IDLE_MONITOR_BACKEND_XSYNC:
+      alarm->xalarm_positive =
+          _xsync_alarm_create(monitor, interval, XSyncPositiveTransition);
+      alarm->xalarm_negative =
+          _xsync_alarm_create(monitor, interval, XSyncNegativeTransition);
+      g_hash_table_insert(monitor->alarm_ids,
+                          GSIZE_TO_POINTER(alarm->xalarm_positive), alarm);
+      g_hash_table_insert(monitor->alarm_ids,
+                          GSIZE_TO_POINTER(alarm->xalarm_negative), alarm);
+      break;
+#ifdef HAVE_WAYLAND
+    case GS_IDLE_MONITOR_BACKEND_WAYLAND:
+      alarm->notification = ext_idle_notifier_v1_get_idle_notification(
+          monitor->idle_notifier, (uint32_t)MIN(interval, G_MAXUINT32),
+          monitor->seat);
+      ext_idle_notification_v1_add_listener(alarm->notification,
+                                            &notification_listener, alarm);
+      break;
+#endif /* HAVE_WAYLAND */
+    case GS_IDLE_MONITOR_BACKEND_LOGIND:
+      logind_arm_alarm(monitor, alarm);
+      break;
+    default:
+      break;
+  }
+
+  return alarm;
 }
 
 guint gs_idle_monitor_add_watch(GSIdleMonitor *monitor, guint interval,
@@ -436,18 +775,39 @@ guint gs_idle_monitor_add_watch(GSIdleMonitor *monitor, guint interval,
   g_return_val_if_fail(GS_IS_IDLE_MONITOR(monitor), 0);
   g_return_val_if_fail(callback != NULL, 0);
 
-  watch = idle_monitor_watch_new(interval);
+  watch = idle_monitor_watch_new();
   watch->callback = callback;
   watch->user_data = user_data;
-
-  _xsync_alarm_set(monitor, watch);
+  watch->alarm = get_alarm(monitor, (gint64)interval);
+  watch->alarm->watches = g_slist_prepend(watch->alarm->watches, watch);
 
   g_hash_table_insert(monitor->watches, GUINT_TO_POINTER(watch->id), watch);
   return watch->id;
 }
 
 void gs_idle_monitor_remove_watch(GSIdleMonitor *monitor, guint id) {
+  GSIdleMonitorWatch *watch;
+  GSIdleMonitorAlarm *alarm;
+
   g_return_if_fail(GS_IS_IDLE_MONITOR(monitor));
 
+  watch = g_hash_table_lookup(monitor->watches, GUINT_TO_POINTER(id));
+  if (watch == NULL) {
+    return;
+  }
+
+  alarm = watch->alarm;
+  alarm->watches = g_slist_remove(alarm->watches, watch);
   g_hash_table_remove(monitor->watches, GUINT_TO_POINTER(id));
+
+  /* The alarm goes away with the last watch on that threshold */
+  if (alarm->watches == NULL) {
+    if (alarm->xalarm_positive != None) {
+      g_hash_table_remove(monitor->alarm_ids,
+                          GSIZE_TO_POINTER(alarm->xalarm_positive));
+      g_hash_table_remove(monitor->alarm_ids,
+                          GSIZE_TO_POINTER(alarm->xalarm_negative));
+    }
+    g_hash_table_remove(monitor->alarms, &alarm->interval);
+  }
 }
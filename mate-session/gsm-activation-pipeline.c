@@ -0,0 +1,170 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gsm-activation-pipeline.h"
+
+#include <gio/gio.h>
+#include <glib.h>
+
+#include "gsm-settings.h"
+
+/* Apps that are activated over D-Bus are started by calling Start on
+ * their well known name, which has the bus activate them first. All the
+ * calls of a phase are sent at once without waiting for the previous
+ * ones, up to activation-max-in-flight at a time, and each of them fails
+ * on its own after its timeout instead of holding the phase until the
+ * phase timeout.
+ */
+#define KEY_ACTIVATION_MAX_IN_FLIGHT "activation-max-in-flight"
+
+#define GSM_SESSION_CLIENT_DBUS_INTERFACE "org.mate.SessionClient"
+
+typedef struct {
+  GsmApp *app;
+  char *name;
+  char *path;
+  char *args;
+  guint timeout; /* milliseconds */
+  GsmActivationFunc func;
+  gint64 dispatched;
+} Activation;
+
+static GDBusConnection *connection = NULL;
+static GQueue queued = G_QUEUE_INIT; /* Activation */
+static guint n_in_flight = 0;
+static guint max_in_flight = 0;
+
+static void dispatch_queued(void);
+
+static void activation_free(Activation *activation) {
+  g_object_unref(activation->app);
+  g_free(activation->name);
+  g_free(activation->path);
+  g_free(activation->args);
+  g_slice_free(Activation, activation);
+}
+
+static void on_start_finished(GObject *source, GAsyncResult *result,
+                              gpointer data) {
+  Activation *activation = data;
+  GVariant *reply;
+  GError *error = NULL;
+
+  reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), result,
+                                        &error);
+
+  n_in_flight--;
+
+  g_debug("GsmActivationPipeline: %s %s after %" G_GINT64_FORMAT " ms, "
+          "%u in flight",
+          activation->name, reply != NULL ? "started" : "failed",
+          (g_get_monotonic_time() - activation->dispatched) / 1000,
+          n_in_flight);
+
+  activation->func(activation->app, error);
+
+  if (reply != NULL) {
+    g_variant_unref(reply);
+  } else {
+    g_error_free(error);
+  }
+
+  activation_free(activation);
+
+  dispatch_queued();
+}
+
+static void dispatch(Activation *activation) {
+  n_in_flight++;
+  activation->dispatched = g_get_monotonic_time();
+
+  g_dbus_connection_call(
+      connection, activation->name, activation->path,
+      GSM_SESSION_CLIENT_DBUS_INTERFACE, "Start",
+      g_variant_new("(s)", activation->args), NULL, G_DBUS_CALL_FLAGS_NONE,
+      (int)activation->timeout, NULL, on_start_finished, activation);
+}
+
+static void dispatch_queued(void) {
+  while (n_in_flight < max_in_flight && !g_queue_is_empty(&queued)) {
+    dispatch(g_queue_pop_head(&queued));
+  }
+}
+
+static guint get_max_in_flight(void) {
+  int value;
+
+  value =
+      gsm_settings_get_int(GSM_SETTINGS_SESSION, KEY_ACTIVATION_MAX_IN_FLIGHT);
+
+  return MAX(value, 1);
+}
+
+/* Calls Start with @args on @path of @name, activating it if needed, and
+ * @func with the result once it replied or @timeout milliseconds after
+ * the call was sent. Errors to connect to the bus are reported right
+ * away. */
+void gsm_activation_pipeline_queue(GsmApp *app, const char *name,
+                                   const char *path, const char *args,
+                                   guint timeout, GsmActivationFunc func) {
+  Activation *activation;
+
+  g_return_if_fail(GSM_IS_APP(app));
+  g_return_if_fail(name != NULL);
+
+  if (connection == NULL) {
+    GError *error = NULL;
+
+    connection = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, &error);
+    if (connection == NULL) {
+      g_warning("GsmActivationPipeline: Unable to connect to the session "
+                "bus: %s",
+                error->message);
+      func(app, error);
+      g_error_free(error);
+      return;
+    }
+
+    max_in_flight = get_max_in_flight();
+  }
+
+  activation = g_slice_new0(Activation);
+  activation->app = g_object_ref(app);
+  activation->name = g_strdup(name);
+  activation->path = g_strdup(path != NULL ? path : "/");
+  activation->args = g_strdup(args != NULL ? args : "");
+  activation->timeout = timeout;
+  activation->func = func;
+
+  g_queue_push_tail(&queued, activation);
+  dispatch_queued();
+}
+
+guint gsm_activation_pipeline_get_n_in_flight(void) {
+  return n_in_flight;
+}
+
+guint gsm_activation_pipeline_get_n_queued(void) {
+  return g_queue_get_length(&queued);
+}
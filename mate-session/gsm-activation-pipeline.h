@@ -0,0 +1,41 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifndef __GSM_ACTIVATION_PIPELINE_H__
+#define __GSM_ACTIVATION_PIPELINE_H__
+
+#include <glib.h>
+
+#include "gsm-app.h"
+
+G_BEGIN_DECLS
+
+typedef void (*GsmActivationFunc)(GsmApp *app, const GError *error);
+
+void gsm_activation_pipeline_queue(GsmApp *app, const char *name,
+                                   const char *path, const char *args,
+                                   guint timeout, GsmActivationFunc func);
+
+guint gsm_activation_pipeline_get_n_in_flight(void);
+guint gsm_activation_pipeline_get_n_queued(void);
+
+G_END_DECLS
+
+#endif /* __GSM_ACTIVATION_PIPELINE_H__ */
@@ -0,0 +1,582 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gsm-app-scope.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <gio/gio.h>
+#include <glib.h>
+
+#include "gsm-settings.h"
+
+/* When enabled, every spawned app is moved into its own transient scope
+ * of the systemd user manager right after it is started. Stopping an app
+ * then stops its scope, which takes its whole process tree down: systemd
+ * sends SIGTERM to every process in it and SIGKILL to whatever is left
+ * after SCOPE_STOP_TIMEOUT. Scopes also get CPU and memory accounting.
+ *
+ * Apps whose scope could not be created are signalled by pid as before.
+ *
+ * The scope is only created once the app runs. Apps spawned through the
+ * spawn helper are started stopped and only continued once systemd has
+ * answered, so everything they fork ends up in the scope. Apps launched
+ * by egg (Terminal or StartupNotify) or without the helper cannot be
+ * held: whatever they fork before the scope exists stays in our own
+ * cgroup, out of reach of the scope's stop and accounting.
+ *
+ * Apps can also be started with a temporary priority: the ones the user
+ * is waiting for at login get a higher CPU and IO weight until the session
+ * is running, the ones that can wait get a lower one until the desktop has
+ * settled. Without scopes only the IO priority is changed, as unprivileged
+ * processes cannot undo a nice.
+ */
+#define KEY_APP_SCOPES "app-scopes"
+
+#define SYSTEMD_DBUS_NAME "org.freedesktop.systemd1"
+#define SYSTEMD_DBUS_PATH "/org/freedesktop/systemd1"
+#define SYSTEMD_DBUS_INTERFACE "org.freedesktop.systemd1.Manager"
+
+#define SCOPE_STOP_TIMEOUT 5 /* seconds */
+
+#define WEIGHT_DEFAULT 100
+#define WEIGHT_BOOST 400
+#define WEIGHT_BACKGROUND 25
+
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_CLASS_NONE 0
+#define IOPRIO_CLASS_BE 2
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_VALUE(class, level) (((class) << IOPRIO_CLASS_SHIFT) | (level))
+
+static int enabled = -1;
+static GDBusConnection *connection = NULL;
+static GHashTable *scopes = NULL;     /* pid -> unit name */
+static GHashTable *pending = NULL;    /* pids whose scope is being created */
+static GHashTable *held = NULL;       /* stopped pids, until the scope is */
+static GHashTable *priorities = NULL; /* pid -> GsmAppPriority */
+static gboolean priority_ended[GSM_APP_PRIORITY_BACKGROUND + 1];
+static guint settle_id = 0;
+
+typedef struct {
+  GPid pid;
+  char *unit;
+} ScopeRequest;
+
+gboolean gsm_app_scope_is_enabled(void) {
+#ifdef HAVE_SYSTEMD
+  GError *error = NULL;
+
+  if (enabled >= 0) {
+    return enabled;
+  }
+
+  enabled = gsm_settings_get_boolean(GSM_SETTINGS_SESSION, KEY_APP_SCOPES);
+
+  if (!enabled) {
+    return FALSE;
+  }
+
+  connection = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, &error);
+  if (connection == NULL) {
+    g_warning("GsmAppScope: Unable to connect to the session bus: %s",
+              error->message);
+    g_error_free(error);
+    enabled = FALSE;
+    return FALSE;
+  }
+
+  scopes = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+  pending = g_hash_table_new(NULL, NULL);
+  held = g_hash_table_new(NULL, NULL);
+
+  return TRUE;
+#else
+  return FALSE;
+#endif
+}
+
+static char *get_unit_name(const char *app_id, GPid pid) {
+  GString *name;
+  const char *p;
+  gsize len;
+
+  name = g_string_new("app-mate-");
+
+  len = strlen(app_id);
+  if (g_str_has_suffix(app_id, ".desktop")) {
+    len -= strlen(".desktop");
+  }
+
+  for (p = app_id; p < app_id + len; p++) {
+    if (g_ascii_isalnum(*p) || *p == ':' || *p == '_' || *p == '.') {
+      g_string_append_c(name, *p);
+    } else {
+      g_string_append_c(name, '_');
+    }
+  }
+
+  g_string_append_printf(name, "-%d.scope", (int)pid);
+
+  return g_string_free(name, FALSE);
+}
+
+static guint64 get_weight(GsmAppPriority priority) {
+  switch (priority) {
+    case GSM_APP_PRIORITY_BOOST:
+      return WEIGHT_BOOST;
+    case GSM_APP_PRIORITY_BACKGROUND:
+      return WEIGHT_BACKGROUND;
+    default:
+      return WEIGHT_DEFAULT;
+  }
+}
+
+static void set_io_priority(GPid pid, GsmAppPriority priority) {
+#ifdef SYS_ioprio_set
+  int ioprio;
+
+  switch (priority) {
+    case GSM_APP_PRIORITY_BOOST:
+      ioprio = IOPRIO_VALUE(IOPRIO_CLASS_BE, 0);
+      break;
+    case GSM_APP_PRIORITY_BACKGROUND:
+      ioprio = IOPRIO_VALUE(IOPRIO_CLASS_BE, 7);
+      break;
+    default:
+      /* Back to the priority derived from the nice value */
+      ioprio = IOPRIO_VALUE(IOPRIO_CLASS_NONE, 0);
+      break;
+  }
+
+  if (syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, (int)pid, ioprio) < 0) {
+    g_debug("GsmAppScope: (pid:%d) unable to set the IO priority: %s",
+            (int)pid, g_strerror(errno));
+  }
+#endif
+}
+
+static void set_unit_weight(const char *unit, guint64 weight) {
+  GVariantBuilder properties;
+
+  g_variant_builder_init(&properties, G_VARIANT_TYPE("a(sv)"));
+  g_variant_builder_add(&properties, "(sv)", "CPUWeight",
+                        g_variant_new_uint64(weight));
+  g_variant_builder_add(&properties, "(sv)", "IOWeight",
+                        g_variant_new_uint64(weight));
+
+  g_dbus_connection_call(connection, SYSTEMD_DBUS_NAME, SYSTEMD_DBUS_PATH,
+                         SYSTEMD_DBUS_INTERFACE, "SetUnitProperties",
+                         g_variant_new("(sba(sv))", unit, TRUE, &properties),
+                         NULL, G_DBUS_CALL_FLAGS_NONE, -1, NULL, NULL, NULL);
+}
+
+/* Puts @pid back to the default priority if its one already ended, e.g.
+ * because the scope was created after the session started running */
+static void update_priority(GPid pid) {
+  GsmAppPriority priority;
+  const char *unit;
+
+  if (priorities == NULL) {
+    return;
+  }
+
+  priority = GPOINTER_TO_INT(
+      g_hash_table_lookup(priorities, GINT_TO_POINTER(pid)));
+  if (priority == GSM_APP_PRIORITY_DEFAULT || !priority_ended[priority]) {
+    return;
+  }
+
+  /* on_scope_started() comes back here */
+  if (pending != NULL && g_hash_table_contains(pending, GINT_TO_POINTER(pid))) {
+    return;
+  }
+
+  g_debug("GsmAppScope: (pid:%d) back to the default priority", (int)pid);
+
+  unit = scopes != NULL ? g_hash_table_lookup(scopes, GINT_TO_POINTER(pid))
+                        : NULL;
+  if (unit != NULL) {
+    set_unit_weight(unit, WEIGHT_DEFAULT);
+  } else {
+    set_io_priority(pid, GSM_APP_PRIORITY_DEFAULT);
+  }
+
+  g_hash_table_remove(priorities, GINT_TO_POINTER(pid));
+}
+
+/* Continues @pid if it was spawned stopped for its scope */
+static void release(GPid pid) {
+  if (held == NULL || !g_hash_table_remove(held, GINT_TO_POINTER(pid))) {
+    return;
+  }
+
+  if (kill(pid, SIGCONT) < 0) {
+    g_debug("GsmAppScope: (pid:%d) Unable to continue: %s", (int)pid,
+            g_strerror(errno));
+  }
+}
+
+static void on_scope_started(GObject *source, GAsyncResult *result,
+                             gpointer data) {
+  ScopeRequest *request = data;
+  GVariant *reply;
+  GError *error = NULL;
+
+  reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), result,
+                                        &error);
+  g_hash_table_remove(pending, GINT_TO_POINTER(request->pid));
+  if (reply == NULL) {
+    g_warning("GsmAppScope: Unable to create %s: %s", request->unit,
+              error->message);
+    g_error_free(error);
+    g_free(request->unit);
+
+    if (priorities != NULL &&
+        g_hash_table_contains(priorities, GINT_TO_POINTER(request->pid))) {
+      set_io_priority(request->pid,
+                      GPOINTER_TO_INT(g_hash_table_lookup(
+                          priorities, GINT_TO_POINTER(request->pid))));
+    }
+  } else {
+    g_debug("GsmAppScope: (pid:%d) moved to %s", (int)request->pid,
+            request->unit);
+    g_hash_table_replace(scopes, GINT_TO_POINTER(request->pid),
+                         request->unit);
+    g_variant_unref(reply);
+  }
+
+  update_priority(request->pid);
+  release(request->pid);
+
+  g_slice_free(ScopeRequest, request);
+}
+
+/* @stopped says that @pid was spawned stopped, to be continued once it is
+ * in its scope; it is only worth it when gsm_app_scope_is_enabled() */
+void gsm_app_scope_attach(const char *app_id, GPid pid,
+                          GsmAppPriority priority, gboolean stopped) {
+  GVariantBuilder properties;
+  ScopeRequest *request;
+  guint32 pid32 = (guint32)pid;
+
+  if (pid < 1) {
+    return;
+  }
+
+  if (stopped && !gsm_app_scope_is_enabled()) {
+    kill(pid, SIGCONT);
+    stopped = FALSE;
+  }
+
+  if (priority_ended[priority]) {
+    priority = GSM_APP_PRIORITY_DEFAULT;
+  }
+
+  if (priority != GSM_APP_PRIORITY_DEFAULT) {
+    if (priorities == NULL) {
+      priorities = g_hash_table_new(NULL, NULL);
+    }
+    g_hash_table_replace(priorities, GINT_TO_POINTER(pid),
+                         GINT_TO_POINTER(priority));
+  }
+
+  if (!gsm_app_scope_is_enabled()) {
+    if (priority != GSM_APP_PRIORITY_DEFAULT) {
+      set_io_priority(pid, priority);
+    }
+    return;
+  }
+
+  request = g_slice_new(ScopeRequest);
+  request->pid = pid;
+  request->unit = get_unit_name(app_id, pid);
+
+  g_variant_builder_init(&properties, G_VARIANT_TYPE("a(sv)"));
+  g_variant_builder_add(&properties, "(sv)", "Description",
+                        g_variant_new_string(app_id));
+  g_variant_builder_add(&properties, "(sv)", "PIDs",
+                        g_variant_new_fixed_array(G_VARIANT_TYPE_UINT32,
+                                                  &pid32, 1, sizeof(pid32)));
+  g_variant_builder_add(&properties, "(sv)", "CollectMode",
+                        g_variant_new_string("inactive-or-failed"));
+  g_variant_builder_add(&properties, "(sv)", "CPUAccounting",
+                        g_variant_new_boolean(TRUE));
+  g_variant_builder_add(&properties, "(sv)", "MemoryAccounting",
+                        g_variant_new_boolean(TRUE));
+  g_variant_builder_add(
+      &properties, "(sv)", "TimeoutStopUSec",
+      g_variant_new_uint64((guint64)SCOPE_STOP_TIMEOUT * G_USEC_PER_SEC));
+  g_variant_builder_add(&properties, "(sv)", "SendSIGKILL",
+                        g_variant_new_boolean(TRUE));
+  if (priority != GSM_APP_PRIORITY_DEFAULT) {
+    g_variant_builder_add(&properties, "(sv)", "CPUWeight",
+                          g_variant_new_uint64(get_weight(priority)));
+    g_variant_builder_add(&properties, "(sv)", "IOWeight",
+                          g_variant_new_uint64(get_weight(priority)));
+  }
+
+  g_hash_table_add(pending, GINT_TO_POINTER(pid));
+  if (stopped) {
+    g_hash_table_add(held, GINT_TO_POINTER(pid));
+  }
+  g_dbus_connection_call(
+      connection, SYSTEMD_DBUS_NAME, SYSTEMD_DBUS_PATH, SYSTEMD_DBUS_INTERFACE,
+      "StartTransientUnit",
+      g_variant_new("(ssa(sv)@a(sa(sv)))", request->unit, "fail", &properties,
+                    g_variant_new_array(G_VARIANT_TYPE("(sa(sv))"), NULL, 0)),
+      G_VARIANT_TYPE("(o)"), G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+      on_scope_started, request);
+}
+
+void gsm_app_scope_forget(GPid pid) {
+  if (held != NULL) {
+    g_hash_table_remove(held, GINT_TO_POINTER(pid));
+  }
+  if (scopes != NULL) {
+    g_hash_table_remove(scopes, GINT_TO_POINTER(pid));
+  }
+  if (priorities != NULL) {
+    g_hash_table_remove(priorities, GINT_TO_POINTER(pid));
+  }
+}
+
+static void end_priority(GsmAppPriority priority) {
+  GList *pids;
+  GList *l;
+
+  priority_ended[priority] = TRUE;
+
+  if (priorities == NULL) {
+    return;
+  }
+
+  pids = g_hash_table_get_keys(priorities);
+  for (l = pids; l != NULL; l = l->next) {
+    update_priority(GPOINTER_TO_INT(l->data));
+  }
+  g_list_free(pids);
+}
+
+static gboolean on_settled(gpointer data) {
+  settle_id = 0;
+  g_debug("GsmAppScope: desktop settled");
+  end_priority(GSM_APP_PRIORITY_BACKGROUND);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Ends the boost of the apps started before the session was running now,
+ * and the penalty of the background ones @settle_seconds later. Apps that
+ * are started after that get the default priority. */
+void gsm_app_scope_session_running(guint settle_seconds) {
+  if (priority_ended[GSM_APP_PRIORITY_BOOST]) {
+    return;
+  }
+
+  end_priority(GSM_APP_PRIORITY_BOOST);
+  settle_id = g_timeout_add_seconds(settle_seconds, on_settled, NULL);
+}
+
+static void stop_unit(GPid pid, const char *unit) {
+  guint64 cpu_usec;
+  guint64 memory_bytes;
+
+  if (gsm_app_scope_get_usage(pid, &cpu_usec, &memory_bytes)) {
+    g_debug("GsmAppScope: stopping %s (cpu: %" G_GUINT64_FORMAT
+            "ms, memory: %" G_GUINT64_FORMAT "kB)",
+            unit, cpu_usec / 1000, memory_bytes / 1024);
+  } else {
+    g_debug("GsmAppScope: stopping %s", unit);
+  }
+
+  g_dbus_connection_call(connection, SYSTEMD_DBUS_NAME, SYSTEMD_DBUS_PATH,
+                         SYSTEMD_DBUS_INTERFACE, "StopUnit",
+                         g_variant_new("(ss)", unit, "replace"),
+                         G_VARIANT_TYPE("(o)"), G_DBUS_CALL_FLAGS_NONE, -1,
+                         NULL, NULL, NULL);
+}
+
+/* Returns FALSE if @pid is not in a scope and has to be signalled */
+gboolean gsm_app_scope_stop(GPid pid) {
+  const char *unit;
+
+  if (scopes == NULL) {
+    return FALSE;
+  }
+
+  unit = g_hash_table_lookup(scopes, GINT_TO_POINTER(pid));
+  if (unit == NULL) {
+    /* A stopped process would not act on the signal it is about to get */
+    release(pid);
+    return FALSE;
+  }
+
+  stop_unit(pid, unit);
+
+  return TRUE;
+}
+
+/* Stops all the scopes at once; systemd takes care of the escalation to
+ * SIGKILL even though we are about to exit */
+void gsm_app_scope_stop_all(void) {
+  GHashTableIter iter;
+  gpointer key;
+  gpointer value;
+
+  if (held != NULL) {
+    GList *pids;
+    GList *l;
+
+    pids = g_hash_table_get_keys(held);
+    for (l = pids; l != NULL; l = l->next) {
+      release(GPOINTER_TO_INT(l->data));
+    }
+    g_list_free(pids);
+  }
+
+  if (scopes == NULL || g_hash_table_size(scopes) == 0) {
+    return;
+  }
+
+  g_debug("GsmAppScope: stopping %u scopes", g_hash_table_size(scopes));
+
+  g_hash_table_iter_init(&iter, scopes);
+  while (g_hash_table_iter_next(&iter, &key, &value)) {
+    stop_unit(GPOINTER_TO_INT(key), value);
+  }
+
+  g_dbus_connection_flush_sync(connection, NULL, NULL);
+}
+
+static char *get_cgroup_dir(GPid pid) {
+  char *path;
+  char *contents;
+  char **lines;
+  char *dir = NULL;
+  guint i;
+
+  path = g_strdup_printf("/proc/%d/cgroup", (int)pid);
+  if (!g_file_get_contents(path, &contents, NULL, NULL)) {
+    g_free(path);
+    return NULL;
+  }
+  g_free(path);
+
+  /* Only the unified hierarchy has everything we need */
+  lines = g_strsplit(contents, "\n", -1);
+  for (i = 0; lines[i] != NULL; i++) {
+    if (g_str_has_prefix(lines[i], "0::/")) {
+      dir = g_build_filename("/sys/fs/cgroup", lines[i] + 3, NULL);
+      break;
+    }
+  }
+
+  g_strfreev(lines);
+  g_free(contents);
+
+  return dir;
+}
+
+static gboolean read_cgroup_value(const char *dir, const char *file,
+                                  const char *key, guint64 *value) {
+  char *path;
+  char *contents;
+  char **lines;
+  gboolean found = FALSE;
+  guint i;
+
+  path = g_build_filename(dir, file, NULL);
+  if (!g_file_get_contents(path, &contents, NULL, NULL)) {
+    g_free(path);
+    return FALSE;
+  }
+  g_free(path);
+
+  lines = g_strsplit(contents, "\n", -1);
+  for (i = 0; lines[i] != NULL && !found; i++) {
+    const char *number = lines[i];
+
+    if (key != NULL) {
+      if (!g_str_has_prefix(lines[i], key) ||
+          lines[i][strlen(key)] != ' ') {
+        continue;
+      }
+      number += strlen(key) + 1;
+    }
+
+    *value = g_ascii_strtoull(number, NULL, 10);
+    found = TRUE;
+  }
+
+  g_strfreev(lines);
+  g_free(contents);
+
+  return found;
+}
+
+gboolean gsm_app_scope_contains(GPid pid) {
+  return scopes != NULL && g_hash_table_contains(scopes, GINT_TO_POINTER(pid));
+}
+
+/* Reads the CPU time and memory used so far by the cgroup of @pid. Unlike
+ * the rest of this file it can be called from any thread, so it is up to
+ * the caller to know that @pid has a scope of its own.
+ */
+gboolean gsm_app_scope_read_usage(GPid pid, guint64 *cpu_usec,
+                                  guint64 *memory_bytes) {
+  char *dir;
+  gboolean ret;
+
+  dir = get_cgroup_dir(pid);
+  if (dir == NULL) {
+    return FALSE;
+  }
+
+  ret = read_cgroup_value(dir, "cpu.stat", "usage_usec", cpu_usec) &&
+        read_cgroup_value(dir, "memory.current", NULL, memory_bytes);
+
+  g_free(dir);
+
+  return ret;
+}
+
+/* Returns the cgroup directory @pid is in, or NULL without the unified
+ * hierarchy. Like gsm_app_scope_read_usage() it can be called from any
+ * thread. */
+char *gsm_app_scope_read_cgroup(GPid pid) { return get_cgroup_dir(pid); }
+
+/* Reads the CPU time and memory used so far by the scope of @pid */
+gboolean gsm_app_scope_get_usage(GPid pid, guint64 *cpu_usec,
+                                 guint64 *memory_bytes) {
+  if (!gsm_app_scope_contains(pid)) {
+    return FALSE;
+  }
+
+  return gsm_app_scope_read_usage(pid, cpu_usec, memory_bytes);
+}
@@ -0,0 +1,54 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifndef __GSM_APP_SCOPE_H__
+#define __GSM_APP_SCOPE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+  GSM_APP_PRIORITY_DEFAULT = 0,
+  GSM_APP_PRIORITY_BOOST,      /* until the session is running */
+  GSM_APP_PRIORITY_BACKGROUND, /* until the desktop has settled */
+} GsmAppPriority;
+
+gboolean gsm_app_scope_is_enabled(void);
+
+void gsm_app_scope_attach(const char *app_id, GPid pid,
+                          GsmAppPriority priority, gboolean stopped);
+void gsm_app_scope_forget(GPid pid);
+
+gboolean gsm_app_scope_stop(GPid pid);
+void gsm_app_scope_stop_all(void);
+
+void gsm_app_scope_session_running(guint settle_seconds);
+
+gboolean gsm_app_scope_contains(GPid pid);
+gboolean gsm_app_scope_get_usage(GPid pid, guint64 *cpu_usec,
+                                 guint64 *memory_bytes);
+gboolean gsm_app_scope_read_usage(GPid pid, guint64 *cpu_usec,
+                                  guint64 *memory_bytes);
+char *gsm_app_scope_read_cgroup(GPid pid);
+
+G_END_DECLS
+
+#endif /* __GSM_APP_SCOPE_H__ */
@@ -30,6 +30,10 @@
 #include <string.h>
 
 #include "gsm-app-glue.h"
+#include "gsm-metrics.h"
+#include "gsm-restart-history.h"
+#include "gsm-trace.h"
+#include "gsm-util.h"
 
 typedef struct {
   char *id;
@@ -37,6 +41,8 @@ typedef struct {
   int phase;
   char *startup_id;
   DBusGConnection *connection;
+  gint64 started; /* when it was last started, until it registers */
+  gint64 startup_latency; /* how long it took to register last time */
 } GsmAppPrivate;
 
 enum { EXITED, DIED, REGISTERED, LAST_SIGNAL };
@@ -97,6 +103,7 @@ static GObject *gsm_app_constructor(
     GObjectConstructParam *construct_properties) {
   GsmApp *app;
   gboolean res;
+  char path[64];
   GsmAppPrivate *priv;
 
   app = GSM_APP(
@@ -104,9 +111,10 @@ static GObject *gsm_app_constructor(
           ->constructor(type, n_construct_properties, construct_properties));
   priv = gsm_app_get_instance_private(app);
 
-  g_free(priv->id);
-  priv->id =
-      g_strdup_printf("/org/gnome/SessionManager/App%u", get_next_app_serial());
+  g_snprintf(path, sizeof(path), "/org/gnome/SessionManager/App%u",
+             get_next_app_serial());
+  gsm_util_intern_release(priv->id);
+  priv->id = gsm_util_intern(path);
 
   res = register_app(app);
   if (!res) {
@@ -133,9 +141,9 @@ static void gsm_app_set_id(GsmApp *app, const char *id) {
 
   priv = gsm_app_get_instance_private(app);
 
-  g_free(priv->id);
+  gsm_util_intern_release(priv->id);
 
-  priv->id = g_strdup(id);
+  priv->id = gsm_util_intern(id);
   g_object_notify(G_OBJECT(app), "id");
 }
 static void gsm_app_set_startup_id(GsmApp *app, const char *startup_id) {
@@ -144,9 +152,9 @@ static void gsm_app_set_startup_id(GsmApp *app, const char *startup_id) {
 
   priv = gsm_app_get_instance_private(app);
 
-  g_free(priv->startup_id);
+  gsm_util_intern_release(priv->startup_id);
 
-  priv->startup_id = g_strdup(startup_id);
+  priv->startup_id = gsm_util_intern(startup_id);
   g_object_notify(G_OBJECT(app), "startup-id");
 }
 
@@ -197,11 +205,8 @@ static void gsm_app_dispose(GObject *object) {
 
   priv = gsm_app_get_instance_private(app);
 
-  g_free(priv->startup_id);
-  priv->startup_id = NULL;
-
-  g_free(priv->id);
-  priv->id = NULL;
+  g_clear_pointer(&priv->startup_id, gsm_util_intern_release);
+  g_clear_pointer(&priv->id, gsm_util_intern_release);
 
   G_OBJECT_CLASS(gsm_app_parent_class)->dispose(object);
 }
@@ -220,6 +225,9 @@ static void gsm_app_class_init(GsmAppClass *klass) {
   klass->impl_provides = NULL;
   klass->impl_is_running = NULL;
   klass->impl_peek_autostart_delay = NULL;
+  klass->impl_peek_restore_priority = NULL;
+  klass->impl_peek_after = NULL;
+  klass->impl_peek_provides = NULL;
 
   g_object_class_install_property(
       object_class, PROP_PHASE,
@@ -287,6 +295,18 @@ GsmManagerPhase gsm_app_peek_phase(GsmApp *app) {
   return priv->phase;
 }
 
+/* Returns the time in microseconds between the last start of @app and its
+ * registration, or 0 if it did not register yet.
+ */
+gint64 gsm_app_peek_startup_latency(GsmApp *app) {
+  GsmAppPrivate *priv;
+  g_return_val_if_fail(GSM_IS_APP(app), 0);
+
+  priv = gsm_app_get_instance_private(app);
+
+  return priv->startup_latency;
+}
+
 gboolean gsm_app_peek_is_disabled(GsmApp *app) {
   g_return_val_if_fail(GSM_IS_APP(app), FALSE);
 
@@ -349,6 +369,9 @@ gboolean gsm_app_start(GsmApp *app, GError **error) {
   priv = gsm_app_get_instance_private(app);
   g_debug("Starting app: %s", priv->id);
 
+  gsm_trace_async_begin("app", gsm_app_peek_app_id(app));
+  priv->started = g_get_monotonic_time();
+
   return GSM_APP_GET_CLASS(app)->impl_start(app, error);
 }
 
@@ -367,8 +390,23 @@ gboolean gsm_app_stop(GsmApp *app, GError **error) {
 }
 
 void gsm_app_registered(GsmApp *app) {
+  GsmAppPrivate *priv;
+
   g_return_if_fail(GSM_IS_APP(app));
 
+  priv = gsm_app_get_instance_private(app);
+  if (priv->started != 0) {
+    priv->startup_latency = g_get_monotonic_time() - priv->started;
+    priv->started = 0;
+
+    gsm_metrics_observe(GSM_METRIC_APP_REGISTER_LATENCY,
+                        priv->startup_latency);
+    gsm_metrics_set_series(GSM_METRIC_SERIES_APP_STARTUP,
+                           gsm_app_peek_app_id(app), priv->startup_latency);
+  }
+
+  gsm_trace_async_end("app", gsm_app_peek_app_id(app), "registered");
+
   g_signal_emit(app, signals[REGISTERED], 0);
 }
 
@@ -382,9 +420,45 @@ int gsm_app_peek_autostart_delay(GsmApp *app) {
   }
 }
 
+/* Returns the priority of an app restored from the saved session, higher
+ * for the clients that were used last, or -1 for any other app */
+int gsm_app_peek_restore_priority(GsmApp *app) {
+  g_return_val_if_fail(GSM_IS_APP(app), -1);
+
+  if (GSM_APP_GET_CLASS(app)->impl_peek_restore_priority) {
+    return GSM_APP_GET_CLASS(app)->impl_peek_restore_priority(app);
+  } else {
+    return -1;
+  }
+}
+
+/* Returns the services or app ids this app has to be started after, or
+ * NULL if it is only ordered by its phase */
+const char *const *gsm_app_peek_after(GsmApp *app) {
+  g_return_val_if_fail(GSM_IS_APP(app), NULL);
+
+  if (GSM_APP_GET_CLASS(app)->impl_peek_after) {
+    return GSM_APP_GET_CLASS(app)->impl_peek_after(app);
+  } else {
+    return NULL;
+  }
+}
+
+const char *const *gsm_app_peek_provides(GsmApp *app) {
+  g_return_val_if_fail(GSM_IS_APP(app), NULL);
+
+  if (GSM_APP_GET_CLASS(app)->impl_peek_provides) {
+    return GSM_APP_GET_CLASS(app)->impl_peek_provides(app);
+  } else {
+    return NULL;
+  }
+}
+
 void gsm_app_exited(GsmApp *app) {
   g_return_if_fail(GSM_IS_APP(app));
 
+  gsm_trace_async_end("app", gsm_app_peek_app_id(app), "exited");
+
   g_signal_emit(app, signals[EXITED], 0);
 }
 
@@ -417,3 +491,12 @@ gboolean gsm_app_get_phase(GsmApp *app, guint *phase, GError **error) {
   *phase = priv->phase;
   return TRUE;
 }
+
+gboolean gsm_app_get_restart_state(GsmApp *app, guint *exits, guint *delay,
+                                   gboolean *given_up, GError **error) {
+  g_return_val_if_fail(GSM_IS_APP(app), FALSE);
+
+  gsm_restart_history_get_state(gsm_app_peek_app_id(app), exits, delay,
+                                given_up);
+  return TRUE;
+}
@@ -49,6 +49,9 @@ struct _GsmAppClass {
   gboolean (*impl_restart)(GsmApp *app, GError **error);
   gboolean (*impl_stop)(GsmApp *app, GError **error);
   int (*impl_peek_autostart_delay)(GsmApp *app);
+  int (*impl_peek_restore_priority)(GsmApp *app);
+  const char *const *(*impl_peek_after)(GsmApp *app);
+  const char *const *(*impl_peek_provides)(GsmApp *app);
   gboolean (*impl_provides)(GsmApp *app, const char *service);
   gboolean (*impl_has_autostart_condition)(GsmApp *app, const char *service);
   gboolean (*impl_is_running)(GsmApp *app);
@@ -76,6 +79,7 @@ const char *gsm_app_peek_id(GsmApp *app);
 const char *gsm_app_peek_app_id(GsmApp *app);
 const char *gsm_app_peek_startup_id(GsmApp *app);
 GsmManagerPhase gsm_app_peek_phase(GsmApp *app);
+gint64 gsm_app_peek_startup_latency(GsmApp *app);
 gboolean gsm_app_peek_is_disabled(GsmApp *app);
 gboolean gsm_app_peek_is_conditionally_disabled(GsmApp *app);
 
@@ -91,11 +95,16 @@ gboolean gsm_app_provides(GsmApp *app, const char *service);
 gboolean gsm_app_has_autostart_condition(GsmApp *app, const char *condition);
 void gsm_app_registered(GsmApp *app);
 int gsm_app_peek_autostart_delay(GsmApp *app);
+int gsm_app_peek_restore_priority(GsmApp *app);
+const char *const *gsm_app_peek_after(GsmApp *app);
+const char *const *gsm_app_peek_provides(GsmApp *app);
 
 /* exported to bus */
 gboolean gsm_app_get_app_id(GsmApp *app, char **id, GError **error);
 gboolean gsm_app_get_startup_id(GsmApp *app, char **id, GError **error);
 gboolean gsm_app_get_phase(GsmApp *app, guint *phase, GError **error);
+gboolean gsm_app_get_restart_state(GsmApp *app, guint *exits, guint *delay,
+                                   gboolean *given_up, GError **error);
 
 G_END_DECLS
 
@@ -33,7 +33,12 @@
 #include <glib.h>
 #include <signal.h>
 
+#include "gsm-activation-pipeline.h"
+#include "gsm-app-scope.h"
 #include "gsm-autostart-app.h"
+#include "gsm-autostart-info.h"
+#include "gsm-condition-monitor.h"
+#include "gsm-spawn-helper.h"
 #include "gsm-util.h"
 
 #ifdef __GNUC__
@@ -53,35 +58,67 @@ enum {
   GSM_CONDITION_UNKNOWN = 5
 };
 
-#define GSM_SESSION_CLIENT_DBUS_INTERFACE "org.mate.SessionClient"
+/* seconds, when nothing is known about how long the app takes */
+#define GSM_AUTOSTART_APP_START_TIMEOUT 20
 
 typedef struct {
   char *desktop_filename;
   char *desktop_id;
+  char *app_id;
   char *startup_id;
 
+  /* only kept while the file is parsed, and while launching apps that
+   * need egg to expand their whole Exec line */
   EggDesktopFile *desktop_file;
+  GVariant *cached_info;
+  GVariant *display; /* capplet display info, until serialized */
 
   /* desktop file state */
+  char *autostart_startup_id;
+  char *dbus_name;
   char *condition_string;
   gboolean condition;
   gboolean autorestart;
   int autostart_delay;
+  int restore_priority;
+  gboolean on_demand;
+  gboolean hidden;
+  gboolean shows_in;
+  char *try_exec;
+  char *try_exec_path;
+  /* is_disabled() result, valid as long as PATH is disabled_path */
+  gboolean disabled_valid;
+  gboolean disabled;
+  char *disabled_path;
+  char **provides;
+  char **after;
+
+  /* launch state, parsed on first start for apps loaded from the cache */
+  gboolean launch_loaded;
+  gboolean launch_with_egg; /* Terminal or StartupNotify */
+  char **exec_argv;
+  char *working_dir;
+  char *dbus_path;
+  char *dbus_args;
 
-  GFileMonitor *condition_monitor;
-  GSettings *condition_settings;
+  GsmConditionMonitor *condition_monitor; /* NULL to not watch conditions */
+  GsmConditionWatch *condition_watch;
 
   int launch_type;
   GPid pid;
   guint child_watch_id;
 
-  GDBusConnection *connection;
-  GDBusProxy *proxy;
+  guint on_demand_watch_id;
 } GsmAutostartAppPrivate;
 
 enum { CONDITION_CHANGED, LAST_SIGNAL };
 
-enum { PROP_0, PROP_DESKTOP_FILENAME };
+enum {
+  PROP_0,
+  PROP_DESKTOP_FILENAME,
+  PROP_CACHED_INFO,
+  PROP_CONDITION_MONITOR
+};
 
 static guint signals[LAST_SIGNAL] = {0};
 
@@ -93,25 +130,73 @@ static void gsm_autostart_app_init(GsmAutostartApp *app) {
   priv = gsm_autostart_app_get_instance_private(app);
 
   priv->pid = -1;
-  priv->condition_monitor = NULL;
+  priv->condition_watch = NULL;
   priv->condition = FALSE;
   priv->autostart_delay = -1;
+  priv->restore_priority = -1;
 }
 
-static gboolean is_disabled(GsmApp *app) {
+static gboolean ensure_desktop_file(GsmAutostartApp *app, GError **error) {
+  GsmAutostartAppPrivate *priv;
+
+  priv = gsm_autostart_app_get_instance_private(app);
+
+  if (priv->desktop_file != NULL) {
+    return TRUE;
+  }
+
+  if (priv->desktop_filename == NULL) {
+    g_set_error(error, GSM_APP_ERROR, GSM_APP_ERROR_GENERAL,
+                "No desktop file");
+    return FALSE;
+  }
+
+  priv->desktop_file = egg_desktop_file_new(priv->desktop_filename, error);
+
+  return priv->desktop_file != NULL;
+}
+
+static void drop_desktop_file(GsmAutostartApp *app) {
+  GsmAutostartAppPrivate *priv;
+
+  priv = gsm_autostart_app_get_instance_private(app);
+
+  g_clear_pointer(&priv->desktop_file, egg_desktop_file_free);
+}
+
+static gboolean try_exec_is_available(GsmAutostartApp *app) {
+  GsmAutostartAppPrivate *priv;
+
+  priv = gsm_autostart_app_get_instance_private(app);
+
+  if (priv->try_exec == NULL) {
+    return TRUE;
+  }
+
+  if (priv->try_exec_path != NULL &&
+      g_file_test(priv->try_exec_path, G_FILE_TEST_IS_EXECUTABLE)) {
+    return TRUE;
+  }
+
+  g_free(priv->try_exec_path);
+  priv->try_exec_path = g_find_program_in_path(priv->try_exec);
+
+  return priv->try_exec_path != NULL;
+}
+
+static gboolean compute_is_disabled(GsmApp *app) {
   GsmAutostartAppPrivate *priv;
 
   priv = gsm_autostart_app_get_instance_private(GSM_AUTOSTART_APP(app));
 
   /* Hidden key, used by autostart spec */
-  if (egg_desktop_file_get_boolean(priv->desktop_file,
-                                   EGG_DESKTOP_FILE_KEY_HIDDEN, NULL)) {
+  if (priv->hidden) {
     g_debug("app %s is disabled by Hidden", gsm_app_peek_id(app));
     return TRUE;
   }
 
   /* Check OnlyShowIn/NotShowIn/TryExec */
-  if (!egg_desktop_file_can_launch(priv->desktop_file, "MATE")) {
+  if (!priv->shows_in || !try_exec_is_available(GSM_AUTOSTART_APP(app))) {
     g_debug("app %s not installed or not for MATE", gsm_app_peek_id(app));
     return TRUE;
   }
@@ -122,6 +207,43 @@ static gboolean is_disabled(GsmApp *app) {
   return FALSE;
 }
 
+static void invalidate_disabled(GsmAutostartApp *app) {
+  GsmAutostartAppPrivate *priv;
+
+  priv = gsm_autostart_app_get_instance_private(app);
+
+  priv->disabled_valid = FALSE;
+  g_free(priv->disabled_path);
+  priv->disabled_path = NULL;
+}
+
+/* Only depends on the desktop file and, through TryExec, on PATH */
+static gboolean is_disabled(GsmApp *app) {
+  GsmAutostartAppPrivate *priv;
+  const char *path;
+
+  priv = gsm_autostart_app_get_instance_private(GSM_AUTOSTART_APP(app));
+
+  path = g_getenv("PATH");
+
+  if (priv->disabled_valid) {
+    if (g_strcmp0(path, priv->disabled_path) == 0) {
+      return priv->disabled;
+    }
+
+    /* TryExec may resolve to a different binary now */
+    g_free(priv->try_exec_path);
+    priv->try_exec_path = NULL;
+  }
+
+  priv->disabled = compute_is_disabled(app);
+  priv->disabled_valid = TRUE;
+  g_free(priv->disabled_path);
+  priv->disabled_path = g_strdup(path);
+
+  return priv->disabled;
+}
+
 static gboolean parse_condition_string(const char *condition_string,
                                        guint *condition_kindp, char **keyp) {
   const char *space;
@@ -161,26 +283,11 @@ static gboolean parse_condition_string(const char *condition_string,
   return (kind != GSM_CONDITION_UNKNOWN);
 }
 
-static void if_exists_condition_cb(GFileMonitor *monitor, GFile *file,
-                                   GFile *other_file, GFileMonitorEvent event,
-                                   GsmApp *app) {
+static void set_condition(GsmApp *app, gboolean condition) {
   GsmAutostartAppPrivate *priv;
-  gboolean condition = FALSE;
 
   priv = gsm_autostart_app_get_instance_private(GSM_AUTOSTART_APP(app));
 
-  switch (event) {
-    case G_FILE_MONITOR_EVENT_CREATED:
-      condition = TRUE;
-      break;
-    case G_FILE_MONITOR_EVENT_DELETED:
-      condition = FALSE;
-      break;
-    default:
-      /* Ignore any other monitor event */
-      return;
-  }
-
   /* Emit only if the condition actually changed */
   if (condition != priv->condition) {
     priv->condition = condition;
@@ -188,65 +295,28 @@ static void if_exists_condition_cb(GFileMonitor *monitor, GFile *file,
   }
 }
 
-static void unless_exists_condition_cb(GFileMonitor *monitor, GFile *file,
-                                       GFile *other_file,
-                                       GFileMonitorEvent event, GsmApp *app) {
-  GsmAutostartAppPrivate *priv;
-  gboolean condition = FALSE;
-
-  priv = gsm_autostart_app_get_instance_private(GSM_AUTOSTART_APP(app));
-
-  switch (event) {
-    case G_FILE_MONITOR_EVENT_CREATED:
-      condition = FALSE;
-      break;
-    case G_FILE_MONITOR_EVENT_DELETED:
-      condition = TRUE;
-      break;
-    default:
-      /* Ignore any other monitor event */
-      return;
-  }
-
-  /* Emit only if the condition actually changed */
-  if (condition != priv->condition) {
-    priv->condition = condition;
-    g_signal_emit(app, signals[CONDITION_CHANGED], 0, condition);
-  }
+static void if_exists_condition_cb(GsmConditionWatch *watch, gboolean exists,
+                                   GsmApp *app) {
+  set_condition(app, exists);
 }
 
-static void gsettings_condition_cb(GSettings *settings, const char *key,
-                                   gpointer user_data) {
-  GsmApp *app;
-  GsmAutostartAppPrivate *priv;
-  gboolean condition;
-
-  g_return_if_fail(GSM_IS_APP(user_data));
-
-  app = GSM_APP(user_data);
-
-  priv = gsm_autostart_app_get_instance_private(GSM_AUTOSTART_APP(app));
-
-  condition = g_settings_get_boolean(settings, key);
+static void unless_exists_condition_cb(GsmConditionWatch *watch,
+                                       gboolean exists, GsmApp *app) {
+  set_condition(app, !exists);
+}
 
+static void gsettings_condition_cb(GsmConditionWatch *watch, gboolean value,
+                                   GsmApp *app) {
   g_debug("GsmAutostartApp: app:%s condition changed condition:%d",
-          gsm_app_peek_id(app), condition);
+          gsm_app_peek_id(app), value);
 
-  /* Emit only if the condition actually changed */
-  if (condition != priv->condition) {
-    priv->condition = condition;
-    g_signal_emit(app, signals[CONDITION_CHANGED], 0, condition);
-  }
+  set_condition(app, value);
 }
 
 static gboolean setup_gsettings_condition_monitor(GsmAutostartApp *app,
                                                   const char *key) {
-  GSettingsSchemaSource *source;
-  GSettingsSchema *schema;
-  GSettings *settings;
   char **elems;
   gboolean retval = FALSE;
-  char *signal;
   GsmAutostartAppPrivate *priv;
 
   elems = g_strsplit(key, " ", 2);
@@ -257,23 +327,13 @@ static gboolean setup_gsettings_condition_monitor(GsmAutostartApp *app,
 
   if (elems[0] == NULL || elems[1] == NULL) goto out;
 
-  source = g_settings_schema_source_get_default();
-
-  schema = g_settings_schema_source_lookup(source, elems[0], TRUE);
-
-  if (schema == NULL) goto out;
-
-  settings = g_settings_new_full(schema, NULL, NULL);
-  g_settings_schema_unref(schema);
+  priv->condition_watch = gsm_condition_watch_setting(
+      priv->condition_monitor, elems[0], elems[1],
+      (GsmConditionWatchFunc)gsettings_condition_cb, app);
+  if (priv->condition_watch == NULL) goto out;
 
-  signal = g_strdup_printf("changed::%s", elems[1]);
-  g_signal_connect(settings, signal,
-                   G_CALLBACK(gsettings_condition_cb), app);
-  g_free(signal);
-
-  retval = g_settings_get_boolean(settings, elems[1]);
-
-  priv->condition_settings = settings;
+  retval = g_settings_get_boolean(
+      gsm_condition_watch_peek_settings(priv->condition_watch), elems[1]);
 
 out:
   g_strfreev(elems);
@@ -290,16 +350,12 @@ static void setup_condition_monitor(GsmAutostartApp *app) {
 
   priv = gsm_autostart_app_get_instance_private(app);
 
-  if (priv->condition_monitor != NULL) {
-    g_file_monitor_cancel(priv->condition_monitor);
-  }
-
-  if (priv->condition_settings != NULL) {
-    g_object_unref(priv->condition_settings);
-    priv->condition_settings = NULL;
+  if (priv->condition_watch != NULL) {
+    gsm_condition_watch_free(priv->condition_watch);
+    priv->condition_watch = NULL;
   }
 
-  if (priv->condition_string == NULL) {
+  if (priv->condition_string == NULL || priv->condition_monitor == NULL) {
     return;
   }
 
@@ -321,35 +377,27 @@ static void setup_condition_monitor(GsmAutostartApp *app) {
 
   if (kind == GSM_CONDITION_IF_EXISTS) {
     char *file_path;
-    GFile *file;
 
     file_path = g_build_filename(g_get_user_config_dir(), key, NULL);
 
     disabled = !g_file_test(file_path, G_FILE_TEST_EXISTS);
 
-    file = g_file_new_for_path(file_path);
-    priv->condition_monitor = g_file_monitor_file(file, 0, NULL, NULL);
+    priv->condition_watch = gsm_condition_watch_file(
+        priv->condition_monitor, file_path,
+        (GsmConditionWatchFunc)if_exists_condition_cb, app);
 
-    g_signal_connect(priv->condition_monitor, "changed",
-                     G_CALLBACK(if_exists_condition_cb), app);
-
-    g_object_unref(file);
     g_free(file_path);
   } else if (kind == GSM_CONDITION_UNLESS_EXISTS) {
     char *file_path;
-    GFile *file;
 
     file_path = g_build_filename(g_get_user_config_dir(), key, NULL);
 
     disabled = g_file_test(file_path, G_FILE_TEST_EXISTS);
 
-    file = g_file_new_for_path(file_path);
-    priv->condition_monitor = g_file_monitor_file(file, 0, NULL, NULL);
-
-    g_signal_connect(priv->condition_monitor, "changed",
-                     G_CALLBACK(unless_exists_condition_cb), app);
+    priv->condition_watch = gsm_condition_watch_file(
+        priv->condition_monitor, file_path,
+        (GsmConditionWatchFunc)unless_exists_condition_cb, app);
 
-    g_object_unref(file);
     g_free(file_path);
   } else if (kind == GSM_CONDITION_MATE) {
     disabled = !setup_gsettings_condition_monitor(app, key);
@@ -360,47 +408,18 @@ static void setup_condition_monitor(GsmAutostartApp *app) {
   }
 
   g_free(key);
-
-  /* FIXME: cache the disabled value? */
 }
 
-static gboolean load_desktop_file(GsmAutostartApp *app) {
-  char *dbus_name;
+static void setup_desktop_info(GsmAutostartApp *app, int phase) {
   char *startup_id;
-  char *phase_str;
-  int phase;
-  gboolean res;
   GsmAutostartAppPrivate *priv;
 
   priv = gsm_autostart_app_get_instance_private(app);
 
-  if (priv->desktop_file == NULL) {
-    return FALSE;
-  }
-
-  phase_str = egg_desktop_file_get_string(priv->desktop_file,
-                                          GSM_AUTOSTART_APP_PHASE_KEY, NULL);
-  if (phase_str != NULL) {
-    if (strcmp(phase_str, "Initialization") == 0) {
-      phase = GSM_MANAGER_PHASE_INITIALIZATION;
-    } else if (strcmp(phase_str, "WindowManager") == 0) {
-      phase = GSM_MANAGER_PHASE_WINDOW_MANAGER;
-    } else if (strcmp(phase_str, "Panel") == 0) {
-      phase = GSM_MANAGER_PHASE_PANEL;
-    } else if (strcmp(phase_str, "Desktop") == 0) {
-      phase = GSM_MANAGER_PHASE_DESKTOP;
-    } else {
-      phase = GSM_MANAGER_PHASE_APPLICATION;
-    }
+  /* The desktop file was (re)loaded */
+  invalidate_disabled(app);
 
-    g_free(phase_str);
-  } else {
-    phase = GSM_MANAGER_PHASE_APPLICATION;
-  }
-
-  dbus_name = egg_desktop_file_get_string(
-      priv->desktop_file, GSM_AUTOSTART_APP_DBUS_NAME_KEY, NULL);
-  if (dbus_name != NULL) {
+  if (priv->dbus_name != NULL) {
     priv->launch_type = AUTOSTART_LAUNCH_ACTIVATE;
   } else {
     priv->launch_type = AUTOSTART_LAUNCH_SPAWN;
@@ -409,56 +428,171 @@ static gboolean load_desktop_file(GsmAutostartApp *app) {
   /* this must only be done on first load */
   switch (priv->launch_type) {
     case AUTOSTART_LAUNCH_SPAWN:
-      startup_id = egg_desktop_file_get_string(
-          priv->desktop_file, GSM_AUTOSTART_APP_STARTUP_ID_KEY, NULL);
-
-      if (startup_id == NULL) {
+      if (priv->autostart_startup_id != NULL) {
+        startup_id = g_strdup(priv->autostart_startup_id);
+      } else {
         startup_id = gsm_util_generate_startup_id();
       }
       break;
     case AUTOSTART_LAUNCH_ACTIVATE:
-      startup_id = g_strdup(dbus_name);
+      startup_id = g_strdup(priv->dbus_name);
       break;
     default:
       g_assert_not_reached();
   }
 
-  res = egg_desktop_file_has_key(priv->desktop_file,
-                                 GSM_AUTOSTART_APP_AUTORESTART_KEY, NULL);
-  if (res) {
-    priv->autorestart = egg_desktop_file_get_boolean(
-        priv->desktop_file, GSM_AUTOSTART_APP_AUTORESTART_KEY, NULL);
+  setup_condition_monitor(app);
+
+  g_object_set(app, "phase", phase, "startup-id", startup_id, NULL);
+
+  g_free(startup_id);
+}
+
+/* Pulls out of the desktop file what launching the app needs, so that
+ * the file does not have to be kept around. Apps that want a terminal or
+ * startup notification are still launched by egg from the whole file. */
+static void load_launch_info(GsmAutostartApp *app) {
+  char *command;
+  GError *error;
+  GsmAutostartAppPrivate *priv;
+
+  priv = gsm_autostart_app_get_instance_private(app);
+
+  g_assert(priv->desktop_file != NULL);
+
+  if (priv->launch_loaded) {
+    return;
+  }
+
+  priv->launch_loaded = TRUE;
+
+  if (priv->launch_type == AUTOSTART_LAUNCH_ACTIVATE) {
+    priv->dbus_path = egg_desktop_file_get_string(
+        priv->desktop_file, GSM_AUTOSTART_APP_DBUS_PATH_KEY, NULL);
+    priv->dbus_args = egg_desktop_file_get_string(
+        priv->desktop_file, GSM_AUTOSTART_APP_DBUS_ARGS_KEY, NULL);
+    return;
+  }
+
+  priv->launch_with_egg =
+      egg_desktop_file_get_boolean(priv->desktop_file,
+                                   EGG_DESKTOP_FILE_KEY_TERMINAL, NULL) ||
+      egg_desktop_file_get_boolean(priv->desktop_file,
+                                   EGG_DESKTOP_FILE_KEY_STARTUP_NOTIFY, NULL);
+  if (priv->launch_with_egg) {
+    return;
+  }
+
+  error = NULL;
+  command = egg_desktop_file_parse_exec(priv->desktop_file, NULL, &error);
+  if (command == NULL ||
+      !g_shell_parse_argv(command, NULL, &priv->exec_argv, &error)) {
+    g_warning("Unable to parse command from  '%s': %s",
+              egg_desktop_file_get_source(priv->desktop_file),
+              error->message);
+    g_error_free(error);
+    /* let egg report the error when the app is started */
+    priv->launch_with_egg = TRUE;
+  }
+  g_free(command);
+
+  priv->working_dir = egg_desktop_file_get_string(
+      priv->desktop_file, EGG_DESKTOP_FILE_KEY_PATH, NULL);
+  if (priv->working_dir != NULL && priv->working_dir[0] == '\0') {
+    g_free(priv->working_dir);
+    priv->working_dir = NULL;
+  }
+}
+
+static gboolean ensure_launch_info(GsmAutostartApp *app, GError **error) {
+  GsmAutostartAppPrivate *priv;
+
+  priv = gsm_autostart_app_get_instance_private(app);
+
+  if (priv->launch_loaded) {
+    return TRUE;
+  }
+
+  if (!ensure_desktop_file(app, error)) {
+    return FALSE;
+  }
+
+  load_launch_info(app);
+  drop_desktop_file(app);
+
+  return TRUE;
+}
+
+static gboolean load_cached_info(GsmAutostartApp *app) {
+  int phase;
+  gboolean has_after;
+  char **after;
+  GsmAutostartAppPrivate *priv;
+
+  priv = gsm_autostart_app_get_instance_private(app);
+
+  g_variant_get(priv->cached_info, GSM_AUTOSTART_INFO_FORMAT, &phase,
+                &priv->autostart_startup_id, &priv->dbus_name,
+                &priv->condition_string, &priv->autostart_delay,
+                &priv->autorestart, &priv->hidden, &priv->shows_in,
+                &priv->try_exec, &priv->try_exec_path, &priv->provides,
+                &has_after, &after, &priv->restore_priority,
+                &priv->on_demand, NULL);
+
+  if (has_after) {
+    priv->after = after;
   } else {
-    priv->autorestart = FALSE;
+    g_strfreev(after);
   }
 
-  g_free(priv->condition_string);
-  priv->condition_string = egg_desktop_file_get_string(
-      priv->desktop_file, "AutostartCondition", NULL);
-  setup_condition_monitor(app);
+  g_variant_unref(priv->cached_info);
+  priv->cached_info = NULL;
+
+  setup_desktop_info(app, phase);
+
+  return TRUE;
+}
+
+static gboolean load_desktop_file(GsmAutostartApp *app) {
+  GError *error;
+  GsmAutostartAppPrivate *priv;
+
+  priv = gsm_autostart_app_get_instance_private(app);
 
-  if (phase == GSM_MANAGER_PHASE_APPLICATION) {
-    /* Only accept an autostart delay for the application phase */
-    priv->autostart_delay = egg_desktop_file_get_integer(
-        priv->desktop_file, GSM_AUTOSTART_APP_DELAY_KEY, NULL);
-    if (priv->autostart_delay < 0) {
-      g_warning("Invalid autostart delay of %d for %s", priv->autostart_delay,
-                gsm_app_peek_id(GSM_APP(app)));
-      priv->autostart_delay = -1;
+  if (priv->cached_info != NULL) {
+    return load_cached_info(app);
+  }
+
+  error = NULL;
+  if (!ensure_desktop_file(app, &error)) {
+    if (priv->desktop_filename != NULL) {
+      g_warning("Could not parse desktop file %s: %s", priv->desktop_filename,
+                error->message);
     }
+    g_error_free(error);
+    return FALSE;
   }
 
-  g_object_set(app, "phase", phase, "startup-id", startup_id, NULL);
+  priv->cached_info = g_variant_ref_sink(
+      gsm_autostart_info_new(priv->desktop_file, priv->desktop_id));
 
-  g_free(startup_id);
-  g_free(dbus_name);
+  /* The display info is kept until the app is serialized into the
+   * autostart cache, which happens right away. */
+  priv->display = g_variant_get_child_value(
+      priv->cached_info, g_variant_n_children(priv->cached_info) - 1);
+
+  load_cached_info(app);
+
+  /* Keep only what we parsed */
+  load_launch_info(app);
+  drop_desktop_file(app);
 
   return TRUE;
 }
 
 static void gsm_autostart_app_set_desktop_filename(
     GsmAutostartApp *app, const char *desktop_filename) {
-  GError *error;
+  char *uri;
   GsmAutostartAppPrivate *priv;
 
   priv = gsm_autostart_app_get_instance_private(app);
@@ -466,22 +600,32 @@ static void gsm_autostart_app_set_desktop_filename(
   if (priv->desktop_file != NULL) {
     egg_desktop_file_free(priv->desktop_file);
     priv->desktop_file = NULL;
-    g_free(priv->desktop_id);
   }
 
+  g_free(priv->desktop_filename);
+  priv->desktop_filename = NULL;
+  g_free(priv->desktop_id);
+  priv->desktop_id = NULL;
+  g_clear_pointer(&priv->app_id, gsm_util_intern_release);
+
   if (desktop_filename == NULL) {
     return;
   }
 
+  priv->desktop_filename = g_strdup(desktop_filename);
   priv->desktop_id = g_path_get_basename(desktop_filename);
 
-  error = NULL;
-  priv->desktop_file = egg_desktop_file_new(desktop_filename, &error);
-  if (priv->desktop_file == NULL) {
-    g_warning("Could not parse desktop file %s: %s", desktop_filename,
-              error->message);
-    g_error_free(error);
-    return;
+  /* Same as the basename of the desktop file source URI, which is what
+   * the app id used to be derived from */
+  uri = g_filename_to_uri(desktop_filename, NULL, NULL);
+  if (uri != NULL) {
+    const char *slash;
+
+    slash = strrchr(uri, '/');
+    priv->app_id = gsm_util_intern(slash != NULL ? slash + 1 : uri);
+    g_free(uri);
+  } else {
+    priv->app_id = gsm_util_intern(priv->desktop_id);
   }
 }
 
@@ -496,6 +640,24 @@ static void gsm_autostart_app_set_property(GObject *object, guint prop_id,
     case PROP_DESKTOP_FILENAME:
       gsm_autostart_app_set_desktop_filename(self, g_value_get_string(value));
       break;
+    case PROP_CACHED_INFO: {
+      GsmAutostartAppPrivate *priv;
+
+      priv = gsm_autostart_app_get_instance_private(self);
+      if (priv->cached_info != NULL) {
+        g_variant_unref(priv->cached_info);
+      }
+      priv->cached_info = g_value_dup_variant(value);
+      break;
+    }
+    case PROP_CONDITION_MONITOR: {
+      GsmAutostartAppPrivate *priv;
+
+      priv = gsm_autostart_app_get_instance_private(self);
+      g_clear_object(&priv->condition_monitor);
+      priv->condition_monitor = g_value_dup_object(value);
+      break;
+    }
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
       break;
@@ -512,12 +674,7 @@ static void gsm_autostart_app_get_property(GObject *object, guint prop_id,
 
   switch (prop_id) {
     case PROP_DESKTOP_FILENAME:
-      if (priv->desktop_file != NULL) {
-        g_value_set_string(value,
-                           egg_desktop_file_get_source(priv->desktop_file));
-      } else {
-        g_value_set_string(value, NULL);
-      }
+      g_value_set_string(value, priv->desktop_filename);
       break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
@@ -540,9 +697,53 @@ static void gsm_autostart_app_dispose(GObject *object) {
     priv->condition_string = NULL;
   }
 
-  if (priv->condition_settings) {
-    g_object_unref(priv->condition_settings);
-    priv->condition_settings = NULL;
+  if (priv->condition_watch) {
+    gsm_condition_watch_free(priv->condition_watch);
+    priv->condition_watch = NULL;
+  }
+
+  g_clear_object(&priv->condition_monitor);
+
+  if (priv->on_demand_watch_id > 0) {
+    g_bus_unwatch_name(priv->on_demand_watch_id);
+    priv->on_demand_watch_id = 0;
+  }
+
+  if (priv->autostart_startup_id) {
+    g_free(priv->autostart_startup_id);
+    priv->autostart_startup_id = NULL;
+  }
+
+  if (priv->dbus_name) {
+    g_free(priv->dbus_name);
+    priv->dbus_name = NULL;
+  }
+
+  if (priv->try_exec) {
+    g_free(priv->try_exec);
+    priv->try_exec = NULL;
+  }
+
+  if (priv->try_exec_path) {
+    g_free(priv->try_exec_path);
+    priv->try_exec_path = NULL;
+  }
+
+  invalidate_disabled(GSM_AUTOSTART_APP(object));
+
+  if (priv->provides) {
+    g_strfreev(priv->provides);
+    priv->provides = NULL;
+  }
+
+  if (priv->after) {
+    g_strfreev(priv->after);
+    priv->after = NULL;
+  }
+
+  if (priv->cached_info) {
+    g_variant_unref(priv->cached_info);
+    priv->cached_info = NULL;
   }
 
   if (priv->desktop_file) {
@@ -550,30 +751,29 @@ static void gsm_autostart_app_dispose(GObject *object) {
     priv->desktop_file = NULL;
   }
 
+  g_clear_pointer(&priv->display, g_variant_unref);
+  g_clear_pointer(&priv->exec_argv, g_strfreev);
+  g_clear_pointer(&priv->working_dir, g_free);
+  g_clear_pointer(&priv->dbus_path, g_free);
+  g_clear_pointer(&priv->dbus_args, g_free);
+
+  if (priv->desktop_filename) {
+    g_free(priv->desktop_filename);
+    priv->desktop_filename = NULL;
+  }
+
   if (priv->desktop_id) {
     g_free(priv->desktop_id);
     priv->desktop_id = NULL;
   }
 
+  g_clear_pointer(&priv->app_id, gsm_util_intern_release);
+
   if (priv->child_watch_id > 0) {
     g_source_remove(priv->child_watch_id);
     priv->child_watch_id = 0;
   }
 
-  if (priv->proxy != NULL) {
-    g_object_unref(priv->proxy);
-    priv->proxy = NULL;
-  }
-
-  if (priv->connection != NULL) {
-    g_object_unref(priv->connection);
-    priv->connection = NULL;
-  }
-
-  if (priv->condition_monitor) {
-    g_file_monitor_cancel(priv->condition_monitor);
-  }
-
   G_OBJECT_CLASS(gsm_autostart_app_parent_class)->dispose(object);
 }
 
@@ -629,16 +829,19 @@ static gboolean is_conditionally_disabled(GsmApp *app) {
     file_path = g_build_filename(g_get_user_config_dir(), key, NULL);
     disabled = g_file_test(file_path, G_FILE_TEST_EXISTS);
     g_free(file_path);
-  } else if (kind == GSM_CONDITION_MATE && priv->condition_settings != NULL) {
+  } else if (kind == GSM_CONDITION_MATE &&
+             gsm_condition_watch_peek_settings(priv->condition_watch) != NULL) {
     char **elems;
     elems = g_strsplit(key, " ", 2);
-    disabled = !g_settings_get_boolean(priv->condition_settings, elems[1]);
+    disabled = !g_settings_get_boolean(
+        gsm_condition_watch_peek_settings(priv->condition_watch), elems[1]);
     g_strfreev(elems);
   } else if (kind == GSM_CONDITION_GSETTINGS &&
-             priv->condition_settings != NULL) {
+             gsm_condition_watch_peek_settings(priv->condition_watch) != NULL) {
     char **elems;
     elems = g_strsplit(key, " ", 2);
-    disabled = !g_settings_get_boolean(priv->condition_settings, elems[1]);
+    disabled = !g_settings_get_boolean(
+        gsm_condition_watch_peek_settings(priv->condition_watch), elems[1]);
     g_strfreev(elems);
   } else {
     disabled = TRUE;
@@ -664,6 +867,7 @@ static void app_exited(GPid pid, int status, GsmAutostartApp *app) {
           : WIFSIGNALED(status) ? WTERMSIG(status)
                                 : -1);
 
+  gsm_app_scope_forget(priv->pid);
   g_spawn_close_pid(priv->pid);
   priv->pid = -1;
   priv->child_watch_id = 0;
@@ -707,6 +911,11 @@ static gboolean autostart_app_stop_spawn(GsmAutostartApp *app, GError **error) {
     return FALSE;
   }
 
+  /* Stopping the scope also takes down the children of the app */
+  if (gsm_app_scope_stop(priv->pid)) {
+    return TRUE;
+  }
+
   res = _signal_pid(priv->pid, SIGTERM);
   if (res != 0) {
     g_set_error(error, GSM_APP_ERROR, GSM_APP_ERROR_STOP, "Unable to stop: %s",
@@ -730,7 +939,7 @@ static gboolean gsm_autostart_app_stop(GsmApp *app, GError **error) {
   aapp = GSM_AUTOSTART_APP(app);
 
   priv = gsm_autostart_app_get_instance_private(aapp);
-  g_return_val_if_fail(priv->desktop_file != NULL, FALSE);
+  g_return_val_if_fail(priv->desktop_filename != NULL, FALSE);
 
   switch (priv->launch_type) {
     case AUTOSTART_LAUNCH_SPAWN:
@@ -747,47 +956,115 @@ static gboolean gsm_autostart_app_stop(GsmApp *app, GError **error) {
   return ret;
 }
 
+/* Through the helper, apps going into a scope are spawned stopped; see
+ * gsm_app_scope_attach() */
+static gboolean autostart_app_spawn_argv(GsmAutostartApp *app,
+                                        const char *startup_id,
+                                        gboolean *stopped, GError **error) {
+  char **envp;
+  gboolean success;
+  GsmAutostartAppPrivate *priv;
+
+  priv = gsm_autostart_app_get_instance_private(app);
+
+  envp = g_get_environ();
+  envp = g_environ_setenv(envp, "DESKTOP_AUTOSTART_ID", startup_id, TRUE);
+
+  if (gsm_spawn_helper_is_running()) {
+    *stopped = gsm_app_scope_is_enabled();
+    success = gsm_spawn_helper_spawn(priv->working_dir, priv->exec_argv, envp,
+                                     *stopped, &priv->pid, error);
+    if (success) {
+      priv->child_watch_id = gsm_spawn_helper_child_watch_add(
+          priv->pid, (GChildWatchFunc)app_exited, app);
+    }
+  } else {
+    success = g_spawn_async(priv->working_dir, priv->exec_argv, envp,
+                            G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD,
+                            NULL, NULL, &priv->pid, error);
+    if (success) {
+      priv->child_watch_id =
+          g_child_watch_add(priv->pid, (GChildWatchFunc)app_exited, app);
+    }
+  }
+
+  g_strfreev(envp);
+
+  return success;
+}
+
+/* Terminal and startup notification are handled by egg, which needs the
+ * whole desktop file; it is only kept for the duration of the launch. */
+static gboolean autostart_app_launch_with_egg(GsmAutostartApp *app,
+                                              const char *startup_id,
+                                              GError **error) {
+  char *env[2] = {NULL, NULL};
+  gboolean success;
+  GsmAutostartAppPrivate *priv;
+
+  priv = gsm_autostart_app_get_instance_private(app);
+
+  if (!ensure_desktop_file(app, error)) {
+    return FALSE;
+  }
+
+  env[0] = g_strdup_printf("DESKTOP_AUTOSTART_ID=%s", startup_id);
+
+  success = egg_desktop_file_launch(
+      priv->desktop_file, NULL, error, EGG_DESKTOP_FILE_LAUNCH_PUTENV, env,
+      EGG_DESKTOP_FILE_LAUNCH_FLAGS, G_SPAWN_DO_NOT_REAP_CHILD,
+      EGG_DESKTOP_FILE_LAUNCH_RETURN_PID, &priv->pid,
+      EGG_DESKTOP_FILE_LAUNCH_RETURN_STARTUP_ID, &priv->startup_id, NULL);
+  if (success) {
+    priv->child_watch_id =
+        g_child_watch_add(priv->pid, (GChildWatchFunc)app_exited, app);
+  }
+
+  g_free(env[0]);
+  drop_desktop_file(app);
+
+  return success;
+}
+
+/* What the user waits for at login goes first, the rest can wait until
+ * the desktop is up */
+static GsmAppPriority get_priority(GsmAutostartApp *app) {
+  if (gsm_app_peek_phase(GSM_APP(app)) < GSM_MANAGER_PHASE_APPLICATION) {
+    return GSM_APP_PRIORITY_BOOST;
+  }
+
+  return GSM_APP_PRIORITY_BACKGROUND;
+}
+
 static gboolean autostart_app_start_spawn(GsmAutostartApp *app,
                                           GError **error) {
-  char *env[2] = {NULL, NULL};
   gboolean success;
+  gboolean stopped = FALSE;
   GError *local_error;
   const char *startup_id;
-  char *command;
   GsmAutostartAppPrivate *priv;
 
   startup_id = gsm_app_peek_startup_id(GSM_APP(app));
   g_assert(startup_id != NULL);
   priv = gsm_autostart_app_get_instance_private(app);
 
-  env[0] = g_strdup_printf("DESKTOP_AUTOSTART_ID=%s", startup_id);
-
-  local_error = NULL;
-  command = egg_desktop_file_parse_exec(priv->desktop_file, NULL, &local_error);
-  if (command == NULL) {
-    g_warning("Unable to parse command from  '%s': %s",
-              egg_desktop_file_get_source(priv->desktop_file),
-              local_error->message);
-    g_error_free(local_error);
-  }
-
-  g_debug("GsmAutostartApp: starting %s: command=%s startup-id=%s",
-          priv->desktop_id, command, startup_id);
-  g_free(command);
+  g_debug("GsmAutostartApp: starting %s: startup-id=%s", priv->desktop_id,
+          startup_id);
 
   g_free(priv->startup_id);
+  priv->startup_id = NULL;
   local_error = NULL;
-  success = egg_desktop_file_launch(
-      priv->desktop_file, NULL, &local_error, EGG_DESKTOP_FILE_LAUNCH_PUTENV,
-      env, EGG_DESKTOP_FILE_LAUNCH_FLAGS, G_SPAWN_DO_NOT_REAP_CHILD,
-      EGG_DESKTOP_FILE_LAUNCH_RETURN_PID, &priv->pid,
-      EGG_DESKTOP_FILE_LAUNCH_RETURN_STARTUP_ID, &priv->startup_id, NULL);
-  g_free(env[0]);
+  if (priv->launch_with_egg) {
+    success = autostart_app_launch_with_egg(app, startup_id, &local_error);
+  } else {
+    success =
+        autostart_app_spawn_argv(app, startup_id, &stopped, &local_error);
+  }
 
   if (success) {
     g_debug("GsmAutostartApp: started pid:%d", priv->pid);
-    priv->child_watch_id =
-        g_child_watch_add(priv->pid, (GChildWatchFunc)app_exited, app);
+    gsm_app_scope_attach(priv->desktop_id, priv->pid, get_priority(app),
+                         stopped);
   } else {
     g_set_error(error, GSM_APP_ERROR, GSM_APP_ERROR_START,
                 "Unable to start application: %s", local_error->message);
@@ -797,82 +1074,40 @@ static gboolean autostart_app_start_spawn(GsmAutostartApp *app,
   return success;
 }
 
-static void start_notify(GObject *source_object, GAsyncResult *res,
-                         gpointer data) {
-  GsmAutostartApp *app;
+static void start_notify(GsmApp *app, const GError *error) {
   GsmAutostartAppPrivate *priv;
-  GError *error;
-  GVariant *variant;
-
-  app = data;
-  priv = gsm_autostart_app_get_instance_private(app);
 
-  error = NULL;
-  if (priv->proxy == NULL) return;
+  priv = gsm_autostart_app_get_instance_private(GSM_AUTOSTART_APP(app));
 
-  variant = g_dbus_proxy_call_finish(priv->proxy, res, &error);
-  if (variant == NULL) {
+  if (error != NULL) {
     g_warning("GsmAutostartApp: Error starting application: %s",
               error->message);
-    g_error_free(error);
+    /* Don't hold the phase until its timeout for it */
+    gsm_app_exited(app);
     return;
-  } else {
-    g_debug("GsmAutostartApp: Started application %s", priv->desktop_id);
-    g_variant_unref(variant);
   }
 
-  g_object_unref(priv->proxy);
-  priv->proxy = NULL;
-
-  g_object_unref(priv->connection);
-  priv->connection = NULL;
+  g_debug("GsmAutostartApp: Started application %s", priv->desktop_id);
+  gsm_app_registered(app);
 }
 
 static gboolean autostart_app_start_activate(GsmAutostartApp *app,
                                              GError **error) {
   const char *name;
-  char *path;
-  char *arguments;
-  GError *local_error;
+  guint timeout;
   GsmAutostartAppPrivate *priv;
 
   priv = gsm_autostart_app_get_instance_private(app);
 
-  local_error = NULL;
-  priv->connection = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, &local_error);
-  if (priv->connection == NULL) {
-    if (local_error != NULL) {
-      g_warning("error getting session bus: %s", local_error->message);
-    }
-    g_propagate_error(error, local_error);
-    return FALSE;
-  }
-
   name = gsm_app_peek_startup_id(GSM_APP(app));
   g_assert(name != NULL);
 
-  path = egg_desktop_file_get_string(priv->desktop_file,
-                                     GSM_AUTOSTART_APP_DBUS_PATH_KEY, NULL);
-  if (path == NULL) {
-    /* just pick one? */
-    path = g_strdup("/");
-  }
-
-  arguments = egg_desktop_file_get_string(
-      priv->desktop_file, GSM_AUTOSTART_APP_DBUS_ARGS_KEY, NULL);
-
-  local_error = NULL;
-  priv->proxy = g_dbus_proxy_new_sync(
-      priv->connection, G_DBUS_PROXY_FLAGS_NONE, NULL, name, path,
-      GSM_SESSION_CLIENT_DBUS_INTERFACE, NULL, &local_error);
-  if (priv->proxy == NULL) {
-    g_propagate_error(error, local_error);
-    return FALSE;
-  }
+  /* No startup history is recorded for activated apps, see
+   * gsm_autostart_app_is_activated() */
+  timeout = GSM_AUTOSTART_APP_START_TIMEOUT * 1000;
 
-  g_dbus_proxy_call(priv->proxy, "Start", g_variant_new("(s)", arguments),
-                    G_DBUS_CALL_FLAGS_NONE, -1, NULL,
-                    (GAsyncReadyCallback)start_notify, app);
+  gsm_activation_pipeline_queue(GSM_APP(app), name, priv->dbus_path,
+                                priv->dbus_args, timeout, start_notify);
 
   return TRUE;
 }
@@ -885,7 +1120,11 @@ static gboolean gsm_autostart_app_start(GsmApp *app, GError **error) {
   aapp = GSM_AUTOSTART_APP(app);
   priv = gsm_autostart_app_get_instance_private(aapp);
 
-  g_return_val_if_fail(priv->desktop_file != NULL, FALSE);
+  g_return_val_if_fail(priv->desktop_filename != NULL, FALSE);
+
+  if (!ensure_launch_info(aapp, error)) {
+    return FALSE;
+  }
 
   switch (priv->launch_type) {
     case AUTOSTART_LAUNCH_SPAWN:
@@ -924,9 +1163,6 @@ static gboolean gsm_autostart_app_restart(GsmApp *app, GError **error) {
 }
 
 static gboolean gsm_autostart_app_provides(GsmApp *app, const char *service) {
-  char **provides;
-  gsize len;
-  gsize i;
   GsmAutostartApp *aapp;
   GsmAutostartAppPrivate *priv;
 
@@ -935,25 +1171,11 @@ static gboolean gsm_autostart_app_provides(GsmApp *app, const char *service) {
   aapp = GSM_AUTOSTART_APP(app);
   priv = gsm_autostart_app_get_instance_private(aapp);
 
-  if (priv->desktop_file == NULL) {
-    return FALSE;
-  }
-
-  provides = egg_desktop_file_get_string_list(
-      priv->desktop_file, GSM_AUTOSTART_APP_PROVIDES_KEY, &len, NULL);
-  if (!provides) {
+  if (priv->provides == NULL) {
     return FALSE;
   }
 
-  for (i = 0; i < len; i++) {
-    if (!strcmp(provides[i], service)) {
-      g_strfreev(provides);
-      return TRUE;
-    }
-  }
-
-  g_strfreev(provides);
-  return FALSE;
+  return g_strv_contains((const char *const *)priv->provides, service);
 }
 
 static gboolean gsm_autostart_app_has_autostart_condition(
@@ -979,47 +1201,35 @@ static gboolean gsm_autostart_app_has_autostart_condition(
 }
 
 static gboolean gsm_autostart_app_get_autorestart(GsmApp *app) {
-  gboolean res;
-  gboolean autorestart;
   GsmAutostartAppPrivate *priv;
 
   priv = gsm_autostart_app_get_instance_private(GSM_AUTOSTART_APP(app));
 
-  if (priv->desktop_file == NULL) {
-    return FALSE;
-  }
+  return priv->autorestart;
+}
 
-  autorestart = FALSE;
+static const char *gsm_autostart_app_get_app_id(GsmApp *app) {
+  GsmAutostartAppPrivate *priv;
 
-  res = egg_desktop_file_has_key(priv->desktop_file,
-                                 GSM_AUTOSTART_APP_AUTORESTART_KEY, NULL);
-  if (res) {
-    autorestart = egg_desktop_file_get_boolean(
-        priv->desktop_file, GSM_AUTOSTART_APP_AUTORESTART_KEY, NULL);
-  }
+  priv = gsm_autostart_app_get_instance_private(GSM_AUTOSTART_APP(app));
 
-  return autorestart;
+  return priv->app_id;
 }
 
-static const char *gsm_autostart_app_get_app_id(GsmApp *app) {
-  const char *location;
-  const char *slash;
+static const char *const *gsm_autostart_app_peek_provides(GsmApp *app) {
   GsmAutostartAppPrivate *priv;
 
   priv = gsm_autostart_app_get_instance_private(GSM_AUTOSTART_APP(app));
 
-  if (priv->desktop_file == NULL) {
-    return NULL;
-  }
+  return (const char *const *)priv->provides;
+}
 
-  location = egg_desktop_file_get_source(priv->desktop_file);
+static const char *const *gsm_autostart_app_peek_after(GsmApp *app) {
+  GsmAutostartAppPrivate *priv;
 
-  slash = strrchr(location, '/');
-  if (slash != NULL) {
-    return slash + 1;
-  } else {
-    return location;
-  }
+  priv = gsm_autostart_app_get_instance_private(GSM_AUTOSTART_APP(app));
+
+  return (const char *const *)priv->after;
 }
 
 static int gsm_autostart_app_peek_autostart_delay(GsmApp *app) {
@@ -1031,6 +1241,14 @@ static int gsm_autostart_app_peek_autostart_delay(GsmApp *app) {
   return priv->autostart_delay;
 }
 
+static int gsm_autostart_app_peek_restore_priority(GsmApp *app) {
+  GsmAutostartAppPrivate *priv;
+
+  priv = gsm_autostart_app_get_instance_private(GSM_AUTOSTART_APP(app));
+
+  return priv->restore_priority;
+}
+
 static GObject *gsm_autostart_app_constructor(
     GType type, guint n_construct_properties,
     GObjectConstructParam *construct_properties) {
@@ -1069,23 +1287,212 @@ static void gsm_autostart_app_class_init(GsmAutostartAppClass *klass) {
   app_class->impl_get_app_id = gsm_autostart_app_get_app_id;
   app_class->impl_get_autorestart = gsm_autostart_app_get_autorestart;
   app_class->impl_peek_autostart_delay = gsm_autostart_app_peek_autostart_delay;
+  app_class->impl_peek_restore_priority =
+      gsm_autostart_app_peek_restore_priority;
+  app_class->impl_peek_after = gsm_autostart_app_peek_after;
+  app_class->impl_peek_provides = gsm_autostart_app_peek_provides;
 
   g_object_class_install_property(
       object_class, PROP_DESKTOP_FILENAME,
       g_param_spec_string("desktop-filename", "Desktop filename",
                           "Freedesktop .desktop file", NULL,
                           G_PARAM_READWRITE | G_PARAM_CONSTRUCT));
+  g_object_class_install_property(
+      object_class, PROP_CACHED_INFO,
+      g_param_spec_variant("cached-info", "Cached info",
+                           "Previously parsed desktop file state",
+                           G_VARIANT_TYPE(GSM_AUTOSTART_INFO_TYPE), NULL,
+                           G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY));
+  g_object_class_install_property(
+      object_class, PROP_CONDITION_MONITOR,
+      g_param_spec_object("condition-monitor", "Condition monitor",
+                          "Shared monitor for AutostartCondition",
+                          GSM_TYPE_CONDITION_MONITOR,
+                          G_PARAM_WRITABLE | G_PARAM_CONSTRUCT_ONLY));
   signals[CONDITION_CHANGED] = g_signal_new(
       "condition-changed", G_OBJECT_CLASS_TYPE(object_class), G_SIGNAL_RUN_LAST,
       G_STRUCT_OFFSET(GsmAutostartAppClass, condition_changed), NULL, NULL,
       g_cclosure_marshal_VOID__BOOLEAN, G_TYPE_NONE, 1, G_TYPE_BOOLEAN);
 }
 
-GsmApp *gsm_autostart_app_new(const char *desktop_file) {
+/* @monitor watches the AutostartCondition of the app; apps created with
+ * NULL only evaluate it once */
+GsmApp *gsm_autostart_app_new(const char *desktop_file,
+                              GsmConditionMonitor *monitor) {
   GsmAutostartApp *app;
 
   app = g_object_new(GSM_TYPE_AUTOSTART_APP, "desktop-filename", desktop_file,
-                     NULL);
+                     "condition-monitor", monitor, NULL);
 
   return GSM_APP(app);
 }
+
+GsmApp *gsm_autostart_app_new_from_cache(const char *desktop_file,
+                                         GVariant *info,
+                                         GsmConditionMonitor *monitor) {
+  GsmAutostartApp *app;
+
+  if (!g_variant_is_of_type(info,
+                            G_VARIANT_TYPE(GSM_AUTOSTART_INFO_TYPE))) {
+    return NULL;
+  }
+
+  app = g_object_new(GSM_TYPE_AUTOSTART_APP, "desktop-filename", desktop_file,
+                     "cached-info", info, "condition-monitor", monitor, NULL);
+
+  return GSM_APP(app);
+}
+
+/* Whether the app is started by D-Bus activation. The reply to its Start
+ * call counts as it having registered, which says nothing about how long
+ * the app itself takes to start, so it is kept out of the startup history.
+ */
+gboolean gsm_autostart_app_is_activated(GsmAutostartApp *app) {
+  GsmAutostartAppPrivate *priv;
+
+  g_return_val_if_fail(GSM_IS_AUTOSTART_APP(app), FALSE);
+
+  priv = gsm_autostart_app_get_instance_private(app);
+
+  return priv->launch_type == AUTOSTART_LAUNCH_ACTIVATE;
+}
+
+/* Overrides the restore priority of a client of the saved session */
+void gsm_autostart_app_set_restore_priority(GsmAutostartApp *app,
+                                            int priority) {
+  GsmAutostartAppPrivate *priv;
+
+  g_return_if_fail(GSM_IS_AUTOSTART_APP(app));
+
+  priv = gsm_autostart_app_get_instance_private(app);
+
+  priv->restore_priority = priority;
+}
+
+/* Returns the pid of the spawned app, or -1 if it is not running or was
+ * activated over D-Bus. */
+GPid gsm_autostart_app_peek_pid(GsmAutostartApp *app) {
+  GsmAutostartAppPrivate *priv;
+
+  g_return_val_if_fail(GSM_IS_AUTOSTART_APP(app), -1);
+
+  priv = gsm_autostart_app_get_instance_private(app);
+
+  return priv->pid;
+}
+
+static void on_demand_name_appeared(GDBusConnection *connection,
+                                    const char *name, const char *name_owner,
+                                    gpointer data) {
+  GsmAutostartApp *app = data;
+  GsmAutostartAppPrivate *priv;
+  GError *error;
+
+  priv = gsm_autostart_app_get_instance_private(app);
+
+  g_debug("GsmAutostartApp: %s was activated, starting %s", name,
+          priv->desktop_id);
+
+  g_bus_unwatch_name(priv->on_demand_watch_id);
+  priv->on_demand_watch_id = 0;
+
+  error = NULL;
+  if (!gsm_app_start(GSM_APP(app), &error)) {
+    g_warning("Could not start application '%s': %s", priv->desktop_id,
+              error->message);
+    g_error_free(error);
+  }
+}
+
+/* Instead of starting an on demand app, waits for its D-Bus name to be
+ * activated by whoever talks to it first and only then starts it. Returns
+ * FALSE if the app has to be started right away. */
+gboolean gsm_autostart_app_start_on_demand(GsmAutostartApp *app) {
+  GsmAutostartAppPrivate *priv;
+
+  g_return_val_if_fail(GSM_IS_AUTOSTART_APP(app), FALSE);
+
+  priv = gsm_autostart_app_get_instance_private(app);
+
+  if (!priv->on_demand || priv->launch_type != AUTOSTART_LAUNCH_ACTIVATE ||
+      gsm_app_peek_phase(GSM_APP(app)) != GSM_MANAGER_PHASE_APPLICATION) {
+    return FALSE;
+  }
+
+  if (priv->on_demand_watch_id == 0) {
+    priv->on_demand_watch_id = g_bus_watch_name(
+        G_BUS_TYPE_SESSION, priv->dbus_name, G_BUS_NAME_WATCHER_FLAGS_NONE,
+        on_demand_name_appeared, NULL, app, NULL);
+  }
+
+  return TRUE;
+}
+
+/* Stops waiting for the D-Bus name of an app started on demand */
+void gsm_autostart_app_cancel_on_demand(GsmAutostartApp *app) {
+  GsmAutostartAppPrivate *priv;
+
+  g_return_if_fail(GSM_IS_AUTOSTART_APP(app));
+
+  priv = gsm_autostart_app_get_instance_private(app);
+
+  if (priv->on_demand_watch_id > 0) {
+    g_debug("GsmAutostartApp: no longer waiting for %s", priv->dbus_name);
+    g_bus_unwatch_name(priv->on_demand_watch_id);
+    priv->on_demand_watch_id = 0;
+  }
+}
+
+static GVariant *serialize_display(GsmAutostartApp *app) {
+  GsmAutostartAppPrivate *priv;
+  GVariant *display;
+  GError *error;
+
+  priv = gsm_autostart_app_get_instance_private(app);
+
+  if (priv->display != NULL) {
+    return g_steal_pointer(&priv->display);
+  }
+
+  error = NULL;
+  if (!ensure_desktop_file(app, &error)) {
+    g_warning("Could not parse desktop file %s: %s", priv->desktop_filename,
+              error->message);
+    g_error_free(error);
+    return g_variant_ref_sink(g_variant_new(
+        GSM_AUTOSTART_CACHE_DISPLAY_TYPE, g_get_language_names()[0], NULL,
+        NULL, NULL, NULL, priv->hidden, FALSE, priv->shows_in,
+        priv->autostart_delay));
+  }
+
+  display = gsm_autostart_info_new_display(priv->desktop_file);
+  drop_desktop_file(app);
+
+  return display;
+}
+
+GVariant *gsm_autostart_app_serialize(GsmAutostartApp *app) {
+  GsmAutostartAppPrivate *priv;
+  const char *const no_strings[] = {NULL};
+  GVariant *display;
+  GVariant *info;
+
+  g_return_val_if_fail(GSM_IS_AUTOSTART_APP(app), NULL);
+
+  priv = gsm_autostart_app_get_instance_private(app);
+
+  display = serialize_display(app);
+  info = g_variant_new(
+      GSM_AUTOSTART_INFO_FORMAT, gsm_app_peek_phase(GSM_APP(app)),
+      priv->autostart_startup_id, priv->dbus_name, priv->condition_string,
+      priv->autostart_delay, priv->autorestart, priv->hidden, priv->shows_in,
+      priv->try_exec, priv->try_exec_path,
+      priv->provides != NULL ? (const char *const *)priv->provides
+                             : no_strings,
+      priv->after != NULL,
+      priv->after != NULL ? (const char *const *)priv->after : no_strings,
+      priv->restore_priority, priv->on_demand, display);
+  g_variant_unref(display);
+
+  return info;
+}
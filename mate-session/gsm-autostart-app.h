@@ -28,6 +28,7 @@
 #include <glib.h>
 
 #include "gsm-app.h"
+#include "gsm-condition-monitor.h"
 
 G_BEGIN_DECLS
 
@@ -42,7 +43,19 @@ struct _GsmAutostartAppClass {
   void (*condition_changed)(GsmApp *app, gboolean condition);
 };
 
-GsmApp *gsm_autostart_app_new(const char *desktop_file);
+GsmApp *gsm_autostart_app_new(const char *desktop_file,
+                              GsmConditionMonitor *monitor);
+GsmApp *gsm_autostart_app_new_from_cache(const char *desktop_file,
+                                         GVariant *info,
+                                         GsmConditionMonitor *monitor);
+
+GVariant *gsm_autostart_app_serialize(GsmAutostartApp *app);
+void gsm_autostart_app_set_restore_priority(GsmAutostartApp *app,
+                                            int priority);
+GPid gsm_autostart_app_peek_pid(GsmAutostartApp *app);
+gboolean gsm_autostart_app_is_activated(GsmAutostartApp *app);
+gboolean gsm_autostart_app_start_on_demand(GsmAutostartApp *app);
+void gsm_autostart_app_cancel_on_demand(GsmAutostartApp *app);
 
 #define GSM_AUTOSTART_APP_PHASE_KEY "X-MATE-Autostart-Phase"
 #define GSM_AUTOSTART_APP_PROVIDES_KEY "X-MATE-Provides"
@@ -53,6 +66,9 @@ GsmApp *gsm_autostart_app_new(const char *desktop_file);
 #define GSM_AUTOSTART_APP_DBUS_ARGS_KEY "X-MATE-DBus-Start-Arguments"
 #define GSM_AUTOSTART_APP_DISCARD_KEY "X-MATE-Autostart-discard-exec"
 #define GSM_AUTOSTART_APP_DELAY_KEY "X-MATE-Autostart-Delay"
+#define GSM_AUTOSTART_APP_AFTER_KEY "X-MATE-Autostart-After"
+#define GSM_AUTOSTART_APP_RESTORE_PRIORITY_KEY "X-MATE-Restore-Priority"
+#define GSM_AUTOSTART_APP_ON_DEMAND_KEY "X-MATE-Autostart-OnDemand"
 
 G_END_DECLS
 
@@ -0,0 +1,511 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gsm-autostart-cache.h"
+
+#include <errno.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+/* The cache keeps, for every directory we scanned, the list of .desktop
+ * files it contained and the parsed app info of each of them, keyed by
+ * file name and validated against mtime/inode/size.  It is read once with
+ * mmap at startup and rewritten after the session is running.
+ *
+ * mate-session-properties only ever reads it.
+ *
+ * Below it there can be a system-wide cache of the same format, built by
+ * mate-session-update-cache for the system autostart directories and
+ * shared read-only by all the sessions of the host. What is found there
+ * is not copied into the cache of the user, which only keeps what the
+ * system cache does not have: their own autostart directory, and the
+ * files that changed since mate-session-update-cache last ran.
+ */
+#define CACHE_MAGIC 0x4d534143 /* "MSAC" */
+#define CACHE_VERSION 4
+#define CACHE_ENTRY_TYPE "(sxttv)"
+#define CACHE_DIR_TYPE "(sxasa" CACHE_ENTRY_TYPE ")"
+#define CACHE_TYPE "(uua" CACHE_DIR_TYPE ")"
+
+typedef struct {
+  gint64 mtime;
+  char **names;
+  GHashTable *entries; /* name -> CACHE_ENTRY_TYPE GVariant */
+} CacheDir;
+
+static gboolean cache_loaded = FALSE;
+static gboolean cache_closed = FALSE;
+static gboolean cache_dirty = FALSE;
+static GMappedFile *cache_file = NULL;
+static GHashTable *old_dirs = NULL;
+static GHashTable *new_dirs = NULL;
+static GMappedFile *system_file = NULL;
+static GHashTable *system_dirs = NULL;
+static GHashTable *system_served = NULL; /* dirs listed from system_dirs */
+static gboolean building_system = FALSE;
+
+static gint64 stat_mtime(const struct stat *st) {
+  return (gint64)st->st_mtim.tv_sec * G_USEC_PER_SEC +
+         st->st_mtim.tv_nsec / 1000;
+}
+
+static CacheDir *cache_dir_new(gint64 mtime) {
+  CacheDir *cd;
+
+  cd = g_slice_new0(CacheDir);
+  cd->mtime = mtime;
+  cd->entries = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                      (GDestroyNotify)g_variant_unref);
+
+  return cd;
+}
+
+static void cache_dir_free(CacheDir *cd) {
+  g_strfreev(cd->names);
+  g_hash_table_destroy(cd->entries);
+  g_slice_free(CacheDir, cd);
+}
+
+static char *get_cache_filename(void) {
+  return g_build_filename(g_get_user_cache_dir(), "mate-session",
+                          "autostart-cache", NULL);
+}
+
+static char *get_system_cache_filename(void) {
+  return g_build_filename(SYSTEM_CACHE_DIR, "autostart-cache", NULL);
+}
+
+static void cache_load_dirs(GHashTable *loaded, GVariant *dirs) {
+  gsize i;
+  gsize n;
+
+  n = g_variant_n_children(dirs);
+  for (i = 0; i < n; i++) {
+    GVariant *dir;
+    GVariant *entries;
+    const char *path;
+    gint64 mtime;
+    char **names;
+    CacheDir *cd;
+    gsize j;
+    gsize n_entries;
+
+    dir = g_variant_get_child_value(dirs, i);
+    g_variant_get(dir, "(&sx^as@a" CACHE_ENTRY_TYPE ")", &path, &mtime,
+                  &names, &entries);
+
+    cd = cache_dir_new(mtime);
+    cd->names = names;
+
+    n_entries = g_variant_n_children(entries);
+    for (j = 0; j < n_entries; j++) {
+      GVariant *entry;
+      const char *name;
+
+      entry = g_variant_get_child_value(entries, j);
+      g_variant_get_child(entry, 0, "&s", &name);
+      g_hash_table_replace(cd->entries, g_strdup(name), entry);
+    }
+
+    g_hash_table_replace(loaded, g_strdup(path), cd);
+
+    g_variant_unref(entries);
+    g_variant_unref(dir);
+  }
+}
+
+static GHashTable *cache_dirs_new(void) {
+  return g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                               (GDestroyNotify)cache_dir_free);
+}
+
+/* Maps @filename and adds the directories it has to @loaded */
+static GMappedFile *cache_map(const char *filename, GHashTable *loaded) {
+  GMappedFile *file;
+  GError *error;
+  GBytes *bytes;
+  GVariant *root;
+  GVariant *dirs;
+  guint32 magic;
+  guint32 version;
+
+  error = NULL;
+  file = g_mapped_file_new(filename, FALSE, &error);
+  if (file == NULL) {
+    g_debug("GsmAutostartCache: Unable to open %s: %s", filename,
+            error->message);
+    g_error_free(error);
+    return NULL;
+  }
+
+  bytes = g_mapped_file_get_bytes(file);
+  root = g_variant_new_from_bytes(G_VARIANT_TYPE(CACHE_TYPE), bytes, FALSE);
+  g_variant_ref_sink(root);
+  g_bytes_unref(bytes);
+
+  g_variant_get(root, "(uu@a" CACHE_DIR_TYPE ")", &magic, &version, &dirs);
+  if (magic != CACHE_MAGIC || version != CACHE_VERSION) {
+    g_debug("GsmAutostartCache: Ignoring %s: unknown format", filename);
+  } else {
+    cache_load_dirs(loaded, dirs);
+    g_debug("GsmAutostartCache: Loaded %u directories from %s",
+            g_hash_table_size(loaded), filename);
+  }
+
+  g_variant_unref(dirs);
+  g_variant_unref(root);
+
+  return file;
+}
+
+static void cache_load(void) {
+  char *filename;
+
+  if (cache_loaded) {
+    return;
+  }
+
+  cache_loaded = TRUE;
+
+  old_dirs = cache_dirs_new();
+  new_dirs = cache_dirs_new();
+  system_dirs = cache_dirs_new();
+  system_served = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+  /* The system cache is rebuilt from scratch */
+  if (building_system) {
+    return;
+  }
+
+  filename = get_system_cache_filename();
+  system_file = cache_map(filename, system_dirs);
+  g_free(filename);
+
+  filename = get_cache_filename();
+  cache_file = cache_map(filename, old_dirs);
+  g_free(filename);
+}
+
+static gboolean entry_matches(GVariant *entry, const struct stat *st) {
+  gint64 mtime;
+  guint64 ino;
+  guint64 size;
+
+  g_variant_get(entry, "(&sxttv)", NULL, &mtime, &ino, &size, NULL);
+
+  return mtime == stat_mtime(st) && ino == (guint64)st->st_ino &&
+         size == (guint64)st->st_size;
+}
+
+static CacheDir *get_new_dir(const char *dir) {
+  CacheDir *cd;
+
+  cd = g_hash_table_lookup(new_dirs, dir);
+  if (cd == NULL) {
+    /* Files that are loaded by path rather than by scanning their
+     * directory only get their entries cached, never the listing.
+     */
+    cd = cache_dir_new(-1);
+    g_hash_table_insert(new_dirs, g_strdup(dir), cd);
+  }
+
+  return cd;
+}
+
+/* Returns the cached list of .desktop files of @dir, or NULL if the
+ * directory changed since it was cached and needs to be read again.
+ */
+char **gsm_autostart_cache_list_dir(const char *dir,
+                                    const struct stat *dir_st) {
+  CacheDir *cd;
+
+  cache_load();
+
+  if (cache_closed) {
+    return NULL;
+  }
+
+  cd = g_hash_table_lookup(system_dirs, dir);
+  if (cd == NULL || cd->names == NULL || cd->mtime != stat_mtime(dir_st)) {
+    cd = g_hash_table_lookup(old_dirs, dir);
+  }
+
+  if (cd == NULL || cd->names == NULL || cd->mtime != stat_mtime(dir_st)) {
+    return NULL;
+  }
+
+  return g_strdupv(cd->names);
+}
+
+void gsm_autostart_cache_begin_dir(const char *dir, const struct stat *dir_st,
+                                   char **names) {
+  CacheDir *old_cd;
+  CacheDir *cd;
+
+  cache_load();
+
+  if (cache_closed) {
+    return;
+  }
+
+  /* A directory the system cache is up to date on is left out of ours,
+   * along with what we had about it before */
+  cd = g_hash_table_lookup(system_dirs, dir);
+  if (cd != NULL && cd->names != NULL && cd->mtime == stat_mtime(dir_st) &&
+      g_strv_equal((const char *const *)cd->names,
+                   (const char *const *)names)) {
+    g_hash_table_add(system_served, g_strdup(dir));
+    if (g_hash_table_contains(old_dirs, dir)) {
+      cache_dirty = TRUE;
+    }
+    return;
+  }
+
+  old_cd = g_hash_table_lookup(old_dirs, dir);
+  if (old_cd == NULL || old_cd->mtime != stat_mtime(dir_st)) {
+    cache_dirty = TRUE;
+  }
+
+  cd = g_hash_table_lookup(new_dirs, dir);
+  if (cd == NULL) {
+    cd = cache_dir_new(stat_mtime(dir_st));
+    g_hash_table_insert(new_dirs, g_strdup(dir), cd);
+  } else {
+    cd->mtime = stat_mtime(dir_st);
+    g_strfreev(cd->names);
+  }
+
+  cd->names = g_strdupv(names);
+}
+
+GVariant *gsm_autostart_cache_lookup(const char *dir, const char *name,
+                                     const struct stat *st) {
+  CacheDir *cd;
+  GVariant *entry;
+  GVariant *info;
+
+  cache_load();
+
+  if (cache_closed) {
+    return NULL;
+  }
+
+  /* Entries of the system cache are used from where they are */
+  cd = g_hash_table_lookup(system_dirs, dir);
+  entry = cd != NULL ? g_hash_table_lookup(cd->entries, name) : NULL;
+  if (entry != NULL && entry_matches(entry, st)) {
+    g_variant_get_child(entry, 4, "v", &info);
+    return info;
+  }
+
+  cd = g_hash_table_lookup(old_dirs, dir);
+  if (cd == NULL) {
+    return NULL;
+  }
+
+  entry = g_hash_table_lookup(cd->entries, name);
+  if (entry == NULL || !entry_matches(entry, st)) {
+    return NULL;
+  }
+
+  g_hash_table_replace(get_new_dir(dir)->entries, g_strdup(name),
+                       g_variant_ref(entry));
+
+  g_variant_get_child(entry, 4, "v", &info);
+
+  return info;
+}
+
+void gsm_autostart_cache_insert(const char *dir, const char *name,
+                                const struct stat *st, GVariant *info) {
+  GVariant *entry;
+
+  cache_load();
+
+  if (cache_closed) {
+    g_variant_unref(g_variant_ref_sink(info));
+    return;
+  }
+
+  entry = g_variant_new("(sxttv)", name, stat_mtime(st), (guint64)st->st_ino,
+                        (guint64)st->st_size, info);
+  g_hash_table_replace(get_new_dir(dir)->entries, g_strdup(name),
+                       g_variant_ref_sink(entry));
+
+  cache_dirty = TRUE;
+}
+
+static GVariant *cache_dir_to_variant(const char *path, CacheDir *cd) {
+  GVariantBuilder entries;
+  GHashTableIter iter;
+  gpointer value;
+  const char *const no_names[] = {NULL};
+
+  g_variant_builder_init(&entries, G_VARIANT_TYPE("a" CACHE_ENTRY_TYPE));
+
+  g_hash_table_iter_init(&iter, cd->entries);
+  while (g_hash_table_iter_next(&iter, NULL, &value)) {
+    g_variant_builder_add_value(&entries, value);
+  }
+
+  return g_variant_new("(sx^as@a" CACHE_ENTRY_TYPE ")", path, cd->mtime,
+                       cd->names != NULL ? (const char *const *)cd->names
+                                         : no_names,
+                       g_variant_builder_end(&entries));
+}
+
+static GVariant *cache_to_variant(void) {
+  GVariantBuilder dirs;
+  GHashTableIter iter;
+  gpointer key;
+  gpointer value;
+  GVariant *root;
+
+  g_variant_builder_init(&dirs, G_VARIANT_TYPE("a" CACHE_DIR_TYPE));
+
+  g_hash_table_iter_init(&iter, new_dirs);
+  while (g_hash_table_iter_next(&iter, &key, &value)) {
+    g_variant_builder_add_value(&dirs, cache_dir_to_variant(key, value));
+  }
+
+  /* Keep what we know about directories that were not looked at during
+   * this login (e.g. because of --autostart), so that they stay warm.
+   */
+  g_hash_table_iter_init(&iter, old_dirs);
+  while (g_hash_table_iter_next(&iter, &key, &value)) {
+    if (!g_hash_table_contains(new_dirs, key) &&
+        !g_hash_table_contains(system_served, key)) {
+      g_variant_builder_add_value(&dirs, cache_dir_to_variant(key, value));
+    }
+  }
+
+  root = g_variant_new("(uu@a" CACHE_DIR_TYPE ")", CACHE_MAGIC, CACHE_VERSION,
+                       g_variant_builder_end(&dirs));
+
+  return g_variant_ref_sink(root);
+}
+
+static gboolean cache_write_file(const char *filename, int dir_mode,
+                                 GError **error) {
+  GVariant *root;
+  char *dirname;
+  gboolean ret;
+
+  dirname = g_path_get_dirname(filename);
+  if (g_mkdir_with_parents(dirname, dir_mode) != 0) {
+    g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                "Unable to create %s: %s", dirname, g_strerror(errno));
+    g_free(dirname);
+    return FALSE;
+  }
+  g_free(dirname);
+
+  root = cache_to_variant();
+  ret = g_file_set_contents(filename, g_variant_get_data(root),
+                            g_variant_get_size(root), error);
+  g_variant_unref(root);
+
+  return ret;
+}
+
+static void cache_write(void) {
+  char *filename;
+  GError *error;
+
+  filename = get_cache_filename();
+
+  error = NULL;
+  if (!cache_write_file(filename, 0700, &error)) {
+    g_warning("GsmAutostartCache: Unable to write %s: %s", filename,
+              error->message);
+    g_error_free(error);
+  } else {
+    g_debug("GsmAutostartCache: Wrote %s", filename);
+  }
+
+  g_free(filename);
+}
+
+/* Writes the cache back if anything changed and releases it. Lookups
+ * after this point always miss.
+ */
+void gsm_autostart_cache_flush(void) {
+  if (!cache_loaded || cache_closed) {
+    return;
+  }
+
+  cache_closed = TRUE;
+
+  if (cache_dirty) {
+    cache_write();
+  }
+
+  g_hash_table_destroy(new_dirs);
+  new_dirs = NULL;
+  g_hash_table_destroy(old_dirs);
+  old_dirs = NULL;
+  g_hash_table_destroy(system_dirs);
+  system_dirs = NULL;
+  g_hash_table_destroy(system_served);
+  system_served = NULL;
+
+  if (cache_file != NULL) {
+    g_mapped_file_unref(cache_file);
+    cache_file = NULL;
+  }
+
+  if (system_file != NULL) {
+    g_mapped_file_unref(system_file);
+    system_file = NULL;
+  }
+}
+
+/* Makes the cache start out empty, for mate-session-update-cache to fill
+ * it with the system directories and write it with
+ * gsm_autostart_cache_write_system(). */
+void gsm_autostart_cache_begin_system(void) {
+  g_return_if_fail(!cache_loaded);
+
+  building_system = TRUE;
+  cache_load();
+}
+
+gboolean gsm_autostart_cache_write_system(GError **error) {
+  char *filename;
+  gboolean ret;
+
+  g_return_val_if_fail(building_system && !cache_closed, FALSE);
+
+  filename = get_system_cache_filename();
+  ret = cache_write_file(filename, 0755, error);
+  if (ret && g_chmod(filename, 0644) != 0) {
+    g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                "Unable to make %s readable: %s", filename, g_strerror(errno));
+    ret = FALSE;
+  }
+  g_free(filename);
+
+  return ret;
+}
@@ -0,0 +1,51 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifndef __GSM_AUTOSTART_CACHE_H__
+#define __GSM_AUTOSTART_CACHE_H__
+
+#include <glib.h>
+#include <sys/stat.h>
+
+G_BEGIN_DECLS
+
+/* The last member of every cached app info: what mate-session-properties
+ * shows of the file, so that it can use the cache too.  Language of the
+ * strings, Name, Comment, Exec, Icon, Hidden, NoDisplay, shows-in-MATE
+ * and X-MATE-Autostart-Delay. */
+#define GSM_AUTOSTART_CACHE_DISPLAY_TYPE "(smsmsmsmsbbbi)"
+
+char **gsm_autostart_cache_list_dir(const char *dir, const struct stat *dir_st);
+void gsm_autostart_cache_begin_dir(const char *dir, const struct stat *dir_st,
+                                   char **names);
+
+GVariant *gsm_autostart_cache_lookup(const char *dir, const char *name,
+                                     const struct stat *st);
+void gsm_autostart_cache_insert(const char *dir, const char *name,
+                                const struct stat *st, GVariant *info);
+
+void gsm_autostart_cache_flush(void);
+
+void gsm_autostart_cache_begin_system(void);
+gboolean gsm_autostart_cache_write_system(GError **error);
+
+G_END_DECLS
+
+#endif /* __GSM_AUTOSTART_CACHE_H__ */
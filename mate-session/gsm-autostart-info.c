@@ -0,0 +1,225 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gsm-autostart-info.h"
+
+#include <string.h>
+
+#include <glib.h>
+
+#include "gsm-autostart-app.h"
+#include "gsm-manager.h"
+
+/* Parsing the desktop file does not need any of the session, so that
+ * mate-session-update-cache can build the system cache from this alone.
+ */
+
+static gboolean desktop_file_shows_in_mate(EggDesktopFile *desktop_file) {
+  EggDesktopFileType type;
+  char **list;
+  gboolean found;
+
+  type = egg_desktop_file_get_desktop_file_type(desktop_file);
+  if (type != EGG_DESKTOP_FILE_TYPE_APPLICATION &&
+      type != EGG_DESKTOP_FILE_TYPE_LINK) {
+    return FALSE;
+  }
+
+  list = egg_desktop_file_get_string_list(
+      desktop_file, EGG_DESKTOP_FILE_KEY_ONLY_SHOW_IN, NULL, NULL);
+  if (list != NULL) {
+    found = g_strv_contains((const char *const *)list, "MATE");
+    g_strfreev(list);
+    if (!found) {
+      return FALSE;
+    }
+  }
+
+  list = egg_desktop_file_get_string_list(
+      desktop_file, EGG_DESKTOP_FILE_KEY_NOT_SHOW_IN, NULL, NULL);
+  if (list != NULL) {
+    found = g_strv_contains((const char *const *)list, "MATE");
+    g_strfreev(list);
+    if (found) {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+static int get_phase(EggDesktopFile *desktop_file) {
+  char *phase_str;
+  int phase;
+
+  phase_str = egg_desktop_file_get_string(desktop_file,
+                                          GSM_AUTOSTART_APP_PHASE_KEY, NULL);
+  if (phase_str == NULL) {
+    return GSM_MANAGER_PHASE_APPLICATION;
+  }
+
+  if (strcmp(phase_str, "Initialization") == 0) {
+    phase = GSM_MANAGER_PHASE_INITIALIZATION;
+  } else if (strcmp(phase_str, "WindowManager") == 0) {
+    phase = GSM_MANAGER_PHASE_WINDOW_MANAGER;
+  } else if (strcmp(phase_str, "Panel") == 0) {
+    phase = GSM_MANAGER_PHASE_PANEL;
+  } else if (strcmp(phase_str, "Desktop") == 0) {
+    phase = GSM_MANAGER_PHASE_DESKTOP;
+  } else {
+    phase = GSM_MANAGER_PHASE_APPLICATION;
+  }
+
+  g_free(phase_str);
+
+  return phase;
+}
+
+GVariant *gsm_autostart_info_new_display(EggDesktopFile *desktop_file) {
+  char *name;
+  char *comment;
+  char *exec;
+  char *icon;
+  GVariant *display;
+
+  name = egg_desktop_file_get_locale_string(
+      desktop_file, EGG_DESKTOP_FILE_KEY_NAME, NULL, NULL);
+  comment = egg_desktop_file_get_locale_string(
+      desktop_file, EGG_DESKTOP_FILE_KEY_COMMENT, NULL, NULL);
+  exec = egg_desktop_file_get_string(desktop_file, EGG_DESKTOP_FILE_KEY_EXEC,
+                                     NULL);
+  icon = egg_desktop_file_get_locale_string(
+      desktop_file, EGG_DESKTOP_FILE_KEY_ICON, NULL, NULL);
+
+  display = g_variant_new(
+      GSM_AUTOSTART_CACHE_DISPLAY_TYPE, g_get_language_names()[0], name,
+      comment, exec, icon,
+      egg_desktop_file_get_boolean(desktop_file, EGG_DESKTOP_FILE_KEY_HIDDEN,
+                                   NULL),
+      egg_desktop_file_get_boolean(desktop_file,
+                                   EGG_DESKTOP_FILE_KEY_NO_DISPLAY, NULL),
+      desktop_file_shows_in_mate(desktop_file),
+      egg_desktop_file_get_integer(desktop_file, GSM_AUTOSTART_APP_DELAY_KEY,
+                                   NULL));
+
+  g_free(name);
+  g_free(comment);
+  g_free(exec);
+  g_free(icon);
+
+  return g_variant_ref_sink(display);
+}
+
+/* Returns a floating reference; @desktop_id is only used in warnings */
+GVariant *gsm_autostart_info_new(EggDesktopFile *desktop_file,
+                                 const char *desktop_id) {
+  const char *const no_strings[] = {NULL};
+  int phase;
+  char *startup_id;
+  char *dbus_name;
+  char *condition_string;
+  int delay = -1;
+  gboolean autorestart = FALSE;
+  char *try_exec = NULL;
+  char **provides;
+  char **after;
+  int restore_priority = -1;
+  gboolean on_demand = FALSE;
+  GVariant *display;
+  GVariant *info;
+
+  phase = get_phase(desktop_file);
+
+  dbus_name = egg_desktop_file_get_string(
+      desktop_file, GSM_AUTOSTART_APP_DBUS_NAME_KEY, NULL);
+  startup_id = egg_desktop_file_get_string(
+      desktop_file, GSM_AUTOSTART_APP_STARTUP_ID_KEY, NULL);
+
+  if (egg_desktop_file_has_key(desktop_file,
+                               GSM_AUTOSTART_APP_AUTORESTART_KEY, NULL)) {
+    autorestart = egg_desktop_file_get_boolean(
+        desktop_file, GSM_AUTOSTART_APP_AUTORESTART_KEY, NULL);
+  }
+
+  if (egg_desktop_file_get_desktop_file_type(desktop_file) ==
+      EGG_DESKTOP_FILE_TYPE_APPLICATION) {
+    try_exec = egg_desktop_file_get_string(
+        desktop_file, EGG_DESKTOP_FILE_KEY_TRY_EXEC, NULL);
+  }
+
+  provides = egg_desktop_file_get_string_list(
+      desktop_file, GSM_AUTOSTART_APP_PROVIDES_KEY, NULL, NULL);
+  after = egg_desktop_file_get_string_list(
+      desktop_file, GSM_AUTOSTART_APP_AFTER_KEY, NULL, NULL);
+
+  condition_string =
+      egg_desktop_file_get_string(desktop_file, "AutostartCondition", NULL);
+
+  if (phase == GSM_MANAGER_PHASE_APPLICATION) {
+    /* Only accept an autostart delay for the application phase */
+    delay = egg_desktop_file_get_integer(desktop_file,
+                                         GSM_AUTOSTART_APP_DELAY_KEY, NULL);
+    if (delay < 0) {
+      g_warning("Invalid autostart delay of %d for %s", delay, desktop_id);
+      delay = -1;
+    }
+
+    /* Set on the clients of the saved session */
+    if (egg_desktop_file_has_key(
+            desktop_file, GSM_AUTOSTART_APP_RESTORE_PRIORITY_KEY, NULL)) {
+      restore_priority = MAX(
+          egg_desktop_file_get_integer(
+              desktop_file, GSM_AUTOSTART_APP_RESTORE_PRIORITY_KEY, NULL),
+          0);
+    }
+
+    /* Only makes sense for apps that are activated over D-Bus, the bus
+     * then starts them when something first talks to them */
+    on_demand = egg_desktop_file_get_boolean(
+        desktop_file, GSM_AUTOSTART_APP_ON_DEMAND_KEY, NULL);
+  }
+
+  display = gsm_autostart_info_new_display(desktop_file);
+
+  /* TryExec is only resolved when the app is first checked */
+  info = g_variant_new(
+      GSM_AUTOSTART_INFO_FORMAT, phase, startup_id, dbus_name,
+      condition_string, delay, autorestart,
+      egg_desktop_file_get_boolean(desktop_file, EGG_DESKTOP_FILE_KEY_HIDDEN,
+                                   NULL),
+      desktop_file_shows_in_mate(desktop_file), try_exec, NULL,
+      provides != NULL ? (const char *const *)provides : no_strings,
+      after != NULL, after != NULL ? (const char *const *)after : no_strings,
+      restore_priority, on_demand, display);
+
+  g_variant_unref(display);
+  g_free(startup_id);
+  g_free(dbus_name);
+  g_free(condition_string);
+  g_free(try_exec);
+  g_strfreev(provides);
+  g_strfreev(after);
+
+  return info;
+}
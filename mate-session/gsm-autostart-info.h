@@ -0,0 +1,47 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifndef __GSM_AUTOSTART_INFO_H__
+#define __GSM_AUTOSTART_INFO_H__
+
+#include <glib.h>
+
+#include "eggdesktopfile.h"
+#include "gsm-autostart-cache.h"
+
+G_BEGIN_DECLS
+
+/* What an autostart desktop file says about its app, as the autostart
+ * cache and the packed saved session keep it: phase, startup-id,
+ * dbus-name, condition, delay, autorestart, hidden, shows-in-MATE,
+ * TryExec, resolved TryExec, provides, after, restore priority, on demand
+ * and the capplet display info */
+#define GSM_AUTOSTART_INFO_TYPE \
+  "(imsmsmsibbbmsmsasbasib" GSM_AUTOSTART_CACHE_DISPLAY_TYPE ")"
+#define GSM_AUTOSTART_INFO_FORMAT "(imsmsmsibbbmsms^asb^asib@" \
+  GSM_AUTOSTART_CACHE_DISPLAY_TYPE ")"
+
+GVariant *gsm_autostart_info_new(EggDesktopFile *desktop_file,
+                                 const char *desktop_id);
+GVariant *gsm_autostart_info_new_display(EggDesktopFile *desktop_file);
+
+G_END_DECLS
+
+#endif /* __GSM_AUTOSTART_INFO_H__ */
@@ -0,0 +1,302 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gsm-caller-info.h"
+
+#include <dbus/dbus-glib-lowlevel.h>
+#include <dbus/dbus.h>
+#include <string.h>
+
+/* Credentials of the peers that talk to us, keyed by unique bus name.
+ * They are fetched with a single asynchronous GetConnectionCredentials
+ * call and kept until the manager sees the name leave the bus.
+ */
+typedef struct {
+  GsmCallerInfoFunc func;
+  gpointer user_data;
+} CallerInfoWaiter;
+
+typedef struct {
+  gboolean valid;
+  uid_t uid;
+  pid_t pid;
+  DBusPendingCall *call;
+  GSList *waiters;
+} CallerInfo;
+
+static DBusConnection *connection = NULL;
+static GHashTable *cache = NULL; /* bus name -> CallerInfo */
+
+static void caller_info_free(CallerInfo *info) {
+  if (info->call != NULL) {
+    dbus_pending_call_cancel(info->call);
+    dbus_pending_call_unref(info->call);
+  }
+  g_slist_free_full(info->waiters, g_free);
+  g_slice_free(CallerInfo, info);
+}
+
+/* Takes ownership of @bus_name and @waiters. Nothing of the cache is
+ * used while they run, since they may look up or forget the name. */
+static void run_waiters(char *bus_name, GSList *waiters, gboolean valid,
+                        uid_t uid, pid_t pid) {
+  GSList *l;
+
+  for (l = waiters; l != NULL; l = l->next) {
+    CallerInfoWaiter *waiter = l->data;
+
+    waiter->func(bus_name, valid, uid, pid, waiter->user_data);
+  }
+
+  g_slist_free_full(waiters, g_free);
+  g_free(bus_name);
+}
+
+static gboolean setup_connection(void) {
+  DBusError error;
+
+  if (connection != NULL) {
+    return TRUE;
+  }
+
+  dbus_error_init(&error);
+  connection = dbus_bus_get(DBUS_BUS_SESSION, &error);
+  if (connection == NULL) {
+    if (dbus_error_is_set(&error)) {
+      g_debug("GsmCallerInfo: Couldn't connect to session bus: %s",
+              error.message);
+      dbus_error_free(&error);
+    }
+    return FALSE;
+  }
+
+  dbus_connection_setup_with_g_main(connection, NULL);
+  dbus_connection_set_exit_on_disconnect(connection, FALSE);
+
+  return TRUE;
+}
+
+static void parse_credentials(DBusMessage *reply, CallerInfo *info) {
+  DBusMessageIter iter;
+  DBusMessageIter array;
+  gboolean have_uid;
+  gboolean have_pid;
+
+  have_uid = FALSE;
+  have_pid = FALSE;
+
+  if (!dbus_message_iter_init(reply, &iter) ||
+      dbus_message_iter_get_arg_type(&iter) != DBUS_TYPE_ARRAY) {
+    return;
+  }
+
+  dbus_message_iter_recurse(&iter, &array);
+  while (dbus_message_iter_get_arg_type(&array) == DBUS_TYPE_DICT_ENTRY) {
+    DBusMessageIter entry;
+    DBusMessageIter value;
+    const char *key;
+    dbus_uint32_t v;
+
+    dbus_message_iter_recurse(&array, &entry);
+    dbus_message_iter_get_basic(&entry, &key);
+    dbus_message_iter_next(&entry);
+    dbus_message_iter_recurse(&entry, &value);
+
+    if (dbus_message_iter_get_arg_type(&value) == DBUS_TYPE_UINT32) {
+      dbus_message_iter_get_basic(&value, &v);
+      if (strcmp(key, "UnixUserID") == 0) {
+        info->uid = v;
+        have_uid = TRUE;
+      } else if (strcmp(key, "ProcessID") == 0) {
+        info->pid = v;
+        have_pid = TRUE;
+      }
+    }
+
+    dbus_message_iter_next(&array);
+  }
+
+  info->valid = have_uid && have_pid;
+}
+
+static void on_get_credentials_reply(DBusPendingCall *call, char *bus_name) {
+  CallerInfo *info;
+  DBusMessage *reply;
+  GSList *waiters;
+  char *name;
+  gboolean valid;
+  uid_t uid;
+  pid_t pid;
+
+  info = g_hash_table_lookup(cache, bus_name);
+  if (info == NULL || info->call != call) {
+    return;
+  }
+
+  reply = dbus_pending_call_steal_reply(call);
+  if (reply != NULL) {
+    if (dbus_message_get_type(reply) == DBUS_MESSAGE_TYPE_METHOD_RETURN) {
+      parse_credentials(reply, info);
+    } else {
+      g_debug("GsmCallerInfo: GetConnectionCredentials(%s) failed: %s",
+              bus_name, dbus_message_get_error_name(reply));
+    }
+    dbus_message_unref(reply);
+  }
+
+  dbus_pending_call_unref(info->call);
+  info->call = NULL;
+
+  valid = info->valid;
+  uid = info->uid;
+  pid = info->pid;
+  if (valid) {
+    g_debug("GsmCallerInfo: %s is uid %d, pid %d", bus_name, uid, pid);
+  }
+
+  waiters = info->waiters;
+  info->waiters = NULL;
+  name = g_strdup(bus_name);
+
+  /* Do not remember failures; a later lookup may succeed */
+  if (!valid) {
+    g_hash_table_remove(cache, bus_name);
+  }
+
+  run_waiters(name, waiters, valid, uid, pid);
+}
+
+static gboolean start_lookup(const char *bus_name, CallerInfo *info) {
+  DBusMessage *message;
+  DBusPendingCall *call;
+
+  if (!setup_connection()) {
+    return FALSE;
+  }
+
+  message = dbus_message_new_method_call(DBUS_SERVICE_DBUS, DBUS_PATH_DBUS,
+                                         DBUS_INTERFACE_DBUS,
+                                         "GetConnectionCredentials");
+  dbus_message_append_args(message, DBUS_TYPE_STRING, &bus_name,
+                           DBUS_TYPE_INVALID);
+
+  call = NULL;
+  if (!dbus_connection_send_with_reply(connection, message, &call, -1) ||
+      call == NULL) {
+    dbus_message_unref(message);
+    return FALSE;
+  }
+
+  dbus_message_unref(message);
+
+  info->call = call;
+  dbus_pending_call_set_notify(
+      call, (DBusPendingCallNotifyFunction)on_get_credentials_reply,
+      g_strdup(bus_name), g_free);
+
+  return TRUE;
+}
+
+/**
+ * gsm_caller_info_lookup:
+ * @bus_name: a unique bus name
+ * @func: (allow-none): called once the credentials are known
+ * @user_data: data for @func
+ *
+ * Looks up the uid and pid of the owner of @bus_name. @func is called
+ * right away if the answer is cached, and from the main loop otherwise;
+ * it is always called exactly once.
+ */
+void gsm_caller_info_lookup(const char *bus_name, GsmCallerInfoFunc func,
+                            gpointer user_data) {
+  CallerInfo *info;
+  CallerInfoWaiter *waiter;
+
+  if (bus_name == NULL || bus_name[0] == '\0') {
+    if (func != NULL) {
+      func(bus_name, FALSE, 0, 0, user_data);
+    }
+    return;
+  }
+
+  if (cache == NULL) {
+    cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                  (GDestroyNotify)caller_info_free);
+  }
+
+  info = g_hash_table_lookup(cache, bus_name);
+  if (info != NULL && info->call == NULL) {
+    if (func != NULL) {
+      func(bus_name, info->valid, info->uid, info->pid, user_data);
+    }
+    return;
+  }
+
+  if (info == NULL) {
+    info = g_slice_new0(CallerInfo);
+    g_hash_table_insert(cache, g_strdup(bus_name), info);
+
+    if (!start_lookup(bus_name, info)) {
+      g_hash_table_remove(cache, bus_name);
+      if (func != NULL) {
+        func(bus_name, FALSE, 0, 0, user_data);
+      }
+      return;
+    }
+  }
+
+  if (func != NULL) {
+    waiter = g_new(CallerInfoWaiter, 1);
+    waiter->func = func;
+    waiter->user_data = user_data;
+    info->waiters = g_slist_append(info->waiters, waiter);
+  }
+}
+
+/* Drops what we know about @bus_name, e.g. because it left the bus.
+ * Pending lookups complete with invalid credentials.
+ */
+void gsm_caller_info_forget(const char *bus_name) {
+  CallerInfo *info;
+  GSList *waiters;
+  char *name;
+
+  if (cache == NULL || bus_name == NULL) {
+    return;
+  }
+
+  info = g_hash_table_lookup(cache, bus_name);
+  if (info == NULL) {
+    return;
+  }
+
+  waiters = info->waiters;
+  info->waiters = NULL;
+  name = g_strdup(bus_name);
+
+  /* cancels the pending call, if any */
+  g_hash_table_remove(cache, bus_name);
+
+  run_waiters(name, waiters, FALSE, 0, 0);
+}
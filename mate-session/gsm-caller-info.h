@@ -0,0 +1,38 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifndef __GSM_CALLER_INFO_H__
+#define __GSM_CALLER_INFO_H__
+
+#include <glib.h>
+#include <sys/types.h>
+
+G_BEGIN_DECLS
+
+typedef void (*GsmCallerInfoFunc)(const char *bus_name, gboolean valid,
+                                  uid_t uid, pid_t pid, gpointer user_data);
+
+void gsm_caller_info_lookup(const char *bus_name, GsmCallerInfoFunc func,
+                            gpointer user_data);
+void gsm_caller_info_forget(const char *bus_name);
+
+G_END_DECLS
+
+#endif /* __GSM_CALLER_INFO_H__ */
@@ -31,6 +31,7 @@
 #include "eggdesktopfile.h"
 #include "gsm-client-glue.h"
 #include "gsm-marshal.h"
+#include "gsm-util.h"
 
 static guint32 client_serial = 1;
 
@@ -118,15 +119,17 @@ static GObject *gsm_client_constructor(
     GObjectConstructParam *construct_properties) {
   GsmClient *client;
   gboolean res;
+  char path[64];
   GsmClientPrivate *priv;
 
   client = GSM_CLIENT(
       G_OBJECT_CLASS(gsm_client_parent_class)
           ->constructor(type, n_construct_properties, construct_properties));
   priv = gsm_client_get_instance_private(client);
-  g_free(priv->id);
-  priv->id = g_strdup_printf("/org/gnome/SessionManager/Client%u",
-                             get_next_client_serial());
+  g_snprintf(path, sizeof(path), "/org/gnome/SessionManager/Client%u",
+             get_next_client_serial());
+  gsm_util_intern_release(priv->id);
+  priv->id = gsm_util_intern(path);
 
   res = register_client(client);
   if (!res) {
@@ -150,9 +153,9 @@ static void gsm_client_finalize(GObject *object) {
 
   g_return_if_fail(priv != NULL);
 
-  g_free(priv->id);
-  g_free(priv->startup_id);
-  g_free(priv->app_id);
+  gsm_util_intern_release(priv->id);
+  gsm_util_intern_release(priv->startup_id);
+  gsm_util_intern_release(priv->app_id);
 
   G_OBJECT_CLASS(gsm_client_parent_class)->finalize(object);
 }
@@ -175,13 +178,8 @@ static void gsm_client_set_startup_id(GsmClient *client,
 
   priv = gsm_client_get_instance_private(client);
 
-  g_free(priv->startup_id);
-
-  if (startup_id != NULL) {
-    priv->startup_id = g_strdup(startup_id);
-  } else {
-    priv->startup_id = g_strdup("");
-  }
+  gsm_util_intern_release(priv->startup_id);
+  priv->startup_id = gsm_util_intern(startup_id != NULL ? startup_id : "");
   g_object_notify(G_OBJECT(client), "startup-id");
 }
 
@@ -191,13 +189,8 @@ void gsm_client_set_app_id(GsmClient *client, const char *app_id) {
 
   priv = gsm_client_get_instance_private(client);
 
-  g_free(priv->app_id);
-
-  if (app_id != NULL) {
-    priv->app_id = g_strdup(app_id);
-  } else {
-    priv->app_id = g_strdup("");
-  }
+  gsm_util_intern_release(priv->app_id);
+  priv->app_id = gsm_util_intern(app_id != NULL ? app_id : "");
   g_object_notify(G_OBJECT(client), "app-id");
 }
 
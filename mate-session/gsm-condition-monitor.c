@@ -0,0 +1,296 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gsm-condition-monitor.h"
+
+#include <gio/gio.h>
+#include <glib.h>
+
+/* AutostartCondition monitors shared between all the apps of the
+ * session: many apps watch keys of the same few schemas, so there is a
+ * single GSettings per schema and a single GFileMonitor per path, and
+ * their notifications are dispatched to the watches of each app.
+ *
+ * The GsmConditionMonitor owning them belongs to the manager; every watch
+ * also holds a reference on it, so it stays around until the last app let
+ * go of its watch.
+ */
+
+struct _GsmConditionMonitor {
+  GObject parent;
+  GHashTable *file_monitors;     /* path -> SharedMonitor */
+  GHashTable *settings_monitors; /* schema -> SharedMonitor */
+};
+
+typedef struct {
+  GsmConditionMonitor *owner;
+  char *name; /* path or schema id */
+  GObject *object; /* GFileMonitor or GSettings */
+  GList *watches;
+  guint dispatching; /* nesting of dispatch(); the monitor is kept alive */
+} SharedMonitor;
+
+struct _GsmConditionWatch {
+  SharedMonitor *monitor;
+  char *key; /* NULL for files */
+  GsmConditionWatchFunc func;
+  gpointer user_data;
+};
+
+G_DEFINE_TYPE(GsmConditionMonitor, gsm_condition_monitor, G_TYPE_OBJECT)
+
+static void shared_monitor_free(SharedMonitor *monitor) {
+  g_assert(monitor->watches == NULL);
+
+  if (G_IS_FILE_MONITOR(monitor->object)) {
+    g_file_monitor_cancel(G_FILE_MONITOR(monitor->object));
+  }
+
+  g_signal_handlers_disconnect_by_data(monitor->object, monitor);
+  g_object_unref(monitor->object);
+  g_free(monitor->name);
+  g_slice_free(SharedMonitor, monitor);
+}
+
+/* Calls the watches of @monitor for @key (or all of them if NULL); a
+ * watch may free any watch, including itself and the last one of
+ * @monitor, from its callback */
+static void dispatch(SharedMonitor *monitor, const char *key,
+                     gboolean value) {
+  GList *watches;
+  GList *l;
+
+  watches = g_list_copy(monitor->watches);
+  monitor->dispatching++;
+
+  for (l = watches; l != NULL; l = l->next) {
+    GsmConditionWatch *watch = l->data;
+
+    if (g_list_find(monitor->watches, watch) == NULL) {
+      continue;
+    }
+
+    if (key != NULL && g_strcmp0(watch->key, key) != 0) {
+      continue;
+    }
+
+    watch->func(watch, value, watch->user_data);
+  }
+
+  g_list_free(watches);
+
+  /* the last watch went away meanwhile */
+  if (--monitor->dispatching == 0 && monitor->watches == NULL) {
+    shared_monitor_free(monitor);
+  }
+}
+
+static void on_file_changed(GFileMonitor *file_monitor, GFile *file,
+                            GFile *other_file, GFileMonitorEvent event,
+                            SharedMonitor *monitor) {
+  switch (event) {
+    case G_FILE_MONITOR_EVENT_CREATED:
+      dispatch(monitor, NULL, TRUE);
+      break;
+    case G_FILE_MONITOR_EVENT_DELETED:
+      dispatch(monitor, NULL, FALSE);
+      break;
+    default:
+      /* Ignore any other monitor event */
+      break;
+  }
+}
+
+static void on_settings_changed(GSettings *settings, const char *key,
+                                SharedMonitor *monitor) {
+  GList *l;
+
+  /* Only read keys somebody watches; others may not even be booleans */
+  for (l = monitor->watches; l != NULL; l = l->next) {
+    GsmConditionWatch *watch = l->data;
+
+    if (g_strcmp0(watch->key, key) == 0) {
+      dispatch(monitor, key, g_settings_get_boolean(settings, key));
+      return;
+    }
+  }
+}
+
+static GsmConditionWatch *add_watch(SharedMonitor *monitor, const char *key,
+                                    GsmConditionWatchFunc func,
+                                    gpointer user_data) {
+  GsmConditionWatch *watch;
+
+  watch = g_slice_new0(GsmConditionWatch);
+  g_object_ref(monitor->owner);
+  watch->monitor = monitor;
+  watch->key = g_strdup(key);
+  watch->func = func;
+  watch->user_data = user_data;
+
+  monitor->watches = g_list_prepend(monitor->watches, watch);
+
+  return watch;
+}
+
+static void gsm_condition_monitor_init(GsmConditionMonitor *monitor) {
+  monitor->file_monitors = g_hash_table_new(g_str_hash, g_str_equal);
+  monitor->settings_monitors = g_hash_table_new(g_str_hash, g_str_equal);
+}
+
+static void gsm_condition_monitor_finalize(GObject *object) {
+  GsmConditionMonitor *monitor = GSM_CONDITION_MONITOR(object);
+
+  /* Every watch holds a reference, so there are no shared monitors left */
+  g_hash_table_destroy(monitor->file_monitors);
+  g_hash_table_destroy(monitor->settings_monitors);
+
+  G_OBJECT_CLASS(gsm_condition_monitor_parent_class)->finalize(object);
+}
+
+static void gsm_condition_monitor_class_init(GsmConditionMonitorClass *klass) {
+  GObjectClass *object_class = G_OBJECT_CLASS(klass);
+
+  object_class->finalize = gsm_condition_monitor_finalize;
+}
+
+GsmConditionMonitor *gsm_condition_monitor_new(void) {
+  return g_object_new(GSM_TYPE_CONDITION_MONITOR, NULL);
+}
+
+/* Watches for @path being created or deleted */
+GsmConditionWatch *gsm_condition_watch_file(GsmConditionMonitor *owner,
+                                            const char *path,
+                                            GsmConditionWatchFunc func,
+                                            gpointer user_data) {
+  SharedMonitor *monitor;
+
+  g_return_val_if_fail(GSM_IS_CONDITION_MONITOR(owner), NULL);
+  g_return_val_if_fail(path != NULL, NULL);
+
+  monitor = g_hash_table_lookup(owner->file_monitors, path);
+  if (monitor == NULL) {
+    GFile *file;
+    GFileMonitor *file_monitor;
+
+    file = g_file_new_for_path(path);
+    file_monitor = g_file_monitor_file(file, 0, NULL, NULL);
+    g_object_unref(file);
+
+    if (file_monitor == NULL) {
+      return NULL;
+    }
+
+    monitor = g_slice_new0(SharedMonitor);
+    monitor->owner = owner;
+    monitor->name = g_strdup(path);
+    monitor->object = G_OBJECT(file_monitor);
+    g_signal_connect(file_monitor, "changed", G_CALLBACK(on_file_changed),
+                     monitor);
+
+    g_hash_table_insert(owner->file_monitors, monitor->name, monitor);
+  }
+
+  return add_watch(monitor, NULL, func, user_data);
+}
+
+/* Watches the boolean @key of @schema_id; returns NULL if the schema is
+ * not installed */
+GsmConditionWatch *gsm_condition_watch_setting(GsmConditionMonitor *owner,
+                                               const char *schema_id,
+                                               const char *key,
+                                               GsmConditionWatchFunc func,
+                                               gpointer user_data) {
+  SharedMonitor *monitor;
+
+  g_return_val_if_fail(GSM_IS_CONDITION_MONITOR(owner), NULL);
+  g_return_val_if_fail(schema_id != NULL, NULL);
+  g_return_val_if_fail(key != NULL, NULL);
+
+  monitor = g_hash_table_lookup(owner->settings_monitors, schema_id);
+  if (monitor == NULL) {
+    GSettingsSchemaSource *source;
+    GSettingsSchema *schema;
+    GSettings *settings;
+
+    source = g_settings_schema_source_get_default();
+    schema = g_settings_schema_source_lookup(source, schema_id, TRUE);
+    if (schema == NULL) {
+      return NULL;
+    }
+
+    settings = g_settings_new_full(schema, NULL, NULL);
+    g_settings_schema_unref(schema);
+
+    monitor = g_slice_new0(SharedMonitor);
+    monitor->owner = owner;
+    monitor->name = g_strdup(schema_id);
+    monitor->object = G_OBJECT(settings);
+    g_signal_connect(settings, "changed", G_CALLBACK(on_settings_changed),
+                     monitor);
+
+    g_hash_table_insert(owner->settings_monitors, monitor->name, monitor);
+  }
+
+  return add_watch(monitor, key, func, user_data);
+}
+
+void gsm_condition_watch_free(GsmConditionWatch *watch) {
+  SharedMonitor *monitor;
+  GsmConditionMonitor *owner;
+
+  if (watch == NULL) {
+    return;
+  }
+
+  monitor = watch->monitor;
+  owner = monitor->owner;
+  monitor->watches = g_list_remove(monitor->watches, watch);
+
+  if (monitor->watches == NULL) {
+    if (G_IS_SETTINGS(monitor->object)) {
+      g_hash_table_remove(owner->settings_monitors, monitor->name);
+    } else {
+      g_hash_table_remove(owner->file_monitors, monitor->name);
+    }
+    /* otherwise dispatch() frees it once it is done with it */
+    if (monitor->dispatching == 0) {
+      shared_monitor_free(monitor);
+    }
+  }
+
+  g_free(watch->key);
+  g_slice_free(GsmConditionWatch, watch);
+
+  g_object_unref(owner);
+}
+
+/* The shared GSettings of a setting watch, or NULL for a file watch */
+GSettings *gsm_condition_watch_peek_settings(GsmConditionWatch *watch) {
+  if (watch == NULL || !G_IS_SETTINGS(watch->monitor->object)) {
+    return NULL;
+  }
+
+  return G_SETTINGS(watch->monitor->object);
+}
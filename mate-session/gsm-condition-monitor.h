@@ -0,0 +1,57 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+#ifndef __GSM_CONDITION_MONITOR_H__
+#define __GSM_CONDITION_MONITOR_H__
+
+#include <gio/gio.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define GSM_TYPE_CONDITION_MONITOR (gsm_condition_monitor_get_type())
+G_DECLARE_FINAL_TYPE(GsmConditionMonitor, gsm_condition_monitor, GSM,
+                     CONDITION_MONITOR, GObject)
+
+typedef struct _GsmConditionWatch GsmConditionWatch;
+
+/* @value is whether the file exists, or the value of the boolean key */
+typedef void (*GsmConditionWatchFunc)(GsmConditionWatch *watch,
+                                      gboolean value, gpointer user_data);
+
+GsmConditionMonitor *gsm_condition_monitor_new(void);
+
+GsmConditionWatch *gsm_condition_watch_file(GsmConditionMonitor *monitor,
+                                            const char *path,
+                                            GsmConditionWatchFunc func,
+                                            gpointer user_data);
+GsmConditionWatch *gsm_condition_watch_setting(GsmConditionMonitor *monitor,
+                                               const char *schema_id,
+                                               const char *key,
+                                               GsmConditionWatchFunc func,
+                                               gpointer user_data);
+void gsm_condition_watch_free(GsmConditionWatch *watch);
+
+GSettings *gsm_condition_watch_peek_settings(GsmConditionWatch *watch);
+
+G_END_DECLS
+
+#endif /* __GSM_CONDITION_MONITOR_H__ */
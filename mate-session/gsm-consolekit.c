@@ -45,13 +45,53 @@
 #define CK_SEAT_INTERFACE "org.freedesktop.ConsoleKit.Seat"
 #define CK_SESSION_INTERFACE "org.freedesktop.ConsoleKit.Session"
 
+#define CK_MATCH_RULE "type='signal',sender='" CK_NAME "'"
+
+/* The answers of ConsoleKit are cached, queried in the background when
+ * the object is created and again whenever ConsoleKit signals that
+ * something changed, so that the main loop doesn't block on it */
+enum {
+  CAPABILITY_STOP = 0,
+  CAPABILITY_RESTART,
+  CAPABILITY_SUSPEND,
+  CAPABILITY_HIBERNATE,
+  N_CAPABILITIES
+};
+
+#define CAPABILITY_UNKNOWN -1
+
+static const struct {
+  const char *method;
+  gboolean returns_string;
+} capability_methods[N_CAPABILITIES] = {{"CanStop", FALSE},
+                                        {"CanRestart", FALSE},
+                                        {"CanSuspend", TRUE},
+                                        {"CanHibernate", TRUE}};
+
 typedef struct {
   DBusGConnection *dbus_connection;
   DBusGProxy *bus_proxy;
   DBusGProxy *ck_proxy;
+  DBusGProxy *session_proxy;
+  DBusGProxy *seat_proxy;
+  gint capabilities[N_CAPABILITIES];
+  DBusGProxyCall *capability_calls[N_CAPABILITIES];
+  char *session_id;
+  char *session_type;
+  char *seat_id;
+  gint can_activate_sessions;
+  DBusGProxyCall *session_id_call;
+  DBusGProxyCall *session_type_call;
+  DBusGProxyCall *seat_id_call;
+  DBusGProxyCall *can_activate_call;
   guint32 is_connected : 1;
 } GsmConsolekitPrivate;
 
+typedef struct {
+  GsmConsolekit *manager;
+  guint capability;
+} CapabilityCall;
+
 enum { PROP_0, PROP_IS_CONNECTED };
 
 enum { REQUEST_COMPLETED = 0, PRIVILEGES_COMPLETED, LAST_SIGNAL };
@@ -72,6 +112,9 @@ static void gsm_consolekit_on_name_owner_changed(DBusGProxy *bus_proxy,
                                                  const char *new_owner,
                                                  GsmConsolekit *manager);
 
+static void gsm_consolekit_invalidate_cache(GsmConsolekit *manager,
+                                            gboolean forget_session);
+
 G_DEFINE_TYPE_WITH_PRIVATE(GsmConsolekit, gsm_consolekit, G_TYPE_OBJECT);
 
 static void gsm_consolekit_get_property(GObject *object, guint prop_id,
@@ -132,6 +175,18 @@ static DBusHandlerResult gsm_consolekit_dbus_filter(DBusConnection *connection,
     gsm_consolekit_free_dbus(manager);
     /* let other filters get this disconnected signal, so that they
      * can handle it too */
+  } else if (dbus_message_is_signal(message, CK_MANAGER_INTERFACE,
+                                    "SeatAdded") ||
+             dbus_message_is_signal(message, CK_MANAGER_INTERFACE,
+                                    "SeatRemoved") ||
+             dbus_message_is_signal(message, CK_SEAT_INTERFACE,
+                                    "SessionAdded") ||
+             dbus_message_is_signal(message, CK_SEAT_INTERFACE,
+                                    "SessionRemoved")) {
+    g_debug("GsmConsolekit: %s, refreshing cached state",
+            dbus_message_get_member(message));
+    gsm_consolekit_invalidate_cache(manager, FALSE);
+    gsm_consolekit_prefetch(manager);
   }
 
   return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
@@ -161,6 +216,7 @@ static gboolean gsm_consolekit_ensure_ck_connection(GsmConsolekit *manager,
     dbus_connection_set_exit_on_disconnect(connection, FALSE);
     dbus_connection_add_filter(connection, gsm_consolekit_dbus_filter, manager,
                                NULL);
+    dbus_bus_add_match(connection, CK_MATCH_RULE, NULL);
   }
 
   if (priv->bus_proxy == NULL) {
@@ -238,29 +294,94 @@ static void gsm_consolekit_on_name_owner_changed(DBusGProxy *bus_proxy,
 
   priv = gsm_consolekit_get_instance_private(manager);
 
+  gsm_consolekit_invalidate_cache(manager, TRUE);
+
   if (priv->ck_proxy != NULL) {
     g_object_unref(priv->ck_proxy);
     priv->ck_proxy = NULL;
   }
 
-  gsm_consolekit_ensure_ck_connection(manager, NULL);
+  if (gsm_consolekit_ensure_ck_connection(manager, NULL) &&
+      new_owner != NULL && new_owner[0] != '\0') {
+    gsm_consolekit_prefetch(manager);
+  }
 }
 
 static void gsm_consolekit_init(GsmConsolekit *manager) {
   GError *error;
+  GsmConsolekitPrivate *priv;
+  guint i;
 
   error = NULL;
+  priv = gsm_consolekit_get_instance_private(manager);
+
+  for (i = 0; i < N_CAPABILITIES; i++) {
+    priv->capabilities[i] = CAPABILITY_UNKNOWN;
+  }
+  priv->can_activate_sessions = CAPABILITY_UNKNOWN;
 
   if (!gsm_consolekit_ensure_ck_connection(manager, &error)) {
     g_warning("Could not connect to ConsoleKit: %s", error->message);
     g_error_free(error);
+    return;
+  }
+
+  gsm_consolekit_prefetch(manager);
+}
+
+static void cancel_call(DBusGProxy *proxy, DBusGProxyCall **call) {
+  if (*call != NULL) {
+    dbus_g_proxy_cancel_call(proxy, *call);
+    *call = NULL;
   }
 }
 
+/* The session and its seat only change when ConsoleKit is restarted */
+static void gsm_consolekit_invalidate_cache(GsmConsolekit *manager,
+                                            gboolean forget_session) {
+  GsmConsolekitPrivate *priv;
+  guint i;
+
+  priv = gsm_consolekit_get_instance_private(manager);
+
+  for (i = 0; i < N_CAPABILITIES; i++) {
+    cancel_call(priv->ck_proxy, &priv->capability_calls[i]);
+    priv->capabilities[i] = CAPABILITY_UNKNOWN;
+  }
+
+  cancel_call(priv->seat_proxy, &priv->can_activate_call);
+  priv->can_activate_sessions = CAPABILITY_UNKNOWN;
+
+  if (!forget_session) {
+    return;
+  }
+
+  cancel_call(priv->ck_proxy, &priv->session_id_call);
+  cancel_call(priv->session_proxy, &priv->session_type_call);
+  cancel_call(priv->session_proxy, &priv->seat_id_call);
+
+  if (priv->session_proxy != NULL) {
+    g_object_unref(priv->session_proxy);
+    priv->session_proxy = NULL;
+  }
+
+  if (priv->seat_proxy != NULL) {
+    g_object_unref(priv->seat_proxy);
+    priv->seat_proxy = NULL;
+  }
+
+  g_clear_pointer(&priv->session_id, g_free);
+  g_clear_pointer(&priv->session_type, g_free);
+  g_clear_pointer(&priv->seat_id, g_free);
+}
+
 static void gsm_consolekit_free_dbus(GsmConsolekit *manager) {
   GsmConsolekitPrivate *priv;
 
   priv = gsm_consolekit_get_instance_private(manager);
+
+  gsm_consolekit_invalidate_cache(manager, TRUE);
+
   if (priv->bus_proxy != NULL) {
     g_object_unref(priv->bus_proxy);
     priv->bus_proxy = NULL;
@@ -453,293 +574,305 @@ void gsm_consolekit_attempt_hibernate(GsmConsolekit *manager) {
   }
 }
 
-static gboolean get_current_session_id(DBusConnection *connection,
-                                       char **session_id) {
-  DBusError local_error;
-  DBusMessage *message;
-  DBusMessage *reply;
-  gboolean ret;
-  DBusMessageIter iter;
-  const char *value;
+static gboolean capability_from_reply(guint capability, gboolean boolean_value,
+                                      const char *string_value) {
+  if (!capability_methods[capability].returns_string) {
+    return boolean_value;
+  }
 
-  ret = FALSE;
-  reply = NULL;
+  return g_strcmp0(string_value, "yes") == 0 ||
+         g_strcmp0(string_value, "challenge") == 0;
+}
 
-  dbus_error_init(&local_error);
-  message = dbus_message_new_method_call(
-      CK_NAME, CK_MANAGER_PATH, CK_MANAGER_INTERFACE, "GetCurrentSession");
-  if (message == NULL) {
-    goto out;
-  }
+static void on_capability_reply(DBusGProxy *proxy, DBusGProxyCall *call,
+                                CapabilityCall *data) {
+  GsmConsolekitPrivate *priv;
+  GError *error = NULL;
+  gboolean boolean_value = FALSE;
+  char *string_value = NULL;
+  gboolean res;
 
-  dbus_error_init(&local_error);
-  reply = dbus_connection_send_with_reply_and_block(connection, message, -1,
-                                                    &local_error);
-  if (reply == NULL) {
-    if (dbus_error_is_set(&local_error)) {
-      g_warning("Unable to determine session: %s", local_error.message);
-      dbus_error_free(&local_error);
-      goto out;
-    }
-  }
+  priv = gsm_consolekit_get_instance_private(data->manager);
+  priv->capability_calls[data->capability] = NULL;
 
-  dbus_message_iter_init(reply, &iter);
-  dbus_message_iter_get_basic(&iter, &value);
-  if (session_id != NULL) {
-    *session_id = g_strdup(value);
+  if (capability_methods[data->capability].returns_string) {
+    res = dbus_g_proxy_end_call(proxy, call, &error, G_TYPE_STRING,
+                                &string_value, G_TYPE_INVALID);
+  } else {
+    res = dbus_g_proxy_end_call(proxy, call, &error, G_TYPE_BOOLEAN,
+                                &boolean_value, G_TYPE_INVALID);
   }
 
-  ret = TRUE;
-out:
-  if (message != NULL) {
-    dbus_message_unref(message);
-  }
-  if (reply != NULL) {
-    dbus_message_unref(reply);
+  if (!res) {
+    g_debug("GsmConsolekit: %s failed: %s",
+            capability_methods[data->capability].method, error->message);
+    g_error_free(error);
+    return;
   }
 
-  return ret;
+  priv->capabilities[data->capability] =
+      capability_from_reply(data->capability, boolean_value, string_value);
+  g_free(string_value);
 }
 
-static gboolean get_seat_id_for_session(DBusConnection *connection,
-                                        const char *session_id,
-                                        char **seat_id) {
-  DBusError local_error;
-  DBusMessage *message;
-  DBusMessage *reply;
-  gboolean ret;
-  DBusMessageIter iter;
-  const char *value;
+static void on_can_activate_reply(DBusGProxy *proxy, DBusGProxyCall *call,
+                                  GsmConsolekit *manager) {
+  GsmConsolekitPrivate *priv;
+  GError *error = NULL;
+  gboolean can_activate;
 
-  ret = FALSE;
-  reply = NULL;
+  priv = gsm_consolekit_get_instance_private(manager);
+  priv->can_activate_call = NULL;
 
-  dbus_error_init(&local_error);
-  message = dbus_message_new_method_call(CK_NAME, session_id,
-                                         CK_SESSION_INTERFACE, "GetSeatId");
-  if (message == NULL) {
-    goto out;
+  if (!dbus_g_proxy_end_call(proxy, call, &error, G_TYPE_BOOLEAN,
+                             &can_activate, G_TYPE_INVALID)) {
+    g_debug("GsmConsolekit: CanActivateSessions failed: %s", error->message);
+    g_error_free(error);
+    return;
   }
 
-  dbus_error_init(&local_error);
-  reply = dbus_connection_send_with_reply_and_block(connection, message, -1,
-                                                    &local_error);
-  if (reply == NULL) {
-    if (dbus_error_is_set(&local_error)) {
-      g_warning("Unable to determine seat: %s", local_error.message);
-      dbus_error_free(&local_error);
-      goto out;
-    }
-  }
+  priv->can_activate_sessions = can_activate;
+}
 
-  dbus_message_iter_init(reply, &iter);
-  dbus_message_iter_get_basic(&iter, &value);
-  if (seat_id != NULL) {
-    *seat_id = g_strdup(value);
-  }
+static void query_can_activate_sessions(GsmConsolekit *manager) {
+  GsmConsolekitPrivate *priv;
 
-  ret = TRUE;
-out:
-  if (message != NULL) {
-    dbus_message_unref(message);
-  }
-  if (reply != NULL) {
-    dbus_message_unref(reply);
+  priv = gsm_consolekit_get_instance_private(manager);
+
+  if (priv->seat_proxy == NULL ||
+      priv->can_activate_sessions != CAPABILITY_UNKNOWN ||
+      priv->can_activate_call != NULL) {
+    return;
   }
 
-  return ret;
+  priv->can_activate_call = dbus_g_proxy_begin_call(
+      priv->seat_proxy, "CanActivateSessions",
+      (DBusGProxyCallNotify)on_can_activate_reply, manager, NULL,
+      G_TYPE_INVALID);
 }
 
-static char *get_current_seat_id(DBusConnection *connection) {
-  gboolean res;
-  char *session_id;
-  char *seat_id;
+static void set_seat_id(GsmConsolekit *manager, const char *seat_id) {
+  GsmConsolekitPrivate *priv;
+
+  priv = gsm_consolekit_get_instance_private(manager);
 
-  session_id = NULL;
-  seat_id = NULL;
+  g_free(priv->seat_id);
+  priv->seat_id = g_strdup(seat_id);
 
-  res = get_current_session_id(connection, &session_id);
-  if (res) {
-    res = get_seat_id_for_session(connection, session_id, &seat_id);
+  if (priv->seat_proxy != NULL) {
+    g_object_unref(priv->seat_proxy);
+    priv->seat_proxy = NULL;
   }
-  g_free(session_id);
 
-  return seat_id;
+  if (seat_id[0] != '\0') {
+    priv->seat_proxy = dbus_g_proxy_new_for_name(
+        priv->dbus_connection, CK_NAME, seat_id, CK_SEAT_INTERFACE);
+  }
 }
 
-void gsm_consolekit_set_session_idle(GsmConsolekit *manager, gboolean is_idle) {
-  gboolean res;
-  GError *error;
-  char *session_id;
-  DBusMessage *message;
-  DBusMessage *reply;
-  DBusError dbus_error;
-  DBusMessageIter iter;
+static void on_seat_id_reply(DBusGProxy *proxy, DBusGProxyCall *call,
+                             GsmConsolekit *manager) {
   GsmConsolekitPrivate *priv;
+  GError *error = NULL;
+  char *seat_id = NULL;
 
-  error = NULL;
   priv = gsm_consolekit_get_instance_private(manager);
+  priv->seat_id_call = NULL;
 
-  if (!gsm_consolekit_ensure_ck_connection(manager, &error)) {
-    g_warning("Could not connect to ConsoleKit: %s", error->message);
+  if (!dbus_g_proxy_end_call(proxy, call, &error, DBUS_TYPE_G_OBJECT_PATH,
+                             &seat_id, G_TYPE_INVALID)) {
+    g_warning("Unable to determine seat: %s", error->message);
     g_error_free(error);
     return;
   }
 
-  session_id = NULL;
-  res = get_current_session_id(
-      dbus_g_connection_get_connection(priv->dbus_connection), &session_id);
-  if (!res) {
-    goto out;
-  }
+  set_seat_id(manager, seat_id);
+  g_free(seat_id);
 
-  g_debug("Updating ConsoleKit idle status: %d", is_idle);
-  message = dbus_message_new_method_call(CK_NAME, session_id,
-                                         CK_SESSION_INTERFACE, "SetIdleHint");
-  if (message == NULL) {
-    g_debug("Couldn't allocate the D-Bus message");
+  query_can_activate_sessions(manager);
+}
+
+static void on_session_type_reply(DBusGProxy *proxy, DBusGProxyCall *call,
+                                  GsmConsolekit *manager) {
+  GsmConsolekitPrivate *priv;
+  GError *error = NULL;
+  char *session_type = NULL;
+
+  priv = gsm_consolekit_get_instance_private(manager);
+  priv->session_type_call = NULL;
+
+  if (!dbus_g_proxy_end_call(proxy, call, &error, G_TYPE_STRING,
+                             &session_type, G_TYPE_INVALID)) {
+    g_warning("Unable to determine session type: %s", error->message);
+    g_error_free(error);
     return;
   }
 
-  dbus_message_iter_init_append(message, &iter);
-  dbus_message_iter_append_basic(&iter, DBUS_TYPE_BOOLEAN, &is_idle);
+  g_free(priv->session_type);
+  priv->session_type = session_type;
+}
+
+static void set_session_id(GsmConsolekit *manager, const char *session_id) {
+  GsmConsolekitPrivate *priv;
 
-  /* FIXME: use async? */
-  dbus_error_init(&dbus_error);
-  reply = dbus_connection_send_with_reply_and_block(
-      dbus_g_connection_get_connection(priv->dbus_connection), message, -1,
-      &dbus_error);
-  dbus_message_unref(message);
+  priv = gsm_consolekit_get_instance_private(manager);
 
-  if (reply != NULL) {
-    dbus_message_unref(reply);
-  }
+  g_free(priv->session_id);
+  priv->session_id = g_strdup(session_id);
 
-  if (dbus_error_is_set(&dbus_error)) {
-    g_debug("%s raised:\n %s\n\n", dbus_error.name, dbus_error.message);
-    dbus_error_free(&dbus_error);
+  if (priv->session_proxy != NULL) {
+    g_object_unref(priv->session_proxy);
   }
 
-out:
-  g_free(session_id);
+  priv->session_proxy = dbus_g_proxy_new_for_name(
+      priv->dbus_connection, CK_NAME, session_id, CK_SESSION_INTERFACE);
 }
 
-static gboolean seat_can_activate_sessions(DBusConnection *connection,
-                                           const char *seat_id) {
-  DBusError local_error;
-  DBusMessage *message;
-  DBusMessage *reply;
-  DBusMessageIter iter;
-  gboolean can_activate;
+static void query_session_info(GsmConsolekit *manager) {
+  GsmConsolekitPrivate *priv;
 
-  can_activate = FALSE;
-  reply = NULL;
+  priv = gsm_consolekit_get_instance_private(manager);
 
-  dbus_error_init(&local_error);
-  message = dbus_message_new_method_call(CK_NAME, seat_id, CK_SEAT_INTERFACE,
-                                         "CanActivateSessions");
-  if (message == NULL) {
-    goto out;
+  if (priv->session_type == NULL && priv->session_type_call == NULL) {
+    priv->session_type_call = dbus_g_proxy_begin_call(
+        priv->session_proxy, "GetSessionType",
+        (DBusGProxyCallNotify)on_session_type_reply, manager, NULL,
+        G_TYPE_INVALID);
   }
 
-  dbus_error_init(&local_error);
-  reply = dbus_connection_send_with_reply_and_block(connection, message, -1,
-                                                    &local_error);
-  if (reply == NULL) {
-    if (dbus_error_is_set(&local_error)) {
-      g_warning("Unable to activate session: %s", local_error.message);
-      dbus_error_free(&local_error);
-      goto out;
-    }
+  if (priv->seat_id == NULL && priv->seat_id_call == NULL) {
+    priv->seat_id_call = dbus_g_proxy_begin_call(
+        priv->session_proxy, "GetSeatId",
+        (DBusGProxyCallNotify)on_seat_id_reply, manager, NULL, G_TYPE_INVALID);
   }
+}
 
-  dbus_message_iter_init(reply, &iter);
-  dbus_message_iter_get_basic(&iter, &can_activate);
+static void on_session_id_reply(DBusGProxy *proxy, DBusGProxyCall *call,
+                                GsmConsolekit *manager) {
+  GsmConsolekitPrivate *priv;
+  GError *error = NULL;
+  char *session_id = NULL;
 
-out:
-  if (message != NULL) {
-    dbus_message_unref(message);
-  }
-  if (reply != NULL) {
-    dbus_message_unref(reply);
+  priv = gsm_consolekit_get_instance_private(manager);
+  priv->session_id_call = NULL;
+
+  if (!dbus_g_proxy_end_call(proxy, call, &error, DBUS_TYPE_G_OBJECT_PATH,
+                             &session_id, G_TYPE_INVALID)) {
+    g_warning("Unable to determine session: %s", error->message);
+    g_error_free(error);
+    return;
   }
 
-  return can_activate;
+  set_session_id(manager, session_id);
+  g_free(session_id);
+
+  query_session_info(manager);
 }
 
-gboolean gsm_consolekit_can_switch_user(GsmConsolekit *manager) {
-  GError *error;
-  char *seat_id;
-  gboolean ret;
+/* Starts querying everything that isn't cached yet without waiting for
+ * the answers; the getters only block if they are called before
+ * ConsoleKit answered */
+void gsm_consolekit_prefetch(GsmConsolekit *manager) {
   GsmConsolekitPrivate *priv;
+  guint i;
 
-  error = NULL;
   priv = gsm_consolekit_get_instance_private(manager);
 
-  if (!gsm_consolekit_ensure_ck_connection(manager, &error)) {
-    g_warning("Could not connect to ConsoleKit: %s", error->message);
-    g_error_free(error);
-    return FALSE;
+  if (priv->ck_proxy == NULL) {
+    return;
   }
 
-  seat_id = get_current_seat_id(
-      dbus_g_connection_get_connection(priv->dbus_connection));
-  if (seat_id == NULL || seat_id[0] == '\0') {
-    g_debug("seat id is not set; can't switch sessions");
-    return FALSE;
-  }
+  for (i = 0; i < N_CAPABILITIES; i++) {
+    CapabilityCall *data;
 
-  ret = seat_can_activate_sessions(
-      dbus_g_connection_get_connection(priv->dbus_connection), seat_id);
-  g_free(seat_id);
+    if (priv->capabilities[i] != CAPABILITY_UNKNOWN ||
+        priv->capability_calls[i] != NULL) {
+      continue;
+    }
 
-  return ret;
-}
+    data = g_new0(CapabilityCall, 1);
+    data->manager = manager;
+    data->capability = i;
 
-gboolean gsm_consolekit_get_restart_privileges(GsmConsolekit *manager) {
-  g_signal_emit(G_OBJECT(manager), signals[PRIVILEGES_COMPLETED], 0, TRUE, TRUE,
-                NULL);
+    priv->capability_calls[i] = dbus_g_proxy_begin_call(
+        priv->ck_proxy, capability_methods[i].method,
+        (DBusGProxyCallNotify)on_capability_reply, data, g_free,
+        G_TYPE_INVALID);
+  }
 
-  return TRUE;
+  if (priv->session_id == NULL) {
+    if (priv->session_id_call == NULL) {
+      priv->session_id_call = dbus_g_proxy_begin_call(
+          priv->ck_proxy, "GetCurrentSession",
+          (DBusGProxyCallNotify)on_session_id_reply, manager, NULL,
+          G_TYPE_INVALID);
+    }
+  } else {
+    query_session_info(manager);
+    query_can_activate_sessions(manager);
+  }
 }
 
-gboolean gsm_consolekit_get_stop_privileges(GsmConsolekit *manager) {
-  g_signal_emit(G_OBJECT(manager), signals[PRIVILEGES_COMPLETED], 0, TRUE, TRUE,
-                NULL);
+static gboolean ensure_session_id(GsmConsolekit *manager) {
+  GsmConsolekitPrivate *priv;
+  GError *error = NULL;
+  char *session_id = NULL;
+
+  priv = gsm_consolekit_get_instance_private(manager);
+
+  if (priv->session_id != NULL) {
+    return TRUE;
+  }
+
+  /* Asked before the prefetched answer came in */
+  cancel_call(priv->ck_proxy, &priv->session_id_call);
+
+  if (!dbus_g_proxy_call(priv->ck_proxy, "GetCurrentSession", &error,
+                         G_TYPE_INVALID, DBUS_TYPE_G_OBJECT_PATH, &session_id,
+                         G_TYPE_INVALID)) {
+    g_warning("Unable to determine session: %s", error->message);
+    g_error_free(error);
+    return FALSE;
+  }
+
+  set_session_id(manager, session_id);
+  g_free(session_id);
 
   return TRUE;
 }
 
-gboolean gsm_consolekit_can_restart(GsmConsolekit *manager) {
-  gboolean res;
-  gboolean can_restart;
-  GError *error;
+static gboolean ensure_seat_id(GsmConsolekit *manager) {
   GsmConsolekitPrivate *priv;
+  GError *error = NULL;
+  char *seat_id = NULL;
 
-  error = NULL;
   priv = gsm_consolekit_get_instance_private(manager);
 
-  if (!gsm_consolekit_ensure_ck_connection(manager, &error)) {
-    g_warning("Could not connect to ConsoleKit: %s", error->message);
-    g_error_free(error);
+  if (priv->seat_id != NULL) {
+    return TRUE;
+  }
+
+  if (!ensure_session_id(manager)) {
     return FALSE;
   }
 
-  res = dbus_g_proxy_call_with_timeout(priv->ck_proxy, "CanRestart", INT_MAX,
-                                       &error, G_TYPE_INVALID, G_TYPE_BOOLEAN,
-                                       &can_restart, G_TYPE_INVALID);
-  if (res == FALSE) {
-    g_warning("Could not make DBUS call: %s", error->message);
+  cancel_call(priv->session_proxy, &priv->seat_id_call);
+
+  if (!dbus_g_proxy_call(priv->session_proxy, "GetSeatId", &error,
+                         G_TYPE_INVALID, DBUS_TYPE_G_OBJECT_PATH, &seat_id,
+                         G_TYPE_INVALID)) {
+    g_warning("Unable to determine seat: %s", error->message);
     g_error_free(error);
     return FALSE;
   }
 
-  return can_restart;
+  set_seat_id(manager, seat_id);
+  g_free(seat_id);
+
+  return TRUE;
 }
 
-gboolean gsm_consolekit_can_stop(GsmConsolekit *manager) {
-  gboolean res;
-  gboolean can_stop;
+void gsm_consolekit_set_session_idle(GsmConsolekit *manager, gboolean is_idle) {
   GError *error;
   GsmConsolekitPrivate *priv;
 
@@ -749,72 +882,102 @@ gboolean gsm_consolekit_can_stop(GsmConsolekit *manager) {
   if (!gsm_consolekit_ensure_ck_connection(manager, &error)) {
     g_warning("Could not connect to ConsoleKit: %s", error->message);
     g_error_free(error);
-    return FALSE;
+    return;
   }
 
-  res = dbus_g_proxy_call_with_timeout(priv->ck_proxy, "CanStop", INT_MAX,
-                                       &error, G_TYPE_INVALID, G_TYPE_BOOLEAN,
-                                       &can_stop, G_TYPE_INVALID);
-
-  if (res == FALSE) {
-    g_warning("Could not make DBUS call: %s", error->message);
-    g_error_free(error);
-    return FALSE;
+  if (!ensure_session_id(manager)) {
+    return;
   }
 
-  return can_stop;
+  g_debug("Updating ConsoleKit idle status: %d", is_idle);
+  dbus_g_proxy_call_no_reply(priv->session_proxy, "SetIdleHint",
+                             G_TYPE_BOOLEAN, is_idle, G_TYPE_INVALID);
 }
 
-gboolean gsm_consolekit_can_suspend(GsmConsolekit *manager) {
-  gboolean res;
-  gboolean can_suspend;
-  gchar *retval;
-  GError *error = NULL;
+gboolean gsm_consolekit_can_switch_user(GsmConsolekit *manager) {
+  GError *error;
+  gboolean can_activate;
   GsmConsolekitPrivate *priv;
 
+  error = NULL;
   priv = gsm_consolekit_get_instance_private(manager);
 
+  if (priv->can_activate_sessions != CAPABILITY_UNKNOWN) {
+    return priv->can_activate_sessions;
+  }
+
   if (!gsm_consolekit_ensure_ck_connection(manager, &error)) {
     g_warning("Could not connect to ConsoleKit: %s", error->message);
     g_error_free(error);
     return FALSE;
   }
 
-  res = dbus_g_proxy_call_with_timeout(priv->ck_proxy, "CanSuspend", INT_MAX,
-                                       &error, G_TYPE_INVALID, G_TYPE_STRING,
-                                       &retval, G_TYPE_INVALID);
+  if (!ensure_seat_id(manager) || priv->seat_proxy == NULL) {
+    g_debug("seat id is not set; can't switch sessions");
+    return FALSE;
+  }
 
-  if (res == FALSE) {
-    g_warning("Could not make DBUS call: %s", error->message);
+  cancel_call(priv->seat_proxy, &priv->can_activate_call);
+
+  if (!dbus_g_proxy_call(priv->seat_proxy, "CanActivateSessions", &error,
+                         G_TYPE_INVALID, G_TYPE_BOOLEAN, &can_activate,
+                         G_TYPE_INVALID)) {
+    g_warning("Unable to activate session: %s", error->message);
     g_error_free(error);
     return FALSE;
   }
 
-  can_suspend =
-      g_strcmp0(retval, "yes") == 0 || g_strcmp0(retval, "challenge") == 0;
+  priv->can_activate_sessions = can_activate;
 
-  g_free(retval);
-  return can_suspend;
+  return can_activate;
 }
 
-gboolean gsm_consolekit_can_hibernate(GsmConsolekit *manager) {
+gboolean gsm_consolekit_get_restart_privileges(GsmConsolekit *manager) {
+  g_signal_emit(G_OBJECT(manager), signals[PRIVILEGES_COMPLETED], 0, TRUE, TRUE,
+                NULL);
+
+  return TRUE;
+}
+
+gboolean gsm_consolekit_get_stop_privileges(GsmConsolekit *manager) {
+  g_signal_emit(G_OBJECT(manager), signals[PRIVILEGES_COMPLETED], 0, TRUE, TRUE,
+                NULL);
+
+  return TRUE;
+}
+
+static gboolean gsm_consolekit_get_capability(GsmConsolekit *manager,
+                                              guint capability) {
   gboolean res;
-  gboolean can_hibernate;
-  gchar *retval;
+  gboolean boolean_value = FALSE;
+  gchar *string_value = NULL;
   GError *error = NULL;
   GsmConsolekitPrivate *priv;
 
   priv = gsm_consolekit_get_instance_private(manager);
 
+  if (priv->capabilities[capability] != CAPABILITY_UNKNOWN) {
+    return priv->capabilities[capability];
+  }
+
   if (!gsm_consolekit_ensure_ck_connection(manager, &error)) {
     g_warning("Could not connect to ConsoleKit: %s", error->message);
     g_error_free(error);
     return FALSE;
   }
 
-  res = dbus_g_proxy_call_with_timeout(priv->ck_proxy, "CanHibernate", INT_MAX,
-                                       &error, G_TYPE_INVALID, G_TYPE_STRING,
-                                       &retval, G_TYPE_INVALID);
+  /* Asked before the prefetched answer came in */
+  cancel_call(priv->ck_proxy, &priv->capability_calls[capability]);
+
+  if (capability_methods[capability].returns_string) {
+    res = dbus_g_proxy_call_with_timeout(
+        priv->ck_proxy, capability_methods[capability].method, INT_MAX, &error,
+        G_TYPE_INVALID, G_TYPE_STRING, &string_value, G_TYPE_INVALID);
+  } else {
+    res = dbus_g_proxy_call_with_timeout(
+        priv->ck_proxy, capability_methods[capability].method, INT_MAX, &error,
+        G_TYPE_INVALID, G_TYPE_BOOLEAN, &boolean_value, G_TYPE_INVALID);
+  }
 
   if (res == FALSE) {
     g_warning("Could not make DBUS call: %s", error->message);
@@ -822,73 +985,64 @@ gboolean gsm_consolekit_can_hibernate(GsmConsolekit *manager) {
     return FALSE;
   }
 
-  can_hibernate =
-      g_strcmp0(retval, "yes") == 0 || g_strcmp0(retval, "challenge") == 0;
+  priv->capabilities[capability] =
+      capability_from_reply(capability, boolean_value, string_value);
+  g_free(string_value);
+
+  return priv->capabilities[capability];
+}
+
+gboolean gsm_consolekit_can_restart(GsmConsolekit *manager) {
+  return gsm_consolekit_get_capability(manager, CAPABILITY_RESTART);
+}
 
-  g_free(retval);
-  return can_hibernate;
+gboolean gsm_consolekit_can_stop(GsmConsolekit *manager) {
+  return gsm_consolekit_get_capability(manager, CAPABILITY_STOP);
+}
+
+gboolean gsm_consolekit_can_suspend(GsmConsolekit *manager) {
+  return gsm_consolekit_get_capability(manager, CAPABILITY_SUSPEND);
+}
+
+gboolean gsm_consolekit_can_hibernate(GsmConsolekit *manager) {
+  return gsm_consolekit_get_capability(manager, CAPABILITY_HIBERNATE);
 }
 
 gchar *gsm_consolekit_get_current_session_type(GsmConsolekit *manager) {
-  GError *gerror;
-  DBusConnection *connection;
-  DBusError error;
-  DBusMessage *message = NULL;
-  DBusMessage *reply = NULL;
-  gchar *session_id;
-  gchar *ret;
-  DBusMessageIter iter;
-  const char *value;
+  GError *error;
+  gchar *session_type = NULL;
   GsmConsolekitPrivate *priv;
 
-  session_id = NULL;
-  ret = NULL;
-  gerror = NULL;
+  error = NULL;
   priv = gsm_consolekit_get_instance_private(manager);
 
-  if (!gsm_consolekit_ensure_ck_connection(manager, &gerror)) {
-    g_warning("Could not connect to ConsoleKit: %s", gerror->message);
-    g_error_free(gerror);
-    goto out;
+  if (priv->session_type != NULL) {
+    return g_strdup(priv->session_type);
   }
 
-  connection = dbus_g_connection_get_connection(priv->dbus_connection);
-  if (!get_current_session_id(connection, &session_id)) {
-    goto out;
+  if (!gsm_consolekit_ensure_ck_connection(manager, &error)) {
+    g_warning("Could not connect to ConsoleKit: %s", error->message);
+    g_error_free(error);
+    return NULL;
   }
 
-  dbus_error_init(&error);
-  message = dbus_message_new_method_call(
-      CK_NAME, session_id, CK_SESSION_INTERFACE, "GetSessionType");
-  if (message == NULL) {
-    goto out;
+  if (!ensure_session_id(manager)) {
+    return NULL;
   }
 
-  reply = dbus_connection_send_with_reply_and_block(connection, message, -1,
-                                                    &error);
+  cancel_call(priv->session_proxy, &priv->session_type_call);
 
-  if (reply == NULL) {
-    if (dbus_error_is_set(&error)) {
-      g_warning("Unable to determine session type: %s", error.message);
-      dbus_error_free(&error);
-    }
-    goto out;
+  if (!dbus_g_proxy_call(priv->session_proxy, "GetSessionType", &error,
+                         G_TYPE_INVALID, G_TYPE_STRING, &session_type,
+                         G_TYPE_INVALID)) {
+    g_warning("Unable to determine session type: %s", error->message);
+    g_error_free(error);
+    return NULL;
   }
 
-  dbus_message_iter_init(reply, &iter);
-  dbus_message_iter_get_basic(&iter, &value);
-  ret = g_strdup(value);
-
-out:
-  if (message != NULL) {
-    dbus_message_unref(message);
-  }
-  if (reply != NULL) {
-    dbus_message_unref(reply);
-  }
-  g_free(session_id);
+  priv->session_type = g_strdup(session_type);
 
-  return ret;
+  return session_type;
 }
 
 GsmConsolekit *gsm_get_consolekit(void) {
@@ -58,6 +58,8 @@ GQuark gsm_consolekit_error_quark(void);
 
 GsmConsolekit *gsm_consolekit_new(void) G_GNUC_MALLOC;
 
+void gsm_consolekit_prefetch(GsmConsolekit *manager);
+
 gboolean gsm_consolekit_can_switch_user(GsmConsolekit *manager);
 
 gboolean gsm_consolekit_get_restart_privileges(GsmConsolekit *manager);
@@ -36,6 +36,7 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "gsm-caller-info.h"
 #include "gsm-manager.h"
 #include "gsm-marshal.h"
 #include "gsm-util.h"
@@ -231,87 +232,31 @@ static GObject *gsm_dbus_client_constructor(
 
 static void gsm_dbus_client_init(GsmDBusClient *client) {}
 
-/* adapted from PolicyKit */
-static gboolean get_caller_info(GsmDBusClient *client, const char *sender,
-                                uid_t *calling_uid, pid_t *calling_pid) {
-  gboolean res;
-  GError *error;
-  DBusGConnection *connection;
-  DBusGProxy *bus_proxy;
-
-  res = FALSE;
-  bus_proxy = NULL;
-
-  if (sender == NULL) {
-    goto out;
-  }
-
-  error = NULL;
-  connection = dbus_g_bus_get(DBUS_BUS_SESSION, &error);
-  if (connection == NULL) {
-    if (error != NULL) {
-      g_warning("error getting session bus: %s", error->message);
-      g_error_free(error);
-    }
-    goto out;
-  }
-
-  bus_proxy = dbus_g_proxy_new_for_name(connection, DBUS_SERVICE_DBUS,
-                                        DBUS_PATH_DBUS, DBUS_INTERFACE_DBUS);
-
-  error = NULL;
-  if (!dbus_g_proxy_call(bus_proxy, "GetConnectionUnixUser", &error,
-                         G_TYPE_STRING, sender, G_TYPE_INVALID, G_TYPE_UINT,
-                         calling_uid, G_TYPE_INVALID)) {
-    g_debug("GetConnectionUnixUser() failed: %s", error->message);
-    g_error_free(error);
-    goto out;
+static void on_caller_info(const char *bus_name, gboolean valid, uid_t uid,
+                           pid_t pid, GsmDBusClient *client) {
+  /* The bus name may have been replaced while we were waiting */
+  if (valid && g_strcmp0(client->bus_name, bus_name) == 0) {
+    client->caller_pid = pid;
   }
 
-  error = NULL;
-  if (!dbus_g_proxy_call(bus_proxy, "GetConnectionUnixProcessID", &error,
-                         G_TYPE_STRING, sender, G_TYPE_INVALID, G_TYPE_UINT,
-                         calling_pid, G_TYPE_INVALID)) {
-    g_debug("GetConnectionUnixProcessID() failed: %s", error->message);
-    g_error_free(error);
-    goto out;
-  }
-
-  res = TRUE;
-
-  g_debug("uid = %d", *calling_uid);
-  g_debug("pid = %d", *calling_pid);
-
-out:
-  if (bus_proxy != NULL) {
-    g_object_unref(bus_proxy);
-  }
-  return res;
+  g_object_unref(client);
 }
 
 static void gsm_dbus_client_set_bus_name(GsmDBusClient *client,
                                          const char *bus_name) {
-  uid_t uid;
-  pid_t pid;
-
   g_return_if_fail(GSM_IS_DBUS_CLIENT(client));
 
-  g_free(client->bus_name);
+  gsm_util_intern_release(client->bus_name);
 
-  client->bus_name = g_strdup(bus_name);
+  client->bus_name = gsm_util_intern(bus_name);
   g_object_notify(G_OBJECT(client), "bus-name");
 
+  client->caller_pid = 0;
   if (client->bus_name != NULL) {
-    gboolean res;
-
-    res = get_caller_info(client, bus_name, &uid, &pid);
-    if (!res) {
-      pid = 0;
-    }
-  } else {
-    pid = 0;
+    gsm_caller_info_lookup(client->bus_name,
+                           (GsmCallerInfoFunc)on_caller_info,
+                           g_object_ref(client));
   }
-  client->caller_pid = pid;
 }
 
 const char *gsm_dbus_client_get_bus_name(GsmDBusClient *client) {
@@ -356,7 +301,7 @@ static void gsm_dbus_client_get_property(GObject *object, guint prop_id,
 static void gsm_dbus_client_finalize(GObject *object) {
   GsmDBusClient *client = (GsmDBusClient *)object;
 
-  g_free(client->bus_name);
+  gsm_util_intern_release(client->bus_name);
 
   G_OBJECT_CLASS(gsm_dbus_client_parent_class)->finalize(object);
 }
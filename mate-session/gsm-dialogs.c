@@ -0,0 +1,118 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gsm-dialogs.h"
+
+#include <gmodule.h>
+
+/* The logout, shutdown and inhibit dialogs are built as a module that is
+ * only loaded the first time one of them is shown, so that a running
+ * session does not keep their code mapped. GTK is only initialized at
+ * that point too, main() only sets up GDK. The module is made resident,
+ * since the dialog types stay registered once it is loaded.
+ */
+#define GSM_DIALOGS_MODULE "gsm-dialogs"
+
+typedef GtkWidget *(*GetDialogFunc)(GdkScreen *screen, guint32 activate_time);
+typedef GtkWidget *(*InhibitDialogNewFunc)(GsmStore *inhibitors,
+                                           GsmStore *clients, int action);
+
+static gboolean module_loaded = FALSE;
+static GetDialogFunc get_logout_dialog = NULL;
+static GetDialogFunc get_shutdown_dialog = NULL;
+static InhibitDialogNewFunc inhibit_dialog_new = NULL;
+
+static gboolean load_module(void) {
+  char *path;
+  GModule *module;
+
+  if (module_loaded) {
+    return inhibit_dialog_new != NULL;
+  }
+
+  module_loaded = TRUE;
+
+  if (!gtk_init_check(NULL, NULL)) {
+    g_warning("GsmDialogs: Unable to initialize GTK");
+    return FALSE;
+  }
+
+  path = g_module_build_path(GSM_DIALOGS_MODULE_DIR, GSM_DIALOGS_MODULE);
+  module = g_module_open(path, G_MODULE_BIND_LAZY | G_MODULE_BIND_LOCAL);
+  if (module == NULL) {
+    g_warning("GsmDialogs: Unable to load %s: %s", path, g_module_error());
+    g_free(path);
+    return FALSE;
+  }
+
+  if (!g_module_symbol(module, "gsm_get_logout_dialog",
+                       (gpointer *)&get_logout_dialog) ||
+      !g_module_symbol(module, "gsm_get_shutdown_dialog",
+                       (gpointer *)&get_shutdown_dialog) ||
+      !g_module_symbol(module, "gsm_inhibit_dialog_new",
+                       (gpointer *)&inhibit_dialog_new)) {
+    g_warning("GsmDialogs: Invalid module %s: %s", path, g_module_error());
+    g_module_close(module);
+    get_logout_dialog = NULL;
+    get_shutdown_dialog = NULL;
+    inhibit_dialog_new = NULL;
+    g_free(path);
+    return FALSE;
+  }
+
+  g_debug("GsmDialogs: Loaded %s", path);
+
+  g_module_make_resident(module);
+  g_free(path);
+
+  return TRUE;
+}
+
+/* These return NULL if the dialogs module could not be loaded. */
+GtkWidget *gsm_dialogs_get_logout_dialog(GdkScreen *screen,
+                                         guint32 activate_time) {
+  if (!load_module()) {
+    return NULL;
+  }
+
+  return get_logout_dialog(screen, activate_time);
+}
+
+GtkWidget *gsm_dialogs_get_shutdown_dialog(GdkScreen *screen,
+                                           guint32 activate_time) {
+  if (!load_module()) {
+    return NULL;
+  }
+
+  return get_shutdown_dialog(screen, activate_time);
+}
+
+GtkWidget *gsm_dialogs_inhibit_dialog_new(GsmStore *inhibitors,
+                                          GsmStore *clients, int action) {
+  if (!load_module()) {
+    return NULL;
+  }
+
+  return inhibit_dialog_new(inhibitors, clients, action);
+}
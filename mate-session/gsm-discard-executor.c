@@ -0,0 +1,149 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gsm-discard-executor.h"
+
+#include <gio/gio.h>
+#include <glib.h>
+
+#include "gsm-settings.h"
+
+/* Discard commands of the clients that left the saved session are run in
+ * the background, a few at a time, instead of one after the other while
+ * the session is being saved. The ones that could not be started before
+ * the timeout are dropped.
+ */
+#define KEY_DISCARD_MAX_JOBS "discard-max-jobs"
+
+#define DISCARD_TIMEOUT 30 /* seconds */
+
+static GQueue pending = G_QUEUE_INIT; /* command lines */
+static guint n_running = 0;
+static guint max_jobs = 0;
+static gint64 deadline = 0;
+static guint timeout_id = 0;
+
+static void run_pending(void);
+
+static void on_discard_exited(GPid pid, gint status, gpointer data) {
+  g_spawn_close_pid(pid);
+
+  n_running--;
+  run_pending();
+}
+
+static gboolean spawn_discard(const char *discard_exec) {
+  char **argv;
+  int argc;
+  GPid pid;
+  GError *error = NULL;
+
+  if (!g_shell_parse_argv(discard_exec, &argc, &argv, NULL)) {
+    return FALSE;
+  }
+
+  if (!g_spawn_async(NULL, argv, NULL,
+                     G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD, NULL,
+                     NULL, &pid, &error)) {
+    g_warning("GsmDiscardExecutor: Unable to run '%s': %s", discard_exec,
+              error->message);
+    g_error_free(error);
+    g_strfreev(argv);
+    return FALSE;
+  }
+
+  g_debug("GsmDiscardExecutor: running '%s'", discard_exec);
+
+  g_child_watch_add(pid, on_discard_exited, NULL);
+  g_strfreev(argv);
+
+  return TRUE;
+}
+
+static void drop_pending(void) {
+  if (!g_queue_is_empty(&pending)) {
+    g_warning("GsmDiscardExecutor: dropping %u discard commands after timeout",
+              g_queue_get_length(&pending));
+    g_queue_clear_full(&pending, g_free);
+  }
+}
+
+static gboolean on_timeout(gpointer data) {
+  timeout_id = 0;
+  drop_pending();
+
+  return FALSE;
+}
+
+static void run_pending(void) {
+  while (n_running < max_jobs && !g_queue_is_empty(&pending)) {
+    char *discard_exec;
+
+    discard_exec = g_queue_pop_head(&pending);
+    if (spawn_discard(discard_exec)) {
+      n_running++;
+    }
+    g_free(discard_exec);
+  }
+
+  if (g_queue_is_empty(&pending) && n_running == 0 && timeout_id > 0) {
+    g_source_remove(timeout_id);
+    timeout_id = 0;
+  }
+}
+
+static guint get_max_jobs(void) {
+  int value;
+
+  value = gsm_settings_get_int(GSM_SETTINGS_SESSION, KEY_DISCARD_MAX_JOBS);
+
+  return MAX(value, 1);
+}
+
+void gsm_discard_executor_queue(const char *discard_exec) {
+  if (max_jobs == 0) {
+    max_jobs = get_max_jobs();
+  }
+
+  g_queue_push_tail(&pending, g_strdup(discard_exec));
+
+  if (timeout_id == 0) {
+    deadline = g_get_monotonic_time() + DISCARD_TIMEOUT * G_USEC_PER_SEC;
+    timeout_id = g_timeout_add_seconds(DISCARD_TIMEOUT, on_timeout, NULL);
+  }
+
+  run_pending();
+}
+
+/* Keeps the main loop running until the queued discard commands are done
+ * or the timeout expired, so that the session does not exit before */
+void gsm_discard_executor_wait(void) {
+  while ((n_running > 0 || !g_queue_is_empty(&pending)) &&
+         g_get_monotonic_time() < deadline) {
+    g_main_context_iteration(NULL, TRUE);
+  }
+
+  drop_pending();
+}
@@ -58,6 +58,10 @@
 
 #define DIALOG_RESPONSE_LOCK_SCREEN 1
 
+/* Window snapshots are reused while the window keeps its size, for at
+ * most this long */
+#define THUMBNAIL_CACHE_TIMEOUT 60 /* seconds */
+
 struct _GsmInhibitDialog {
   GtkDialog parent;
   GtkBuilder *xml;
@@ -69,8 +73,41 @@ struct _GsmInhibitDialog {
   gboolean have_xrender;
   int xrender_event_base;
   int xrender_error_base;
+  GQueue *thumbnail_jobs;
+  guint thumbnail_id;
+  GHashTable *rows;    /* inhibitor id -> GtkTreeRowReference */
+  GHashTable *pending; /* inhibitor id -> PENDING_ADD or PENDING_REMOVE */
+  guint pending_id;
 };
 
+enum { PENDING_ADD = 1, PENDING_REMOVE };
+
+/* What the .desktop file of an app id says, looked up once per process */
+typedef struct {
+  char *name;
+  char *icon_name;
+} AppInfo;
+
+static GHashTable *app_info_cache = NULL; /* app id -> AppInfo */
+static GHashTable *icon_cache = NULL;     /* icon name -> GdkPixbuf */
+
+typedef struct {
+  char *inhibitor_id;
+  guint xid;
+  int width;
+  int height;
+  GdkPixbuf *pixbuf;
+} ThumbnailJob;
+
+typedef struct {
+  int width;
+  int height;
+  gint64 time;
+  GdkPixbuf *pixbuf;
+} Thumbnail;
+
+static GHashTable *thumbnail_cache = NULL; /* xid -> Thumbnail */
+
 enum { PROP_0, PROP_ACTION, PROP_INHIBITOR_STORE, PROP_CLIENT_STORE };
 
 enum {
@@ -78,6 +115,7 @@ enum {
   INHIBIT_NAME_COLUMN,
   INHIBIT_REASON_COLUMN,
   INHIBIT_ID_COLUMN,
+  INHIBIT_ICON_NAME_COLUMN,
   NUMBER_OF_COLUMNS
 };
 
@@ -133,27 +171,25 @@ static void gsm_inhibit_dialog_set_action(GsmInhibitDialog *dialog,
 
 static gboolean find_inhibitor(GsmInhibitDialog *dialog, const char *id,
                                GtkTreeIter *iter) {
-  GtkTreeModel *model;
+  GtkTreeRowReference *row;
+  GtkTreePath *path;
   gboolean found_item;
 
   g_assert(GSM_IS_INHIBIT_DIALOG(dialog));
 
-  found_item = FALSE;
-  model = GTK_TREE_MODEL(dialog->list_store);
-
-  if (!gtk_tree_model_get_iter_first(model, iter)) {
+  if (id == NULL) {
     return FALSE;
   }
 
-  do {
-    char *item_id;
+  row = g_hash_table_lookup(dialog->rows, id);
+  if (row == NULL || !gtk_tree_row_reference_valid(row)) {
+    return FALSE;
+  }
 
-    gtk_tree_model_get(model, iter, INHIBIT_ID_COLUMN, &item_id, -1);
-    if (item_id != NULL && id != NULL && strcmp(item_id, id) == 0) {
-      found_item = TRUE;
-    }
-    g_free(item_id);
-  } while (!found_item && gtk_tree_model_iter_next(model, iter));
+  path = gtk_tree_row_reference_get_path(row);
+  found_item =
+      gtk_tree_model_get_iter(GTK_TREE_MODEL(dialog->list_store), iter, path);
+  gtk_tree_path_free(path);
 
   return found_item;
 }
@@ -340,150 +376,381 @@ static Pixmap get_pixmap_for_window(Display *display, Window window,
 
 #endif /* HAVE_COMPOSITE */
 
-static GdkPixbuf *get_pixbuf_for_window(GdkDisplay *gdkdisplay, guint xid,
-                                        int thumb_width, int thumb_height) {
-  GdkPixbuf *pixbuf = NULL;
+static void thumbnail_free(Thumbnail *thumbnail) {
+  g_object_unref(thumbnail->pixbuf);
+  g_slice_free(Thumbnail, thumbnail);
+}
+
+static void thumbnail_job_free(ThumbnailJob *job) {
+  g_free(job->inhibitor_id);
+  if (job->pixbuf != NULL) {
+    g_object_unref(job->pixbuf);
+  }
+  g_slice_free(ThumbnailJob, job);
+}
+
+static gboolean thumbnail_is_stale(gpointer key, Thumbnail *thumbnail,
+                                   gpointer now) {
+  return *(gint64 *)now - thumbnail->time >
+         THUMBNAIL_CACHE_TIMEOUT * G_USEC_PER_SEC;
+}
+
+static void cache_thumbnail(guint xid, int width, int height,
+                            GdkPixbuf *pixbuf) {
+  Thumbnail *thumbnail;
+  gint64 now;
+
+  if (thumbnail_cache == NULL) {
+    thumbnail_cache = g_hash_table_new_full(NULL, NULL, NULL,
+                                            (GDestroyNotify)thumbnail_free);
+  }
+
+  now = g_get_monotonic_time();
+  g_hash_table_foreach_remove(thumbnail_cache, (GHRFunc)thumbnail_is_stale,
+                              &now);
+
+  thumbnail = g_slice_new(Thumbnail);
+  thumbnail->width = width;
+  thumbnail->height = height;
+  thumbnail->time = now;
+  thumbnail->pixbuf = g_object_ref(pixbuf);
+  g_hash_table_replace(thumbnail_cache, GUINT_TO_POINTER(xid), thumbnail);
+}
+
 #ifdef HAVE_XRENDER
-  Display *display;
-  Window xwindow;
-  Pixmap xpixmap;
+static gboolean get_window_size(GdkDisplay *gdkdisplay, guint xid, int *width,
+                                int *height) {
+  XWindowAttributes attr;
+  Status status;
+
+  gdk_x11_display_error_trap_push(gdkdisplay);
+  status = XGetWindowAttributes(GDK_DISPLAY_XDISPLAY(gdkdisplay), (Window)xid,
+                                &attr);
+  if (gdk_x11_display_error_trap_pop(gdkdisplay) != 0 || status == 0) {
+    return FALSE;
+  }
+
+  *width = attr.width;
+  *height = attr.height;
+
+  return TRUE;
+}
+#endif /* HAVE_XRENDER */
+
+static GdkPixbuf *lookup_thumbnail(GdkDisplay *gdkdisplay, guint xid) {
+#ifdef HAVE_XRENDER
+  Thumbnail *thumbnail;
   int width;
   int height;
 
-  display = GDK_DISPLAY_XDISPLAY(gdkdisplay);
-  xwindow = (Window)xid;
-  xpixmap = get_pixmap_for_window(display, xwindow, &width, &height);
-  if (xpixmap == None) {
-    g_debug("GsmInhibitDialog: Unable to get window snapshot for %u", xid);
+  if (thumbnail_cache == NULL) {
     return NULL;
-  } else {
-    g_debug("GsmInhibitDialog: Got xpixmap %u", (guint)xpixmap);
   }
 
-  pixbuf = pixbuf_get_from_pixmap(display, xpixmap, width, height);
+  thumbnail = g_hash_table_lookup(thumbnail_cache, GUINT_TO_POINTER(xid));
+  if (thumbnail == NULL ||
+      g_get_monotonic_time() - thumbnail->time >
+          THUMBNAIL_CACHE_TIMEOUT * G_USEC_PER_SEC ||
+      !get_window_size(gdkdisplay, xid, &width, &height) ||
+      width != thumbnail->width || height != thumbnail->height) {
+    return NULL;
+  }
+
+  g_debug("GsmInhibitDialog: reusing snapshot of %u", xid);
+
+  return g_object_ref(thumbnail->pixbuf);
+#else
+  return NULL;
+#endif
+}
+
+/* Reads the window contents back from the X server; this has to happen
+ * on the main thread, only the scaling is done in a worker */
+static gboolean capture_window(GdkDisplay *gdkdisplay, ThumbnailJob *job) {
+#ifdef HAVE_XRENDER
+  Display *display;
+  Pixmap xpixmap;
+
+  if (!get_window_size(gdkdisplay, job->xid, &job->width, &job->height)) {
+    g_debug("GsmInhibitDialog: window %u is gone", job->xid);
+    return FALSE;
+  }
+
+  display = GDK_DISPLAY_XDISPLAY(gdkdisplay);
 
+  gdk_x11_display_error_trap_push(gdkdisplay);
+  xpixmap = get_pixmap_for_window(display, (Window)job->xid, &job->width,
+                                  &job->height);
   if (xpixmap != None) {
-    gdk_x11_display_error_trap_push(gdkdisplay);
+    g_debug("GsmInhibitDialog: Got xpixmap %u", (guint)xpixmap);
+    job->pixbuf =
+        pixbuf_get_from_pixmap(display, xpixmap, job->width, job->height);
     XFreePixmap(display, xpixmap);
-    gdk_display_sync(gdkdisplay);
-    gdk_x11_display_error_trap_pop_ignored(gdkdisplay);
   }
+  gdk_display_sync(gdkdisplay);
+  gdk_x11_display_error_trap_pop_ignored(gdkdisplay);
 
-  if (pixbuf != NULL) {
-    GdkPixbuf *scaled;
-    g_debug("GsmInhibitDialog: scaling pixbuf to w=%d h=%d", width, height);
-    scaled = scale_pixbuf(pixbuf, thumb_width, thumb_height, TRUE);
-    g_object_unref(pixbuf);
-    pixbuf = scaled;
+  if (job->pixbuf == NULL) {
+    g_debug("GsmInhibitDialog: Unable to get window snapshot for %u",
+            job->xid);
   }
+
+  return job->pixbuf != NULL;
 #else
   g_debug("GsmInhibitDialog: no support for getting window snapshot");
+  return FALSE;
 #endif
+}
+
+static void scale_thumbnail_thread(GTask *task, gpointer source_object,
+                                   ThumbnailJob *job,
+                                   GCancellable *cancellable) {
+  g_task_return_pointer(task,
+                        scale_pixbuf(job->pixbuf, DEFAULT_SNAPSHOT_SIZE,
+                                     DEFAULT_SNAPSHOT_SIZE, TRUE),
+                        g_object_unref);
+}
+
+static void on_thumbnail_scaled(GsmInhibitDialog *dialog, GAsyncResult *result,
+                                gpointer data) {
+  ThumbnailJob *job;
+  GdkPixbuf *pixbuf;
+  GtkTreeIter iter;
+
+  job = g_task_get_task_data(G_TASK(result));
+  pixbuf = g_task_propagate_pointer(G_TASK(result), NULL);
+  if (pixbuf == NULL) {
+    return;
+  }
+
+  cache_thumbnail(job->xid, job->width, job->height, pixbuf);
+
+  if (!dialog->is_done && dialog->list_store != NULL &&
+      find_inhibitor(dialog, job->inhibitor_id, &iter)) {
+    gtk_list_store_set(dialog->list_store, &iter, INHIBIT_IMAGE_COLUMN, pixbuf,
+                       -1);
+  }
+
+  g_object_unref(pixbuf);
+}
+
+/* Captures one queued window per main loop iteration so that the dialog
+ * shows up and stays responsive while the snapshots come in */
+static gboolean process_thumbnail_jobs(GsmInhibitDialog *dialog) {
+  ThumbnailJob *job;
+  GTask *task;
+
+  job = g_queue_pop_head(dialog->thumbnail_jobs);
+  if (job != NULL) {
+    if (capture_window(gtk_widget_get_display(GTK_WIDGET(dialog)), job)) {
+      task = g_task_new(dialog, NULL, (GAsyncReadyCallback)on_thumbnail_scaled,
+                        NULL);
+      g_task_set_task_data(task, job, (GDestroyNotify)thumbnail_job_free);
+      g_task_run_in_thread(task, (GTaskThreadFunc)scale_thumbnail_thread);
+      g_object_unref(task);
+    } else {
+      thumbnail_job_free(job);
+    }
+  }
+
+  if (g_queue_is_empty(dialog->thumbnail_jobs)) {
+    dialog->thumbnail_id = 0;
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static void queue_thumbnail(GsmInhibitDialog *dialog, GsmInhibitor *inhibitor,
+                            guint xid) {
+  ThumbnailJob *job;
+
+  job = g_slice_new0(ThumbnailJob);
+  job->inhibitor_id = g_strdup(gsm_inhibitor_peek_id(inhibitor));
+  job->xid = xid;
+  g_queue_push_tail(dialog->thumbnail_jobs, job);
+
+  if (dialog->thumbnail_id == 0) {
+    dialog->thumbnail_id =
+        g_idle_add((GSourceFunc)process_thumbnail_jobs, dialog);
+  }
+}
+
+static EggDesktopFile *find_desktop_file(const char *app_id) {
+  char *desktop_filename;
+  EggDesktopFile *desktop_file;
+  char **search_dirs;
+  GError *error;
+
+  desktop_file = NULL;
+
+  if (!g_str_has_suffix(app_id, ".desktop")) {
+    desktop_filename = g_strdup_printf("%s.desktop", app_id);
+  } else {
+    desktop_filename = g_strdup(app_id);
+  }
+
+  search_dirs = gsm_util_get_desktop_dirs();
+  if (g_path_is_absolute(desktop_filename)) {
+    error = NULL;
+    desktop_file = egg_desktop_file_new(desktop_filename, &error);
+    if (desktop_file == NULL) {
+      char *basename;
+
+      if (error) {
+        g_warning("Unable to load desktop file '%s': %s", desktop_filename,
+                  error->message);
+        g_error_free(error);
+      } else {
+        g_warning("Unable to load desktop file '%s'", desktop_filename);
+      }
+
+      basename = g_path_get_basename(desktop_filename);
+      g_free(desktop_filename);
+      desktop_filename = basename;
+    }
+  }
+
+  if (desktop_file == NULL) {
+    error = NULL;
+    desktop_file = egg_desktop_file_new_from_dirs(
+        desktop_filename, (const char **)search_dirs, &error);
+  }
+
+  /* look for a file with a vendor prefix */
+  if (desktop_file == NULL) {
+    if (error) {
+      g_warning("Unable to find desktop file '%s': %s", desktop_filename,
+                error->message);
+      g_error_free(error);
+    } else {
+      g_warning("Unable to find desktop file '%s'", desktop_filename);
+    }
+    g_free(desktop_filename);
+    desktop_filename = g_strdup_printf("mate-%s.desktop", app_id);
+    error = NULL;
+    desktop_file = egg_desktop_file_new_from_dirs(
+        desktop_filename, (const char **)search_dirs, &error);
+  }
+  g_strfreev(search_dirs);
+
+  if (desktop_file == NULL) {
+    if (error) {
+      g_warning("Unable to find desktop file '%s': %s", desktop_filename,
+                error->message);
+      g_error_free(error);
+    } else {
+      g_warning("Unable to find desktop file '%s'", desktop_filename);
+    }
+  }
+
+  g_free(desktop_filename);
+
+  return desktop_file;
+}
+
+static void app_info_free(AppInfo *info) {
+  g_free(info->name);
+  g_free(info->icon_name);
+  g_slice_free(AppInfo, info);
+}
+
+static const AppInfo *get_app_info(const char *app_id) {
+  AppInfo *info;
+  EggDesktopFile *desktop_file;
+
+  if (app_info_cache == NULL) {
+    app_info_cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                           (GDestroyNotify)app_info_free);
+  }
+
+  info = g_hash_table_lookup(app_info_cache, app_id);
+  if (info != NULL) {
+    return info;
+  }
+
+  /* Apps without a desktop file are remembered too */
+  info = g_slice_new0(AppInfo);
+  desktop_file = find_desktop_file(app_id);
+  if (desktop_file != NULL) {
+    info->name = g_strdup(egg_desktop_file_get_name(desktop_file));
+    info->icon_name = g_strdup(egg_desktop_file_get_icon(desktop_file));
+    egg_desktop_file_free(desktop_file);
+  }
+
+  g_hash_table_insert(app_info_cache, g_strdup(app_id), info);
+
+  return info;
+}
+
+static GdkPixbuf *get_icon(const char *icon_name) {
+  GdkPixbuf *pixbuf;
+
+  if (icon_name == NULL) {
+    icon_name = "mate-windows";
+  }
+
+  if (icon_cache == NULL) {
+    icon_cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                       g_object_unref);
+  }
+
+  if (g_hash_table_lookup_extended(icon_cache, icon_name, NULL,
+                                   (gpointer *)&pixbuf)) {
+    return pixbuf;
+  }
+
+  pixbuf = _load_icon(gtk_icon_theme_get_default(), icon_name,
+                      DEFAULT_ICON_SIZE, DEFAULT_ICON_SIZE, DEFAULT_ICON_SIZE,
+                      NULL);
+  if (pixbuf == NULL && strcmp(icon_name, "mate-windows") != 0) {
+    pixbuf = get_icon("mate-windows");
+    if (pixbuf != NULL) {
+      g_object_ref(pixbuf);
+    }
+  }
+
+  g_hash_table_insert(icon_cache, g_strdup(icon_name), pixbuf);
+
   return pixbuf;
 }
 
 static void add_inhibitor(GsmInhibitDialog *dialog, GsmInhibitor *inhibitor) {
   GdkDisplay *gdkdisplay;
   const char *name;
+  const char *icon_name;
   const char *app_id;
-  char *desktop_filename;
+  const AppInfo *info;
   GdkPixbuf *pixbuf;
-  EggDesktopFile *desktop_file;
-  GError *error;
+  GtkTreeIter iter;
+  GtkTreePath *path;
   guint xid;
   char *freeme;
 
   gdkdisplay = gtk_widget_get_display(GTK_WIDGET(dialog));
 
-  /* FIXME: get info from xid */
-
-  desktop_file = NULL;
   name = NULL;
+  icon_name = NULL;
   pixbuf = NULL;
   freeme = NULL;
 
   app_id = gsm_inhibitor_peek_app_id(inhibitor);
 
-  if (IS_STRING_EMPTY(app_id)) {
-    desktop_filename = NULL;
-  } else if (!g_str_has_suffix(app_id, ".desktop")) {
-    desktop_filename = g_strdup_printf("%s.desktop", app_id);
-  } else {
-    desktop_filename = g_strdup(app_id);
-  }
-
   xid = gsm_inhibitor_peek_toplevel_xid(inhibitor);
   g_debug("GsmInhibitDialog: inhibitor has XID %u", xid);
   if (xid > 0 && dialog->have_xrender) {
-    pixbuf = get_pixbuf_for_window(gdkdisplay, xid, DEFAULT_SNAPSHOT_SIZE,
-                                   DEFAULT_SNAPSHOT_SIZE);
+    /* Rows start with the application icon; the snapshot replaces it
+     * once it has been taken */
+    pixbuf = lookup_thumbnail(gdkdisplay, xid);
     if (pixbuf == NULL) {
-      g_debug("GsmInhibitDialog: unable to read pixbuf from %u", xid);
+      queue_thumbnail(dialog, inhibitor, xid);
     }
   }
 
-  if (desktop_filename != NULL) {
-    char **search_dirs = gsm_util_get_desktop_dirs();
-    if (g_path_is_absolute(desktop_filename)) {
-      error = NULL;
-      desktop_file = egg_desktop_file_new(desktop_filename, &error);
-      if (desktop_file == NULL) {
-        char *basename;
-
-        if (error) {
-          g_warning("Unable to load desktop file '%s': %s", desktop_filename,
-                    error->message);
-          g_error_free(error);
-        } else {
-          g_warning("Unable to load desktop file '%s'", desktop_filename);
-        }
-
-        basename = g_path_get_basename(desktop_filename);
-        g_free(desktop_filename);
-        desktop_filename = basename;
-      }
-    }
-
-    if (desktop_file == NULL) {
-      error = NULL;
-      desktop_file = egg_desktop_file_new_from_dirs(
-          desktop_filename, (const char **)search_dirs, &error);
-    }
-
-    /* look for a file with a vendor prefix */
-    if (desktop_file == NULL) {
-      if (error) {
-        g_warning("Unable to find desktop file '%s': %s", desktop_filename,
-                  error->message);
-        g_error_free(error);
-      } else {
-        g_warning("Unable to find desktop file '%s'", desktop_filename);
-      }
-      g_free(desktop_filename);
-      desktop_filename = g_strdup_printf("mate-%s.desktop", app_id);
-      error = NULL;
-      desktop_file = egg_desktop_file_new_from_dirs(
-          desktop_filename, (const char **)search_dirs, &error);
-    }
-    g_strfreev(search_dirs);
-
-    if (desktop_file == NULL) {
-      if (error) {
-        g_warning("Unable to find desktop file '%s': %s", desktop_filename,
-                  error->message);
-        g_error_free(error);
-      } else {
-        g_warning("Unable to find desktop file '%s'", desktop_filename);
-      }
-    } else {
-      name = egg_desktop_file_get_name(desktop_file);
-      if (pixbuf == NULL) {
-        const char *icon_name = egg_desktop_file_get_icon(desktop_file);
-        pixbuf = _load_icon(gtk_icon_theme_get_default(), icon_name,
-                            DEFAULT_ICON_SIZE, DEFAULT_ICON_SIZE,
-                            DEFAULT_ICON_SIZE, NULL);
-      }
-    }
+  if (!IS_STRING_EMPTY(app_id)) {
+    info = get_app_info(app_id);
+    name = info->name;
+    icon_name = info->icon_name;
   }
 
   /* try client info */
@@ -508,26 +775,25 @@ static void add_inhibitor(GsmInhibitDialog *dialog, GsmInhibitor *inhibitor) {
     }
   }
 
-  if (pixbuf == NULL) {
-    pixbuf = _load_icon(gtk_icon_theme_get_default(), "mate-windows",
-                        DEFAULT_ICON_SIZE, DEFAULT_ICON_SIZE, DEFAULT_ICON_SIZE,
-                        NULL);
-  }
-
+  /* The icon itself is only loaded when the row gets drawn */
   gtk_list_store_insert_with_values(
-      dialog->list_store, NULL, 0, INHIBIT_IMAGE_COLUMN, pixbuf,
+      dialog->list_store, &iter, 0, INHIBIT_IMAGE_COLUMN, pixbuf,
       INHIBIT_NAME_COLUMN, name, INHIBIT_REASON_COLUMN,
       gsm_inhibitor_peek_reason(inhibitor), INHIBIT_ID_COLUMN,
-      gsm_inhibitor_peek_id(inhibitor), -1);
+      gsm_inhibitor_peek_id(inhibitor), INHIBIT_ICON_NAME_COLUMN, icon_name,
+      -1);
+
+  path =
+      gtk_tree_model_get_path(GTK_TREE_MODEL(dialog->list_store), &iter);
+  g_hash_table_replace(
+      dialog->rows, g_strdup(gsm_inhibitor_peek_id(inhibitor)),
+      gtk_tree_row_reference_new(GTK_TREE_MODEL(dialog->list_store), path));
+  gtk_tree_path_free(path);
 
-  g_free(desktop_filename);
   g_free(freeme);
   if (pixbuf != NULL) {
     g_object_unref(pixbuf);
   }
-  if (desktop_file != NULL) {
-    egg_desktop_file_free(desktop_file);
-  }
 }
 
 static gboolean model_has_one_entry(GtkTreeModel *model) {
@@ -572,47 +838,98 @@ static void update_dialog_text(GsmInhibitDialog *dialog) {
   }
 }
 
-static void on_store_inhibitor_added(GsmStore *store, const char *id,
-                                     GsmInhibitDialog *dialog) {
-  GsmInhibitor *inhibitor;
+static void remove_inhibitor(GsmInhibitDialog *dialog, const char *id) {
   GtkTreeIter iter;
 
-  g_debug("GsmInhibitDialog: inhibitor added: %s", id);
+  if (find_inhibitor(dialog, id, &iter)) {
+    gtk_list_store_remove(dialog->list_store, &iter);
+  }
+  g_hash_table_remove(dialog->rows, id);
+}
+
+/* Applies the inhibitors that came and went since the last frame at
+ * once, so that the dialog is laid out once per batch */
+static gboolean apply_pending_changes(GsmInhibitDialog *dialog) {
+  GHashTableIter iter;
+  gpointer key;
+  gpointer value;
+  GtkTreeIter first;
+
+  dialog->pending_id = 0;
 
   if (dialog->is_done) {
-    return;
+    g_hash_table_remove_all(dialog->pending);
+    return FALSE;
+  }
+
+  g_hash_table_iter_init(&iter, dialog->pending);
+  while (g_hash_table_iter_next(&iter, &key, &value)) {
+    const char *id = key;
+
+    if (GPOINTER_TO_INT(value) == PENDING_REMOVE) {
+      remove_inhibitor(dialog, id);
+    } else if (!g_hash_table_contains(dialog->rows, id)) {
+      GsmInhibitor *inhibitor;
+
+      inhibitor = (GsmInhibitor *)gsm_store_lookup(dialog->inhibitors, id);
+      if (inhibitor != NULL) {
+        add_inhibitor(dialog, inhibitor);
+      }
+    }
   }
+  g_hash_table_remove_all(dialog->pending);
 
-  inhibitor = (GsmInhibitor *)gsm_store_lookup(store, id);
+  update_dialog_text(dialog);
 
-  /* Add to model */
-  if (!find_inhibitor(dialog, id, &iter)) {
-    add_inhibitor(dialog, inhibitor);
-    update_dialog_text(dialog);
+  /* if there are no inhibitors left then trigger response */
+  if (!gtk_tree_model_get_iter_first(GTK_TREE_MODEL(dialog->list_store),
+                                     &first)) {
+    gtk_dialog_response(GTK_DIALOG(dialog), GTK_RESPONSE_ACCEPT);
   }
+
+  return FALSE;
 }
 
-static void on_store_inhibitor_removed(GsmStore *store, const char *id,
-                                       GsmInhibitDialog *dialog) {
-  GtkTreeIter iter;
+static void queue_pending_change(GsmInhibitDialog *dialog, const char *id,
+                                 int change) {
+  /* An inhibitor that is removed before it was shown is simply dropped */
+  if (change == PENDING_REMOVE &&
+      GPOINTER_TO_INT(g_hash_table_lookup(dialog->pending, id)) ==
+          PENDING_ADD &&
+      !g_hash_table_contains(dialog->rows, id)) {
+    g_hash_table_remove(dialog->pending, id);
+  } else {
+    g_hash_table_replace(dialog->pending, g_strdup(id),
+                         GINT_TO_POINTER(change));
+  }
 
-  g_debug("GsmInhibitDialog: inhibitor removed: %s", id);
+  if (dialog->pending_id == 0) {
+    dialog->pending_id =
+        g_idle_add_full(GDK_PRIORITY_REDRAW - 10,
+                        (GSourceFunc)apply_pending_changes, dialog, NULL);
+  }
+}
+
+static void on_store_inhibitor_added(GsmStore *store, const char *id,
+                                     GsmInhibitDialog *dialog) {
+  g_debug("GsmInhibitDialog: inhibitor added: %s", id);
 
   if (dialog->is_done) {
     return;
   }
 
-  /* Remove from model */
-  if (find_inhibitor(dialog, id, &iter)) {
-    gtk_list_store_remove(dialog->list_store, &iter);
-    update_dialog_text(dialog);
-  }
+  queue_pending_change(dialog, id, PENDING_ADD);
+}
 
-  /* if there are no inhibitors left then trigger response */
-  if (!gtk_tree_model_get_iter_first(GTK_TREE_MODEL(dialog->list_store),
-                                     &iter)) {
-    gtk_dialog_response(GTK_DIALOG(dialog), GTK_RESPONSE_ACCEPT);
+static void on_store_inhibitor_removed(GsmStore *store, const char *id,
+                                       GsmInhibitDialog *dialog) {
+  g_debug("GsmInhibitDialog: inhibitor removed: %s", id);
+
+  if (dialog->is_done) {
+    return;
   }
+
+  queue_pending_change(dialog, id, PENDING_REMOVE);
 }
 
 static void gsm_inhibit_dialog_set_inhibitor_store(GsmInhibitDialog *dialog,
@@ -700,6 +1017,27 @@ static void gsm_inhibit_dialog_get_property(GObject *object, guint prop_id,
   }
 }
 
+static void image_cell_data_func(GtkTreeViewColumn *tree_column,
+                                 GtkCellRenderer *cell, GtkTreeModel *model,
+                                 GtkTreeIter *iter, GsmInhibitDialog *dialog) {
+  GdkPixbuf *pixbuf;
+  char *icon_name;
+
+  pixbuf = NULL;
+  icon_name = NULL;
+  gtk_tree_model_get(model, iter, INHIBIT_IMAGE_COLUMN, &pixbuf,
+                     INHIBIT_ICON_NAME_COLUMN, &icon_name, -1);
+
+  if (pixbuf != NULL) {
+    g_object_set(cell, "pixbuf", pixbuf, NULL);
+    g_object_unref(pixbuf);
+  } else {
+    g_object_set(cell, "pixbuf", get_icon(icon_name), NULL);
+  }
+
+  g_free(icon_name);
+}
+
 static void name_cell_data_func(GtkTreeViewColumn *tree_column,
                                 GtkCellRenderer *cell, GtkTreeModel *model,
                                 GtkTreeIter *iter, GsmInhibitDialog *dialog) {
@@ -774,7 +1112,7 @@ static void setup_dialog(GsmInhibitDialog *dialog) {
 
   dialog->list_store =
       gtk_list_store_new(NUMBER_OF_COLUMNS, GDK_TYPE_PIXBUF, G_TYPE_STRING,
-                         G_TYPE_STRING, G_TYPE_STRING);
+                         G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING);
 
   treeview =
       GTK_WIDGET(gtk_builder_get_object(dialog->xml, "inhibitors-treeview"));
@@ -788,8 +1126,9 @@ static void setup_dialog(GsmInhibitDialog *dialog) {
   gtk_tree_view_column_pack_start(column, renderer, FALSE);
   gtk_tree_view_append_column(GTK_TREE_VIEW(treeview), column);
 
-  gtk_tree_view_column_set_attributes(column, renderer, "pixbuf",
-                                      INHIBIT_IMAGE_COLUMN, NULL);
+  gtk_tree_view_column_set_cell_data_func(
+      column, renderer, (GtkTreeCellDataFunc)image_cell_data_func, dialog,
+      NULL);
 
   g_object_set(renderer, "xalign", 1.0, NULL);
 
@@ -854,6 +1193,25 @@ static void gsm_inhibit_dialog_dispose(GObject *object) {
 
   g_debug("GsmInhibitDialog: dispose called");
 
+  if (dialog->thumbnail_id > 0) {
+    g_source_remove(dialog->thumbnail_id);
+    dialog->thumbnail_id = 0;
+  }
+
+  if (dialog->thumbnail_jobs != NULL) {
+    g_queue_free_full(dialog->thumbnail_jobs,
+                      (GDestroyNotify)thumbnail_job_free);
+    dialog->thumbnail_jobs = NULL;
+  }
+
+  if (dialog->pending_id > 0) {
+    g_source_remove(dialog->pending_id);
+    dialog->pending_id = 0;
+  }
+
+  g_clear_pointer(&dialog->pending, g_hash_table_destroy);
+  g_clear_pointer(&dialog->rows, g_hash_table_destroy);
+
   if (dialog->list_store != NULL) {
     g_object_unref(dialog->list_store);
     dialog->list_store = NULL;
@@ -905,6 +1263,13 @@ static void gsm_inhibit_dialog_init(GsmInhibitDialog *dialog) {
   GtkWidget *widget;
   GError *error;
 
+  dialog->thumbnail_jobs = g_queue_new();
+  dialog->rows =
+      g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                            (GDestroyNotify)gtk_tree_row_reference_free);
+  dialog->pending =
+      g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
   dialog->xml = gtk_builder_new();
   gtk_builder_set_translation_domain(dialog->xml, GETTEXT_PACKAGE);
 
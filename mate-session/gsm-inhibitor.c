@@ -128,14 +128,16 @@ static GObject *gsm_inhibitor_constructor(
     GObjectConstructParam *construct_properties) {
   GsmInhibitor *inhibitor;
   gboolean res;
+  char path[64];
 
   inhibitor = GSM_INHIBITOR(
       G_OBJECT_CLASS(gsm_inhibitor_parent_class)
           ->constructor(type, n_construct_properties, construct_properties));
 
-  g_free(inhibitor->id);
-  inhibitor->id = g_strdup_printf("/org/gnome/SessionManager/Inhibitor%u",
-                                  get_next_inhibitor_serial());
+  g_snprintf(path, sizeof(path), "/org/gnome/SessionManager/Inhibitor%u",
+             get_next_inhibitor_serial());
+  gsm_util_intern_release(inhibitor->id);
+  inhibitor->id = gsm_util_intern(path);
   res = register_inhibitor(inhibitor);
   if (!res) {
     g_warning("Unable to register inhibitor with session bus");
@@ -150,13 +152,8 @@ static void gsm_inhibitor_set_bus_name(GsmInhibitor *inhibitor,
                                        const char *bus_name) {
   g_return_if_fail(GSM_IS_INHIBITOR(inhibitor));
 
-  g_free(inhibitor->bus_name);
-
-  if (bus_name != NULL) {
-    inhibitor->bus_name = g_strdup(bus_name);
-  } else {
-    inhibitor->bus_name = g_strdup("");
-  }
+  gsm_util_intern_release(inhibitor->bus_name);
+  inhibitor->bus_name = gsm_util_intern(bus_name != NULL ? bus_name : "");
   g_object_notify(G_OBJECT(inhibitor), "bus-name");
 }
 
@@ -164,9 +161,9 @@ static void gsm_inhibitor_set_app_id(GsmInhibitor *inhibitor,
                                      const char *app_id) {
   g_return_if_fail(GSM_IS_INHIBITOR(inhibitor));
 
-  g_free(inhibitor->app_id);
+  gsm_util_intern_release(inhibitor->app_id);
 
-  inhibitor->app_id = g_strdup(app_id);
+  inhibitor->app_id = gsm_util_intern(app_id);
   g_object_notify(G_OBJECT(inhibitor), "app-id");
 }
 
@@ -174,15 +171,11 @@ static void gsm_inhibitor_set_client_id(GsmInhibitor *inhibitor,
                                         const char *client_id) {
   g_return_if_fail(GSM_IS_INHIBITOR(inhibitor));
 
-  g_free(inhibitor->client_id);
+  gsm_util_intern_release(inhibitor->client_id);
 
   g_debug("GsmInhibitor: setting client-id = %s", client_id);
 
-  if (client_id != NULL) {
-    inhibitor->client_id = g_strdup(client_id);
-  } else {
-    inhibitor->client_id = g_strdup("");
-  }
+  inhibitor->client_id = gsm_util_intern(client_id != NULL ? client_id : "");
   g_object_notify(G_OBJECT(inhibitor), "client-id");
 }
 
@@ -408,10 +401,10 @@ static void gsm_inhibitor_get_property(GObject *object, guint prop_id,
 static void gsm_inhibitor_finalize(GObject *object) {
   GsmInhibitor *inhibitor = (GsmInhibitor *)object;
 
-  g_free(inhibitor->id);
-  g_free(inhibitor->bus_name);
-  g_free(inhibitor->app_id);
-  g_free(inhibitor->client_id);
+  gsm_util_intern_release(inhibitor->id);
+  gsm_util_intern_release(inhibitor->bus_name);
+  gsm_util_intern_release(inhibitor->app_id);
+  gsm_util_intern_release(inhibitor->client_id);
   g_free(inhibitor->reason);
 
   G_OBJECT_CLASS(gsm_inhibitor_parent_class)->finalize(object);
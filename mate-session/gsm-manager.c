@@ -33,6 +33,7 @@
 #include <gdk/gdkx.h>
 #include <gio/gio.h> /* for gsettings */
 #include <glib-object.h>
+#include <glib-unix.h>
 #include <glib.h>
 #include <glib/gi18n.h>
 #include <glib/gstdio.h>
@@ -45,22 +46,40 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "gsm-activation-pipeline.h"
+#include "gsm-app-scope.h"
 #include "gsm-autostart-app.h"
+#include "gsm-autostart-cache.h"
+#include "gsm-caller-info.h"
+#include "gsm-condition-monitor.h"
 #include "gsm-consolekit.h"
 #include "gsm-dbus-client.h"
+#include "gsm-dialogs.h"
 #include "gsm-inhibit-dialog.h"
 #include "gsm-inhibitor.h"
 #include "gsm-logout-dialog.h"
 #include "gsm-manager-glue.h"
+#include "gsm-marshal.h"
+#include "gsm-metrics.h"
+#include "gsm-ordered-set.h"
 #include "gsm-presence.h"
+#include "gsm-readahead.h"
+#include "gsm-resource-monitor.h"
+#include "gsm-startup-graph.h"
+#include "gsm-restart-history.h"
+#include "gsm-startup-history.h"
 #include "gsm-store.h"
+#include "gsm-switch-user.h"
+#include "gsm-trace.h"
 #include "gsm-util.h"
 #include "gsm-xsmp-client.h"
+#include "mdm-log.h"
 #include "mdm.h"
 #ifdef HAVE_SYSTEMD
 #include "gsm-systemd.h"
 #endif
 #include "gsm-session-save.h"
+#include "gsm-settings.h"
 
 #define GSM_MANAGER_GET_PRIVATE(o) \
   (G_TYPE_INSTANCE_GET_PRIVATE((o), GSM_TYPE_MANAGER, GsmManagerPrivate))
@@ -69,6 +88,16 @@
 #define GSM_MANAGER_DBUS_NAME "org.gnome.SessionManager"
 
 #define GSM_MANAGER_PHASE_TIMEOUT 30 /* seconds */
+/* How long a client gets to answer whether the session can end before it
+ * is reported as not responding */
+#define GSM_MANAGER_QUERY_TIMEOUT 1000 /* milliseconds */
+/* How long clients get to save their state on logout; the ones that are
+ * not done by then are saved with their last known properties */
+#define GSM_MANAGER_SAVE_TIMEOUT 10 /* seconds */
+/* Checkpoints are postponed by doubling the interval up to this factor
+ * while the user is active or the system is busy */
+#define GSM_MANAGER_CHECKPOINT_MAX_BACKOFF 8
+#define GSM_MANAGER_CHECKPOINT_BUSY_THRESHOLD 50 /* percent */
 
 /* In the exit phase, all apps were already given the chance to inhibit the
  * session end At that stage we don't want to wait much for apps to respond, we
@@ -76,20 +105,39 @@
  */
 #define GSM_MANAGER_EXIT_PHASE_TIMEOUT 1 /* seconds */
 
-#define MDM_FLEXISERVER_COMMAND "mdmflexiserver"
-#define MDM_FLEXISERVER_ARGS "--startnew Standard"
+/* Budget of a fast logout when logout-budget is not set */
+#define GSM_MANAGER_FAST_LOGOUT_BUDGET 10 /* seconds */
 
-#define GDM_FLEXISERVER_COMMAND "gdmflexiserver"
-#define GDM_FLEXISERVER_ARGS "--startnew Standard"
+/* ClientsChanged and InhibitorsChanged are emitted at most this often */
+#define GSM_MANAGER_CHANGED_SIGNAL_INTERVAL 50 /* milliseconds */
+
+#define GSM_MANAGER_OBJECT_PATH_ARRAY_TYPE \
+  (dbus_g_type_get_collection("GPtrArray", DBUS_TYPE_G_OBJECT_PATH))
 
-#define LOCKDOWN_SCHEMA "org.mate.lockdown"
 #define KEY_LOCK_DISABLE "disable-lock-screen"
 #define KEY_LOG_OUT_DISABLE "disable-log-out"
 #define KEY_USER_SWITCH_DISABLE "disable-user-switching"
 
-#define SESSION_SCHEMA "org.mate.session"
 #define KEY_IDLE_DELAY "idle-delay"
+#define KEY_IDLE_DEBOUNCE "idle-debounce"
 #define KEY_AUTOSAVE "auto-save-session"
+#define KEY_DEPENDENCY_STARTUP "dependency-startup"
+#define KEY_LONGEST_STARTUP_FIRST "longest-startup-first"
+#define KEY_DELAYED_START_THRESHOLD "delayed-start-busy-threshold"
+#define KEY_CHECKPOINT_INTERVAL "checkpoint-interval"
+#define KEY_RESTORE_MAX_PENDING "restore-max-pending"
+#define KEY_RESTORE_BUSY_THRESHOLD "restore-busy-threshold"
+#define KEY_LOGOUT_BUDGET "logout-budget"
+
+/* GsmStore indexes */
+#define INDEX_STARTUP_ID "startup-id"
+#define INDEX_APP_ID "app-id"
+#define INDEX_PROVIDES "provides"
+#define INDEX_BUS_NAME "bus-name"
+#define INDEX_CLIENT_ID "client-id"
+#define INDEX_COOKIE "cookie"
+
+#define N_INHIBITOR_FLAG_BITS 32
 
 #ifdef __GNUC__
 #define UNUSED_VARIABLE __attribute__((unused))
@@ -108,24 +156,65 @@ typedef enum {
   GSM_MANAGER_LOGOUT_SHUTDOWN_MDM
 } GsmManagerLogoutType;
 
+/* Object ids added or removed since the last ClientsChanged or
+ * InhibitorsChanged signal */
+typedef struct {
+  GHashTable *added;
+  GHashTable *removed;
+} ChangeBatch;
+
 typedef struct {
   gboolean failsafe;
   GsmStore *clients;
   GsmStore *inhibitors;
   GsmStore *apps;
+  GsmConditionMonitor *condition_monitor; /* shared by the apps */
   GsmPresence *presence;
 
+  GHashTable *inhibitor_flags; /* id -> flags */
+  ChangeBatch client_changes;
+  ChangeBatch inhibitor_changes;
+  guint changed_signals_id;
+  guint32 next_cookie;
+  /* Number of inhibitors holding each GsmInhibitorFlag bit, and a counter
+   * bumped whenever one of them drops to or rises from zero */
+  guint inhibited_counts[N_INHIBITOR_FLAG_BITS];
+  guint inhibited_generation;
+  guint inhibited_generation_sent;
+
   /* Current status */
   GsmManagerPhase phase;
   guint phase_timeout_id;
-  GSList *pending_apps;
+  GsmOrderedSet *pending_apps;
+  GsmStartupGraph *startup_graph;
+  GHashTable *launching_apps; /* GsmApp -> LaunchingApp */
+  GQueue *delayed_starts;      /* DelayedStart, soonest first */
+  guint delayed_start_id;
+  GQueue *restore_queue; /* GsmApp, highest restore priority first */
+  guint n_restoring;     /* restored apps that did not register yet */
+  gint64 restore_admitted; /* monotonic time of the last restored app */
+  guint restore_id;
   GsmManagerLogoutMode logout_mode;
-  GSList *query_clients;
+  GsmOrderedSet *query_clients;
+  GHashTable *query_responses; /* client id -> QueryResponse */
+  gint64 phase_started;
+  gint64 end_session_sent; /* when the last EndSession round went out */
   guint query_timeout_id;
+  guint save_timeout_id;
+  guint checkpoint_id;
+  guint checkpoint_backoff;
+  /* Time allowed for the whole end of the session, and how much of it
+   * each of the query-end-session, end-session and exit phases used */
+  gint64 logout_budget;  /* microseconds, 0 if there is none */
+  gint64 logout_started; /* monotonic time */
+  gint64 logout_phase_started; /* monotonic time */
+  gint64 logout_spent[3];
+  gboolean logout_budget_forced;
+  guint logout_budget_id;
   /* This is used for GSM_MANAGER_PHASE_END_SESSION only at the moment,
    * since it uses a sublist of all running client that replied in a
    * specific way */
-  GSList *next_query_clients;
+  GsmOrderedSet *next_query_clients;
   /* This is the action that will be done just before we exit */
   GsmManagerLogoutType logout_type;
 
@@ -140,19 +229,48 @@ typedef struct {
 
   char *renderer;
 
-  DBusGProxy *bus_proxy;
+  /* Bus names we hold a NameOwnerChanged match rule for */
+  GHashTable *bus_names;     /* client or inhibitor id -> bus name */
+  GHashTable *watched_names; /* bus name -> number of ids */
+
+  /* Inhibitors created by InhibitFd */
+  GHashTable *inhibit_fds; /* inhibitor id -> InhibitFd */
+
+  /* Inhibitors created with a timeout, all expired by a single timer */
+  GQueue *inhibitor_expiries; /* InhibitorExpiry, soonest first */
+  GHashTable *expiry_links;   /* inhibitor id -> link in inhibitor_expiries */
+  guint inhibitor_expiry_id;
+
   DBusGConnection *connection;
   gboolean dbus_disconnected : 1;
 } GsmManagerPrivate;
 
+/* The end of an InhibitFd pipe kept by the manager */
+typedef struct {
+  int fd;
+  guint watch_id;
+} InhibitFd;
+
+static void inhibit_fd_free(InhibitFd *data);
+
+typedef struct {
+  gint64 deadline; /* monotonic time, in seconds */
+  char *id;
+} InhibitorExpiry;
+
+static void inhibitor_expiry_free(InhibitorExpiry *expiry);
+
 enum { PROP_0, PROP_CLIENT_STORE, PROP_RENDERER, PROP_FAILSAFE };
 
 enum {
   PHASE_CHANGED,
   CLIENT_ADDED,
   CLIENT_REMOVED,
+  CLIENTS_CHANGED,
   INHIBITOR_ADDED,
   INHIBITOR_REMOVED,
+  INHIBITORS_CHANGED,
+  INHIBITED_CHANGED,
   SESSION_RUNNING,
   SESSION_OVER,
   LAST_SIGNAL
@@ -171,6 +289,9 @@ static void _handle_client_end_session_response(
 
 static gboolean auto_save_is_enabled(GsmManager *manager);
 static void maybe_save_session(GsmManager *manager);
+static gboolean session_can_be_saved(GsmManager *manager);
+static gboolean checkpoints_enabled(GsmManager *manager);
+static void schedule_checkpoint(GsmManager *manager);
 
 static gpointer manager_object = NULL;
 
@@ -240,25 +361,115 @@ static void debug_inhibitors(GsmManager *manager) {
   gsm_store_foreach(priv->inhibitors, (GsmStoreFunc)_debug_inhibitor, manager);
 }
 
-static gboolean _find_by_cookie(const char *id, GsmInhibitor *inhibitor,
-                                guint *cookie_ap) {
-  guint cookie_b;
+static char **single_index_key(const char *key) {
+  char **keys;
+
+  if (IS_STRING_EMPTY(key)) {
+    return NULL;
+  }
+
+  keys = g_new0(char *, 2);
+  keys[0] = gsm_util_intern(key);
+
+  return keys;
+}
+
+static char **client_startup_id_key(GsmClient *client) {
+  return single_index_key(gsm_client_peek_startup_id(client));
+}
 
-  cookie_b = gsm_inhibitor_peek_cookie(inhibitor);
+static char **client_bus_name_key(GsmClient *client) {
+  if (!GSM_IS_DBUS_CLIENT(client)) {
+    return NULL;
+  }
 
-  return (*cookie_ap == cookie_b);
+  return single_index_key(
+      gsm_dbus_client_get_bus_name(GSM_DBUS_CLIENT(client)));
 }
 
-static gboolean _find_by_startup_id(const char *id, GsmClient *client,
-                                    const char *startup_id_a) {
-  const char *startup_id_b;
+static char **app_startup_id_key(GsmApp *app) {
+  return single_index_key(gsm_app_peek_startup_id(app));
+}
 
-  startup_id_b = gsm_client_peek_startup_id(client);
-  if (IS_STRING_EMPTY(startup_id_b)) {
-    return FALSE;
+static char **app_app_id_key(GsmApp *app) {
+  return single_index_key(gsm_app_peek_app_id(app));
+}
+
+static char **app_provides_keys(GsmApp *app) {
+  const char *const *provides;
+  char **keys;
+  guint i;
+
+  provides = gsm_app_peek_provides(app);
+  if (provides == NULL) {
+    return NULL;
+  }
+
+  keys = g_new0(char *, g_strv_length((char **)provides) + 1);
+  for (i = 0; provides[i] != NULL; i++) {
+    keys[i] = gsm_util_intern(provides[i]);
+  }
+
+  return keys;
+}
+
+static char **inhibitor_cookie_key(GsmInhibitor *inhibitor) {
+  char key[16];
+
+  g_snprintf(key, sizeof(key), "%u", gsm_inhibitor_peek_cookie(inhibitor));
+
+  return single_index_key(key);
+}
+
+static char **inhibitor_bus_name_key(GsmInhibitor *inhibitor) {
+  return single_index_key(gsm_inhibitor_peek_bus_name(inhibitor));
+}
+
+static char **inhibitor_client_id_key(GsmInhibitor *inhibitor) {
+  return single_index_key(gsm_inhibitor_peek_client_id(inhibitor));
+}
+
+static GsmInhibitor *find_inhibitor_for_cookie(GsmManager *manager,
+                                               guint cookie) {
+  char key[16];
+  GsmManagerPrivate *priv;
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  g_snprintf(key, sizeof(key), "%u", cookie);
+
+  return (GsmInhibitor *)gsm_store_lookup_by_index(priv->inhibitors,
+                                                   INDEX_COOKIE, key);
+}
+
+static GsmClient *find_client_for_startup_id(GsmManager *manager,
+                                             const char *startup_id) {
+  GsmManagerPrivate *priv;
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  return (GsmClient *)gsm_store_lookup_by_index(priv->clients,
+                                                INDEX_STARTUP_ID, startup_id);
+}
+
+/* Starts @app, unless it is started on demand: then it is only started
+ * once its D-Bus name is activated, and *on_demand is set */
+static gboolean start_or_defer_app(GsmApp *app, gboolean *on_demand,
+                                   GError **error) {
+  if (GSM_IS_AUTOSTART_APP(app) &&
+      gsm_autostart_app_start_on_demand(GSM_AUTOSTART_APP(app))) {
+    g_debug("GsmManager: %s will be started on demand", gsm_app_peek_id(app));
+    if (on_demand != NULL) {
+      *on_demand = TRUE;
+    }
+    return TRUE;
   }
 
-  return (strcmp(startup_id_a, startup_id_b) == 0);
+  if (on_demand != NULL) {
+    *on_demand = FALSE;
+  }
+
+  return gsm_app_start(app, error);
 }
 
 static void app_condition_changed(GsmApp *app, gboolean condition,
@@ -271,9 +482,7 @@ static void app_condition_changed(GsmApp *app, gboolean condition,
   g_debug("GsmManager: app:%s condition changed condition:%d",
           gsm_app_peek_id(app), condition);
 
-  client = (GsmClient *)gsm_store_find(priv->clients,
-                                       (GsmStoreFunc)_find_by_startup_id,
-                                       (char *)gsm_app_peek_startup_id(app));
+  client = find_client_for_startup_id(manager, gsm_app_peek_startup_id(app));
 
   if (condition) {
     if (!gsm_app_is_running(app) && client == NULL) {
@@ -282,7 +491,7 @@ static void app_condition_changed(GsmApp *app, gboolean condition,
 
       g_debug("GsmManager: starting app '%s'", gsm_app_peek_id(app));
 
-      res = gsm_app_start(app, &error);
+      res = start_or_defer_app(app, NULL, &error);
       if (error != NULL) {
         g_warning("Not able to start app from its condition: %s",
                   error->message);
@@ -296,6 +505,10 @@ static void app_condition_changed(GsmApp *app, gboolean condition,
     GError *error;
     gboolean UNUSED_VARIABLE res;
 
+    if (GSM_IS_AUTOSTART_APP(app)) {
+      gsm_autostart_app_cancel_on_demand(GSM_AUTOSTART_APP(app));
+    }
+
     if (client != NULL) {
       /* Kill client in case condition if false and make sure it won't
        * be automatically restarted by adding the client to
@@ -477,6 +690,87 @@ static void gsm_manager_quit(GsmManager *manager) {
   }
 }
 
+static void on_environment_flushed(GsmManager *manager) {
+  start_phase(manager);
+  g_object_unref(manager);
+}
+
+/* Apps of the next phase may be bus activated, so the variables set so
+ * far have to be exported before the phase starts */
+static void start_phase_after_environment(GsmManager *manager) {
+  GsmManagerPrivate *priv;
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  if (priv->phase > GSM_MANAGER_PHASE_RUNNING) {
+    start_phase(manager);
+    return;
+  }
+
+  gsm_util_flush_environment(
+      (GsmUtilEnvironmentFlushedFunc)on_environment_flushed,
+      g_object_ref(manager));
+}
+
+static const char *const logout_budget_phases[] = {"query", "end session",
+                                                   "exit"};
+
+/* Cumulative share of the budget, in percent, that may have been spent by
+ * the end of each phase; time a phase does not use goes to the next one */
+static const guint logout_budget_shares[] = {40, 90, 100};
+
+static void report_logout_budget(GsmManager *manager) {
+  GsmManagerPrivate *priv;
+  GString *report;
+  char *detail;
+  guint i;
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  report = g_string_new(NULL);
+  for (i = 0; i < G_N_ELEMENTS(priv->logout_spent); i++) {
+    g_string_append_printf(report, "%s%s %.2fs", i > 0 ? ", " : "",
+                           logout_budget_phases[i],
+                           priv->logout_spent[i] / (double)G_USEC_PER_SEC);
+  }
+
+  g_message("Session ended in %.2fs of a %.2fs logout budget (%s)%s",
+            (g_get_monotonic_time() - priv->logout_started) /
+                (double)G_USEC_PER_SEC,
+            priv->logout_budget / (double)G_USEC_PER_SEC, report->str,
+            priv->logout_budget_forced ? ", forced once the budget was spent"
+                                       : "");
+
+  detail = g_strdup_printf("%s%s", report->str,
+                           priv->logout_budget_forced ? ", forced" : "");
+  gsm_trace_instant("logout", "budget", detail);
+  g_free(detail);
+
+  g_string_free(report, TRUE);
+}
+
+static void finish_logout_budget_phase(GsmManager *manager) {
+  GsmManagerPrivate *priv;
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  if (priv->logout_budget_id > 0) {
+    g_source_remove(priv->logout_budget_id);
+    priv->logout_budget_id = 0;
+  }
+
+  if (priv->logout_budget == 0) {
+    return;
+  }
+
+  priv->logout_spent[priv->phase - GSM_MANAGER_PHASE_QUERY_END_SESSION] =
+      g_get_monotonic_time() - priv->logout_phase_started;
+
+  if (priv->phase == GSM_MANAGER_PHASE_EXIT) {
+    report_logout_budget(manager);
+  }
+}
+
 static void end_phase(GsmManager *manager) {
   GsmManagerPrivate *priv;
   gboolean start_next_phase = TRUE;
@@ -485,14 +779,19 @@ static void end_phase(GsmManager *manager) {
 
   g_debug("GsmManager: ending phase %s\n", phase_num_to_name(priv->phase));
 
-  g_slist_free(priv->pending_apps);
-  priv->pending_apps = NULL;
+  gsm_trace_end("phase", phase_num_to_name(priv->phase));
+  gsm_metrics_observe_labeled(GSM_METRIC_PHASE_DURATION,
+                              phase_num_to_name(priv->phase),
+                              g_get_monotonic_time() - priv->phase_started);
 
-  g_slist_free(priv->query_clients);
-  priv->query_clients = NULL;
+  if (priv->phase >= GSM_MANAGER_PHASE_QUERY_END_SESSION) {
+    finish_logout_budget_phase(manager);
+  }
 
-  g_slist_free(priv->next_query_clients);
-  priv->next_query_clients = NULL;
+  gsm_ordered_set_clear(priv->pending_apps);
+  gsm_ordered_set_clear(priv->query_clients);
+  gsm_ordered_set_clear(priv->next_query_clients);
+  g_hash_table_remove_all(priv->query_responses);
 
   if (priv->phase_timeout_id > 0) {
     g_source_remove(priv->phase_timeout_id);
@@ -516,7 +815,14 @@ static void end_phase(GsmManager *manager) {
     case GSM_MANAGER_PHASE_QUERY_END_SESSION:
       break;
     case GSM_MANAGER_PHASE_END_SESSION:
-      if (auto_save_is_enabled(manager)) maybe_save_session(manager);
+      if (priv->save_timeout_id > 0) {
+        g_source_remove(priv->save_timeout_id);
+        priv->save_timeout_id = 0;
+      }
+      if (auto_save_is_enabled(manager))
+        maybe_save_session(manager);
+      else
+        gsm_session_save_abort();
       break;
     case GSM_MANAGER_PHASE_EXIT:
       start_next_phase = FALSE;
@@ -529,7 +835,7 @@ static void end_phase(GsmManager *manager) {
 
   if (start_next_phase) {
     priv->phase++;
-    start_phase(manager);
+    start_phase_after_environment(manager);
   }
 }
 
@@ -537,10 +843,10 @@ static void app_registered(GsmApp *app, GsmManager *manager) {
   GsmManagerPrivate *priv;
 
   priv = gsm_manager_get_instance_private(manager);
-  priv->pending_apps = g_slist_remove(priv->pending_apps, app);
+  gsm_ordered_set_remove(priv->pending_apps, app);
   g_signal_handlers_disconnect_by_func(app, app_registered, manager);
 
-  if (priv->pending_apps == NULL) {
+  if (gsm_ordered_set_is_empty(priv->pending_apps)) {
     if (priv->phase_timeout_id > 0) {
       g_source_remove(priv->phase_timeout_id);
       priv->phase_timeout_id = 0;
@@ -564,12 +870,19 @@ static gboolean on_phase_timeout(GsmManager *manager) {
     case GSM_MANAGER_PHASE_PANEL:
     case GSM_MANAGER_PHASE_DESKTOP:
     case GSM_MANAGER_PHASE_APPLICATION:
-      for (a = priv->pending_apps; a; a = a->next) {
+      if (priv->startup_graph != NULL) {
+        gsm_startup_graph_expire_phase(priv->startup_graph, priv->phase);
+      }
+      for (a = gsm_ordered_set_peek_items(priv->pending_apps); a != NULL;
+           a = a->next) {
         g_warning("Application '%s' failed to register before timeout",
                   gsm_app_peek_app_id(a->data));
         g_signal_handlers_disconnect_by_func(a->data, app_registered, manager);
         /* FIXME: what if the app was filling in a required slot? */
       }
+      if (!gsm_ordered_set_is_empty(priv->pending_apps)) {
+        g_free(mdm_log_dump("phase timeout", NULL));
+      }
       break;
     case GSM_MANAGER_PHASE_RUNNING:
       break;
@@ -588,13 +901,15 @@ static gboolean on_phase_timeout(GsmManager *manager) {
   return FALSE;
 }
 
-static gboolean _autostart_delay_timeout(GsmApp *app) {
+static void start_delayed_app(GsmApp *app) {
   GError *error = NULL;
   gboolean res;
 
+  gsm_trace_instant("app", "delayed-start", gsm_app_peek_app_id(app));
+
   if (!gsm_app_peek_is_disabled(app) &&
       !gsm_app_peek_is_conditionally_disabled(app)) {
-    res = gsm_app_start(app, &error);
+    res = start_or_defer_app(app, NULL, &error);
     if (!res) {
       if (error != NULL) {
         g_warning("Could not launch application '%s': %s",
@@ -603,199 +918,781 @@ static gboolean _autostart_delay_timeout(GsmApp *app) {
       }
     }
   }
+}
 
-  g_object_unref(app);
+typedef struct {
+  gint64 deadline; /* monotonic time, in seconds */
+  GsmApp *app;
+} DelayedStart;
 
-  return FALSE;
+static void delayed_start_free(DelayedStart *start) {
+  g_object_unref(start->app);
+  g_slice_free(DelayedStart, start);
 }
 
-static gboolean _start_app(const char *id, GsmApp *app, GsmManager *manager) {
-  GError *error;
-  gboolean res;
-  int delay;
-  GsmManagerPrivate *priv;
+static gint compare_delayed_starts(const DelayedStart *a, const DelayedStart *b,
+                                   gpointer data) {
+  return (a->deadline > b->deadline) - (a->deadline < b->deadline);
+}
 
-  priv = gsm_manager_get_instance_private(manager);
+/* Returns the IO pressure (PSI "some" over 10 seconds) in percent */
+static double get_io_pressure(void) {
+  char *contents;
+  double value = 0;
 
-  if (gsm_app_peek_phase(app) != priv->phase) {
-    goto out;
+  if (g_file_get_contents("/proc/pressure/io", &contents, NULL, NULL)) {
+    if (sscanf(contents, "some avg10=%lf", &value) != 1) {
+      value = 0;
+    }
+    g_free(contents);
   }
 
-  /* Keep track of app autostart condition in order to react
-   * accordingly in the future. */
-  g_signal_connect(app, "condition-changed", G_CALLBACK(app_condition_changed),
-                   manager);
-
-  if (gsm_app_peek_is_disabled(app) ||
-      gsm_app_peek_is_conditionally_disabled(app)) {
-    g_debug("GsmManager: Skipping disabled app: %s", id);
-    goto out;
-  }
+  return value;
+}
 
-  delay = gsm_app_peek_autostart_delay(app);
-  if (delay > 0) {
-    g_timeout_add_seconds(delay, (GSourceFunc)_autostart_delay_timeout,
-                          g_object_ref(app));
-    g_debug("GsmManager: %s is scheduled to start in %d seconds", id, delay);
-    goto out;
-  }
+/* Returns the CPU pressure (PSI "some" over 10 seconds) in percent, or
+ * the 1 minute load average per CPU if PSI is not available */
+static double get_system_busyness(void) {
+  char *contents;
+  double value = 0;
+  double loadavg;
 
-  error = NULL;
-  res = gsm_app_start(app, &error);
-  if (!res) {
-    if (error != NULL) {
-      g_warning("Could not launch application '%s': %s",
-                gsm_app_peek_app_id(app), error->message);
-      g_error_free(error);
-      error = NULL;
+  if (g_file_get_contents("/proc/pressure/cpu", &contents, NULL, NULL)) {
+    if (sscanf(contents, "some avg10=%lf", &value) != 1) {
+      value = 0;
     }
-    goto out;
+    g_free(contents);
+    return value;
   }
 
-  if (priv->phase < GSM_MANAGER_PHASE_APPLICATION) {
-    g_signal_connect(app, "exited", G_CALLBACK(app_registered), manager);
-    g_signal_connect(app, "registered", G_CALLBACK(app_registered), manager);
-    priv->pending_apps = g_slist_prepend(priv->pending_apps, app);
+  if (getloadavg(&loadavg, 1) == 1) {
+    value = loadavg * 100 / g_get_num_processors();
   }
-out:
-  return FALSE;
-}
-
-static void do_phase_startup(GsmManager *manager) {
-  GsmManagerPrivate *priv;
-
-  priv = gsm_manager_get_instance_private(manager);
-  gsm_store_foreach(priv->apps, (GsmStoreFunc)_start_app, manager);
 
-  if (priv->pending_apps != NULL) {
-    if (priv->phase < GSM_MANAGER_PHASE_APPLICATION) {
-      priv->phase_timeout_id = g_timeout_add_seconds(
-          GSM_MANAGER_PHASE_TIMEOUT, (GSourceFunc)on_phase_timeout, manager);
-    }
-  } else {
-    end_phase(manager);
-  }
+  return value;
 }
 
-typedef struct {
-  GsmManager *manager;
-  guint flags;
-} ClientEndSessionData;
+static void schedule_delayed_starts(GsmManager *manager);
 
-static gboolean _client_end_session(GsmClient *client,
-                                    ClientEndSessionData *data) {
-  gboolean ret;
-  GError *error;
+static gboolean system_is_busy(GsmManager *manager) {
   GsmManagerPrivate *priv;
+  int threshold;
 
-  priv = gsm_manager_get_instance_private(data->manager);
+  priv = gsm_manager_get_instance_private(manager);
 
-  error = NULL;
-  ret = gsm_client_end_session(client, data->flags, &error);
-  if (!ret) {
-    g_warning("Unable to query client: %s", error->message);
-    g_error_free(error);
-    /* FIXME: what should we do if we can't communicate with client? */
-  } else {
-    g_debug("GsmManager: adding client to end-session clients: %s",
-            gsm_client_peek_id(client));
-    priv->query_clients = g_slist_prepend(priv->query_clients, client);
+  /* Let the apps we wait for finish their own startup first */
+  if (priv->phase < GSM_MANAGER_PHASE_RUNNING) {
+    return TRUE;
   }
 
-  return FALSE;
-}
+  threshold =
+      gsm_settings_get_int(GSM_SETTINGS_SESSION, KEY_DELAYED_START_THRESHOLD);
 
-static gboolean _client_end_session_helper(const char *id, GsmClient *client,
-                                           ClientEndSessionData *data) {
-  return _client_end_session(client, data);
+  return threshold > 0 && get_system_busyness() > threshold;
 }
 
-static void do_phase_end_session(GsmManager *manager) {
-  ClientEndSessionData data;
+static gboolean on_delayed_start_timeout(GsmManager *manager) {
   GsmManagerPrivate *priv;
+  DelayedStart *start;
+  gint64 now;
 
-  data.manager = manager;
-  data.flags = 0;
   priv = gsm_manager_get_instance_private(manager);
+  priv->delayed_start_id = 0;
 
-  if (priv->logout_mode == GSM_MANAGER_LOGOUT_MODE_FORCE) {
-    data.flags |= GSM_CLIENT_END_SESSION_FLAG_FORCEFUL;
+  now = g_get_monotonic_time() / G_USEC_PER_SEC;
+
+  start = g_queue_peek_head(priv->delayed_starts);
+  if (start == NULL) {
+    return FALSE;
   }
-  if (auto_save_is_enabled(manager)) {
-    data.flags |= GSM_CLIENT_END_SESSION_FLAG_SAVE;
+
+  /* Hold the batch back while the system is busy, but only for so long */
+  if (start->deadline > now - GSM_MANAGER_PHASE_TIMEOUT &&
+      system_is_busy(manager)) {
+    g_debug("GsmManager: system is busy, holding delayed apps back");
+    priv->delayed_start_id = g_timeout_add_seconds(
+        1, (GSourceFunc)on_delayed_start_timeout, manager);
+    return FALSE;
   }
 
-  if (priv->phase_timeout_id > 0) {
-    g_source_remove(priv->phase_timeout_id);
-    priv->phase_timeout_id = 0;
+  /* Start everything that is due, all at once */
+  while ((start = g_queue_peek_head(priv->delayed_starts)) != NULL &&
+         start->deadline <= now) {
+    g_queue_pop_head(priv->delayed_starts);
+    start_delayed_app(start->app);
+    delayed_start_free(start);
   }
 
-  if (gsm_store_size(priv->clients) > 0) {
-    priv->phase_timeout_id = g_timeout_add_seconds(
-        GSM_MANAGER_PHASE_TIMEOUT, (GSourceFunc)on_phase_timeout, manager);
+  schedule_delayed_starts(manager);
 
-    gsm_store_foreach(priv->clients, (GsmStoreFunc)_client_end_session_helper,
-                      &data);
-  } else {
-    end_phase(manager);
-  }
+  return FALSE;
 }
 
-static void do_phase_end_session_part_2(GsmManager *manager) {
-  ClientEndSessionData data;
+/* Arms the single timer for the earliest delayed start */
+static void schedule_delayed_starts(GsmManager *manager) {
   GsmManagerPrivate *priv;
+  DelayedStart *start;
+  gint64 now;
 
-  data.manager = manager;
-  data.flags = 0;
   priv = gsm_manager_get_instance_private(manager);
 
-  if (priv->logout_mode == GSM_MANAGER_LOGOUT_MODE_FORCE) {
-    data.flags |= GSM_CLIENT_END_SESSION_FLAG_FORCEFUL;
+  if (priv->delayed_start_id > 0) {
+    g_source_remove(priv->delayed_start_id);
+    priv->delayed_start_id = 0;
   }
-  if (auto_save_is_enabled(manager)) {
-    data.flags |= GSM_CLIENT_END_SESSION_FLAG_SAVE;
+
+  start = g_queue_peek_head(priv->delayed_starts);
+  if (start == NULL) {
+    return;
   }
-  data.flags |= GSM_CLIENT_END_SESSION_FLAG_LAST;
 
-  /* keep the timeout that was started at the beginning of the
-   * GSM_MANAGER_PHASE_END_SESSION phase */
+  now = g_get_monotonic_time() / G_USEC_PER_SEC;
+  priv->delayed_start_id = g_timeout_add_seconds(
+      (guint)MAX(start->deadline - now, 0),
+      (GSourceFunc)on_delayed_start_timeout, manager);
+}
 
-  if (g_slist_length(priv->next_query_clients) > 0) {
-    g_slist_foreach(priv->next_query_clients, (GFunc)_client_end_session,
-                    &data);
+static void queue_delayed_start(GsmManager *manager, GsmApp *app, int delay) {
+  GsmManagerPrivate *priv;
+  DelayedStart *start;
 
-    g_slist_free(priv->next_query_clients);
-    priv->next_query_clients = NULL;
-  } else {
-    end_phase(manager);
-  }
-}
+  priv = gsm_manager_get_instance_private(manager);
 
-static gboolean _client_stop(const char *id, GsmClient *client,
-                             gpointer user_data) {
-  gboolean ret;
-  GError *error;
+  start = g_slice_new(DelayedStart);
+  start->deadline = g_get_monotonic_time() / G_USEC_PER_SEC + delay;
+  start->app = g_object_ref(app);
 
-  error = NULL;
-  ret = gsm_client_stop(client, &error);
-  if (!ret) {
-    g_warning("Unable to stop client: %s", error->message);
-    g_error_free(error);
-    /* FIXME: what should we do if we can't communicate with client? */
-  } else {
-    g_debug("GsmManager: stopped client: %s", gsm_client_peek_id(client));
-  }
+  g_queue_insert_sorted(priv->delayed_starts, start,
+                        (GCompareDataFunc)compare_delayed_starts, NULL);
 
-  return FALSE;
+  if (g_queue_peek_head(priv->delayed_starts) == start) {
+    schedule_delayed_starts(manager);
+  }
 }
 
-#ifdef HAVE_SYSTEMD
-static void maybe_restart_user_bus(GsmManager *manager) {
-  GsmSystemd *systemd;
+static void admit_restored_apps(GsmManager *manager);
+
+static void on_restored_app_done(GsmApp *app, GsmManager *manager) {
   GsmManagerPrivate *priv;
-  GDBusConnection *connection;
 
-  g_autoptr(GVariant) reply = NULL;
+  priv = gsm_manager_get_instance_private(manager);
+
+  g_signal_handlers_disconnect_by_func(app, on_restored_app_done, manager);
+  priv->n_restoring--;
+
+  admit_restored_apps(manager);
+}
+
+static gboolean on_restore_timeout(GsmManager *manager) {
+  GsmManagerPrivate *priv;
+
+  priv = gsm_manager_get_instance_private(manager);
+  priv->restore_id = 0;
+
+  admit_restored_apps(manager);
+
+  return FALSE;
+}
+
+static gboolean restore_is_throttled(GsmManager *manager) {
+  GsmManagerPrivate *priv;
+  int max_pending;
+  int threshold;
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  max_pending =
+      gsm_settings_get_int(GSM_SETTINGS_SESSION, KEY_RESTORE_MAX_PENDING);
+  if (max_pending > 0 && priv->n_restoring >= (guint)max_pending) {
+    return TRUE;
+  }
+
+  threshold =
+      gsm_settings_get_int(GSM_SETTINGS_SESSION, KEY_RESTORE_BUSY_THRESHOLD);
+
+  return threshold > 0 && (get_system_busyness() > threshold ||
+                           get_io_pressure() > threshold);
+}
+
+/* Starts the restored apps, most recently used first, as long as few of
+ * them are still starting up and the system is not under pressure. An app
+ * is started anyway when none was for a whole phase timeout. */
+static void admit_restored_apps(GsmManager *manager) {
+  GsmManagerPrivate *priv;
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  /* Hold the rest back while the session is ending; they are admitted
+   * again if the logout is cancelled */
+  if (priv->phase > GSM_MANAGER_PHASE_RUNNING) {
+    if (priv->restore_id > 0) {
+      g_source_remove(priv->restore_id);
+      priv->restore_id = 0;
+    }
+    return;
+  }
+
+  while (!g_queue_is_empty(priv->restore_queue)) {
+    GsmApp *app;
+    GError *error = NULL;
+
+    if (restore_is_throttled(manager) &&
+        g_get_monotonic_time() - priv->restore_admitted <
+            GSM_MANAGER_PHASE_TIMEOUT * G_USEC_PER_SEC) {
+      if (priv->restore_id == 0) {
+        priv->restore_id = g_timeout_add_seconds(
+            1, (GSourceFunc)on_restore_timeout, manager);
+      }
+      return;
+    }
+
+    app = g_queue_pop_head(priv->restore_queue);
+    priv->restore_admitted = g_get_monotonic_time();
+
+    g_debug("GsmManager: restoring %s (priority %d)", gsm_app_peek_id(app),
+            gsm_app_peek_restore_priority(app));
+
+    if (gsm_app_start(app, &error)) {
+      priv->n_restoring++;
+      g_signal_connect(app, "registered", G_CALLBACK(on_restored_app_done),
+                       manager);
+      g_signal_connect(app, "exited", G_CALLBACK(on_restored_app_done),
+                       manager);
+    } else if (error != NULL) {
+      g_warning("Could not launch application '%s': %s",
+                gsm_app_peek_app_id(app), error->message);
+      g_error_free(error);
+    }
+
+    g_object_unref(app);
+  }
+}
+
+static gboolean _cancel_on_demand(const char *id, GsmApp *app,
+                                  gpointer data) {
+  if (GSM_IS_AUTOSTART_APP(app)) {
+    gsm_autostart_app_cancel_on_demand(GSM_AUTOSTART_APP(app));
+  }
+
+  return FALSE;
+}
+
+/* Forgets the restored apps that were not started yet */
+static void drop_restored_apps(GsmManager *manager) {
+  GsmManagerPrivate *priv;
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  if (priv->restore_id > 0) {
+    g_source_remove(priv->restore_id);
+    priv->restore_id = 0;
+  }
+
+  g_queue_free_full(priv->restore_queue, g_object_unref);
+  priv->restore_queue = g_queue_new();
+}
+
+static gint compare_restore_priorities(GsmApp *a, GsmApp *b, gpointer data) {
+  return gsm_app_peek_restore_priority(b) - gsm_app_peek_restore_priority(a);
+}
+
+static void queue_restored_app(GsmManager *manager, GsmApp *app) {
+  GsmManagerPrivate *priv;
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  g_queue_insert_sorted(priv->restore_queue, g_object_ref(app),
+                        (GCompareDataFunc)compare_restore_priorities, NULL);
+
+  /* let all the apps of the phase be queued before picking the first */
+  if (priv->restore_id == 0) {
+    priv->restore_id = g_idle_add((GSourceFunc)on_restore_timeout, manager);
+  }
+}
+
+typedef struct {
+  GsmManager *manager;
+  GsmApp *app;
+  gint64 spawn_time;
+  guint deadline_id;
+} LaunchingApp;
+
+static void launching_app_free(LaunchingApp *launching) {
+  if (launching->deadline_id > 0) {
+    g_source_remove(launching->deadline_id);
+    launching->deadline_id = 0;
+  }
+
+  g_signal_handlers_disconnect_by_data(launching->app, launching);
+  g_slice_free(LaunchingApp, launching);
+}
+
+static void on_launching_app_registered(GsmApp *app, LaunchingApp *launching) {
+  GsmManager *manager = launching->manager;
+  GsmManagerPrivate *priv;
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  gsm_startup_history_record(gsm_app_peek_app_id(app),
+                             g_get_monotonic_time() - launching->spawn_time);
+  g_hash_table_remove(priv->launching_apps, app);
+
+  if (priv->phase < GSM_MANAGER_PHASE_RUNNING && GSM_IS_AUTOSTART_APP(app)) {
+    gsm_readahead_record(gsm_autostart_app_peek_pid(GSM_AUTOSTART_APP(app)));
+  }
+
+  /* The history was already saved when the session started running */
+  if (priv->phase >= GSM_MANAGER_PHASE_RUNNING) {
+    gsm_startup_history_save();
+  }
+}
+
+static void on_launching_app_exited(GsmApp *app, LaunchingApp *launching) {
+  GsmManagerPrivate *priv;
+
+  priv = gsm_manager_get_instance_private(launching->manager);
+
+  g_hash_table_remove(priv->launching_apps, app);
+}
+
+/* The app takes much longer than usual to register: let it finish in
+ * the background rather than holding up the rest of the session */
+static gboolean on_launching_app_deadline(LaunchingApp *launching) {
+  GsmManager *manager = launching->manager;
+  GsmApp *app = launching->app;
+  GsmManagerPrivate *priv;
+
+  priv = gsm_manager_get_instance_private(manager);
+  launching->deadline_id = 0;
+
+  g_warning("Application '%s' is taking longer than usual to register, "
+            "not waiting for it",
+            gsm_app_peek_app_id(app));
+
+  if (priv->startup_graph != NULL) {
+    gsm_startup_graph_expire_app(priv->startup_graph, app);
+  } else if (gsm_ordered_set_contains(priv->pending_apps, app)) {
+    app_registered(app, manager);
+  }
+
+  return FALSE;
+}
+
+static void track_launching_app(GsmManager *manager, GsmApp *app) {
+  GsmManagerPrivate *priv;
+  LaunchingApp *launching;
+  guint deadline;
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  /* Only apps we wait for are worth learning about */
+  if (priv->phase >= GSM_MANAGER_PHASE_APPLICATION &&
+      priv->startup_graph == NULL) {
+    return;
+  }
+
+  /* Activated apps have their own timeout, and all the history would
+   * learn about them is the D-Bus round trip */
+  if (GSM_IS_AUTOSTART_APP(app) &&
+      gsm_autostart_app_is_activated(GSM_AUTOSTART_APP(app))) {
+    return;
+  }
+
+  launching = g_slice_new0(LaunchingApp);
+  launching->manager = manager;
+  launching->app = app;
+  launching->spawn_time = g_get_monotonic_time();
+
+  g_signal_connect(app, "registered", G_CALLBACK(on_launching_app_registered),
+                   launching);
+  g_signal_connect(app, "exited", G_CALLBACK(on_launching_app_exited),
+                   launching);
+
+  deadline = gsm_startup_history_get_deadline(gsm_app_peek_app_id(app),
+                                              GSM_MANAGER_PHASE_TIMEOUT);
+  if (deadline > 0 && deadline < GSM_MANAGER_PHASE_TIMEOUT * 1000) {
+    g_debug("GsmManager: waiting at most %u ms for %s", deadline,
+            gsm_app_peek_app_id(app));
+    launching->deadline_id = g_timeout_add(
+        deadline, (GSourceFunc)on_launching_app_deadline, launching);
+  }
+
+  g_hash_table_replace(priv->launching_apps, app, launching);
+}
+
+/* Returns TRUE if the app was launched right away */
+static gboolean launch_app(GsmApp *app, GsmManager *manager) {
+  GError *error;
+  gboolean res;
+  gboolean on_demand;
+  int delay;
+  const char *id;
+
+  id = gsm_app_peek_id(app);
+
+  /* Keep track of app autostart condition in order to react
+   * accordingly in the future. */
+  g_signal_connect(app, "condition-changed", G_CALLBACK(app_condition_changed),
+                   manager);
+
+  if (gsm_app_peek_is_disabled(app) ||
+      gsm_app_peek_is_conditionally_disabled(app)) {
+    g_debug("GsmManager: Skipping disabled app: %s", id);
+    return FALSE;
+  }
+
+  delay = gsm_app_peek_autostart_delay(app);
+  if (delay > 0) {
+    queue_delayed_start(manager, app, delay);
+    g_debug("GsmManager: %s is scheduled to start in %d seconds", id, delay);
+    return FALSE;
+  }
+
+  if (gsm_app_peek_restore_priority(app) >= 0) {
+    queue_restored_app(manager, app);
+    return FALSE;
+  }
+
+  error = NULL;
+  res = start_or_defer_app(app, &on_demand, &error);
+  if (!res) {
+    if (error != NULL) {
+      g_warning("Could not launch application '%s': %s",
+                gsm_app_peek_app_id(app), error->message);
+      g_error_free(error);
+    }
+    return FALSE;
+  }
+
+  if (on_demand) {
+    return FALSE;
+  }
+
+  track_launching_app(manager, app);
+
+  return TRUE;
+}
+
+static gboolean _start_app(const char *id, GsmApp *app, GsmManager *manager) {
+  GsmManagerPrivate *priv;
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  if (gsm_app_peek_phase(app) != priv->phase) {
+    goto out;
+  }
+
+  if (!launch_app(app, manager)) {
+    goto out;
+  }
+
+  if (priv->phase < GSM_MANAGER_PHASE_APPLICATION) {
+    g_signal_connect(app, "exited", G_CALLBACK(app_registered), manager);
+    g_signal_connect(app, "registered", G_CALLBACK(app_registered), manager);
+    gsm_ordered_set_add(priv->pending_apps, app);
+  }
+out:
+  return FALSE;
+}
+
+typedef struct {
+  GsmApp *app;
+  guint latency; /* milliseconds, 0 if unknown */
+} PhaseApp;
+
+typedef struct {
+  GsmManagerPhase phase;
+  GArray *apps; /* PhaseApp */
+} CollectPhaseAppsData;
+
+static gboolean _collect_phase_app(const char *id, GsmApp *app,
+                                   CollectPhaseAppsData *data) {
+  PhaseApp phase_app;
+
+  if (gsm_app_peek_phase(app) == data->phase) {
+    phase_app.app = app;
+    /* activated apps are not tracked; ignore what older versions recorded */
+    if (GSM_IS_AUTOSTART_APP(app) &&
+        gsm_autostart_app_is_activated(GSM_AUTOSTART_APP(app))) {
+      phase_app.latency = 0;
+    } else {
+      phase_app.latency =
+          gsm_startup_history_get_latency(gsm_app_peek_app_id(app));
+    }
+    g_array_append_val(data->apps, phase_app);
+  }
+
+  return FALSE;
+}
+
+static int compare_phase_apps(const PhaseApp *a, const PhaseApp *b) {
+  if (a->latency != b->latency) {
+    return a->latency > b->latency ? -1 : 1;
+  }
+
+  return g_strcmp0(gsm_app_peek_id(a->app), gsm_app_peek_id(b->app));
+}
+
+/* Starts the apps of the current phase that took the longest to register
+ * at the previous logins first, so that the slowest one does not get
+ * started last and hold the phase back even longer. Apps we know nothing
+ * about are started after them.
+ */
+static void start_phase_apps_longest_first(GsmManager *manager) {
+  GsmManagerPrivate *priv;
+  CollectPhaseAppsData data;
+  guint i;
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  data.phase = priv->phase;
+  data.apps = g_array_new(FALSE, FALSE, sizeof(PhaseApp));
+  gsm_store_foreach(priv->apps, (GsmStoreFunc)_collect_phase_app, &data);
+  g_array_sort(data.apps, (GCompareFunc)compare_phase_apps);
+
+  for (i = 0; i < data.apps->len; i++) {
+    PhaseApp *phase_app = &g_array_index(data.apps, PhaseApp, i);
+
+    g_debug("GsmManager: starting %s (usually registers after %u ms)",
+            gsm_app_peek_id(phase_app->app), phase_app->latency);
+    _start_app(gsm_app_peek_id(phase_app->app), phase_app->app, manager);
+  }
+
+  g_array_free(data.apps, TRUE);
+}
+
+static gboolean dependency_startup_is_enabled(GsmManager *manager) {
+  GsmManagerPrivate *priv;
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  if (priv->startup_graph != NULL) {
+    return TRUE;
+  }
+
+  return priv->phase == GSM_MANAGER_PHASE_WINDOW_MANAGER &&
+         gsm_settings_get_boolean(GSM_SETTINGS_SESSION,
+                                  KEY_DEPENDENCY_STARTUP);
+}
+
+static gboolean _add_graph_app(const char *id, GsmApp *app,
+                               GsmStartupGraph *graph) {
+  if (gsm_app_peek_phase(app) >= GSM_MANAGER_PHASE_WINDOW_MANAGER &&
+      gsm_app_peek_phase(app) <= GSM_MANAGER_PHASE_APPLICATION) {
+    gsm_startup_graph_add_app(graph, app);
+  }
+
+  return FALSE;
+}
+
+static void maybe_end_graph_phase(GsmManager *manager) {
+  GsmManagerPrivate *priv;
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  if (priv->phase < GSM_MANAGER_PHASE_WINDOW_MANAGER ||
+      priv->phase > GSM_MANAGER_PHASE_APPLICATION) {
+    return;
+  }
+
+  if (gsm_startup_graph_phase_is_done(priv->startup_graph, priv->phase)) {
+    end_phase(manager);
+  }
+}
+
+/* From the window manager phase on, apps are started as soon as the apps
+ * they depend on are up rather than when the whole previous phase is;
+ * the phases only report how far startup got. */
+static void do_phase_startup_graph(GsmManager *manager) {
+  GsmManagerPrivate *priv;
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  if (priv->startup_graph == NULL) {
+    priv->startup_graph = gsm_startup_graph_new(
+        (GsmStartupGraphStartFunc)launch_app,
+        (GsmStartupGraphNotifyFunc)maybe_end_graph_phase, manager);
+    gsm_store_foreach(priv->apps, (GsmStoreFunc)_add_graph_app,
+                      priv->startup_graph);
+    gsm_startup_graph_run(priv->startup_graph);
+  }
+
+  if (gsm_startup_graph_phase_is_done(priv->startup_graph, priv->phase)) {
+    end_phase(manager);
+  } else {
+    priv->phase_timeout_id = g_timeout_add_seconds(
+        GSM_MANAGER_PHASE_TIMEOUT, (GSourceFunc)on_phase_timeout, manager);
+  }
+}
+
+static void do_phase_startup(GsmManager *manager) {
+  GsmManagerPrivate *priv;
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  if (dependency_startup_is_enabled(manager)) {
+    do_phase_startup_graph(manager);
+    return;
+  }
+
+  if (gsm_settings_get_boolean(GSM_SETTINGS_SESSION,
+                               KEY_LONGEST_STARTUP_FIRST)) {
+    start_phase_apps_longest_first(manager);
+  } else {
+    gsm_store_foreach(priv->apps, (GsmStoreFunc)_start_app, manager);
+  }
+
+  if (!gsm_ordered_set_is_empty(priv->pending_apps)) {
+    if (priv->phase < GSM_MANAGER_PHASE_APPLICATION) {
+      priv->phase_timeout_id = g_timeout_add_seconds(
+          GSM_MANAGER_PHASE_TIMEOUT, (GSourceFunc)on_phase_timeout, manager);
+    }
+  } else {
+    end_phase(manager);
+  }
+}
+
+typedef struct {
+  GsmManager *manager;
+  guint flags;
+} ClientEndSessionData;
+
+static gboolean _client_end_session(GsmClient *client,
+                                    ClientEndSessionData *data) {
+  gboolean ret;
+  GError *error;
+  GsmManagerPrivate *priv;
+
+  priv = gsm_manager_get_instance_private(data->manager);
+
+  error = NULL;
+  ret = gsm_client_end_session(client, data->flags, &error);
+  if (!ret) {
+    g_warning("Unable to query client: %s", error->message);
+    g_error_free(error);
+    /* FIXME: what should we do if we can't communicate with client? */
+  } else {
+    g_debug("GsmManager: adding client to end-session clients: %s",
+            gsm_client_peek_id(client));
+    gsm_ordered_set_add(priv->query_clients, client);
+  }
+
+  return FALSE;
+}
+
+static gboolean _client_end_session_helper(const char *id, GsmClient *client,
+                                           ClientEndSessionData *data) {
+  return _client_end_session(client, data);
+}
+
+static gboolean on_save_timeout(GsmManager *manager) {
+  GsmManagerPrivate *priv;
+
+  priv = gsm_manager_get_instance_private(manager);
+  priv->save_timeout_id = 0;
+
+  g_warning("Not all clients saved their state in time, saving them as-is");
+
+  end_phase(manager);
+
+  return FALSE;
+}
+
+static void do_phase_end_session(GsmManager *manager) {
+  ClientEndSessionData data;
+  GsmManagerPrivate *priv;
+
+  data.manager = manager;
+  data.flags = 0;
+  priv = gsm_manager_get_instance_private(manager);
+
+  if (priv->logout_mode == GSM_MANAGER_LOGOUT_MODE_FORCE) {
+    data.flags |= GSM_CLIENT_END_SESSION_FLAG_FORCEFUL;
+  }
+  if (auto_save_is_enabled(manager)) {
+    data.flags |= GSM_CLIENT_END_SESSION_FLAG_SAVE;
+  }
+
+  if (priv->phase_timeout_id > 0) {
+    g_source_remove(priv->phase_timeout_id);
+    priv->phase_timeout_id = 0;
+  }
+
+  if (gsm_store_size(priv->clients) > 0) {
+    priv->phase_timeout_id = g_timeout_add_seconds(
+        GSM_MANAGER_PHASE_TIMEOUT, (GSourceFunc)on_phase_timeout, manager);
+
+    /* write each client out as soon as it is done saving its state */
+    if ((data.flags & GSM_CLIENT_END_SESSION_FLAG_SAVE) &&
+        session_can_be_saved(manager)) {
+      gsm_session_save_begin();
+      priv->save_timeout_id = g_timeout_add_seconds(
+          GSM_MANAGER_SAVE_TIMEOUT, (GSourceFunc)on_save_timeout, manager);
+    }
+
+    priv->end_session_sent = g_get_monotonic_time();
+    gsm_store_foreach(priv->clients, (GsmStoreFunc)_client_end_session_helper,
+                      &data);
+  } else {
+    end_phase(manager);
+  }
+}
+
+static void do_phase_end_session_part_2(GsmManager *manager) {
+  ClientEndSessionData data;
+  GsmManagerPrivate *priv;
+
+  data.manager = manager;
+  data.flags = 0;
+  priv = gsm_manager_get_instance_private(manager);
+
+  if (priv->logout_mode == GSM_MANAGER_LOGOUT_MODE_FORCE) {
+    data.flags |= GSM_CLIENT_END_SESSION_FLAG_FORCEFUL;
+  }
+  if (auto_save_is_enabled(manager)) {
+    data.flags |= GSM_CLIENT_END_SESSION_FLAG_SAVE;
+  }
+  data.flags |= GSM_CLIENT_END_SESSION_FLAG_LAST;
+
+  /* keep the timeout that was started at the beginning of the
+   * GSM_MANAGER_PHASE_END_SESSION phase */
+
+  if (!gsm_ordered_set_is_empty(priv->next_query_clients)) {
+    priv->end_session_sent = g_get_monotonic_time();
+    g_list_foreach(gsm_ordered_set_peek_items(priv->next_query_clients),
+                   (GFunc)_client_end_session, &data);
+
+    gsm_ordered_set_clear(priv->next_query_clients);
+  } else {
+    end_phase(manager);
+  }
+}
+
+static gboolean _client_stop(const char *id, GsmClient *client,
+                             gpointer user_data) {
+  gboolean ret;
+  GError *error;
+
+  error = NULL;
+  ret = gsm_client_stop(client, &error);
+  if (!ret) {
+    g_warning("Unable to stop client: %s", error->message);
+    g_error_free(error);
+    /* FIXME: what should we do if we can't communicate with client? */
+  } else {
+    g_debug("GsmManager: stopped client: %s", gsm_client_peek_id(client));
+  }
+
+  return FALSE;
+}
+
+#ifdef HAVE_SYSTEMD
+static void maybe_restart_user_bus(GsmManager *manager) {
+  GsmSystemd *systemd;
+  GsmManagerPrivate *priv;
+  GDBusConnection *connection;
+
+  g_autoptr(GVariant) reply = NULL;
   g_autoptr(GError) error = NULL;
 
   priv = gsm_manager_get_instance_private(manager);
@@ -832,6 +1729,9 @@ static void do_phase_exit(GsmManager *manager) {
     gsm_store_foreach(priv->clients, (GsmStoreFunc)_client_stop, NULL);
   }
 
+  /* take down what is left of the apps, all at once */
+  gsm_app_scope_stop_all();
+
 #ifdef HAVE_SYSTEMD
   maybe_restart_user_bus(manager);
 #endif
@@ -839,6 +1739,65 @@ static void do_phase_exit(GsmManager *manager) {
   end_phase(manager);
 }
 
+typedef struct {
+  gint64 sent;     /* monotonic time */
+  gint64 deadline; /* monotonic time */
+} QueryResponse;
+
+static void query_response_free(QueryResponse *response) {
+  g_slice_free(QueryResponse, response);
+}
+
+static char *get_client_app_id(GsmClient *client) {
+  char *app_id;
+
+  app_id = g_strdup(gsm_client_peek_app_id(client));
+  if (IS_STRING_EMPTY(app_id)) {
+    /* XSMP clients don't give us an app id unless we start them */
+    g_free(app_id);
+    app_id = gsm_client_get_app_name(client);
+  }
+
+  return app_id;
+}
+
+/* Records how long @client took to answer the end of session query */
+static void record_query_response(GsmManager *manager, GsmClient *client) {
+  GsmManagerPrivate *priv;
+  QueryResponse *response;
+  char *app_id;
+  gint64 latency;
+  char *detail;
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  response =
+      g_hash_table_lookup(priv->query_responses, gsm_client_peek_id(client));
+  if (response == NULL) {
+    return;
+  }
+
+  latency = g_get_monotonic_time() - response->sent;
+  app_id = get_client_app_id(client);
+
+  if (app_id != NULL) {
+    gsm_startup_history_record_query(app_id, latency);
+  }
+
+  gsm_metrics_observe_labeled(
+      GSM_METRIC_QUERY_END_SESSION_RESPONSE,
+      app_id != NULL ? app_id : gsm_client_peek_id(client), latency);
+
+  detail = g_strdup_printf("%s %" G_GINT64_FORMAT " ms",
+                           app_id != NULL ? app_id : gsm_client_peek_id(client),
+                           latency / 1000);
+  gsm_trace_instant("client", "query-end-session-response", detail);
+  g_free(detail);
+
+  g_hash_table_remove(priv->query_responses, gsm_client_peek_id(client));
+  g_free(app_id);
+}
+
 static gboolean _client_query_end_session(const char *id, GsmClient *client,
                                           ClientEndSessionData *data) {
   gboolean ret;
@@ -854,62 +1813,71 @@ static gboolean _client_query_end_session(const char *id, GsmClient *client,
     g_error_free(error);
     /* FIXME: what should we do if we can't communicate with client? */
   } else {
+    QueryResponse *response;
+
     g_debug("GsmManager: adding client to query clients: %s",
             gsm_client_peek_id(client));
-    priv->query_clients = g_slist_prepend(priv->query_clients, client);
+    gsm_ordered_set_add(priv->query_clients, client);
+
+    response = g_slice_new(QueryResponse);
+    response->sent = g_get_monotonic_time();
+    response->deadline = response->sent + GSM_MANAGER_QUERY_TIMEOUT * 1000;
+    g_hash_table_replace(priv->query_responses,
+                         g_strdup(gsm_client_peek_id(client)), response);
   }
 
   return FALSE;
 }
 
-static gboolean inhibitor_has_flag(gpointer key, GsmInhibitor *inhibitor,
-                                   gpointer data) {
-  guint flag;
-  guint flags;
-
-  flag = GPOINTER_TO_UINT(data);
-
-  flags = gsm_inhibitor_peek_flags(inhibitor);
-
-  return (flags & flag);
-}
-
-static gboolean gsm_manager_is_logout_inhibited(GsmManager *manager) {
-  GsmInhibitor *inhibitor;
+/* Whether any inhibitor holds one of @flags */
+static gboolean is_inhibited_for_flags(GsmManager *manager, guint flags) {
   GsmManagerPrivate *priv;
+  guint i;
 
   priv = gsm_manager_get_instance_private(manager);
 
-  if (priv->inhibitors == NULL) {
-    return FALSE;
+  for (i = 0; i < N_INHIBITOR_FLAG_BITS; i++) {
+    if ((flags & (1u << i)) && priv->inhibited_counts[i] > 0) {
+      return TRUE;
+    }
   }
 
-  inhibitor = (GsmInhibitor *)gsm_store_find(
-      priv->inhibitors, (GsmStoreFunc)inhibitor_has_flag,
-      GUINT_TO_POINTER(GSM_INHIBITOR_FLAG_LOGOUT));
-  if (inhibitor == NULL) {
-    return FALSE;
-  }
-  return TRUE;
+  return FALSE;
 }
 
-static gboolean gsm_manager_is_idle_inhibited(GsmManager *manager) {
-  GsmInhibitor *inhibitor;
+static void update_inhibited_counts(GsmManager *manager, guint flags,
+                                    gboolean added) {
   GsmManagerPrivate *priv;
+  gboolean changed;
+  guint i;
 
   priv = gsm_manager_get_instance_private(manager);
 
-  if (priv->inhibitors == NULL) {
-    return FALSE;
+  changed = FALSE;
+  for (i = 0; i < N_INHIBITOR_FLAG_BITS; i++) {
+    if (!(flags & (1u << i))) {
+      continue;
+    }
+
+    if (added) {
+      changed |= (priv->inhibited_counts[i]++ == 0);
+    } else {
+      g_assert(priv->inhibited_counts[i] > 0);
+      changed |= (--priv->inhibited_counts[i] == 0);
+    }
   }
 
-  inhibitor = (GsmInhibitor *)gsm_store_find(
-      priv->inhibitors, (GsmStoreFunc)inhibitor_has_flag,
-      GUINT_TO_POINTER(GSM_INHIBITOR_FLAG_IDLE));
-  if (inhibitor == NULL) {
-    return FALSE;
+  if (changed) {
+    priv->inhibited_generation++;
   }
-  return TRUE;
+}
+
+static gboolean gsm_manager_is_logout_inhibited(GsmManager *manager) {
+  return is_inhibited_for_flags(manager, GSM_INHIBITOR_FLAG_LOGOUT);
+}
+
+static gboolean gsm_manager_is_idle_inhibited(GsmManager *manager) {
+  return is_inhibited_for_flags(manager, GSM_INHIBITOR_FLAG_IDLE);
 }
 
 static gboolean _client_cancel_end_session(const char *id, GsmClient *client,
@@ -965,6 +1933,18 @@ static void cancel_end_session(GsmManager *manager) {
   gsm_store_foreach(priv->clients, (GsmStoreFunc)_client_cancel_end_session,
                     NULL);
 
+  if (priv->save_timeout_id > 0) {
+    g_source_remove(priv->save_timeout_id);
+    priv->save_timeout_id = 0;
+  }
+  gsm_session_save_abort();
+
+  if (priv->logout_budget_id > 0) {
+    g_source_remove(priv->logout_budget_id);
+    priv->logout_budget_id = 0;
+  }
+  priv->logout_budget = 0;
+
   gsm_manager_set_phase(manager, GSM_MANAGER_PHASE_RUNNING);
   priv->logout_mode = GSM_MANAGER_LOGOUT_MODE_NORMAL;
 
@@ -974,29 +1954,7 @@ static void cancel_end_session(GsmManager *manager) {
   start_phase(manager);
 }
 
-static gboolean process_is_running(const char *name) {
-  int num_processes;
-  char *command = g_strdup_printf("pidof %s | wc -l", name);
-  FILE *fp = popen(command, "r");
-
-  if (fscanf(fp, "%d", &num_processes) != 1) num_processes = 0;
-
-  pclose(fp);
-  g_free(command);
-
-  if (num_processes > 0) {
-    return TRUE;
-  } else {
-    return FALSE;
-  }
-}
-
 static void manager_switch_user(GsmManager *manager) {
-  GError *error;
-  gboolean res;
-  char *command;
-  const gchar *xdg_seat_path = g_getenv("XDG_SEAT_PATH");
-
   /* We have to do this here and in request_switch_user() because this
    * function can be called at a later time, not just directly after
    * request_switch_user(). */
@@ -1005,54 +1963,7 @@ static void manager_switch_user(GsmManager *manager) {
     return;
   }
 
-  if (process_is_running("mdm")) {
-    /* MDM */
-    command =
-        g_strdup_printf("%s %s", MDM_FLEXISERVER_COMMAND, MDM_FLEXISERVER_ARGS);
-
-    error = NULL;
-    res = g_spawn_command_line_sync(command, NULL, NULL, NULL, &error);
-
-    g_free(command);
-
-    if (!res) {
-      g_debug("GsmManager: Unable to start MDM greeter: %s", error->message);
-      g_error_free(error);
-    }
-  } else if (process_is_running("gdm") || process_is_running("gdm3") ||
-             process_is_running("gdm-binary")) {
-    /* GDM */
-    command =
-        g_strdup_printf("%s %s", GDM_FLEXISERVER_COMMAND, GDM_FLEXISERVER_ARGS);
-
-    error = NULL;
-    res = g_spawn_command_line_sync(command, NULL, NULL, NULL, &error);
-
-    g_free(command);
-
-    if (!res) {
-      g_debug("GsmManager: Unable to start GDM greeter: %s", error->message);
-      g_error_free(error);
-    }
-  } else if (xdg_seat_path != NULL) {
-    /* LightDM */
-    GDBusProxyFlags flags = G_DBUS_PROXY_FLAGS_DO_NOT_AUTO_START;
-    GDBusProxy *proxy = NULL;
-    error = NULL;
-
-    proxy = g_dbus_proxy_new_for_bus_sync(
-        G_BUS_TYPE_SYSTEM, flags, NULL, "org.freedesktop.DisplayManager",
-        xdg_seat_path, "org.freedesktop.DisplayManager.Seat", NULL, &error);
-    if (proxy != NULL) {
-      g_dbus_proxy_call_sync(proxy, "SwitchToGreeter", g_variant_new("()"),
-                             G_DBUS_CALL_FLAGS_NONE, -1, NULL, NULL);
-      g_object_unref(proxy);
-    } else {
-      g_debug("GsmManager: Unable to start LightDM greeter: %s",
-              error->message);
-      g_error_free(error);
-    }
-  }
+  gsm_switch_user_start();
 }
 
 static void manager_perhaps_lock(void) {
@@ -1198,6 +2109,34 @@ static void inhibit_dialog_response(GsmInhibitDialog *dialog, guint response_id,
   }
 }
 
+/* Shows the dialog listing what inhibits @action, which then decides on
+ * whether to go ahead. Returns FALSE if it could not be shown. */
+static gboolean show_inhibit_dialog(GsmManager *manager,
+                                    GsmLogoutAction action) {
+  GsmManagerPrivate *priv;
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  if (priv->inhibit_dialog != NULL) {
+    g_debug("GsmManager: inhibit dialog already up");
+    gtk_window_present(GTK_WINDOW(priv->inhibit_dialog));
+    return TRUE;
+  }
+
+  priv->inhibit_dialog =
+      gsm_dialogs_inhibit_dialog_new(priv->inhibitors, priv->clients, action);
+  if (priv->inhibit_dialog == NULL) {
+    g_warning("Unable to show the inhibit dialog, the action stays inhibited");
+    return FALSE;
+  }
+
+  g_signal_connect(priv->inhibit_dialog, "response",
+                   G_CALLBACK(inhibit_dialog_response), manager);
+  gtk_widget_show(priv->inhibit_dialog);
+
+  return TRUE;
+}
+
 static void query_end_session_complete(GsmManager *manager) {
   GsmLogoutAction action;
   GsmManagerPrivate *priv;
@@ -1206,6 +2145,8 @@ static void query_end_session_complete(GsmManager *manager) {
 
   g_debug("GsmManager: query end session complete");
 
+  gsm_startup_history_save();
+
   /* Remove the timeout since this can be called from outside the timer
    * and we don't want to have it called twice */
   if (priv->query_timeout_id > 0) {
@@ -1218,12 +2159,6 @@ static void query_end_session_complete(GsmManager *manager) {
     return;
   }
 
-  if (priv->inhibit_dialog != NULL) {
-    g_debug("GsmManager: inhibit dialog already up");
-    gtk_window_present(GTK_WINDOW(priv->inhibit_dialog));
-    return;
-  }
-
   switch (priv->logout_type) {
     case GSM_MANAGER_LOGOUT_LOGOUT:
       action = GSM_LOGOUT_ACTION_LOGOUT;
@@ -1249,38 +2184,99 @@ static void query_end_session_complete(GsmManager *manager) {
    * actually handled the same way as GSM_LOGOUT_ACTION_LOGOUT in the
    * inhibit dialog; the action, if the button is clicked, will be to
    * simply go to the next phase. */
-  priv->inhibit_dialog =
-      gsm_inhibit_dialog_new(priv->inhibitors, priv->clients, action);
-
-  g_signal_connect(priv->inhibit_dialog, "response",
-                   G_CALLBACK(inhibit_dialog_response), manager);
-  gtk_widget_show(priv->inhibit_dialog);
+  if (!show_inhibit_dialog(manager, action)) {
+    /* the inhibitors cannot be overridden without the dialog */
+    cancel_end_session(manager);
+  }
 }
 
-static guint32 generate_cookie(void) {
+/* Cookies are handed out in sequence from a random starting point, so
+ * that a stale cookie from a previous session is unlikely to match, and
+ * wrap around within [1, G_MAXINT32) skipping the ones still in use. */
+static guint32 _generate_unique_cookie(GsmManager *manager) {
   guint32 cookie;
+  GsmManagerPrivate *priv;
 
-  cookie = (guint32)g_random_int_range(1, G_MAXINT32);
+  priv = gsm_manager_get_instance_private(manager);
+
+  if (priv->next_cookie == 0) {
+    priv->next_cookie = (guint32)g_random_int_range(1, G_MAXINT32);
+  }
+
+  do {
+    cookie = priv->next_cookie;
+    priv->next_cookie = cookie + 1 < G_MAXINT32 ? cookie + 1 : 1;
+  } while (find_inhibitor_for_cookie(manager, cookie) != NULL);
 
   return cookie;
 }
 
-static guint32 _generate_unique_cookie(GsmManager *manager) {
-  guint32 cookie;
+static gboolean _on_query_end_session_timeout(GsmManager *manager);
+
+/* Arms the query timer for the earliest deadline of the clients that did
+ * not answer yet */
+static void schedule_query_timeout(GsmManager *manager) {
   GsmManagerPrivate *priv;
+  GHashTableIter iter;
+  gpointer value;
+  gint64 deadline = G_MAXINT64;
 
   priv = gsm_manager_get_instance_private(manager);
 
-  do {
-    cookie = generate_cookie();
-  } while (gsm_store_find(priv->inhibitors, (GsmStoreFunc)_find_by_cookie,
-                          &cookie) != NULL);
+  if (priv->query_timeout_id > 0) {
+    g_source_remove(priv->query_timeout_id);
+    priv->query_timeout_id = 0;
+  }
 
-  return cookie;
+  g_hash_table_iter_init(&iter, priv->query_responses);
+  while (g_hash_table_iter_next(&iter, NULL, &value)) {
+    QueryResponse *response = value;
+
+    deadline = MIN(deadline, response->deadline);
+  }
+
+  if (deadline == G_MAXINT64) {
+    return;
+  }
+
+  priv->query_timeout_id = g_timeout_add(
+      (guint)MAX((deadline - g_get_monotonic_time()) / 1000, 0),
+      (GSourceFunc)_on_query_end_session_timeout, manager);
+}
+
+static void add_not_responding_inhibitor(GsmManager *manager,
+                                         GsmClient *client) {
+  guint cookie;
+  GsmInhibitor *inhibitor;
+  const char *bus_name;
+  char *app_id;
+  GsmManagerPrivate *priv;
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  /* Add JIT inhibit for unresponsive client */
+  if (GSM_IS_DBUS_CLIENT(client)) {
+    bus_name = gsm_dbus_client_get_bus_name(GSM_DBUS_CLIENT(client));
+  } else {
+    bus_name = NULL;
+  }
+
+  app_id = get_client_app_id(client);
+
+  cookie = _generate_unique_cookie(manager);
+  inhibitor = gsm_inhibitor_new_for_client(
+      gsm_client_peek_id(client), app_id, GSM_INHIBITOR_FLAG_LOGOUT,
+      _("Not responding"), bus_name, cookie);
+  g_free(app_id);
+  gsm_store_add(priv->inhibitors, gsm_inhibitor_peek_id(inhibitor),
+                G_OBJECT(inhibitor));
+  g_object_unref(inhibitor);
 }
 
 static gboolean _on_query_end_session_timeout(GsmManager *manager) {
   GSList *l;
+  GSList *expired = NULL;
+  gint64 now;
   GsmManagerPrivate *priv;
 
   priv = gsm_manager_get_instance_private(manager);
@@ -1289,49 +2285,55 @@ static gboolean _on_query_end_session_timeout(GsmManager *manager) {
 
   g_debug("GsmManager: query end session timed out");
 
-  for (l = priv->query_clients; l != NULL; l = l->next) {
-    guint cookie;
-    GsmInhibitor *inhibitor;
-    const char *bus_name;
-    char *app_id;
+  now = g_get_monotonic_time();
 
-    g_warning("Client '%s' failed to reply before timeout",
-              gsm_client_peek_id(l->data));
+  for (l = gsm_ordered_set_peek_items(priv->query_clients); l != NULL;
+       l = l->next) {
+    QueryResponse *response;
 
-    /* Don't add "not responding" inhibitors if logout is forced
-     */
-    if (priv->logout_mode == GSM_MANAGER_LOGOUT_MODE_FORCE) {
-      continue;
+    response =
+        g_hash_table_lookup(priv->query_responses, gsm_client_peek_id(l->data));
+    if (response == NULL || response->deadline <= now) {
+      expired = g_slist_prepend(expired, l->data);
     }
+  }
+
+  for (l = expired; l != NULL; l = l->next) {
+    GsmClient *client = l->data;
+    char *app_id;
 
-    /* Add JIT inhibit for unresponsive client */
-    if (GSM_IS_DBUS_CLIENT(l->data)) {
-      bus_name = gsm_dbus_client_get_bus_name(l->data);
+    app_id = get_client_app_id(client);
+    if (app_id != NULL) {
+      gsm_startup_history_record_query(app_id, -1);
+      g_warning("Client '%s' (%s) failed to reply before timeout, %u times so "
+                "far",
+                gsm_client_peek_id(client), app_id,
+                gsm_startup_history_get_query_timeouts(app_id));
     } else {
-      bus_name = NULL;
+      g_warning("Client '%s' failed to reply before timeout",
+                gsm_client_peek_id(client));
     }
+    gsm_trace_instant("client", "query-end-session-timeout",
+                      app_id != NULL ? app_id : gsm_client_peek_id(client));
+    g_free(app_id);
 
-    app_id = g_strdup(gsm_client_peek_app_id(l->data));
-    if (IS_STRING_EMPTY(app_id)) {
-      /* XSMP clients don't give us an app id unless we start them */
-      g_free(app_id);
-      app_id = gsm_client_get_app_name(l->data);
-    }
+    g_hash_table_remove(priv->query_responses, gsm_client_peek_id(client));
+    gsm_ordered_set_remove(priv->query_clients, client);
 
-    cookie = _generate_unique_cookie(manager);
-    inhibitor = gsm_inhibitor_new_for_client(
-        gsm_client_peek_id(l->data), app_id, GSM_INHIBITOR_FLAG_LOGOUT,
-        _("Not responding"), bus_name, cookie);
-    g_free(app_id);
-    gsm_store_add(priv->inhibitors, gsm_inhibitor_peek_id(inhibitor),
-                  G_OBJECT(inhibitor));
-    g_object_unref(inhibitor);
+    /* Don't add "not responding" inhibitors if logout is forced
+     */
+    if (priv->logout_mode != GSM_MANAGER_LOGOUT_MODE_FORCE) {
+      add_not_responding_inhibitor(manager, client);
+    }
   }
 
-  g_slist_free(priv->query_clients);
-  priv->query_clients = NULL;
+  g_slist_free(expired);
 
-  query_end_session_complete(manager);
+  if (gsm_ordered_set_is_empty(priv->query_clients)) {
+    query_end_session_complete(manager);
+  } else {
+    schedule_query_timeout(manager);
+  }
 
   return FALSE;
 }
@@ -1360,10 +2362,15 @@ static void do_phase_query_end_session(GsmManager *manager) {
   gsm_store_foreach(priv->clients, (GsmStoreFunc)_client_query_end_session,
                     &data);
 
-  /* This phase doesn't time out unless logout is forced. Typically, this
-   * separate timer is only used to show UI. */
-  priv->query_timeout_id = g_timeout_add_seconds(
-      1, (GSourceFunc)_on_query_end_session_timeout, manager);
+  /* Nothing to wait for */
+  if (gsm_ordered_set_is_empty(priv->query_clients)) {
+    query_end_session_complete(manager);
+    return;
+  }
+
+  /* This phase doesn't time out unless logout is forced. Typically, the
+   * per-client deadlines are only used to show UI. */
+  schedule_query_timeout(manager);
 }
 
 static void update_idle(GsmManager *manager) {
@@ -1377,6 +2384,81 @@ static void update_idle(GsmManager *manager) {
   }
 }
 
+static gboolean on_logout_budget_timeout(GsmManager *manager) {
+  GsmManagerPrivate *priv;
+  GSList *l;
+
+  priv = gsm_manager_get_instance_private(manager);
+  priv->logout_budget_id = 0;
+
+  g_warning("Logout budget spent during the %s phase, forcing the end of the "
+            "session",
+            phase_num_to_name(priv->phase));
+
+  priv->logout_mode = GSM_MANAGER_LOGOUT_MODE_FORCE;
+  priv->logout_budget_forced = TRUE;
+
+  for (l = gsm_ordered_set_peek_items(priv->query_clients); l != NULL;
+       l = l->next) {
+    g_warning("Client '%s' did not reply within the logout budget",
+              gsm_client_peek_id(l->data));
+  }
+
+  /* Like "Log out anyway" in the inhibit dialog */
+  if (priv->inhibit_dialog != NULL) {
+    gtk_widget_destroy(GTK_WIDGET(priv->inhibit_dialog));
+    priv->inhibit_dialog = NULL;
+  }
+  gsm_store_foreach_remove(priv->inhibitors, (GsmStoreFunc)inhibitor_is_jit,
+                           manager);
+
+  end_phase(manager);
+
+  return FALSE;
+}
+
+/* Gives the phase that is starting what is left of its share of the
+ * logout budget; the budget starts with the query-end-session phase */
+static void arm_logout_budget(GsmManager *manager) {
+  GsmManagerPrivate *priv;
+  guint index;
+  gint64 now;
+  gint64 deadline;
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  now = g_get_monotonic_time();
+
+  if (priv->phase == GSM_MANAGER_PHASE_QUERY_END_SESSION) {
+    if (priv->logout_budget == 0) {
+      priv->logout_budget =
+          (gint64)gsm_settings_get_int(GSM_SETTINGS_SESSION,
+                                       KEY_LOGOUT_BUDGET) *
+          G_USEC_PER_SEC;
+    }
+    priv->logout_started = now;
+    priv->logout_budget_forced = FALSE;
+    memset(priv->logout_spent, 0, sizeof(priv->logout_spent));
+  }
+
+  if (priv->logout_budget == 0) {
+    return;
+  }
+
+  index = priv->phase - GSM_MANAGER_PHASE_QUERY_END_SESSION;
+  deadline = priv->logout_started +
+             priv->logout_budget * logout_budget_shares[index] / 100;
+
+  priv->logout_phase_started = now;
+  priv->logout_budget_id = g_timeout_add(
+      (guint)MAX((deadline - now) / 1000, 0),
+      (GSourceFunc)on_logout_budget_timeout, manager);
+
+  g_debug("GsmManager: %s phase has %" G_GINT64_FORMAT "ms of the logout "
+          "budget",
+          phase_num_to_name(priv->phase), MAX((deadline - now) / 1000, 0));
+}
+
 static void start_phase(GsmManager *manager) {
   GsmManagerPrivate *priv;
 
@@ -1384,13 +2466,14 @@ static void start_phase(GsmManager *manager) {
 
   g_debug("GsmManager: starting phase %s\n", phase_num_to_name(priv->phase));
 
+  gsm_trace_begin("phase", phase_num_to_name(priv->phase));
+  priv->phase_started = g_get_monotonic_time();
+
   /* reset state */
-  g_slist_free(priv->pending_apps);
-  priv->pending_apps = NULL;
-  g_slist_free(priv->query_clients);
-  priv->query_clients = NULL;
-  g_slist_free(priv->next_query_clients);
-  priv->next_query_clients = NULL;
+  gsm_ordered_set_clear(priv->pending_apps);
+  gsm_ordered_set_clear(priv->query_clients);
+  gsm_ordered_set_clear(priv->next_query_clients);
+  g_hash_table_remove_all(priv->query_responses);
 
   if (priv->query_timeout_id > 0) {
     g_source_remove(priv->query_timeout_id);
@@ -1413,14 +2496,28 @@ static void start_phase(GsmManager *manager) {
     case GSM_MANAGER_PHASE_RUNNING:
       g_signal_emit(manager, signals[SESSION_RUNNING], 0);
       update_idle(manager);
+      gsm_autostart_cache_flush();
+      gsm_startup_history_save();
+      gsm_readahead_save();
+      gsm_app_scope_session_running(GSM_MANAGER_PHASE_TIMEOUT);
+      gsm_trace_stop_later(GSM_MANAGER_PHASE_TIMEOUT);
+      schedule_checkpoint(manager);
+      /* resumes the restore after a cancelled logout */
+      admit_restored_apps(manager);
       break;
     case GSM_MANAGER_PHASE_QUERY_END_SESSION:
+      arm_logout_budget(manager);
       do_phase_query_end_session(manager);
       break;
     case GSM_MANAGER_PHASE_END_SESSION:
+      drop_restored_apps(manager);
+      /* nothing should be activated into a session that is ending */
+      gsm_store_foreach(priv->apps, (GsmStoreFunc)_cancel_on_demand, NULL);
+      arm_logout_budget(manager);
       do_phase_end_session(manager);
       break;
     case GSM_MANAGER_PHASE_EXIT:
+      arm_logout_budget(manager);
       do_phase_exit(manager);
       break;
     default:
@@ -1467,13 +2564,20 @@ static void debug_app_summary(GsmManager *manager) {
 }
 
 void gsm_manager_start(GsmManager *manager) {
+  GsmManagerPrivate *priv;
+
   g_debug("GsmManager: GSM starting to manage");
 
   g_return_if_fail(GSM_IS_MANAGER(manager));
 
+  priv = gsm_manager_get_instance_private(manager);
+
+  gsm_readahead_start();
+  gsm_resource_monitor_start(priv->clients);
+
   gsm_manager_set_phase(manager, GSM_MANAGER_PHASE_INITIALIZATION);
   debug_app_summary(manager);
-  start_phase(manager);
+  start_phase_after_environment(manager);
 }
 
 void _gsm_manager_set_renderer(GsmManager *manager, const char *renderer) {
@@ -1483,61 +2587,39 @@ void _gsm_manager_set_renderer(GsmManager *manager, const char *renderer) {
   priv->renderer = g_strdup(renderer);
 }
 
-static gboolean _app_has_app_id(const char *id, GsmApp *app,
-                                const char *app_id_a) {
-  const char *app_id_b;
-
-  app_id_b = gsm_app_peek_app_id(app);
-  return (app_id_b != NULL && strcmp(app_id_a, app_id_b) == 0);
-}
-
 static GsmApp *find_app_for_app_id(GsmManager *manager, const char *app_id) {
-  GsmApp *app;
   GsmManagerPrivate *priv;
 
   priv = gsm_manager_get_instance_private(manager);
-  app = (GsmApp *)gsm_store_find(priv->apps, (GsmStoreFunc)_app_has_app_id,
-                                 (char *)app_id);
-  return app;
-}
-
-static gboolean inhibitor_has_client_id(gpointer key, GsmInhibitor *inhibitor,
-                                        const char *client_id_a) {
-  gboolean matches;
-  const char *client_id_b;
-
-  client_id_b = gsm_inhibitor_peek_client_id(inhibitor);
-
-  matches = FALSE;
-  if (!IS_STRING_EMPTY(client_id_a) && !IS_STRING_EMPTY(client_id_b)) {
-    matches = (strcmp(client_id_a, client_id_b) == 0);
-    if (matches) {
-      g_debug("GsmManager: removing JIT inhibitor for %s for reason '%s'",
-              gsm_inhibitor_peek_client_id(inhibitor),
-              gsm_inhibitor_peek_reason(inhibitor));
-    }
-  }
 
-  return matches;
+  return (GsmApp *)gsm_store_lookup_by_index(priv->apps, INDEX_APP_ID, app_id);
 }
 
-static gboolean _app_has_startup_id(const char *id, GsmApp *app,
-                                    const char *startup_id_a) {
-  const char *startup_id_b;
+static void remove_inhibitors_for_client(GsmManager *manager,
+                                         const char *client_id) {
+  GSList *inhibitors;
+  GSList *l;
+  GsmManagerPrivate *priv;
+
+  priv = gsm_manager_get_instance_private(manager);
 
-  startup_id_b = gsm_app_peek_startup_id(app);
+  inhibitors = gsm_store_lookup_all_by_index(priv->inhibitors, INDEX_CLIENT_ID,
+                                             client_id);
+  for (l = inhibitors; l != NULL; l = l->next) {
+    GsmInhibitor *inhibitor = l->data;
 
-  if (IS_STRING_EMPTY(startup_id_b)) {
-    return FALSE;
+    g_debug("GsmManager: removing JIT inhibitor for %s for reason '%s'",
+            gsm_inhibitor_peek_client_id(inhibitor),
+            gsm_inhibitor_peek_reason(inhibitor));
+    gsm_store_remove(priv->inhibitors, gsm_inhibitor_peek_id(inhibitor));
   }
 
-  return (strcmp(startup_id_a, startup_id_b) == 0);
+  g_slist_free(inhibitors);
 }
 
 static GsmApp *find_app_for_startup_id(GsmManager *manager,
                                        const char *startup_id) {
   GsmApp *found_app;
-  GSList *a;
   GsmManagerPrivate *priv;
 
   found_app = NULL;
@@ -1546,20 +2628,24 @@ static GsmApp *find_app_for_startup_id(GsmManager *manager,
   /* If we're starting up the session, try to match the new client
    * with one pending apps for the current phase. If not, try to match
    * with any of the autostarted apps. */
-  if (priv->phase < GSM_MANAGER_PHASE_APPLICATION) {
-    for (a = priv->pending_apps; a != NULL; a = a->next) {
-      GsmApp *app = GSM_APP(a->data);
+  if (priv->phase < GSM_MANAGER_PHASE_APPLICATION &&
+      priv->startup_graph == NULL) {
+    GsmApp *app;
 
-      if (strcmp(startup_id, gsm_app_peek_startup_id(app)) == 0) {
-        found_app = app;
-        goto out;
-      }
+    /* Apps that missed their deadline are not pending anymore, but
+     * still get to register */
+    app = (GsmApp *)gsm_store_lookup_by_index(priv->apps, INDEX_STARTUP_ID,
+                                              startup_id);
+    if (app != NULL && (gsm_ordered_set_contains(priv->pending_apps, app) ||
+                        g_hash_table_contains(priv->launching_apps, app))) {
+      found_app = app;
+      goto out;
     }
   } else {
     GsmApp *app;
 
-    app = (GsmApp *)gsm_store_find(
-        priv->apps, (GsmStoreFunc)_app_has_startup_id, (char *)startup_id);
+    app = (GsmApp *)gsm_store_lookup_by_index(priv->apps, INDEX_STARTUP_ID,
+                                              startup_id);
     if (app != NULL) {
       found_app = app;
       goto out;
@@ -1569,11 +2655,77 @@ out:
   return found_app;
 }
 
-static void _disconnect_client(GsmManager *manager, GsmClient *client) {
-  gboolean is_condition_client;
+typedef struct {
+  GsmManager *manager;
   GsmApp *app;
+} DelayedRestart;
+
+static void restart_app(GsmApp *app) {
   GError *error;
   gboolean UNUSED_VARIABLE res;
+
+  g_debug("GsmManager: restarting app");
+
+  error = NULL;
+  res = gsm_app_restart(app, &error);
+  if (error != NULL) {
+    g_warning("Error on restarting session managed app: %s", error->message);
+    g_error_free(error);
+  }
+}
+
+static gboolean on_restart_delay_elapsed(DelayedRestart *restart) {
+  GsmManagerPrivate *priv;
+
+  priv = gsm_manager_get_instance_private(restart->manager);
+
+  if (priv->phase >= GSM_MANAGER_PHASE_QUERY_END_SESSION) {
+    g_debug("GsmManager: in shutdown, not restarting application");
+  } else if (gsm_app_is_running(restart->app)) {
+    g_debug("GsmManager: app already restarted");
+  } else {
+    restart_app(restart->app);
+  }
+
+  return G_SOURCE_REMOVE;
+}
+
+static void delayed_restart_free(DelayedRestart *restart) {
+  g_object_unref(restart->manager);
+  g_object_unref(restart->app);
+  g_slice_free(DelayedRestart, restart);
+}
+
+/* Restarts @app right away or after a backoff, depending on how often it
+ * exited lately, or gives up on it if it keeps exiting */
+static void schedule_app_restart(GsmManager *manager, GsmApp *app) {
+  DelayedRestart *restart;
+  guint delay;
+
+  switch (gsm_restart_history_record_exit(gsm_app_peek_app_id(app), &delay)) {
+    case GSM_RESTART_NOW:
+      restart_app(app);
+      break;
+    case GSM_RESTART_LATER:
+      restart = g_slice_new(DelayedRestart);
+      restart->manager = g_object_ref(manager);
+      restart->app = g_object_ref(app);
+      g_timeout_add_full(G_PRIORITY_DEFAULT, delay,
+                         (GSourceFunc)on_restart_delay_elapsed, restart,
+                         (GDestroyNotify)delayed_restart_free);
+      break;
+    case GSM_RESTART_GIVE_UP:
+      g_debug("GsmManager: app keeps exiting, not restarting application");
+      break;
+    default:
+      g_assert_not_reached();
+      break;
+  }
+}
+
+static void _disconnect_client(GsmManager *manager, GsmClient *client) {
+  gboolean is_condition_client;
+  GsmApp *app;
   const char *app_id;
   const char *startup_id;
   gboolean app_restart;
@@ -1596,9 +2748,7 @@ static void _disconnect_client(GsmManager *manager, GsmClient *client) {
   }
 
   /* remove any inhibitors for this client */
-  gsm_store_foreach_remove(priv->inhibitors,
-                           (GsmStoreFunc)inhibitor_has_client_id,
-                           (gpointer)gsm_client_peek_id(client));
+  remove_inhibitors_for_client(manager, gsm_client_peek_id(client));
 
   app = NULL;
 
@@ -1662,49 +2812,20 @@ static void _disconnect_client(GsmManager *manager, GsmClient *client) {
     goto out;
   }
 
-  g_debug("GsmManager: restarting app");
-
-  error = NULL;
-  res = gsm_app_restart(app, &error);
-  if (error != NULL) {
-    g_warning("Error on restarting session managed app: %s", error->message);
-    g_error_free(error);
-  }
+  schedule_app_restart(manager, app);
 
 out:
   g_object_unref(client);
 }
 
-typedef struct {
-  const char *service_name;
-  GsmManager *manager;
-} RemoveClientData;
-
 static gboolean _disconnect_dbus_client(const char *id, GsmClient *client,
-                                        RemoveClientData *data) {
-  const char *name;
-
+                                        GsmManager *manager) {
   if (!GSM_IS_DBUS_CLIENT(client)) {
     return FALSE;
   }
 
-  /* If no service name, then we simply disconnect all clients */
-  if (!data->service_name) {
-    _disconnect_client(data->manager, client);
-    return TRUE;
-  }
-
-  name = gsm_dbus_client_get_bus_name(GSM_DBUS_CLIENT(client));
-  if (IS_STRING_EMPTY(name)) {
-    return FALSE;
-  }
-
-  if (strcmp(data->service_name, name) == 0) {
-    _disconnect_client(data->manager, client);
-    return TRUE;
-  }
-
-  return FALSE;
+  _disconnect_client(manager, client);
+  return TRUE;
 }
 
 /**
@@ -1718,16 +2839,31 @@ static gboolean _disconnect_dbus_client(const char *id, GsmClient *client,
  */
 static void remove_clients_for_connection(GsmManager *manager,
                                           const char *service_name) {
-  RemoveClientData data;
   GsmManagerPrivate *priv;
 
-  data.service_name = service_name;
-  data.manager = manager;
   priv = gsm_manager_get_instance_private(manager);
 
-  /* disconnect dbus clients for name */
-  gsm_store_foreach_remove(priv->clients, (GsmStoreFunc)_disconnect_dbus_client,
-                           &data);
+  if (service_name == NULL) {
+    /* disconnect all dbus clients */
+    gsm_store_foreach_remove(priv->clients,
+                             (GsmStoreFunc)_disconnect_dbus_client, manager);
+  } else {
+    GSList *clients;
+    GSList *l;
+
+    /* disconnect dbus clients for name */
+    clients = gsm_store_lookup_all_by_index(priv->clients, INDEX_BUS_NAME,
+                                            service_name);
+    for (l = clients; l != NULL; l = l->next) {
+      GsmClient *client = l->data;
+
+      g_object_ref(client);
+      _disconnect_client(manager, client);
+      gsm_store_remove(priv->clients, gsm_client_peek_id(client));
+      g_object_unref(client);
+    }
+    g_slist_free(clients);
+  }
 
   if (priv->phase >= GSM_MANAGER_PHASE_QUERY_END_SESSION &&
       gsm_store_size(priv->clients) == 0) {
@@ -1736,54 +2872,41 @@ static void remove_clients_for_connection(GsmManager *manager,
   }
 }
 
-static gboolean inhibitor_has_bus_name(gpointer key, GsmInhibitor *inhibitor,
-                                       RemoveClientData *data) {
-  gboolean matches;
-  const char *bus_name_b;
-
-  bus_name_b = gsm_inhibitor_peek_bus_name(inhibitor);
-
-  matches = FALSE;
-  if (!IS_STRING_EMPTY(data->service_name) && !IS_STRING_EMPTY(bus_name_b)) {
-    matches = (strcmp(data->service_name, bus_name_b) == 0);
-    if (matches) {
-      g_debug(
-          "GsmManager: removing inhibitor from %s for reason '%s' on "
-          "connection %s",
-          gsm_inhibitor_peek_app_id(inhibitor),
-          gsm_inhibitor_peek_reason(inhibitor),
-          gsm_inhibitor_peek_bus_name(inhibitor));
-    }
-  }
-
-  return matches;
-}
-
 static void remove_inhibitors_for_connection(GsmManager *manager,
                                              const char *service_name) {
-  guint UNUSED_VARIABLE n_removed;
-  RemoveClientData data;
+  GSList *inhibitors;
+  GSList *l;
   GsmManagerPrivate *priv;
 
-  data.service_name = service_name;
-  data.manager = manager;
   priv = gsm_manager_get_instance_private(manager);
 
-  debug_inhibitors(manager);
+  inhibitors = gsm_store_lookup_all_by_index(priv->inhibitors, INDEX_BUS_NAME,
+                                             service_name);
+  for (l = inhibitors; l != NULL; l = l->next) {
+    GsmInhibitor *inhibitor = l->data;
+
+    g_debug(
+        "GsmManager: removing inhibitor from %s for reason '%s' on "
+        "connection %s",
+        gsm_inhibitor_peek_app_id(inhibitor),
+        gsm_inhibitor_peek_reason(inhibitor),
+        gsm_inhibitor_peek_bus_name(inhibitor));
+    gsm_store_remove(priv->inhibitors, gsm_inhibitor_peek_id(inhibitor));
+  }
 
-  n_removed = gsm_store_foreach_remove(
-      priv->inhibitors, (GsmStoreFunc)inhibitor_has_bus_name, &data);
+  g_slist_free(inhibitors);
 }
 
-static void bus_name_owner_changed(DBusGProxy *bus_proxy,
+static void bus_name_owner_changed(GsmManager *manager,
                                    const char *service_name,
                                    const char *old_service_name,
-                                   const char *new_service_name,
-                                   GsmManager *manager) {
+                                   const char *new_service_name) {
   if (strlen(new_service_name) == 0 && strlen(old_service_name) > 0) {
     /* service removed */
-    remove_inhibitors_for_connection(manager, old_service_name);
-    remove_clients_for_connection(manager, old_service_name);
+    g_debug("GsmManager: %s left the bus", service_name);
+    remove_inhibitors_for_connection(manager, service_name);
+    remove_clients_for_connection(manager, service_name);
+    debug_inhibitors(manager);
   } else if (strlen(old_service_name) == 0 && strlen(new_service_name) > 0) {
     /* service added */
 
@@ -1792,6 +2915,135 @@ static void bus_name_owner_changed(DBusGProxy *bus_proxy,
   }
 }
 
+static char *get_name_owner_changed_rule(const char *name) {
+  return g_strdup_printf("type='signal',sender='" DBUS_SERVICE_DBUS
+                         "',interface='" DBUS_INTERFACE_DBUS
+                         "',member='NameOwnerChanged',arg0='%s'",
+                         name);
+}
+
+typedef struct {
+  GsmManager *manager;
+  char *name;
+} NameHasOwnerData;
+
+static void name_has_owner_data_free(NameHasOwnerData *data) {
+  g_object_unref(data->manager);
+  g_free(data->name);
+  g_slice_free(NameHasOwnerData, data);
+}
+
+static void on_name_has_owner_reply(DBusPendingCall *call,
+                                    NameHasOwnerData *data) {
+  GsmManagerPrivate *priv;
+  DBusMessage *reply;
+  dbus_bool_t has_owner;
+
+  priv = gsm_manager_get_instance_private(data->manager);
+
+  reply = dbus_pending_call_steal_reply(call);
+  if (reply == NULL) {
+    return;
+  }
+
+  /* The name may have left before our match rule was in place */
+  if (dbus_message_get_type(reply) == DBUS_MESSAGE_TYPE_METHOD_RETURN &&
+      dbus_message_get_args(reply, NULL, DBUS_TYPE_BOOLEAN, &has_owner,
+                            DBUS_TYPE_INVALID) &&
+      !has_owner && g_hash_table_contains(priv->watched_names, data->name)) {
+    bus_name_owner_changed(data->manager, data->name, data->name, "");
+  }
+
+  dbus_message_unref(reply);
+}
+
+static void watch_bus_name(GsmManager *manager, const char *id,
+                           const char *name) {
+  GsmManagerPrivate *priv;
+  DBusConnection *connection;
+  DBusMessage *message;
+  DBusPendingCall *call;
+  NameHasOwnerData *data;
+  char *rule;
+  guint count;
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  if (IS_STRING_EMPTY(name) || g_hash_table_contains(priv->bus_names, id)) {
+    return;
+  }
+
+  count = GPOINTER_TO_UINT(g_hash_table_lookup(priv->watched_names, name));
+  g_hash_table_insert(priv->bus_names, g_strdup(id), g_strdup(name));
+  g_hash_table_replace(priv->watched_names, g_strdup(name),
+                       GUINT_TO_POINTER(count + 1));
+
+  if (count > 0 || priv->connection == NULL || priv->dbus_disconnected) {
+    return;
+  }
+
+  connection = dbus_g_connection_get_connection(priv->connection);
+
+  rule = get_name_owner_changed_rule(name);
+  dbus_bus_add_match(connection, rule, NULL);
+  g_free(rule);
+
+  message = dbus_message_new_method_call(DBUS_SERVICE_DBUS, DBUS_PATH_DBUS,
+                                         DBUS_INTERFACE_DBUS, "NameHasOwner");
+  dbus_message_append_args(message, DBUS_TYPE_STRING, &name,
+                           DBUS_TYPE_INVALID);
+
+  call = NULL;
+  if (dbus_connection_send_with_reply(connection, message, &call, -1) &&
+      call != NULL) {
+    data = g_slice_new(NameHasOwnerData);
+    data->manager = g_object_ref(manager);
+    data->name = g_strdup(name);
+    dbus_pending_call_set_notify(
+        call, (DBusPendingCallNotifyFunction)on_name_has_owner_reply, data,
+        (DBusFreeFunction)name_has_owner_data_free);
+    dbus_pending_call_unref(call);
+  }
+
+  dbus_message_unref(message);
+}
+
+static void unwatch_bus_name(GsmManager *manager, const char *id) {
+  GsmManagerPrivate *priv;
+  DBusConnection *connection;
+  const char *name;
+  char *rule;
+  guint count;
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  name = g_hash_table_lookup(priv->bus_names, id);
+  if (name == NULL) {
+    return;
+  }
+
+  count = GPOINTER_TO_UINT(g_hash_table_lookup(priv->watched_names, name));
+  if (count > 1) {
+    g_hash_table_replace(priv->watched_names, g_strdup(name),
+                         GUINT_TO_POINTER(count - 1));
+  } else {
+    gsm_caller_info_forget(name);
+    g_hash_table_remove(priv->watched_names, name);
+
+    if (priv->connection != NULL && !priv->dbus_disconnected) {
+      connection = dbus_g_connection_get_connection(priv->connection);
+      rule = get_name_owner_changed_rule(name);
+      dbus_bus_remove_match(connection, rule, NULL);
+      g_free(rule);
+    }
+  }
+
+  g_hash_table_remove(priv->bus_names, id);
+}
+
+static void handle_inhibit_fd(GsmManager *manager, DBusConnection *connection,
+                              DBusMessage *message);
+
 static DBusHandlerResult gsm_manager_bus_filter(DBusConnection *connection,
                                                 DBusMessage *message,
                                                 void *user_data) {
@@ -1808,6 +3060,30 @@ static DBusHandlerResult gsm_manager_bus_filter(DBusConnection *connection,
     remove_clients_for_connection(manager, NULL);
     /* let other filters get this disconnected signal, so that they
      * can handle it too */
+  } else if (dbus_message_is_signal(message, DBUS_INTERFACE_DBUS,
+                                    "NameOwnerChanged") &&
+             dbus_message_has_sender(message, DBUS_SERVICE_DBUS)) {
+    const char *name;
+    const char *old_owner;
+    const char *new_owner;
+
+    /* Only names of our clients and inhibitors are matched, but other
+     * code on this connection may have broader rules; and only the bus
+     * itself may tell us that a name went away */
+    if (dbus_message_get_args(message, NULL, DBUS_TYPE_STRING, &name,
+                              DBUS_TYPE_STRING, &old_owner, DBUS_TYPE_STRING,
+                              &new_owner, DBUS_TYPE_INVALID) &&
+        g_hash_table_contains(priv->watched_names, name)) {
+      bus_name_owner_changed(manager, name, old_owner, new_owner);
+    }
+  } else if (dbus_message_is_method_call(message, GSM_MANAGER_DBUS_NAME,
+                                         "InhibitFd") &&
+             g_strcmp0(dbus_message_get_path(message),
+                       GSM_MANAGER_DBUS_PATH) == 0) {
+    /* dbus-glib cannot pass file descriptors, so this one method is
+     * handled here rather than through the generated glue */
+    handle_inhibit_fd(manager, connection, message);
+    return DBUS_HANDLER_RESULT_HANDLED;
   }
 
   return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
@@ -1834,14 +3110,10 @@ static gboolean register_manager(GsmManager *manager) {
   dbus_connection_add_filter(connection, gsm_manager_bus_filter, manager, NULL);
   priv->dbus_disconnected = FALSE;
 
-  priv->bus_proxy = dbus_g_proxy_new_for_name(
-      priv->connection, DBUS_SERVICE_DBUS, DBUS_PATH_DBUS, DBUS_INTERFACE_DBUS);
-  dbus_g_proxy_add_signal(priv->bus_proxy, "NameOwnerChanged", G_TYPE_STRING,
-                          G_TYPE_STRING, G_TYPE_STRING, G_TYPE_INVALID);
-  dbus_g_proxy_connect_signal(priv->bus_proxy, "NameOwnerChanged",
-                              G_CALLBACK(bus_name_owner_changed), manager,
-                              NULL);
-
+  /* Still on dbus-glib: the clients, inhibitors, apps and presence are
+   * exported on this same connection, which also owns the bus name, so
+   * the manager cannot move to a GDBus skeleton on its own connection
+   * before they do. */
   dbus_g_connection_register_g_object(priv->connection, GSM_MANAGER_DBUS_PATH,
                                       G_OBJECT(manager));
 
@@ -1858,19 +3130,6 @@ static void gsm_manager_set_failsafe(GsmManager *manager, gboolean enabled) {
   priv->failsafe = enabled;
 }
 
-static gboolean _client_has_startup_id(const char *id, GsmClient *client,
-                                       const char *startup_id_a) {
-  const char *startup_id_b;
-
-  startup_id_b = gsm_client_peek_startup_id(client);
-
-  if (IS_STRING_EMPTY(startup_id_b)) {
-    return FALSE;
-  }
-
-  return (strcmp(startup_id_a, startup_id_b) == 0);
-}
-
 static void on_client_disconnected(GsmClient *client, GsmManager *manager) {
   GsmManagerPrivate *priv;
 
@@ -1878,6 +3137,13 @@ static void on_client_disconnected(GsmClient *client, GsmManager *manager) {
 
   priv = gsm_manager_get_instance_private(manager);
 
+  if (priv->phase == GSM_MANAGER_PHASE_RUNNING &&
+      checkpoints_enabled(manager) &&
+      gsm_client_peek_restart_style_hint(client) !=
+          GSM_CLIENT_RESTART_IMMEDIATELY) {
+    gsm_session_journal_remove(client);
+  }
+
   _disconnect_client(manager, client);
   gsm_store_remove(priv->clients, gsm_client_peek_id(client));
   if (priv->phase >= GSM_MANAGER_PHASE_QUERY_END_SESSION &&
@@ -1908,8 +3174,7 @@ static gboolean on_xsmp_client_register_request(GsmXSMPClient *client,
   } else {
     GsmClient *sm_client;
 
-    sm_client = (GsmClient *)gsm_store_find(
-        priv->clients, (GsmStoreFunc)_client_has_startup_id, *id);
+    sm_client = find_client_for_startup_id(manager, *id);
     /* We can't have two clients with the same id. */
     if (sm_client != NULL) {
       goto out;
@@ -1947,19 +3212,18 @@ out:
 }
 
 static gboolean auto_save_is_enabled(GsmManager *manager) {
-  GsmManagerPrivate *priv;
-
-  priv = gsm_manager_get_instance_private(manager);
-  return g_settings_get_boolean(priv->settings_session, KEY_AUTOSAVE);
+  return gsm_settings_get_boolean(GSM_SETTINGS_SESSION, KEY_AUTOSAVE);
 }
 
-static void maybe_save_session(GsmManager *manager) {
+/* Sessions are not saved in the login window, and only while the
+ * session is running or when logging out */
+static gboolean session_can_be_saved(GsmManager *manager) {
   GsmConsolekit *consolekit = NULL;
 #ifdef HAVE_SYSTEMD
   GsmSystemd *systemd = NULL;
 #endif
   char *session_type;
-  GError *error;
+  gboolean ret = FALSE;
   GsmManagerPrivate *priv;
 
 #ifdef HAVE_SYSTEMD
@@ -1984,13 +3248,30 @@ static void maybe_save_session(GsmManager *manager) {
 #endif
 
   priv = gsm_manager_get_instance_private(manager);
-  /* We only allow session saving when session is running or when
-   * logging out */
-  if (priv->phase != GSM_MANAGER_PHASE_RUNNING &&
-      priv->phase != GSM_MANAGER_PHASE_END_SESSION) {
-    goto out;
+  ret = (priv->phase == GSM_MANAGER_PHASE_RUNNING ||
+         priv->phase == GSM_MANAGER_PHASE_END_SESSION);
+
+out:
+  if (consolekit != NULL) g_object_unref(consolekit);
+#ifdef HAVE_SYSTEMD
+  if (systemd != NULL) g_object_unref(systemd);
+#endif
+  g_free(session_type);
+
+  return ret;
+}
+
+static void maybe_save_session(GsmManager *manager) {
+  GError *error;
+  GsmManagerPrivate *priv;
+
+  if (!session_can_be_saved(manager)) {
+    gsm_session_save_abort();
+    return;
   }
 
+  priv = gsm_manager_get_instance_private(manager);
+
   error = NULL;
   gsm_session_save(priv->clients, &error);
 
@@ -1998,13 +3279,79 @@ static void maybe_save_session(GsmManager *manager) {
     g_warning("Error saving session: %s", error->message);
     g_error_free(error);
   }
+}
 
-out:
-  if (consolekit != NULL) g_object_unref(consolekit);
-#ifdef HAVE_SYSTEMD
-  if (systemd != NULL) g_object_unref(systemd);
-#endif
-  g_free(session_type);
+static gboolean checkpoints_enabled(GsmManager *manager) {
+  return auto_save_is_enabled(manager) &&
+         gsm_settings_get_int(GSM_SETTINGS_SESSION, KEY_CHECKPOINT_INTERVAL) >
+             0;
+}
+
+static gboolean _client_save_state(const char *id, GsmClient *client,
+                                   gpointer user_data) {
+  if (GSM_IS_XSMP_CLIENT(client)) {
+    gsm_xsmp_client_save_state(GSM_XSMP_CLIENT(client));
+  }
+
+  return FALSE;
+}
+
+static gboolean on_checkpoint_timeout(GsmManager *manager) {
+  GsmManagerPrivate *priv;
+  guint status;
+
+  priv = gsm_manager_get_instance_private(manager);
+  priv->checkpoint_id = 0;
+
+  if (priv->phase != GSM_MANAGER_PHASE_RUNNING ||
+      !session_can_be_saved(manager)) {
+    return FALSE;
+  }
+
+  g_object_get(priv->presence, "status", &status, NULL);
+
+  if ((status != GSM_PRESENCE_STATUS_IDLE ||
+       get_system_busyness() > GSM_MANAGER_CHECKPOINT_BUSY_THRESHOLD) &&
+      priv->checkpoint_backoff < GSM_MANAGER_CHECKPOINT_MAX_BACKOFF) {
+    priv->checkpoint_backoff *= 2;
+    g_debug("GsmManager: postponing checkpoint (backoff %u)",
+            priv->checkpoint_backoff);
+  } else {
+    g_debug("GsmManager: checkpointing the session");
+    priv->checkpoint_backoff = 1;
+    gsm_store_foreach(priv->clients, (GsmStoreFunc)_client_save_state, NULL);
+  }
+
+  schedule_checkpoint(manager);
+
+  return FALSE;
+}
+
+static void schedule_checkpoint(GsmManager *manager) {
+  GsmManagerPrivate *priv;
+  int interval;
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  if (priv->checkpoint_id > 0) {
+    g_source_remove(priv->checkpoint_id);
+    priv->checkpoint_id = 0;
+  }
+
+  if (priv->phase != GSM_MANAGER_PHASE_RUNNING ||
+      !checkpoints_enabled(manager)) {
+    return;
+  }
+
+  if (priv->checkpoint_backoff == 0) {
+    priv->checkpoint_backoff = 1;
+  }
+
+  interval =
+      gsm_settings_get_int(GSM_SETTINGS_SESSION, KEY_CHECKPOINT_INTERVAL);
+  priv->checkpoint_id =
+      g_timeout_add_seconds(interval * 60 * priv->checkpoint_backoff,
+                            (GSourceFunc)on_checkpoint_timeout, manager);
 }
 
 static void _handle_client_end_session_response(
@@ -2013,8 +3360,13 @@ static void _handle_client_end_session_response(
   GsmManagerPrivate *priv;
 
   priv = gsm_manager_get_instance_private(manager);
-  /* just ignore if received outside of shutdown */
+  /* just ignore if received outside of shutdown, apart from recording
+   * the state clients saved during a checkpoint */
   if (priv->phase < GSM_MANAGER_PHASE_QUERY_END_SESSION) {
+    if (priv->phase == GSM_MANAGER_PHASE_RUNNING &&
+        checkpoints_enabled(manager)) {
+      gsm_session_journal_client(client);
+    }
     return;
   }
 
@@ -2028,7 +3380,21 @@ static void _handle_client_end_session_response(
     return;
   }
 
-  priv->query_clients = g_slist_remove(priv->query_clients, client);
+  if (priv->phase == GSM_MANAGER_PHASE_QUERY_END_SESSION) {
+    record_query_response(manager, client);
+  } else if (priv->phase == GSM_MANAGER_PHASE_END_SESSION &&
+             gsm_ordered_set_contains(priv->query_clients, client)) {
+    char *app_id;
+
+    app_id = get_client_app_id(client);
+    gsm_metrics_observe_labeled(
+        GSM_METRIC_END_SESSION_RESPONSE,
+        app_id != NULL ? app_id : gsm_client_peek_id(client),
+        g_get_monotonic_time() - priv->end_session_sent);
+    g_free(app_id);
+  }
+
+  gsm_ordered_set_remove(priv->query_clients, client);
 
   if (!is_ok && priv->logout_mode != GSM_MANAGER_LOGOUT_MODE_FORCE) {
     guint cookie;
@@ -2061,34 +3427,35 @@ static void _handle_client_end_session_response(
                   G_OBJECT(inhibitor));
     g_object_unref(inhibitor);
   } else {
-    gsm_store_foreach_remove(priv->inhibitors,
-                             (GsmStoreFunc)inhibitor_has_client_id,
-                             (gpointer)gsm_client_peek_id(client));
+    remove_inhibitors_for_client(manager, gsm_client_peek_id(client));
   }
 
   if (priv->phase == GSM_MANAGER_PHASE_QUERY_END_SESSION) {
-    if (priv->query_clients == NULL) {
+    if (gsm_ordered_set_is_empty(priv->query_clients)) {
       query_end_session_complete(manager);
     }
   } else if (priv->phase == GSM_MANAGER_PHASE_END_SESSION) {
+    if (is_ok) {
+      gsm_session_save_client(client);
+    }
+
     if (do_last) {
       /* This only makes sense if we're in part 1 of
        * GSM_MANAGER_PHASE_END_SESSION. Doing this in part 2
        * can only happen because of a buggy client that loops
        * wanting to be last again and again. The phase
        * timeout will take care of this issue. */
-      priv->next_query_clients =
-          g_slist_prepend(priv->next_query_clients, client);
+      gsm_ordered_set_add(priv->next_query_clients, client);
     }
 
     /* we can continue to the next step if all clients have replied
      * and if there's no inhibitor */
-    if (priv->query_clients != NULL ||
+    if (!gsm_ordered_set_is_empty(priv->query_clients) ||
         gsm_manager_is_logout_inhibited(manager)) {
       return;
     }
 
-    if (priv->next_query_clients != NULL) {
+    if (!gsm_ordered_set_is_empty(priv->next_query_clients)) {
       do_phase_end_session_part_2(manager);
     } else {
       end_phase(manager);
@@ -2124,12 +3491,112 @@ static void on_xsmp_client_logout_request(GsmXSMPClient *client,
   }
 }
 
+static void change_batch_init(ChangeBatch *batch) {
+  batch->added = g_hash_table_new_full(
+      g_str_hash, gsm_util_intern_equal,
+      (GDestroyNotify)gsm_util_intern_release, NULL);
+  batch->removed = g_hash_table_new_full(
+      g_str_hash, gsm_util_intern_equal,
+      (GDestroyNotify)gsm_util_intern_release, NULL);
+}
+
+static void change_batch_clear(ChangeBatch *batch) {
+  g_clear_pointer(&batch->added, g_hash_table_destroy);
+  g_clear_pointer(&batch->removed, g_hash_table_destroy);
+}
+
+static GPtrArray *change_batch_take(GHashTable *ids) {
+  GPtrArray *paths;
+  GHashTableIter iter;
+  gpointer key;
+
+  paths =
+      g_ptr_array_new_with_free_func((GDestroyNotify)gsm_util_intern_release);
+
+  g_hash_table_iter_init(&iter, ids);
+  while (g_hash_table_iter_next(&iter, &key, NULL)) {
+    g_ptr_array_add(paths, key);
+    g_hash_table_iter_steal(&iter);
+  }
+
+  return paths;
+}
+
+static gboolean change_batch_emit(GsmManager *manager, ChangeBatch *batch,
+                                  guint signal) {
+  GPtrArray *added;
+  GPtrArray *removed;
+
+  if (g_hash_table_size(batch->added) == 0 &&
+      g_hash_table_size(batch->removed) == 0) {
+    return FALSE;
+  }
+
+  added = change_batch_take(batch->added);
+  removed = change_batch_take(batch->removed);
+
+  g_signal_emit(manager, signals[signal], 0, added, removed);
+
+  g_ptr_array_unref(added);
+  g_ptr_array_unref(removed);
+
+  return TRUE;
+}
+
+static gboolean emit_changed_signals(GsmManager *manager) {
+  GsmManagerPrivate *priv;
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  priv->changed_signals_id = 0;
+
+  change_batch_emit(manager, &priv->client_changes, CLIENTS_CHANGED);
+  if (change_batch_emit(manager, &priv->inhibitor_changes,
+                        INHIBITORS_CHANGED)) {
+    update_idle(manager);
+  }
+
+  /* Inhibited state only changes along with an inhibitor batch, so this is
+   * rate-limited the same way */
+  if (priv->inhibited_generation != priv->inhibited_generation_sent) {
+    priv->inhibited_generation_sent = priv->inhibited_generation;
+    g_signal_emit(manager, signals[INHIBITED_CHANGED], 0,
+                  priv->inhibited_generation);
+  }
+
+  return FALSE;
+}
+
+/* Records that @id was added or removed and schedules the batched signal;
+ * an object that comes and goes within one batch is not reported. */
+static void queue_change(GsmManager *manager, ChangeBatch *batch,
+                         const char *id, gboolean added) {
+  GsmManagerPrivate *priv;
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  if (added) {
+    g_hash_table_add(batch->added, gsm_util_intern(id));
+  } else if (!g_hash_table_remove(batch->added, id)) {
+    g_hash_table_add(batch->removed, gsm_util_intern(id));
+  }
+
+  if (priv->changed_signals_id == 0) {
+    priv->changed_signals_id =
+        g_timeout_add(GSM_MANAGER_CHANGED_SIGNAL_INTERVAL,
+                      (GSourceFunc)emit_changed_signals, manager);
+  }
+}
+
 static void on_store_client_added(GsmStore *store, const char *id,
                                   GsmManager *manager) {
+  GsmManagerPrivate *priv;
   GsmClient *client;
 
   g_debug("GsmManager: Client added: %s", id);
 
+  priv = gsm_manager_get_instance_private(manager);
+
   client = (GsmClient *)gsm_store_lookup(store, id);
 
   /* a bit hacky */
@@ -2143,15 +3610,28 @@ static void on_store_client_added(GsmStore *store, const char *id,
   g_signal_connect(client, "end-session-response",
                    G_CALLBACK(on_client_end_session_response), manager);
 
+  if (GSM_IS_DBUS_CLIENT(client)) {
+    watch_bus_name(manager, id,
+                   gsm_dbus_client_get_bus_name(GSM_DBUS_CLIENT(client)));
+  }
+
   g_signal_emit(manager, signals[CLIENT_ADDED], 0, id);
+  queue_change(manager, &priv->client_changes, id, TRUE);
   /* FIXME: disconnect signal handler */
 }
 
 static void on_store_client_removed(GsmStore *store, const char *id,
                                     GsmManager *manager) {
+  GsmManagerPrivate *priv;
+
   g_debug("GsmManager: Client removed: %s", id);
 
+  priv = gsm_manager_get_instance_private(manager);
+
+  unwatch_bus_name(manager, id);
+
   g_signal_emit(manager, signals[CLIENT_REMOVED], 0, id);
+  queue_change(manager, &priv->client_changes, id, FALSE);
 }
 
 static void gsm_manager_set_client_store(GsmManager *manager, GsmStore *store) {
@@ -2178,6 +3658,11 @@ static void gsm_manager_set_client_store(GsmManager *manager, GsmStore *store) {
   priv->clients = store;
 
   if (priv->clients != NULL) {
+    gsm_store_add_index(priv->clients, INDEX_STARTUP_ID, "startup-id",
+                        (GsmStoreIndexFunc)client_startup_id_key);
+    gsm_store_add_index(priv->clients, INDEX_BUS_NAME, NULL,
+                        (GsmStoreIndexFunc)client_bus_name_key);
+
     g_signal_connect(priv->clients, "added", G_CALLBACK(on_store_client_added),
                      manager);
     g_signal_connect(priv->clients, "removed",
@@ -2228,34 +3713,177 @@ static void gsm_manager_get_property(GObject *object, guint prop_id,
   }
 }
 
-static gboolean _find_app_provides(const char *id, GsmApp *app,
-                                   const char *service) {
-  return gsm_app_provides(app, service);
-}
+static GObject *gsm_manager_constructor(
+    GType type, guint n_construct_properties,
+    GObjectConstructParam *construct_properties) {
+  GsmManager *manager;
+
+  manager = GSM_MANAGER(
+      G_OBJECT_CLASS(gsm_manager_parent_class)
+          ->constructor(type, n_construct_properties, construct_properties));
+  return G_OBJECT(manager);
+}
+
+static void inhibitor_expiry_free(InhibitorExpiry *expiry) {
+  g_free(expiry->id);
+  g_slice_free(InhibitorExpiry, expiry);
+}
+
+static gint compare_inhibitor_expiries(const InhibitorExpiry *a,
+                                       const InhibitorExpiry *b,
+                                       gpointer data) {
+  return (a->deadline > b->deadline) - (a->deadline < b->deadline);
+}
+
+static void schedule_inhibitor_expiries(GsmManager *manager);
+
+static gboolean on_inhibitor_expiry_timeout(GsmManager *manager) {
+  GsmManagerPrivate *priv;
+  InhibitorExpiry *expiry;
+  gint64 now;
+
+  priv = gsm_manager_get_instance_private(manager);
+  priv->inhibitor_expiry_id = 0;
+
+  now = g_get_monotonic_time() / G_USEC_PER_SEC;
+
+  /* Unlink each due entry before removing its inhibitor, so that the
+   * store's "removed" handler finds nothing left to cancel */
+  while ((expiry = g_queue_peek_head(priv->inhibitor_expiries)) != NULL &&
+         expiry->deadline <= now) {
+    g_queue_pop_head(priv->inhibitor_expiries);
+    g_hash_table_remove(priv->expiry_links, expiry->id);
+
+    g_debug("GsmManager: inhibitor %s: timeout expired", expiry->id);
+    gsm_store_remove(priv->inhibitors, expiry->id);
+    inhibitor_expiry_free(expiry);
+  }
+
+  schedule_inhibitor_expiries(manager);
+
+  return FALSE;
+}
+
+/* Arms the single timer for the earliest inhibitor expiry */
+static void schedule_inhibitor_expiries(GsmManager *manager) {
+  GsmManagerPrivate *priv;
+  InhibitorExpiry *expiry;
+  gint64 now;
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  if (priv->inhibitor_expiry_id > 0) {
+    g_source_remove(priv->inhibitor_expiry_id);
+    priv->inhibitor_expiry_id = 0;
+  }
+
+  expiry = g_queue_peek_head(priv->inhibitor_expiries);
+  if (expiry == NULL) {
+    return;
+  }
+
+  now = g_get_monotonic_time() / G_USEC_PER_SEC;
+  priv->inhibitor_expiry_id = g_timeout_add_seconds(
+      (guint)MAX(expiry->deadline - now, 0),
+      (GSourceFunc)on_inhibitor_expiry_timeout, manager);
+}
+
+static void queue_inhibitor_expiry(GsmManager *manager, const char *id,
+                                   guint timeout) {
+  GsmManagerPrivate *priv;
+  InhibitorExpiry *expiry;
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  expiry = g_slice_new(InhibitorExpiry);
+  expiry->deadline = g_get_monotonic_time() / G_USEC_PER_SEC + timeout;
+  expiry->id = g_strdup(id);
+
+  g_queue_insert_sorted(priv->inhibitor_expiries, expiry,
+                        (GCompareDataFunc)compare_inhibitor_expiries, NULL);
+  g_hash_table_replace(priv->expiry_links, g_strdup(id),
+                       g_queue_find(priv->inhibitor_expiries, expiry));
+
+  if (g_queue_peek_head(priv->inhibitor_expiries) == expiry) {
+    schedule_inhibitor_expiries(manager);
+  }
+}
+
+/* Drops the expiry of an inhibitor that went away by other means */
+static void cancel_inhibitor_expiry(GsmManager *manager, const char *id) {
+  GsmManagerPrivate *priv;
+  GList *link;
+  gboolean was_head;
 
-static GObject *gsm_manager_constructor(
-    GType type, guint n_construct_properties,
-    GObjectConstructParam *construct_properties) {
-  GsmManager *manager;
+  priv = gsm_manager_get_instance_private(manager);
 
-  manager = GSM_MANAGER(
-      G_OBJECT_CLASS(gsm_manager_parent_class)
-          ->constructor(type, n_construct_properties, construct_properties));
-  return G_OBJECT(manager);
+  link = g_hash_table_lookup(priv->expiry_links, id);
+  if (link == NULL) {
+    return;
+  }
+
+  was_head = link == priv->inhibitor_expiries->head;
+
+  inhibitor_expiry_free(link->data);
+  g_queue_delete_link(priv->inhibitor_expiries, link);
+  g_hash_table_remove(priv->expiry_links, id);
+
+  if (was_head) {
+    schedule_inhibitor_expiries(manager);
+  }
 }
 
 static void on_store_inhibitor_added(GsmStore *store, const char *id,
                                      GsmManager *manager) {
+  GsmManagerPrivate *priv;
+  GsmInhibitor *inhibitor;
+  guint flags;
+
   g_debug("GsmManager: Inhibitor added: %s", id);
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  inhibitor = (GsmInhibitor *)gsm_store_lookup(store, id);
+  flags = gsm_inhibitor_peek_flags(inhibitor);
+
+  /* A re-added id replaces the previous inhibitor */
+  if (g_hash_table_contains(priv->inhibitor_flags, id)) {
+    update_inhibited_counts(
+        manager,
+        GPOINTER_TO_UINT(g_hash_table_lookup(priv->inhibitor_flags, id)),
+        FALSE);
+  }
+
+  g_hash_table_replace(priv->inhibitor_flags, g_strdup(id),
+                       GUINT_TO_POINTER(flags));
+  update_inhibited_counts(manager, flags, TRUE);
+
+  watch_bus_name(manager, id, gsm_inhibitor_peek_bus_name(inhibitor));
+
   g_signal_emit(manager, signals[INHIBITOR_ADDED], 0, id);
-  update_idle(manager);
+  queue_change(manager, &priv->inhibitor_changes, id, TRUE);
 }
 
 static void on_store_inhibitor_removed(GsmStore *store, const char *id,
                                        GsmManager *manager) {
+  GsmManagerPrivate *priv;
+  gpointer flags;
+
   g_debug("GsmManager: Inhibitor removed: %s", id);
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  if (g_hash_table_lookup_extended(priv->inhibitor_flags, id, NULL, &flags)) {
+    update_inhibited_counts(manager, GPOINTER_TO_UINT(flags), FALSE);
+    g_hash_table_remove(priv->inhibitor_flags, id);
+  }
+
+  unwatch_bus_name(manager, id);
+  g_hash_table_remove(priv->inhibit_fds, id);
+  cancel_inhibitor_expiry(manager, id);
+
   g_signal_emit(manager, signals[INHIBITOR_REMOVED], 0, id);
-  update_idle(manager);
+  queue_change(manager, &priv->inhibitor_changes, id, FALSE);
 }
 
 static void gsm_manager_dispose(GObject *object) {
@@ -2266,6 +3894,9 @@ static void gsm_manager_dispose(GObject *object) {
 
   priv = gsm_manager_get_instance_private(manager);
 
+  gsm_metrics_remove_gauges(manager);
+  gsm_resource_monitor_stop();
+
   if (priv->clients != NULL) {
     g_signal_handlers_disconnect_by_func(priv->clients, on_store_client_added,
                                          manager);
@@ -2275,11 +3906,78 @@ static void gsm_manager_dispose(GObject *object) {
     priv->clients = NULL;
   }
 
+  if (priv->startup_graph != NULL) {
+    gsm_startup_graph_free(priv->startup_graph);
+    priv->startup_graph = NULL;
+  }
+
+  if (priv->launching_apps != NULL) {
+    g_hash_table_destroy(priv->launching_apps);
+    priv->launching_apps = NULL;
+  }
+
+  if (priv->delayed_start_id > 0) {
+    g_source_remove(priv->delayed_start_id);
+    priv->delayed_start_id = 0;
+  }
+
+  if (priv->save_timeout_id > 0) {
+    g_source_remove(priv->save_timeout_id);
+    priv->save_timeout_id = 0;
+  }
+
+  if (priv->restore_id > 0) {
+    g_source_remove(priv->restore_id);
+    priv->restore_id = 0;
+  }
+
+  if (priv->restore_queue != NULL) {
+    g_queue_free_full(priv->restore_queue, g_object_unref);
+    priv->restore_queue = NULL;
+  }
+
+  if (priv->checkpoint_id > 0) {
+    g_source_remove(priv->checkpoint_id);
+    priv->checkpoint_id = 0;
+  }
+
+  if (priv->logout_budget_id > 0) {
+    g_source_remove(priv->logout_budget_id);
+    priv->logout_budget_id = 0;
+  }
+
+  if (priv->delayed_starts != NULL) {
+    g_queue_free_full(priv->delayed_starts, (GDestroyNotify)delayed_start_free);
+    priv->delayed_starts = NULL;
+  }
+
+  if (priv->pending_apps != NULL) {
+    gsm_ordered_set_free(priv->pending_apps);
+    priv->pending_apps = NULL;
+  }
+
+  if (priv->query_clients != NULL) {
+    gsm_ordered_set_free(priv->query_clients);
+    priv->query_clients = NULL;
+  }
+
+  if (priv->query_responses != NULL) {
+    g_hash_table_destroy(priv->query_responses);
+    priv->query_responses = NULL;
+  }
+
+  if (priv->next_query_clients != NULL) {
+    gsm_ordered_set_free(priv->next_query_clients);
+    priv->next_query_clients = NULL;
+  }
+
   if (priv->apps != NULL) {
     g_object_unref(priv->apps);
     priv->apps = NULL;
   }
 
+  g_clear_object(&priv->condition_monitor);
+
   if (priv->inhibitors != NULL) {
     g_signal_handlers_disconnect_by_func(priv->inhibitors,
                                          on_store_inhibitor_added, manager);
@@ -2290,17 +3988,63 @@ static void gsm_manager_dispose(GObject *object) {
     priv->inhibitors = NULL;
   }
 
+  if (priv->inhibitor_flags != NULL) {
+    g_hash_table_destroy(priv->inhibitor_flags);
+    priv->inhibitor_flags = NULL;
+  }
+
+  if (priv->changed_signals_id > 0) {
+    g_source_remove(priv->changed_signals_id);
+    priv->changed_signals_id = 0;
+  }
+
+  change_batch_clear(&priv->client_changes);
+  change_batch_clear(&priv->inhibitor_changes);
+
+  if (priv->bus_names != NULL) {
+    g_hash_table_destroy(priv->bus_names);
+    priv->bus_names = NULL;
+  }
+
+  if (priv->watched_names != NULL) {
+    g_hash_table_destroy(priv->watched_names);
+    priv->watched_names = NULL;
+  }
+
+  if (priv->inhibit_fds != NULL) {
+    g_hash_table_destroy(priv->inhibit_fds);
+    priv->inhibit_fds = NULL;
+  }
+
+  if (priv->inhibitor_expiry_id > 0) {
+    g_source_remove(priv->inhibitor_expiry_id);
+    priv->inhibitor_expiry_id = 0;
+  }
+
+  if (priv->expiry_links != NULL) {
+    g_hash_table_destroy(priv->expiry_links);
+    priv->expiry_links = NULL;
+  }
+
+  if (priv->inhibitor_expiries != NULL) {
+    g_queue_free_full(priv->inhibitor_expiries,
+                      (GDestroyNotify)inhibitor_expiry_free);
+    priv->inhibitor_expiries = NULL;
+  }
+
   if (priv->presence != NULL) {
     g_object_unref(priv->presence);
     priv->presence = NULL;
   }
 
   if (priv->settings_session) {
+    g_signal_handlers_disconnect_by_data(priv->settings_session, manager);
     g_object_unref(priv->settings_session);
     priv->settings_session = NULL;
   }
 
   if (priv->settings_lockdown) {
+    g_signal_handlers_disconnect_by_data(priv->settings_lockdown, manager);
     g_object_unref(priv->settings_lockdown);
     priv->settings_lockdown = NULL;
   }
@@ -2341,6 +4085,11 @@ static void gsm_manager_class_init(GsmManagerClass *klass) {
       "client-removed", G_TYPE_FROM_CLASS(object_class), G_SIGNAL_RUN_LAST,
       G_STRUCT_OFFSET(GsmManagerClass, client_removed), NULL, NULL,
       g_cclosure_marshal_VOID__BOXED, G_TYPE_NONE, 1, DBUS_TYPE_G_OBJECT_PATH);
+  signals[CLIENTS_CHANGED] = g_signal_new(
+      "clients-changed", G_TYPE_FROM_CLASS(object_class), G_SIGNAL_RUN_LAST,
+      G_STRUCT_OFFSET(GsmManagerClass, clients_changed), NULL, NULL,
+      gsm_marshal_VOID__BOXED_BOXED, G_TYPE_NONE, 2,
+      GSM_MANAGER_OBJECT_PATH_ARRAY_TYPE, GSM_MANAGER_OBJECT_PATH_ARRAY_TYPE);
   signals[INHIBITOR_ADDED] = g_signal_new(
       "inhibitor-added", G_TYPE_FROM_CLASS(object_class), G_SIGNAL_RUN_LAST,
       G_STRUCT_OFFSET(GsmManagerClass, inhibitor_added), NULL, NULL,
@@ -2349,6 +4098,15 @@ static void gsm_manager_class_init(GsmManagerClass *klass) {
       "inhibitor-removed", G_TYPE_FROM_CLASS(object_class), G_SIGNAL_RUN_LAST,
       G_STRUCT_OFFSET(GsmManagerClass, inhibitor_removed), NULL, NULL,
       g_cclosure_marshal_VOID__BOXED, G_TYPE_NONE, 1, DBUS_TYPE_G_OBJECT_PATH);
+  signals[INHIBITORS_CHANGED] = g_signal_new(
+      "inhibitors-changed", G_TYPE_FROM_CLASS(object_class), G_SIGNAL_RUN_LAST,
+      G_STRUCT_OFFSET(GsmManagerClass, inhibitors_changed), NULL, NULL,
+      gsm_marshal_VOID__BOXED_BOXED, G_TYPE_NONE, 2,
+      GSM_MANAGER_OBJECT_PATH_ARRAY_TYPE, GSM_MANAGER_OBJECT_PATH_ARRAY_TYPE);
+  signals[INHIBITED_CHANGED] = g_signal_new(
+      "inhibited-changed", G_TYPE_FROM_CLASS(object_class), G_SIGNAL_RUN_LAST,
+      G_STRUCT_OFFSET(GsmManagerClass, inhibited_changed), NULL, NULL,
+      g_cclosure_marshal_VOID__UINT, G_TYPE_NONE, 1, G_TYPE_UINT);
 
   g_object_class_install_property(
       object_class, PROP_FAILSAFE,
@@ -2373,8 +4131,10 @@ static void load_idle_delay_from_gsettings(GsmManager *manager) {
   GsmManagerPrivate *priv;
 
   priv = gsm_manager_get_instance_private(manager);
-  value = g_settings_get_int(priv->settings_session, KEY_IDLE_DELAY);
+  value = gsm_settings_get_int(GSM_SETTINGS_SESSION, KEY_IDLE_DELAY);
   gsm_presence_set_idle_timeout(priv->presence, value * 60000);
+  value = gsm_settings_get_int(GSM_SETTINGS_SESSION, KEY_IDLE_DEBOUNCE);
+  gsm_presence_set_idle_debounce(priv->presence, value);
 }
 
 static void on_gsettings_key_changed(GSettings *settings, gchar *key,
@@ -2384,8 +4144,14 @@ static void on_gsettings_key_changed(GSettings *settings, gchar *key,
   priv = gsm_manager_get_instance_private(manager);
   if (g_strcmp0(key, KEY_IDLE_DELAY) == 0) {
     int delay;
-    delay = g_settings_get_int(settings, key);
+    delay = gsm_settings_get_int(GSM_SETTINGS_SESSION, key);
     gsm_presence_set_idle_timeout(priv->presence, delay * 60000);
+  } else if (g_strcmp0(key, KEY_IDLE_DEBOUNCE) == 0) {
+    gsm_presence_set_idle_debounce(
+        priv->presence, gsm_settings_get_int(GSM_SETTINGS_SESSION, key));
+  } else if (g_strcmp0(key, KEY_CHECKPOINT_INTERVAL) == 0 ||
+             g_strcmp0(key, KEY_AUTOSAVE) == 0) {
+    schedule_checkpoint(manager);
   } else if (g_strcmp0(key, KEY_LOCK_DISABLE) == 0) {
     /* ??? */
     gboolean UNUSED_VARIABLE disabled;
@@ -2401,10 +4167,14 @@ static void on_gsettings_key_changed(GSettings *settings, gchar *key,
 
 static void on_presence_status_changed(GsmPresence *presence, guint status,
                                        GsmManager *manager) {
+  gsm_resource_monitor_set_idle(status == GSM_PRESENCE_STATUS_IDLE);
+
 #ifdef HAVE_SYSTEMD
   if (LOGIND_RUNNING()) {
     GsmSystemd *systemd;
 
+    /* logind does not derive the idle hint of graphical sessions, so it is
+     * always set; repeated values are dropped by GsmSystemd */
     systemd = gsm_get_systemd();
     gsm_systemd_set_session_idle(systemd, (status == GSM_PRESENCE_STATUS_IDLE));
   } else {
@@ -2419,23 +4189,134 @@ static void on_presence_status_changed(GsmPresence *presence, guint status,
 #endif
 }
 
+static guint get_n_clients(GsmManager *manager) {
+  GsmManagerPrivate *priv;
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  return priv->clients != NULL ? gsm_store_size(priv->clients) : 0;
+}
+
+static guint get_n_inhibitors(GsmManager *manager) {
+  GsmManagerPrivate *priv;
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  return priv->inhibitors != NULL ? gsm_store_size(priv->inhibitors) : 0;
+}
+
+static guint get_n_apps(GsmManager *manager) {
+  GsmManagerPrivate *priv;
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  return priv->apps != NULL ? gsm_store_size(priv->apps) : 0;
+}
+
+static guint get_n_pending_apps(GsmManager *manager) {
+  GsmManagerPrivate *priv;
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  return priv->pending_apps != NULL ? gsm_ordered_set_size(priv->pending_apps)
+                                    : 0;
+}
+
+static guint get_n_launching_apps(GsmManager *manager) {
+  GsmManagerPrivate *priv;
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  return priv->launching_apps != NULL
+             ? g_hash_table_size(priv->launching_apps)
+             : 0;
+}
+
+static guint get_n_activations_in_flight(GsmManager *manager) {
+  return gsm_activation_pipeline_get_n_in_flight();
+}
+
+static guint get_n_activations_queued(GsmManager *manager) {
+  return gsm_activation_pipeline_get_n_queued();
+}
+
+static void add_metrics_gauges(GsmManager *manager) {
+  gsm_metrics_add_gauge("clients", "Number of registered clients",
+                        (GsmMetricsGaugeFunc)get_n_clients, manager);
+  gsm_metrics_add_gauge("inhibitors", "Number of inhibitors",
+                        (GsmMetricsGaugeFunc)get_n_inhibitors, manager);
+  gsm_metrics_add_gauge("apps", "Number of known apps",
+                        (GsmMetricsGaugeFunc)get_n_apps, manager);
+  gsm_metrics_add_gauge("pending_apps",
+                        "Apps the current startup phase waits for",
+                        (GsmMetricsGaugeFunc)get_n_pending_apps, manager);
+  gsm_metrics_add_gauge("launching_apps",
+                        "Apps started that did not register or exit yet",
+                        (GsmMetricsGaugeFunc)get_n_launching_apps, manager);
+  gsm_metrics_add_gauge("activations_in_flight",
+                        "D-Bus activations waiting for a reply",
+                        (GsmMetricsGaugeFunc)get_n_activations_in_flight,
+                        manager);
+  gsm_metrics_add_gauge("activations_queued",
+                        "D-Bus activations waiting to be sent",
+                        (GsmMetricsGaugeFunc)get_n_activations_queued,
+                        manager);
+}
+
 static void gsm_manager_init(GsmManager *manager) {
   GsmManagerPrivate *priv;
 
   priv = gsm_manager_get_instance_private(manager);
 
-  priv->settings_session = g_settings_new(SESSION_SCHEMA);
-  priv->settings_lockdown = g_settings_new(LOCKDOWN_SCHEMA);
+  priv->settings_session = g_object_ref(gsm_settings_get(GSM_SETTINGS_SESSION));
+  priv->settings_lockdown =
+      g_object_ref(gsm_settings_get(GSM_SETTINGS_LOCKDOWN));
 
   priv->inhibitors = gsm_store_new();
+  priv->inhibitor_flags =
+      g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  change_batch_init(&priv->client_changes);
+  change_batch_init(&priv->inhibitor_changes);
+  priv->bus_names =
+      g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  priv->watched_names =
+      g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  priv->inhibit_fds = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                            (GDestroyNotify)inhibit_fd_free);
+  priv->inhibitor_expiries = g_queue_new();
+  priv->expiry_links =
+      g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  priv->launching_apps = g_hash_table_new_full(
+      NULL, NULL, NULL, (GDestroyNotify)launching_app_free);
+  priv->delayed_starts = g_queue_new();
+  priv->restore_queue = g_queue_new();
+  priv->pending_apps = gsm_ordered_set_new();
+  priv->query_clients = gsm_ordered_set_new();
+  priv->query_responses = g_hash_table_new_full(
+      g_str_hash, g_str_equal, g_free, (GDestroyNotify)query_response_free);
+  priv->next_query_clients = gsm_ordered_set_new();
+  gsm_store_add_index(priv->inhibitors, INDEX_COOKIE, NULL,
+                      (GsmStoreIndexFunc)inhibitor_cookie_key);
+  gsm_store_add_index(priv->inhibitors, INDEX_BUS_NAME, NULL,
+                      (GsmStoreIndexFunc)inhibitor_bus_name_key);
+  gsm_store_add_index(priv->inhibitors, INDEX_CLIENT_ID, NULL,
+                      (GsmStoreIndexFunc)inhibitor_client_id_key);
   g_signal_connect(priv->inhibitors, "added",
                    G_CALLBACK(on_store_inhibitor_added), manager);
   g_signal_connect(priv->inhibitors, "removed",
                    G_CALLBACK(on_store_inhibitor_removed), manager);
 
   priv->apps = gsm_store_new();
+  priv->condition_monitor = gsm_condition_monitor_new();
+  gsm_store_add_index(priv->apps, INDEX_STARTUP_ID, "startup-id",
+                      (GsmStoreIndexFunc)app_startup_id_key);
+  gsm_store_add_index(priv->apps, INDEX_APP_ID, NULL,
+                      (GsmStoreIndexFunc)app_app_id_key);
+  gsm_store_add_index(priv->apps, INDEX_PROVIDES, NULL,
+                      (GsmStoreIndexFunc)app_provides_keys);
 
   priv->presence = gsm_presence_new();
+  gsm_switch_user_init();
   g_signal_connect(priv->presence, "status-changed",
                    G_CALLBACK(on_presence_status_changed), manager);
   g_signal_connect(priv->settings_session, "changed",
@@ -2444,6 +4325,8 @@ static void gsm_manager_init(GsmManager *manager) {
                    G_CALLBACK(on_gsettings_key_changed), manager);
 
   load_idle_delay_from_gsettings(manager);
+
+  add_metrics_gauges(manager);
 }
 
 static void gsm_manager_finalize(GObject *object) {
@@ -2522,41 +4405,11 @@ gboolean gsm_manager_initialization_error(GsmManager *manager,
 }
 
 static gboolean gsm_manager_is_switch_user_inhibited(GsmManager *manager) {
-  GsmInhibitor *inhibitor;
-  GsmManagerPrivate *priv;
-
-  priv = gsm_manager_get_instance_private(manager);
-
-  if (priv->inhibitors == NULL) {
-    return FALSE;
-  }
-
-  inhibitor = (GsmInhibitor *)gsm_store_find(
-      priv->inhibitors, (GsmStoreFunc)inhibitor_has_flag,
-      GUINT_TO_POINTER(GSM_INHIBITOR_FLAG_SWITCH_USER));
-  if (inhibitor == NULL) {
-    return FALSE;
-  }
-  return TRUE;
+  return is_inhibited_for_flags(manager, GSM_INHIBITOR_FLAG_SWITCH_USER);
 }
 
 static gboolean gsm_manager_is_suspend_inhibited(GsmManager *manager) {
-  GsmInhibitor *inhibitor;
-  GsmManagerPrivate *priv;
-
-  priv = gsm_manager_get_instance_private(manager);
-
-  if (priv->inhibitors == NULL) {
-    return FALSE;
-  }
-
-  inhibitor = (GsmInhibitor *)gsm_store_find(
-      priv->inhibitors, (GsmStoreFunc)inhibitor_has_flag,
-      GUINT_TO_POINTER(GSM_INHIBITOR_FLAG_SUSPEND));
-  if (inhibitor == NULL) {
-    return FALSE;
-  }
-  return TRUE;
+  return is_inhibited_for_flags(manager, GSM_INHIBITOR_FLAG_SUSPEND);
 }
 
 static void request_reboot_privileges_completed_consolekit(
@@ -2792,8 +4645,6 @@ static void request_shutdown(GsmManager *manager) {
 }
 
 static void request_suspend(GsmManager *manager) {
-  GsmManagerPrivate *priv;
-
   g_debug("GsmManager: requesting suspend");
 
   if (!gsm_manager_is_suspend_inhibited(manager)) {
@@ -2801,24 +4652,10 @@ static void request_suspend(GsmManager *manager) {
     return;
   }
 
-  priv = gsm_manager_get_instance_private(manager);
-  if (priv->inhibit_dialog != NULL) {
-    g_debug("GsmManager: inhibit dialog already up");
-    gtk_window_present(GTK_WINDOW(priv->inhibit_dialog));
-    return;
-  }
-
-  priv->inhibit_dialog = gsm_inhibit_dialog_new(priv->inhibitors, priv->clients,
-                                                GSM_LOGOUT_ACTION_SLEEP);
-
-  g_signal_connect(priv->inhibit_dialog, "response",
-                   G_CALLBACK(inhibit_dialog_response), manager);
-  gtk_widget_show(priv->inhibit_dialog);
+  show_inhibit_dialog(manager, GSM_LOGOUT_ACTION_SLEEP);
 }
 
 static void request_hibernate(GsmManager *manager) {
-  GsmManagerPrivate *priv;
-
   g_debug("GsmManager: requesting hibernate");
 
   /* hibernate uses suspend inhibit */
@@ -2827,19 +4664,7 @@ static void request_hibernate(GsmManager *manager) {
     return;
   }
 
-  priv = gsm_manager_get_instance_private(manager);
-  if (priv->inhibit_dialog != NULL) {
-    g_debug("GsmManager: inhibit dialog already up");
-    gtk_window_present(GTK_WINDOW(priv->inhibit_dialog));
-    return;
-  }
-
-  priv->inhibit_dialog = gsm_inhibit_dialog_new(priv->inhibitors, priv->clients,
-                                                GSM_LOGOUT_ACTION_HIBERNATE);
-
-  g_signal_connect(priv->inhibit_dialog, "response",
-                   G_CALLBACK(inhibit_dialog_response), manager);
-  gtk_widget_show(priv->inhibit_dialog);
+  show_inhibit_dialog(manager, GSM_LOGOUT_ACTION_HIBERNATE);
 }
 
 static void request_logout(GsmManager *manager, GsmManagerLogoutMode mode) {
@@ -2856,8 +4681,6 @@ static void request_logout(GsmManager *manager, GsmManagerLogoutMode mode) {
 }
 
 static void request_switch_user(GsmManager *manager) {
-  GsmManagerPrivate *priv;
-
   g_debug("GsmManager: requesting user switch");
 
   /* See comment in manager_switch_user() to understand why we do this in
@@ -2867,24 +4690,17 @@ static void request_switch_user(GsmManager *manager) {
     return;
   }
 
-  if (!gsm_manager_is_switch_user_inhibited(manager)) {
-    manager_switch_user(manager);
+  if (!gsm_switch_user_is_available()) {
+    g_warning("Unable to switch user: No display manager to switch with");
     return;
   }
 
-  priv = gsm_manager_get_instance_private(manager);
-  if (priv->inhibit_dialog != NULL) {
-    g_debug("GsmManager: inhibit dialog already up");
-    gtk_window_present(GTK_WINDOW(priv->inhibit_dialog));
+  if (!gsm_manager_is_switch_user_inhibited(manager)) {
+    manager_switch_user(manager);
     return;
   }
 
-  priv->inhibit_dialog = gsm_inhibit_dialog_new(priv->inhibitors, priv->clients,
-                                                GSM_LOGOUT_ACTION_SWITCH_USER);
-
-  g_signal_connect(priv->inhibit_dialog, "response",
-                   G_CALLBACK(inhibit_dialog_response), manager);
-  gtk_widget_show(priv->inhibit_dialog);
+  show_inhibit_dialog(manager, GSM_LOGOUT_ACTION_SWITCH_USER);
 }
 
 static void logout_dialog_response(GsmLogoutDialog *logout_dialog,
@@ -2952,8 +4768,13 @@ static void show_shutdown_dialog(GsmManager *manager) {
 
   priv->logout_mode = GSM_MANAGER_LOGOUT_MODE_NORMAL;
 
-  dialog = gsm_get_shutdown_dialog(gdk_screen_get_default(),
-                                   gtk_get_current_event_time());
+  dialog = gsm_dialogs_get_shutdown_dialog(gdk_screen_get_default(),
+                                           gtk_get_current_event_time());
+  if (dialog == NULL) {
+    g_warning("Unable to show the shutdown dialog, shutting down without it");
+    request_shutdown(manager);
+    return;
+  }
 
   g_signal_connect(dialog, "response", G_CALLBACK(logout_dialog_response),
                    manager);
@@ -2975,8 +4796,13 @@ static void show_logout_dialog(GsmManager *manager) {
 
   priv->logout_mode = GSM_MANAGER_LOGOUT_MODE_NORMAL;
 
-  dialog = gsm_get_logout_dialog(gdk_screen_get_default(),
-                                 gtk_get_current_event_time());
+  dialog = gsm_dialogs_get_logout_dialog(gdk_screen_get_default(),
+                                         gtk_get_current_event_time());
+  if (dialog == NULL) {
+    g_warning("Unable to show the logout dialog, logging out without it");
+    request_logout(manager, GSM_MANAGER_LOGOUT_MODE_NORMAL);
+    return;
+  }
 
   g_signal_connect(dialog, "response", G_CALLBACK(logout_dialog_response),
                    manager);
@@ -2998,7 +4824,7 @@ static void user_logout(GsmManager *manager, GsmManagerLogoutMode mode) {
   }
 
   logout_prompt =
-      g_settings_get_boolean(priv->settings_session, "logout-prompt");
+      gsm_settings_get_boolean(GSM_SETTINGS_SESSION, "logout-prompt");
 
   /* If the shell isn't running, and this isn't a non-interative logout request,
    * and the user has their settings configured to show a confirmation dialog
@@ -3068,19 +4894,12 @@ gboolean gsm_manager_request_reboot(GsmManager *manager, GError **error) {
 }
 
 static gboolean _log_out_is_locked_down(GsmManager *manager) {
-  GsmManagerPrivate *priv;
-
-  priv = gsm_manager_get_instance_private(manager);
-
-  return g_settings_get_boolean(priv->settings_lockdown, KEY_LOG_OUT_DISABLE);
+  return gsm_settings_get_boolean(GSM_SETTINGS_LOCKDOWN, KEY_LOG_OUT_DISABLE);
 }
 
 static gboolean _switch_user_is_locked_down(GsmManager *manager) {
-  GsmManagerPrivate *priv;
-
-  priv = gsm_manager_get_instance_private(manager);
-  return g_settings_get_boolean(priv->settings_lockdown,
-                                KEY_USER_SWITCH_DISABLE);
+  return gsm_settings_get_boolean(GSM_SETTINGS_LOCKDOWN,
+                                  KEY_USER_SWITCH_DISABLE);
 }
 
 gboolean gsm_manager_shutdown(GsmManager *manager, GError **error) {
@@ -3145,6 +4964,7 @@ gboolean gsm_manager_can_shutdown(GsmManager *manager,
 gboolean gsm_manager_logout(GsmManager *manager, guint logout_mode,
                             GError **error) {
   GsmManagerPrivate *priv;
+  gboolean fast;
   g_debug("GsmManager: Logout called");
 
   g_return_val_if_fail(GSM_IS_MANAGER(manager), FALSE);
@@ -3163,11 +4983,29 @@ gboolean gsm_manager_logout(GsmManager *manager, guint logout_mode,
     return FALSE;
   }
 
+  fast = (logout_mode & GSM_MANAGER_LOGOUT_FLAG_FAST) != 0;
+  logout_mode &= ~GSM_MANAGER_LOGOUT_FLAG_FAST;
+
   switch (logout_mode) {
     case GSM_MANAGER_LOGOUT_MODE_NORMAL:
     case GSM_MANAGER_LOGOUT_MODE_NO_CONFIRMATION:
     case GSM_MANAGER_LOGOUT_MODE_FORCE:
-      user_logout(manager, logout_mode);
+      if (fast) {
+        priv->logout_budget = (gint64)gsm_settings_get_int(
+                                  GSM_SETTINGS_SESSION, KEY_LOGOUT_BUDGET) *
+                              G_USEC_PER_SEC;
+        if (priv->logout_budget == 0) {
+          priv->logout_budget =
+              GSM_MANAGER_FAST_LOGOUT_BUDGET * G_USEC_PER_SEC;
+        }
+        /* a fast logout never asks for confirmation */
+        request_logout(manager,
+                       logout_mode == GSM_MANAGER_LOGOUT_MODE_NORMAL
+                           ? GSM_MANAGER_LOGOUT_MODE_NO_CONFIRMATION
+                           : logout_mode);
+      } else {
+        user_logout(manager, logout_mode);
+      }
       break;
 
     default:
@@ -3189,9 +5027,11 @@ gboolean gsm_manager_register_client(GsmManager *manager, const char *app_id,
   GsmClient *client;
   GsmApp *app;
   GsmManagerPrivate *priv;
+  gint64 start;
 
   g_return_val_if_fail(GSM_IS_MANAGER(manager), FALSE);
 
+  start = g_get_monotonic_time();
   app = NULL;
   client = NULL;
 
@@ -3213,9 +5053,7 @@ gboolean gsm_manager_register_client(GsmManager *manager, const char *app_id,
   if (IS_STRING_EMPTY(startup_id)) {
     new_startup_id = gsm_util_generate_startup_id();
   } else {
-    client = (GsmClient *)gsm_store_find(priv->clients,
-                                         (GsmStoreFunc)_client_has_startup_id,
-                                         (char *)startup_id);
+    client = find_client_for_startup_id(manager, startup_id);
     /* We can't have two clients with the same startup id. */
     if (client != NULL) {
       GError *new_error;
@@ -3278,6 +5116,9 @@ gboolean gsm_manager_register_client(GsmManager *manager, const char *app_id,
 
   dbus_g_method_return(context, gsm_client_peek_id(client));
 
+  gsm_metrics_observe(GSM_METRIC_REGISTER_CLIENT_LATENCY,
+                      g_get_monotonic_time() - start);
+
   return TRUE;
 }
 
@@ -3305,82 +5146,225 @@ gboolean gsm_manager_unregister_client(GsmManager *manager,
     return FALSE;
   }
 
-  /* don't disconnect client here, only change the status.
-     Wait until it leaves the bus before disconnecting it */
-  gsm_client_set_status(client, GSM_CLIENT_UNREGISTERED);
+  /* don't disconnect client here, only change the status.
+     Wait until it leaves the bus before disconnecting it */
+  gsm_client_set_status(client, GSM_CLIENT_UNREGISTERED);
+
+  dbus_g_method_return(context);
+
+  return TRUE;
+}
+
+/* Validates the arguments of Inhibit, InhibitWithTimeout and InhibitFd and
+ * adds the inhibitor, which expires after timeout seconds unless that is 0;
+ * returns its cookie, or 0 */
+static guint add_inhibitor(GsmManager *manager, const char *app_id,
+                           guint toplevel_xid, const char *reason, guint flags,
+                           guint timeout, const char *bus_name,
+                           GError **error) {
+  GsmInhibitor *inhibitor;
+  guint cookie;
+  GsmManagerPrivate *priv;
+
+  priv = gsm_manager_get_instance_private(manager);
+  if (priv->logout_mode == GSM_MANAGER_LOGOUT_MODE_FORCE) {
+    g_set_error(error, GSM_MANAGER_ERROR, GSM_MANAGER_ERROR_GENERAL,
+                "Forced logout cannot be inhibited");
+    return 0;
+  }
+
+  if (IS_STRING_EMPTY(app_id)) {
+    g_set_error(error, GSM_MANAGER_ERROR, GSM_MANAGER_ERROR_GENERAL,
+                "Application ID not specified");
+    return 0;
+  }
+
+  if (IS_STRING_EMPTY(reason)) {
+    g_set_error(error, GSM_MANAGER_ERROR, GSM_MANAGER_ERROR_GENERAL,
+                "Reason not specified");
+    return 0;
+  }
+
+  if (flags == 0) {
+    g_set_error(error, GSM_MANAGER_ERROR, GSM_MANAGER_ERROR_GENERAL,
+                "Invalid inhibit flags");
+    return 0;
+  }
+
+  cookie = _generate_unique_cookie(manager);
+  inhibitor = gsm_inhibitor_new(app_id, toplevel_xid, flags, reason, bus_name,
+                                cookie);
+  gsm_store_add(priv->inhibitors, gsm_inhibitor_peek_id(inhibitor),
+                G_OBJECT(inhibitor));
+  if (timeout > 0) {
+    queue_inhibitor_expiry(manager, gsm_inhibitor_peek_id(inhibitor), timeout);
+  }
+  g_object_unref(inhibitor);
+
+  return cookie;
+}
+
+gboolean gsm_manager_inhibit(GsmManager *manager, const char *app_id,
+                             guint toplevel_xid, const char *reason,
+                             guint flags, DBusGMethodInvocation *context) {
+  return gsm_manager_inhibit_with_timeout(manager, app_id, toplevel_xid,
+                                          reason, flags, 0, context);
+}
+
+gboolean gsm_manager_inhibit_with_timeout(GsmManager *manager,
+                                          const char *app_id,
+                                          guint toplevel_xid,
+                                          const char *reason, guint flags,
+                                          guint timeout,
+                                          DBusGMethodInvocation *context) {
+  GError *error;
+  guint cookie;
+  gint64 start;
+
+  g_return_val_if_fail(GSM_IS_MANAGER(manager), FALSE);
+
+  start = g_get_monotonic_time();
+
+  g_debug(
+      "GsmManager: Inhibit xid=%u app_id=%s reason=%s flags=%u timeout=%u",
+      toplevel_xid, app_id, reason, flags, timeout);
+
+  error = NULL;
+  cookie = add_inhibitor(manager, app_id, toplevel_xid, reason, flags, timeout,
+                         dbus_g_method_get_sender(context), &error);
+  if (cookie == 0) {
+    g_debug("GsmManager: Unable to inhibit: %s", error->message);
+    dbus_g_method_return_error(context, error);
+    g_error_free(error);
+    return FALSE;
+  }
+
+  dbus_g_method_return(context, cookie);
 
-  dbus_g_method_return(context);
+  gsm_metrics_observe(GSM_METRIC_INHIBIT_LATENCY,
+                      g_get_monotonic_time() - start);
 
   return TRUE;
 }
 
-gboolean gsm_manager_inhibit(GsmManager *manager, const char *app_id,
-                             guint toplevel_xid, const char *reason,
-                             guint flags, DBusGMethodInvocation *context) {
-  GsmInhibitor *inhibitor;
-  guint cookie;
+static void inhibit_fd_free(InhibitFd *data) {
+  if (data->watch_id > 0) {
+    g_source_remove(data->watch_id);
+  }
+  close(data->fd);
+  g_slice_free(InhibitFd, data);
+}
+
+static gboolean on_inhibit_fd_closed(int fd, GIOCondition condition,
+                                     GsmManager *manager) {
   GsmManagerPrivate *priv;
+  GHashTableIter iter;
+  gpointer key;
+  InhibitFd *data;
 
-  g_return_val_if_fail(GSM_IS_MANAGER(manager), FALSE);
+  priv = gsm_manager_get_instance_private(manager);
 
-  g_debug("GsmManager: Inhibit xid=%u app_id=%s reason=%s flags=%u",
-          toplevel_xid, app_id, reason, flags);
+  g_hash_table_iter_init(&iter, priv->inhibit_fds);
+  while (g_hash_table_iter_next(&iter, &key, (gpointer *)&data)) {
+    if (data->fd == fd) {
+      char *id;
 
-  priv = gsm_manager_get_instance_private(manager);
-  if (priv->logout_mode == GSM_MANAGER_LOGOUT_MODE_FORCE) {
-    GError *new_error;
+      /* the source goes away with us */
+      data->watch_id = 0;
 
-    new_error = g_error_new(GSM_MANAGER_ERROR, GSM_MANAGER_ERROR_GENERAL,
-                            "Forced logout cannot be inhibited");
-    g_debug("GsmManager: Unable to inhibit: %s", new_error->message);
-    dbus_g_method_return_error(context, new_error);
-    g_error_free(new_error);
-    return FALSE;
+      id = g_strdup(key);
+      g_debug("GsmManager: inhibitor %s: file descriptor closed", id);
+      gsm_store_remove(priv->inhibitors, id);
+      g_free(id);
+      break;
+    }
   }
 
-  if (IS_STRING_EMPTY(app_id)) {
-    GError *new_error;
+  return FALSE;
+}
 
-    new_error = g_error_new(GSM_MANAGER_ERROR, GSM_MANAGER_ERROR_GENERAL,
-                            "Application ID not specified");
-    g_debug("GsmManager: Unable to inhibit: %s", new_error->message);
-    dbus_g_method_return_error(context, new_error);
-    g_error_free(new_error);
-    return FALSE;
+/* InhibitFd(s app_id, u toplevel_xid, s reason, u flags) -> (h fd, u cookie)
+ *
+ * Like Inhibit, but the inhibitor is tied to the returned file descriptor
+ * instead of the caller's bus name: it goes away once every copy of the
+ * descriptor is closed, or with Uninhibit. */
+static void handle_inhibit_fd(GsmManager *manager, DBusConnection *connection,
+                              DBusMessage *message) {
+  GsmManagerPrivate *priv;
+  DBusMessage *reply;
+  DBusError dbus_error;
+  const char *app_id;
+  const char *reason;
+  dbus_uint32_t toplevel_xid;
+  dbus_uint32_t flags;
+  dbus_uint32_t cookie;
+  GsmInhibitor *inhibitor;
+  InhibitFd *data;
+  GError *error;
+  int fds[2];
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  dbus_error_init(&dbus_error);
+  if (!dbus_message_get_args(message, &dbus_error, DBUS_TYPE_STRING, &app_id,
+                             DBUS_TYPE_UINT32, &toplevel_xid, DBUS_TYPE_STRING,
+                             &reason, DBUS_TYPE_UINT32, &flags,
+                             DBUS_TYPE_INVALID)) {
+    reply = dbus_message_new_error(message, DBUS_ERROR_INVALID_ARGS,
+                                   dbus_error.message);
+    dbus_error_free(&dbus_error);
+    goto out;
   }
 
-  if (IS_STRING_EMPTY(reason)) {
-    GError *new_error;
+  g_debug("GsmManager: InhibitFd xid=%u app_id=%s reason=%s flags=%u",
+          toplevel_xid, app_id, reason, flags);
 
-    new_error = g_error_new(GSM_MANAGER_ERROR, GSM_MANAGER_ERROR_GENERAL,
-                            "Reason not specified");
-    g_debug("GsmManager: Unable to inhibit: %s", new_error->message);
-    dbus_g_method_return_error(context, new_error);
-    g_error_free(new_error);
-    return FALSE;
+  if (!dbus_connection_can_send_type(connection, DBUS_TYPE_UNIX_FD)) {
+    reply = dbus_message_new_error(message, DBUS_ERROR_NOT_SUPPORTED,
+                                   "File descriptor passing not supported");
+    goto out;
   }
 
-  if (flags == 0) {
-    GError *new_error;
+  if (!g_unix_open_pipe(fds, FD_CLOEXEC, NULL)) {
+    reply = dbus_message_new_error(message, DBUS_ERROR_FAILED,
+                                   "Unable to create pipe");
+    goto out;
+  }
 
-    new_error = g_error_new(GSM_MANAGER_ERROR, GSM_MANAGER_ERROR_GENERAL,
-                            "Invalid inhibit flags");
-    g_debug("GsmManager: Unable to inhibit: %s", new_error->message);
-    dbus_g_method_return_error(context, new_error);
-    g_error_free(new_error);
-    return FALSE;
+  /* no bus name: the inhibitor outlives the caller's connection */
+  error = NULL;
+  cookie = add_inhibitor(manager, app_id, toplevel_xid, reason, flags, 0, NULL,
+                         &error);
+  if (cookie == 0) {
+    g_debug("GsmManager: Unable to inhibit: %s", error->message);
+    reply = dbus_message_new_error(message, DBUS_ERROR_FAILED, error->message);
+    g_error_free(error);
+    close(fds[0]);
+    close(fds[1]);
+    goto out;
   }
 
-  cookie = _generate_unique_cookie(manager);
-  inhibitor = gsm_inhibitor_new(app_id, toplevel_xid, flags, reason,
-                                dbus_g_method_get_sender(context), cookie);
-  gsm_store_add(priv->inhibitors, gsm_inhibitor_peek_id(inhibitor),
-                G_OBJECT(inhibitor));
-  g_object_unref(inhibitor);
+  inhibitor = find_inhibitor_for_cookie(manager, cookie);
 
-  dbus_g_method_return(context, cookie);
+  data = g_slice_new(InhibitFd);
+  data->fd = fds[0];
+  data->watch_id =
+      g_unix_fd_add(fds[0], G_IO_HUP | G_IO_ERR,
+                    (GUnixFDSourceFunc)on_inhibit_fd_closed, manager);
+  g_hash_table_replace(priv->inhibit_fds,
+                       g_strdup(gsm_inhibitor_peek_id(inhibitor)), data);
 
-  return TRUE;
+  reply = dbus_message_new_method_return(message);
+  dbus_message_append_args(reply, DBUS_TYPE_UNIX_FD, &fds[1],
+                           DBUS_TYPE_UINT32, &cookie, DBUS_TYPE_INVALID);
+  /* the message holds its own copy */
+  close(fds[1]);
+
+out:
+  if (reply != NULL) {
+    dbus_connection_send(connection, reply, NULL);
+    dbus_message_unref(reply);
+  }
 }
 
 gboolean gsm_manager_uninhibit(GsmManager *manager, guint cookie,
@@ -3393,8 +5377,7 @@ gboolean gsm_manager_uninhibit(GsmManager *manager, guint cookie,
   g_debug("GsmManager: Uninhibit %u", cookie);
 
   priv = gsm_manager_get_instance_private(manager);
-  inhibitor = (GsmInhibitor *)gsm_store_find(
-      priv->inhibitors, (GsmStoreFunc)_find_by_cookie, &cookie);
+  inhibitor = find_inhibitor_for_cookie(manager, cookie);
   if (inhibitor == NULL) {
     GError *new_error;
 
@@ -3422,25 +5405,28 @@ gboolean gsm_manager_uninhibit(GsmManager *manager, guint cookie,
 
 gboolean gsm_manager_is_inhibited(GsmManager *manager, guint flags,
                                   gboolean *is_inhibited, GError *error) {
-  GsmInhibitor *inhibitor;
+  gint64 start;
+
+  g_return_val_if_fail(GSM_IS_MANAGER(manager), FALSE);
+
+  start = g_get_monotonic_time();
+  *is_inhibited = is_inhibited_for_flags(manager, flags);
+  gsm_metrics_observe(GSM_METRIC_IS_INHIBITED_LATENCY,
+                      g_get_monotonic_time() - start);
+
+  return TRUE;
+}
+
+gboolean gsm_manager_get_inhibited_generation(GsmManager *manager,
+                                              guint *generation,
+                                              GError **error) {
   GsmManagerPrivate *priv;
 
   g_return_val_if_fail(GSM_IS_MANAGER(manager), FALSE);
 
   priv = gsm_manager_get_instance_private(manager);
-  if (priv->inhibitors == NULL || gsm_store_size(priv->inhibitors) == 0) {
-    *is_inhibited = FALSE;
-    return TRUE;
-  }
 
-  inhibitor = (GsmInhibitor *)gsm_store_find(priv->inhibitors,
-                                             (GsmStoreFunc)inhibitor_has_flag,
-                                             GUINT_TO_POINTER(flags));
-  if (inhibitor == NULL) {
-    *is_inhibited = FALSE;
-  } else {
-    *is_inhibited = TRUE;
-  }
+  *generation = priv->inhibited_generation;
 
   return TRUE;
 }
@@ -3485,6 +5471,168 @@ gboolean gsm_manager_get_inhibitors(GsmManager *manager, GPtrArray **inhibitors,
   return TRUE;
 }
 
+/* a(oa{sv}): the object path and the properties of each object */
+#define GSM_MANAGER_PROPERTY_MAP_TYPE \
+  (dbus_g_type_get_map("GHashTable", G_TYPE_STRING, G_TYPE_VALUE))
+#define GSM_MANAGER_OBJECT_PROPERTIES_TYPE                              \
+  (dbus_g_type_get_struct("GValueArray", DBUS_TYPE_G_OBJECT_PATH,       \
+                          GSM_MANAGER_PROPERTY_MAP_TYPE, G_TYPE_INVALID))
+
+static void property_value_free(GValue *value) {
+  g_value_unset(value);
+  g_slice_free(GValue, value);
+}
+
+static void add_string_property(GHashTable *properties, const char *name,
+                                const char *value) {
+  GValue *gvalue;
+
+  gvalue = g_slice_new0(GValue);
+  g_value_init(gvalue, G_TYPE_STRING);
+  g_value_set_string(gvalue, value != NULL ? value : "");
+  g_hash_table_insert(properties, g_strdup(name), gvalue);
+}
+
+static void add_uint_property(GHashTable *properties, const char *name,
+                              guint value) {
+  GValue *gvalue;
+
+  gvalue = g_slice_new0(GValue);
+  g_value_init(gvalue, G_TYPE_UINT);
+  g_value_set_uint(gvalue, value);
+  g_hash_table_insert(properties, g_strdup(name), gvalue);
+}
+
+static void add_uint64_property(GHashTable *properties, const char *name,
+                                guint64 value) {
+  GValue *gvalue;
+
+  gvalue = g_slice_new0(GValue);
+  g_value_init(gvalue, G_TYPE_UINT64);
+  g_value_set_uint64(gvalue, value);
+  g_hash_table_insert(properties, g_strdup(name), gvalue);
+}
+
+/* Takes ownership of @properties */
+static void add_object_properties(GPtrArray *array, const char *path,
+                                  GHashTable *properties) {
+  GValue entry = G_VALUE_INIT;
+
+  g_value_init(&entry, GSM_MANAGER_OBJECT_PROPERTIES_TYPE);
+  g_value_take_boxed(&entry, dbus_g_type_specialized_construct(
+                                 GSM_MANAGER_OBJECT_PROPERTIES_TYPE));
+  dbus_g_type_struct_set(&entry, 0, path, 1, properties, G_MAXUINT);
+  g_hash_table_unref(properties);
+
+  g_ptr_array_add(array, g_value_dup_boxed(&entry));
+  g_value_unset(&entry);
+}
+
+static GHashTable *property_map_new(void) {
+  return g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                               (GDestroyNotify)property_value_free);
+}
+
+typedef struct {
+  GsmManager *manager;
+  GPtrArray *array;
+} ListifyData;
+
+static gboolean listify_client_properties(char *id, GsmClient *client,
+                                          ListifyData *data) {
+  GHashTable *properties;
+  const char *app_id;
+  GsmApp *app = NULL;
+  guint64 cpu_usec;
+  guint64 rss_bytes;
+
+  properties = property_map_new();
+  add_string_property(properties, "app-id", gsm_client_peek_app_id(client));
+  add_string_property(properties, "startup-id",
+                      gsm_client_peek_startup_id(client));
+  add_uint_property(properties, "status", gsm_client_peek_status(client));
+  add_uint_property(properties, "restart-style-hint",
+                    gsm_client_peek_restart_style_hint(client));
+
+  if (gsm_resource_monitor_get_usage(id, &cpu_usec, &rss_bytes)) {
+    add_uint64_property(properties, "cpu-time", cpu_usec);
+    add_uint64_property(properties, "rss", rss_bytes);
+  }
+
+  app_id = gsm_client_peek_app_id(client);
+  if (!IS_STRING_EMPTY(app_id)) {
+    app = find_app_for_app_id(data->manager, app_id);
+  }
+  if (app != NULL && gsm_app_peek_startup_latency(app) > 0) {
+    add_uint64_property(properties, "startup-time",
+                        gsm_app_peek_startup_latency(app));
+  }
+
+  add_object_properties(data->array, id, properties);
+
+  return FALSE;
+}
+
+static gboolean listify_inhibitor_properties(char *id, GsmInhibitor *inhibitor,
+                                             GPtrArray *array) {
+  GHashTable *properties;
+
+  properties = property_map_new();
+  add_string_property(properties, "app-id",
+                      gsm_inhibitor_peek_app_id(inhibitor));
+  add_string_property(properties, "client-id",
+                      gsm_inhibitor_peek_client_id(inhibitor));
+  add_string_property(properties, "reason",
+                      gsm_inhibitor_peek_reason(inhibitor));
+  add_uint_property(properties, "flags", gsm_inhibitor_peek_flags(inhibitor));
+  add_uint_property(properties, "toplevel-xid",
+                    gsm_inhibitor_peek_toplevel_xid(inhibitor));
+
+  add_object_properties(array, id, properties);
+
+  return FALSE;
+}
+
+gboolean gsm_manager_get_clients_with_properties(GsmManager *manager,
+                                                 GPtrArray **clients,
+                                                 GError **error) {
+  GsmManagerPrivate *priv;
+  ListifyData data;
+
+  g_return_val_if_fail(GSM_IS_MANAGER(manager), FALSE);
+
+  if (clients == NULL) {
+    return FALSE;
+  }
+
+  data.manager = manager;
+  data.array = *clients = g_ptr_array_new();
+  priv = gsm_manager_get_instance_private(manager);
+  gsm_store_foreach(priv->clients, (GsmStoreFunc)listify_client_properties,
+                    &data);
+
+  return TRUE;
+}
+
+gboolean gsm_manager_get_inhibitors_with_properties(GsmManager *manager,
+                                                    GPtrArray **inhibitors,
+                                                    GError **error) {
+  GsmManagerPrivate *priv;
+
+  g_return_val_if_fail(GSM_IS_MANAGER(manager), FALSE);
+
+  if (inhibitors == NULL) {
+    return FALSE;
+  }
+
+  *inhibitors = g_ptr_array_new();
+  priv = gsm_manager_get_instance_private(manager);
+  gsm_store_foreach(priv->inhibitors,
+                    (GsmStoreFunc)listify_inhibitor_properties, *inhibitors);
+
+  return TRUE;
+}
+
 static gboolean _app_has_autostart_condition(const char *id, GsmApp *app,
                                              const char *condition) {
   gboolean has;
@@ -3553,6 +5701,46 @@ static void append_app(GsmManager *manager, GsmApp *app) {
   gsm_store_add(priv->apps, id, G_OBJECT(app));
 }
 
+static GsmApp *load_autostart_app(GsmManager *manager, const char *path) {
+  GsmManagerPrivate *priv;
+  struct stat st;
+  char *dirname;
+  char *basename;
+  GVariant *info;
+  GsmApp *app;
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  if (stat(path, &st) != 0) {
+    return gsm_autostart_app_new(path, priv->condition_monitor);
+  }
+
+  dirname = g_path_get_dirname(path);
+  basename = g_path_get_basename(path);
+
+  app = NULL;
+  info = gsm_autostart_cache_lookup(dirname, basename, &st);
+  if (info != NULL) {
+    app = gsm_autostart_app_new_from_cache(path, info,
+                                           priv->condition_monitor);
+    g_variant_unref(info);
+  }
+
+  if (app == NULL) {
+    app = gsm_autostart_app_new(path, priv->condition_monitor);
+    if (app != NULL) {
+      gsm_autostart_cache_insert(
+          dirname, basename, &st,
+          gsm_autostart_app_serialize(GSM_AUTOSTART_APP(app)));
+    }
+  }
+
+  g_free(basename);
+  g_free(dirname);
+
+  return app;
+}
+
 gboolean gsm_manager_add_autostart_app(GsmManager *manager, const char *path,
                                        const char *provides) {
   GsmApp *app;
@@ -3566,15 +5754,15 @@ gboolean gsm_manager_add_autostart_app(GsmManager *manager, const char *path,
   if (provides != NULL) {
     GsmApp *dup;
 
-    dup = (GsmApp *)gsm_store_find(priv->apps, (GsmStoreFunc)_find_app_provides,
-                                   (char *)provides);
+    dup = (GsmApp *)gsm_store_lookup_by_index(priv->apps, INDEX_PROVIDES,
+                                              provides);
     if (dup != NULL) {
       g_debug("GsmManager: service '%s' is already provided", provides);
       return FALSE;
     }
   }
 
-  app = gsm_autostart_app_new(path);
+  app = load_autostart_app(manager, path);
   if (app == NULL) {
     g_warning("could not read %s", path);
     return FALSE;
@@ -3589,32 +5777,169 @@ gboolean gsm_manager_add_autostart_app(GsmManager *manager, const char *path,
 
 gboolean gsm_manager_add_autostart_apps_from_dir(GsmManager *manager,
                                                  const char *path) {
-  GDir *dir;
-  const char *name;
+  struct stat dir_st;
+  char **names;
+  guint i;
 
   g_return_val_if_fail(GSM_IS_MANAGER(manager), FALSE);
   g_return_val_if_fail(path != NULL, FALSE);
 
   g_debug("GsmManager: *** Adding autostart apps for %s", path);
 
-  dir = g_dir_open(path, 0, NULL);
-  if (dir == NULL) {
+  if (stat(path, &dir_st) != 0 || !S_ISDIR(dir_st.st_mode)) {
     return FALSE;
   }
 
-  while ((name = g_dir_read_name(dir))) {
+  /* an unchanged directory does not need to be read again */
+  names = gsm_autostart_cache_list_dir(path, &dir_st);
+  if (names == NULL) {
+    GDir *dir;
+    const char *name;
+    GPtrArray *array;
+
+    dir = g_dir_open(path, 0, NULL);
+    if (dir == NULL) {
+      return FALSE;
+    }
+
+    array = g_ptr_array_new();
+    while ((name = g_dir_read_name(dir))) {
+      if (g_str_has_suffix(name, ".desktop")) {
+        g_ptr_array_add(array, g_strdup(name));
+      }
+    }
+    g_ptr_array_add(array, NULL);
+
+    g_dir_close(dir);
+
+    names = (char **)g_ptr_array_free(array, FALSE);
+  }
+
+  gsm_autostart_cache_begin_dir(path, &dir_st, names);
+
+  for (i = 0; names[i] != NULL; i++) {
     char *desktop_file;
 
-    if (!g_str_has_suffix(name, ".desktop")) {
-      continue;
+    desktop_file = g_build_filename(path, names[i], NULL);
+    gsm_manager_add_autostart_app(manager, desktop_file, NULL);
+    g_free(desktop_file);
+  }
+
+  g_strfreev(names);
+
+  return TRUE;
+}
+
+typedef struct {
+  const char *path;
+  GHashTable *priorities;
+} SavedPriorities;
+
+static gboolean _apply_saved_priority(const char *id, GsmApp *app,
+                                      SavedPriorities *data) {
+  char *desktop_file;
+  char *dirname;
+  char *basename;
+  gpointer priority;
+
+  if (!GSM_IS_AUTOSTART_APP(app)) {
+    return FALSE;
+  }
+
+  g_object_get(app, "desktop-filename", &desktop_file, NULL);
+  if (desktop_file == NULL) {
+    return FALSE;
+  }
+
+  dirname = g_path_get_dirname(desktop_file);
+  basename = g_path_get_basename(desktop_file);
+
+  if (strcmp(dirname, data->path) == 0 &&
+      g_hash_table_lookup_extended(data->priorities, basename, NULL,
+                                   &priority)) {
+    gsm_autostart_app_set_restore_priority(GSM_AUTOSTART_APP(app),
+                                           GPOINTER_TO_INT(priority));
+  }
+
+  g_free(basename);
+  g_free(dirname);
+  g_free(desktop_file);
+
+  return FALSE;
+}
+
+/* The saved files only hold the restore priority of the save that last
+ * wrote them; the priorities of the last save are kept apart */
+static void apply_saved_priorities(GsmManager *manager, const char *path) {
+  GsmManagerPrivate *priv;
+  SavedPriorities data;
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  data.path = path;
+  data.priorities = gsm_session_read_priorities(path);
+
+  if (g_hash_table_size(data.priorities) > 0) {
+    gsm_store_foreach(priv->apps, (GsmStoreFunc)_apply_saved_priority, &data);
+  }
+
+  g_hash_table_destroy(data.priorities);
+}
+
+/* Loads the saved session from its packed file if it is up to date,
+ * and from the directory of desktop files otherwise; the packed file is
+ * written again the next time the session is saved. */
+gboolean gsm_manager_add_saved_session_apps(GsmManager *manager,
+                                            const char *path) {
+  GsmManagerPrivate *priv;
+  GVariant *entries;
+  GVariantIter iter;
+  const char *name;
+  GVariant *info;
+
+  g_return_val_if_fail(GSM_IS_MANAGER(manager), FALSE);
+  g_return_val_if_fail(path != NULL, FALSE);
+
+  priv = gsm_manager_get_instance_private(manager);
+
+  entries = gsm_session_read_packed(path);
+  if (entries == NULL) {
+    if (!gsm_manager_add_autostart_apps_from_dir(manager, path)) {
+      return FALSE;
     }
+    apply_saved_priorities(manager, path);
+    return TRUE;
+  }
+
+  g_debug("GsmManager: *** Adding packed saved session apps for %s", path);
+
+  g_variant_iter_init(&iter, entries);
+  while (g_variant_iter_next(&iter, "(&s&sv)", &name, NULL, &info)) {
+    char *desktop_file;
+    GsmApp *app;
 
     desktop_file = g_build_filename(path, name, NULL);
-    gsm_manager_add_autostart_app(manager, desktop_file, NULL);
+
+    app = gsm_autostart_app_new_from_cache(desktop_file, info,
+                                           priv->condition_monitor);
+    if (app == NULL) {
+      app = load_autostart_app(manager, desktop_file);
+    }
+
+    if (app != NULL) {
+      append_app(manager, app);
+      g_object_unref(app);
+    } else {
+      g_warning("could not read %s", desktop_file);
+    }
+
     g_free(desktop_file);
+    g_variant_unref(info);
   }
 
-  g_dir_close(dir);
+  g_variant_unref(entries);
+
+  apply_saved_priorities(manager, path);
 
   return TRUE;
 }
@@ -3629,3 +5954,20 @@ gboolean gsm_manager_is_session_running(GsmManager *manager, gboolean *running,
   *running = (priv->phase == GSM_MANAGER_PHASE_RUNNING);
   return TRUE;
 }
+
+gboolean gsm_manager_dump_debug_log(GsmManager *manager, char **filename,
+                                    GError **error) {
+  GError *local_error = NULL;
+
+  g_return_val_if_fail(GSM_IS_MANAGER(manager), FALSE);
+
+  *filename = mdm_log_dump("D-Bus request", &local_error);
+  if (*filename == NULL) {
+    g_set_error(error, GSM_MANAGER_ERROR, GSM_MANAGER_ERROR_GENERAL, "%s",
+                local_error->message);
+    g_error_free(local_error);
+    return FALSE;
+  }
+
+  return TRUE;
+}
@@ -44,8 +44,13 @@ struct _GsmManagerClass {
 
   void (*client_added)(GsmManager *manager, const char *id);
   void (*client_removed)(GsmManager *manager, const char *id);
+  void (*clients_changed)(GsmManager *manager, GPtrArray *added,
+                          GPtrArray *removed);
   void (*inhibitor_added)(GsmManager *manager, const char *id);
   void (*inhibitor_removed)(GsmManager *manager, const char *id);
+  void (*inhibitors_changed)(GsmManager *manager, GPtrArray *added,
+                             GPtrArray *removed);
+  void (*inhibited_changed)(GsmManager *manager, guint generation);
 };  // GsmManagerClass;
 
 typedef enum {
@@ -88,6 +93,10 @@ typedef enum {
   GSM_MANAGER_LOGOUT_MODE_FORCE
 } GsmManagerLogoutMode;
 
+/* May be or'ed with a GsmManagerLogoutMode to end the session within the
+ * logout budget, or a default one if none is configured */
+#define GSM_MANAGER_LOGOUT_FLAG_FAST 4
+
 GType gsm_manager_error_get_type(void);
 #define GSM_MANAGER_TYPE_ERROR (gsm_manager_error_get_type())
 
@@ -99,6 +108,8 @@ gboolean gsm_manager_add_autostart_app(GsmManager *manager, const char *path,
                                        const char *provides);
 gboolean gsm_manager_add_autostart_apps_from_dir(GsmManager *manager,
                                                  const char *path);
+gboolean gsm_manager_add_saved_session_apps(GsmManager *manager,
+                                            const char *path);
 gboolean gsm_manager_add_legacy_session_apps(GsmManager *manager,
                                              const char *path);
 
@@ -116,10 +127,19 @@ gboolean gsm_manager_unregister_client(GsmManager *manager,
 gboolean gsm_manager_inhibit(GsmManager *manager, const char *app_id,
                              guint toplevel_xid, const char *reason,
                              guint flags, DBusGMethodInvocation *context);
+gboolean gsm_manager_inhibit_with_timeout(GsmManager *manager,
+                                          const char *app_id,
+                                          guint toplevel_xid,
+                                          const char *reason, guint flags,
+                                          guint timeout,
+                                          DBusGMethodInvocation *context);
 gboolean gsm_manager_uninhibit(GsmManager *manager, guint inhibit_cookie,
                                DBusGMethodInvocation *context);
 gboolean gsm_manager_is_inhibited(GsmManager *manager, guint flags,
                                   gboolean *is_inhibited, GError *error);
+gboolean gsm_manager_get_inhibited_generation(GsmManager *manager,
+                                              guint *generation,
+                                              GError **error);
 
 gboolean gsm_manager_request_shutdown(GsmManager *manager, GError **error);
 
@@ -142,6 +162,12 @@ gboolean gsm_manager_get_clients(GsmManager *manager, GPtrArray **clients,
                                  GError **error);
 gboolean gsm_manager_get_inhibitors(GsmManager *manager, GPtrArray **inhibitors,
                                     GError **error);
+gboolean gsm_manager_get_clients_with_properties(GsmManager *manager,
+                                                 GPtrArray **clients,
+                                                 GError **error);
+gboolean gsm_manager_get_inhibitors_with_properties(GsmManager *manager,
+                                                    GPtrArray **inhibitors,
+                                                    GError **error);
 gboolean gsm_manager_is_autostart_condition_handled(GsmManager *manager,
                                                     const char *condition,
                                                     gboolean *handled,
@@ -150,6 +176,8 @@ gboolean gsm_manager_set_phase(GsmManager *manager, GsmManagerPhase phase);
 
 gboolean gsm_manager_is_session_running(GsmManager *manager, gboolean *running,
                                         GError **error);
+gboolean gsm_manager_dump_debug_log(GsmManager *manager, char **filename,
+                                    GError **error);
 
 void _gsm_manager_set_renderer(GsmManager *manager, const char *renderer);
 
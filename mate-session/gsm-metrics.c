@@ -0,0 +1,413 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gsm-metrics.h"
+
+#include <string.h>
+
+#include <glib.h>
+
+/* Counters meant to be scraped: the histograms and gauges are written in
+ * the Prometheus text format to $XDG_RUNTIME_DIR/mate-session/metrics.prom
+ * every GSM_METRICS_INTERVAL seconds when the output changed, and when
+ * the session ends.
+ *
+ * Observing a plain metric is a few atomic increments, so it can be done
+ * from the writer threads too. Labeled metrics look their series up in a
+ * hash table and are only observed from the main thread, for events that
+ * happen a few times per session. So are the labeled gauges, which hold
+ * the last value they were set to.
+ */
+#define GSM_METRICS_INTERVAL 15
+#define N_BUCKETS 18
+
+typedef enum { UNIT_SECONDS, UNIT_BYTES } MetricUnit;
+
+typedef struct {
+  const char *name;
+  const char *help;
+  MetricUnit unit;
+  const char *label;
+} MetricInfo;
+
+typedef struct {
+  gint buckets[N_BUCKETS];
+  gint count;
+  gsize sum;
+} Histogram;
+
+typedef struct {
+  char *name;
+  char *help;
+  GsmMetricsGaugeFunc func;
+  gpointer data;
+} Gauge;
+
+static const MetricInfo series_info[GSM_METRIC_SERIES_N_SERIES] = {
+    {"client_cpu_seconds", "CPU time used by the clients so far",
+     UNIT_SECONDS, "client"},
+    {"client_rss_bytes", "Resident memory of the clients", UNIT_BYTES,
+     "client"},
+    {"app_startup_seconds",
+     "Time the apps took to register the last time they were started",
+     UNIT_SECONDS, "app"}};
+
+static const MetricInfo metric_info[GSM_METRIC_N_METRICS] = {
+    {"app_register_seconds",
+     "Time between starting an app and its registration", UNIT_SECONDS,
+     NULL},
+    {"session_save_seconds", "Time taken to save the session", UNIT_SECONDS,
+     NULL},
+    {"session_save_bytes", "Bytes written by a session save", UNIT_BYTES,
+     NULL},
+    {"inhibit_seconds", "Time spent handling Inhibit", UNIT_SECONDS, NULL},
+    {"register_client_seconds", "Time spent handling RegisterClient",
+     UNIT_SECONDS, NULL},
+    {"is_inhibited_seconds", "Time spent handling IsInhibited", UNIT_SECONDS,
+     NULL},
+    {"phase_duration_seconds", "Duration of the session phases",
+     UNIT_SECONDS, "phase"},
+    {"query_end_session_response_seconds",
+     "Time taken by the clients to answer QueryEndSession", UNIT_SECONDS,
+     "client"},
+    {"end_session_response_seconds",
+     "Time taken by the clients to answer EndSession", UNIT_SECONDS,
+     "client"}};
+
+/* upper bounds in microseconds and bytes, the last bucket is +Inf */
+static const gint64 second_bounds[N_BUCKETS - 1] = {
+    100,     250,     500,     1000,    2500,    5000,
+    10000,   25000,   50000,   100000,  250000,  500000,
+    1000000, 2500000, 5000000, 10000000, 30000000};
+static const gint64 byte_bounds[N_BUCKETS - 1] = {
+    256,    512,    1024,    2048,    4096,    8192,
+    16384,  32768,  65536,   131072,  262144,  524288,
+    1048576, 2097152, 4194304, 8388608, 16777216};
+
+static Histogram histograms[GSM_METRIC_N_METRICS];
+static GHashTable *labeled[GSM_METRIC_N_METRICS]; /* label -> Histogram */
+static GPtrArray *gauges = NULL;
+static GHashTable *series[GSM_METRIC_SERIES_N_SERIES]; /* label -> gint64 */
+static char *last_output = NULL;
+static guint write_id = 0;
+
+static const gint64 *get_bounds(GsmMetric metric) {
+  return metric_info[metric].unit == UNIT_BYTES ? byte_bounds
+                                                : second_bounds;
+}
+
+static void histogram_observe(Histogram *histogram, const gint64 *bounds,
+                              gint64 value) {
+  int i;
+
+  for (i = 0; i < N_BUCKETS - 1 && value > bounds[i]; i++) {
+  }
+
+  g_atomic_int_inc(&histogram->buckets[i]);
+  g_atomic_int_inc(&histogram->count);
+  g_atomic_pointer_add(&histogram->sum, MAX(value, 0));
+}
+
+void gsm_metrics_observe(GsmMetric metric, gint64 value) {
+  g_return_if_fail(metric < GSM_METRIC_N_METRICS);
+  g_return_if_fail(metric_info[metric].label == NULL);
+
+  histogram_observe(&histograms[metric], get_bounds(metric), value);
+}
+
+void gsm_metrics_observe_labeled(GsmMetric metric, const char *label,
+                                 gint64 value) {
+  Histogram *histogram;
+
+  g_return_if_fail(metric < GSM_METRIC_N_METRICS);
+  g_return_if_fail(metric_info[metric].label != NULL);
+
+  if (labeled[metric] == NULL) {
+    labeled[metric] =
+        g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  }
+
+  histogram = g_hash_table_lookup(labeled[metric], label);
+  if (histogram == NULL) {
+    histogram = g_new0(Histogram, 1);
+    g_hash_table_insert(labeled[metric], g_strdup(label), histogram);
+  }
+
+  histogram_observe(histogram, get_bounds(metric), value);
+}
+
+static void gauge_free(Gauge *gauge) {
+  g_free(gauge->name);
+  g_free(gauge->help);
+  g_slice_free(Gauge, gauge);
+}
+
+void gsm_metrics_add_gauge(const char *name, const char *help,
+                           GsmMetricsGaugeFunc func, gpointer data) {
+  Gauge *gauge;
+
+  if (gauges == NULL) {
+    gauges = g_ptr_array_new_with_free_func((GDestroyNotify)gauge_free);
+  }
+
+  gauge = g_slice_new(Gauge);
+  gauge->name = g_strdup(name);
+  gauge->help = g_strdup(help);
+  gauge->func = func;
+  gauge->data = data;
+
+  g_ptr_array_add(gauges, gauge);
+}
+
+void gsm_metrics_remove_gauges(gpointer data) {
+  guint i;
+
+  if (gauges == NULL) {
+    return;
+  }
+
+  for (i = gauges->len; i > 0; i--) {
+    Gauge *gauge = g_ptr_array_index(gauges, i - 1);
+
+    if (gauge->data == data) {
+      g_ptr_array_remove_index(gauges, i - 1);
+    }
+  }
+}
+
+void gsm_metrics_set_series(GsmMetricSeries id, const char *label,
+                            gint64 value) {
+  gint64 *stored;
+
+  g_return_if_fail(id < GSM_METRIC_SERIES_N_SERIES);
+
+  if (series[id] == NULL) {
+    series[id] = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  }
+
+  stored = g_new(gint64, 1);
+  *stored = value;
+  g_hash_table_replace(series[id], g_strdup(label), stored);
+}
+
+void gsm_metrics_clear_series(GsmMetricSeries id) {
+  g_return_if_fail(id < GSM_METRIC_SERIES_N_SERIES);
+
+  if (series[id] != NULL) {
+    g_hash_table_remove_all(series[id]);
+  }
+}
+
+static void append_label_value(GString *str, const char *value) {
+  const char *p;
+
+  for (p = value; *p != '\0'; p++) {
+    if (*p == '"' || *p == '\\') {
+      g_string_append_c(str, '\\');
+      g_string_append_c(str, *p);
+    } else if (*p == '\n') {
+      g_string_append(str, "\\n");
+    } else {
+      g_string_append_c(str, *p);
+    }
+  }
+}
+
+static void append_value(GString *str, MetricUnit unit, gint64 value) {
+  if (unit == UNIT_SECONDS) {
+    g_string_append_printf(str, "%" G_GINT64_FORMAT ".%06" G_GINT64_FORMAT,
+                           value / G_USEC_PER_SEC, value % G_USEC_PER_SEC);
+  } else {
+    g_string_append_printf(str, "%" G_GINT64_FORMAT, value);
+  }
+}
+
+static void append_histogram(GString *str, GsmMetric metric,
+                             const char *label, Histogram *histogram) {
+  const MetricInfo *info = &metric_info[metric];
+  const gint64 *bounds;
+  char *labels;
+  gint64 cumulative = 0;
+  int i;
+
+  bounds = get_bounds(metric);
+
+  if (label != NULL) {
+    GString *tmp;
+
+    tmp = g_string_new(info->label);
+    g_string_append(tmp, "=\"");
+    append_label_value(tmp, label);
+    g_string_append(tmp, "\",");
+    labels = g_string_free(tmp, FALSE);
+  } else {
+    labels = g_strdup("");
+  }
+
+  for (i = 0; i < N_BUCKETS; i++) {
+    cumulative += g_atomic_int_get(&histogram->buckets[i]);
+
+    g_string_append_printf(str, "mate_session_%s_bucket{%sle=\"", info->name,
+                           labels);
+    if (i == N_BUCKETS - 1) {
+      g_string_append(str, "+Inf");
+    } else {
+      append_value(str, info->unit, bounds[i]);
+    }
+    g_string_append_printf(str, "\"} %" G_GINT64_FORMAT "\n", cumulative);
+  }
+
+  /* drop the trailing comma */
+  if (labels[0] != '\0') {
+    labels[strlen(labels) - 1] = '\0';
+  }
+
+  g_string_append_printf(str, "mate_session_%s_sum%s%s%s ", info->name,
+                         labels[0] != '\0' ? "{" : "", labels,
+                         labels[0] != '\0' ? "}" : "");
+  append_value(str, info->unit,
+               (gint64)(gsize)g_atomic_pointer_get(&histogram->sum));
+  g_string_append_printf(str, "\nmate_session_%s_count%s%s%s %d\n",
+                         info->name, labels[0] != '\0' ? "{" : "", labels,
+                         labels[0] != '\0' ? "}" : "",
+                         g_atomic_int_get(&histogram->count));
+
+  g_free(labels);
+}
+
+static char *format_metrics(void) {
+  GString *str;
+  int metric;
+  int id;
+  guint i;
+
+  str = g_string_sized_new(8192);
+
+  for (metric = 0; metric < GSM_METRIC_N_METRICS; metric++) {
+    const MetricInfo *info = &metric_info[metric];
+
+    g_string_append_printf(str,
+                           "# HELP mate_session_%s %s\n"
+                           "# TYPE mate_session_%s histogram\n",
+                           info->name, info->help, info->name);
+
+    if (info->label == NULL) {
+      append_histogram(str, metric, NULL, &histograms[metric]);
+    } else if (labeled[metric] != NULL) {
+      GHashTableIter iter;
+      gpointer key;
+      gpointer value;
+
+      g_hash_table_iter_init(&iter, labeled[metric]);
+      while (g_hash_table_iter_next(&iter, &key, &value)) {
+        append_histogram(str, metric, key, value);
+      }
+    }
+  }
+
+  for (i = 0; gauges != NULL && i < gauges->len; i++) {
+    Gauge *gauge = g_ptr_array_index(gauges, i);
+
+    g_string_append_printf(str,
+                           "# HELP mate_session_%s %s\n"
+                           "# TYPE mate_session_%s gauge\n"
+                           "mate_session_%s %u\n",
+                           gauge->name, gauge->help, gauge->name, gauge->name,
+                           gauge->func(gauge->data));
+  }
+
+  for (id = 0; id < GSM_METRIC_SERIES_N_SERIES; id++) {
+    const MetricInfo *info = &series_info[id];
+    GHashTableIter iter;
+    gpointer key;
+    gpointer value;
+
+    if (series[id] == NULL || g_hash_table_size(series[id]) == 0) {
+      continue;
+    }
+
+    g_string_append_printf(str,
+                           "# HELP mate_session_%s %s\n"
+                           "# TYPE mate_session_%s gauge\n",
+                           info->name, info->help, info->name);
+
+    g_hash_table_iter_init(&iter, series[id]);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+      g_string_append_printf(str, "mate_session_%s{%s=\"", info->name,
+                             info->label);
+      append_label_value(str, key);
+      g_string_append(str, "\"} ");
+      append_value(str, info->unit, *(gint64 *)value);
+      g_string_append_c(str, '\n');
+    }
+  }
+
+  return g_string_free(str, FALSE);
+}
+
+/* Writes the metrics file if anything changed since the last time */
+void gsm_metrics_flush(void) {
+  char *output;
+  char *dirname;
+  char *filename;
+  GError *error;
+
+  output = format_metrics();
+  if (g_strcmp0(output, last_output) == 0) {
+    g_free(output);
+    return;
+  }
+
+  dirname = g_build_filename(g_get_user_runtime_dir(), "mate-session", NULL);
+  filename = g_build_filename(dirname, "metrics.prom", NULL);
+
+  error = NULL;
+  if (g_mkdir_with_parents(dirname, 0700) != 0) {
+    g_warning("GsmMetrics: Unable to create %s", dirname);
+  } else if (!g_file_set_contents(filename, output, -1, &error)) {
+    g_warning("GsmMetrics: Unable to write %s: %s", filename, error->message);
+    g_error_free(error);
+  }
+
+  g_free(last_output);
+  last_output = output;
+
+  g_free(filename);
+  g_free(dirname);
+}
+
+static gboolean on_write_timeout(gpointer data) {
+  gsm_metrics_flush();
+
+  return TRUE;
+}
+
+void gsm_metrics_init(void) {
+  if (write_id > 0) {
+    return;
+  }
+
+  write_id =
+      g_timeout_add_seconds(GSM_METRICS_INTERVAL, on_write_timeout, NULL);
+}
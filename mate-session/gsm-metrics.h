@@ -0,0 +1,73 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifndef __GSM_METRICS_H__
+#define __GSM_METRICS_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+  /* plain histograms, cheap enough for the D-Bus hot paths */
+  GSM_METRIC_APP_REGISTER_LATENCY,
+  GSM_METRIC_SESSION_SAVE_DURATION,
+  GSM_METRIC_SESSION_SAVE_BYTES,
+  GSM_METRIC_INHIBIT_LATENCY,
+  GSM_METRIC_REGISTER_CLIENT_LATENCY,
+  GSM_METRIC_IS_INHIBITED_LATENCY,
+  /* histograms with one series per label */
+  GSM_METRIC_PHASE_DURATION,
+  GSM_METRIC_QUERY_END_SESSION_RESPONSE,
+  GSM_METRIC_END_SESSION_RESPONSE,
+  GSM_METRIC_N_METRICS
+} GsmMetric;
+
+/* gauges with one series per label, set from the main thread */
+typedef enum {
+  GSM_METRIC_SERIES_CLIENT_CPU_TIME,
+  GSM_METRIC_SERIES_CLIENT_RSS,
+  GSM_METRIC_SERIES_APP_STARTUP,
+  GSM_METRIC_SERIES_N_SERIES
+} GsmMetricSeries;
+
+typedef guint (*GsmMetricsGaugeFunc)(gpointer data);
+
+void gsm_metrics_init(void);
+
+/* @value is in microseconds, or bytes for the save size */
+void gsm_metrics_observe(GsmMetric metric, gint64 value);
+void gsm_metrics_observe_labeled(GsmMetric metric, const char *label,
+                                 gint64 value);
+
+void gsm_metrics_add_gauge(const char *name, const char *help,
+                           GsmMetricsGaugeFunc func, gpointer data);
+void gsm_metrics_remove_gauges(gpointer data);
+
+/* @value is in microseconds, or bytes for the RSS */
+void gsm_metrics_set_series(GsmMetricSeries series, const char *label,
+                            gint64 value);
+void gsm_metrics_clear_series(GsmMetricSeries series);
+
+void gsm_metrics_flush(void);
+
+G_END_DECLS
+
+#endif /* __GSM_METRICS_H__ */
@@ -0,0 +1,95 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gsm-ordered-set.h"
+
+#include <glib.h>
+
+struct _GsmOrderedSet {
+  GQueue items;
+  GHashTable *links; /* item -> its GList link in items */
+};
+
+GsmOrderedSet *gsm_ordered_set_new(void) {
+  GsmOrderedSet *set;
+
+  set = g_slice_new0(GsmOrderedSet);
+  g_queue_init(&set->items);
+  set->links = g_hash_table_new(NULL, NULL);
+
+  return set;
+}
+
+void gsm_ordered_set_free(GsmOrderedSet *set) {
+  g_queue_clear(&set->items);
+  g_hash_table_destroy(set->links);
+  g_slice_free(GsmOrderedSet, set);
+}
+
+/* Appends @item; returns FALSE if it already was in @set */
+gboolean gsm_ordered_set_add(GsmOrderedSet *set, gpointer item) {
+  if (g_hash_table_contains(set->links, item)) {
+    return FALSE;
+  }
+
+  g_queue_push_tail(&set->items, item);
+  g_hash_table_insert(set->links, item, g_queue_peek_tail_link(&set->items));
+
+  return TRUE;
+}
+
+gboolean gsm_ordered_set_remove(GsmOrderedSet *set, gpointer item) {
+  GList *link;
+
+  link = g_hash_table_lookup(set->links, item);
+  if (link == NULL) {
+    return FALSE;
+  }
+
+  g_hash_table_remove(set->links, item);
+  g_queue_delete_link(&set->items, link);
+
+  return TRUE;
+}
+
+gboolean gsm_ordered_set_contains(GsmOrderedSet *set, gpointer item) {
+  return g_hash_table_contains(set->links, item);
+}
+
+void gsm_ordered_set_clear(GsmOrderedSet *set) {
+  g_queue_clear(&set->items);
+  g_hash_table_remove_all(set->links);
+}
+
+guint gsm_ordered_set_size(GsmOrderedSet *set) {
+  return g_queue_get_length(&set->items);
+}
+
+gboolean gsm_ordered_set_is_empty(GsmOrderedSet *set) {
+  return g_queue_is_empty(&set->items);
+}
+
+GList *gsm_ordered_set_peek_items(GsmOrderedSet *set) {
+  return set->items.head;
+}
@@ -0,0 +1,50 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+#ifndef __GSM_ORDERED_SET_H__
+#define __GSM_ORDERED_SET_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* A set of pointers that remembers insertion order, with O(1) add,
+ * remove and lookup */
+typedef struct _GsmOrderedSet GsmOrderedSet;
+
+GsmOrderedSet *gsm_ordered_set_new(void);
+void gsm_ordered_set_free(GsmOrderedSet *set);
+
+gboolean gsm_ordered_set_add(GsmOrderedSet *set, gpointer item);
+gboolean gsm_ordered_set_remove(GsmOrderedSet *set, gpointer item);
+gboolean gsm_ordered_set_contains(GsmOrderedSet *set, gpointer item);
+void gsm_ordered_set_clear(GsmOrderedSet *set);
+
+guint gsm_ordered_set_size(GsmOrderedSet *set);
+gboolean gsm_ordered_set_is_empty(GsmOrderedSet *set);
+
+/* Items, oldest first; owned by the set and only valid until it is
+ * modified */
+GList *gsm_ordered_set_peek_items(GsmOrderedSet *set);
+
+G_END_DECLS
+
+#endif /* __GSM_ORDERED_SET_H__ */
@@ -50,7 +50,11 @@ typedef struct {
   gboolean idle_enabled;
   GSIdleMonitor *idle_monitor;
   guint idle_watch_id;
+  guint idle_watch_timeout;
   guint idle_timeout;
+  guint idle_debounce;
+  guint debounce_id;
+  gboolean debounce_idle;
   gboolean screensaver_active;
   DBusGConnection *bus_connection;
   DBusGProxy *bus_proxy;
@@ -63,6 +67,7 @@ enum {
   PROP_STATUS_TEXT,
   PROP_IDLE_ENABLED,
   PROP_IDLE_TIMEOUT,
+  PROP_IDLE_DEBOUNCE,
 };
 
 enum { STATUS_CHANGED, STATUS_TEXT_CHANGED, LAST_SIGNAL };
@@ -125,14 +130,56 @@ static void set_session_idle(GsmPresence *presence, gboolean is_idle) {
   }
 }
 
+static void cancel_debounce(GsmPresence *presence) {
+  GsmPresencePrivate *priv;
+
+  priv = gsm_presence_get_instance_private(presence);
+
+  if (priv->debounce_id > 0) {
+    g_source_remove(priv->debounce_id);
+    priv->debounce_id = 0;
+  }
+}
+
+static gboolean on_debounce_timeout(GsmPresence *presence) {
+  GsmPresencePrivate *priv;
+
+  priv = gsm_presence_get_instance_private(presence);
+  priv->debounce_id = 0;
+
+  set_session_idle(presence, priv->debounce_idle);
+
+  return FALSE;
+}
+
+/* Idle transitions only take effect once they held for idle-debounce
+ * milliseconds; one that is undone before that is dropped */
 static gboolean on_idle_timeout(GSIdleMonitor *monitor, guint id,
                                 gboolean condition, GsmPresence *presence) {
-  gboolean handled;
+  GsmPresencePrivate *priv;
+
+  priv = gsm_presence_get_instance_private(presence);
+
+  if (priv->debounce_id > 0) {
+    if (priv->debounce_idle != condition) {
+      g_debug("GsmPresence: idle transition reverted within %u ms",
+              priv->idle_debounce);
+      cancel_debounce(presence);
+    }
+    return TRUE;
+  }
+
+  if (priv->idle_debounce == 0 ||
+      condition == (priv->status == GSM_PRESENCE_STATUS_IDLE)) {
+    set_session_idle(presence, condition);
+    return TRUE;
+  }
 
-  handled = TRUE;
-  set_session_idle(presence, condition);
+  priv->debounce_idle = condition;
+  priv->debounce_id = g_timeout_add(
+      priv->idle_debounce, (GSourceFunc)on_debounce_timeout, presence);
 
-  return handled;
+  return TRUE;
 }
 
 static void reset_idle_watch(GsmPresence *presence) {
@@ -143,6 +190,17 @@ static void reset_idle_watch(GsmPresence *presence) {
     return;
   }
 
+  if (!priv->screensaver_active && priv->idle_enabled &&
+      priv->idle_timeout > 0) {
+    /* Keep the watch we have if it is for the same timeout */
+    if (priv->idle_watch_id > 0 &&
+        priv->idle_watch_timeout == priv->idle_timeout) {
+      return;
+    }
+  }
+
+  cancel_debounce(presence);
+
   if (priv->idle_watch_id > 0) {
     g_debug("GsmPresence: removing idle watch");
     gs_idle_monitor_remove_watch(priv->idle_monitor, priv->idle_watch_id);
@@ -156,6 +214,7 @@ static void reset_idle_watch(GsmPresence *presence) {
     priv->idle_watch_id = gs_idle_monitor_add_watch(
         priv->idle_monitor, priv->idle_timeout,
         (GSIdleMonitorWatchFunc)on_idle_timeout, presence);
+    priv->idle_watch_timeout = priv->idle_timeout;
   }
 }
 
@@ -166,6 +225,7 @@ static void on_screensaver_active_changed(DBusGProxy *proxy, gboolean is_active,
   g_debug("screensaver status changed: %d", is_active);
   priv = gsm_presence_get_instance_private(presence);
   if (priv->screensaver_active != is_active) {
+    cancel_debounce(presence);
     priv->screensaver_active = is_active;
     reset_idle_watch(presence);
     set_session_idle(presence, is_active);
@@ -351,6 +411,18 @@ void gsm_presence_set_idle_timeout(GsmPresence *presence, guint timeout) {
   }
 }
 
+void gsm_presence_set_idle_debounce(GsmPresence *presence, guint debounce) {
+  GsmPresencePrivate *priv;
+
+  g_return_if_fail(GSM_IS_PRESENCE(presence));
+  priv = gsm_presence_get_instance_private(presence);
+
+  if (debounce != priv->idle_debounce) {
+    priv->idle_debounce = debounce;
+    g_object_notify(G_OBJECT(presence), "idle-debounce");
+  }
+}
+
 static void gsm_presence_set_property(GObject *object, guint prop_id,
                                       const GValue *value, GParamSpec *pspec) {
   GsmPresence *self;
@@ -370,6 +442,9 @@ static void gsm_presence_set_property(GObject *object, guint prop_id,
     case PROP_IDLE_TIMEOUT:
       gsm_presence_set_idle_timeout(self, g_value_get_uint(value));
       break;
+    case PROP_IDLE_DEBOUNCE:
+      gsm_presence_set_idle_debounce(self, g_value_get_uint(value));
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
       break;
@@ -398,6 +473,9 @@ static void gsm_presence_get_property(GObject *object, guint prop_id,
     case PROP_IDLE_TIMEOUT:
       g_value_set_uint(value, priv->idle_timeout);
       break;
+    case PROP_IDLE_DEBOUNCE:
+      g_value_set_uint(value, priv->idle_debounce);
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec);
       break;
@@ -410,6 +488,8 @@ static void gsm_presence_finalize(GObject *object) {
 
   priv = gsm_presence_get_instance_private(presence);
 
+  cancel_debounce(presence);
+
   if (priv->idle_watch_id > 0) {
     gs_idle_monitor_remove_watch(priv->idle_monitor, priv->idle_watch_id);
     priv->idle_watch_id = 0;
@@ -462,6 +542,10 @@ static void gsm_presence_class_init(GsmPresenceClass *klass) {
       g_param_spec_uint("idle-timeout", "idle timeout", "idle timeout", 0,
                         G_MAXINT, 300000,
                         G_PARAM_READWRITE | G_PARAM_CONSTRUCT));
+  g_object_class_install_property(
+      object_class, PROP_IDLE_DEBOUNCE,
+      g_param_spec_uint("idle-debounce", "idle debounce", "idle debounce", 0,
+                        G_MAXINT, 0, G_PARAM_READWRITE | G_PARAM_CONSTRUCT));
 
   dbus_g_object_type_install_info(GSM_TYPE_PRESENCE,
                                   &dbus_glib_gsm_presence_object_info);
@@ -60,6 +60,7 @@ GsmPresence *gsm_presence_new(void);
 
 void gsm_presence_set_idle_enabled(GsmPresence *presence, gboolean enabled);
 void gsm_presence_set_idle_timeout(GsmPresence *presence, guint n_seconds);
+void gsm_presence_set_idle_debounce(GsmPresence *presence, guint msec);
 
 /* exported to bus */
 gboolean gsm_presence_set_status(GsmPresence *presence, guint status,
@@ -0,0 +1,215 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gsm-readahead.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+/* While the session starts, we record the files mapped by the autostart
+ * apps once they registered: their binary and shared libraries. At the
+ * next login, the kernel is asked to read all of them in while the
+ * initialization phase runs, so that the apps of the later phases do not
+ * each fault their files in one after the other from a cold cache.
+ *
+ * The list is a text file with one path per line, rewritten at every
+ * login that recorded something.
+ */
+#define READAHEAD_MAX_FILES 4096
+/* Opening files on a cold cache blocks on the directory lookups */
+#define READAHEAD_THREADS 4
+
+static GHashTable *recorded = NULL; /* path set */
+
+static char *get_readahead_filename(void) {
+  return g_build_filename(g_get_user_cache_dir(), "mate-session", "readahead",
+                          NULL);
+}
+
+static void prefetch_file(char *path, gpointer user_data) {
+  struct stat st;
+  int fd;
+
+  /* The list is user writable: never block opening a FIFO or a device */
+  fd = open(path, O_RDONLY | O_NONBLOCK | O_NOCTTY | O_CLOEXEC);
+  if (fd >= 0) {
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+      posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+    }
+    close(fd);
+  }
+
+  g_free(path);
+}
+
+/* Starts reading in the files recorded at the previous login, without
+ * waiting for it to complete. */
+void gsm_readahead_start(void) {
+  char *filename;
+  char *contents;
+  char **paths;
+  GThreadPool *pool;
+  GError *error;
+  guint n_files;
+  guint i;
+
+  filename = get_readahead_filename();
+
+  error = NULL;
+  if (!g_file_get_contents(filename, &contents, NULL, &error)) {
+    g_debug("GsmReadahead: Unable to read %s: %s", filename, error->message);
+    g_error_free(error);
+    g_free(filename);
+    return;
+  }
+
+  error = NULL;
+  pool = g_thread_pool_new((GFunc)prefetch_file, NULL, READAHEAD_THREADS,
+                           FALSE, &error);
+  if (pool == NULL) {
+    g_warning("GsmReadahead: Unable to start prefetching: %s",
+              error->message);
+    g_error_free(error);
+    g_free(contents);
+    g_free(filename);
+    return;
+  }
+
+  n_files = 0;
+  paths = g_strsplit(contents, "\n", -1);
+  for (i = 0; paths[i] != NULL && n_files < READAHEAD_MAX_FILES; i++) {
+    if (paths[i][0] == '/') {
+      g_thread_pool_push(pool, g_strdup(paths[i]), NULL);
+      n_files++;
+    }
+  }
+
+  g_debug("GsmReadahead: Prefetching %u files from %s", n_files, filename);
+
+  /* the pool goes away on its own once the queue is done */
+  g_thread_pool_free(pool, FALSE, FALSE);
+
+  g_strfreev(paths);
+  g_free(contents);
+  g_free(filename);
+}
+
+/* Records the files mapped by the process @pid, an app that just
+ * registered while the session is starting. */
+void gsm_readahead_record(GPid pid) {
+  char *maps_path;
+  char *contents;
+  char **lines;
+  guint i;
+
+  if (pid <= 0) {
+    return;
+  }
+
+  maps_path = g_strdup_printf("/proc/%d/maps", (int)pid);
+  if (!g_file_get_contents(maps_path, &contents, NULL, NULL)) {
+    g_free(maps_path);
+    return;
+  }
+
+  if (recorded == NULL) {
+    recorded = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  }
+
+  /* address perms offset dev inode pathname */
+  lines = g_strsplit(contents, "\n", -1);
+  for (i = 0; lines[i] != NULL; i++) {
+    const char *path;
+    guint64 inode;
+
+    if (g_hash_table_size(recorded) >= READAHEAD_MAX_FILES) {
+      break;
+    }
+
+    path = strchr(lines[i], '/');
+    if (path == NULL ||
+        sscanf(lines[i], "%*s %*s %*s %*s %" G_GUINT64_FORMAT, &inode) != 1 ||
+        inode == 0 || g_str_has_suffix(path, " (deleted)") ||
+        g_str_has_prefix(path, "/dev/")) {
+      continue;
+    }
+
+    if (!g_hash_table_contains(recorded, path)) {
+      g_hash_table_add(recorded, g_strdup(path));
+    }
+  }
+
+  g_strfreev(lines);
+  g_free(contents);
+  g_free(maps_path);
+}
+
+void gsm_readahead_save(void) {
+  GString *contents;
+  GList *paths;
+  GList *l;
+  char *filename;
+  char *dirname;
+  GError *error;
+
+  if (recorded == NULL) {
+    return;
+  }
+
+  /* sorted, so that files of the same directory are read together */
+  paths = g_list_sort(g_hash_table_get_keys(recorded), (GCompareFunc)strcmp);
+
+  contents = g_string_new(NULL);
+  for (l = paths; l != NULL; l = l->next) {
+    g_string_append_printf(contents, "%s\n", (char *)l->data);
+  }
+
+  filename = get_readahead_filename();
+  dirname = g_path_get_dirname(filename);
+
+  error = NULL;
+  if (g_mkdir_with_parents(dirname, 0700) != 0) {
+    g_warning("GsmReadahead: Unable to create %s", dirname);
+  } else if (!g_file_set_contents(filename, contents->str, contents->len,
+                                  &error)) {
+    g_warning("GsmReadahead: Unable to write %s: %s", filename,
+              error->message);
+    g_error_free(error);
+  } else {
+    g_debug("GsmReadahead: Wrote %u files to %s",
+            g_hash_table_size(recorded), filename);
+  }
+
+  g_list_free(paths);
+  g_string_free(contents, TRUE);
+  g_free(dirname);
+  g_free(filename);
+  g_clear_pointer(&recorded, g_hash_table_destroy);
+}
@@ -0,0 +1,423 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gsm-resource-monitor.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#include <gio/gio.h>
+#include <glib.h>
+
+#include "gsm-app-scope.h"
+#include "gsm-client.h"
+#include "gsm-metrics.h"
+#include "gsm-settings.h"
+
+/* Samples the CPU time and resident memory of every client we know the
+ * PID of, every resource-sample-interval seconds. The files are read on a
+ * worker thread: from the scope of the client when it has one, which also
+ * accounts for its children, otherwise from /proc. While the session is
+ * idle the interval doubles after every sample, up to
+ * GSM_RESOURCE_MONITOR_MAX_BACKOFF times.
+ */
+#define KEY_SAMPLE_INTERVAL "resource-sample-interval"
+#define GSM_RESOURCE_MONITOR_MAX_BACKOFF 8
+
+typedef struct {
+  char *client_id;
+  char *label;
+  char *cgroup;
+  GPid pid;
+  gboolean scoped;
+  gboolean valid;
+  guint64 cpu_usec;
+  guint64 rss_bytes;
+} Sample;
+
+typedef struct {
+  guint64 cpu_usec;
+  guint64 rss_bytes;
+} Usage;
+
+static GsmStore *client_store = NULL;
+static GHashTable *usage = NULL; /* client id -> Usage */
+static GCancellable *cancellable = NULL;
+static guint interval = 0;
+static guint backoff = 1;
+static gboolean session_idle = FALSE;
+static gboolean sampling = FALSE;
+static guint sample_id = 0;
+
+static void schedule_sample(void);
+
+static void sample_free(Sample *sample) {
+  g_free(sample->client_id);
+  g_free(sample->label);
+  g_free(sample->cgroup);
+  g_slice_free(Sample, sample);
+}
+
+static gboolean read_proc_usage(GPid pid, guint64 *cpu_usec,
+                                guint64 *rss_bytes) {
+  char *path;
+  char *contents;
+  char *end;
+  char **fields;
+  gboolean ret = FALSE;
+  long ticks;
+  long page_size;
+
+  ticks = sysconf(_SC_CLK_TCK);
+  page_size = sysconf(_SC_PAGESIZE);
+  if (ticks <= 0 || page_size <= 0) {
+    return FALSE;
+  }
+
+  path = g_strdup_printf("/proc/%d/stat", (int)pid);
+  if (!g_file_get_contents(path, &contents, NULL, NULL)) {
+    g_free(path);
+    return FALSE;
+  }
+  g_free(path);
+
+  /* The command name can contain anything, the fields start after it */
+  end = strrchr(contents, ')');
+  if (end == NULL || end[1] != ' ') {
+    g_free(contents);
+    return FALSE;
+  }
+
+  /* utime and stime are the 14th and 15th fields, the state the 3rd */
+  fields = g_strsplit(end + 2, " ", 14);
+  if (g_strv_length(fields) >= 13) {
+    guint64 utime = g_ascii_strtoull(fields[11], NULL, 10);
+    guint64 stime = g_ascii_strtoull(fields[12], NULL, 10);
+
+    *cpu_usec = (utime + stime) * G_USEC_PER_SEC / ticks;
+    ret = TRUE;
+  }
+  g_strfreev(fields);
+  g_free(contents);
+
+  if (!ret) {
+    return FALSE;
+  }
+
+  path = g_strdup_printf("/proc/%d/statm", (int)pid);
+  if (!g_file_get_contents(path, &contents, NULL, NULL)) {
+    g_free(path);
+    return FALSE;
+  }
+  g_free(path);
+
+  fields = g_strsplit(contents, " ", 3);
+  if (g_strv_length(fields) >= 2) {
+    *rss_bytes = g_ascii_strtoull(fields[1], NULL, 10) * page_size;
+  } else {
+    ret = FALSE;
+  }
+  g_strfreev(fields);
+  g_free(contents);
+
+  return ret;
+}
+
+static void sample_thread(GTask *task, gpointer source_object,
+                          GPtrArray *samples, GCancellable *cancellable) {
+  guint i;
+
+  for (i = 0; i < samples->len; i++) {
+    Sample *sample = g_ptr_array_index(samples, i);
+
+    if (g_cancellable_is_cancelled(cancellable)) {
+      break;
+    }
+
+    sample->cgroup = gsm_app_scope_read_cgroup(sample->pid);
+
+    if (sample->scoped) {
+      sample->valid = gsm_app_scope_read_usage(
+          sample->pid, &sample->cpu_usec, &sample->rss_bytes);
+    } else {
+      sample->valid = read_proc_usage(sample->pid, &sample->cpu_usec,
+                                      &sample->rss_bytes);
+    }
+  }
+
+  g_task_return_boolean(task, TRUE);
+}
+
+static void add_to_series(GHashTable *sums, const char *label,
+                          guint64 value) {
+  guint64 *sum;
+
+  sum = g_hash_table_lookup(sums, label);
+  if (sum == NULL) {
+    sum = g_new0(guint64, 1);
+    g_hash_table_insert(sums, (char *)label, sum);
+  }
+
+  *sum += value;
+}
+
+static void set_series(GsmMetricSeries series, GHashTable *sums) {
+  GHashTableIter iter;
+  gpointer key;
+  gpointer value;
+
+  gsm_metrics_clear_series(series);
+
+  g_hash_table_iter_init(&iter, sums);
+  while (g_hash_table_iter_next(&iter, &key, &value)) {
+    gsm_metrics_set_series(series, key, *(guint64 *)value);
+  }
+}
+
+/* Returns what @sample measured, so that it is only added to the series
+ * once: the scope for scoped clients, otherwise the process. NULL when a
+ * scope already covers the process. */
+static char *get_sample_key(Sample *sample, GHashTable *scope_cgroups) {
+  if (sample->cgroup != NULL) {
+    if (sample->scoped) {
+      return g_strdup(sample->cgroup);
+    }
+    if (g_hash_table_contains(scope_cgroups, sample->cgroup)) {
+      return NULL;
+    }
+  }
+
+  return g_strdup_printf("%d", (int)sample->pid);
+}
+
+/* Clients of the same app are reported together. Clients sharing a
+ * process, like one registered over XSMP and D-Bus, or a scope are only
+ * counted once. */
+static void apply_samples(GPtrArray *samples) {
+  GHashTable *cpu;
+  GHashTable *rss;
+  GHashTable *scope_cgroups;
+  GHashTable *counted;
+  guint i;
+
+  g_hash_table_remove_all(usage);
+
+  cpu = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, g_free);
+  rss = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, g_free);
+  scope_cgroups = g_hash_table_new(g_str_hash, g_str_equal);
+  counted = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+  for (i = 0; i < samples->len; i++) {
+    Sample *sample = g_ptr_array_index(samples, i);
+
+    if (sample->valid && sample->scoped && sample->cgroup != NULL) {
+      g_hash_table_add(scope_cgroups, sample->cgroup);
+    }
+  }
+
+  for (i = 0; i < samples->len; i++) {
+    Sample *sample = g_ptr_array_index(samples, i);
+    Usage *u;
+    char *key;
+
+    if (!sample->valid) {
+      continue;
+    }
+
+    u = g_new(Usage, 1);
+    u->cpu_usec = sample->cpu_usec;
+    u->rss_bytes = sample->rss_bytes;
+    g_hash_table_replace(usage, g_strdup(sample->client_id), u);
+
+    key = get_sample_key(sample, scope_cgroups);
+    if (key == NULL || !g_hash_table_add(counted, key)) {
+      continue;
+    }
+
+    add_to_series(cpu, sample->label, sample->cpu_usec);
+    add_to_series(rss, sample->label, sample->rss_bytes);
+  }
+
+  set_series(GSM_METRIC_SERIES_CLIENT_CPU_TIME, cpu);
+  set_series(GSM_METRIC_SERIES_CLIENT_RSS, rss);
+
+  g_hash_table_destroy(counted);
+  g_hash_table_destroy(scope_cgroups);
+  g_hash_table_destroy(rss);
+  g_hash_table_destroy(cpu);
+
+  g_debug("GsmResourceMonitor: sampled %u of %u clients",
+          g_hash_table_size(usage), samples->len);
+}
+
+static void on_sample_done(GObject *source, GAsyncResult *result,
+                           GPtrArray *samples) {
+  GCancellable *task_cancellable;
+
+  task_cancellable = g_task_get_cancellable(G_TASK(result));
+
+  /* Stopped meanwhile */
+  if (g_cancellable_is_cancelled(task_cancellable)) {
+    return;
+  }
+
+  sampling = FALSE;
+  apply_samples(samples);
+
+  if (session_idle && backoff < GSM_RESOURCE_MONITOR_MAX_BACKOFF) {
+    backoff *= 2;
+  }
+
+  schedule_sample();
+}
+
+static gboolean collect_sample(const char *id, GsmClient *client,
+                               GPtrArray *samples) {
+  Sample *sample;
+  const char *app_id;
+  guint pid = 0;
+
+  gsm_client_get_unix_process_id(client, &pid, NULL);
+  if (pid == 0) {
+    return FALSE;
+  }
+
+  app_id = gsm_client_peek_app_id(client);
+
+  sample = g_slice_new0(Sample);
+  sample->client_id = g_strdup(id);
+  sample->label = g_strdup(app_id != NULL && app_id[0] != '\0' ? app_id : id);
+  sample->pid = (GPid)pid;
+  sample->scoped = gsm_app_scope_contains(sample->pid);
+  g_ptr_array_add(samples, sample);
+
+  return FALSE;
+}
+
+static gboolean on_sample_timeout(gpointer data) {
+  GPtrArray *samples;
+  GTask *task;
+
+  sample_id = 0;
+
+  samples = g_ptr_array_new_with_free_func((GDestroyNotify)sample_free);
+  gsm_store_foreach(client_store, (GsmStoreFunc)collect_sample, samples);
+
+  sampling = TRUE;
+
+  task = g_task_new(NULL, cancellable, (GAsyncReadyCallback)on_sample_done,
+                    samples);
+  g_task_set_task_data(task, samples, (GDestroyNotify)g_ptr_array_unref);
+  g_task_run_in_thread(task, (GTaskThreadFunc)sample_thread);
+  g_object_unref(task);
+
+  return FALSE;
+}
+
+static void schedule_sample(void) {
+  if (sample_id != 0) {
+    g_source_remove(sample_id);
+  }
+
+  sample_id =
+      g_timeout_add_seconds(interval * backoff, on_sample_timeout, NULL);
+}
+
+void gsm_resource_monitor_start(GsmStore *clients) {
+  g_return_if_fail(GSM_IS_STORE(clients));
+
+  if (client_store != NULL) {
+    return;
+  }
+
+  interval = gsm_settings_get_int(GSM_SETTINGS_SESSION, KEY_SAMPLE_INTERVAL);
+  if (interval == 0) {
+    g_debug("GsmResourceMonitor: disabled");
+    return;
+  }
+
+  client_store = g_object_ref(clients);
+  usage = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  cancellable = g_cancellable_new();
+  backoff = 1;
+
+  schedule_sample();
+}
+
+void gsm_resource_monitor_stop(void) {
+  if (client_store == NULL) {
+    return;
+  }
+
+  if (sample_id != 0) {
+    g_source_remove(sample_id);
+    sample_id = 0;
+  }
+
+  /* A sample still running will be dropped when it is done */
+  g_cancellable_cancel(cancellable);
+  g_clear_object(&cancellable);
+  sampling = FALSE;
+
+  g_clear_pointer(&usage, g_hash_table_destroy);
+  g_clear_object(&client_store);
+
+  gsm_metrics_clear_series(GSM_METRIC_SERIES_CLIENT_CPU_TIME);
+  gsm_metrics_clear_series(GSM_METRIC_SERIES_CLIENT_RSS);
+}
+
+void gsm_resource_monitor_set_idle(gboolean idle) {
+  session_idle = idle;
+
+  if (idle || backoff == 1) {
+    return;
+  }
+
+  backoff = 1;
+
+  /* Do not wait for a backed off sample once the user is back */
+  if (client_store != NULL && !sampling) {
+    schedule_sample();
+  }
+}
+
+/* Returns the last sample taken of @client_id */
+gboolean gsm_resource_monitor_get_usage(const char *client_id,
+                                        guint64 *cpu_usec, guint64 *rss_bytes) {
+  Usage *u;
+
+  if (usage == NULL) {
+    return FALSE;
+  }
+
+  u = g_hash_table_lookup(usage, client_id);
+  if (u == NULL) {
+    return FALSE;
+  }
+
+  *cpu_usec = u->cpu_usec;
+  *rss_bytes = u->rss_bytes;
+
+  return TRUE;
+}
@@ -0,0 +1,238 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gsm-restart-history.h"
+
+#include <string.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+/* For every app that is restarted when it exits we remember when it
+ * exited during the last RESTART_WINDOW, and restart it later and later
+ * the more it did: right away the first time, then after
+ * RESTART_MIN_BACKOFF, doubling up to RESTART_MAX_BACKOFF. An app that
+ * exits RESTART_MAX_EXITS times within the window is not restarted
+ * anymore.
+ *
+ * The history is a key file with one group per app id in the runtime
+ * directory, so that it survives the manager being restarted but not the
+ * session: it is ignored if it was written for another session.
+ */
+#define RESTART_GROUP_SESSION "Session"
+#define RESTART_KEY_ID "Id"
+#define RESTART_KEY_EXITS "Exits"
+#define RESTART_KEY_NEXT_RESTART "NextRestart"
+#define RESTART_KEY_GIVEN_UP "GivenUp"
+
+#define RESTART_WINDOW (120 * G_USEC_PER_SEC)
+#define RESTART_MAX_EXITS 6
+#define RESTART_MIN_BACKOFF 1000  /* milliseconds */
+#define RESTART_MAX_BACKOFF 60000 /* milliseconds */
+
+static GKeyFile *history = NULL;
+
+static char *get_history_filename(void) {
+  return g_build_filename(g_get_user_runtime_dir(), "mate-session",
+                          "restart-history", NULL);
+}
+
+static const char *get_session_id(void) {
+  const char *id;
+
+  id = g_getenv("XDG_SESSION_ID");
+
+  return id != NULL ? id : "";
+}
+
+static void history_load(void) {
+  char *filename;
+  char *id;
+  GError *error;
+
+  if (history != NULL) {
+    return;
+  }
+
+  history = g_key_file_new();
+
+  filename = get_history_filename();
+
+  error = NULL;
+  if (!g_key_file_load_from_file(history, filename, G_KEY_FILE_NONE, &error)) {
+    g_debug("GsmRestartHistory: Unable to load %s: %s", filename,
+            error->message);
+    g_error_free(error);
+  }
+
+  id = g_key_file_get_string(history, RESTART_GROUP_SESSION, RESTART_KEY_ID,
+                             NULL);
+  if (g_strcmp0(id, get_session_id()) != 0) {
+    g_key_file_free(history);
+    history = g_key_file_new();
+    g_key_file_set_string(history, RESTART_GROUP_SESSION, RESTART_KEY_ID,
+                          get_session_id());
+  }
+
+  g_free(id);
+  g_free(filename);
+}
+
+static void history_save(void) {
+  char *filename;
+  char *dirname;
+  GError *error;
+
+  filename = get_history_filename();
+  dirname = g_path_get_dirname(filename);
+
+  error = NULL;
+  if (g_mkdir_with_parents(dirname, 0700) != 0) {
+    g_warning("GsmRestartHistory: Unable to create %s", dirname);
+  } else if (!g_key_file_save_to_file(history, filename, &error)) {
+    g_warning("GsmRestartHistory: Unable to write %s: %s", filename,
+              error->message);
+    g_error_free(error);
+  }
+
+  g_free(dirname);
+  g_free(filename);
+}
+
+/* Returns the exits of @app_id that are still within the window, oldest
+ * first, and their number in @n_exits */
+static gint64 *get_exits(const char *app_id, gint64 now, gsize *n_exits) {
+  char **list;
+  gint64 *exits;
+  gsize n = 0;
+  gsize i;
+
+  list = g_key_file_get_string_list(history, app_id, RESTART_KEY_EXITS, &n,
+                                    NULL);
+  exits = g_new(gint64, n + 1);
+  *n_exits = 0;
+
+  for (i = 0; i < n; i++) {
+    gint64 exit_time;
+
+    exit_time = g_ascii_strtoll(list[i], NULL, 10);
+    if (exit_time > now - RESTART_WINDOW && exit_time <= now) {
+      exits[(*n_exits)++] = exit_time;
+    }
+  }
+
+  g_strfreev(list);
+
+  return exits;
+}
+
+static void set_exits(const char *app_id, const gint64 *exits, gsize n_exits) {
+  char **list;
+  gsize i;
+
+  list = g_new0(char *, n_exits + 1);
+  for (i = 0; i < n_exits; i++) {
+    list[i] = g_strdup_printf("%" G_GINT64_FORMAT, exits[i]);
+  }
+
+  g_key_file_set_string_list(history, app_id, RESTART_KEY_EXITS,
+                             (const char *const *)list, n_exits);
+
+  g_strfreev(list);
+}
+
+/* Records that @app_id exited and should be restarted. Returns whether to
+ * do it now, in @delay milliseconds, or not at all. */
+GsmRestartVerdict gsm_restart_history_record_exit(const char *app_id,
+                                                  guint *delay) {
+  GsmRestartVerdict verdict;
+  gint64 now;
+  gint64 *exits;
+  gsize n_exits;
+
+  g_return_val_if_fail(app_id != NULL, GSM_RESTART_NOW);
+
+  history_load();
+
+  *delay = 0;
+
+  if (g_key_file_get_boolean(history, app_id, RESTART_KEY_GIVEN_UP, NULL)) {
+    return GSM_RESTART_GIVE_UP;
+  }
+
+  now = g_get_real_time();
+  exits = get_exits(app_id, now, &n_exits);
+  exits[n_exits++] = now;
+
+  if (n_exits >= RESTART_MAX_EXITS) {
+    g_warning("GsmRestartHistory: %s exited %u times in %u seconds, "
+              "not restarting it anymore",
+              app_id, (guint)n_exits, (guint)(RESTART_WINDOW / G_USEC_PER_SEC));
+    g_key_file_set_boolean(history, app_id, RESTART_KEY_GIVEN_UP, TRUE);
+    verdict = GSM_RESTART_GIVE_UP;
+  } else if (n_exits == 1) {
+    verdict = GSM_RESTART_NOW;
+  } else {
+    *delay = MIN((guint)RESTART_MIN_BACKOFF << (n_exits - 2),
+                 RESTART_MAX_BACKOFF);
+    g_debug("GsmRestartHistory: %s exited %u times, restarting it in %u ms",
+            app_id, (guint)n_exits, *delay);
+    verdict = GSM_RESTART_LATER;
+  }
+
+  set_exits(app_id, exits, n_exits);
+  g_key_file_set_int64(history, app_id, RESTART_KEY_NEXT_RESTART,
+                       now + (gint64)*delay * 1000);
+  history_save();
+
+  g_free(exits);
+
+  return verdict;
+}
+
+/* Returns how many times @app_id exited within the window, in how many
+ * milliseconds it will be restarted and whether it will not be anymore */
+void gsm_restart_history_get_state(const char *app_id, guint *n_exits,
+                                   guint *delay, gboolean *given_up) {
+  gint64 now;
+  gint64 *exits;
+  gint64 next_restart;
+  gsize n;
+
+  g_return_if_fail(app_id != NULL);
+
+  history_load();
+
+  now = g_get_real_time();
+  exits = get_exits(app_id, now, &n);
+  g_free(exits);
+
+  next_restart = g_key_file_get_int64(history, app_id,
+                                      RESTART_KEY_NEXT_RESTART, NULL);
+
+  *n_exits = (guint)n;
+  *delay = next_restart > now ? (guint)((next_restart - now) / 1000) : 0;
+  *given_up =
+      g_key_file_get_boolean(history, app_id, RESTART_KEY_GIVEN_UP, NULL);
+}
@@ -25,66 +25,648 @@
 
 #include "gsm-session-save.h"
 
+#include <X11/Xatom.h>
+#include <X11/Xlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <gdk/gdkx.h>
 #include <glib.h>
 #include <glib/gstdio.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "gsm-autostart-app.h"
 #include "gsm-client.h"
+#include "gsm-discard-executor.h"
+#include "gsm-metrics.h"
 #include "gsm-util.h"
 
-static gboolean gsm_session_clear_saved_session(const char *directory,
-                                                GHashTable *discard_hash);
+/* What was last written for every file of the saved session, so that
+ * saving again only rewrites the clients that changed and only discards
+ * the state of the ones that went away.
+ */
+typedef struct {
+  char *checksum; /* of the file without its restore priority */
+  int priority;   /* restore priority as of the last save */
+  char *discard_exec;
+  GVariant *info; /* parsed app, as stored in the packed session */
+} SavedEntry;
+
+/* Besides the directory with one desktop file per client, the session
+ * is also written as a single packed file next to it, which holds the
+ * parsed app of every client and can be mapped at login without reading
+ * the desktop files. It is only used while the directory has not been
+ * modified since it was written. */
+#define PACK_MAGIC 0x4d535353 /* "MSSS" */
+#define PACK_VERSION 3
+#define PACK_ENTRY_TYPE "(ssv)"
+#define PACK_TYPE "(uuxa" PACK_ENTRY_TYPE ")"
+
+/* The files of the clients that did not change are not rewritten, so the
+ * restore priority they hold is only the one of the save that wrote them.
+ * The priorities of every save are written to a small key file next to
+ * the saved session, which overrides them. */
+#define PRIORITIES_GROUP "Restore Priorities"
+
+static GHashTable *saved_entries = NULL; /* filename -> SavedEntry */
 
+/* A save in progress. Clients are saved on the main thread as soon as
+ * they are done saving their own state, and the files that changed are
+ * written by a worker thread meanwhile. */
 typedef struct {
-  char *dir;
+  const char *dir;
+  GHashTable *entries;
   GHashTable *discard_hash;
-  GError **error;
-} SessionSaveData;
+  GHashTable *saved_clients; /* ids of the clients saved so far */
+  GHashTable *priorities;    /* SM client id -> restore priority */
+  GThreadPool *writer;
+  GMutex mutex;
+  GError *error; /* first error; protected by mutex */
+  gint n_written;
+  gint n_bytes; /* written by the worker thread */
+  gint64 started;
+} SessionSave;
+
+typedef struct {
+  char *path;
+  char *contents;
+  gsize length;
+} WriteJob;
+
+static SessionSave *current_save = NULL;
+
+/* Between two saves, checkpoints of the clients are appended to a
+ * journal next to the saved session, which is replayed at the next login
+ * if the session did not end with a save. Every record is a little
+ * endian 32 bit length followed by a (operation, file name, contents)
+ * GVariant, and a truncated last record is ignored. */
+#define JOURNAL_RECORD_TYPE "(sss)"
+#define JOURNAL_SAVE "save"
+#define JOURNAL_REMOVE "remove"
+
+static int journal_fd = -1;
+static GHashTable *journaled = NULL; /* filename -> checksum, "" if removed */
+
+static void saved_entry_free(SavedEntry *entry) {
+  g_free(entry->checksum);
+  gsm_util_intern_release(entry->discard_exec);
+  if (entry->info != NULL) {
+    g_variant_unref(entry->info);
+  }
+  g_slice_free(SavedEntry, entry);
+}
+
+/* Checksums @keyfile without its restore priority, which follows the
+ * stacking order and so changes all the time even when the client does
+ * not; the key is removed from @keyfile. */
+static char *compute_checksum(GKeyFile *keyfile) {
+  char *contents;
+  gsize length;
+  char *checksum;
+
+  g_key_file_remove_key(keyfile, G_KEY_FILE_DESKTOP_GROUP,
+                        GSM_AUTOSTART_APP_RESTORE_PRIORITY_KEY, NULL);
+
+  contents = g_key_file_to_data(keyfile, &length, NULL);
+  checksum = g_compute_checksum_for_data(G_CHECKSUM_SHA1,
+                                         (const guchar *)contents, length);
+  g_free(contents);
+
+  return checksum;
+}
+
+/* Takes ownership of @checksum */
+static SavedEntry *saved_entry_new(char *checksum, int priority,
+                                   GKeyFile *keyfile) {
+  SavedEntry *entry;
+
+  entry = g_slice_new0(SavedEntry);
+  entry->checksum = checksum;
+  entry->priority = priority;
+  if (keyfile != NULL) {
+    char *discard_exec;
+
+    discard_exec = g_key_file_get_string(
+        keyfile, G_KEY_FILE_DESKTOP_GROUP, GSM_AUTOSTART_APP_DISCARD_KEY, NULL);
+    entry->discard_exec = gsm_util_intern(discard_exec);
+    g_free(discard_exec);
+  }
+
+  return entry;
+}
+
+static GHashTable *saved_entries_new(void) {
+  return g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                               (GDestroyNotify)saved_entry_free);
+}
+
+static char *get_pack_filename(const char *directory) {
+  return g_strconcat(directory, ".pack", NULL);
+}
+
+static char *get_priorities_filename(const char *directory) {
+  return g_strconcat(directory, ".priorities", NULL);
+}
+
+static gint64 get_dir_mtime(const char *directory) {
+  GStatBuf st;
+
+  if (g_stat(directory, &st) != 0) {
+    return -1;
+  }
+
+  return (gint64)st.st_mtim.tv_sec * G_USEC_PER_SEC +
+         st.st_mtim.tv_nsec / 1000;
+}
+
+/* Returns the apps of the packed session, as an array of (file name,
+ * checksum, GsmAutostartApp info), or NULL if the session has to be read
+ * from its directory. */
+GVariant *gsm_session_read_packed(const char *directory) {
+  char *filename;
+  GMappedFile *file;
+  GBytes *bytes;
+  GVariant *root;
+  GVariant *entries = NULL;
+  guint32 magic;
+  guint32 version;
+  gint64 mtime;
+
+  filename = get_pack_filename(directory);
+  file = g_mapped_file_new(filename, FALSE, NULL);
+  g_free(filename);
+
+  if (file == NULL) {
+    return NULL;
+  }
+
+  bytes = g_mapped_file_get_bytes(file);
+  g_mapped_file_unref(file);
+
+  root = g_variant_new_from_bytes(G_VARIANT_TYPE(PACK_TYPE), bytes, FALSE);
+  g_variant_ref_sink(root);
+  g_bytes_unref(bytes);
+
+  g_variant_get(root, "(uux@a" PACK_ENTRY_TYPE ")", &magic, &version, &mtime,
+                &entries);
+
+  if (magic != PACK_MAGIC || version != PACK_VERSION ||
+      mtime != get_dir_mtime(directory)) {
+    g_debug("GsmSessionSave: packed session is missing or stale");
+    g_variant_unref(entries);
+    entries = NULL;
+  }
+
+  g_variant_unref(root);
+
+  return entries;
+}
+
+/* Returns the size of the pack, or 0 if it could not be written */
+static gsize write_pack(const char *directory, GHashTable *entries) {
+  GVariantBuilder builder;
+  GHashTableIter iter;
+  gpointer key;
+  gpointer value;
+  GVariant *root;
+  char *filename;
+  GError *error = NULL;
+  gsize size;
+
+  g_variant_builder_init(&builder, G_VARIANT_TYPE("a" PACK_ENTRY_TYPE));
+
+  g_hash_table_iter_init(&iter, entries);
+  while (g_hash_table_iter_next(&iter, &key, &value)) {
+    SavedEntry *entry = value;
+
+    if (entry->info == NULL) {
+      char *path;
+      GsmApp *app;
+
+      path = g_build_filename(directory, key, NULL);
+      app = gsm_autostart_app_new(path, NULL);
+      g_free(path);
+
+      if (app == NULL) {
+        continue;
+      }
+
+      entry->info = g_variant_ref_sink(
+          gsm_autostart_app_serialize(GSM_AUTOSTART_APP(app)));
+      g_object_unref(app);
+    }
+
+    g_variant_builder_add(&builder, PACK_ENTRY_TYPE, key, entry->checksum,
+                          entry->info);
+  }
+
+  root = g_variant_new("(uux@a" PACK_ENTRY_TYPE ")", PACK_MAGIC, PACK_VERSION,
+                       get_dir_mtime(directory),
+                       g_variant_builder_end(&builder));
+  g_variant_ref_sink(root);
+
+  filename = get_pack_filename(directory);
+  size = g_variant_get_size(root);
+  if (!g_file_set_contents(filename, g_variant_get_data(root), size, &error)) {
+    g_warning("GsmSessionSave: Unable to write %s: %s", filename,
+              error->message);
+    g_error_free(error);
+    size = 0;
+  }
+
+  g_free(filename);
+  g_variant_unref(root);
+
+  return size;
+}
 
-static gboolean save_one_client(char *id, GObject *object,
-                                SessionSaveData *data) {
-  GsmClient *client;
+static void write_priorities(const char *directory, GHashTable *entries) {
+  GKeyFile *keyfile;
+  GHashTableIter iter;
+  gpointer key;
+  gpointer value;
+  char *filename;
+  char *contents;
+  gsize length;
+  GError *error = NULL;
+
+  keyfile = g_key_file_new();
+
+  g_hash_table_iter_init(&iter, entries);
+  while (g_hash_table_iter_next(&iter, &key, &value)) {
+    SavedEntry *entry = value;
+
+    g_key_file_set_integer(keyfile, PRIORITIES_GROUP, key, entry->priority);
+  }
+
+  contents = g_key_file_to_data(keyfile, &length, NULL);
+  filename = get_priorities_filename(directory);
+  if (!g_file_set_contents(filename, contents, length, &error)) {
+    g_warning("GsmSessionSave: Unable to write %s: %s", filename,
+              error->message);
+    g_error_free(error);
+  }
+
+  g_free(filename);
+  g_free(contents);
+  g_key_file_free(keyfile);
+}
+
+/* Returns the restore priorities of the last save, by file name */
+GHashTable *gsm_session_read_priorities(const char *directory) {
+  GHashTable *priorities;
+  GKeyFile *keyfile;
+  char *filename;
+  char **keys;
+  guint i;
+
+  priorities = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+  keyfile = g_key_file_new();
+  filename = get_priorities_filename(directory);
+  if (!g_key_file_load_from_file(keyfile, filename, G_KEY_FILE_NONE, NULL)) {
+    goto out;
+  }
+
+  keys = g_key_file_get_keys(keyfile, PRIORITIES_GROUP, NULL, NULL);
+  for (i = 0; keys != NULL && keys[i] != NULL; i++) {
+    int priority;
+
+    priority =
+        g_key_file_get_integer(keyfile, PRIORITIES_GROUP, keys[i], NULL);
+    g_hash_table_replace(priorities, g_strdup(keys[i]),
+                         GINT_TO_POINTER(MAX(priority, 0)));
+  }
+  g_strfreev(keys);
+
+out:
+  g_free(filename);
+  g_key_file_free(keyfile);
+
+  return priorities;
+}
+
+/* Reads what a previous login saved */
+static void load_saved_entries(const char *directory) {
+  GDir *dir;
+  const char *filename;
+  GVariant *pack;
+  GHashTable *packed_infos; /* filename -> (checksum, info) entry */
+  GHashTable *priorities;
+
+  saved_entries = saved_entries_new();
+  priorities = gsm_session_read_priorities(directory);
+
+  packed_infos = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                       (GDestroyNotify)g_variant_unref);
+  pack = gsm_session_read_packed(directory);
+  if (pack != NULL) {
+    GVariantIter iter;
+    GVariant *child;
+
+    g_variant_iter_init(&iter, pack);
+    while ((child = g_variant_iter_next_value(&iter))) {
+      const char *name;
+
+      g_variant_get_child(child, 0, "&s", &name);
+      g_hash_table_replace(packed_infos, (gpointer)name, child);
+    }
+  }
+
+  dir = g_dir_open(directory, 0, NULL);
+  if (dir == NULL) {
+    goto out;
+  }
+
+  while ((filename = g_dir_read_name(dir))) {
+    char *path;
+    char *contents;
+    gsize length;
+    GKeyFile *keyfile;
+    char *checksum;
+    int priority;
+    gpointer saved_priority;
+    SavedEntry *entry;
+    GVariant *packed;
+
+    path = g_build_filename(directory, filename, NULL);
+
+    if (g_file_get_contents(path, &contents, &length, NULL)) {
+      keyfile = g_key_file_new();
+      if (g_key_file_load_from_data(keyfile, contents, length,
+                                    G_KEY_FILE_NONE, NULL)) {
+        priority = g_key_file_get_integer(
+            keyfile, G_KEY_FILE_DESKTOP_GROUP,
+            GSM_AUTOSTART_APP_RESTORE_PRIORITY_KEY, NULL);
+        checksum = compute_checksum(keyfile);
+      } else {
+        g_key_file_free(keyfile);
+        keyfile = NULL;
+        priority = 0;
+        checksum = g_compute_checksum_for_data(
+            G_CHECKSUM_SHA1, (const guchar *)contents, length);
+      }
+
+      if (g_hash_table_lookup_extended(priorities, filename, NULL,
+                                       &saved_priority)) {
+        priority = GPOINTER_TO_INT(saved_priority);
+      }
+
+      entry = saved_entry_new(checksum, priority, keyfile);
+      g_hash_table_insert(saved_entries, g_strdup(filename), entry);
+
+      /* the parsed app stays valid as long as the file didn't change */
+      packed = g_hash_table_lookup(packed_infos, filename);
+      if (packed != NULL) {
+        const char *checksum;
+
+        g_variant_get_child(packed, 1, "&s", &checksum);
+        if (strcmp(checksum, entry->checksum) == 0) {
+          g_variant_get_child(packed, 2, "v", &entry->info);
+        }
+      }
+
+      if (keyfile != NULL) {
+        g_key_file_free(keyfile);
+      }
+      g_free(contents);
+    }
+
+    g_free(path);
+  }
+
+  g_dir_close(dir);
+
+out:
+  g_hash_table_destroy(priorities);
+  g_hash_table_destroy(packed_infos);
+  if (pack != NULL) {
+    g_variant_unref(pack);
+  }
+}
+
+static char *get_window_sm_client_id(Display *xdisplay, Window window) {
+  Atom leader_atom;
+  Atom sm_client_id_atom;
+  Atom type;
+  int format;
+  unsigned long n_items;
+  unsigned long bytes_after;
+  unsigned char *data = NULL;
+  Window leader = window;
+  char *ret = NULL;
+
+  leader_atom = XInternAtom(xdisplay, "WM_CLIENT_LEADER", False);
+  sm_client_id_atom = XInternAtom(xdisplay, "SM_CLIENT_ID", False);
+
+  if (XGetWindowProperty(xdisplay, window, leader_atom, 0, 1, False,
+                         XA_WINDOW, &type, &format, &n_items, &bytes_after,
+                         &data) == Success &&
+      data != NULL) {
+    if (type == XA_WINDOW && n_items == 1) {
+      leader = *(Window *)data;
+    }
+    XFree(data);
+    data = NULL;
+  }
+
+  if (XGetWindowProperty(xdisplay, leader, sm_client_id_atom, 0, 256, False,
+                         XA_STRING, &type, &format, &n_items, &bytes_after,
+                         &data) == Success &&
+      data != NULL) {
+    if (type == XA_STRING && format == 8) {
+      ret = g_strndup((const char *)data, n_items);
+    }
+    XFree(data);
+  }
+
+  return ret;
+}
+
+/* Ranks the clients by the stacking order of their windows, which is the
+ * order they were last used in: the topmost one gets the highest
+ * priority and is restored first at the next login. */
+static GHashTable *get_restore_priorities(void) {
+  GHashTable *priorities;
+  GdkDisplay *display;
+  Display *xdisplay;
+  Atom type;
+  int format;
+  unsigned long n_items;
+  unsigned long bytes_after;
+  unsigned char *data = NULL;
+
+  priorities = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+  display = gdk_display_get_default();
+  if (display == NULL || !GDK_IS_X11_DISPLAY(display)) {
+    return priorities;
+  }
+
+  xdisplay = GDK_DISPLAY_XDISPLAY(display);
+
+  gdk_x11_display_error_trap_push(display);
+
+  if (XGetWindowProperty(
+          xdisplay, DefaultRootWindow(xdisplay),
+          XInternAtom(xdisplay, "_NET_CLIENT_LIST_STACKING", False), 0,
+          G_MAXLONG, False, XA_WINDOW, &type, &format, &n_items, &bytes_after,
+          &data) == Success &&
+      data != NULL) {
+    Window *windows = (Window *)data;
+    unsigned long i;
+
+    /* bottom to top */
+    for (i = 0; i < n_items; i++) {
+      char *id;
+
+      id = get_window_sm_client_id(xdisplay, windows[i]);
+      if (id != NULL) {
+        g_hash_table_replace(priorities, id, GUINT_TO_POINTER(i + 1));
+      }
+    }
+
+    XFree(data);
+  }
+
+  gdk_x11_display_error_trap_pop_ignored(display);
+
+  return priorities;
+}
+
+static void set_error(SessionSave *save, GError *error) {
+  g_mutex_lock(&save->mutex);
+  if (save->error == NULL) {
+    save->error = error;
+  } else {
+    g_error_free(error);
+  }
+  g_mutex_unlock(&save->mutex);
+}
+
+static gboolean has_error(SessionSave *save) {
+  gboolean ret;
+
+  g_mutex_lock(&save->mutex);
+  ret = (save->error != NULL);
+  g_mutex_unlock(&save->mutex);
+
+  return ret;
+}
+
+/* Runs in the writer thread */
+static void write_job_run(WriteJob *job, SessionSave *save) {
+  GError *error = NULL;
+
+  if (g_file_set_contents(job->path, job->contents, job->length, &error)) {
+    g_atomic_int_inc(&save->n_written);
+    g_atomic_int_add(&save->n_bytes, (gint)job->length);
+    g_debug("GsmSessionSave: wrote %s", job->path);
+  } else {
+    set_error(save, error);
+  }
+
+  g_free(job->path);
+  g_free(job->contents);
+  g_slice_free(WriteJob, job);
+}
+
+/* Builds the saved file of @client, with @priority as its restore
+ * priority, and its checksum as compute_checksum() sees it; returns the
+ * key file, or NULL on errors */
+static GKeyFile *build_client_file(GsmClient *client, int priority,
+                                   char **contents, gsize *length,
+                                   char **checksum, GError **error) {
+  GKeyFile *keyfile;
+  GError *local_error = NULL;
+
+  keyfile = gsm_client_save(client, &local_error);
+  if (keyfile == NULL || local_error != NULL) {
+    goto error;
+  }
+
+  *checksum = compute_checksum(keyfile);
+
+  g_key_file_set_integer(keyfile, G_KEY_FILE_DESKTOP_GROUP,
+                         GSM_AUTOSTART_APP_RESTORE_PRIORITY_KEY, priority);
+
+  *contents = g_key_file_to_data(keyfile, length, &local_error);
+  if (local_error != NULL) {
+    g_free(*checksum);
+    *checksum = NULL;
+    goto error;
+  }
+
+  return keyfile;
+
+error:
+  if (keyfile != NULL) {
+    g_key_file_free(keyfile);
+  }
+  if (local_error != NULL) {
+    g_propagate_error(error, local_error);
+  }
+
+  return NULL;
+}
+
+static void save_one_client(SessionSave *save, GsmClient *client) {
   GKeyFile *keyfile;
-  char *path = NULL;
   char *filename = NULL;
   char *contents = NULL;
+  char *checksum = NULL;
   gsize length = 0;
-  char *discard_exec;
+  int priority;
+  SavedEntry *entry;
+  SavedEntry *old_entry;
+  WriteJob *job;
   GError *local_error;
 
-  client = GSM_CLIENT(object);
+  g_hash_table_add(save->saved_clients,
+                   gsm_util_intern(gsm_client_peek_id(client)));
 
   local_error = NULL;
 
-  keyfile = gsm_client_save(client, &local_error);
-
-  if (keyfile == NULL || local_error) {
-    goto out;
-  }
-
-  contents = g_key_file_to_data(keyfile, &length, &local_error);
+  priority = GPOINTER_TO_INT(g_hash_table_lookup(
+      save->priorities, gsm_client_peek_startup_id(client)));
 
-  if (local_error) {
+  keyfile = build_client_file(client, priority, &contents, &length, &checksum,
+                              &local_error);
+  if (keyfile == NULL) {
     goto out;
   }
 
   filename = g_strdup_printf("%s.desktop", gsm_client_peek_startup_id(client));
 
-  path = g_build_filename(data->dir, filename, NULL);
+  entry = saved_entry_new(checksum, priority, keyfile);
+  g_hash_table_replace(save->entries, g_strdup(filename), entry);
 
-  g_file_set_contents(path, contents, length, &local_error);
+  if (entry->discard_exec) {
+    g_hash_table_add(save->discard_hash,
+                     g_ref_string_acquire(entry->discard_exec));
+  }
 
-  if (local_error) {
+  old_entry = g_hash_table_lookup(saved_entries, filename);
+  if (old_entry != NULL && strcmp(old_entry->checksum, entry->checksum) == 0) {
+    g_debug("GsmSessionSave: client %s is unchanged",
+            gsm_client_peek_id(client));
+    /* the new priority only goes to the priorities file */
+    if (old_entry->info != NULL) {
+      entry->info = g_variant_ref(old_entry->info);
+    }
     goto out;
   }
 
-  discard_exec = g_key_file_get_string(keyfile, G_KEY_FILE_DESKTOP_GROUP,
-                                       GSM_AUTOSTART_APP_DISCARD_KEY, NULL);
-  if (discard_exec) {
-    g_hash_table_insert(data->discard_hash, discard_exec, discard_exec);
-  }
+  job = g_slice_new(WriteJob);
+  job->path = g_build_filename(save->dir, filename, NULL);
+  job->contents = contents;
+  job->length = length;
+  contents = NULL;
+
+  g_thread_pool_push(save->writer, job, NULL);
 
-  g_debug("GsmSessionSave: saved client %s to %s", id, filename);
+  g_debug("GsmSessionSave: saving client %s to %s", gsm_client_peek_id(client),
+          filename);
 
 out:
   if (keyfile != NULL) {
@@ -93,136 +675,444 @@ out:
 
   g_free(contents);
   g_free(filename);
-  g_free(path);
 
-  /* in case of any error, stop saving session */
   if (local_error) {
-    g_propagate_error(data->error, local_error);
-    g_error_free(local_error);
+    set_error(save, local_error);
+  }
+}
 
-    return TRUE;
+static gboolean save_remaining_client(char *id, GObject *object,
+                                      SessionSave *save) {
+  if (!g_hash_table_contains(save->saved_clients, id)) {
+    save_one_client(save, GSM_CLIENT(object));
   }
 
-  return FALSE;
+  /* in case of any error, stop saving session */
+  return has_error(save);
 }
 
-void gsm_session_save(GsmStore *client_store, GError **error) {
-  const char *save_dir;
-  char *tmp_dir;
-  SessionSaveData data;
+/* Drops the entries that are gone or were rewritten. A discard command
+ * is only run when no client of the new session still uses it.
+ */
+static void drop_old_entries(const char *directory, GHashTable *entries,
+                             GHashTable *discard_hash) {
+  GHashTableIter iter;
+  gpointer key;
+  gpointer value;
 
-  g_debug("GsmSessionSave: Saving session");
+  g_hash_table_iter_init(&iter, saved_entries);
+  while (g_hash_table_iter_next(&iter, &key, &value)) {
+    const char *filename = key;
+    SavedEntry *old_entry = value;
+    SavedEntry *entry;
+
+    entry = g_hash_table_lookup(entries, filename);
+    if (entry != NULL && strcmp(entry->checksum, old_entry->checksum) == 0) {
+      continue;
+    }
+
+    if (old_entry->discard_exec &&
+        !g_hash_table_contains(discard_hash, old_entry->discard_exec)) {
+      gsm_discard_executor_queue(old_entry->discard_exec);
+    }
+
+    if (entry == NULL) {
+      char *path;
+
+      g_debug("GsmSessionSave: removing '%s' from saved session", filename);
+
+      path = g_build_filename(directory, filename, NULL);
+      g_unlink(path);
+      g_free(path);
+    }
+  }
+}
+
+static char *get_journal_filename(const char *directory) {
+  return g_strconcat(directory, ".journal", NULL);
+}
+
+/* The saved session is up to date, so the journal is not needed anymore */
+static void reset_journal(const char *directory) {
+  char *filename;
+
+  if (journal_fd >= 0) {
+    close(journal_fd);
+    journal_fd = -1;
+  }
+
+  if (journaled != NULL) {
+    g_hash_table_destroy(journaled);
+    journaled = NULL;
+  }
+
+  filename = get_journal_filename(directory);
+  g_unlink(filename);
+  g_free(filename);
+}
+
+static void append_record(const char *directory, const char *operation,
+                          const char *filename, const char *contents) {
+  GVariant *record;
+  GByteArray *buffer;
+  guint32 length;
+  gsize written;
+
+  if (journal_fd < 0) {
+    char *path;
+
+    path = get_journal_filename(directory);
+    journal_fd =
+        g_open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (journal_fd < 0) {
+      g_warning("GsmSessionSave: Unable to open %s: %s", path,
+                g_strerror(errno));
+      g_free(path);
+      return;
+    }
+    g_free(path);
+  }
+
+  record = g_variant_new(JOURNAL_RECORD_TYPE, operation, filename, contents);
+  g_variant_ref_sink(record);
+
+  length = GUINT32_TO_LE(g_variant_get_size(record));
+  buffer = g_byte_array_new();
+  g_byte_array_append(buffer, (const guint8 *)&length, sizeof(length));
+  g_byte_array_append(buffer, g_variant_get_data(record),
+                      g_variant_get_size(record));
+
+  /* the whole record at once, so that a crash can only truncate it */
+  written = 0;
+  while (written < buffer->len) {
+    gssize n;
+
+    n = write(journal_fd, buffer->data + written, buffer->len - written);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      g_warning("GsmSessionSave: Unable to write to the journal: %s",
+                g_strerror(errno));
+      break;
+    }
+    written += n;
+  }
+
+  fdatasync(journal_fd);
+
+  g_byte_array_free(buffer, TRUE);
+  g_variant_unref(record);
+}
+
+static const char *lookup_checksum(const char *directory,
+                                   const char *filename) {
+  SavedEntry *entry;
+
+  if (journaled == NULL) {
+    journaled = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  }
+
+  if (g_hash_table_contains(journaled, filename)) {
+    return g_hash_table_lookup(journaled, filename);
+  }
+
+  if (saved_entries == NULL) {
+    load_saved_entries(directory);
+  }
+
+  entry = g_hash_table_lookup(saved_entries, filename);
+
+  return entry != NULL ? entry->checksum : "";
+}
+
+/* Records the current state of @client in the journal, if it changed */
+void gsm_session_journal_client(GsmClient *client) {
+  const char *save_dir;
+  GKeyFile *keyfile;
+  SavedEntry *entry;
+  char *contents = NULL;
+  gsize length;
+  char *checksum = NULL;
+  char *filename = NULL;
+  GError *error = NULL;
 
   save_dir = gsm_util_get_saved_session_dir();
-  if (save_dir == NULL) {
-    g_warning("GsmSessionSave: cannot create saved session directory");
+  if (save_dir == NULL || current_save != NULL) {
     return;
   }
 
-  tmp_dir = gsm_util_get_empty_tmp_session_dir();
-  if (tmp_dir == NULL) {
-    g_warning("GsmSessionSave: cannot create new saved session directory");
+  if (saved_entries == NULL) {
+    load_saved_entries(save_dir);
+  }
+
+  filename = g_strdup_printf("%s.desktop", gsm_client_peek_startup_id(client));
+
+  /* there is no stacking order between saves; keep the last priority */
+  entry = g_hash_table_lookup(saved_entries, filename);
+  keyfile = build_client_file(client, entry != NULL ? entry->priority : 0,
+                              &contents, &length, &checksum, &error);
+  if (keyfile == NULL) {
+    if (error != NULL) {
+      g_warning("GsmSessionSave: Unable to save client %s: %s",
+                gsm_client_peek_id(client), error->message);
+      g_error_free(error);
+    }
+    g_free(filename);
     return;
   }
+  g_key_file_free(keyfile);
 
-  /* save the session in a temp directory, and remember the discard
-   * commands */
-  data.dir = tmp_dir;
-  data.discard_hash =
-      g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
-  data.error = error;
+  if (strcmp(checksum, lookup_checksum(save_dir, filename)) != 0) {
+    g_debug("GsmSessionSave: journaling client %s",
+            gsm_client_peek_id(client));
+    append_record(save_dir, JOURNAL_SAVE, filename, contents);
+    g_hash_table_replace(journaled, filename, checksum);
+    filename = NULL;
+    checksum = NULL;
+  }
 
-  gsm_store_foreach(client_store, (GsmStoreFunc)save_one_client, &data);
+  g_free(checksum);
+  g_free(filename);
+  g_free(contents);
+}
 
-  if (!*error) {
-    /* remove the old saved session */
-    gsm_session_clear_saved_session(save_dir, data.discard_hash);
+/* Records in the journal that @client went away */
+void gsm_session_journal_remove(GsmClient *client) {
+  const char *save_dir;
+  char *filename;
 
-    /* rename the temp session dir */
-    if (g_file_test(save_dir, G_FILE_TEST_IS_DIR)) g_rmdir(save_dir);
-    g_rename(tmp_dir, save_dir);
+  save_dir = gsm_util_get_saved_session_dir();
+  if (save_dir == NULL || current_save != NULL) {
+    return;
+  }
+
+  filename = g_strdup_printf("%s.desktop", gsm_client_peek_startup_id(client));
+
+  if (*lookup_checksum(save_dir, filename) != '\0') {
+    g_debug("GsmSessionSave: journaling removal of client %s",
+            gsm_client_peek_id(client));
+    append_record(save_dir, JOURNAL_REMOVE, filename, "");
+    g_hash_table_replace(journaled, filename, g_strdup(""));
   } else {
-    g_warning("GsmSessionSave: error saving session: %s", (*error)->message);
-    /* FIXME: we should create a hash table filled with the discard
-     * commands that are in desktop files from save_dir. */
-    gsm_session_clear_saved_session(tmp_dir, NULL);
-    g_rmdir(tmp_dir);
+    g_free(filename);
+  }
+}
+
+static void replay_record(const char *directory, GVariant *record) {
+  const char *operation;
+  const char *filename;
+  const char *contents;
+  char *path;
+
+  g_variant_get(record, "(&s&s&s)", &operation, &filename, &contents);
+
+  if (strchr(filename, '/') != NULL ||
+      !g_str_has_suffix(filename, ".desktop")) {
+    return;
+  }
+
+  path = g_build_filename(directory, filename, NULL);
+
+  if (strcmp(operation, JOURNAL_SAVE) == 0) {
+    g_debug("GsmSessionSave: recovering %s", filename);
+    g_file_set_contents(path, contents, -1, NULL);
+  } else if (strcmp(operation, JOURNAL_REMOVE) == 0) {
+    g_debug("GsmSessionSave: recovering removal of %s", filename);
+    g_unlink(path);
   }
 
-  g_hash_table_destroy(data.discard_hash);
-  g_free(tmp_dir);
+  g_free(path);
 }
 
-static gboolean gsm_session_clear_one_client(const char *filename,
-                                             GHashTable *discard_hash) {
-  gboolean result = TRUE;
-  GKeyFile *key_file = NULL;
-  char *discard_exec = NULL;
+/* Applies the checkpoints of a session that ended without being saved,
+ * e.g. because of a crash, to the saved session */
+void gsm_session_journal_replay(void) {
+  const char *save_dir;
+  char *filename;
+  char *contents;
+  gsize length;
+  gsize offset;
 
-  g_debug("GsmSessionSave: removing '%s' from saved session", filename);
+  save_dir = gsm_util_get_saved_session_dir();
+  if (save_dir == NULL) {
+    return;
+  }
 
-  key_file = g_key_file_new();
-  if (g_key_file_load_from_file(key_file, filename, G_KEY_FILE_NONE, NULL)) {
-    char **argv;
-    int argc;
+  filename = get_journal_filename(save_dir);
 
-    discard_exec = g_key_file_get_string(key_file, G_KEY_FILE_DESKTOP_GROUP,
-                                         GSM_AUTOSTART_APP_DISCARD_KEY, NULL);
-    if (!discard_exec) goto out;
+  if (!g_file_get_contents(filename, &contents, &length, NULL)) {
+    g_free(filename);
+    return;
+  }
 
-    if (g_hash_table_lookup(discard_hash, discard_exec)) goto out;
+  g_debug("GsmSessionSave: replaying %s", filename);
 
-    if (!g_shell_parse_argv(discard_exec, &argc, &argv, NULL)) goto out;
+  offset = 0;
+  while (length - offset >= sizeof(guint32)) {
+    guint32 size;
+    GBytes *bytes;
+    GVariant *record;
 
-    result = g_spawn_async(NULL, argv, NULL, G_SPAWN_SEARCH_PATH, NULL, NULL,
-                           NULL, NULL) &&
-             result;
+    memcpy(&size, contents + offset, sizeof(size));
+    size = GUINT32_FROM_LE(size);
+    offset += sizeof(size);
 
-    g_strfreev(argv);
-  } else {
-    result = FALSE;
+    if (size > length - offset) {
+      g_debug("GsmSessionSave: ignoring truncated journal record");
+      break;
+    }
+
+    bytes = g_bytes_new(contents + offset, size);
+    record = g_variant_new_from_bytes(G_VARIANT_TYPE(JOURNAL_RECORD_TYPE),
+                                      bytes, FALSE);
+    g_variant_ref_sink(record);
+    replay_record(save_dir, record);
+    g_variant_unref(record);
+    g_bytes_unref(bytes);
+
+    offset += size;
   }
 
-out:
-  if (key_file) g_key_file_free(key_file);
-  if (discard_exec) g_free(discard_exec);
+  /* the saved session is now what the journal described */
+  g_unlink(filename);
+
+  g_free(contents);
+  g_free(filename);
+}
+
+/* Starts saving the session; clients can then be saved one by one with
+ * gsm_session_save_client() as they become ready, and gsm_session_save()
+ * saves the others and completes the save. */
+void gsm_session_save_begin(void) {
+  const char *save_dir;
+  SessionSave *save;
 
-  result = (g_unlink(filename) == 0) && result;
+  if (current_save != NULL) {
+    return;
+  }
 
-  return result;
+  save_dir = gsm_util_get_saved_session_dir();
+  if (save_dir == NULL) {
+    g_warning("GsmSessionSave: cannot create saved session directory");
+    return;
+  }
+
+  if (saved_entries == NULL) {
+    load_saved_entries(save_dir);
+  }
+
+  save = g_slice_new0(SessionSave);
+  save->dir = save_dir;
+  save->started = g_get_monotonic_time();
+  save->entries = saved_entries_new();
+  save->discard_hash =
+      g_hash_table_new_full(g_str_hash, gsm_util_intern_equal,
+                            (GDestroyNotify)gsm_util_intern_release, NULL);
+  save->saved_clients =
+      g_hash_table_new_full(g_str_hash, gsm_util_intern_equal,
+                            (GDestroyNotify)gsm_util_intern_release, NULL);
+  save->priorities = get_restore_priorities();
+  g_mutex_init(&save->mutex);
+  /* a single thread, so that the files are written in order */
+  save->writer =
+      g_thread_pool_new((GFunc)write_job_run, save, 1, FALSE, NULL);
+
+  current_save = save;
 }
 
-static gboolean gsm_session_clear_saved_session(const char *directory,
-                                                GHashTable *discard_hash) {
-  GDir *dir;
-  const char *filename;
-  gboolean result = TRUE;
-  GError *error;
+void gsm_session_save_client(GsmClient *client) {
+  if (current_save == NULL || has_error(current_save)) {
+    return;
+  }
+
+  save_one_client(current_save, client);
+}
+
+static SessionSave *end_save(void) {
+  SessionSave *save;
 
-  g_debug("GsmSessionSave: clearing currently saved session at %s", directory);
+  save = current_save;
+  current_save = NULL;
 
-  if (directory == NULL) {
-    return FALSE;
+  /* wait for the pending writes */
+  g_thread_pool_free(save->writer, FALSE, TRUE);
+
+  return save;
+}
+
+static void session_save_free(SessionSave *save) {
+  g_hash_table_destroy(save->entries);
+  g_hash_table_destroy(save->discard_hash);
+  g_hash_table_destroy(save->saved_clients);
+  g_hash_table_destroy(save->priorities);
+  g_mutex_clear(&save->mutex);
+  if (save->error != NULL) {
+    g_error_free(save->error);
   }
+  g_slice_free(SessionSave, save);
+}
 
-  error = NULL;
-  dir = g_dir_open(directory, 0, &error);
-  if (error) {
-    g_warning("GsmSessionSave: error loading saved session directory: %s",
-              error->message);
-    g_error_free(error);
-    return FALSE;
+/* Drops a save that was begun, e.g. because the logout was cancelled */
+void gsm_session_save_abort(void) {
+  SessionSave *save;
+
+  if (current_save == NULL) {
+    return;
   }
 
-  while ((filename = g_dir_read_name(dir))) {
-    char *path = g_build_filename(directory, filename, NULL);
+  save = end_save();
+  session_save_free(save);
+
+  /* some entries may have been rewritten already */
+  g_hash_table_destroy(saved_entries);
+  saved_entries = NULL;
+}
 
-    result = gsm_session_clear_one_client(path, discard_hash) && result;
+void gsm_session_save(GsmStore *client_store, GError **error) {
+  SessionSave *save;
 
-    g_free(path);
+  g_debug("GsmSessionSave: Saving session");
+
+  gsm_session_save_begin();
+  if (current_save == NULL) {
+    return;
   }
 
-  g_dir_close(dir);
+  /* the clients that did not save their state in time are saved with
+   * the properties they last set */
+  gsm_store_foreach(client_store, (GsmStoreFunc)save_remaining_client,
+                    current_save);
+
+  save = end_save();
+
+  if (save->error == NULL) {
+    drop_old_entries(save->dir, save->entries, save->discard_hash);
+
+    g_debug("GsmSessionSave: wrote %d of %u clients", save->n_written,
+            g_hash_table_size(save->entries));
+
+    save->n_bytes += (gint)write_pack(save->dir, save->entries);
+    write_priorities(save->dir, save->entries);
+    reset_journal(save->dir);
+
+    gsm_metrics_observe(GSM_METRIC_SESSION_SAVE_DURATION,
+                        g_get_monotonic_time() - save->started);
+    gsm_metrics_observe(GSM_METRIC_SESSION_SAVE_BYTES, save->n_bytes);
+
+    g_hash_table_destroy(saved_entries);
+    saved_entries = save->entries;
+    save->entries = saved_entries_new();
+  } else {
+    g_warning("GsmSessionSave: error saving session: %s",
+              save->error->message);
+    g_propagate_error(error, save->error);
+    save->error = NULL;
+    /* Some entries may have been rewritten already, the old ones are
+     * left in place; read the directory again on the next save */
+    g_hash_table_destroy(saved_entries);
+    saved_entries = NULL;
+  }
 
-  return result;
+  session_save_free(save);
 }
@@ -23,12 +23,23 @@
 
 #include <glib.h>
 
+#include "gsm-client.h"
 #include "gsm-store.h"
 
 G_BEGIN_DECLS
 
+void gsm_session_save_begin(void);
+void gsm_session_save_client(GsmClient *client);
+void gsm_session_save_abort(void);
 void gsm_session_save(GsmStore *client_store, GError **error);
 
+GVariant *gsm_session_read_packed(const char *directory);
+GHashTable *gsm_session_read_priorities(const char *directory);
+
+void gsm_session_journal_client(GsmClient *client);
+void gsm_session_journal_remove(GsmClient *client);
+void gsm_session_journal_replay(void);
+
 G_END_DECLS
 
 #endif /* __GSM_SESSION_SAVE_H__ */
@@ -0,0 +1,156 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gsm-settings.h"
+
+#include <gio/gio.h>
+#include <glib.h>
+
+/* All the settings the session manager reads go through one GSettings
+ * object per schema, created once, and the values that were read are
+ * kept until they change, so that reading them again does not have to
+ * look them up in the backend.
+ *
+ * The cache is invalidated from a "changed" handler that is connected
+ * before anybody else can connect to the objects, so the handlers of the
+ * callers already see the new values.
+ */
+typedef struct {
+  const char *id;
+  gboolean optional;
+} SchemaInfo;
+
+static const SchemaInfo schemas[GSM_SETTINGS_N_SCHEMAS] = {
+    [GSM_SETTINGS_SESSION] = {"org.mate.session", FALSE},
+    [GSM_SETTINGS_REQUIRED_COMPONENTS] =
+        {"org.mate.session.required-components", FALSE},
+    [GSM_SETTINGS_LOCKDOWN] = {"org.mate.lockdown", FALSE},
+    [GSM_SETTINGS_INTERFACE] = {"org.mate.interface", FALSE},
+    [GSM_SETTINGS_VISUAL] = {"org.mate.applications-at-visual", FALSE},
+    [GSM_SETTINGS_MOBILITY] = {"org.mate.applications-at-mobility", FALSE},
+    [GSM_SETTINGS_DEBUG] = {"org.mate.debug", TRUE},
+};
+
+static gboolean initialized = FALSE;
+static GSettings *settings[GSM_SETTINGS_N_SCHEMAS];
+static GHashTable *values[GSM_SETTINGS_N_SCHEMAS]; /* key -> GVariant */
+
+static void on_changed(GSettings *object, const char *key, gpointer data) {
+  g_hash_table_remove(values[GPOINTER_TO_INT(data)], key);
+}
+
+static gboolean schema_exists(const char *id) {
+  GSettingsSchema *schema;
+
+  schema = g_settings_schema_source_lookup(
+      g_settings_schema_source_get_default(), id, TRUE);
+  if (schema == NULL) {
+    return FALSE;
+  }
+
+  g_settings_schema_unref(schema);
+
+  return TRUE;
+}
+
+void gsm_settings_init(void) {
+  int i;
+
+  if (initialized) {
+    return;
+  }
+
+  initialized = TRUE;
+
+  for (i = 0; i < GSM_SETTINGS_N_SCHEMAS; i++) {
+    if (schemas[i].optional && !schema_exists(schemas[i].id)) {
+      g_debug("GsmSettings: %s is not installed", schemas[i].id);
+      continue;
+    }
+
+    settings[i] = g_settings_new(schemas[i].id);
+    values[i] = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                      (GDestroyNotify)g_variant_unref);
+    g_signal_connect(settings[i], "changed", G_CALLBACK(on_changed),
+                     GINT_TO_POINTER(i));
+  }
+}
+
+/* Returns the shared object for @schema, or NULL for an optional schema
+ * that is not installed */
+GSettings *gsm_settings_get(GsmSettingsSchema schema) {
+  g_return_val_if_fail(schema < GSM_SETTINGS_N_SCHEMAS, NULL);
+
+  gsm_settings_init();
+
+  return settings[schema];
+}
+
+static GVariant *get_value(GsmSettingsSchema schema, const char *key) {
+  GVariant *value;
+
+  if (gsm_settings_get(schema) == NULL) {
+    return NULL;
+  }
+
+  value = g_hash_table_lookup(values[schema], key);
+  if (value == NULL) {
+    value = g_settings_get_value(settings[schema], key);
+    g_hash_table_insert(values[schema], g_strdup(key), value);
+  }
+
+  return value;
+}
+
+gboolean gsm_settings_get_boolean(GsmSettingsSchema schema, const char *key) {
+  GVariant *value;
+
+  value = get_value(schema, key);
+
+  return value != NULL ? g_variant_get_boolean(value) : FALSE;
+}
+
+int gsm_settings_get_int(GsmSettingsSchema schema, const char *key) {
+  GVariant *value;
+
+  value = get_value(schema, key);
+
+  return value != NULL ? g_variant_get_int32(value) : 0;
+}
+
+char *gsm_settings_get_string(GsmSettingsSchema schema, const char *key) {
+  GVariant *value;
+
+  value = get_value(schema, key);
+
+  return value != NULL ? g_variant_dup_string(value, NULL) : NULL;
+}
+
+char **gsm_settings_get_strv(GsmSettingsSchema schema, const char *key) {
+  GVariant *value;
+
+  value = get_value(schema, key);
+
+  return value != NULL ? g_variant_dup_strv(value, NULL) : g_new0(char *, 1);
+}
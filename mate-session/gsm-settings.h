@@ -0,0 +1,50 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifndef __GSM_SETTINGS_H__
+#define __GSM_SETTINGS_H__
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+  GSM_SETTINGS_SESSION = 0,
+  GSM_SETTINGS_REQUIRED_COMPONENTS,
+  GSM_SETTINGS_LOCKDOWN,
+  GSM_SETTINGS_INTERFACE,
+  GSM_SETTINGS_VISUAL,
+  GSM_SETTINGS_MOBILITY,
+  GSM_SETTINGS_DEBUG, /* optional */
+  GSM_SETTINGS_N_SCHEMAS
+} GsmSettingsSchema;
+
+void gsm_settings_init(void);
+
+GSettings *gsm_settings_get(GsmSettingsSchema schema);
+
+gboolean gsm_settings_get_boolean(GsmSettingsSchema schema, const char *key);
+int gsm_settings_get_int(GsmSettingsSchema schema, const char *key);
+char *gsm_settings_get_string(GsmSettingsSchema schema, const char *key);
+char **gsm_settings_get_strv(GsmSettingsSchema schema, const char *key);
+
+G_END_DECLS
+
+#endif /* __GSM_SETTINGS_H__ */
@@ -0,0 +1,657 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gsm-spawn-helper.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <glib-unix.h>
+#include <glib.h>
+
+/* Forking mate-session once GTK, X11 and D-Bus are set up is expensive,
+ * so a small helper is forked first thing in main() and spawns the apps
+ * for us. Since the apps are the helper's children, the helper reaps
+ * them and reports their wait status, which we turn back into child
+ * watches.
+ *
+ * Requests are a guint32 size followed by a "(s^as^asb)" GVariant holding
+ * the working directory ("" for none), argv (with argv[0] a full path),
+ * envp and whether the child is to be stopped before it runs anything.
+ * Replies are HelperReply structs; a stopped child has stopped by the
+ * time its SPAWNED reply is sent, so a SIGCONT cannot get lost.
+ *
+ * Should the helper die, its children are reparented and their wait
+ * status is lost; they are then polled for until they are gone.
+ */
+#define SPAWN_REQUEST_TYPE "(s^as^asb)"
+
+enum { HELPER_REPLY_SPAWNED, HELPER_REPLY_EXITED };
+
+typedef struct {
+  guint32 type;
+  gint32 pid;
+  gint32 value; /* errno for SPAWNED, wait status for EXITED */
+} HelperReply;
+
+typedef struct {
+  GSource source;
+  GPid pid;
+  gint status;
+} ChildExitSource;
+
+static int helper_fd = -1;
+static GHashTable *exit_statuses = NULL; /* pid -> status, not watched yet */
+static GHashTable *exit_sources = NULL;  /* pid -> ChildExitSource */
+static GHashTable *children = NULL;      /* spawned pids not reported exited */
+static guint orphans_id = 0;
+
+static int sigchld_pipe[2] = {-1, -1};
+
+static gboolean read_all(int fd, gpointer buf, gsize len) {
+  gsize done = 0;
+
+  while (done < len) {
+    ssize_t n;
+
+    n = read(fd, (char *)buf + done, len - done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return FALSE;
+    }
+    done += n;
+  }
+
+  return TRUE;
+}
+
+static gboolean write_all(int fd, gconstpointer buf, gsize len) {
+  gsize done = 0;
+
+  while (done < len) {
+    ssize_t n;
+
+    n = write(fd, (const char *)buf + done, len - done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return FALSE;
+    }
+    done += n;
+  }
+
+  return TRUE;
+}
+
+/* Helper side */
+
+static void on_sigchld(int signo) {
+  int saved_errno = errno;
+  char c = 0;
+
+  if (write(sigchld_pipe[1], &c, 1) < 0) {
+    /* the pipe is full, which is as good */
+  }
+
+  errno = saved_errno;
+}
+
+static int helper_spawn(const char *cwd, char **argv, char **envp,
+                        gboolean stopped, pid_t *pid) {
+  posix_spawnattr_t attr;
+  sigset_t mask;
+  int res;
+
+  if (cwd == NULL && !stopped) {
+    posix_spawnattr_init(&attr);
+
+    sigemptyset(&mask);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attr, &mask);
+    posix_spawnattr_setflags(&attr,
+                             POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+
+    res = posix_spawn(pid, argv[0], NULL, &attr, argv, envp);
+
+    posix_spawnattr_destroy(&attr);
+
+    return res;
+  } else {
+    int err_pipe[2];
+    int err = 0;
+
+    /* posix_spawn cannot change directory portably, nor stop the child */
+    if (pipe2(err_pipe, O_CLOEXEC) < 0) {
+      return errno;
+    }
+
+    *pid = fork();
+    if (*pid < 0) {
+      err = errno;
+      close(err_pipe[0]);
+      close(err_pipe[1]);
+      return err;
+    }
+
+    if (*pid == 0) {
+      signal(SIGCHLD, SIG_DFL);
+      signal(SIGPIPE, SIG_DFL);
+      sigemptyset(&mask);
+      sigprocmask(SIG_SETMASK, &mask, NULL);
+
+      if (cwd == NULL || chdir(cwd) == 0) {
+        /* Errors of execve() after this only show as exit status 127 */
+        if (stopped) {
+          raise(SIGSTOP);
+        }
+        execve(argv[0], argv, envp);
+      }
+
+      err = errno;
+      write_all(err_pipe[1], &err, sizeof(err));
+      _exit(127);
+    }
+
+    close(err_pipe[1]);
+
+    if (stopped) {
+      int status = 0;
+
+      /* Either stopped, or already failed to change directory */
+      while (waitpid(*pid, &status, WUNTRACED) < 0 && errno == EINTR) {
+        continue;
+      }
+      if (WIFSTOPPED(status)) {
+        close(err_pipe[0]);
+        return 0;
+      }
+      if (!read_all(err_pipe[0], &err, sizeof(err))) {
+        err = ECHILD;
+      }
+      close(err_pipe[0]);
+      return err;
+    }
+
+    if (!read_all(err_pipe[0], &err, sizeof(err))) {
+      err = 0;
+    }
+    close(err_pipe[0]);
+
+    if (err != 0) {
+      waitpid(*pid, NULL, 0);
+    }
+
+    return err;
+  }
+}
+
+static gboolean helper_handle_request(int fd) {
+  guint32 size;
+  gpointer data;
+  GVariant *request;
+  const char *cwd;
+  const char **argv;
+  const char **envp;
+  gboolean stopped;
+  HelperReply reply;
+  pid_t pid = -1;
+
+  if (!read_all(fd, &size, sizeof(size))) {
+    return FALSE;
+  }
+
+  data = g_malloc(size);
+  if (!read_all(fd, data, size)) {
+    g_free(data);
+    return FALSE;
+  }
+
+  request = g_variant_new_from_data(G_VARIANT_TYPE(SPAWN_REQUEST_TYPE), data,
+                                    size, FALSE, g_free, data);
+  g_variant_ref_sink(request);
+  g_variant_get(request, "(&s^a&s^a&sb)", &cwd, &argv, &envp, &stopped);
+
+  if (argv[0] == NULL) {
+    reply.value = EINVAL;
+  } else {
+    reply.value = helper_spawn(cwd[0] != '\0' ? cwd : NULL, (char **)argv,
+                               (char **)envp, stopped, &pid);
+  }
+
+  reply.type = HELPER_REPLY_SPAWNED;
+  reply.pid = pid;
+
+  g_free(argv);
+  g_free(envp);
+  g_variant_unref(request);
+
+  return write_all(fd, &reply, sizeof(reply));
+}
+
+static gboolean helper_reap_children(int fd) {
+  HelperReply reply;
+  char buf[64];
+  pid_t pid;
+  int status;
+
+  while (read(sigchld_pipe[0], buf, sizeof(buf)) > 0) {
+    /* drain */
+  }
+
+  while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+    reply.type = HELPER_REPLY_EXITED;
+    reply.pid = pid;
+    reply.value = status;
+
+    if (!write_all(fd, &reply, sizeof(reply))) {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+/* The helper has all of mate-session's file descriptors at the time it
+ * was forked, including a passed XSMP socket, which the apps must not
+ * inherit. */
+static void close_inherited_fds(int keep_fd) {
+  DIR *dir;
+  GArray *fds;
+  struct dirent *entry;
+  guint i;
+
+  dir = opendir("/proc/self/fd");
+  if (dir == NULL) {
+    long max_fd;
+    int fd;
+
+    max_fd = sysconf(_SC_OPEN_MAX);
+    if (max_fd < 0) {
+      max_fd = 1024;
+    }
+    for (fd = 3; fd < max_fd; fd++) {
+      if (fd != keep_fd) {
+        close(fd);
+      }
+    }
+    return;
+  }
+
+  /* not closed while the directory is being read */
+  fds = g_array_new(FALSE, FALSE, sizeof(int));
+  while ((entry = readdir(dir)) != NULL) {
+    char *end;
+    gint64 fd;
+
+    fd = g_ascii_strtoll(entry->d_name, &end, 10);
+    if (*end == '\0' && end != entry->d_name && fd > 2 && fd != keep_fd &&
+        fd != dirfd(dir)) {
+      int n = (int)fd;
+
+      g_array_append_val(fds, n);
+    }
+  }
+  closedir(dir);
+
+  for (i = 0; i < fds->len; i++) {
+    close(g_array_index(fds, int, i));
+  }
+  g_array_free(fds, TRUE);
+}
+
+static void helper_main(int fd) {
+  struct sigaction sa;
+
+  close_inherited_fds(fd);
+
+  if (pipe2(sigchld_pipe, O_CLOEXEC | O_NONBLOCK) < 0) {
+    _exit(1);
+  }
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_sigchld;
+  sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGCHLD, &sa, NULL);
+
+  for (;;) {
+    struct pollfd fds[2];
+
+    fds[0].fd = fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = sigchld_pipe[0];
+    fds[1].events = POLLIN;
+
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+
+    /* Always report a spawn before the exit of that child */
+    if (fds[0].revents & POLLIN) {
+      if (!helper_handle_request(fd)) {
+        break;
+      }
+    } else if (fds[0].revents & (POLLHUP | POLLERR)) {
+      /* mate-session went away */
+      break;
+    }
+
+    if (fds[1].revents & POLLIN) {
+      if (!helper_reap_children(fd)) {
+        break;
+      }
+    }
+  }
+
+  _exit(0);
+}
+
+/* Session side */
+
+static gboolean child_exit_source_dispatch(GSource *source,
+                                           GSourceFunc callback,
+                                           gpointer user_data) {
+  ChildExitSource *exit_source = (ChildExitSource *)source;
+
+  g_source_set_ready_time(source, -1);
+
+  if (callback != NULL) {
+    ((GChildWatchFunc)callback)(exit_source->pid, exit_source->status,
+                                user_data);
+  }
+
+  return G_SOURCE_REMOVE;
+}
+
+static void child_exit_source_finalize(GSource *source) {
+  ChildExitSource *exit_source = (ChildExitSource *)source;
+
+  if (exit_sources != NULL &&
+      g_hash_table_lookup(exit_sources, GINT_TO_POINTER(exit_source->pid)) ==
+          source) {
+    g_hash_table_remove(exit_sources, GINT_TO_POINTER(exit_source->pid));
+  }
+}
+
+static GSourceFuncs child_exit_source_funcs = {
+    NULL, NULL, child_exit_source_dispatch, child_exit_source_finalize};
+
+static void child_exited(GPid pid, gint status) {
+  ChildExitSource *exit_source;
+
+  g_hash_table_remove(children, GINT_TO_POINTER(pid));
+
+  exit_source = g_hash_table_lookup(exit_sources, GINT_TO_POINTER(pid));
+  if (exit_source != NULL) {
+    exit_source->status = status;
+    g_source_set_ready_time((GSource *)exit_source, 0);
+  } else {
+    g_hash_table_insert(exit_statuses, GINT_TO_POINTER(pid),
+                        GINT_TO_POINTER(status));
+  }
+}
+
+/* Reports the children of the dead helper as they go away. Their exit
+ * status is lost, so they are reported as having exited normally. */
+static gboolean poll_orphans(gpointer data) {
+  GHashTableIter iter;
+  gpointer key;
+  GSList *gone = NULL;
+  GSList *l;
+
+  g_hash_table_iter_init(&iter, children);
+  while (g_hash_table_iter_next(&iter, &key, NULL)) {
+    if (kill(GPOINTER_TO_INT(key), 0) < 0 && errno == ESRCH) {
+      gone = g_slist_prepend(gone, key);
+    }
+  }
+
+  for (l = gone; l != NULL; l = l->next) {
+    child_exited(GPOINTER_TO_INT(l->data), 0);
+  }
+  g_slist_free(gone);
+
+  if (g_hash_table_size(children) == 0) {
+    orphans_id = 0;
+    return G_SOURCE_REMOVE;
+  }
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void stop_helper(void) {
+  g_warning("GsmSpawnHelper: Lost the spawn helper, spawning directly");
+
+  close(helper_fd);
+  helper_fd = -1;
+
+  if (g_hash_table_size(children) > 0 && orphans_id == 0) {
+    g_debug("GsmSpawnHelper: watching %u orphaned children",
+            g_hash_table_size(children));
+    poll_orphans(NULL);
+    if (g_hash_table_size(children) > 0) {
+      orphans_id = g_timeout_add_seconds(1, poll_orphans, NULL);
+    }
+  }
+}
+
+static gboolean read_reply(HelperReply *reply) {
+  if (!read_all(helper_fd, reply, sizeof(*reply))) {
+    stop_helper();
+    return FALSE;
+  }
+
+  if (reply->type == HELPER_REPLY_EXITED) {
+    child_exited(reply->pid, reply->value);
+  }
+
+  return TRUE;
+}
+
+static gboolean on_helper_readable(gint fd, GIOCondition condition,
+                                   gpointer data) {
+  HelperReply reply;
+
+  if (helper_fd < 0) {
+    return G_SOURCE_REMOVE;
+  }
+
+  if (!read_reply(&reply)) {
+    return G_SOURCE_REMOVE;
+  }
+
+  if (reply.type != HELPER_REPLY_EXITED) {
+    g_warning("GsmSpawnHelper: Unexpected reply %u", reply.type);
+  }
+
+  return G_SOURCE_CONTINUE;
+}
+
+/* Forks the spawn helper. Must be called before threads are started and
+ * before anything big is loaded. */
+void gsm_spawn_helper_start(void) {
+  int fds[2];
+  pid_t pid;
+
+  if (helper_fd >= 0) {
+    return;
+  }
+
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+    g_warning("GsmSpawnHelper: Unable to create socket: %s",
+              g_strerror(errno));
+    return;
+  }
+
+  pid = fork();
+  if (pid < 0) {
+    g_warning("GsmSpawnHelper: Unable to fork: %s", g_strerror(errno));
+    close(fds[0]);
+    close(fds[1]);
+    return;
+  }
+
+  if (pid == 0) {
+    close(fds[0]);
+    helper_main(fds[1]);
+  }
+
+  close(fds[1]);
+  helper_fd = fds[0];
+
+  exit_statuses = g_hash_table_new(NULL, NULL);
+  exit_sources = g_hash_table_new(NULL, NULL);
+  children = g_hash_table_new(NULL, NULL);
+
+  g_unix_fd_add(helper_fd, G_IO_IN | G_IO_HUP | G_IO_ERR, on_helper_readable,
+                NULL);
+}
+
+gboolean gsm_spawn_helper_is_running(void) {
+  return helper_fd >= 0;
+}
+
+/* Spawns @argv through the helper, searching for argv[0] in our own PATH.
+ * The child can only be watched with gsm_spawn_helper_child_watch_add().
+ * With @stopped the child is stopped before it runs anything of its own,
+ * and is left for the caller to continue with SIGCONT. */
+gboolean gsm_spawn_helper_spawn(const char *working_directory, char **argv,
+                                char **envp, gboolean stopped,
+                                GPid *child_pid, GError **error) {
+  GVariant *request;
+  char *program;
+  char **real_argv;
+  guint32 size;
+  HelperReply reply;
+
+  g_return_val_if_fail(argv != NULL && argv[0] != NULL, FALSE);
+
+  if (helper_fd < 0) {
+    g_set_error(error, G_SPAWN_ERROR, G_SPAWN_ERROR_FAILED,
+                "The spawn helper is not running");
+    return FALSE;
+  }
+
+  program = g_find_program_in_path(argv[0]);
+  if (program == NULL) {
+    g_set_error(error, G_SPAWN_ERROR, G_SPAWN_ERROR_NOENT,
+                "Failed to execute child process \"%s\" (%s)", argv[0],
+                g_strerror(ENOENT));
+    return FALSE;
+  }
+
+  real_argv = g_strdupv(argv);
+  g_free(real_argv[0]);
+  real_argv[0] = program;
+
+  request = g_variant_new(SPAWN_REQUEST_TYPE,
+                          working_directory != NULL ? working_directory : "",
+                          real_argv, envp, stopped);
+  g_variant_ref_sink(request);
+  g_strfreev(real_argv);
+
+  size = g_variant_get_size(request);
+  if (!write_all(helper_fd, &size, sizeof(size)) ||
+      !write_all(helper_fd, g_variant_get_data(request), size)) {
+    g_variant_unref(request);
+    stop_helper();
+    g_set_error(error, G_SPAWN_ERROR, G_SPAWN_ERROR_FAILED,
+                "Unable to talk to the spawn helper");
+    return FALSE;
+  }
+
+  g_variant_unref(request);
+
+  do {
+    if (!read_reply(&reply)) {
+      g_set_error(error, G_SPAWN_ERROR, G_SPAWN_ERROR_FAILED,
+                  "Unable to talk to the spawn helper");
+      return FALSE;
+    }
+  } while (reply.type != HELPER_REPLY_SPAWNED);
+
+  if (reply.value != 0) {
+    g_set_error(error, G_SPAWN_ERROR, G_SPAWN_ERROR_FAILED,
+                "Failed to execute child process \"%s\" (%s)", argv[0],
+                g_strerror(reply.value));
+    return FALSE;
+  }
+
+  /* An exit we got for an earlier child with the same pid is stale */
+  g_hash_table_remove(exit_statuses, GINT_TO_POINTER(reply.pid));
+  g_hash_table_add(children, GINT_TO_POINTER(reply.pid));
+
+  *child_pid = reply.pid;
+
+  return TRUE;
+}
+
+/* Like g_child_watch_add(), for children of the helper. The returned id
+ * can be removed with g_source_remove(). */
+guint gsm_spawn_helper_child_watch_add(GPid pid, GChildWatchFunc function,
+                                       gpointer data) {
+  GSource *source;
+  ChildExitSource *exit_source;
+  gpointer status;
+  guint id;
+
+  g_return_val_if_fail(exit_sources != NULL, 0);
+
+  source = g_source_new(&child_exit_source_funcs, sizeof(ChildExitSource));
+  exit_source = (ChildExitSource *)source;
+  exit_source->pid = pid;
+
+  g_source_set_callback(source, (GSourceFunc)function, data, NULL);
+
+  g_hash_table_insert(exit_sources, GINT_TO_POINTER(pid), source);
+
+  if (g_hash_table_lookup_extended(exit_statuses, GINT_TO_POINTER(pid), NULL,
+                                   &status)) {
+    g_hash_table_remove(exit_statuses, GINT_TO_POINTER(pid));
+    exit_source->status = GPOINTER_TO_INT(status);
+    g_source_set_ready_time(source, 0);
+  }
+
+  id = g_source_attach(source, NULL);
+  g_source_unref(source);
+
+  return id;
+}
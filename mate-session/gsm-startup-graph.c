@@ -0,0 +1,376 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gsm-startup-graph.h"
+
+#include <glib-object.h>
+#include <glib.h>
+
+/* Every app is a node that can be started once all the nodes it depends
+ * on are resolved, i.e. registered, exited, failed to start or timed out.
+ *
+ * An app with an X-MATE-Autostart-After key depends on the apps that
+ * provide one of the listed services or have one of the listed app ids.
+ * Any other app depends on all the apps of the earlier phases, which is
+ * what the phase barriers did.
+ */
+
+typedef struct {
+  GsmApp *app;
+  GsmManagerPhase phase;
+  GPtrArray *dependents;
+  guint n_deps;
+  gboolean use_after;
+  gboolean started;
+  gboolean waiting;
+  gboolean resolved;
+} StartupNode;
+
+struct _GsmStartupGraph {
+  GPtrArray *nodes;
+  GHashTable *nodes_by_app;
+  GsmStartupGraphStartFunc start_func;
+  GsmStartupGraphNotifyFunc notify_func;
+  gpointer user_data;
+};
+
+static void start_node(GsmStartupGraph *graph, StartupNode *node);
+
+static void startup_node_free(StartupNode *node) {
+  g_ptr_array_free(node->dependents, TRUE);
+  g_object_unref(node->app);
+  g_slice_free(StartupNode, node);
+}
+
+GsmStartupGraph *gsm_startup_graph_new(GsmStartupGraphStartFunc start_func,
+                                       GsmStartupGraphNotifyFunc notify_func,
+                                       gpointer user_data) {
+  GsmStartupGraph *graph;
+
+  graph = g_slice_new0(GsmStartupGraph);
+  graph->nodes = g_ptr_array_new_with_free_func(
+      (GDestroyNotify)startup_node_free);
+  graph->nodes_by_app = g_hash_table_new(NULL, NULL);
+  graph->start_func = start_func;
+  graph->notify_func = notify_func;
+  graph->user_data = user_data;
+
+  return graph;
+}
+
+static void on_app_done(GsmApp *app, GsmStartupGraph *graph);
+
+void gsm_startup_graph_free(GsmStartupGraph *graph) {
+  guint i;
+
+  for (i = 0; i < graph->nodes->len; i++) {
+    StartupNode *node = g_ptr_array_index(graph->nodes, i);
+
+    if (node->waiting) {
+      g_signal_handlers_disconnect_by_func(node->app, on_app_done, graph);
+    }
+  }
+
+  g_hash_table_destroy(graph->nodes_by_app);
+  g_ptr_array_free(graph->nodes, TRUE);
+  g_slice_free(GsmStartupGraph, graph);
+}
+
+void gsm_startup_graph_add_app(GsmStartupGraph *graph, GsmApp *app) {
+  StartupNode *node;
+
+  if (g_hash_table_contains(graph->nodes_by_app, app)) {
+    return;
+  }
+
+  node = g_slice_new0(StartupNode);
+  node->app = g_object_ref(app);
+  node->phase = gsm_app_peek_phase(app);
+  node->dependents = g_ptr_array_new();
+  node->use_after = (gsm_app_peek_after(app) != NULL);
+
+  g_ptr_array_add(graph->nodes, node);
+  g_hash_table_insert(graph->nodes_by_app, app, node);
+}
+
+static void add_edge(StartupNode *prerequisite, StartupNode *node) {
+  if (prerequisite == node) {
+    return;
+  }
+
+  g_ptr_array_add(prerequisite->dependents, node);
+  node->n_deps++;
+}
+
+static void add_after_edges(GsmStartupGraph *graph, StartupNode *node) {
+  const char *const *after;
+  guint i;
+  guint j;
+
+  after = gsm_app_peek_after(node->app);
+
+  for (i = 0; after[i] != NULL; i++) {
+    gboolean found = FALSE;
+
+    for (j = 0; j < graph->nodes->len; j++) {
+      StartupNode *other = g_ptr_array_index(graph->nodes, j);
+
+      if (gsm_app_provides(other->app, after[i]) ||
+          g_strcmp0(gsm_app_peek_app_id(other->app), after[i]) == 0) {
+        add_edge(other, node);
+        found = TRUE;
+      }
+    }
+
+    if (!found) {
+      g_debug("GsmStartupGraph: nothing to wait for for '%s' of %s", after[i],
+              gsm_app_peek_app_id(node->app));
+    }
+  }
+}
+
+static void add_phase_edges(GsmStartupGraph *graph, StartupNode *node) {
+  guint i;
+
+  for (i = 0; i < graph->nodes->len; i++) {
+    StartupNode *other = g_ptr_array_index(graph->nodes, i);
+
+    if (other->phase < node->phase) {
+      add_edge(other, node);
+    }
+  }
+}
+
+static void build_edges(GsmStartupGraph *graph) {
+  guint i;
+
+  for (i = 0; i < graph->nodes->len; i++) {
+    StartupNode *node = g_ptr_array_index(graph->nodes, i);
+
+    g_ptr_array_set_size(node->dependents, 0);
+    node->n_deps = 0;
+  }
+
+  for (i = 0; i < graph->nodes->len; i++) {
+    StartupNode *node = g_ptr_array_index(graph->nodes, i);
+
+    if (node->use_after) {
+      add_after_edges(graph, node);
+    } else {
+      add_phase_edges(graph, node);
+    }
+  }
+}
+
+/* Falls back to phase ordering for every app that is part of, or
+ * depends on, a dependency cycle. Phase edges always point to a later
+ * phase, so this is enough to break all cycles. */
+static gboolean break_cycles(GsmStartupGraph *graph) {
+  GHashTable *n_deps;
+  GQueue queue = G_QUEUE_INIT;
+  gboolean found_cycle = FALSE;
+  guint i;
+
+  n_deps = g_hash_table_new(NULL, NULL);
+
+  for (i = 0; i < graph->nodes->len; i++) {
+    StartupNode *node = g_ptr_array_index(graph->nodes, i);
+
+    g_hash_table_insert(n_deps, node, GUINT_TO_POINTER(node->n_deps));
+    if (node->n_deps == 0) {
+      g_queue_push_tail(&queue, node);
+    }
+  }
+
+  while (!g_queue_is_empty(&queue)) {
+    StartupNode *node = g_queue_pop_head(&queue);
+
+    for (i = 0; i < node->dependents->len; i++) {
+      StartupNode *dependent = g_ptr_array_index(node->dependents, i);
+      guint left;
+
+      left = GPOINTER_TO_UINT(g_hash_table_lookup(n_deps, dependent)) - 1;
+      g_hash_table_insert(n_deps, dependent, GUINT_TO_POINTER(left));
+      if (left == 0) {
+        g_queue_push_tail(&queue, dependent);
+      }
+    }
+  }
+
+  for (i = 0; i < graph->nodes->len; i++) {
+    StartupNode *node = g_ptr_array_index(graph->nodes, i);
+
+    if (GPOINTER_TO_UINT(g_hash_table_lookup(n_deps, node)) > 0) {
+      g_warning("Dependency cycle involving '%s', starting it by phase",
+                gsm_app_peek_app_id(node->app));
+      node->use_after = FALSE;
+      found_cycle = TRUE;
+    }
+  }
+
+  g_hash_table_destroy(n_deps);
+
+  return found_cycle;
+}
+
+static void resolve_node(GsmStartupGraph *graph, StartupNode *node) {
+  guint i;
+
+  if (node->resolved) {
+    return;
+  }
+
+  node->resolved = TRUE;
+
+  if (node->waiting) {
+    g_signal_handlers_disconnect_by_func(node->app, on_app_done, graph);
+    node->waiting = FALSE;
+  }
+
+  for (i = 0; i < node->dependents->len; i++) {
+    StartupNode *dependent = g_ptr_array_index(node->dependents, i);
+
+    dependent->n_deps--;
+    if (dependent->n_deps == 0 && !dependent->started) {
+      start_node(graph, dependent);
+    }
+  }
+}
+
+static void on_app_done(GsmApp *app, GsmStartupGraph *graph) {
+  StartupNode *node;
+
+  node = g_hash_table_lookup(graph->nodes_by_app, app);
+  if (node == NULL) {
+    return;
+  }
+
+  g_debug("GsmStartupGraph: %s is up", gsm_app_peek_app_id(app));
+
+  resolve_node(graph, node);
+
+  if (graph->notify_func != NULL) {
+    graph->notify_func(graph->user_data);
+  }
+}
+
+static void start_node(GsmStartupGraph *graph, StartupNode *node) {
+  gboolean launched;
+
+  node->started = TRUE;
+
+  launched = graph->start_func(node->app, graph->user_data);
+
+  /* Like with phase barriers, applications are not waited for unless
+   * something explicitly depends on them */
+  if (launched && (node->phase < GSM_MANAGER_PHASE_APPLICATION ||
+                   node->dependents->len > 0)) {
+    node->waiting = TRUE;
+    g_signal_connect(node->app, "exited", G_CALLBACK(on_app_done), graph);
+    g_signal_connect(node->app, "registered", G_CALLBACK(on_app_done), graph);
+  } else {
+    resolve_node(graph, node);
+  }
+}
+
+void gsm_startup_graph_run(GsmStartupGraph *graph) {
+  guint i;
+
+  build_edges(graph);
+  if (break_cycles(graph)) {
+    build_edges(graph);
+  }
+
+  for (i = 0; i < graph->nodes->len; i++) {
+    StartupNode *node = g_ptr_array_index(graph->nodes, i);
+
+    if (!node->started && node->n_deps == 0) {
+      start_node(graph, node);
+    }
+  }
+}
+
+/* The apps of @phase and earlier are either up, or, for the application
+ * phase which is never waited for, at least started */
+gboolean gsm_startup_graph_phase_is_done(GsmStartupGraph *graph,
+                                         GsmManagerPhase phase) {
+  guint i;
+
+  for (i = 0; i < graph->nodes->len; i++) {
+    StartupNode *node = g_ptr_array_index(graph->nodes, i);
+
+    if (node->phase > phase) {
+      continue;
+    }
+
+    if (node->phase < GSM_MANAGER_PHASE_APPLICATION ? !node->resolved
+                                                    : !node->started) {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+/* Stops waiting for @app even though it did not register yet */
+void gsm_startup_graph_expire_app(GsmStartupGraph *graph, GsmApp *app) {
+  StartupNode *node;
+
+  node = g_hash_table_lookup(graph->nodes_by_app, app);
+  if (node == NULL || !node->started || node->resolved) {
+    return;
+  }
+
+  resolve_node(graph, node);
+
+  if (graph->notify_func != NULL) {
+    graph->notify_func(graph->user_data);
+  }
+}
+
+void gsm_startup_graph_expire_phase(GsmStartupGraph *graph,
+                                    GsmManagerPhase phase) {
+  guint i;
+
+  for (i = 0; i < graph->nodes->len; i++) {
+    StartupNode *node = g_ptr_array_index(graph->nodes, i);
+
+    if (node->phase > phase || node->resolved) {
+      continue;
+    }
+
+    if (!node->started) {
+      g_warning("Starting '%s' without waiting for its dependencies",
+                gsm_app_peek_app_id(node->app));
+      start_node(graph, node);
+    }
+
+    if (node->waiting) {
+      g_warning("Application '%s' failed to register before timeout",
+                gsm_app_peek_app_id(node->app));
+    }
+
+    resolve_node(graph, node);
+  }
+}
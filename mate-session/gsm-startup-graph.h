@@ -0,0 +1,54 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifndef __GSM_STARTUP_GRAPH_H__
+#define __GSM_STARTUP_GRAPH_H__
+
+#include <glib.h>
+
+#include "gsm-app.h"
+
+G_BEGIN_DECLS
+
+typedef struct _GsmStartupGraph GsmStartupGraph;
+
+/* Starts @app; returns TRUE if it was launched right away and its
+ * registration can be waited for */
+typedef gboolean (*GsmStartupGraphStartFunc)(GsmApp *app, gpointer user_data);
+/* Called whenever an app registered or exited */
+typedef void (*GsmStartupGraphNotifyFunc)(gpointer user_data);
+
+GsmStartupGraph *gsm_startup_graph_new(GsmStartupGraphStartFunc start_func,
+                                       GsmStartupGraphNotifyFunc notify_func,
+                                       gpointer user_data);
+void gsm_startup_graph_free(GsmStartupGraph *graph);
+
+void gsm_startup_graph_add_app(GsmStartupGraph *graph, GsmApp *app);
+void gsm_startup_graph_run(GsmStartupGraph *graph);
+
+gboolean gsm_startup_graph_phase_is_done(GsmStartupGraph *graph,
+                                         GsmManagerPhase phase);
+void gsm_startup_graph_expire_app(GsmStartupGraph *graph, GsmApp *app);
+void gsm_startup_graph_expire_phase(GsmStartupGraph *graph,
+                                    GsmManagerPhase phase);
+
+G_END_DECLS
+
+#endif /* __GSM_STARTUP_GRAPH_H__ */
@@ -0,0 +1,262 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gsm-startup-history.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+/* For every app we remember how long it took from being spawned to
+ * registering with us during the last few logins, in milliseconds, and
+ * how long it took to answer whether the session can end at the last few
+ * logouts. The history is a key file with one group per app id.
+ */
+#define HISTORY_KEY_LATENCIES "Latencies"
+#define HISTORY_KEY_QUERY_LATENCIES "QueryLatencies"
+#define HISTORY_KEY_QUERY_TIMEOUTS "QueryTimeouts"
+#define HISTORY_MAX_SAMPLES 20
+/* Never give up on an app sooner than this, in milliseconds */
+#define HISTORY_MIN_DEADLINE 3000
+
+static GKeyFile *history = NULL;
+static gboolean history_dirty = FALSE;
+
+static char *get_history_filename(void) {
+  return g_build_filename(g_get_user_cache_dir(), "mate-session",
+                          "startup-history", NULL);
+}
+
+static void history_load(void) {
+  char *filename;
+  GError *error;
+
+  if (history != NULL) {
+    return;
+  }
+
+  history = g_key_file_new();
+
+  filename = get_history_filename();
+
+  error = NULL;
+  if (!g_key_file_load_from_file(history, filename, G_KEY_FILE_NONE, &error)) {
+    g_debug("GsmStartupHistory: Unable to load %s: %s", filename,
+            error->message);
+    g_error_free(error);
+  }
+
+  g_free(filename);
+}
+
+static gint append_sample(const char *app_id, const char *key,
+                          gint64 latency) {
+  gint *samples;
+  gint *new_samples;
+  gsize n_samples;
+  gsize skip;
+  gint sample;
+
+  samples = g_key_file_get_integer_list(history, app_id, key, &n_samples, NULL);
+  if (samples == NULL) {
+    n_samples = 0;
+  }
+
+  /* Keep the HISTORY_MAX_SAMPLES most recent samples */
+  skip = (n_samples >= HISTORY_MAX_SAMPLES) ? n_samples - HISTORY_MAX_SAMPLES + 1
+                                            : 0;
+
+  new_samples = g_new(gint, n_samples - skip + 1);
+  if (n_samples > skip) {
+    memcpy(new_samples, samples + skip, (n_samples - skip) * sizeof(gint));
+  }
+  new_samples[n_samples - skip] = (gint)CLAMP(latency / 1000, 0, G_MAXINT);
+
+  g_key_file_set_integer_list(history, app_id, key, new_samples,
+                              n_samples - skip + 1);
+  sample = new_samples[n_samples - skip];
+
+  history_dirty = TRUE;
+
+  g_free(new_samples);
+  g_free(samples);
+
+  return sample;
+}
+
+/* Records that @app_id registered @latency microseconds after being
+ * spawned */
+void gsm_startup_history_record(const char *app_id, gint64 latency) {
+  gint sample;
+
+  g_return_if_fail(app_id != NULL);
+
+  history_load();
+
+  sample = append_sample(app_id, HISTORY_KEY_LATENCIES, latency);
+
+  g_debug("GsmStartupHistory: %s registered after %d ms", app_id, sample);
+}
+
+/* Records that @app_id answered a query-end-session @latency microseconds
+ * after it was sent, or did not answer it in time if @latency is
+ * negative */
+void gsm_startup_history_record_query(const char *app_id, gint64 latency) {
+  gint sample;
+
+  g_return_if_fail(app_id != NULL);
+
+  history_load();
+
+  if (latency < 0) {
+    g_key_file_set_integer(
+        history, app_id, HISTORY_KEY_QUERY_TIMEOUTS,
+        g_key_file_get_integer(history, app_id, HISTORY_KEY_QUERY_TIMEOUTS,
+                               NULL) +
+            1);
+    history_dirty = TRUE;
+    return;
+  }
+
+  sample = append_sample(app_id, HISTORY_KEY_QUERY_LATENCIES, latency);
+
+  g_debug("GsmStartupHistory: %s answered the end of session query after "
+          "%d ms",
+          app_id, sample);
+}
+
+/* Returns how many end of session queries @app_id failed to answer in
+ * time */
+guint gsm_startup_history_get_query_timeouts(const char *app_id) {
+  g_return_val_if_fail(app_id != NULL, 0);
+
+  history_load();
+
+  return MAX(g_key_file_get_integer(history, app_id, HISTORY_KEY_QUERY_TIMEOUTS,
+                                    NULL),
+             0);
+}
+
+static int compare_samples(gconstpointer a, gconstpointer b) {
+  return *(const gint *)a - *(const gint *)b;
+}
+
+/* Returns how long to wait, in milliseconds, for @app_id to register
+ * before not waiting for it anymore: twice the 99th percentile of its
+ * recorded latencies, at most @ceiling seconds. Returns 0 if nothing is
+ * known about @app_id. */
+guint gsm_startup_history_get_deadline(const char *app_id, guint ceiling) {
+  gint *samples;
+  gsize n_samples;
+  guint64 deadline;
+
+  g_return_val_if_fail(app_id != NULL, 0);
+
+  history_load();
+
+  samples = g_key_file_get_integer_list(history, app_id, HISTORY_KEY_LATENCIES,
+                                        &n_samples, NULL);
+  if (samples == NULL) {
+    return 0;
+  }
+
+  if (n_samples == 0) {
+    g_free(samples);
+    return 0;
+  }
+
+  qsort(samples, n_samples, sizeof(gint), compare_samples);
+
+  deadline = (guint64)MAX(samples[(n_samples * 99 + 99) / 100 - 1], 0) * 2;
+  deadline = CLAMP(deadline, HISTORY_MIN_DEADLINE, (guint64)ceiling * 1000);
+
+  g_free(samples);
+
+  return (guint)deadline;
+}
+
+void gsm_startup_history_save(void) {
+  char *filename;
+  char *dirname;
+  char *contents;
+  gsize length;
+  GError *error;
+
+  if (history == NULL || !history_dirty) {
+    return;
+  }
+
+  history_dirty = FALSE;
+
+  filename = get_history_filename();
+  dirname = g_path_get_dirname(filename);
+  contents = g_key_file_to_data(history, &length, NULL);
+
+  error = NULL;
+  if (g_mkdir_with_parents(dirname, 0700) != 0) {
+    g_warning("GsmStartupHistory: Unable to create %s", dirname);
+  } else if (!g_file_set_contents(filename, contents, length, &error)) {
+    g_warning("GsmStartupHistory: Unable to write %s: %s", filename,
+              error->message);
+    g_error_free(error);
+  } else {
+    g_debug("GsmStartupHistory: Wrote %s", filename);
+  }
+
+  g_free(contents);
+  g_free(dirname);
+  g_free(filename);
+}
+
+/* Returns the median of the recorded latencies of @app_id, in
+ * milliseconds, or 0 if nothing is known about it. */
+guint gsm_startup_history_get_latency(const char *app_id) {
+  gint *samples;
+  gsize n_samples;
+  guint latency;
+
+  g_return_val_if_fail(app_id != NULL, 0);
+
+  history_load();
+
+  samples = g_key_file_get_integer_list(history, app_id, HISTORY_KEY_LATENCIES,
+                                        &n_samples, NULL);
+  if (samples == NULL) {
+    return 0;
+  }
+
+  if (n_samples == 0) {
+    g_free(samples);
+    return 0;
+  }
+
+  qsort(samples, n_samples, sizeof(gint), compare_samples);
+  latency = (guint)MAX(samples[n_samples / 2], 0);
+
+  g_free(samples);
+
+  return latency;
+}
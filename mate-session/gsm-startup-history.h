@@ -0,0 +1,40 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+
+#ifndef __GSM_STARTUP_HISTORY_H__
+#define __GSM_STARTUP_HISTORY_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+void gsm_startup_history_record(const char *app_id, gint64 latency);
+guint gsm_startup_history_get_deadline(const char *app_id, guint ceiling);
+guint gsm_startup_history_get_latency(const char *app_id);
+
+void gsm_startup_history_record_query(const char *app_id, gint64 latency);
+guint gsm_startup_history_get_query_timeouts(const char *app_id);
+
+void gsm_startup_history_save(void);
+
+G_END_DECLS
+
+#endif /* __GSM_STARTUP_HISTORY_H__ */
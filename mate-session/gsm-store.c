@@ -34,11 +34,21 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "gsm-util.h"
+
 typedef struct {
   GHashTable *objects;
+  GHashTable *indexes;
   gboolean locked;
 } GsmStorePrivate;
 
+typedef struct {
+  char *property;
+  GsmStoreIndexFunc func;
+  GHashTable *objects_by_key; /* interned key -> GSList of objects */
+  GHashTable *keys_by_object; /* object -> interned keys */
+} GsmStoreIndex;
+
 enum { ADDED, REMOVED, LAST_SIGNAL };
 
 enum { PROP_0, PROP_LOCKED };
@@ -58,6 +68,132 @@ GQuark gsm_store_error_quark(void) {
   return ret;
 }
 
+static GsmStoreIndex *gsm_store_index_new(const char *property,
+                                          GsmStoreIndexFunc func) {
+  GsmStoreIndex *idx;
+
+  idx = g_slice_new0(GsmStoreIndex);
+  idx->property = g_strdup(property);
+  idx->func = func;
+  idx->objects_by_key =
+      g_hash_table_new_full(g_str_hash, gsm_util_intern_equal,
+                            (GDestroyNotify)gsm_util_intern_release, NULL);
+  idx->keys_by_object = g_hash_table_new_full(
+      NULL, NULL, NULL, (GDestroyNotify)gsm_util_intern_freev);
+
+  return idx;
+}
+
+static void gsm_store_index_free(GsmStoreIndex *idx) {
+  GHashTableIter iter;
+  gpointer list;
+
+  g_hash_table_iter_init(&iter, idx->objects_by_key);
+  while (g_hash_table_iter_next(&iter, NULL, &list)) {
+    g_slist_free(list);
+  }
+
+  g_hash_table_destroy(idx->objects_by_key);
+  g_hash_table_destroy(idx->keys_by_object);
+  g_free(idx->property);
+  g_slice_free(GsmStoreIndex, idx);
+}
+
+static void index_object(GsmStoreIndex *idx, GObject *object) {
+  char **keys;
+  guint i;
+
+  keys = idx->func(object);
+  if (keys == NULL) {
+    return;
+  }
+
+  g_hash_table_insert(idx->keys_by_object, object, keys);
+
+  for (i = 0; keys[i] != NULL; i++) {
+    GSList *list;
+
+    list = g_hash_table_lookup(idx->objects_by_key, keys[i]);
+    list = g_slist_append(list, object);
+    g_hash_table_replace(idx->objects_by_key, g_ref_string_acquire(keys[i]),
+                         list);
+  }
+}
+
+static void unindex_object(GsmStoreIndex *idx, GObject *object) {
+  char **keys;
+  guint i;
+
+  keys = g_hash_table_lookup(idx->keys_by_object, object);
+  if (keys == NULL) {
+    return;
+  }
+
+  for (i = 0; keys[i] != NULL; i++) {
+    GSList *list;
+
+    list = g_hash_table_lookup(idx->objects_by_key, keys[i]);
+    list = g_slist_remove(list, object);
+    if (list != NULL) {
+      g_hash_table_replace(idx->objects_by_key,
+                           g_ref_string_acquire(keys[i]), list);
+    } else {
+      g_hash_table_remove(idx->objects_by_key, keys[i]);
+    }
+  }
+
+  g_hash_table_remove(idx->keys_by_object, object);
+}
+
+static void on_object_notify(GObject *object, GParamSpec *pspec,
+                             GsmStore *store) {
+  GHashTableIter iter;
+  gpointer value;
+  GsmStorePrivate *priv;
+
+  priv = gsm_store_get_instance_private(store);
+
+  g_hash_table_iter_init(&iter, priv->indexes);
+  while (g_hash_table_iter_next(&iter, NULL, &value)) {
+    GsmStoreIndex *idx = value;
+
+    if (idx->property != NULL && strcmp(idx->property, pspec->name) == 0) {
+      unindex_object(idx, object);
+      index_object(idx, object);
+    }
+  }
+}
+
+static void store_index_object(GsmStore *store, GObject *object) {
+  GHashTableIter iter;
+  gpointer idx;
+  GsmStorePrivate *priv;
+
+  priv = gsm_store_get_instance_private(store);
+
+  g_hash_table_iter_init(&iter, priv->indexes);
+  while (g_hash_table_iter_next(&iter, NULL, &idx)) {
+    index_object(idx, object);
+  }
+
+  g_signal_connect(object, "notify", G_CALLBACK(on_object_notify), store);
+}
+
+static void store_unindex_object(GsmStore *store, GObject *object) {
+  GHashTableIter iter;
+  gpointer idx;
+  GsmStorePrivate *priv;
+
+  priv = gsm_store_get_instance_private(store);
+
+  g_signal_handlers_disconnect_by_func(object, on_object_notify, store);
+
+  g_hash_table_iter_init(&iter, priv->indexes);
+  while (g_hash_table_iter_next(&iter, NULL, &idx)) {
+    unindex_object(idx, object);
+  }
+}
+
 guint gsm_store_size(GsmStore *store) {
   GsmStorePrivate *priv;
   priv = gsm_store_get_instance_private(store);
@@ -78,17 +214,19 @@ gboolean gsm_store_remove(GsmStore *store, const char *id) {
     return FALSE;
   }
 
-  id_copy = g_strdup(id);
+  id_copy = gsm_util_intern(id);
 
   g_object_ref(found);
 
+  store_unindex_object(store, found);
+
   removed = g_hash_table_remove(priv->objects, id_copy);
   g_assert(removed);
 
   g_signal_emit(store, signals[REMOVED], 0, id_copy);
 
   g_object_unref(found);
-  g_free(id_copy);
+  gsm_util_intern_release(id_copy);
 
   return TRUE;
 }
@@ -141,7 +279,9 @@ static gboolean foreach_remove_wrapper(const char *id, GObject *object,
 
   res = (data->func)(id, object, data->user_data);
   if (res) {
-    data->removed = g_list_prepend(data->removed, g_strdup(id));
+    store_unindex_object(data->store, object);
+    data->removed =
+        g_list_prepend(data->removed, g_ref_string_acquire((char *)id));
   }
 
   return res;
@@ -170,7 +310,7 @@ guint gsm_store_foreach_remove(GsmStore *store, GsmStoreFunc func,
     id = data.removed->data;
     g_debug("GsmStore: emitting removed for %s", id);
     g_signal_emit(store, signals[REMOVED], 0, id);
-    g_free(data.removed->data);
+    gsm_util_intern_release(data.removed->data);
     data.removed->data = NULL;
     data.removed = g_list_delete_link(data.removed, data.removed);
   }
@@ -191,6 +331,7 @@ void gsm_store_clear(GsmStore *store) {
 }
 
 gboolean gsm_store_add(GsmStore *store, const char *id, GObject *object) {
+  GObject *old;
   GsmStorePrivate *priv;
   g_return_val_if_fail(store != NULL, FALSE);
   g_return_val_if_fail(id != NULL, FALSE);
@@ -206,13 +347,93 @@ gboolean gsm_store_add(GsmStore *store, const char *id, GObject *object) {
 
   g_debug("GsmStore: Adding object id %s to store", id);
 
-  g_hash_table_insert(priv->objects, g_strdup(id), g_object_ref(object));
+  old = g_hash_table_lookup(priv->objects, id);
+  if (old != NULL) {
+    store_unindex_object(store, old);
+  }
+
+  g_hash_table_insert(priv->objects, gsm_util_intern(id),
+                      g_object_ref(object));
+  store_index_object(store, object);
 
   g_signal_emit(store, signals[ADDED], 0, id);
 
   return TRUE;
 }
 
+/**
+ * gsm_store_add_index:
+ * @store: a #GsmStore
+ * @name: the name of the index
+ * @property: the property the keys depend on, or NULL if they never change
+ * @func: returns the keys of an object
+ *
+ * Adds an index to look objects up by the keys @func returns. The index
+ * is kept up to date as objects are added and removed, and as @property
+ * changes.
+ */
+void gsm_store_add_index(GsmStore *store, const char *name,
+                         const char *property, GsmStoreIndexFunc func) {
+  GsmStoreIndex *idx;
+  GHashTableIter iter;
+  gpointer object;
+  GsmStorePrivate *priv;
+
+  g_return_if_fail(GSM_IS_STORE(store));
+  g_return_if_fail(name != NULL);
+  g_return_if_fail(func != NULL);
+
+  priv = gsm_store_get_instance_private(store);
+
+  if (g_hash_table_contains(priv->indexes, name)) {
+    return;
+  }
+
+  idx = gsm_store_index_new(property, func);
+  g_hash_table_insert(priv->indexes, g_strdup(name), idx);
+
+  g_hash_table_iter_init(&iter, priv->objects);
+  while (g_hash_table_iter_next(&iter, NULL, &object)) {
+    index_object(idx, object);
+  }
+}
+
+static GSList *lookup_index(GsmStore *store, const char *name,
+                            const char *key) {
+  GsmStoreIndex *idx;
+  GsmStorePrivate *priv;
+
+  priv = gsm_store_get_instance_private(store);
+
+  idx = g_hash_table_lookup(priv->indexes, name);
+  g_return_val_if_fail(idx != NULL, NULL);
+
+  if (key == NULL) {
+    return NULL;
+  }
+
+  return g_hash_table_lookup(idx->objects_by_key, key);
+}
+
+GObject *gsm_store_lookup_by_index(GsmStore *store, const char *name,
+                                   const char *key) {
+  GSList *list;
+
+  g_return_val_if_fail(GSM_IS_STORE(store), NULL);
+
+  list = lookup_index(store, name, key);
+
+  return list != NULL ? list->data : NULL;
+}
+
+/* The objects are not referenced, only the list has to be freed */
+GSList *gsm_store_lookup_all_by_index(GsmStore *store, const char *name,
+                                      const char *key) {
+  g_return_val_if_fail(GSM_IS_STORE(store), NULL);
+
+  return g_slist_copy(lookup_index(store, name, key));
+}
+
 void gsm_store_set_locked(GsmStore *store, gboolean locked) {
   GsmStorePrivate *priv;
   g_return_if_fail(GSM_IS_STORE(store));
@@ -307,8 +528,11 @@ static void gsm_store_init(GsmStore *store) {
   GsmStorePrivate *priv;
   priv = gsm_store_get_instance_private(store);
 
-  priv->objects = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
-                                        (GDestroyNotify)_destroy_object);
+  priv->objects = g_hash_table_new_full(
+      g_str_hash, gsm_util_intern_equal,
+      (GDestroyNotify)gsm_util_intern_release, (GDestroyNotify)_destroy_object);
+  priv->indexes = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                        (GDestroyNotify)gsm_store_index_free);
 }
 
 static void gsm_store_finalize(GObject *object) {
@@ -324,6 +548,7 @@ static void gsm_store_finalize(GObject *object) {
   g_return_if_fail(priv != NULL);
 
   g_hash_table_destroy(priv->objects);
+  g_hash_table_destroy(priv->indexes);
 
   G_OBJECT_CLASS(gsm_store_parent_class)->finalize(object);
 }
@@ -43,6 +43,10 @@ typedef enum { GSM_STORE_ERROR_GENERAL } GsmStoreError;
 
 typedef gboolean (*GsmStoreFunc)(const char *id, GObject *object,
                                  gpointer user_data);
+/* Returns the keys @object is indexed under, or NULL. The keys are
+ * interned with gsm_util_intern() and the array is freed by the store.
+ */
+typedef char **(*GsmStoreIndexFunc)(GObject *object);
 
 GQuark gsm_store_error_quark(void);
 
@@ -63,6 +67,13 @@ GObject *gsm_store_find(GsmStore *store, GsmStoreFunc predicate,
                         gpointer user_data);
 GObject *gsm_store_lookup(GsmStore *store, const char *id);
 
+void gsm_store_add_index(GsmStore *store, const char *name,
+                         const char *property, GsmStoreIndexFunc func);
+GObject *gsm_store_lookup_by_index(GsmStore *store, const char *name,
+                                   const char *key);
+GSList *gsm_store_lookup_all_by_index(GsmStore *store, const char *name,
+                                      const char *key);
+
 G_END_DECLS
 
 #endif /* __GSM_STORE_H */
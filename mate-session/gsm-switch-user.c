@@ -0,0 +1,286 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gsm-switch-user.h"
+
+#include <gio/gio.h>
+#include <glib.h>
+
+#include "mdm.h"
+
+/* How to get to the greeter depends on the display manager. Instead of
+ * looking for its processes every time, we find out which of them is
+ * there, in the same order as before (MDM, GDM, then any display manager
+ * implementing org.freedesktop.DisplayManager such as LightDM), when the
+ * manager starts and again when one of their bus names comes or goes, or
+ * when switching failed. The bus names are watched and the seat queried
+ * asynchronously, so switching itself is a single call.
+ *
+ * If logind says the seat cannot do graphics at all, there is nothing to
+ * switch to.
+ */
+#define MDM_FLEXISERVER_COMMAND "mdmflexiserver"
+#define GDM_FLEXISERVER_COMMAND "gdmflexiserver"
+#define FLEXISERVER_ARGS "--startnew"
+#define FLEXISERVER_SESSION "Standard"
+
+#define GDM_DBUS_NAME "org.gnome.DisplayManager"
+#define DM_DBUS_NAME "org.freedesktop.DisplayManager"
+#define DM_SEAT_DBUS_INTERFACE "org.freedesktop.DisplayManager.Seat"
+
+#define LOGIND_DBUS_NAME "org.freedesktop.login1"
+#define LOGIND_SEAT_DBUS_PATH "/org/freedesktop/login1/seat/self"
+#define LOGIND_SEAT_DBUS_INTERFACE "org.freedesktop.login1.Seat"
+
+typedef enum {
+  SWITCH_USER_NONE = 0,
+  SWITCH_USER_MDM,
+  SWITCH_USER_GDM,
+  SWITCH_USER_SEAT,
+} SwitchUserMethod;
+
+typedef enum { NAME_GDM = 0, NAME_DM, NAME_LOGIND, N_NAMES } WatchedName;
+
+static const char *watched_names[N_NAMES] = {GDM_DBUS_NAME, DM_DBUS_NAME,
+                                             LOGIND_DBUS_NAME};
+
+static gboolean probed = FALSE;
+static guint probe_id = 0;
+static SwitchUserMethod method = SWITCH_USER_NONE;
+static char *flexiserver = NULL; /* for MDM and GDM, if installed */
+static GDBusConnection *system_bus = NULL;
+static guint watch_ids[N_NAMES];
+static gboolean name_owned[N_NAMES];
+static gboolean can_graphical = TRUE;
+static GCancellable *seat_cancellable = NULL;
+
+/* Only looks at what is already known about the bus, MDM being the one
+ * display manager that has to be asked through its socket */
+static void probe(void) {
+  if (probe_id != 0) {
+    g_source_remove(probe_id);
+    probe_id = 0;
+  }
+
+  if (probed) {
+    return;
+  }
+
+  probed = TRUE;
+  method = SWITCH_USER_NONE;
+  g_clear_pointer(&flexiserver, g_free);
+
+  if (!can_graphical) {
+    g_debug("GsmSwitchUser: the seat cannot do graphics");
+    return;
+  }
+
+  if (mdm_is_available()) {
+    method = SWITCH_USER_MDM;
+    flexiserver = g_find_program_in_path(MDM_FLEXISERVER_COMMAND);
+  } else if (name_owned[NAME_GDM] &&
+             (flexiserver = g_find_program_in_path(GDM_FLEXISERVER_COMMAND)) !=
+                 NULL) {
+    method = SWITCH_USER_GDM;
+  } else if (name_owned[NAME_DM] && g_getenv("XDG_SEAT_PATH") != NULL) {
+    method = SWITCH_USER_SEAT;
+  }
+
+  g_debug("GsmSwitchUser: using %s",
+          method == SWITCH_USER_MDM   ? "MDM"
+          : method == SWITCH_USER_GDM ? "GDM"
+          : method == SWITCH_USER_SEAT ? DM_SEAT_DBUS_INTERFACE
+                                       : "nothing");
+}
+
+static gboolean on_probe_idle(gpointer data) {
+  probe_id = 0;
+  probe();
+
+  return FALSE;
+}
+
+static void invalidate(void) {
+  probed = FALSE;
+
+  if (probe_id == 0) {
+    probe_id = g_idle_add(on_probe_idle, NULL);
+  }
+}
+
+static void on_can_graphical_finished(GObject *source, GAsyncResult *result,
+                                      gpointer data) {
+  GVariant *reply;
+  GVariant *value;
+  GError *error = NULL;
+
+  reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), result,
+                                        &error);
+  if (reply == NULL) {
+    if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+      g_debug("GsmSwitchUser: Unable to query the seat: %s", error->message);
+    }
+    g_error_free(error);
+    return;
+  }
+
+  g_variant_get(reply, "(v)", &value);
+  if (g_variant_is_of_type(value, G_VARIANT_TYPE_BOOLEAN)) {
+    can_graphical = g_variant_get_boolean(value);
+  }
+  g_variant_unref(value);
+  g_variant_unref(reply);
+
+  invalidate();
+}
+
+static void query_seat(void) {
+  if (seat_cancellable != NULL) {
+    g_cancellable_cancel(seat_cancellable);
+    g_object_unref(seat_cancellable);
+    seat_cancellable = NULL;
+  }
+
+  can_graphical = TRUE;
+  if (!name_owned[NAME_LOGIND]) {
+    return;
+  }
+
+  seat_cancellable = g_cancellable_new();
+  g_dbus_connection_call(
+      system_bus, LOGIND_DBUS_NAME, LOGIND_SEAT_DBUS_PATH,
+      "org.freedesktop.DBus.Properties", "Get",
+      g_variant_new("(ss)", LOGIND_SEAT_DBUS_INTERFACE, "CanGraphical"),
+      G_VARIANT_TYPE("(v)"), G_DBUS_CALL_FLAGS_NONE, -1, seat_cancellable,
+      on_can_graphical_finished, NULL);
+}
+
+static void on_name_changed(GDBusConnection *connection, const char *name,
+                            const char *name_owner, gpointer data) {
+  WatchedName index = GPOINTER_TO_INT(data);
+
+  g_debug("GsmSwitchUser: %s changed", name);
+
+  name_owned[index] = name_owner != NULL;
+  if (index == NAME_LOGIND) {
+    query_seat();
+  }
+
+  invalidate();
+}
+
+/* Watches the bus names of the display managers, so that they are looked
+ * for again when one starts or stops */
+void gsm_switch_user_init(void) {
+  GError *error = NULL;
+  guint i;
+
+  if (system_bus != NULL) {
+    return;
+  }
+
+  /* MDM can be found without the bus */
+  invalidate();
+
+  system_bus = g_bus_get_sync(G_BUS_TYPE_SYSTEM, NULL, &error);
+  if (system_bus == NULL) {
+    g_debug("GsmSwitchUser: Unable to connect to the system bus: %s",
+            error->message);
+    g_error_free(error);
+    return;
+  }
+
+  for (i = 0; i < N_NAMES; i++) {
+    watch_ids[i] = g_bus_watch_name_on_connection(
+        system_bus, watched_names[i], G_BUS_NAME_WATCHER_FLAGS_NONE,
+        on_name_changed, on_name_changed, GINT_TO_POINTER(i), NULL);
+  }
+}
+
+gboolean gsm_switch_user_is_available(void) {
+  probe();
+
+  return method != SWITCH_USER_NONE;
+}
+
+static void spawn_flexiserver(void) {
+  char *argv[] = {flexiserver, FLEXISERVER_ARGS, FLEXISERVER_SESSION, NULL};
+  GError *error = NULL;
+
+  if (!g_spawn_async(NULL, argv, NULL, G_SPAWN_DEFAULT, NULL, NULL, NULL,
+                     &error)) {
+    g_debug("GsmSwitchUser: Unable to start the greeter: %s",
+            error->message);
+    g_error_free(error);
+    invalidate();
+  }
+}
+
+static void on_switch_to_greeter_finished(GObject *source,
+                                          GAsyncResult *result,
+                                          gpointer data) {
+  GVariant *reply;
+  GError *error = NULL;
+
+  reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), result,
+                                        &error);
+  if (reply == NULL) {
+    g_debug("GsmSwitchUser: Unable to start the greeter: %s",
+            error->message);
+    g_error_free(error);
+    invalidate();
+    return;
+  }
+
+  g_variant_unref(reply);
+}
+
+/* Shows the greeter of the display manager, without waiting for it */
+void gsm_switch_user_start(void) {
+  probe();
+
+  switch (method) {
+    case SWITCH_USER_MDM:
+      if (flexiserver != NULL) {
+        spawn_flexiserver();
+      } else {
+        mdm_new_login();
+      }
+      break;
+    case SWITCH_USER_GDM:
+      spawn_flexiserver();
+      break;
+    case SWITCH_USER_SEAT:
+      g_dbus_connection_call(system_bus, DM_DBUS_NAME,
+                             g_getenv("XDG_SEAT_PATH"), DM_SEAT_DBUS_INTERFACE,
+                             "SwitchToGreeter", NULL, NULL,
+                             G_DBUS_CALL_FLAGS_NO_AUTO_START, -1, NULL,
+                             on_switch_to_greeter_finished, NULL);
+      break;
+    default:
+      g_debug("GsmSwitchUser: no way to switch user");
+      invalidate();
+      break;
+  }
+}
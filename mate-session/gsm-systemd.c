@@ -45,13 +45,44 @@
 #define SD_SEAT_INTERFACE "org.freedesktop.login1.Seat"
 #define SD_SESSION_INTERFACE "org.freedesktop.login1.Session"
 
+#define SD_MATCH_RULE \
+  "type='signal',sender='" SD_NAME "',path='" SD_PATH "'"
+
+/* The answers of logind are cached, queried in the background when the
+ * object is created and again whenever logind signals that something
+ * changed, so that the main loop doesn't block on logind */
+enum {
+  CAPABILITY_STOP = 0,
+  CAPABILITY_RESTART,
+  CAPABILITY_SUSPEND,
+  CAPABILITY_HIBERNATE,
+  N_CAPABILITIES
+};
+
+#define CAPABILITY_UNKNOWN -1
+
+static const char *capability_methods[N_CAPABILITIES] = {
+    "CanPowerOff", "CanReboot", "CanSuspend", "CanHibernate"};
+
 typedef struct {
   DBusGConnection *dbus_connection;
   DBusGProxy *bus_proxy;
   DBusGProxy *sd_proxy;
+  DBusGProxy *session_proxy;
+  gint capabilities[N_CAPABILITIES];
+  DBusGProxyCall *capability_calls[N_CAPABILITIES];
+  DBusGProxyCall *session_call;
+  char *session_class;
   guint32 is_connected : 1;
+  guint32 idle_hint_sent : 1;
+  guint32 idle_hint : 1;
 } GsmSystemdPrivate;
 
+typedef struct {
+  GsmSystemd *manager;
+  guint capability;
+} CapabilityCall;
+
 enum { PROP_0, PROP_IS_CONNECTED };
 
 enum { REQUEST_COMPLETED = 0, PRIVILEGES_COMPLETED, LAST_SIGNAL };
@@ -72,6 +103,12 @@ static void gsm_systemd_on_name_owner_changed(DBusGProxy *bus_proxy,
                                               const char *new_owner,
                                               GsmSystemd *manager);
 
+static void gsm_systemd_invalidate_cache(GsmSystemd *manager);
+static void invalidate_capabilities(GsmSystemd *manager);
+static void invalidate_session(GsmSystemd *manager);
+static gboolean is_own_session_removed(GsmSystemd *manager,
+                                       DBusMessage *message);
+
 G_DEFINE_TYPE_WITH_PRIVATE(GsmSystemd, gsm_systemd, G_TYPE_OBJECT);
 
 static void gsm_systemd_get_property(GObject *object, guint prop_id,
@@ -131,6 +168,26 @@ static DBusHandlerResult gsm_systemd_dbus_filter(DBusConnection *connection,
     return DBUS_HANDLER_RESULT_HANDLED;
   }
 
+  if (dbus_message_is_signal(message, DBUS_INTERFACE_PROPERTIES,
+                             "PropertiesChanged") ||
+      dbus_message_is_signal(message, SD_INTERFACE, "SessionNew") ||
+      dbus_message_is_signal(message, SD_INTERFACE, "SessionRemoved") ||
+      dbus_message_is_signal(message, SD_INTERFACE, "SeatNew") ||
+      dbus_message_is_signal(message, SD_INTERFACE, "SeatRemoved")) {
+    if (g_strcmp0(dbus_message_get_path(message), SD_PATH) == 0) {
+      g_debug("GsmSystemd: %s, refreshing cached state",
+              dbus_message_get_member(message));
+      /* What the power actions are allowed to do depends on the other
+       * sessions and seats, but our own session only changes when it
+       * is removed */
+      invalidate_capabilities(manager);
+      if (is_own_session_removed(manager, message)) {
+        invalidate_session(manager);
+      }
+      gsm_systemd_prefetch(manager);
+    }
+  }
+
   return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 }
 
@@ -159,6 +216,7 @@ static gboolean gsm_systemd_ensure_sd_connection(GsmSystemd *manager,
     dbus_connection_set_exit_on_disconnect(connection, FALSE);
     dbus_connection_add_filter(connection, gsm_systemd_dbus_filter, manager,
                                NULL);
+    dbus_bus_add_match(connection, SD_MATCH_RULE, NULL);
   }
 
   if (priv->bus_proxy == NULL) {
@@ -234,29 +292,220 @@ static void gsm_systemd_on_name_owner_changed(DBusGProxy *bus_proxy,
     return;
   }
 
+  gsm_systemd_invalidate_cache(manager);
+
   if (priv->sd_proxy != NULL) {
     g_object_unref(priv->sd_proxy);
     priv->sd_proxy = NULL;
   }
 
-  gsm_systemd_ensure_sd_connection(manager, NULL);
+  if (gsm_systemd_ensure_sd_connection(manager, NULL) && new_owner != NULL &&
+      new_owner[0] != '\0') {
+    gsm_systemd_prefetch(manager);
+  }
 }
 
 static void gsm_systemd_init(GsmSystemd *manager) {
   GError *error;
+  GsmSystemdPrivate *priv;
+  guint i;
 
   error = NULL;
+  priv = gsm_systemd_get_instance_private(manager);
+
+  for (i = 0; i < N_CAPABILITIES; i++) {
+    priv->capabilities[i] = CAPABILITY_UNKNOWN;
+  }
 
   if (!gsm_systemd_ensure_sd_connection(manager, &error)) {
     g_warning("Could not connect to Systemd: %s", error->message);
     g_error_free(error);
+    return;
+  }
+
+  gsm_systemd_prefetch(manager);
+}
+
+static void invalidate_capabilities(GsmSystemd *manager) {
+  GsmSystemdPrivate *priv;
+  guint i;
+
+  priv = gsm_systemd_get_instance_private(manager);
+
+  for (i = 0; i < N_CAPABILITIES; i++) {
+    if (priv->capability_calls[i] != NULL) {
+      dbus_g_proxy_cancel_call(priv->sd_proxy, priv->capability_calls[i]);
+      priv->capability_calls[i] = NULL;
+    }
+    priv->capabilities[i] = CAPABILITY_UNKNOWN;
+  }
+}
+
+static void invalidate_session(GsmSystemd *manager) {
+  GsmSystemdPrivate *priv;
+
+  priv = gsm_systemd_get_instance_private(manager);
+
+  if (priv->session_call != NULL) {
+    dbus_g_proxy_cancel_call(priv->sd_proxy, priv->session_call);
+    priv->session_call = NULL;
+  }
+
+  if (priv->session_proxy != NULL) {
+    g_object_unref(priv->session_proxy);
+    priv->session_proxy = NULL;
+    priv->idle_hint_sent = FALSE;
+  }
+}
+
+static void gsm_systemd_invalidate_cache(GsmSystemd *manager) {
+  invalidate_capabilities(manager);
+  invalidate_session(manager);
+}
+
+/* Whether @message is the SessionRemoved signal of our own session */
+static gboolean is_own_session_removed(GsmSystemd *manager,
+                                       DBusMessage *message) {
+  GsmSystemdPrivate *priv;
+  const char *session_id;
+  const char *session_path;
+
+  priv = gsm_systemd_get_instance_private(manager);
+
+  if (priv->session_proxy == NULL ||
+      !dbus_message_is_signal(message, SD_INTERFACE, "SessionRemoved")) {
+    return FALSE;
+  }
+
+  if (!dbus_message_get_args(message, NULL, DBUS_TYPE_STRING, &session_id,
+                             DBUS_TYPE_OBJECT_PATH, &session_path,
+                             DBUS_TYPE_INVALID)) {
+    return FALSE;
+  }
+
+  return g_strcmp0(session_path,
+                   dbus_g_proxy_get_path(priv->session_proxy)) == 0;
+}
+
+static gboolean capability_from_string(const char *value) {
+  return g_strcmp0(value, "yes") == 0 || g_strcmp0(value, "challenge") == 0;
+}
+
+static void on_capability_reply(DBusGProxy *proxy, DBusGProxyCall *call,
+                                CapabilityCall *data) {
+  GsmSystemdPrivate *priv;
+  GError *error = NULL;
+  char *value = NULL;
+
+  priv = gsm_systemd_get_instance_private(data->manager);
+  priv->capability_calls[data->capability] = NULL;
+
+  if (!dbus_g_proxy_end_call(proxy, call, &error, G_TYPE_STRING, &value,
+                             G_TYPE_INVALID)) {
+    g_debug("GsmSystemd: %s failed: %s", capability_methods[data->capability],
+            error->message);
+    g_error_free(error);
+    return;
   }
+
+  priv->capabilities[data->capability] = capability_from_string(value);
+  g_free(value);
+}
+
+static void set_session_proxy(GsmSystemd *manager, const char *session_path) {
+  GsmSystemdPrivate *priv;
+
+  priv = gsm_systemd_get_instance_private(manager);
+
+  if (priv->session_proxy != NULL) {
+    g_object_unref(priv->session_proxy);
+  }
+
+  /* A new session object has not been told anything yet */
+  priv->idle_hint_sent = FALSE;
+  priv->session_proxy = dbus_g_proxy_new_for_name(
+      priv->dbus_connection, SD_NAME, session_path, SD_SESSION_INTERFACE);
+}
+
+static void on_session_reply(DBusGProxy *proxy, DBusGProxyCall *call,
+                             GsmSystemd *manager) {
+  GsmSystemdPrivate *priv;
+  GError *error = NULL;
+  char *session_path = NULL;
+
+  priv = gsm_systemd_get_instance_private(manager);
+  priv->session_call = NULL;
+
+  if (!dbus_g_proxy_end_call(proxy, call, &error, DBUS_TYPE_G_OBJECT_PATH,
+                             &session_path, G_TYPE_INVALID)) {
+    g_warning("Unable to get session path: %s", error->message);
+    g_error_free(error);
+    return;
+  }
+
+  set_session_proxy(manager, session_path);
+  g_free(session_path);
+}
+
+/* Starts querying everything that isn't cached yet without waiting for
+ * the answers; the getters only block if they are called before logind
+ * answered */
+void gsm_systemd_prefetch(GsmSystemd *manager) {
+  GsmSystemdPrivate *priv;
+#ifdef HAVE_SYSTEMD
+  char *session_id = NULL;
+#endif
+  guint i;
+
+  priv = gsm_systemd_get_instance_private(manager);
+
+  if (priv->sd_proxy == NULL) {
+    return;
+  }
+
+  for (i = 0; i < N_CAPABILITIES; i++) {
+    CapabilityCall *data;
+
+    if (priv->capabilities[i] != CAPABILITY_UNKNOWN ||
+        priv->capability_calls[i] != NULL) {
+      continue;
+    }
+
+    data = g_new0(CapabilityCall, 1);
+    data->manager = manager;
+    data->capability = i;
+
+    priv->capability_calls[i] = dbus_g_proxy_begin_call(
+        priv->sd_proxy, capability_methods[i],
+        (DBusGProxyCallNotify)on_capability_reply, data, g_free,
+        G_TYPE_INVALID);
+  }
+
+#ifdef HAVE_SYSTEMD
+  if (priv->session_proxy != NULL || priv->session_call != NULL) {
+    return;
+  }
+
+  sd_pid_get_session(getpid(), &session_id);
+  if (session_id == NULL) {
+    return;
+  }
+
+  priv->session_call = dbus_g_proxy_begin_call(
+      priv->sd_proxy, "GetSession", (DBusGProxyCallNotify)on_session_reply,
+      manager, NULL, G_TYPE_STRING, session_id, G_TYPE_INVALID);
+
+  free(session_id);
+#endif /* HAVE_SYSTEMD */
 }
 
 static void gsm_systemd_free_dbus(GsmSystemd *manager) {
   GsmSystemdPrivate *priv;
 
   priv = gsm_systemd_get_instance_private(manager);
+
+  gsm_systemd_invalidate_cache(manager);
+
   if (priv->bus_proxy != NULL) {
     g_object_unref(priv->bus_proxy);
     priv->bus_proxy = NULL;
@@ -280,13 +529,17 @@ static void gsm_systemd_free_dbus(GsmSystemd *manager) {
 static void gsm_systemd_finalize(GObject *object) {
   GsmSystemd *manager;
   GObjectClass *parent_class;
+  GsmSystemdPrivate *priv;
 
   manager = GSM_SYSTEMD(object);
+  priv = gsm_systemd_get_instance_private(manager);
 
   parent_class = G_OBJECT_CLASS(gsm_systemd_parent_class);
 
   gsm_systemd_free_dbus(manager);
 
+  g_free(priv->session_class);
+
   if (parent_class->finalize != NULL) {
     parent_class->finalize(object);
   }
@@ -474,68 +727,52 @@ void gsm_systemd_attempt_stop(GsmSystemd *manager) {
   }
 }
 
-static void gsm_systemd_get_session_path(DBusConnection *connection,
-                                         char **session_path) {
+static gboolean gsm_systemd_ensure_session_proxy(GsmSystemd *manager) {
 #ifdef HAVE_SYSTEMD
-  DBusError local_error;
-  DBusMessage *message;
-  DBusMessage *reply;
-  DBusMessageIter iter;
-  gchar *session_id = NULL;
-
-  sd_pid_get_session(getpid(), &session_id);
+  GsmSystemdPrivate *priv;
+  GError *error = NULL;
+  char *session_id = NULL;
+  char *session_path = NULL;
 
-  if (session_id == NULL) return;
+  priv = gsm_systemd_get_instance_private(manager);
 
-  reply = NULL;
+  if (priv->session_proxy != NULL) {
+    return TRUE;
+  }
 
-  dbus_error_init(&local_error);
-  message = dbus_message_new_method_call(SD_NAME, SD_PATH, SD_INTERFACE,
-                                         "GetSession");
-  if (message == NULL) {
-    goto out;
+  /* Asked before the prefetched answer came in */
+  if (priv->session_call != NULL) {
+    dbus_g_proxy_cancel_call(priv->sd_proxy, priv->session_call);
+    priv->session_call = NULL;
   }
 
-  dbus_message_iter_init_append(message, &iter);
-  dbus_message_iter_append_basic(&iter, DBUS_TYPE_STRING, &session_id);
+  sd_pid_get_session(getpid(), &session_id);
 
-  dbus_error_init(&local_error);
-  reply = dbus_connection_send_with_reply_and_block(connection, message, -1,
-                                                    &local_error);
-  if (reply == NULL) {
-    if (dbus_error_is_set(&local_error)) {
-      g_warning("Unable to get session path: %s", local_error.message);
-      dbus_error_free(&local_error);
-      goto out;
-    }
+  if (session_id == NULL) return FALSE;
+
+  if (!dbus_g_proxy_call(priv->sd_proxy, "GetSession", &error, G_TYPE_STRING,
+                         session_id, G_TYPE_INVALID, DBUS_TYPE_G_OBJECT_PATH,
+                         &session_path, G_TYPE_INVALID)) {
+    g_warning("Unable to get session path: %s", error->message);
+    g_error_free(error);
+    free(session_id);
+    return FALSE;
   }
 
-  dbus_message_iter_init(reply, &iter);
-  dbus_message_iter_get_basic(&iter, session_path);
+  set_session_proxy(manager, session_path);
 
-out:
-  if (message != NULL) {
-    dbus_message_unref(message);
-  }
-  if (reply != NULL) {
-    dbus_message_unref(reply);
-  }
-  if (session_id != NULL) {
-    g_free(session_id);
-  }
+  g_free(session_path);
+  free(session_id);
+
+  return TRUE;
 #else
-  (void)connection;
-  (void)session_path;
+  (void)manager;
+  return FALSE;
 #endif /* HAVE_SYSTEMD */
 }
 
 void gsm_systemd_set_session_idle(GsmSystemd *manager, gboolean is_idle) {
   GError *error;
-  char *session_path = NULL;
-  DBusMessage *message;
-  DBusMessage *reply;
-  DBusError dbus_error;
-  DBusMessageIter iter;
   GsmSystemdPrivate *priv;
 
   error = NULL;
@@ -547,37 +784,22 @@ void gsm_systemd_set_session_idle(GsmSystemd *manager, gboolean is_idle) {
     return;
   }
 
-  gsm_systemd_get_session_path(
-      dbus_g_connection_get_connection(priv->dbus_connection), &session_path);
-
-  g_return_if_fail(session_path != NULL);
-
-  g_debug("Updating Systemd idle status: %d", is_idle);
-  message = dbus_message_new_method_call(SD_NAME, session_path,
-                                         SD_SESSION_INTERFACE, "SetIdleHint");
-  if (message == NULL) {
-    g_debug("Couldn't allocate the D-Bus message");
+  if (!gsm_systemd_ensure_session_proxy(manager)) {
     return;
   }
 
-  dbus_message_iter_init_append(message, &iter);
-  dbus_message_iter_append_basic(&iter, DBUS_TYPE_BOOLEAN, &is_idle);
-
-  /* FIXME: use async? */
-  dbus_error_init(&dbus_error);
-  reply = dbus_connection_send_with_reply_and_block(
-      dbus_g_connection_get_connection(priv->dbus_connection), message, -1,
-      &dbus_error);
-  dbus_message_unref(message);
-
-  if (reply != NULL) {
-    dbus_message_unref(reply);
+  /* Only changes are sent: the idle monitor may follow this very hint, and
+   * repeating a value would only echo its own report back on the bus */
+  is_idle = is_idle != FALSE;
+  if (priv->idle_hint_sent && priv->idle_hint == (guint32)is_idle) {
+    return;
   }
 
-  if (dbus_error_is_set(&dbus_error)) {
-    g_debug("%s raised:\n %s\n\n", dbus_error.name, dbus_error.message);
-    dbus_error_free(&dbus_error);
-  }
+  g_debug("Updating Systemd idle status: %d", is_idle);
+  dbus_g_proxy_call_no_reply(priv->session_proxy, "SetIdleHint",
+                             G_TYPE_BOOLEAN, is_idle, G_TYPE_INVALID);
+  priv->idle_hint_sent = TRUE;
+  priv->idle_hint = is_idle;
 }
 
 gboolean gsm_systemd_can_switch_user(GsmSystemd *manager) {
@@ -624,128 +846,62 @@ gboolean gsm_systemd_get_stop_privileges(GsmSystemd *manager) {
   return TRUE;
 }
 
-gboolean gsm_systemd_can_restart(GsmSystemd *manager) {
+static gboolean gsm_systemd_get_capability(GsmSystemd *manager,
+                                           guint capability) {
   gboolean res;
   gchar *value;
-  gboolean can_restart;
   GError *error;
   GsmSystemdPrivate *priv;
 
   error = NULL;
   priv = gsm_systemd_get_instance_private(manager);
 
-  if (!gsm_systemd_ensure_sd_connection(manager, &error)) {
-    g_warning("Could not connect to Systemd: %s", error->message);
-    g_error_free(error);
-    return FALSE;
-  }
-
-  res = dbus_g_proxy_call_with_timeout(priv->sd_proxy, "CanReboot", INT_MAX,
-                                       &error, G_TYPE_INVALID, G_TYPE_STRING,
-                                       &value, G_TYPE_INVALID);
-  if (res == FALSE) {
-    g_warning("Could not make DBUS call: %s", error->message);
-    g_error_free(error);
-    return FALSE;
+  if (priv->capabilities[capability] != CAPABILITY_UNKNOWN) {
+    return priv->capabilities[capability];
   }
 
-  can_restart =
-      g_strcmp0(value, "yes") == 0 || g_strcmp0(value, "challenge") == 0;
-  g_free(value);
-  return can_restart;
-}
-
-gboolean gsm_systemd_can_stop(GsmSystemd *manager) {
-  gboolean res;
-  gchar *value;
-  gboolean can_stop;
-  GError *error;
-  GsmSystemdPrivate *priv;
-
-  error = NULL;
-  priv = gsm_systemd_get_instance_private(manager);
-
   if (!gsm_systemd_ensure_sd_connection(manager, &error)) {
     g_warning("Could not connect to Systemd: %s", error->message);
     g_error_free(error);
     return FALSE;
   }
 
-  res = dbus_g_proxy_call_with_timeout(priv->sd_proxy, "CanPowerOff", INT_MAX,
-                                       &error, G_TYPE_INVALID, G_TYPE_STRING,
-                                       &value, G_TYPE_INVALID);
+  /* Asked before the prefetched answer came in */
+  if (priv->capability_calls[capability] != NULL) {
+    dbus_g_proxy_cancel_call(priv->sd_proxy,
+                             priv->capability_calls[capability]);
+    priv->capability_calls[capability] = NULL;
+  }
 
+  res = dbus_g_proxy_call_with_timeout(
+      priv->sd_proxy, capability_methods[capability], INT_MAX, &error,
+      G_TYPE_INVALID, G_TYPE_STRING, &value, G_TYPE_INVALID);
   if (res == FALSE) {
     g_warning("Could not make DBUS call: %s", error->message);
     g_error_free(error);
     return FALSE;
   }
 
-  can_stop = g_strcmp0(value, "yes") == 0 || g_strcmp0(value, "challenge") == 0;
+  priv->capabilities[capability] = capability_from_string(value);
   g_free(value);
-  return can_stop;
-}
 
-gboolean gsm_systemd_can_hibernate(GsmSystemd *manager) {
-  gboolean res;
-  gchar *value;
-  gboolean can_hibernate;
-  GError *error;
-  GsmSystemdPrivate *priv;
-
-  error = NULL;
-  priv = gsm_systemd_get_instance_private(manager);
+  return priv->capabilities[capability];
+}
 
-  if (!gsm_systemd_ensure_sd_connection(manager, &error)) {
-    g_warning("Could not connect to Systemd: %s", error->message);
-    g_error_free(error);
-    return FALSE;
-  }
+gboolean gsm_systemd_can_restart(GsmSystemd *manager) {
+  return gsm_systemd_get_capability(manager, CAPABILITY_RESTART);
+}
 
-  res = dbus_g_proxy_call_with_timeout(priv->sd_proxy, "CanHibernate", INT_MAX,
-                                       &error, G_TYPE_INVALID, G_TYPE_STRING,
-                                       &value, G_TYPE_INVALID);
-  if (res == FALSE) {
-    g_warning("Could not make DBUS call: %s", error->message);
-    g_error_free(error);
-    return FALSE;
-  }
+gboolean gsm_systemd_can_stop(GsmSystemd *manager) {
+  return gsm_systemd_get_capability(manager, CAPABILITY_STOP);
+}
 
-  can_hibernate =
-      g_strcmp0(value, "yes") == 0 || g_strcmp0(value, "challenge") == 0;
-  g_free(value);
-  return can_hibernate;
+gboolean gsm_systemd_can_hibernate(GsmSystemd *manager) {
+  return gsm_systemd_get_capability(manager, CAPABILITY_HIBERNATE);
 }
 
 gboolean gsm_systemd_can_suspend(GsmSystemd *manager) {
-  gboolean res;
-  gchar *value;
-  gboolean can_suspend;
-  GError *error;
-  GsmSystemdPrivate *priv;
-
-  error = NULL;
-  priv = gsm_systemd_get_instance_private(manager);
-
-  if (!gsm_systemd_ensure_sd_connection(manager, &error)) {
-    g_warning("Could not connect to Systemd: %s", error->message);
-    g_error_free(error);
-    return FALSE;
-  }
-
-  res = dbus_g_proxy_call_with_timeout(priv->sd_proxy, "CanSuspend", INT_MAX,
-                                       &error, G_TYPE_INVALID, G_TYPE_STRING,
-                                       &value, G_TYPE_INVALID);
-  if (res == FALSE) {
-    g_warning("Could not make DBUS call: %s", error->message);
-    g_error_free(error);
-    return FALSE;
-  }
-
-  can_suspend =
-      g_strcmp0(value, "yes") == 0 || g_strcmp0(value, "challenge") == 0;
-  g_free(value);
-  return can_suspend;
+  return gsm_systemd_get_capability(manager, CAPABILITY_SUSPEND);
 }
 
 void gsm_systemd_attempt_hibernate(GsmSystemd *manager) {
@@ -802,11 +958,18 @@ gchar *gsm_systemd_get_current_session_type(GsmSystemd *manager) {
   GError *gerror;
   gchar *session_id = NULL;
   gchar *session_class = NULL;
+  GsmSystemdPrivate *priv;
 #ifdef HAVE_SYSTEMD
   int res;
 #endif
 
   gerror = NULL;
+  priv = gsm_systemd_get_instance_private(manager);
+
+  /* The class of a session never changes */
+  if (priv->session_class != NULL) {
+    return g_strdup(priv->session_class);
+  }
 
   if (!gsm_systemd_ensure_sd_connection(manager, &gerror)) {
     g_warning("Could not connect to Systemd: %s", gerror->message);
@@ -830,6 +993,8 @@ gchar *gsm_systemd_get_current_session_type(GsmSystemd *manager) {
   g_free(session_id);
 #endif
 
+  priv->session_class = g_strdup(session_class);
+
   return session_class;
 }
 
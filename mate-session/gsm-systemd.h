@@ -57,6 +57,8 @@ GQuark gsm_systemd_error_quark(void);
 
 GsmSystemd *gsm_systemd_new(void) G_GNUC_MALLOC;
 
+void gsm_systemd_prefetch(GsmSystemd *manager);
+
 gboolean gsm_systemd_can_switch_user(GsmSystemd *manager);
 
 gboolean gsm_systemd_get_restart_privileges(GsmSystemd *manager);
@@ -0,0 +1,232 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "gsm-trace.h"
+
+#include <unistd.h>
+
+#include <glib.h>
+
+/* The startup timeline is kept in memory as a list of events with
+ * monotonic timestamps and written as a Chrome trace (the JSON format
+ * also read by Perfetto) to $XDG_RUNTIME_DIR/mate-session/.
+ *
+ * Phases are begin/end events, app launches are async events keyed by
+ * the app id since they overlap, everything else is an instant event.
+ */
+#define TRACE_MAX_EVENTS 16384
+
+typedef struct {
+  gint64 ts;
+  char ph;
+  const char *category;
+  char *name;
+  char *detail;
+} TraceEvent;
+
+static GArray *events = NULL;
+static guint dropped_events = 0;
+static gboolean trace_stopped = FALSE;
+static guint stop_id = 0;
+
+static void trace_event_clear(TraceEvent *event) {
+  g_free(event->name);
+  g_free(event->detail);
+}
+
+void gsm_trace_init(void) {
+  if (events != NULL || trace_stopped) {
+    return;
+  }
+
+  events = g_array_sized_new(FALSE, FALSE, sizeof(TraceEvent), 256);
+  g_array_set_clear_func(events, (GDestroyNotify)trace_event_clear);
+
+  gsm_trace_instant("session", "init", NULL);
+}
+
+static void trace_add(char ph, const char *category, const char *name,
+                      const char *detail) {
+  TraceEvent event;
+
+  if (events == NULL) {
+    return;
+  }
+
+  if (events->len >= TRACE_MAX_EVENTS) {
+    dropped_events++;
+    return;
+  }
+
+  event.ts = g_get_monotonic_time();
+  event.ph = ph;
+  event.category = category;
+  event.name = g_strdup(name);
+  event.detail = g_strdup(detail);
+
+  g_array_append_val(events, event);
+}
+
+void gsm_trace_begin(const char *category, const char *name) {
+  trace_add('B', category, name, NULL);
+}
+
+void gsm_trace_end(const char *category, const char *name) {
+  trace_add('E', category, name, NULL);
+}
+
+void gsm_trace_async_begin(const char *category, const char *name) {
+  trace_add('b', category, name, NULL);
+}
+
+void gsm_trace_async_end(const char *category, const char *name,
+                         const char *detail) {
+  trace_add('e', category, name, detail);
+}
+
+void gsm_trace_instant(const char *category, const char *name,
+                       const char *detail) {
+  trace_add('i', category, name, detail);
+}
+
+static void append_json_string(GString *str, const char *value) {
+  const char *p;
+
+  g_string_append_c(str, '"');
+
+  for (p = value != NULL ? value : ""; *p != '\0'; p++) {
+    switch (*p) {
+      case '"':
+        g_string_append(str, "\\\"");
+        break;
+      case '\\':
+        g_string_append(str, "\\\\");
+        break;
+      default:
+        if ((guchar)*p < 0x20) {
+          g_string_append_printf(str, "\\u%04x", (guchar)*p);
+        } else {
+          g_string_append_c(str, *p);
+        }
+        break;
+    }
+  }
+
+  g_string_append_c(str, '"');
+}
+
+static void append_event(GString *str, const TraceEvent *event, int pid) {
+  g_string_append(str, "{\"name\":");
+  append_json_string(str, event->name);
+  g_string_append(str, ",\"cat\":");
+  append_json_string(str, event->category);
+  g_string_append_printf(str,
+                         ",\"ph\":\"%c\",\"ts\":%" G_GINT64_FORMAT
+                         ",\"pid\":%d,\"tid\":%d",
+                         event->ph, event->ts, pid, pid);
+
+  if (event->ph == 'b' || event->ph == 'e') {
+    g_string_append(str, ",\"id\":");
+    append_json_string(str, event->name);
+  } else if (event->ph == 'i') {
+    g_string_append(str, ",\"s\":\"t\"");
+  }
+
+  if (event->detail != NULL) {
+    g_string_append(str, ",\"args\":{\"detail\":");
+    append_json_string(str, event->detail);
+    g_string_append_c(str, '}');
+  }
+
+  g_string_append_c(str, '}');
+}
+
+/* (Re)writes the trace file with all the events recorded so far */
+void gsm_trace_flush(void) {
+  GString *str;
+  char *dirname;
+  char *filename;
+  GError *error;
+  int pid;
+  guint i;
+
+  if (events == NULL) {
+    return;
+  }
+
+  pid = (int)getpid();
+
+  str = g_string_sized_new(events->len * 96);
+  g_string_append(str, "{\"traceEvents\":[\n");
+
+  for (i = 0; i < events->len; i++) {
+    append_event(str, &g_array_index(events, TraceEvent, i), pid);
+    g_string_append(str, i + 1 < events->len ? ",\n" : "\n");
+  }
+
+  g_string_append_printf(str,
+                         "],\"displayTimeUnit\":\"ms\","
+                         "\"otherData\":{\"dropped_events\":\"%u\"}}\n",
+                         dropped_events);
+
+  dirname = g_build_filename(g_get_user_runtime_dir(), "mate-session", NULL);
+  filename = g_build_filename(dirname, "startup-trace.json", NULL);
+
+  error = NULL;
+  if (g_mkdir_with_parents(dirname, 0700) != 0) {
+    g_warning("GsmTrace: Unable to create %s", dirname);
+  } else if (!g_file_set_contents(filename, str->str, str->len, &error)) {
+    g_warning("GsmTrace: Unable to write %s: %s", filename, error->message);
+    g_error_free(error);
+  } else {
+    g_debug("GsmTrace: Wrote %u events to %s", events->len, filename);
+  }
+
+  g_free(filename);
+  g_free(dirname);
+  g_string_free(str, TRUE);
+}
+
+static gboolean on_stop_timeout(gpointer data) {
+  stop_id = 0;
+
+  gsm_trace_flush();
+
+  g_array_free(events, TRUE);
+  events = NULL;
+  trace_stopped = TRUE;
+
+  return FALSE;
+}
+
+/* Writes the trace now, keeps recording for @seconds more to catch the
+ * apps that are still starting, then writes it again and stops. */
+void gsm_trace_stop_later(guint seconds) {
+  if (events == NULL || stop_id > 0) {
+    return;
+  }
+
+  gsm_trace_flush();
+  stop_id = g_timeout_add_seconds(seconds, on_stop_timeout, NULL);
+}
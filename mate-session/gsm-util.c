@@ -28,6 +28,7 @@
 #include <ctype.h>
 #include <dbus/dbus-glib.h>
 #include <errno.h>
+#include <gio/gio.h>
 #include <glib.h>
 #include <glib/gi18n.h>
 #include <glib/gstdio.h>
@@ -82,39 +83,117 @@ static char **gsm_util_get_app_dirs() {
   return (char **)g_ptr_array_free(dirs, FALSE);
 }
 
+/* Basenames of the .desktop files of each directory we looked in, so
+ * that resolving an app name does not need to stat and parse files along
+ * every XDG dir. A directory is read again after its monitor reported a
+ * change. */
+typedef struct {
+  GHashTable *names; /* NULL until the directory is read */
+  GFileMonitor *monitor;
+} DesktopDirIndex;
+
+static GHashTable *desktop_dir_indexes = NULL; /* dir -> DesktopDirIndex */
+
+static void on_desktop_dir_changed(GFileMonitor *monitor, GFile *file,
+                                   GFile *other_file, GFileMonitorEvent event,
+                                   DesktopDirIndex *idx) {
+  if (idx->names != NULL) {
+    g_hash_table_destroy(idx->names);
+    idx->names = NULL;
+  }
+}
+
+static DesktopDirIndex *get_desktop_dir_index(const char *dir) {
+  DesktopDirIndex *idx;
+  GDir *d;
+  const char *name;
+
+  if (desktop_dir_indexes == NULL) {
+    desktop_dir_indexes = g_hash_table_new(g_str_hash, g_str_equal);
+  }
+
+  idx = g_hash_table_lookup(desktop_dir_indexes, dir);
+  if (idx == NULL) {
+    GFile *file;
+
+    idx = g_new0(DesktopDirIndex, 1);
+
+    file = g_file_new_for_path(dir);
+    idx->monitor = g_file_monitor_directory(file, G_FILE_MONITOR_NONE, NULL,
+                                            NULL);
+    if (idx->monitor != NULL) {
+      g_signal_connect(idx->monitor, "changed",
+                       G_CALLBACK(on_desktop_dir_changed), idx);
+    }
+    g_object_unref(file);
+
+    g_hash_table_insert(desktop_dir_indexes, g_strdup(dir), idx);
+  }
+
+  /* Without a monitor we cannot tell when the listing gets stale */
+  if (idx->names != NULL && idx->monitor != NULL) {
+    return idx;
+  }
+
+  if (idx->names != NULL) {
+    g_hash_table_destroy(idx->names);
+  }
+
+  idx->names = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+  d = g_dir_open(dir, 0, NULL);
+  if (d == NULL) {
+    return idx;
+  }
+
+  while ((name = g_dir_read_name(d))) {
+    if (g_str_has_suffix(name, ".desktop")) {
+      g_hash_table_add(idx->names, g_strdup(name));
+    }
+  }
+
+  g_dir_close(d);
+
+  return idx;
+}
+
+static char *find_desktop_file_in_dirs(const char *desktop_file,
+                                       char **dirs) {
+  int i;
+
+  for (i = 0; dirs[i] != NULL; i++) {
+    DesktopDirIndex *idx;
+
+    idx = get_desktop_dir_index(dirs[i]);
+    if (g_hash_table_contains(idx->names, desktop_file)) {
+      return g_build_filename(dirs[i], desktop_file, NULL);
+    }
+  }
+
+  return NULL;
+}
+
 char *gsm_util_find_desktop_file_for_app_name(const char *name,
                                               char **autostart_dirs) {
   char *app_path;
   char **app_dirs;
-  GKeyFile *key_file;
   char *desktop_file;
-  int i;
 
   app_path = NULL;
 
   app_dirs = gsm_util_get_app_dirs();
 
-  key_file = g_key_file_new();
-
   desktop_file = g_strdup_printf("%s.desktop", name);
 
   g_debug("GsmUtil: Looking for file '%s'", desktop_file);
 
-  for (i = 0; app_dirs[i] != NULL; i++) {
-    g_debug("GsmUtil: Looking in '%s'", app_dirs[i]);
-  }
-
-  g_key_file_load_from_dirs(key_file, desktop_file, (const char **)app_dirs,
-                            &app_path, G_KEY_FILE_NONE, NULL);
-
+  app_path = find_desktop_file_in_dirs(desktop_file, app_dirs);
   if (app_path != NULL) {
     g_debug("GsmUtil: found in XDG app dirs: '%s'", app_path);
   }
 
   if (app_path == NULL && autostart_dirs != NULL) {
-    g_key_file_load_from_dirs(key_file, desktop_file,
-                              (const char **)autostart_dirs, &app_path,
-                              G_KEY_FILE_NONE, NULL);
+    app_path = find_desktop_file_in_dirs(desktop_file, autostart_dirs);
     if (app_path != NULL) {
       g_debug("GsmUtil: found in autostart dirs: '%s'", app_path);
     }
@@ -125,24 +204,20 @@ char *gsm_util_find_desktop_file_for_app_name(const char *name,
     g_free(desktop_file);
     desktop_file = g_strdup_printf("mate-%s.desktop", name);
 
-    g_key_file_load_from_dirs(key_file, desktop_file, (const char **)app_dirs,
-                              &app_path, G_KEY_FILE_NONE, NULL);
+    app_path = find_desktop_file_in_dirs(desktop_file, app_dirs);
     if (app_path != NULL) {
       g_debug("GsmUtil: found in XDG app dirs: '%s'", app_path);
     }
   }
 
   if (app_path == NULL && autostart_dirs != NULL) {
-    g_key_file_load_from_dirs(key_file, desktop_file,
-                              (const char **)autostart_dirs, &app_path,
-                              G_KEY_FILE_NONE, NULL);
+    app_path = find_desktop_file_in_dirs(desktop_file, autostart_dirs);
     if (app_path != NULL) {
       g_debug("GsmUtil: found in autostart dirs: '%s'", app_path);
     }
   }
 
   g_free(desktop_file);
-  g_key_file_free(key_file);
 
   g_strfreev(app_dirs);
 
@@ -162,38 +237,6 @@ static gboolean ensure_dir_exists(const char *dir) {
   return FALSE;
 }
 
-gchar *gsm_util_get_empty_tmp_session_dir(void) {
-  char *tmp;
-  gboolean exists;
-
-  tmp = g_build_filename(g_get_user_config_dir(), "mate-session",
-                         "saved-session.new", NULL);
-
-  exists = ensure_dir_exists(tmp);
-
-  if (G_UNLIKELY(!exists)) {
-    g_warning(
-        "GsmSessionSave: could not create directory for saved session: %s",
-        tmp);
-    g_free(tmp);
-    return NULL;
-  } else {
-    /* make sure it's empty */
-    GDir *dir = g_dir_open(tmp, 0, NULL);
-    if (dir) {
-      const char *filename;
-      while ((filename = g_dir_read_name(dir))) {
-        gchar *path = g_build_filename(tmp, filename, NULL);
-        g_unlink(path);
-        g_free(path);
-      }
-      g_dir_close(dir);
-    }
-  }
-
-  return tmp;
-}
-
 const gchar *gsm_util_get_saved_session_dir(void) {
   if (_saved_session_dir == NULL) {
     gboolean exists;
@@ -405,41 +448,52 @@ char *gsm_util_generate_startup_id(void) {
                          (unsigned long)pid, sequence);
 }
 
-static gboolean gsm_util_update_activation_environment(const char *variable,
-                                                       const char *value,
-                                                       GError **error) {
-  GDBusConnection *connection;
-  gboolean environment_updated;
-  GVariantBuilder builder;
-  GVariant *reply;
-  GError *bus_error = NULL;
+/**
+ * gsm_util_intern:
+ * @str: an identifier, or %NULL
+ *
+ * Returns a reference to the interned copy of @str. App ids, startup
+ * ids, client ids and bus names are held by apps, clients, inhibitors
+ * and the store indexes at the same time; interning them makes all of
+ * these share one allocation, so that equal identifiers are equal
+ * pointers.
+ *
+ * Return value: an interned string to release with
+ * gsm_util_intern_release(), or %NULL.
+ **/
+char *gsm_util_intern(const char *str) {
+  if (str == NULL) {
+    return NULL;
+  }
 
-  environment_updated = FALSE;
-  connection = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, error);
+  return g_ref_string_new_intern(str);
+}
 
-  if (connection == NULL) {
-    return FALSE;
+void gsm_util_intern_release(char *str) {
+  if (str != NULL) {
+    g_ref_string_release(str);
   }
+}
 
-  g_variant_builder_init(&builder, G_VARIANT_TYPE("a{ss}"));
-  g_variant_builder_add(&builder, "{ss}", variable, value);
+void gsm_util_intern_freev(char **strv) {
+  guint i;
 
-  reply = g_dbus_connection_call_sync(
-      connection, "org.freedesktop.DBus", "/org/freedesktop/DBus",
-      "org.freedesktop.DBus", "UpdateActivationEnvironment",
-      g_variant_new("(@a{ss})", g_variant_builder_end(&builder)), NULL,
-      G_DBUS_CALL_FLAGS_NONE, -1, NULL, &bus_error);
+  if (strv == NULL) {
+    return;
+  }
 
-  if (bus_error != NULL) {
-    g_propagate_error(error, bus_error);
-  } else {
-    environment_updated = TRUE;
-    g_variant_unref(reply);
+  for (i = 0; strv[i] != NULL; i++) {
+    g_ref_string_release(strv[i]);
   }
 
-  g_clear_object(&connection);
+  g_free(strv);
+}
 
-  return environment_updated;
+/* A GEqualFunc for hash tables keyed by interned strings that may be
+ * looked up with plain ones.
+ */
+gboolean gsm_util_intern_equal(gconstpointer a, gconstpointer b) {
+  return a == b || strcmp(a, b) == 0;
 }
 
 gboolean gsm_util_export_activation_environment(GError **error) {
@@ -565,73 +619,183 @@ gboolean gsm_util_export_user_environment(GError **error) {
 
   return environment_updated;
 }
+#endif
 
-static gboolean gsm_util_update_user_environment(const char *variable,
-                                                 const char *value,
-                                                 GError **error) {
-  GDBusConnection *connection;
-  gboolean environment_updated;
-  char *entry;
-  GVariantBuilder builder;
-  GVariant *reply;
-  GError *bus_error = NULL;
+/* Variables set with gsm_util_setenv() are only exported to the bus
+ * activation environment and to systemd when the environment is flushed,
+ * with one asynchronous call per target for all of them.
+ */
+typedef struct {
+  GsmUtilEnvironmentFlushedFunc func;
+  gpointer user_data;
+  GHashTable *variables;
+  guint n_pending;
+} EnvironmentFlush;
 
-  environment_updated = FALSE;
-  connection = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, error);
+static GHashTable *pending_environment = NULL; /* variable -> value */
 
-  if (connection == NULL) {
-    return FALSE;
+static void environment_flush_unref(EnvironmentFlush *flush) {
+  if (--flush->n_pending > 0) {
+    return;
   }
 
-  g_variant_builder_init(&builder, G_VARIANT_TYPE("as"));
-  entry = g_strdup_printf("%s=%s", variable, value);
-  g_variant_builder_add(&builder, "s", entry);
-  g_free(entry);
-
-  reply = g_dbus_connection_call_sync(
-      connection, "org.freedesktop.systemd1", "/org/freedesktop/systemd1",
-      "org.freedesktop.systemd1.Manager", "SetEnvironment",
-      g_variant_new("(@as)", g_variant_builder_end(&builder)), NULL,
-      G_DBUS_CALL_FLAGS_NONE, -1, NULL, &bus_error);
-
-  if (bus_error != NULL) {
-    g_propagate_error(error, bus_error);
-  } else {
-    environment_updated = TRUE;
-    g_variant_unref(reply);
+  if (flush->func != NULL) {
+    flush->func(flush->user_data);
   }
 
-  g_clear_object(&connection);
-
-  return environment_updated;
+  g_hash_table_destroy(flush->variables);
+  g_slice_free(EnvironmentFlush, flush);
 }
-#endif
 
-void gsm_util_setenv(const char *variable, const char *value) {
+static void on_activation_environment_updated(GObject *source,
+                                              GAsyncResult *result,
+                                              EnvironmentFlush *flush) {
+  GVariant *reply;
   GError *error = NULL;
 
-  g_setenv(variable, value, TRUE);
+  reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), result,
+                                        &error);
 
   /* If this fails it isn't fatal, it means some things like session
    * management and keyring won't work in activated clients.
    */
-  if (!gsm_util_update_activation_environment(variable, value, &error)) {
+  if (reply == NULL) {
     g_warning(
-        "Could not make bus activated clients aware of %s=%s environment "
-        "variable: %s",
-        variable, value, error->message);
-    g_clear_error(&error);
+        "Could not make bus activated clients aware of %u environment "
+        "variables: %s",
+        g_hash_table_size(flush->variables), error->message);
+    g_error_free(error);
+  } else {
+    g_variant_unref(reply);
   }
 
+  environment_flush_unref(flush);
+}
+
 #ifdef HAVE_SYSTEMD
+static void on_user_environment_updated(GObject *source, GAsyncResult *result,
+                                        EnvironmentFlush *flush) {
+  GVariant *reply;
+  GError *error = NULL;
+
+  reply = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), result,
+                                        &error);
+
   /* If this fails, the system user session won't get the updated environment
    */
-  if (!gsm_util_update_user_environment(variable, value, &error)) {
-    g_debug("Could not make systemd aware of %s=%s environment variable: %s",
-            variable, value, error->message);
-    g_clear_error(&error);
+  if (reply == NULL) {
+    g_debug("Could not make systemd aware of %u environment variables: %s",
+            g_hash_table_size(flush->variables), error->message);
+    g_error_free(error);
+  } else {
+    g_variant_unref(reply);
   }
+
+  environment_flush_unref(flush);
+}
+#endif
+
+static void on_environment_bus_get(GObject *source, GAsyncResult *result,
+                                   EnvironmentFlush *flush) {
+  GDBusConnection *connection;
+  GVariantBuilder activation_builder;
+#ifdef HAVE_SYSTEMD
+  GVariantBuilder user_builder;
 #endif
+  GHashTableIter iter;
+  gpointer key;
+  gpointer value;
+  GError *error = NULL;
+
+  connection = g_bus_get_finish(result, &error);
+  if (connection == NULL) {
+    g_warning("Could not export %u environment variables: %s",
+              g_hash_table_size(flush->variables), error->message);
+    g_error_free(error);
+    environment_flush_unref(flush);
+    return;
+  }
+
+  g_variant_builder_init(&activation_builder, G_VARIANT_TYPE("a{ss}"));
+#ifdef HAVE_SYSTEMD
+  g_variant_builder_init(&user_builder, G_VARIANT_TYPE("as"));
+#endif
+
+  g_hash_table_iter_init(&iter, flush->variables);
+  while (g_hash_table_iter_next(&iter, &key, &value)) {
+    g_variant_builder_add(&activation_builder, "{ss}", key, value);
+#ifdef HAVE_SYSTEMD
+    g_variant_builder_add_value(
+        &user_builder,
+        g_variant_new_take_string(g_strdup_printf("%s=%s", (char *)key,
+                                                  (char *)value)));
+#endif
+  }
+
+  /* Both targets are updated in parallel, the flush completes when the
+   * last one answered */
+  flush->n_pending++;
+  g_dbus_connection_call(
+      connection, "org.freedesktop.DBus", "/org/freedesktop/DBus",
+      "org.freedesktop.DBus", "UpdateActivationEnvironment",
+      g_variant_new("(@a{ss})", g_variant_builder_end(&activation_builder)),
+      NULL, G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+      (GAsyncReadyCallback)on_activation_environment_updated, flush);
+
+#ifdef HAVE_SYSTEMD
+  flush->n_pending++;
+  g_dbus_connection_call(
+      connection, "org.freedesktop.systemd1", "/org/freedesktop/systemd1",
+      "org.freedesktop.systemd1.Manager", "SetEnvironment",
+      g_variant_new("(@as)", g_variant_builder_end(&user_builder)), NULL,
+      G_DBUS_CALL_FLAGS_NONE, -1, NULL,
+      (GAsyncReadyCallback)on_user_environment_updated, flush);
+#endif
+
+  g_object_unref(connection);
+  environment_flush_unref(flush);
+}
+
+void gsm_util_setenv(const char *variable, const char *value) {
+  g_setenv(variable, value, TRUE);
+
+  if (pending_environment == NULL) {
+    pending_environment =
+        g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  }
+
+  g_hash_table_replace(pending_environment, g_strdup(variable),
+                       g_strdup(value));
+}
+
+/* Exports the variables set since the last flush and calls @func once
+ * both the bus and systemd know about them, or right away if there is
+ * nothing to export.
+ */
+void gsm_util_flush_environment(GsmUtilEnvironmentFlushedFunc func,
+                                gpointer user_data) {
+  EnvironmentFlush *flush;
+
+  if (pending_environment == NULL ||
+      g_hash_table_size(pending_environment) == 0) {
+    if (func != NULL) {
+      func(user_data);
+    }
+    return;
+  }
+
+  g_debug("GsmUtil: Exporting %u environment variables",
+          g_hash_table_size(pending_environment));
+
+  flush = g_slice_new0(EnvironmentFlush);
+  flush->func = func;
+  flush->user_data = user_data;
+  flush->variables = pending_environment;
+  flush->n_pending = 1;
+  pending_environment = NULL;
+
+  g_bus_get(G_BUS_TYPE_SESSION, NULL,
+            (GAsyncReadyCallback)on_environment_bus_get, flush);
 }
 
 GtkWidget *gsm_util_dialog_add_button(GtkDialog *dialog,
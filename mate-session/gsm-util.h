@@ -33,8 +33,6 @@ gchar **gsm_get_screen_locker_command(void);
 char *gsm_util_find_desktop_file_for_app_name(const char *app_name,
                                               char **dirs);
 
-gchar *gsm_util_get_empty_tmp_session_dir(void);
-
 const char *gsm_util_get_saved_session_dir(void);
 
 gchar **gsm_util_get_autostart_dirs(void);
@@ -47,13 +45,22 @@ void gsm_util_init_error(gboolean fatal, const char *format, ...);
 
 char *gsm_util_generate_startup_id(void);
 
+char *gsm_util_intern(const char *str);
+void gsm_util_intern_release(char *str);
+void gsm_util_intern_freev(char **strv);
+gboolean gsm_util_intern_equal(gconstpointer a, gconstpointer b);
+
 gboolean gsm_util_export_activation_environment(GError **error);
 
 #ifdef HAVE_SYSTEMD
 gboolean gsm_util_export_user_environment(GError **error);
 #endif
 
+typedef void (*GsmUtilEnvironmentFlushedFunc)(gpointer user_data);
+
 void gsm_util_setenv(const char *variable, const char *value);
+void gsm_util_flush_environment(GsmUtilEnvironmentFlushedFunc func,
+                                gpointer user_data);
 
 GtkWidget *gsm_util_dialog_add_button(GtkDialog *dialog,
                                       const gchar *button_text,
@@ -30,6 +30,7 @@
 #include <fcntl.h>
 #include <gio/gio.h>
 #include <glib/gi18n.h>
+#include <poll.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
@@ -38,10 +39,14 @@
 #include "gsm-autostart-app.h"
 #include "gsm-manager.h"
 #include "gsm-marshal.h"
+#include "gsm-settings.h"
+#include "gsm-trace.h"
 #include "gsm-util.h"
 
 #define GsmDesktopFile "_GSM_DesktopFile"
 
+#define KEY_XSMP_BATCH_LIMIT "xsmp-batch-limit"
+
 typedef struct {
   GsmClient parent;
   SmsConn conn;
@@ -50,7 +55,15 @@ typedef struct {
   guint watch_id;
 
   char *description;
-  GPtrArray *props;
+  GHashTable *props; /* name -> SmProp */
+
+  /* Parsed values of the properties used when saving the session */
+  GsmClientRestartStyle restart_style;
+  guint pid;
+  char *program;
+  char *restart_command;
+  char *discard_command;
+  char *desktop_file;
 
   /* SaveYourself state */
   int current_save_yourself;
@@ -66,16 +79,55 @@ static guint signals[LAST_SIGNAL] = {0};
 
 G_DEFINE_TYPE_WITH_PRIVATE(GsmXSMPClient, gsm_xsmp_client, GSM_TYPE_CLIENT)
 
+/* How many messages a connection may have handled in a single main loop
+ * wakeup before the others get their turn */
+guint gsm_xsmp_get_batch_limit(void) {
+  static guint batch_limit = 0;
+
+  if (batch_limit == 0) {
+    batch_limit = MAX(
+        gsm_settings_get_int(GSM_SETTINGS_SESSION, KEY_XSMP_BATCH_LIMIT), 1);
+  }
+
+  return batch_limit;
+}
+
+/* Whether another message was already received on @ice_conn, so that it
+ * can be handled without going back to the main loop */
+gboolean gsm_xsmp_has_pending_input(IceConn ice_conn) {
+  struct pollfd pfd;
+
+  if (IceConnectionStatus(ice_conn) != IceConnectAccepted &&
+      IceConnectionStatus(ice_conn) != IceConnectPending) {
+    return FALSE;
+  }
+
+  pfd.fd = IceConnectionNumber(ice_conn);
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+
+  return poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN);
+}
+
 static gboolean client_iochannel_watch(GIOChannel *channel,
                                        GIOCondition condition,
                                        GsmXSMPClient *client) {
   gboolean keep_going;
+  IceProcessMessagesStatus status;
+  guint n_messages = 0;
   GsmXSMPClientPrivate *priv;
 
   g_object_ref(client);
   priv = gsm_xsmp_client_get_instance_private(client);
 
-  switch (IceProcessMessages(priv->ice_connection, NULL, NULL)) {
+  do {
+    status = IceProcessMessages(priv->ice_connection, NULL, NULL);
+    n_messages++;
+  } while (status == IceProcessMessagesSuccess &&
+           n_messages < gsm_xsmp_get_batch_limit() &&
+           gsm_xsmp_has_pending_input(priv->ice_connection));
+
+  switch (status) {
     case IceProcessMessagesSuccess:
       keep_going = TRUE;
       break;
@@ -106,39 +158,25 @@ static gboolean client_iochannel_watch(GIOChannel *channel,
   return keep_going;
 }
 
-static SmProp *find_property(GsmXSMPClient *client, const char *name,
-                             int *index) {
+static SmProp *find_property(GsmXSMPClient *client, const char *name) {
   GsmXSMPClientPrivate *priv;
-  guint i;
 
   priv = gsm_xsmp_client_get_instance_private(client);
-  for (i = 0; i < priv->props->len; i++) {
-    SmProp *prop = priv->props->pdata[i];
-    if (strcmp(prop->name, name) == 0) {
-      if (index)
-        *index = (int)i;
-      return prop;
-    }
-  }
-  if (index)
-    *index = -1;
-  return NULL;
+
+  return g_hash_table_lookup(priv->props, name);
 }
 
 static void set_description(GsmXSMPClient *client) {
-  SmProp *prop;
   const char *id;
   GsmXSMPClientPrivate *priv;
 
   priv = gsm_xsmp_client_get_instance_private(client);
-  prop = find_property(client, SmProgram, NULL);
   id = gsm_client_peek_startup_id(GSM_CLIENT(client));
 
   g_free(priv->description);
-  if (prop) {
+  if (priv->program != NULL) {
     priv->description =
-        g_strdup_printf("%p [%.*s %s]", client, prop->vals[0].length,
-                        (char *)prop->vals[0].value, id);
+        g_strdup_printf("%p [%s %s]", client, priv->program, id);
   } else if (id != NULL) {
     priv->description = g_strdup_printf("%p [%s]", client, id);
   } else {
@@ -184,26 +222,103 @@ static void gsm_xsmp_client_init(GsmXSMPClient *client) {
 
   priv = gsm_xsmp_client_get_instance_private(client);
 
-  priv->props = g_ptr_array_new();
+  priv->props = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+                                      (GDestroyNotify)SmFreeProperty);
+  priv->restart_style = GSM_CLIENT_RESTART_IF_RUNNING;
   priv->current_save_yourself = -1;
   priv->next_save_yourself = -1;
   priv->next_save_yourself_allow_interact = FALSE;
 }
 
-static void delete_property(GsmXSMPClient *client, const char *name) {
-  int index;
+static char *prop_to_command(SmProp *prop);
+static gboolean _parse_value_as_uint(const char *value, guint *uintval);
+
+static char *prop_to_string(SmProp *prop) {
+  if (prop == NULL || strcmp(prop->type, SmARRAY8) != 0 ||
+      prop->num_vals < 1) {
+    return NULL;
+  }
+
+  return g_strndup(prop->vals[0].value, prop->vals[0].length);
+}
+
+static char *prop_to_command_or_null(SmProp *prop) {
+  if (prop == NULL || strcmp(prop->type, SmLISTofARRAY8) != 0) {
+    return NULL;
+  }
+
+  return prop_to_command(prop);
+}
+
+static GsmClientRestartStyle prop_to_restart_style(SmProp *prop) {
+  if (prop == NULL || strcmp(prop->type, SmCARD8) != 0 ||
+      prop->num_vals < 1) {
+    return GSM_CLIENT_RESTART_IF_RUNNING;
+  }
+
+  switch (((unsigned char *)prop->vals[0].value)[0]) {
+    case SmRestartAnyway:
+      return GSM_CLIENT_RESTART_ANYWAY;
+    case SmRestartImmediately:
+      return GSM_CLIENT_RESTART_IMMEDIATELY;
+    case SmRestartNever:
+      return GSM_CLIENT_RESTART_NEVER;
+    case SmRestartIfRunning:
+    default:
+      return GSM_CLIENT_RESTART_IF_RUNNING;
+  }
+}
+
+static guint prop_to_pid(SmProp *prop) {
+  char *value;
+  guint pid = 0;
+
+  value = prop_to_string(prop);
+  if (value == NULL || !_parse_value_as_uint(value, &pid)) {
+    pid = 0;
+  }
+  g_free(value);
+
+  return pid;
+}
+
+/* Parses the property @name again after it was set or deleted, if it is
+ * one of those read when saving the session */
+static void update_parsed_property(GsmXSMPClient *client, const char *name) {
   SmProp *prop;
   GsmXSMPClientPrivate *priv;
 
   priv = gsm_xsmp_client_get_instance_private(client);
-
-  prop = find_property(client, name, &index);
-  if (!prop) {
-    return;
+  prop = find_property(client, name);
+
+  if (strcmp(name, SmProgram) == 0) {
+    g_free(priv->program);
+    priv->program = prop_to_string(prop);
+    set_description(client);
+  } else if (strcmp(name, SmRestartCommand) == 0) {
+    g_free(priv->restart_command);
+    priv->restart_command = prop_to_command_or_null(prop);
+  } else if (strcmp(name, SmDiscardCommand) == 0) {
+    g_free(priv->discard_command);
+    priv->discard_command = prop_to_command_or_null(prop);
+  } else if (strcmp(name, SmRestartStyleHint) == 0) {
+    priv->restart_style = prop_to_restart_style(prop);
+  } else if (strcmp(name, SmProcessID) == 0) {
+    priv->pid = prop_to_pid(prop);
+  } else if (strcmp(name, GsmDesktopFile) == 0) {
+    g_free(priv->desktop_file);
+    priv->desktop_file = prop_to_string(prop);
   }
+}
 
-  g_ptr_array_remove_index_fast(priv->props, index);
-  SmFreeProperty(prop);
+static void delete_property(GsmXSMPClient *client, const char *name) {
+  GsmXSMPClientPrivate *priv;
+
+  priv = gsm_xsmp_client_get_instance_private(client);
+
+  if (g_hash_table_remove(priv->props, name)) {
+    update_parsed_property(client, name);
+  }
 }
 
 static void debug_print_property(SmProp *prop) {
@@ -248,12 +363,12 @@ static void set_properties_callback(SmsConn conn, SmPointer manager_data,
   g_debug("GsmXSMPClient: Set properties from client '%s'", priv->description);
 
   for (i = 0; i < num_props; i++) {
-    delete_property(client, props[i]->name);
-    g_ptr_array_add(priv->props, props[i]);
+    /* the key is owned by the property, so replace both */
+    g_hash_table_replace(priv->props, props[i]->name, props[i]);
 
     debug_print_property(props[i]);
 
-    if (!strcmp(props[i]->name, SmProgram)) set_description(client);
+    update_parsed_property(client, props[i]->name);
   }
 
   free(props);
@@ -281,12 +396,25 @@ static void delete_properties_callback(SmsConn conn, SmPointer manager_data,
 static void get_properties_callback(SmsConn conn, SmPointer manager_data) {
   GsmXSMPClientPrivate *priv;
   GsmXSMPClient *client = manager_data;
+  GHashTableIter iter;
+  gpointer value;
+  SmProp **props;
+  int n_props = 0;
 
   priv = gsm_xsmp_client_get_instance_private(client);
 
   g_debug("GsmXSMPClient: Get properties request from '%s'", priv->description);
 
-  SmsReturnProperties(conn, priv->props->len, (SmProp **)priv->props->pdata);
+  props = g_new(SmProp *, g_hash_table_size(priv->props));
+
+  g_hash_table_iter_init(&iter, priv->props);
+  while (g_hash_table_iter_next(&iter, NULL, &value)) {
+    props[n_props++] = value;
+  }
+
+  SmsReturnProperties(conn, n_props, props);
+
+  g_free(props);
 }
 
 static char *prop_to_command(SmProp *prop) {
@@ -331,27 +459,19 @@ static char *prop_to_command(SmProp *prop) {
 }
 
 static char *xsmp_get_restart_command(GsmClient *client) {
-  SmProp *prop;
-
-  prop = find_property(GSM_XSMP_CLIENT(client), SmRestartCommand, NULL);
+  GsmXSMPClientPrivate *priv;
 
-  if (!prop || strcmp(prop->type, SmLISTofARRAY8) != 0) {
-    return NULL;
-  }
+  priv = gsm_xsmp_client_get_instance_private(GSM_XSMP_CLIENT(client));
 
-  return prop_to_command(prop);
+  return g_strdup(priv->restart_command);
 }
 
 static char *xsmp_get_discard_command(GsmClient *client) {
-  SmProp *prop;
-
-  prop = find_property(GSM_XSMP_CLIENT(client), SmDiscardCommand, NULL);
+  GsmXSMPClientPrivate *priv;
 
-  if (!prop || strcmp(prop->type, SmLISTofARRAY8) != 0) {
-    return NULL;
-  }
+  priv = gsm_xsmp_client_get_instance_private(GSM_XSMP_CLIENT(client));
 
-  return prop_to_command(prop);
+  return g_strdup(priv->discard_command);
 }
 
 static void do_save_yourself(GsmXSMPClient *client, int save_type,
@@ -448,17 +568,16 @@ static gboolean xsmp_cancel_end_session(GsmClient *client, GError **error) {
 }
 
 static char *get_desktop_file_path(GsmXSMPClient *client) {
-  SmProp *prop;
   char *desktop_file_path = NULL;
   char **dirs;
-  const char *program_name;
+  GsmXSMPClientPrivate *priv;
+
+  priv = gsm_xsmp_client_get_instance_private(client);
 
   /* XSMP clients using eggsmclient defines a special property
    * pointing to their respective desktop entry file */
-  prop = find_property(client, GsmDesktopFile, NULL);
-
-  if (prop) {
-    GFile *file = g_file_new_for_uri(prop->vals[0].value);
+  if (priv->desktop_file != NULL) {
+    GFile *file = g_file_new_for_uri(priv->desktop_file);
     desktop_file_path = g_file_get_path(file);
     g_object_unref(file);
     goto out;
@@ -466,18 +585,14 @@ static char *get_desktop_file_path(GsmXSMPClient *client) {
 
   /* If we can't get desktop file from GsmDesktopFile then we
    * try to find the desktop file from its program name */
-  prop = find_property(client, SmProgram, NULL);
-
-  if (!prop) {
+  if (priv->program == NULL) {
     goto out;
   }
 
-  program_name = prop->vals[0].value;
-
   dirs = gsm_util_get_autostart_dirs();
 
   desktop_file_path =
-      gsm_util_find_desktop_file_for_app_name(program_name, dirs);
+      gsm_util_find_desktop_file_for_app_name(priv->program, dirs);
 
   g_strfreev(dirs);
 
@@ -491,14 +606,14 @@ out:
 
 static void set_desktop_file_keys_from_client(GsmClient *client,
                                               GKeyFile *keyfile) {
-  SmProp *prop;
   const char *name;
   char *comment;
+  GsmXSMPClientPrivate *priv;
 
-  prop = find_property(GSM_XSMP_CLIENT(client), SmProgram, NULL);
+  priv = gsm_xsmp_client_get_instance_private(GSM_XSMP_CLIENT(client));
 
-  if (prop) {
-    name = prop->vals[0].value;
+  if (priv->program != NULL) {
+    name = priv->program;
   } else {
     /* It'd be really surprising to reach this code: if we're here,
      * then the XSMP client already has set several XSMP
@@ -546,30 +661,24 @@ static GKeyFile *create_client_key_file(GsmClient *client,
   return keyfile;
 }
 
-static GsmClientRestartStyle xsmp_get_restart_style_hint(GsmClient *client);
-
 static GKeyFile *xsmp_save(GsmClient *client, GError **error) {
-  GsmClientRestartStyle restart_style;
-
   GKeyFile *keyfile = NULL;
   char *desktop_file_path = NULL;
-  char *exec_program = NULL;
-  char *exec_discard = NULL;
-  char *startup_id = NULL;
   GError *local_error;
+  GsmXSMPClientPrivate *priv;
+
+  priv = gsm_xsmp_client_get_instance_private(GSM_XSMP_CLIENT(client));
 
   g_debug("GsmXSMPClient: saving client with id %s",
           gsm_client_peek_id(client));
 
   local_error = NULL;
 
-  restart_style = xsmp_get_restart_style_hint(client);
-  if (restart_style == GSM_CLIENT_RESTART_NEVER) {
+  if (priv->restart_style == GSM_CLIENT_RESTART_NEVER) {
     goto out;
   }
 
-  exec_program = xsmp_get_restart_command(client);
-  if (!exec_program) {
+  if (priv->restart_command == NULL) {
     goto out;
   }
 
@@ -582,24 +691,20 @@ static GKeyFile *xsmp_save(GsmClient *client, GError **error) {
     goto out;
   }
 
-  g_object_get(client, "startup-id", &startup_id, NULL);
-
   g_key_file_set_string(keyfile, G_KEY_FILE_DESKTOP_GROUP,
-                        GSM_AUTOSTART_APP_STARTUP_ID_KEY, startup_id);
+                        GSM_AUTOSTART_APP_STARTUP_ID_KEY,
+                        gsm_client_peek_startup_id(client));
 
   g_key_file_set_string(keyfile, G_KEY_FILE_DESKTOP_GROUP,
-                        G_KEY_FILE_DESKTOP_KEY_EXEC, exec_program);
+                        G_KEY_FILE_DESKTOP_KEY_EXEC, priv->restart_command);
 
-  exec_discard = xsmp_get_discard_command(client);
-  if (exec_discard)
+  if (priv->discard_command)
     g_key_file_set_string(keyfile, G_KEY_FILE_DESKTOP_GROUP,
-                          GSM_AUTOSTART_APP_DISCARD_KEY, exec_discard);
+                          GSM_AUTOSTART_APP_DISCARD_KEY,
+                          priv->discard_command);
 
 out:
   g_free(desktop_file_path);
-  g_free(exec_program);
-  g_free(exec_discard);
-  g_free(startup_id);
 
   if (local_error != NULL) {
     g_propagate_error(error, local_error);
@@ -697,7 +802,7 @@ static char *xsmp_get_app_name(GsmClient *client) {
   SmProp *prop;
   char *name = NULL;
 
-  prop = find_property(GSM_XSMP_CLIENT(client), SmProgram, NULL);
+  prop = find_property(GSM_XSMP_CLIENT(client), SmProgram);
   if (prop) {
     name = prop_to_command(prop);
   }
@@ -776,8 +881,11 @@ static void gsm_xsmp_client_finalize(GObject *object) {
   gsm_xsmp_client_disconnect(client);
 
   g_free(priv->description);
-  g_ptr_array_foreach(priv->props, (GFunc)SmFreeProperty, NULL);
-  g_ptr_array_free(priv->props, TRUE);
+  g_hash_table_destroy(priv->props);
+  g_free(priv->program);
+  g_free(priv->restart_command);
+  g_free(priv->discard_command);
+  g_free(priv->desktop_file);
 
   G_OBJECT_CLASS(gsm_xsmp_client_parent_class)->finalize(object);
 }
@@ -797,36 +905,11 @@ static gboolean _boolean_handled_accumulator(GSignalInvocationHint *ihint,
 }
 
 static GsmClientRestartStyle xsmp_get_restart_style_hint(GsmClient *client) {
-  SmProp *prop;
-  GsmClientRestartStyle hint;
-
-  g_debug("GsmXSMPClient: getting restart style");
-  hint = GSM_CLIENT_RESTART_IF_RUNNING;
-
-  prop = find_property(GSM_XSMP_CLIENT(client), SmRestartStyleHint, NULL);
-
-  if (!prop || strcmp(prop->type, SmCARD8) != 0) {
-    return GSM_CLIENT_RESTART_IF_RUNNING;
-  }
+  GsmXSMPClientPrivate *priv;
 
-  switch (((unsigned char *)prop->vals[0].value)[0]) {
-    case SmRestartIfRunning:
-      hint = GSM_CLIENT_RESTART_IF_RUNNING;
-      break;
-    case SmRestartAnyway:
-      hint = GSM_CLIENT_RESTART_ANYWAY;
-      break;
-    case SmRestartImmediately:
-      hint = GSM_CLIENT_RESTART_IMMEDIATELY;
-      break;
-    case SmRestartNever:
-      hint = GSM_CLIENT_RESTART_NEVER;
-      break;
-    default:
-      break;
-  }
+  priv = gsm_xsmp_client_get_instance_private(GSM_XSMP_CLIENT(client));
 
-  return hint;
+  return priv->restart_style;
 }
 
 static gboolean _parse_value_as_uint(const char *value, guint *uintval) {
@@ -852,25 +935,11 @@ static gboolean _parse_value_as_uint(const char *value, guint *uintval) {
 }
 
 static guint xsmp_get_unix_process_id(GsmClient *client) {
-  SmProp *prop;
-  guint pid;
-  gboolean res;
-
-  g_debug("GsmXSMPClient: getting pid");
-
-  prop = find_property(GSM_XSMP_CLIENT(client), SmProcessID, NULL);
-
-  if (!prop || strcmp(prop->type, SmARRAY8) != 0) {
-    return 0;
-  }
+  GsmXSMPClientPrivate *priv;
 
-  pid = 0;
-  res = _parse_value_as_uint((char *)prop->vals[0].value, &pid);
-  if (!res) {
-    pid = 0;
-  }
+  priv = gsm_xsmp_client_get_instance_private(GSM_XSMP_CLIENT(client));
 
-  return pid;
+  return priv->pid;
 }
 
 static void gsm_xsmp_client_class_init(GsmXSMPClientClass *klass) {
@@ -954,6 +1023,8 @@ static Status register_client_callback(SmsConn conn, SmPointer manager_data,
 
   set_description(client);
 
+  gsm_trace_instant("xsmp", "register-client", id);
+
   g_debug("GsmXSMPClient: Sending RegisterClientReply to '%s'",
           priv->description);
 
@@ -1190,6 +1261,22 @@ void gsm_xsmp_client_connect(GsmXSMPClient *client, SmsConn conn,
   callbacks_ret->get_properties.manager_data = client;
 }
 
+/* Asks an idle client to update its saved state, without interaction;
+ * clients that are already saving are left alone */
 void gsm_xsmp_client_save_state(GsmXSMPClient *client) {
+  GsmXSMPClientPrivate *priv;
+
   g_return_if_fail(GSM_IS_XSMP_CLIENT(client));
+
+  priv = gsm_xsmp_client_get_instance_private(client);
+
+  if (priv->conn == NULL || priv->current_save_yourself != -1 ||
+      gsm_client_peek_status(GSM_CLIENT(client)) != GSM_CLIENT_REGISTERED) {
+    return;
+  }
+
+  g_debug("GsmXSMPClient: Sending checkpoint SaveYourself to '%s'",
+          priv->description);
+
+  do_save_yourself(client, SmSaveLocal, FALSE);
 }
@@ -51,6 +51,9 @@ struct _GsmXSMPClientClass {
   void (*save_yourself_done)(GsmXSMPClient *client);
 };
 
+guint gsm_xsmp_get_batch_limit(void);
+gboolean gsm_xsmp_has_pending_input(IceConn ice_conn);
+
 GsmClient *gsm_xsmp_client_new(IceConn ice_conn);
 
 void gsm_xsmp_client_connect(GsmXSMPClient *client, SmsConn conn,
@@ -30,14 +30,19 @@
 #include <X11/ICE/ICEutil.h>
 #include <X11/SM/SMlib.h>
 #include <fcntl.h>
+#include <gio/gio.h>
 #include <glib-object.h>
 #include <glib.h>
 #include <glib/gi18n.h>
+#include <glib/gstdio.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 #if HAVE_XTRANS
@@ -49,6 +54,7 @@
 #undef TRANS_SERVER
 #endif /* HAVE_XTRANS */
 
+#include "gsm-settings.h"
 #include "gsm-util.h"
 #include "gsm-xsmp-client.h"
 #include "gsm-xsmp-server.h"
@@ -62,6 +68,13 @@
 #define GSM_ICE_MAGIC_COOKIE_AUTH_NAME "MIT-MAGIC-COOKIE-1"
 #define GSM_ICE_MAGIC_COOKIE_LEN 16
 
+#define KEY_PRIVATE_ICEAUTHORITY "private-ice-authority"
+
+/* First file descriptor passed by systemd socket activation */
+#define GSM_LISTEN_FDS_START 3
+/* Listening socket passed by a parent that is not systemd */
+#define GSM_XSMP_FD_ENV "MATE_SESSION_XSMP_FD"
+
 struct _GsmXsmpServer {
   GObject parent;
   GsmStore *client_store;
@@ -69,6 +82,12 @@ struct _GsmXsmpServer {
   IceListenObj *xsmp_sockets;
   int num_xsmp_sockets;
   int num_local_xsmp_sockets;
+
+  /* Network ID of the pre-bound socket that replaced xsmp_sockets[0] */
+  char *activated_network_id;
+
+  GSList *auth_entries; /* IceAuthFileEntry written for our sockets */
+  char *private_authority;
 };
 
 enum { PROP_0, PROP_CLIENT_STORE };
@@ -126,10 +145,20 @@ static gboolean auth_iochannel_watch(GIOChannel *source, GIOCondition condition,
                                      IceConn ice_conn) {
   GsmIceConnectionWatch *data;
   gboolean keep_going;
+  IceProcessMessagesStatus status;
+  guint n_messages = 0;
 
   data = ice_conn->context;
 
-  switch (IceProcessMessages(ice_conn, NULL, NULL)) {
+  /* Stop as soon as the connection got its own GsmXSMPClient watch */
+  do {
+    status = IceProcessMessages(ice_conn, NULL, NULL);
+    n_messages++;
+  } while (status == IceProcessMessagesSuccess && ice_conn->context == data &&
+           n_messages < gsm_xsmp_get_batch_limit() &&
+           gsm_xsmp_has_pending_input(ice_conn));
+
+  switch (status) {
     case IceProcessMessagesSuccess:
       keep_going = TRUE;
       break;
@@ -297,6 +326,7 @@ static Status accept_xsmp_connection(SmsConn sms_conn, GsmXsmpServer *server,
 
   /* Each GsmXSMPClient has its own IceConn watcher */
   free_ice_connection_watch(data);
+  ice_conn->context = NULL;
 
   client = gsm_xsmp_client_new(ice_conn);
 
@@ -354,8 +384,12 @@ static void sms_error_handler(SmsConn conn, Bool swap,
    */
 }
 
+/* @network_id is the one libICE knows the listener by, @advertised_id the
+ * one clients find in SESSION_MANAGER and look their cookie up with.
+ */
 static IceAuthFileEntry *auth_entry_new(const char *protocol,
-                                        const char *network_id) {
+                                        const char *network_id,
+                                        const char *advertised_id) {
   IceAuthFileEntry *file_entry;
   IceAuthDataEntry data_entry;
 
@@ -364,7 +398,7 @@ static IceAuthFileEntry *auth_entry_new(const char *protocol,
   file_entry->protocol_name = strdup(protocol);
   file_entry->protocol_data = NULL;
   file_entry->protocol_data_length = 0;
-  file_entry->network_id = strdup(network_id);
+  file_entry->network_id = strdup(advertised_id);
   file_entry->auth_name = strdup(GSM_ICE_MAGIC_COOKIE_AUTH_NAME);
   file_entry->auth_data = IceGenerateMagicCookie(GSM_ICE_MAGIC_COOKIE_LEN);
   file_entry->auth_data_length = GSM_ICE_MAGIC_COOKIE_LEN;
@@ -373,7 +407,7 @@ static IceAuthFileEntry *auth_entry_new(const char *protocol,
    * actually use for checking client auth.
    */
   data_entry.protocol_name = file_entry->protocol_name;
-  data_entry.network_id = file_entry->network_id;
+  data_entry.network_id = (char *)network_id;
   data_entry.auth_name = file_entry->auth_name;
   data_entry.auth_data = file_entry->auth_data;
   data_entry.auth_data_length = file_entry->auth_data_length;
@@ -382,15 +416,115 @@ static IceAuthFileEntry *auth_entry_new(const char *protocol,
   return file_entry;
 }
 
-static gboolean update_iceauthority(GsmXsmpServer *server, gboolean adding) {
+typedef gboolean (*AuthEntryFilter)(GsmXsmpServer *server,
+                                    IceAuthFileEntry *entry);
+
+/* Entries with no network ID are invalid, and entries with the network ID
+ * of one of our sockets were left behind by an old process */
+static gboolean auth_entry_is_stale(GsmXsmpServer *server,
+                                    IceAuthFileEntry *entry) {
+  GSList *l;
+
+  if (entry->network_id == NULL) {
+    return TRUE;
+  }
+
+  for (l = server->auth_entries; l != NULL; l = l->next) {
+    IceAuthFileEntry *ours = l->data;
+
+    if (strcmp(entry->network_id, ours->network_id) == 0) {
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+static gboolean auth_entry_is_ours(GsmXsmpServer *server,
+                                   IceAuthFileEntry *entry) {
+  GSList *l;
+
+  for (l = server->auth_entries; l != NULL; l = l->next) {
+    IceAuthFileEntry *ours = l->data;
+
+    if (entry->network_id != NULL &&
+        strcmp(entry->network_id, ours->network_id) == 0 &&
+        strcmp(entry->protocol_name, ours->protocol_name) == 0 &&
+        entry->auth_data_length == ours->auth_data_length &&
+        memcmp(entry->auth_data, ours->auth_data, ours->auth_data_length) ==
+            0) {
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+static void write_auth_entries(FILE *fp, GSList *entries) {
+  GSList *l;
+
+  for (l = entries; l != NULL; l = l->next) {
+    IceWriteAuthFileEntry(fp, l->data);
+  }
+}
+
+/* Rewrites the locked ICE authority file without the entries matching
+ * @filter, followed by our own entries if @add_ours */
+static gboolean rewrite_iceauthority(GsmXsmpServer *server, FILE *fp,
+                                     AuthEntryFilter filter,
+                                     gboolean add_ours) {
+  IceAuthFileEntry *auth_entry;
+  GSList *entries = NULL;
+  gboolean ok;
+
+  rewind(fp);
+  while ((auth_entry = IceReadAuthFileEntry(fp)) != NULL) {
+    if (filter(server, auth_entry)) {
+      IceFreeAuthFileEntry(auth_entry);
+    } else {
+      entries = g_slist_prepend(entries, auth_entry);
+    }
+  }
+  entries = g_slist_reverse(entries);
+
+  rewind(fp);
+  write_auth_entries(fp, entries);
+  if (add_ours) {
+    write_auth_entries(fp, server->auth_entries);
+  }
+
+  ok = (fflush(fp) == 0 && ftruncate(fileno(fp), ftell(fp)) == 0);
+
+  g_slist_free_full(entries, (GDestroyNotify)IceFreeAuthFileEntry);
+
+  return ok;
+}
+
+/* Appends our entries to the ICE authority file. It is only rewritten when
+ * it has stale or invalid entries, which would shadow ours */
+static gboolean add_iceauthority_entries(GsmXsmpServer *server) {
   char *filename;
-  char **our_network_ids;
   FILE *fp;
   IceAuthFileEntry *auth_entry;
-  GSList *entries;
-  GSList *e;
-  int i;
+  gboolean has_stale = FALSE;
   gboolean ok = FALSE;
+  int i;
+
+  for (i = 0; i < server->num_local_xsmp_sockets; i++) {
+    char *network_id = IceGetListenConnectionString(server->xsmp_sockets[i]);
+    const char *advertised_id = network_id;
+
+    if (i == 0 && server->activated_network_id != NULL) {
+      advertised_id = server->activated_network_id;
+    }
+
+    server->auth_entries = g_slist_append(
+        server->auth_entries, auth_entry_new("ICE", network_id, advertised_id));
+    server->auth_entries =
+        g_slist_append(server->auth_entries,
+                       auth_entry_new("XSMP", network_id, advertised_id));
+    free(network_id);
+  }
 
   filename = IceAuthFileName();
   if (IceLockAuthFile(filename, GSM_ICE_AUTH_RETRIES, GSM_ICE_AUTH_INTERVAL,
@@ -398,41 +532,12 @@ static gboolean update_iceauthority(GsmXsmpServer *server, gboolean adding) {
     return FALSE;
   }
 
-  our_network_ids = g_malloc(server->num_local_xsmp_sockets * sizeof(char *));
-  for (i = 0; i < server->num_local_xsmp_sockets; i++) {
-    our_network_ids[i] = IceGetListenConnectionString(server->xsmp_sockets[i]);
-  }
-
-  entries = NULL;
-
   fp = fopen(filename, "r+");
   if (fp != NULL) {
-    while ((auth_entry = IceReadAuthFileEntry(fp)) != NULL) {
-      /* Skip/delete entries with no network ID (invalid), or with
-       * our network ID; if we're starting up, an entry with our
-       * ID must be a stale entry left behind by an old process,
-       * and if we're shutting down, it won't be valid in the
-       * future, so either way we want to remove it from the list.
-       */
-      if (!auth_entry->network_id) {
-        IceFreeAuthFileEntry(auth_entry);
-        continue;
-      }
-
-      for (i = 0; i < server->num_local_xsmp_sockets; i++) {
-        if (!strcmp(auth_entry->network_id, our_network_ids[i])) {
-          IceFreeAuthFileEntry(auth_entry);
-          break;
-        }
-      }
-      if (i != server->num_local_xsmp_sockets) {
-        continue;
-      }
-
-      entries = g_slist_prepend(entries, auth_entry);
+    while (!has_stale && (auth_entry = IceReadAuthFileEntry(fp)) != NULL) {
+      has_stale = auth_entry_is_stale(server, auth_entry);
+      IceFreeAuthFileEntry(auth_entry);
     }
-
-    rewind(fp);
   } else {
     int fd;
 
@@ -452,39 +557,251 @@ static gboolean update_iceauthority(GsmXsmpServer *server, gboolean adding) {
     }
   }
 
-  if (adding) {
-    for (i = 0; i < server->num_local_xsmp_sockets; i++) {
-      entries =
-          g_slist_append(entries, auth_entry_new("ICE", our_network_ids[i]));
-      entries =
-          g_slist_prepend(entries, auth_entry_new("XSMP", our_network_ids[i]));
-    }
-  }
-
-  for (e = entries; e; e = e->next) {
-    IceAuthFileEntry *auth_file_entry = e->data;
-    IceWriteAuthFileEntry(fp, auth_file_entry);
-    IceFreeAuthFileEntry(auth_file_entry);
+  if (has_stale) {
+    g_debug("GsmXsmpServer: removing stale entries from %s", filename);
+    ok = rewrite_iceauthority(server, fp, auth_entry_is_stale, TRUE);
+  } else {
+    fseek(fp, 0, SEEK_END);
+    write_auth_entries(fp, server->auth_entries);
+    ok = (fflush(fp) == 0);
   }
-  g_slist_free(entries);
 
   fclose(fp);
-  ok = TRUE;
 
 cleanup:
   IceUnlockAuthFile(filename);
-  for (i = 0; i < server->num_local_xsmp_sockets; i++) {
-    free(our_network_ids[i]);
-  }
-  g_free(our_network_ids);
 
   return ok;
 }
 
+/* Removes exactly the entries we added, with a single rewrite */
+static void remove_iceauthority_entries(GsmXsmpServer *server) {
+  char *filename;
+  FILE *fp;
+
+  if (server->auth_entries == NULL) {
+    return;
+  }
+
+  if (server->private_authority != NULL) {
+    g_unlink(server->private_authority);
+    return;
+  }
+
+  filename = IceAuthFileName();
+  if (IceLockAuthFile(filename, GSM_ICE_AUTH_RETRIES, GSM_ICE_AUTH_INTERVAL,
+                      GSM_ICE_AUTH_LOCK_TIMEOUT) != IceAuthLockSuccess) {
+    g_warning("Unable to lock ICE authority file: %s", filename);
+    return;
+  }
+
+  fp = fopen(filename, "r+");
+  if (fp != NULL) {
+    if (!rewrite_iceauthority(server, fp, auth_entry_is_ours, FALSE)) {
+      g_warning("Unable to write to ICE authority file: %s", filename);
+    }
+    fclose(fp);
+  }
+
+  IceUnlockAuthFile(filename);
+}
+
+/* Keeps our entries in a file of our own rather than in the one that is
+ * shared with other sessions, unless ICEAUTHORITY was set by the user */
+static void setup_private_iceauthority(GsmXsmpServer *server) {
+  gboolean private_authority;
+  char *dir;
+
+  private_authority =
+      gsm_settings_get_boolean(GSM_SETTINGS_SESSION, KEY_PRIVATE_ICEAUTHORITY);
+
+  if (!private_authority || g_getenv("ICEAUTHORITY") != NULL) {
+    return;
+  }
+
+  dir = g_build_filename(g_get_user_runtime_dir(), "mate-session", NULL);
+  if (g_mkdir_with_parents(dir, 0700) != 0) {
+    g_warning("Unable to create %s, using the shared ICE authority file", dir);
+    g_free(dir);
+    return;
+  }
+
+  server->private_authority =
+      g_strdup_printf("%s/ICEauthority-%d", dir, (int)getpid());
+  g_free(dir);
+
+  /* clients do not need the file to exist if they have no entry for us */
+  gsm_util_setenv("ICEAUTHORITY", server->private_authority);
+}
+
+static gboolean is_listening_unix_socket(int fd) {
+  struct sockaddr_un addr;
+  socklen_t len = sizeof(addr);
+  int type;
+  int listening;
+  socklen_t opt_len;
+
+  if (getsockname(fd, (struct sockaddr *)&addr, &len) != 0 ||
+      addr.sun_family != AF_UNIX) {
+    return FALSE;
+  }
+
+  opt_len = sizeof(type);
+  if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &opt_len) != 0 ||
+      type != SOCK_STREAM) {
+    return FALSE;
+  }
+
+  opt_len = sizeof(listening);
+  if (getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &opt_len) != 0 ||
+      !listening) {
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Returns the listening socket we were started with, either by systemd
+ * socket activation or by a parent naming it in MATE_SESSION_XSMP_FD, or
+ * -1. The variables are cleared so that our children do not see them.
+ */
+static int get_activated_socket(void) {
+  const char *value;
+  int fd = -1;
+
+  value = g_getenv("LISTEN_PID");
+  if (value != NULL && g_ascii_strtoull(value, NULL, 10) == (guint64)getpid()) {
+    value = g_getenv("LISTEN_FDS");
+    if (value != NULL && g_ascii_strtoull(value, NULL, 10) >= 1) {
+      fd = GSM_LISTEN_FDS_START;
+    }
+  }
+
+  if (fd == -1) {
+    value = g_getenv(GSM_XSMP_FD_ENV);
+    if (value != NULL) {
+      char *end;
+      gint64 n;
+
+      n = g_ascii_strtoll(value, &end, 10);
+      if (*end == '\0' && n >= 0 && n <= G_MAXINT) {
+        fd = (int)n;
+      }
+    }
+  }
+
+  g_unsetenv("LISTEN_PID");
+  g_unsetenv("LISTEN_FDS");
+  g_unsetenv("LISTEN_FDNAMES");
+  g_unsetenv(GSM_XSMP_FD_ENV);
+
+  if (fd != -1 && !is_listening_unix_socket(fd)) {
+    g_warning("Ignoring passed XSMP socket %d: not a listening Unix socket",
+              fd);
+    fd = -1;
+  }
+
+  return fd;
+}
+
+/* Builds the network ID of @fd in the form libICE uses for @library_id */
+static char *compose_activated_network_id(int fd, const char *library_id) {
+  struct sockaddr_un addr;
+  socklen_t len = sizeof(addr);
+  const char *host;
+  const char *host_end;
+  gsize path_len;
+
+  host = strchr(library_id, '/');
+  host_end = host != NULL ? strchr(host, ':') : NULL;
+  if (host_end == NULL) {
+    return NULL;
+  }
+  host++;
+
+  memset(&addr, 0, sizeof(addr));
+  if (getsockname(fd, (struct sockaddr *)&addr, &len) != 0 ||
+      len <= offsetof(struct sockaddr_un, sun_path)) {
+    return NULL;
+  }
+
+  path_len = len - offsetof(struct sockaddr_un, sun_path);
+
+  /* Abstract sockets are spelled with a leading '@' by Xtrans */
+  if (addr.sun_path[0] == '\0') {
+    if (path_len < 2) {
+      return NULL;
+    }
+    return g_strdup_printf("local/%.*s:@%.*s", (int)(host_end - host), host,
+                           (int)(path_len - 1), addr.sun_path + 1);
+  }
+
+  return g_strdup_printf("local/%.*s:%s", (int)(host_end - host), host,
+                         addr.sun_path);
+}
+
+/* libICE cannot listen on a socket it did not create, so the pre-bound one
+ * takes the place of the file descriptor of our first local listener.
+ * Only its address is known early: the ICE authentication cookie for it is
+ * created afterwards by setup_listener(), and libICE picks the
+ * authentication data when a client opens its connection, so clients that
+ * connected before that will fail to authenticate.
+ */
+static void adopt_activated_socket(GsmXsmpServer *server, int fd) {
+  char *library_id;
+  int target;
+
+  library_id = IceGetListenConnectionString(server->xsmp_sockets[0]);
+  server->activated_network_id = compose_activated_network_id(fd, library_id);
+  free(library_id);
+
+  target = IceGetListenConnectionNumber(server->xsmp_sockets[0]);
+
+  if (server->activated_network_id == NULL || dup2(fd, target) == -1) {
+    g_warning("Unable to use passed XSMP socket %d", fd);
+    g_clear_pointer(&server->activated_network_id, g_free);
+    close(fd);
+    return;
+  }
+
+  close(fd);
+  fcntl(target, F_SETFD, fcntl(target, F_GETFD, 0) | FD_CLOEXEC);
+  fcntl(target, F_SETFL, fcntl(target, F_GETFL, 0) | O_NONBLOCK);
+
+  g_debug("GsmXsmpServer: listening on passed socket %s",
+          server->activated_network_id);
+}
+
+static char *compose_network_id_list(GsmXsmpServer *server) {
+  char *list;
+  char *rest;
+  char *result;
+
+  if (server->activated_network_id == NULL) {
+    list = IceComposeNetworkIdList(server->num_local_xsmp_sockets,
+                                   server->xsmp_sockets);
+    result = g_strdup(list);
+    free(list);
+    return result;
+  }
+
+  if (server->num_local_xsmp_sockets == 1) {
+    return g_strdup(server->activated_network_id);
+  }
+
+  rest = IceComposeNetworkIdList(server->num_local_xsmp_sockets - 1,
+                                 server->xsmp_sockets + 1);
+  result = g_strconcat(server->activated_network_id, ",", rest, NULL);
+  free(rest);
+
+  return result;
+}
+
 static void setup_listener(GsmXsmpServer *server) {
   char error[256];
   mode_t saved_umask;
   char *network_id_list;
+  int activated_fd;
   int i;
   int res;
 
@@ -557,6 +874,11 @@ static void setup_listener(GsmXsmpServer *server) {
         TRUE, "IceListenForConnections did not return a local listener!");
   }
 
+  activated_fd = get_activated_socket();
+  if (activated_fd != -1) {
+    adopt_activated_socket(server, activated_fd);
+  }
+
 #ifdef HAVE_XTRANS
   if (server->num_local_xsmp_sockets != server->num_xsmp_sockets) {
     /* Xtrans was apparently compiled with support for some
@@ -580,18 +902,18 @@ static void setup_listener(GsmXsmpServer *server) {
 #endif
 
   /* Update .ICEauthority with new auth entries for our socket */
-  if (!update_iceauthority(server, TRUE)) {
+  setup_private_iceauthority(server);
+  if (!add_iceauthority_entries(server)) {
     /* FIXME: is this really fatal? Hm... */
     gsm_util_init_error(TRUE, "Could not update ICEauthority file %s",
                         IceAuthFileName());
   }
 
-  network_id_list = IceComposeNetworkIdList(server->num_local_xsmp_sockets,
-                                            server->xsmp_sockets);
+  network_id_list = compose_network_id_list(server);
 
   gsm_util_setenv("SESSION_MANAGER", network_id_list);
   g_debug("GsmXsmpServer: SESSION_MANAGER=%s\n", network_id_list);
-  free(network_id_list);
+  g_free(network_id_list);
 }
 
 static GObject *gsm_xsmp_server_constructor(
@@ -631,6 +953,12 @@ static void gsm_xsmp_server_finalize(GObject *object) {
 
   xsmp_server = GSM_XSMP_SERVER(object);
 
+  remove_iceauthority_entries(xsmp_server);
+  g_slist_free_full(xsmp_server->auth_entries,
+                    (GDestroyNotify)IceFreeAuthFileEntry);
+  g_free(xsmp_server->private_authority);
+  g_free(xsmp_server->activated_network_id);
+
   IceFreeListenObjs(xsmp_server->num_xsmp_sockets, xsmp_server->xsmp_sockets);
 
   if (xsmp_server->client_store != NULL) {
@@ -33,44 +33,45 @@
 #include <glib.h>
 #include <glib/gi18n.h>
 #include <gtk/gtk.h>
+#include <locale.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/wait.h>
 #include <time.h>
 #include <unistd.h>
 
 #include "gsm-consolekit.h"
+#include "gsm-discard-executor.h"
 #include "mdm-log.h"
 #include "mdm-signal-handler.h"
 #ifdef HAVE_SYSTEMD
 #include "gsm-systemd.h"
 #endif
 #include "gsm-manager.h"
+#include "gsm-metrics.h"
+#include "gsm-session-save.h"
+#include "gsm-settings.h"
+#include "gsm-spawn-helper.h"
 #include "gsm-store.h"
+#include "gsm-trace.h"
 #include "gsm-util.h"
 #include "gsm-xsmp-server.h"
 #include "msm-gnome.h"
 
-#define GSM_SCHEMA "org.mate.session"
 #define GSM_DEFAULT_SESSION_KEY "default-session"
-#define GSM_REQUIRED_COMPONENTS_SCHEMA GSM_SCHEMA ".required-components"
 #define GSM_REQUIRED_COMPONENTS_LIST_KEY "required-components-list"
 
 #define ACCESSIBILITY_KEY "accessibility"
-#define ACCESSIBILITY_SCHEMA "org.mate.interface"
 
-#define DEBUG_SCHEMA "org.mate.debug"
 #define DEBUG_KEY "mate-session"
 
-#define VISUAL_SCHEMA "org.mate.applications-at-visual"
 #define VISUAL_KEY "exec"
 #define VISUAL_STARTUP_KEY "startup"
 
-#define MOBILITY_SCHEMA "org.mate.applications-at-mobility"
 #define MOBILITY_KEY "exec"
 #define MOBILITY_STARTUP_KEY "startup"
 
-#define MATE_INTERFACE_SCHEMA "org.mate.interface"
 #define GTK_OVERLAY_SCROLL "gtk-overlay-scrolling"
 
 #define GSM_DBUS_NAME "org.gnome.SessionManager"
@@ -87,7 +88,7 @@ static gboolean initialize_gsettings(void) {
   time_t now = time(0);
   gboolean ret;
 
-  settings = g_settings_new(GSM_SCHEMA);
+  settings = gsm_settings_get(GSM_SETTINGS_SESSION);
 
   if (!settings) return FALSE;
 
@@ -95,8 +96,6 @@ static gboolean initialize_gsettings(void) {
 
   g_settings_sync();
 
-  g_object_unref(settings);
-
   return ret;
 }
 
@@ -191,16 +190,14 @@ static void append_default_apps(GsmManager* manager,
                                 char** autostart_dirs) {
   gint i;
   gchar** default_apps;
-  GSettings* settings;
 
   g_debug("main: *** Adding default apps");
 
   g_assert(default_session_key != NULL);
   g_assert(autostart_dirs != NULL);
 
-  settings = g_settings_new(GSM_SCHEMA);
-  default_apps = g_settings_get_strv(settings, default_session_key);
-  g_object_unref(settings);
+  default_apps =
+      gsm_settings_get_strv(GSM_SETTINGS_SESSION, default_session_key);
 
   for (i = 0; default_apps[i]; i++) {
     char* app_path;
@@ -224,16 +221,11 @@ static void append_default_apps(GsmManager* manager,
 static void append_required_apps(GsmManager* manager) {
   gchar** required_components;
   gint i;
-  GSettings* settings;
-  GSettings* settings_required_components;
 
   g_debug("main: *** Adding required apps");
 
-  settings = g_settings_new(GSM_SCHEMA);
-  settings_required_components = g_settings_new(GSM_REQUIRED_COMPONENTS_SCHEMA);
-
-  required_components =
-      g_settings_get_strv(settings, GSM_REQUIRED_COMPONENTS_LIST_KEY);
+  required_components = gsm_settings_get_strv(GSM_SETTINGS_SESSION,
+                                              GSM_REQUIRED_COMPONENTS_LIST_KEY);
 
   if (required_components == NULL) {
     g_warning("No required applications specified");
@@ -249,7 +241,7 @@ static void append_required_apps(GsmManager* manager) {
       component = required_components[i];
 
       default_provider =
-          g_settings_get_string(settings_required_components, component);
+          gsm_settings_get_string(GSM_SETTINGS_REQUIRED_COMPONENTS, component);
 
       g_debug("main: %s looking for component: '%s'", component,
               default_provider);
@@ -277,23 +269,15 @@ static void append_required_apps(GsmManager* manager) {
   g_debug("main: *** Done adding required apps");
 
   g_strfreev(required_components);
-
-  g_object_unref(settings);
-  g_object_unref(settings_required_components);
 }
 
 static void append_accessibility_apps(GsmManager* manager) {
-  GSettings* mobility_settings;
-  GSettings* visual_settings;
-
   g_debug("main: *** Adding accesibility apps");
 
-  mobility_settings = g_settings_new(MOBILITY_SCHEMA);
-  visual_settings = g_settings_new(VISUAL_SCHEMA);
-
-  if (g_settings_get_boolean(mobility_settings, MOBILITY_STARTUP_KEY)) {
+  if (gsm_settings_get_boolean(GSM_SETTINGS_MOBILITY, MOBILITY_STARTUP_KEY)) {
     gchar* mobility_exec;
-    mobility_exec = g_settings_get_string(mobility_settings, MOBILITY_KEY);
+    mobility_exec =
+        gsm_settings_get_string(GSM_SETTINGS_MOBILITY, MOBILITY_KEY);
     if (mobility_exec != NULL && mobility_exec[0] != 0) {
       char* app_path;
       app_path = gsm_util_find_desktop_file_for_app_name(mobility_exec, NULL);
@@ -305,9 +289,9 @@ static void append_accessibility_apps(GsmManager* manager) {
     }
   }
 
-  if (g_settings_get_boolean(visual_settings, VISUAL_STARTUP_KEY)) {
+  if (gsm_settings_get_boolean(GSM_SETTINGS_VISUAL, VISUAL_STARTUP_KEY)) {
     gchar* visual_exec;
-    visual_exec = g_settings_get_string(visual_settings, VISUAL_KEY);
+    visual_exec = gsm_settings_get_string(GSM_SETTINGS_VISUAL, VISUAL_KEY);
     if (visual_exec != NULL && visual_exec[0] != 0) {
       char* app_path;
       app_path = gsm_util_find_desktop_file_for_app_name(visual_exec, NULL);
@@ -318,9 +302,6 @@ static void append_accessibility_apps(GsmManager* manager) {
       g_free(visual_exec);
     }
   }
-
-  g_object_unref(mobility_settings);
-  g_object_unref(visual_settings);
 }
 
 static void maybe_load_saved_session_apps(GsmManager* manager) {
@@ -348,16 +329,11 @@ static void maybe_load_saved_session_apps(GsmManager* manager) {
 #endif
 
   if (!is_login) {
-    GSettings* settings;
-    gboolean autostart;
-
-    settings = g_settings_new(GSM_SCHEMA);
-    autostart = g_settings_get_boolean(settings, KEY_AUTOSAVE);
-    g_object_unref(settings);
-
-    if (autostart == TRUE)
-      gsm_manager_add_autostart_apps_from_dir(manager,
-                                              gsm_util_get_saved_session_dir());
+    if (gsm_settings_get_boolean(GSM_SETTINGS_SESSION, KEY_AUTOSAVE)) {
+      gsm_session_journal_replay();
+      gsm_manager_add_saved_session_apps(manager,
+                                         gsm_util_get_saved_session_dir());
+    }
   }
 
   if (consolekit != NULL) g_object_unref(consolekit);
@@ -432,6 +408,11 @@ static gboolean signal_cb(int signo, gpointer data) {
       ret = TRUE;
       mdm_log_toggle_debug();
       break;
+    case SIGUSR2:
+      g_debug("Got USR2 signal");
+      ret = TRUE;
+      g_free(mdm_log_dump("SIGUSR2", NULL));
+      break;
     default:
       g_debug("Caught unhandled signal %d", signo);
       ret = TRUE;
@@ -497,56 +478,103 @@ static gboolean require_dbus_session(int argc, char** argv, GError** error) {
 }
 
 static void debug_changed(GSettings* settings, gchar* key, gpointer user_data) {
-  debug = g_settings_get_boolean(settings, DEBUG_KEY);
+  debug = gsm_settings_get_boolean(GSM_SETTINGS_DEBUG, DEBUG_KEY);
   mdm_log_set_debug(debug);
 }
 
-static gboolean schema_exists(const gchar* schema_name) {
-  GSettingsSchemaSource* source;
-  GSettingsSchema* schema;
-  gboolean exists;
-
-  source = g_settings_schema_source_get_default();
-  schema = g_settings_schema_source_lookup(source, schema_name, FALSE);
-  exists = (schema != NULL);
-  if (schema) g_settings_schema_unref(schema);
-
-  return exists;
-}
-
 static void set_overlay_scroll(void) {
-  GSettings* settings;
   gboolean enabled;
 
-  settings = g_settings_new(MATE_INTERFACE_SCHEMA);
-  enabled = g_settings_get_boolean(settings, GTK_OVERLAY_SCROLL);
+  enabled =
+      gsm_settings_get_boolean(GSM_SETTINGS_INTERFACE, GTK_OVERLAY_SCROLL);
 
   if (enabled) {
     gsm_util_setenv("GTK_OVERLAY_SCROLLING", "1");
   } else {
     gsm_util_setenv("GTK_OVERLAY_SCROLLING", "0");
   }
-
-  g_object_unref(settings);
 }
 
-static gboolean check_gl(gchar** gl_renderer, GError** error) {
-  int status;
+/* The GL check runs while the session is being loaded; its result is
+ * only needed before the first app is started */
+typedef struct {
+  GPid pid;
+  int stdout_fd;
+  GError* error;
+} GlCheck;
+
+static void start_gl_check(GlCheck* check) {
   char* argv[] = {LIBEXECDIR "/mate-session-check-accelerated", NULL};
 
+  check->pid = 0;
+  check->stdout_fd = -1;
+  check->error = NULL;
+
   if (getenv("DISPLAY") == NULL) {
     /* Not connected to X11, someone else will take care of checking GL */
-    return TRUE;
+    return;
   }
 
-  if (!g_spawn_sync(NULL, (char**)argv, NULL, 0, NULL, NULL, gl_renderer, NULL,
-                    &status, error)) {
+  g_spawn_async_with_pipes(NULL, (char**)argv, NULL, G_SPAWN_DO_NOT_REAP_CHILD,
+                           NULL, NULL, &check->pid, NULL, &check->stdout_fd,
+                           NULL, &check->error);
+}
+
+static gboolean finish_gl_check(GlCheck* check, gchar** gl_renderer,
+                                GError** error) {
+  GString* output;
+  char buf[256];
+  ssize_t n;
+  int status;
+
+  if (check->error != NULL) {
+    g_propagate_error(error, check->error);
+    check->error = NULL;
     return FALSE;
   }
 
+  if (check->pid == 0) {
+    return TRUE;
+  }
+
+  output = g_string_new(NULL);
+  while ((n = read(check->stdout_fd, buf, sizeof(buf))) != 0) {
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    g_string_append_len(output, buf, n);
+  }
+  close(check->stdout_fd);
+  check->stdout_fd = -1;
+
+  while (waitpid(check->pid, &status, 0) < 0) {
+    if (errno != EINTR) {
+      g_set_error(error, G_SPAWN_ERROR, G_SPAWN_ERROR_FAILED,
+                  "Unable to wait for the GL check: %s", g_strerror(errno));
+      g_string_free(output, TRUE);
+      return FALSE;
+    }
+  }
+  g_spawn_close_pid(check->pid);
+  check->pid = 0;
+
+  g_free(*gl_renderer);
+  *gl_renderer = g_string_free(output, FALSE);
+
   return g_spawn_check_exit_status(status, error);
 }
 
+static gboolean check_gl(gchar** gl_renderer, GError** error) {
+  GlCheck check;
+
+  start_gl_check(&check);
+
+  return finish_gl_check(&check, gl_renderer, error);
+}
+
 int main(int argc, char** argv) {
   struct sigaction sa;
   GError* error;
@@ -554,12 +582,13 @@ int main(int argc, char** argv) {
   GsmManager* manager;
   GsmStore* client_store;
   GsmXsmpServer* xsmp_server;
-  GSettings* debug_settings = NULL;
-  GSettings* accessibility_settings;
+  GSettings* debug_settings;
+  GOptionContext* context;
   MdmSignalHandler* signal_handler;
   static char** override_autostart_dirs = NULL;
   char* gl_renderer = NULL;
   gboolean gl_failed = FALSE;
+  GlCheck gl_check;
 
   static GOptionEntry entries[] = {
       {"autostart", 'a', 0, G_OPTION_ARG_STRING_ARRAY, &override_autostart_dirs,
@@ -575,11 +604,17 @@ int main(int argc, char** argv) {
        NULL},
       {NULL, 0, 0, 0, NULL, NULL, NULL}};
 
+  gsm_trace_init();
+  gsm_metrics_init();
+
   /* Make sure that we have a session bus */
   if (!require_dbus_session(argc, argv, &error)) {
     gsm_util_init_error(TRUE, "%s", error->message);
   }
 
+  /* Fork the app launcher while we are still small */
+  gsm_spawn_helper_start();
+
 #ifdef ENABLE_NLS
   bindtextdomain(GETTEXT_PACKAGE, LOCALE_DIR);
   bind_textdomain_codeset(GETTEXT_PACKAGE, "UTF-8");
@@ -591,15 +626,25 @@ int main(int argc, char** argv) {
   sigemptyset(&sa.sa_mask);
   sigaction(SIGPIPE, &sa, 0);
 
+  /* GTK itself is only initialized when one of the dialogs is shown (see
+   * gsm-dialogs.c); until then the session only needs the display. The
+   * GDK options, like --display, are left for gdk_init(). */
+  setlocale(LC_ALL, "");
+
   error = NULL;
-  gtk_init_with_args(&argc, &argv, (char*)_(" - the MATE session manager"),
-                     entries, GETTEXT_PACKAGE, &error);
+  context = g_option_context_new(_(" - the MATE session manager"));
+  g_option_context_add_main_entries(context, entries, GETTEXT_PACKAGE);
+  g_option_context_set_ignore_unknown_options(context, TRUE);
+  g_option_context_parse(context, &argc, &argv, &error);
+  g_option_context_free(context);
 
   if (error != NULL) {
     g_warning("%s", error->message);
     exit(EXIT_FAILURE);
   }
 
+  gdk_init(&argc, &argv);
+
   if (show_version) {
     g_print("%s %s\n", g_get_application_name(), VERSION);
     exit(EXIT_FAILURE);
@@ -615,11 +660,12 @@ int main(int argc, char** argv) {
 
   /* Allows to enable/disable debug from GSettings only if it is not set from
    * argument */
-  if (!debug && schema_exists(DEBUG_SCHEMA)) {
-    debug_settings = g_settings_new(DEBUG_SCHEMA);
+  gsm_settings_init();
+  debug_settings = gsm_settings_get(GSM_SETTINGS_DEBUG);
+  if (!debug && debug_settings != NULL) {
     g_signal_connect(debug_settings, "changed::" DEBUG_KEY,
                      G_CALLBACK(debug_changed), NULL);
-    debug = g_settings_get_boolean(debug_settings, DEBUG_KEY);
+    debug = gsm_settings_get_boolean(GSM_SETTINGS_DEBUG, DEBUG_KEY);
   }
 
   mdm_log_set_debug(debug);
@@ -627,28 +673,10 @@ int main(int argc, char** argv) {
   if (disable_acceleration_check) {
     g_debug("hardware acceleration check is disabled");
   } else {
-    /* Check GL, if it doesn't work out then force software fallback */
-    if (!check_gl(&gl_renderer, &error)) {
-      gl_failed = TRUE;
-
-      g_debug("hardware acceleration check failed: %s",
-              error ? error->message : "");
-      g_clear_error(&error);
-      if (g_getenv("LIBGL_ALWAYS_SOFTWARE") == NULL) {
-        g_setenv("LIBGL_ALWAYS_SOFTWARE", "1", TRUE);
-        if (!check_gl(&gl_renderer, &error)) {
-          g_warning("software acceleration check failed: %s",
-                    error ? error->message : "");
-          g_clear_error(&error);
-        } else {
-          gl_failed = FALSE;
-        }
-      }
-    }
-  }
+    gsm_trace_begin("session", "gl-check");
 
-  if (gl_failed) {
-    g_warning("gl_failed!");
+    /* Check GL in the background while the session is loaded */
+    start_gl_check(&gl_check);
   }
 
   if (g_getenv("XDG_CURRENT_DESKTOP") == NULL)
@@ -672,11 +700,9 @@ int main(int argc, char** argv) {
   if (initialize_gsettings() != TRUE) exit(EXIT_FAILURE);
 
   /* Look if accessibility is enabled */
-  accessibility_settings = g_settings_new(ACCESSIBILITY_SCHEMA);
-  if (g_settings_get_boolean(accessibility_settings, ACCESSIBILITY_KEY)) {
+  if (gsm_settings_get_boolean(GSM_SETTINGS_INTERFACE, ACCESSIBILITY_KEY)) {
     gsm_util_setenv("GTK_MODULES", "gail:atk-bridge");
   }
-  g_object_unref(accessibility_settings);
 
   client_store = gsm_store_new();
 
@@ -700,6 +726,7 @@ int main(int argc, char** argv) {
   mdm_signal_handler_add(signal_handler, SIGFPE, signal_cb, NULL);
   mdm_signal_handler_add(signal_handler, SIGHUP, signal_cb, NULL);
   mdm_signal_handler_add(signal_handler, SIGUSR1, signal_cb, NULL);
+  mdm_signal_handler_add(signal_handler, SIGUSR2, signal_cb, NULL);
   mdm_signal_handler_add(signal_handler, SIGTERM, signal_cb, manager);
   mdm_signal_handler_add(signal_handler, SIGINT, signal_cb, manager);
   mdm_signal_handler_set_fatal_func(signal_handler, shutdown_cb, manager);
@@ -711,12 +738,45 @@ int main(int argc, char** argv) {
   }
 
   gsm_xsmp_server_start(xsmp_server);
+
+  if (!disable_acceleration_check) {
+    /* Check GL, if it doesn't work out then force software fallback.
+     * This has to be known before any app is started, since they all
+     * inherit LIBGL_ALWAYS_SOFTWARE. */
+    if (!finish_gl_check(&gl_check, &gl_renderer, &error)) {
+      gl_failed = TRUE;
+
+      g_debug("hardware acceleration check failed: %s",
+              error ? error->message : "");
+      g_clear_error(&error);
+      if (g_getenv("LIBGL_ALWAYS_SOFTWARE") == NULL) {
+        g_setenv("LIBGL_ALWAYS_SOFTWARE", "1", TRUE);
+        if (!check_gl(&gl_renderer, &error)) {
+          g_warning("software acceleration check failed: %s",
+                    error ? error->message : "");
+          g_clear_error(&error);
+        } else {
+          gl_failed = FALSE;
+        }
+      }
+    }
+
+    gsm_trace_end("session", "gl-check");
+  }
+
+  if (gl_failed) {
+    g_warning("gl_failed!");
+  }
+
   _gsm_manager_set_renderer(manager, gl_renderer);
   g_free(gl_renderer);
   gsm_manager_start(manager);
 
   gtk_main();
 
+  gsm_metrics_flush();
+  gsm_discard_executor_wait();
+
   if (xsmp_server != NULL) {
     g_object_unref(xsmp_server);
   }
@@ -730,10 +790,6 @@ int main(int argc, char** argv) {
     g_object_unref(client_store);
   }
 
-  if (debug_settings != NULL) {
-    g_object_unref(debug_settings);
-  }
-
   msm_gnome_stop();
   mdm_log_shutdown();
 
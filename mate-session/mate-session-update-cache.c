@@ -0,0 +1,159 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/* Builds the system-wide autostart cache shared by all the sessions of the
+ * host, for the autostart directories that are not the user's own. It is
+ * run on installation, and is meant to be run again by the packages that
+ * install files in those directories.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <glib.h>
+#include <glib/gi18n.h>
+#include <locale.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "eggdesktopfile.h"
+#include "gsm-autostart-cache.h"
+#include "gsm-autostart-info.h"
+#include "gsm-util.h"
+
+static guint add_dir(const char* path) {
+  struct stat dir_st;
+  GDir* dir;
+  const char* name;
+  GPtrArray* names;
+  guint n_apps = 0;
+  guint i;
+
+  if (stat(path, &dir_st) != 0 || !S_ISDIR(dir_st.st_mode)) {
+    return 0;
+  }
+
+  dir = g_dir_open(path, 0, NULL);
+  if (dir == NULL) {
+    return 0;
+  }
+
+  names = g_ptr_array_new_with_free_func(g_free);
+  while ((name = g_dir_read_name(dir))) {
+    if (g_str_has_suffix(name, ".desktop")) {
+      g_ptr_array_add(names, g_strdup(name));
+    }
+  }
+  g_ptr_array_add(names, NULL);
+  g_dir_close(dir);
+
+  gsm_autostart_cache_begin_dir(path, &dir_st, (char**)names->pdata);
+
+  for (i = 0; i < names->len - 1; i++) {
+    const char* basename = g_ptr_array_index(names, i);
+    struct stat st;
+    char* filename;
+    EggDesktopFile* desktop_file;
+
+    filename = g_build_filename(path, basename, NULL);
+    desktop_file =
+        stat(filename, &st) == 0 ? egg_desktop_file_new(filename, NULL) : NULL;
+    if (desktop_file != NULL) {
+      gsm_autostart_cache_insert(
+          path, basename, &st, gsm_autostart_info_new(desktop_file, basename));
+      egg_desktop_file_free(desktop_file);
+      n_apps++;
+    } else {
+      g_printerr(_("Could not read %s\n"), filename);
+    }
+    g_free(filename);
+  }
+
+  g_ptr_array_unref(names);
+
+  return n_apps;
+}
+
+int main(int argc, char* argv[]) {
+  GOptionContext* context;
+  GError* error;
+  char** dirs;
+  char* user_dir;
+  gboolean verbose = FALSE;
+  guint i;
+
+  GOptionEntry options[] = {
+      {"verbose", 'v', 0, G_OPTION_ARG_NONE, &verbose,
+       N_("Print the directories that were cached"), NULL},
+      {NULL, 0, 0, 0, NULL, NULL, NULL}};
+
+  setlocale(LC_ALL, "");
+
+#ifdef ENABLE_NLS
+  bindtextdomain(GETTEXT_PACKAGE, LOCALE_DIR);
+  bind_textdomain_codeset(GETTEXT_PACKAGE, "UTF-8");
+  textdomain(GETTEXT_PACKAGE);
+#endif /* ENABLE_NLS */
+
+  error = NULL;
+  context = g_option_context_new(NULL);
+  g_option_context_set_summary(
+      context, _("Update the system-wide cache of the autostart applications"));
+  g_option_context_add_main_entries(context, options, GETTEXT_PACKAGE);
+  if (!g_option_context_parse(context, &argc, &argv, &error)) {
+    g_printerr("%s\n", error->message);
+    g_error_free(error);
+    g_option_context_free(context);
+    return EXIT_FAILURE;
+  }
+  g_option_context_free(context);
+
+  gsm_autostart_cache_begin_system();
+
+  user_dir = g_build_filename(g_get_user_config_dir(), "autostart", NULL);
+
+  dirs = gsm_util_get_autostart_dirs();
+  for (i = 0; dirs[i] != NULL; i++) {
+    guint n_apps;
+
+    if (strcmp(dirs[i], user_dir) == 0) {
+      continue;
+    }
+
+    n_apps = add_dir(dirs[i]);
+    if (verbose && n_apps > 0) {
+      g_print(_("%s: %u applications\n"), dirs[i], n_apps);
+    }
+  }
+
+  g_strfreev(dirs);
+  g_free(user_dir);
+
+  error = NULL;
+  if (!gsm_autostart_cache_write_system(&error)) {
+    g_printerr(_("Could not write the cache: %s\n"), error->message);
+    g_error_free(error);
+    return EXIT_FAILURE;
+  }
+
+  return EXIT_SUCCESS;
+}
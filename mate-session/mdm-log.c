@@ -27,6 +27,7 @@
 
 #include "mdm-log.h"
 
+#include <errno.h>
 #include <glib.h>
 #include <glib/gstdio.h>
 #include <signal.h>
@@ -37,10 +38,31 @@
 #include <time.h>
 #include <unistd.h>
 
+/* Every message, debug ones included, is also kept in a ring buffer so
+ * that what led to a problem can be dumped after the fact with
+ * mdm_log_dump() even when debugging was off, which only decides what
+ * goes to syslog.
+ *
+ * Writers claim a slot with one atomic increment and publish it with its
+ * sequence number once the text is in place; the dump skips the slots
+ * that are being rewritten. Messages are cut at RING_TEXT_SIZE.
+ */
+#define RING_SIZE 4096 /* must be a power of two */
+#define RING_TEXT_SIZE 240
+
+typedef struct {
+  gint seq; /* index of the record + 1, 0 while it is being written */
+  gint64 ts;
+  char text[RING_TEXT_SIZE];
+} RingRecord;
+
 static gboolean initialized = FALSE;
 static int syslog_levels =
     (G_LOG_LEVEL_ERROR | G_LOG_LEVEL_CRITICAL | G_LOG_LEVEL_WARNING);
 
+static RingRecord ring[RING_SIZE];
+static gint ring_head = 0;
+
 static void log_level_to_priority_and_prefix(GLogLevelFlags log_level,
                                              int *priorityp,
                                              const char **prefixp) {
@@ -98,6 +120,109 @@ static void log_level_to_priority_and_prefix(GLogLevelFlags log_level,
   }
 }
 
+static void ring_add(const char *log_domain, const char *level_prefix,
+                     const char *message) {
+  RingRecord *record;
+  guint index;
+
+  index = (guint)g_atomic_int_add(&ring_head, 1);
+  record = &ring[index & (RING_SIZE - 1)];
+
+  g_atomic_int_set(&record->seq, 0);
+  record->ts = g_get_monotonic_time();
+  g_snprintf(record->text, sizeof(record->text), "%s%s%s: %s",
+             log_domain != NULL ? log_domain : "",
+             log_domain != NULL ? "-" : "", level_prefix,
+             message != NULL ? message : "(NULL) message");
+  g_atomic_int_set(&record->seq, (gint)(index + 1));
+}
+
+static void append_ring(GString *str) {
+  guint head;
+  guint i;
+  gint64 offset;
+
+  /* to turn the monotonic timestamps into wall clock time */
+  offset = g_get_real_time() - g_get_monotonic_time();
+
+  head = (guint)g_atomic_int_get(&ring_head);
+  for (i = head > RING_SIZE ? head - RING_SIZE : 0; i != head; i++) {
+    RingRecord *record = &ring[i & (RING_SIZE - 1)];
+    char text[RING_TEXT_SIZE];
+    char stamp[32];
+    struct tm tm;
+    time_t secs;
+    gint64 ts;
+
+    if (g_atomic_int_get(&record->seq) != (gint)(i + 1)) {
+      continue;
+    }
+
+    ts = record->ts;
+    memcpy(text, record->text, sizeof(text));
+    text[sizeof(text) - 1] = '\0';
+
+    /* overwritten while we were copying it */
+    if (g_atomic_int_get(&record->seq) != (gint)(i + 1)) {
+      continue;
+    }
+
+    ts += offset;
+    secs = (time_t)(ts / G_USEC_PER_SEC);
+    localtime_r(&secs, &tm);
+    strftime(stamp, sizeof(stamp), "%H:%M:%S", &tm);
+
+    g_string_append_printf(str, "%s.%06d %s", stamp,
+                           (int)(ts % G_USEC_PER_SEC), text);
+    if (str->str[str->len - 1] != '\n') {
+      g_string_append_c(str, '\n');
+    }
+  }
+}
+
+/* Writes the messages kept in memory to $XDG_RUNTIME_DIR/mate-session/
+ * and returns the file name. @reason is recorded at the top of the file.
+ * If @error is NULL failures are logged instead.
+ */
+char *mdm_log_dump(const char *reason, GError **error) {
+  GString *str;
+  char *dirname;
+  char *filename;
+  GError *local_error = NULL;
+
+  str = g_string_sized_new(RING_SIZE * 96);
+  g_string_append_printf(str, "# %s debug log, dumped because of: %s\n",
+                         g_get_prgname() != NULL ? g_get_prgname() : "",
+                         reason);
+  append_ring(str);
+
+  dirname = g_build_filename(g_get_user_runtime_dir(), "mate-session", NULL);
+  filename = g_build_filename(dirname, "debug-log", NULL);
+
+  if (g_mkdir_with_parents(dirname, 0700) != 0) {
+    g_set_error(&local_error, G_FILE_ERROR, g_file_error_from_errno(errno),
+                "Unable to create %s", dirname);
+  } else {
+    g_file_set_contents(filename, str->str, str->len, &local_error);
+  }
+
+  g_string_free(str, TRUE);
+  g_free(dirname);
+
+  if (local_error != NULL) {
+    if (error == NULL) {
+      g_warning("Unable to dump the debug log: %s", local_error->message);
+    }
+    g_propagate_error(error, local_error);
+    g_free(filename);
+    return NULL;
+  }
+
+  g_message("Dumped the debug log to %s (%s)", filename, reason);
+
+  return filename;
+}
+
 void mdm_log_default_handler(const gchar *log_domain, GLogLevelFlags log_level,
                              const gchar *message, gpointer unused_data) {
   GString *gstring;
@@ -109,6 +234,10 @@ void mdm_log_default_handler(const gchar *log_domain, GLogLevelFlags log_level,
 
   is_fatal = (log_level & G_LOG_FLAG_FATAL) != 0;
 
+  log_level_to_priority_and_prefix(log_level, &priority, &level_prefix);
+
+  ring_add(log_domain, level_prefix, message);
+
   do_log = (log_level & syslog_levels);
   if (!do_log) {
     return;
@@ -118,8 +247,6 @@ void mdm_log_default_handler(const gchar *log_domain, GLogLevelFlags log_level,
     mdm_log_init();
   }
 
-  log_level_to_priority_and_prefix(log_level, &priority, &level_prefix);
-
   gstring = g_string_new(NULL);
 
   if (log_domain != NULL) {
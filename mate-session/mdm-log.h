@@ -33,6 +33,7 @@ void mdm_log_default_handler(const gchar *log_domain, GLogLevelFlags log_level,
                              const gchar *message, gpointer unused_data);
 void mdm_log_set_debug(gboolean debug);
 void mdm_log_toggle_debug(void);
+char *mdm_log_dump(const char *reason, GError **error);
 void mdm_log_init(void);
 void mdm_log_shutdown(void);
 
@@ -66,10 +66,15 @@ typedef struct {
   MdmLogoutAction current_actions;
 
   time_t last_update;
+
+  /* What mdm_set_logout_action() last told MDM, if anything */
+  MdmLogoutAction sent_action;
+  gboolean action_sent;
 } MdmProtocolData;
 
-static MdmProtocolData mdm_protocol_data = {0, NULL, MDM_LOGOUT_ACTION_NONE,
-                                            MDM_LOGOUT_ACTION_NONE, 0};
+static MdmProtocolData mdm_protocol_data = {
+    0, NULL, MDM_LOGOUT_ACTION_NONE, MDM_LOGOUT_ACTION_NONE, 0,
+    MDM_LOGOUT_ACTION_NONE, FALSE};
 
 static char* mdm_send_protocol_msg(MdmProtocolData* data, const char* msg) {
   GString* retval;
@@ -390,6 +395,13 @@ void mdm_set_logout_action(MdmLogoutAction action) {
   char* msg;
   char* response;
 
+  /* The manager resets the action every time a logout ends, which would
+   * otherwise cost a connection and handshake each time */
+  if (mdm_protocol_data.action_sent &&
+      mdm_protocol_data.sent_action == action) {
+    return;
+  }
+
   if (!mdm_init_protocol_connection(&mdm_protocol_data)) {
     return;
   }
@@ -414,6 +426,11 @@ void mdm_set_logout_action(MdmLogoutAction action) {
   response = mdm_send_protocol_msg(&mdm_protocol_data, msg);
 
   g_free(msg);
+
+  /* Only a confirmed action is remembered */
+  mdm_protocol_data.action_sent =
+      response != NULL && strncmp(response, "OK", 2) == 0;
+  mdm_protocol_data.sent_action = action;
   g_free(response);
 
   mdm_protocol_data.last_update = 0;
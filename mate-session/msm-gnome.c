@@ -42,7 +42,8 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
-#define GSM_SCHEMA "org.mate.session"
+#include "gsm-settings.h"
+
 #define GSM_GNOME_COMPAT_STARTUP_KEY "gnome-compat-startup"
 
 #define GNOME_KEYRING_DAEMON "gnome-keyring-daemon"
@@ -130,13 +131,12 @@ static void msm_compat_gnome_smproxy_shutdown(void) {
 }
 
 void msm_gnome_start(void) {
-  GSettings *settings;
   gchar **array;
 
   if (gnome_compat_started == TRUE) return;
 
-  settings = g_settings_new(GSM_SCHEMA);
-  array = g_settings_get_strv(settings, GSM_GNOME_COMPAT_STARTUP_KEY);
+  array =
+      gsm_settings_get_strv(GSM_SETTINGS_SESSION, GSM_GNOME_COMPAT_STARTUP_KEY);
   if (array) {
     gchar **it;
 
@@ -157,7 +157,6 @@ void msm_gnome_start(void) {
   } else {
     g_debug("MsmGnome: No components found to start");
   }
-  g_object_unref(settings);
 }
 
 void msm_gnome_stop(void) {
@@ -0,0 +1,169 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <gio/gio.h>
+#include <glib.h>
+#include <stdlib.h>
+
+#define SM_DBUS_NAME "org.gnome.SessionManager"
+#define SM_DBUS_PATH "/org/gnome/SessionManager"
+#define SM_DBUS_INTERFACE "org.gnome.SessionManager"
+
+#define GSM_INHIBITOR_FLAG_SUSPEND (1 << 2)
+
+/* Measures Inhibit/Uninhibit round trips against the running session
+ * manager while a number of other inhibitors are held, the way media
+ * players and backup tools use the interface. Only the suspend flag is
+ * used, so the session is not affected while it runs.
+ */
+
+static int n_held = 1000;
+static int n_calls = 5000;
+static int n_rounds = 5;
+
+static GOptionEntry entries[] = {
+    {"held", 'H', 0, G_OPTION_ARG_INT, &n_held,
+     "Number of inhibitors kept during the run", "N"},
+    {"calls", 'c', 0, G_OPTION_ARG_INT, &n_calls,
+     "Inhibit/Uninhibit pairs per round", "N"},
+    {"rounds", 'r', 0, G_OPTION_ARG_INT, &n_rounds, "Number of rounds", "N"},
+    {NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL}};
+
+static gboolean do_inhibit(GDBusProxy *proxy, guint *cookie) {
+  GError *error = NULL;
+  GVariant *ret;
+
+  ret = g_dbus_proxy_call_sync(
+      proxy, "Inhibit",
+      g_variant_new("(susu)", "test-inhibit-throughput", 0,
+                    "Benchmarking the session manager",
+                    GSM_INHIBITOR_FLAG_SUSPEND),
+      G_DBUS_CALL_FLAGS_NONE, -1, NULL, &error);
+  if (ret == NULL) {
+    g_printerr("Failed to inhibit: %s\n", error->message);
+    g_error_free(error);
+    return FALSE;
+  }
+
+  g_variant_get(ret, "(u)", cookie);
+  g_variant_unref(ret);
+
+  return TRUE;
+}
+
+static gboolean do_uninhibit(GDBusProxy *proxy, guint cookie) {
+  GError *error = NULL;
+  GVariant *ret;
+
+  ret = g_dbus_proxy_call_sync(proxy, "Uninhibit",
+                               g_variant_new("(u)", cookie),
+                               G_DBUS_CALL_FLAGS_NONE, -1, NULL, &error);
+  if (ret == NULL) {
+    g_printerr("Failed to uninhibit: %s\n", error->message);
+    g_error_free(error);
+    return FALSE;
+  }
+
+  g_variant_unref(ret);
+
+  return TRUE;
+}
+
+int main(int argc, char *argv[]) {
+  GOptionContext *context;
+  GError *error = NULL;
+  GDBusProxy *proxy;
+  guint *held;
+  gint64 total = 0;
+  gint64 best = G_MAXINT64;
+  gboolean ok = TRUE;
+  int n_inhibited;
+  int round;
+  int i;
+
+  context = g_option_context_new("- benchmark Inhibit and Uninhibit");
+  g_option_context_add_main_entries(context, entries, NULL);
+  if (!g_option_context_parse(context, &argc, &argv, &error)) {
+    g_printerr("%s\n", error->message);
+    g_error_free(error);
+    return EXIT_FAILURE;
+  }
+  g_option_context_free(context);
+
+  if (n_held < 0 || n_calls < 1 || n_rounds < 1) {
+    g_printerr("Counts must be positive\n");
+    return EXIT_FAILURE;
+  }
+
+  proxy = g_dbus_proxy_new_for_bus_sync(
+      G_BUS_TYPE_SESSION, G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES, NULL,
+      SM_DBUS_NAME, SM_DBUS_PATH, SM_DBUS_INTERFACE, NULL, &error);
+  if (proxy == NULL) {
+    g_printerr("Unable to connect to the session manager: %s\n",
+               error->message);
+    g_error_free(error);
+    return EXIT_FAILURE;
+  }
+
+  held = g_new0(guint, MAX(n_held, 1));
+  for (n_inhibited = 0; n_inhibited < n_held; n_inhibited++) {
+    if (!do_inhibit(proxy, &held[n_inhibited])) {
+      ok = FALSE;
+      break;
+    }
+  }
+
+  for (round = 0; ok && round < n_rounds; round++) {
+    gint64 start;
+    gint64 elapsed;
+
+    start = g_get_monotonic_time();
+
+    for (i = 0; ok && i < n_calls; i++) {
+      guint cookie;
+
+      ok = do_inhibit(proxy, &cookie) && do_uninhibit(proxy, cookie);
+    }
+
+    elapsed = g_get_monotonic_time() - start;
+    total += elapsed;
+    best = MIN(best, elapsed);
+  }
+
+  if (ok) {
+    g_print("%d held inhibitors, %d pairs per round: best %.2f ms, average "
+            "%.2f ms, %.0f pairs/s\n",
+            n_held, n_calls, best / 1000.0, total / 1000.0 / n_rounds,
+            (double)n_calls * n_rounds / (total / (double)G_USEC_PER_SEC));
+  }
+
+  for (i = 0; i < n_inhibited; i++) {
+    do_uninhibit(proxy, held[i]);
+  }
+
+  g_free(held);
+  g_object_unref(proxy);
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
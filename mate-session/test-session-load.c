@@ -0,0 +1,1269 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <X11/ICE/ICElib.h>
+#include <X11/SM/SMlib.h>
+#include <gio/gio.h>
+#include <glib-unix.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <math.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "test-util.h"
+
+#define SM_DBUS_NAME "org.gnome.SessionManager"
+#define SM_DBUS_PATH "/org/gnome/SessionManager"
+#define SM_DBUS_INTERFACE "org.gnome.SessionManager"
+#define SM_CLIENT_DBUS_INTERFACE "org.gnome.SessionManager.ClientPrivate"
+
+#define GSM_INHIBITOR_FLAG_SUSPEND (1 << 2)
+#define GSM_INHIBITOR_FLAG_IDLE (1 << 3)
+
+#define CALL_TIMEOUT_MS 30000
+#define LOGOUT_TIMEOUT_MS 60000
+
+/* Puts a synthetic load on the session manager and reports latency
+ * percentiles and CPU time for a few scenarios:
+ *
+ *  - register: every D-Bus client calls RegisterClient at the same time,
+ *    the XSMP clients connect and the inhibitors are taken;
+ *  - churn: short lived bus connections register a client and take an
+ *    inhibitor, then disconnect without cleaning up, so everything goes
+ *    through NameOwnerChanged;
+ *  - logout: the session is ended with all the clients above connected.
+ *    They answer QueryEndSession, EndSession and SaveYourself after a
+ *    delay drawn from --latency, and --stragglers of the D-Bus clients
+ *    only answer QueryEndSession after --straggler-delay, past the
+ *    session manager's timeout.
+ *
+ * The register and churn scenarios can run inside any session. The
+ * logout scenario needs --session, which starts the given mate-session
+ * on a private bus with an empty autostart directory; run it on a spare
+ * display such as Xvfb, since the required components are still started.
+ */
+
+typedef enum {
+  LATENCY_FIXED,
+  LATENCY_UNIFORM,
+  LATENCY_EXPONENTIAL
+} LatencyKind;
+
+typedef struct {
+  LatencyKind kind;
+  double a;
+  double b;
+} Latency;
+
+typedef struct {
+  GDBusConnection *connection;
+  char *path;
+  guint signal_id;
+  guint response_id;
+  gboolean straggler;
+  gint64 start;
+} DBusClient;
+
+typedef struct {
+  SmcConn conn;
+  guint done_id;
+  gboolean dead;
+} XsmpClient;
+
+typedef struct {
+  guint watch_id;
+  int n_clients;
+} IceWatch;
+
+typedef struct {
+  gint64 wall;
+  gint64 session_cpu;
+  gint64 own_cpu;
+} Usage;
+
+static int n_xsmp_clients = 50;
+static int n_dbus_clients = 50;
+static int n_inhibitors = 100;
+static int n_stragglers = 0;
+static int straggler_delay = 2000;
+static int n_churn = 200;
+static int logout_mode = 2;
+static char *latency_spec = NULL;
+static char *scenario = NULL;
+static char *session_path = NULL;
+
+static GOptionEntry entries[] = {
+    {"xsmp-clients", 'x', 0, G_OPTION_ARG_INT, &n_xsmp_clients,
+     "Number of XSMP clients", "N"},
+    {"dbus-clients", 'd', 0, G_OPTION_ARG_INT, &n_dbus_clients,
+     "Number of D-Bus clients", "N"},
+    {"inhibitors", 'i', 0, G_OPTION_ARG_INT, &n_inhibitors,
+     "Number of inhibitors held", "N"},
+    {"latency", 'l', 0, G_OPTION_ARG_STRING, &latency_spec,
+     "Client response delay: fixed:MS, uniform:MIN:MAX or exp:MEAN "
+     "(default uniform:0:50)",
+     "SPEC"},
+    {"stragglers", 0, 0, G_OPTION_ARG_INT, &n_stragglers,
+     "D-Bus clients that answer QueryEndSession late", "N"},
+    {"straggler-delay", 0, 0, G_OPTION_ARG_INT, &straggler_delay,
+     "How late the stragglers answer", "MS"},
+    {"churn", 'c', 0, G_OPTION_ARG_INT, &n_churn,
+     "Number of connect/register/disconnect cycles", "N"},
+    {"logout-mode", 0, 0, G_OPTION_ARG_INT, &logout_mode,
+     "Mode passed to Logout (default 2, forced)", "MODE"},
+    {"scenario", 's', 0, G_OPTION_ARG_STRING, &scenario,
+     "register, churn, logout or all (default)", "NAME"},
+    {"session", 0, 0, G_OPTION_ARG_FILENAME, &session_path,
+     "Run the given mate-session on a private bus", "PATH"},
+    {NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL}};
+
+static Latency latency = {LATENCY_UNIFORM, 0, 50};
+
+static char *bus_address = NULL;
+static GDBusConnection *control = NULL;
+static GDBusConnection *inhibit_connection = NULL;
+static GHashTable *ice_watches = NULL;
+static int n_pending = 0;
+static int n_errors = 0;
+
+static GPid session_pid = 0;
+static guint32 session_manager_pid = 0;
+static gboolean session_exited = FALSE;
+static gint64 session_exit_time = 0;
+static gint64 session_exit_cpu = 0;
+
+static gboolean in_logout = FALSE;
+static gint64 logout_start = 0;
+static GArray *query_delivery = NULL;
+static GArray *end_session_delivery = NULL;
+static GArray *save_yourself_delivery = NULL;
+static GArray *die_delivery = NULL;
+
+static gboolean parse_latency(const char *spec) {
+  char **parts;
+  gboolean ret = FALSE;
+  guint n;
+
+  parts = g_strsplit(spec, ":", -1);
+  n = g_strv_length(parts);
+
+  if (n == 2 && strcmp(parts[0], "fixed") == 0) {
+    latency.kind = LATENCY_FIXED;
+    latency.a = g_ascii_strtod(parts[1], NULL);
+    ret = latency.a >= 0;
+  } else if (n == 3 && strcmp(parts[0], "uniform") == 0) {
+    latency.kind = LATENCY_UNIFORM;
+    latency.a = g_ascii_strtod(parts[1], NULL);
+    latency.b = g_ascii_strtod(parts[2], NULL);
+    ret = latency.a >= 0 && latency.b >= latency.a;
+  } else if (n == 2 && strcmp(parts[0], "exp") == 0) {
+    latency.kind = LATENCY_EXPONENTIAL;
+    latency.a = g_ascii_strtod(parts[1], NULL);
+    ret = latency.a >= 0;
+  }
+
+  g_strfreev(parts);
+
+  return ret;
+}
+
+static guint latency_sample(void) {
+  switch (latency.kind) {
+    case LATENCY_FIXED:
+      return (guint)latency.a;
+    case LATENCY_UNIFORM:
+      if (latency.b <= latency.a) {
+        return (guint)latency.a;
+      }
+      return (guint)g_random_double_range(latency.a, latency.b);
+    case LATENCY_EXPONENTIAL:
+      return (guint)(-latency.a * log(1.0 - g_random_double()));
+  }
+
+  return 0;
+}
+
+static void series_add(GArray *series, gint64 value) {
+  g_array_append_val(series, value);
+}
+
+static double percentile(GArray *series, double p) {
+  guint i;
+
+  i = (guint)(p * (series->len - 1) + 0.5);
+
+  return g_array_index(series, gint64, i) / 1000.0;
+}
+
+static void series_report(const char *name, GArray *series) {
+  if (series->len == 0) {
+    g_print("  %-28s no samples\n", name);
+    return;
+  }
+
+  g_array_sort(series, test_compare_int64);
+  g_print("  %-28s n=%-5u p50 %8.2f  p90 %8.2f  p99 %8.2f  max %8.2f ms\n",
+          name, series->len, percentile(series, 0.5), percentile(series, 0.9),
+          percentile(series, 0.99), percentile(series, 1.0));
+}
+
+static gint64 timeval_usec(const struct timeval *tv) {
+  return (gint64)tv->tv_sec * G_USEC_PER_SEC + tv->tv_usec;
+}
+
+static gint64 get_own_cpu(void) {
+  struct rusage ru;
+
+  getrusage(RUSAGE_SELF, &ru);
+
+  return timeval_usec(&ru.ru_utime) + timeval_usec(&ru.ru_stime);
+}
+
+/* Returns the CPU time used so far by the session manager, or -1 */
+static gint64 get_session_cpu(void) {
+  char *path;
+  char *contents;
+  char *p;
+  unsigned long utime;
+  unsigned long stime;
+  gint64 ret = -1;
+
+  if (session_exited) {
+    return session_exit_cpu;
+  }
+
+  if (session_manager_pid == 0) {
+    return -1;
+  }
+
+  path = g_strdup_printf("/proc/%u/stat", session_manager_pid);
+  if (!g_file_get_contents(path, &contents, NULL, NULL)) {
+    g_free(path);
+    return -1;
+  }
+
+  /* the command name may contain spaces, skip past it */
+  p = strrchr(contents, ')');
+  if (p != NULL &&
+      sscanf(p + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+             &utime, &stime) == 2) {
+    ret = (gint64)(utime + stime) * G_USEC_PER_SEC / sysconf(_SC_CLK_TCK);
+  }
+
+  g_free(contents);
+  g_free(path);
+
+  return ret;
+}
+
+static void usage_begin(Usage *usage) {
+  usage->wall = g_get_monotonic_time();
+  usage->session_cpu = get_session_cpu();
+  usage->own_cpu = get_own_cpu();
+}
+
+static void usage_report(Usage *usage) {
+  gint64 session_cpu;
+
+  session_cpu = get_session_cpu();
+
+  g_print("  wall %.1f ms, benchmark CPU %.1f ms",
+          (g_get_monotonic_time() - usage->wall) / 1000.0,
+          (get_own_cpu() - usage->own_cpu) / 1000.0);
+  if (session_cpu >= 0 && usage->session_cpu >= 0) {
+    g_print(", session manager CPU %.1f ms",
+            (session_cpu - usage->session_cpu) / 1000.0);
+  }
+  g_print("\n");
+}
+
+static gboolean session_reap(void) {
+  struct rusage ru;
+  int status;
+
+  if (session_pid == 0 || session_exited) {
+    return session_exited;
+  }
+
+  if (wait4(session_pid, &status, WNOHANG, &ru) == session_pid) {
+    session_exited = TRUE;
+    session_exit_time = g_get_monotonic_time();
+    session_exit_cpu = timeval_usec(&ru.ru_utime) + timeval_usec(&ru.ru_stime);
+  }
+
+  return session_exited;
+}
+
+static gboolean on_wakeup(gpointer data) {
+  session_reap();
+
+  return G_SOURCE_CONTINUE;
+}
+
+/* Iterates the main context until @done returns TRUE */
+static gboolean wait_until(gboolean (*done)(void), int timeout_ms) {
+  gint64 deadline;
+
+  deadline = g_get_monotonic_time() + (gint64)timeout_ms * 1000;
+  while (!done()) {
+    if (g_get_monotonic_time() > deadline) {
+      return FALSE;
+    }
+    g_main_context_iteration(NULL, TRUE);
+  }
+
+  return TRUE;
+}
+
+static gboolean no_calls_pending(void) { return n_pending == 0; }
+
+static GDBusConnection *open_private_connection(GError **error) {
+  return g_dbus_connection_new_for_address_sync(
+      bus_address,
+      G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+          G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+      NULL, NULL, error);
+}
+
+static GVariant *call_sm(GDBusConnection *connection, const char *method,
+                         GVariant *parameters, const char *reply_type,
+                         GError **error) {
+  return g_dbus_connection_call_sync(
+      connection, SM_DBUS_NAME, SM_DBUS_PATH, SM_DBUS_INTERFACE, method,
+      parameters, G_VARIANT_TYPE(reply_type), G_DBUS_CALL_FLAGS_NONE,
+      CALL_TIMEOUT_MS, NULL, error);
+}
+
+static int count_objects(const char *method) {
+  GError *error = NULL;
+  GVariant *ret;
+  GVariant *list;
+  int n;
+
+  ret = call_sm(control, method, NULL, "(ao)", &error);
+  if (ret == NULL) {
+    g_printerr("%s failed: %s\n", method, error->message);
+    g_error_free(error);
+    return -1;
+  }
+
+  list = g_variant_get_child_value(ret, 0);
+  n = (int)g_variant_n_children(list);
+  g_variant_unref(list);
+  g_variant_unref(ret);
+
+  return n;
+}
+
+/* Waits until the session manager has forgotten about everything we
+ * registered, and returns how long that took.
+ */
+static gint64 wait_for_drain(int base_clients, int base_inhibitors) {
+  gint64 start;
+  gint64 deadline;
+
+  start = g_get_monotonic_time();
+  deadline = start + (gint64)CALL_TIMEOUT_MS * 1000;
+
+  while (g_get_monotonic_time() < deadline) {
+    int clients;
+    int inhibitors;
+
+    clients = count_objects("GetClients");
+    inhibitors = count_objects("GetInhibitors");
+    if (clients < 0 || inhibitors < 0) {
+      return -1;
+    }
+
+    if (clients <= base_clients && inhibitors <= base_inhibitors) {
+      return g_get_monotonic_time() - start;
+    }
+
+    g_main_context_iteration(NULL, FALSE);
+    g_usleep(1000);
+  }
+
+  g_printerr("The session manager still has our clients after %d ms\n",
+             CALL_TIMEOUT_MS);
+
+  return -1;
+}
+
+static gboolean dbus_client_respond(gpointer data) {
+  DBusClient *client = data;
+
+  client->response_id = 0;
+
+  g_dbus_connection_call(client->connection, SM_DBUS_NAME, client->path,
+                         SM_CLIENT_DBUS_INTERFACE, "EndSessionResponse",
+                         g_variant_new("(bs)", TRUE, ""), NULL,
+                         G_DBUS_CALL_FLAGS_NONE, -1, NULL, NULL, NULL);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void dbus_client_schedule_response(DBusClient *client, guint delay) {
+  if (client->response_id != 0) {
+    g_source_remove(client->response_id);
+  }
+
+  client->response_id = g_timeout_add(delay, dbus_client_respond, client);
+}
+
+static void on_client_signal(GDBusConnection *connection, const char *sender,
+                             const char *path, const char *interface,
+                             const char *signal_name, GVariant *parameters,
+                             gpointer data) {
+  DBusClient *client = data;
+  gint64 now;
+
+  now = g_get_monotonic_time();
+
+  if (strcmp(signal_name, "QueryEndSession") == 0) {
+    if (in_logout) {
+      series_add(query_delivery, now - logout_start);
+    }
+    dbus_client_schedule_response(
+        client, client->straggler ? (guint)straggler_delay : latency_sample());
+  } else if (strcmp(signal_name, "EndSession") == 0) {
+    if (in_logout) {
+      series_add(end_session_delivery, now - logout_start);
+    }
+    dbus_client_schedule_response(client, latency_sample());
+  }
+}
+
+static void on_client_registered(GObject *source, GAsyncResult *result,
+                                 gpointer data) {
+  DBusClient *client = data;
+  GError *error = NULL;
+  GVariant *ret;
+  GArray *series;
+
+  series = g_object_get_data(source, "series");
+
+  ret = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), result,
+                                      &error);
+  if (ret == NULL) {
+    g_printerr("RegisterClient failed: %s\n", error->message);
+    g_error_free(error);
+    n_errors++;
+  } else {
+    series_add(series, g_get_monotonic_time() - client->start);
+    g_variant_get(ret, "(o)", &client->path);
+    g_variant_unref(ret);
+
+    client->signal_id = g_dbus_connection_signal_subscribe(
+        client->connection, NULL, SM_CLIENT_DBUS_INTERFACE, NULL,
+        client->path, NULL, G_DBUS_SIGNAL_FLAGS_NONE, on_client_signal,
+        client, NULL);
+  }
+
+  n_pending--;
+}
+
+static void on_timed_call_done(GObject *source, GAsyncResult *result,
+                               gpointer data) {
+  gint64 *start = data;
+  GError *error = NULL;
+  GVariant *ret;
+  GArray *series;
+
+  series = g_object_get_data(source, "series");
+
+  ret = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), result,
+                                      &error);
+  if (ret == NULL) {
+    g_printerr("Call failed: %s\n", error->message);
+    g_error_free(error);
+    n_errors++;
+  } else {
+    series_add(series, g_get_monotonic_time() - *start);
+    g_variant_unref(ret);
+  }
+
+  g_free(start);
+  n_pending--;
+}
+
+static void dbus_client_free(DBusClient *client) {
+  if (client->response_id != 0) {
+    g_source_remove(client->response_id);
+  }
+
+  if (client->connection != NULL) {
+    if (client->signal_id != 0) {
+      g_dbus_connection_signal_unsubscribe(client->connection,
+                                           client->signal_id);
+    }
+    g_dbus_connection_close_sync(client->connection, NULL, NULL);
+    g_object_unref(client->connection);
+  }
+
+  g_free(client->path);
+  g_free(client);
+}
+
+static void ice_io_error_handler(IceConn conn) {
+  /* Don't exit, IceProcessMessages() reports the error */
+}
+
+static gboolean on_ice_input(int fd, GIOCondition condition, gpointer data) {
+  IceConn ice = data;
+
+  if (IceProcessMessages(ice, NULL, NULL) == IceProcessMessagesIOError) {
+    /* The session manager went away */
+    g_hash_table_remove(ice_watches, ice);
+    return G_SOURCE_REMOVE;
+  }
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void xsmp_client_close(XsmpClient *client) {
+  IceConn ice;
+  IceWatch *watch;
+
+  if (client->done_id != 0) {
+    g_source_remove(client->done_id);
+    client->done_id = 0;
+  }
+
+  if (client->conn == NULL) {
+    return;
+  }
+
+  ice = SmcGetIceConnection(client->conn);
+  watch = g_hash_table_lookup(ice_watches, ice);
+  if (watch != NULL && --watch->n_clients == 0) {
+    g_source_remove(watch->watch_id);
+    g_hash_table_remove(ice_watches, ice);
+  }
+
+  SmcCloseConnection(client->conn, 0, NULL);
+  client->conn = NULL;
+}
+
+static gboolean xsmp_client_save_done(gpointer data) {
+  XsmpClient *client = data;
+
+  client->done_id = 0;
+
+  if (client->conn != NULL) {
+    SmcSaveYourselfDone(client->conn, True);
+    IceFlush(SmcGetIceConnection(client->conn));
+  }
+
+  return G_SOURCE_REMOVE;
+}
+
+static void save_yourself(SmcConn conn, SmPointer data, int save_type,
+                          Bool shutdown, int interact_style, Bool fast) {
+  XsmpClient *client = data;
+
+  if (!shutdown || !in_logout) {
+    SmcSaveYourselfDone(conn, True);
+    return;
+  }
+
+  series_add(save_yourself_delivery, g_get_monotonic_time() - logout_start);
+
+  if (client->done_id != 0) {
+    g_source_remove(client->done_id);
+  }
+  client->done_id =
+      g_timeout_add(latency_sample(), xsmp_client_save_done, client);
+}
+
+static void die(SmcConn conn, SmPointer data) {
+  XsmpClient *client = data;
+
+  if (in_logout) {
+    series_add(die_delivery, g_get_monotonic_time() - logout_start);
+  }
+
+  /* Closed once the logout is over, we are inside IceProcessMessages() */
+  client->dead = TRUE;
+}
+
+static void save_complete(SmcConn conn, SmPointer data) {}
+
+static void shutdown_cancelled(SmcConn conn, SmPointer data) {}
+
+static gboolean xsmp_client_open(XsmpClient *client) {
+  SmcCallbacks callbacks;
+  SmPropValue program_value;
+  SmPropValue hint_value;
+  SmProp program_prop;
+  SmProp hint_prop;
+  SmProp *props[2];
+  char hint;
+  char *client_id = NULL;
+  char error[256];
+  IceConn ice;
+  IceWatch *watch;
+
+  memset(&callbacks, 0, sizeof(callbacks));
+  callbacks.save_yourself.callback = save_yourself;
+  callbacks.save_yourself.client_data = client;
+  callbacks.die.callback = die;
+  callbacks.die.client_data = client;
+  callbacks.save_complete.callback = save_complete;
+  callbacks.shutdown_cancelled.callback = shutdown_cancelled;
+
+  client->conn = SmcOpenConnection(
+      NULL, NULL, SmProtoMajor, SmProtoMinor,
+      SmcSaveYourselfProcMask | SmcDieProcMask | SmcSaveCompleteProcMask |
+          SmcShutdownCancelledProcMask,
+      &callbacks, NULL, &client_id, sizeof(error), error);
+  if (client->conn == NULL) {
+    g_printerr("Unable to connect to the session manager: %s\n", error);
+    return FALSE;
+  }
+
+  free(client_id);
+
+  /* Keep the synthetic clients out of the saved session */
+  program_prop.name = (char *)SmProgram;
+  program_prop.type = (char *)SmARRAY8;
+  program_prop.num_vals = 1;
+  program_prop.vals = &program_value;
+  program_value.value = (char *)"test-session-load";
+  program_value.length = strlen(program_value.value);
+
+  hint = SmRestartNever;
+  hint_prop.name = (char *)SmRestartStyleHint;
+  hint_prop.type = (char *)SmCARD8;
+  hint_prop.num_vals = 1;
+  hint_prop.vals = &hint_value;
+  hint_value.value = &hint;
+  hint_value.length = 1;
+
+  props[0] = &program_prop;
+  props[1] = &hint_prop;
+  SmcSetProperties(client->conn, 2, props);
+
+  ice = SmcGetIceConnection(client->conn);
+  IceFlush(ice);
+
+  /* libICE shares one connection between clients of the same process */
+  watch = g_hash_table_lookup(ice_watches, ice);
+  if (watch == NULL) {
+    watch = g_new0(IceWatch, 1);
+    watch->watch_id =
+        g_unix_fd_add(IceConnectionNumber(ice), G_IO_IN, on_ice_input, ice);
+    g_hash_table_insert(ice_watches, ice, watch);
+  }
+  watch->n_clients++;
+
+  return TRUE;
+}
+
+static gboolean run_register(DBusClient **dbus_clients,
+                             XsmpClient *xsmp_clients) {
+  GArray *register_series;
+  GArray *connect_series;
+  GArray *inhibit_series;
+  GError *error = NULL;
+  Usage usage;
+  int i;
+
+  register_series = g_array_new(FALSE, FALSE, sizeof(gint64));
+  connect_series = g_array_new(FALSE, FALSE, sizeof(gint64));
+  inhibit_series = g_array_new(FALSE, FALSE, sizeof(gint64));
+
+  /* Connecting to the bus is not what we are measuring */
+  for (i = 0; i < n_dbus_clients; i++) {
+    dbus_clients[i] = g_new0(DBusClient, 1);
+    dbus_clients[i]->straggler = i < n_stragglers;
+    dbus_clients[i]->connection = open_private_connection(&error);
+    if (dbus_clients[i]->connection == NULL) {
+      g_printerr("Unable to connect to the bus: %s\n", error->message);
+      g_error_free(error);
+      return FALSE;
+    }
+    g_object_set_data(G_OBJECT(dbus_clients[i]->connection), "series",
+                      register_series);
+  }
+
+  inhibit_connection = open_private_connection(&error);
+  if (inhibit_connection == NULL) {
+    g_printerr("Unable to connect to the bus: %s\n", error->message);
+    g_error_free(error);
+    return FALSE;
+  }
+  g_object_set_data(G_OBJECT(inhibit_connection), "series", inhibit_series);
+
+  usage_begin(&usage);
+
+  for (i = 0; i < n_dbus_clients; i++) {
+    DBusClient *client = dbus_clients[i];
+    char *app_id;
+
+    app_id = g_strdup_printf("test-session-load-%d", i);
+    client->start = g_get_monotonic_time();
+    g_dbus_connection_call(client->connection, SM_DBUS_NAME, SM_DBUS_PATH,
+                           SM_DBUS_INTERFACE, "RegisterClient",
+                           g_variant_new("(ss)", app_id, ""),
+                           G_VARIANT_TYPE("(o)"), G_DBUS_CALL_FLAGS_NONE,
+                           CALL_TIMEOUT_MS, NULL, on_client_registered,
+                           client);
+    n_pending++;
+    g_free(app_id);
+  }
+
+  for (i = 0; i < n_inhibitors; i++) {
+    gint64 *start;
+
+    start = g_new(gint64, 1);
+    *start = g_get_monotonic_time();
+    g_dbus_connection_call(
+        inhibit_connection, SM_DBUS_NAME, SM_DBUS_PATH, SM_DBUS_INTERFACE,
+        "Inhibit",
+        g_variant_new("(susu)", "test-session-load", 0,
+                      "Benchmarking the session manager",
+                      GSM_INHIBITOR_FLAG_SUSPEND | GSM_INHIBITOR_FLAG_IDLE),
+        G_VARIANT_TYPE("(u)"), G_DBUS_CALL_FLAGS_NONE, CALL_TIMEOUT_MS, NULL,
+        on_timed_call_done, start);
+    n_pending++;
+  }
+
+  /* SmcOpenConnection() blocks, so the XSMP clients connect one after the
+   * other while the D-Bus calls above are in flight.
+   */
+  for (i = 0; i < n_xsmp_clients; i++) {
+    gint64 start;
+
+    start = g_get_monotonic_time();
+    if (!xsmp_client_open(&xsmp_clients[i])) {
+      return FALSE;
+    }
+    series_add(connect_series, g_get_monotonic_time() - start);
+  }
+
+  if (!wait_until(no_calls_pending, CALL_TIMEOUT_MS) || n_errors > 0) {
+    g_printerr("Registration did not complete\n");
+    return FALSE;
+  }
+
+  g_print("register: %d D-Bus clients, %d XSMP clients, %d inhibitors\n",
+          n_dbus_clients, n_xsmp_clients, n_inhibitors);
+  series_report("RegisterClient", register_series);
+  series_report("XSMP connect", connect_series);
+  series_report("Inhibit", inhibit_series);
+  usage_report(&usage);
+
+  g_array_free(register_series, TRUE);
+  g_array_free(connect_series, TRUE);
+  g_array_free(inhibit_series, TRUE);
+
+  return TRUE;
+}
+
+static gboolean churn_cycle(int i) {
+  GDBusConnection *connection;
+  GError *error = NULL;
+  GVariant *ret;
+  char *app_id;
+
+  connection = open_private_connection(&error);
+  if (connection == NULL) {
+    g_printerr("Unable to connect to the bus: %s\n", error->message);
+    g_error_free(error);
+    return FALSE;
+  }
+
+  app_id = g_strdup_printf("test-session-load-churn-%d", i);
+  ret = call_sm(connection, "RegisterClient", g_variant_new("(ss)", app_id, ""),
+                "(o)", &error);
+  g_free(app_id);
+  if (ret != NULL) {
+    g_variant_unref(ret);
+    ret = call_sm(connection, "Inhibit",
+                  g_variant_new("(susu)", "test-session-load", 0,
+                                "Benchmarking the session manager",
+                                GSM_INHIBITOR_FLAG_SUSPEND),
+                  "(u)", &error);
+  }
+
+  /* Leave it to NameOwnerChanged to clean up */
+  g_dbus_connection_close_sync(connection, NULL, NULL);
+  g_object_unref(connection);
+
+  if (ret == NULL) {
+    g_printerr("Churn cycle failed: %s\n", error->message);
+    g_error_free(error);
+    return FALSE;
+  }
+
+  g_variant_unref(ret);
+
+  return TRUE;
+}
+
+static gboolean run_churn(void) {
+  GArray *cycle_series;
+  GArray *drain_series;
+  Usage usage;
+  gint64 drain;
+  gboolean ok = TRUE;
+  int clients;
+  int inhibitors;
+  int i;
+
+  /* Whatever is held by the register scenario stays */
+  clients = count_objects("GetClients");
+  inhibitors = count_objects("GetInhibitors");
+  if (clients < 0 || inhibitors < 0) {
+    return FALSE;
+  }
+
+  cycle_series = g_array_new(FALSE, FALSE, sizeof(gint64));
+  drain_series = g_array_new(FALSE, FALSE, sizeof(gint64));
+
+  usage_begin(&usage);
+
+  for (i = 0; ok && i < n_churn; i++) {
+    gint64 start;
+
+    start = g_get_monotonic_time();
+    ok = churn_cycle(i);
+    series_add(cycle_series, g_get_monotonic_time() - start);
+
+    /* Keep the XSMP clients responsive */
+    while (g_main_context_iteration(NULL, FALSE)) {
+    }
+  }
+
+  drain = ok ? wait_for_drain(clients, inhibitors) : -1;
+  if (drain >= 0) {
+    series_add(drain_series, drain);
+  }
+
+  if (ok) {
+    g_print("churn: %d connect/register/inhibit/disconnect cycles\n",
+            n_churn);
+    series_report("cycle", cycle_series);
+    series_report("cleanup after last cycle", drain_series);
+    usage_report(&usage);
+  }
+
+  g_array_free(cycle_series, TRUE);
+  g_array_free(drain_series, TRUE);
+
+  return ok && drain >= 0;
+}
+
+static gboolean logout_done(void) { return session_reap(); }
+
+static void on_logout_done(GObject *source, GAsyncResult *result,
+                           gpointer data) {
+  GError *error = NULL;
+  GVariant *ret;
+
+  ret = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), result,
+                                      &error);
+  if (ret == NULL) {
+    /* The session may well be gone before it replies */
+    g_debug("Logout: %s", error->message);
+    g_error_free(error);
+  } else {
+    g_variant_unref(ret);
+  }
+}
+
+static gboolean run_logout(void) {
+  GArray *exit_series;
+  Usage usage;
+  gboolean ok;
+
+  query_delivery = g_array_new(FALSE, FALSE, sizeof(gint64));
+  end_session_delivery = g_array_new(FALSE, FALSE, sizeof(gint64));
+  save_yourself_delivery = g_array_new(FALSE, FALSE, sizeof(gint64));
+  die_delivery = g_array_new(FALSE, FALSE, sizeof(gint64));
+  exit_series = g_array_new(FALSE, FALSE, sizeof(gint64));
+
+  usage_begin(&usage);
+
+  in_logout = TRUE;
+  logout_start = g_get_monotonic_time();
+  g_dbus_connection_call(control, SM_DBUS_NAME, SM_DBUS_PATH,
+                         SM_DBUS_INTERFACE, "Logout",
+                         g_variant_new("(u)", (guint)logout_mode), NULL,
+                         G_DBUS_CALL_FLAGS_NONE, LOGOUT_TIMEOUT_MS, NULL,
+                         on_logout_done, NULL);
+
+  ok = wait_until(logout_done, LOGOUT_TIMEOUT_MS);
+  in_logout = FALSE;
+
+  if (!ok) {
+    g_printerr("The session did not end within %d ms\n", LOGOUT_TIMEOUT_MS);
+  } else {
+    series_add(exit_series, session_exit_time - logout_start);
+
+    g_print("logout: mode %d, %d stragglers answering after %d ms\n",
+            logout_mode, n_stragglers, straggler_delay);
+    series_report("QueryEndSession delivered", query_delivery);
+    series_report("EndSession delivered", end_session_delivery);
+    series_report("SaveYourself delivered", save_yourself_delivery);
+    series_report("Die delivered", die_delivery);
+    series_report("session exit", exit_series);
+    usage_report(&usage);
+  }
+
+  g_array_free(query_delivery, TRUE);
+  g_array_free(end_session_delivery, TRUE);
+  g_array_free(save_yourself_delivery, TRUE);
+  g_array_free(die_delivery, TRUE);
+  g_array_free(exit_series, TRUE);
+
+  return ok;
+}
+
+static gboolean get_session_manager_pid(void) {
+  GError *error = NULL;
+  GVariant *ret;
+
+  ret = g_dbus_connection_call_sync(
+      control, "org.freedesktop.DBus", "/org/freedesktop/DBus",
+      "org.freedesktop.DBus", "GetConnectionUnixProcessID",
+      g_variant_new("(s)", SM_DBUS_NAME), G_VARIANT_TYPE("(u)"),
+      G_DBUS_CALL_FLAGS_NONE, -1, NULL, &error);
+  if (ret == NULL) {
+    g_printerr("Unable to find the session manager: %s\n", error->message);
+    g_error_free(error);
+    return FALSE;
+  }
+
+  g_variant_get(ret, "(u)", &session_manager_pid);
+  g_variant_unref(ret);
+
+  return TRUE;
+}
+
+static gboolean is_session_running(void) {
+  GVariant *ret;
+  gboolean running = FALSE;
+
+  ret = call_sm(control, "IsSessionRunning", NULL, "(b)", NULL);
+  if (ret != NULL) {
+    g_variant_get(ret, "(b)", &running);
+    g_variant_unref(ret);
+  }
+
+  return running;
+}
+
+/* Starts @session_path with an autostart directory that only holds a probe
+ * writing out SESSION_MANAGER, which we need to reach its XSMP server.
+ */
+static gboolean spawn_session(const char *tmpdir) {
+  char *autostart;
+  char *probe;
+  char *desktop;
+  char *contents;
+  char *iceauthority;
+  char **envp;
+  char *argv[4];
+  GError *error = NULL;
+  gint64 deadline;
+  gboolean ok = FALSE;
+
+  autostart = g_build_filename(tmpdir, "autostart", NULL);
+  probe = g_build_filename(tmpdir, "session-manager", NULL);
+  desktop = g_build_filename(autostart, "test-session-load.desktop", NULL);
+  iceauthority = g_build_filename(tmpdir, "ICEauthority", NULL);
+
+  g_mkdir(autostart, 0700);
+  contents = g_strdup_printf(
+      "[Desktop Entry]\n"
+      "Type=Application\n"
+      "Name=Session load probe\n"
+      "Exec=sh -c 'echo \"$SESSION_MANAGER\" > %s.tmp && mv %s.tmp %s'\n",
+      probe, probe, probe);
+  if (!g_file_set_contents(desktop, contents, -1, &error)) {
+    g_printerr("Unable to write %s: %s\n", desktop, error->message);
+    g_error_free(error);
+    g_free(contents);
+    goto out;
+  }
+  g_free(contents);
+
+  /* Both sides have to agree on the ICE authority file */
+  g_setenv("ICEAUTHORITY", iceauthority, TRUE);
+  envp = g_get_environ();
+
+  argv[0] = (char *)session_path;
+  argv[1] = (char *)"--autostart";
+  argv[2] = autostart;
+  argv[3] = NULL;
+
+  if (!g_spawn_async(NULL, argv, envp, G_SPAWN_DO_NOT_REAP_CHILD, NULL, NULL,
+                     &session_pid, &error)) {
+    g_printerr("Unable to start %s: %s\n", session_path, error->message);
+    g_error_free(error);
+    g_strfreev(envp);
+    goto out;
+  }
+  g_strfreev(envp);
+
+  session_manager_pid = (guint32)session_pid;
+
+  deadline = g_get_monotonic_time() + (gint64)CALL_TIMEOUT_MS * 1000;
+  while (!g_file_test(probe, G_FILE_TEST_EXISTS) || !is_session_running()) {
+    if (session_reap()) {
+      g_printerr("%s exited during startup\n", session_path);
+      goto out;
+    }
+
+    if (g_get_monotonic_time() > deadline) {
+      g_printerr("%s did not start within %d ms\n", session_path,
+                 CALL_TIMEOUT_MS);
+      goto out;
+    }
+
+    g_usleep(G_USEC_PER_SEC / 20);
+  }
+
+  if (!g_file_get_contents(probe, &contents, NULL, &error)) {
+    g_printerr("Unable to read %s: %s\n", probe, error->message);
+    g_error_free(error);
+    goto out;
+  }
+  g_setenv("SESSION_MANAGER", g_strstrip(contents), TRUE);
+  g_free(contents);
+
+  ok = TRUE;
+
+out:
+  g_remove(probe);
+  g_remove(desktop);
+  g_rmdir(autostart);
+  g_free(iceauthority);
+  g_free(desktop);
+  g_free(probe);
+  g_free(autostart);
+
+  return ok;
+}
+
+static void stop_session(const char *tmpdir) {
+  char *iceauthority;
+
+  if (session_pid != 0 && !session_exited) {
+    kill(session_pid, SIGTERM);
+    waitpid(session_pid, NULL, 0);
+    session_exited = TRUE;
+  }
+
+  iceauthority = g_build_filename(tmpdir, "ICEauthority", NULL);
+  g_remove(iceauthority);
+  g_free(iceauthority);
+  g_rmdir(tmpdir);
+}
+
+int main(int argc, char *argv[]) {
+  GOptionContext *context;
+  GError *error = NULL;
+  GTestDBus *test_bus = NULL;
+  char *tmpdir = NULL;
+  DBusClient **dbus_clients;
+  XsmpClient *xsmp_clients;
+  gboolean do_register;
+  gboolean do_churn;
+  gboolean do_logout;
+  gboolean ok = FALSE;
+  int base_clients;
+  int base_inhibitors;
+  gint64 drain;
+  int i;
+
+  context = g_option_context_new("- put a synthetic load on the session "
+                                 "manager");
+  g_option_context_add_main_entries(context, entries, NULL);
+  if (!g_option_context_parse(context, &argc, &argv, &error)) {
+    g_printerr("%s\n", error->message);
+    g_error_free(error);
+    return EXIT_FAILURE;
+  }
+  g_option_context_free(context);
+
+  if (latency_spec != NULL && !parse_latency(latency_spec)) {
+    g_printerr("Invalid latency specification '%s'\n", latency_spec);
+    return EXIT_FAILURE;
+  }
+
+  if (n_xsmp_clients < 0 || n_dbus_clients < 0 || n_inhibitors < 0 ||
+      n_churn < 0 || straggler_delay < 0 || n_stragglers < 0 ||
+      n_stragglers > n_dbus_clients) {
+    g_printerr("Invalid counts\n");
+    return EXIT_FAILURE;
+  }
+
+  if (scenario == NULL || strcmp(scenario, "all") == 0) {
+    do_register = TRUE;
+    do_churn = TRUE;
+    do_logout = session_path != NULL;
+  } else if (strcmp(scenario, "register") == 0) {
+    do_register = TRUE;
+    do_churn = FALSE;
+    do_logout = FALSE;
+  } else if (strcmp(scenario, "churn") == 0) {
+    do_register = FALSE;
+    do_churn = TRUE;
+    do_logout = FALSE;
+  } else if (strcmp(scenario, "logout") == 0) {
+    /* Logging out an empty session would not tell us much */
+    do_register = TRUE;
+    do_churn = FALSE;
+    do_logout = TRUE;
+  } else {
+    g_printerr("Unknown scenario '%s'\n", scenario);
+    return EXIT_FAILURE;
+  }
+
+  if (do_logout && session_path == NULL) {
+    g_printerr("The logout scenario ends the session, it needs --session\n");
+    return EXIT_FAILURE;
+  }
+
+  /* Writing to a session manager that already exited must not kill us */
+  signal(SIGPIPE, SIG_IGN);
+  IceSetIOErrorHandler(ice_io_error_handler);
+  ice_watches =
+      g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+  g_timeout_add(20, on_wakeup, NULL);
+
+  if (session_path != NULL) {
+    tmpdir = g_dir_make_tmp("test-session-load-XXXXXX", &error);
+    if (tmpdir == NULL) {
+      g_printerr("Unable to create a temporary directory: %s\n",
+                 error->message);
+      g_error_free(error);
+      return EXIT_FAILURE;
+    }
+
+    test_bus = g_test_dbus_new(G_TEST_DBUS_NONE);
+    g_test_dbus_up(test_bus);
+  }
+
+  bus_address = g_dbus_address_get_for_bus_sync(G_BUS_TYPE_SESSION, NULL,
+                                                &error);
+  if (bus_address == NULL) {
+    g_printerr("Unable to find the session bus: %s\n", error->message);
+    g_error_free(error);
+    goto out;
+  }
+
+  control = open_private_connection(&error);
+  if (control == NULL) {
+    g_printerr("Unable to connect to the session bus: %s\n", error->message);
+    g_error_free(error);
+    goto out;
+  }
+
+  if (session_path != NULL) {
+    if (!spawn_session(tmpdir)) {
+      goto out;
+    }
+  } else if (!get_session_manager_pid()) {
+    goto out;
+  }
+
+  base_clients = count_objects("GetClients");
+  base_inhibitors = count_objects("GetInhibitors");
+  if (base_clients < 0 || base_inhibitors < 0) {
+    goto out;
+  }
+
+  dbus_clients = g_new0(DBusClient *, n_dbus_clients);
+  xsmp_clients = g_new0(XsmpClient, n_xsmp_clients);
+
+  ok = TRUE;
+
+  if (do_register) {
+    ok = run_register(dbus_clients, xsmp_clients);
+  }
+
+  if (ok && do_churn) {
+    ok = run_churn();
+  }
+
+  if (ok && do_logout) {
+    ok = run_logout();
+  }
+
+  for (i = 0; i < n_xsmp_clients; i++) {
+    xsmp_client_close(&xsmp_clients[i]);
+  }
+
+  for (i = 0; i < n_dbus_clients; i++) {
+    if (dbus_clients[i] != NULL) {
+      dbus_client_free(dbus_clients[i]);
+    }
+  }
+
+  if (inhibit_connection != NULL) {
+    g_dbus_connection_close_sync(inhibit_connection, NULL, NULL);
+    g_object_unref(inhibit_connection);
+  }
+
+  if (ok && do_register && !do_logout) {
+    drain = wait_for_drain(base_clients, base_inhibitors);
+    if (drain < 0) {
+      ok = FALSE;
+    } else {
+      g_print("teardown: all clients gone after %.2f ms\n", drain / 1000.0);
+    }
+  }
+
+  g_free(xsmp_clients);
+  g_free(dbus_clients);
+
+out:
+  if (control != NULL) {
+    g_dbus_connection_close_sync(control, NULL, NULL);
+    g_object_unref(control);
+  }
+
+  if (session_path != NULL) {
+    stop_session(tmpdir);
+    g_test_dbus_down(test_bus);
+    g_object_unref(test_bus);
+    g_free(tmpdir);
+  }
+
+  g_free(bus_address);
+  g_hash_table_destroy(ice_watches);
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,809 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <fcntl.h>
+#include <gio/gio.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "test-util.h"
+
+#define SM_DBUS_NAME "org.gnome.SessionManager"
+#define SM_DBUS_PATH "/org/gnome/SessionManager"
+#define SM_DBUS_INTERFACE "org.gnome.SessionManager"
+
+#define GSM_SCHEMA "org.mate.session"
+#define GSM_REQUIRED_COMPONENTS_SCHEMA GSM_SCHEMA ".required-components"
+#define GSM_REQUIRED_COMPONENTS_LIST_KEY "required-components-list"
+
+#define CONDITION_FLAG "test-session-startup-flag"
+#define DBUS_NAME_PREFIX "org.mate.SessionStartupTest.App"
+#define STOP_TIMEOUT_MS 10000
+
+/* Starts mate-session over and over on a private bus against a synthetic
+ * autostart directory given with --autostart, and reports how long it took
+ * to reach the running phase and how long each startup phase lasted, as
+ * one JSON object per line.
+ *
+ * Every phase gets --entries desktop files. Most of them run true, some
+ * are delayed, have an AutostartCondition that does or does not hold, a
+ * TryExec that is or is not found, and in the application phase some are
+ * D-Bus activated. The required components are replaced by stubs unless
+ * --real-components is given. Settings come from the memory backend and
+ * the XDG directories live in a temporary directory, so nothing from the
+ * user's session leaks into the numbers. The phase durations are read from
+ * the startup trace mate-session writes when the session is running.
+ *
+ * It needs an X display: the current one, or a private Xvfb with --xvfb.
+ */
+
+typedef struct {
+  const char *name;
+  const char *key;
+} Phase;
+
+static const Phase phases[] = {{"STARTUP", NULL},
+                               {"INITIALIZATION", "Initialization"},
+                               {"WINDOW_MANAGER", "WindowManager"},
+                               {"PANEL", "Panel"},
+                               {"DESKTOP", "Desktop"},
+                               {"APPLICATION", "Application"}};
+
+static char *session_path = NULL;
+static char *xvfb_path = NULL;
+static int n_entries = 20;
+static int n_rounds = 5;
+static int timeout = 60;
+static gboolean cold = FALSE;
+static gboolean real_components = FALSE;
+
+static GOptionEntry entries[] = {
+    {"session", 0, 0, G_OPTION_ARG_FILENAME, &session_path,
+     "The mate-session to start (default: from PATH)", "PATH"},
+    {"entries", 'n', 0, G_OPTION_ARG_INT, &n_entries,
+     "Number of autostart entries per phase", "N"},
+    {"rounds", 'r', 0, G_OPTION_ARG_INT, &n_rounds, "Number of rounds", "N"},
+    {"cold", 0, 0, G_OPTION_ARG_NONE, &cold,
+     "Clear the caches and startup history before every round", NULL},
+    {"real-components", 0, 0, G_OPTION_ARG_NONE, &real_components,
+     "Start the configured required components instead of stubs", NULL},
+    {"xvfb", 0, 0, G_OPTION_ARG_FILENAME, &xvfb_path,
+     "Start the session on a private display served by this Xvfb", "PATH"},
+    {"timeout", 't', 0, G_OPTION_ARG_INT, &timeout,
+     "Seconds to wait for the session to be running", "SECONDS"},
+    {NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL}};
+
+static char *tmpdir = NULL;
+static GPid xvfb_pid = 0;
+static gboolean session_running = FALSE;
+
+static char *tmp_path(const char *first, ...) G_GNUC_NULL_TERMINATED;
+
+static char *tmp_path(const char *first, ...) {
+  GString *path;
+  const char *element;
+  va_list args;
+
+  path = g_string_new(tmpdir);
+
+  va_start(args, first);
+  for (element = first; element != NULL; element = va_arg(args, const char *)) {
+    g_string_append_c(path, G_DIR_SEPARATOR);
+    g_string_append(path, element);
+  }
+  va_end(args);
+
+  return g_string_free(path, FALSE);
+}
+
+static gboolean write_file(const char *path, const char *contents) {
+  GError *error = NULL;
+
+  if (!g_file_set_contents(path, contents, -1, &error)) {
+    g_printerr("Unable to write %s: %s\n", path, error->message);
+    g_error_free(error);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static gboolean remove_tree(const char *path) {
+  GDir *dir;
+  const char *name;
+
+  dir = g_dir_open(path, 0, NULL);
+  if (dir != NULL) {
+    while ((name = g_dir_read_name(dir)) != NULL) {
+      char *child;
+
+      child = g_build_filename(path, name, NULL);
+      remove_tree(child);
+      g_free(child);
+    }
+    g_dir_close(dir);
+  }
+
+  return g_remove(path) == 0;
+}
+
+/* Writes one autostart entry. @i picks its flavour so that every run of
+ * the benchmark generates the same tree.
+ */
+static gboolean write_entry(const char *autostart, const char *services,
+                            const Phase *phase, int i) {
+  GString *contents;
+  char *id;
+  char *path;
+  gboolean ret;
+  gboolean application;
+
+  application = phase->key != NULL && strcmp(phase->key, "Application") == 0;
+  id = g_strdup_printf("%s-%d", phase->key, i);
+
+  contents = g_string_new("[Desktop Entry]\nType=Application\n");
+  g_string_append_printf(contents, "Name=Startup benchmark %s\n", id);
+  g_string_append_printf(contents, "X-MATE-Autostart-Phase=%s\n",
+                         phase->key);
+
+  switch (i % 10) {
+    case 1:
+      g_string_append(contents,
+                      "AutostartCondition=if-exists " CONDITION_FLAG "\n");
+      break;
+    case 2:
+      g_string_append(contents,
+                      "AutostartCondition=unless-exists " CONDITION_FLAG "\n");
+      break;
+    case 3:
+      g_string_append(contents, "TryExec=true\n");
+      break;
+    case 4:
+      g_string_append(contents, "TryExec=test-session-startup-missing\n");
+      break;
+    case 5:
+      if (application) {
+        g_string_append(contents, "X-MATE-Autostart-Delay=1\n");
+      }
+      break;
+    case 6:
+      g_string_append(contents, "Hidden=true\n");
+      break;
+    case 7:
+      g_string_append(contents, "OnlyShowIn=GNOME;\n");
+      break;
+    default:
+      break;
+  }
+
+  if (application && i % 10 == 8) {
+    char *service;
+    char *service_path;
+
+    /* The activated service exits right away, which is enough to go
+     * through the whole activation path.
+     */
+    g_string_append_printf(contents,
+                           "Exec=true\nX-MATE-DBus-Name=" DBUS_NAME_PREFIX
+                           "%d\n",
+                           i);
+
+    service = g_strdup_printf(
+        "[D-BUS Service]\nName=" DBUS_NAME_PREFIX "%d\nExec=/bin/true\n", i);
+    service_path =
+        g_strdup_printf("%s/" DBUS_NAME_PREFIX "%d.service", services, i);
+    ret = write_file(service_path, service);
+    g_free(service_path);
+    g_free(service);
+    if (!ret) {
+      goto out;
+    }
+  } else {
+    g_string_append(contents, "Exec=true\n");
+  }
+
+  path = g_strdup_printf("%s/test-session-startup-%s.desktop", autostart, id);
+  ret = write_file(path, contents->str);
+  g_free(path);
+
+out:
+  g_string_free(contents, TRUE);
+  g_free(id);
+
+  return ret;
+}
+
+/* Stubs for the required components, found first through XDG_DATA_DIRS */
+static gboolean write_component_stubs(const char *applications) {
+  GSettings *settings;
+  GSettings *components;
+  char **list;
+  gboolean ret = TRUE;
+  int i;
+
+  settings = g_settings_new(GSM_SCHEMA);
+  components = g_settings_new(GSM_REQUIRED_COMPONENTS_SCHEMA);
+  list = g_settings_get_strv(settings, GSM_REQUIRED_COMPONENTS_LIST_KEY);
+
+  for (i = 0; ret && list[i] != NULL; i++) {
+    char *provider;
+    char *contents;
+    char *path;
+
+    provider = g_settings_get_string(components, list[i]);
+    if (provider == NULL || provider[0] == '\0') {
+      g_free(provider);
+      continue;
+    }
+
+    contents = g_strdup_printf(
+        "[Desktop Entry]\nType=Application\nName=Stub %s\nExec=true\n"
+        "X-MATE-Autostart-Phase=%s\n",
+        list[i],
+        strcmp(list[i], "windowmanager") == 0 ? "WindowManager"
+        : strcmp(list[i], "panel") == 0       ? "Panel"
+        : strcmp(list[i], "filemanager") == 0 ? "Desktop"
+                                              : "Application");
+    path = g_strdup_printf("%s/%s.desktop", applications, provider);
+    ret = write_file(path, contents);
+    g_free(path);
+    g_free(contents);
+    g_free(provider);
+  }
+
+  g_strfreev(list);
+  g_object_unref(components);
+  g_object_unref(settings);
+
+  return ret;
+}
+
+static gboolean generate_tree(void) {
+  char *autostart;
+  char *services;
+  char *applications;
+  char *config;
+  char *flag;
+  gboolean ret = TRUE;
+  guint p;
+  int i;
+
+  autostart = tmp_path("autostart", NULL);
+  services = tmp_path("services", NULL);
+  applications = tmp_path("data", "applications", NULL);
+  config = tmp_path("config", NULL);
+  flag = tmp_path("config", CONDITION_FLAG, NULL);
+
+  g_mkdir_with_parents(autostart, 0700);
+  g_mkdir_with_parents(services, 0700);
+  g_mkdir_with_parents(applications, 0700);
+  g_mkdir_with_parents(config, 0700);
+
+  ret = write_file(flag, "");
+
+  for (p = 0; ret && p < G_N_ELEMENTS(phases); p++) {
+    if (phases[p].key == NULL) {
+      continue;
+    }
+
+    for (i = 0; ret && i < n_entries; i++) {
+      ret = write_entry(autostart, services, &phases[p], i);
+    }
+  }
+
+  if (ret && !real_components) {
+    ret = write_component_stubs(applications);
+  }
+
+  g_free(flag);
+  g_free(config);
+  g_free(applications);
+  g_free(services);
+  g_free(autostart);
+
+  return ret;
+}
+
+static gboolean start_xvfb(void) {
+  GError *error = NULL;
+  char buf[32];
+  char *display;
+  char *fd_arg;
+  char *argv[9];
+  struct pollfd pfd;
+  gssize n = 0;
+  int fds[2];
+  gboolean ret = FALSE;
+
+  if (pipe(fds) != 0) {
+    g_printerr("Unable to create a pipe\n");
+    return FALSE;
+  }
+  fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+
+  fd_arg = g_strdup_printf("%d", fds[1]);
+  argv[0] = xvfb_path;
+  argv[1] = (char *)"-displayfd";
+  argv[2] = fd_arg;
+  argv[3] = (char *)"-nolisten";
+  argv[4] = (char *)"tcp";
+  argv[5] = (char *)"-screen";
+  argv[6] = (char *)"0";
+  argv[7] = (char *)"1024x768x24";
+  argv[8] = NULL;
+
+  if (!g_spawn_async(NULL, argv, NULL,
+                     G_SPAWN_LEAVE_DESCRIPTORS_OPEN |
+                         G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_SEARCH_PATH,
+                     NULL, NULL, &xvfb_pid, &error)) {
+    g_printerr("Unable to start %s: %s\n", xvfb_path, error->message);
+    g_error_free(error);
+    goto out;
+  }
+
+  close(fds[1]);
+  fds[1] = -1;
+
+  /* Xvfb writes the display number once it accepts connections */
+  pfd.fd = fds[0];
+  pfd.events = POLLIN;
+  if (poll(&pfd, 1, 10000) > 0) {
+    n = read(fds[0], buf, sizeof(buf) - 1);
+  }
+
+  if (n <= 0) {
+    g_printerr("%s did not report a display\n", xvfb_path);
+    goto out;
+  }
+
+  buf[n] = '\0';
+  display = g_strdup_printf(":%s", g_strstrip(buf));
+  g_setenv("DISPLAY", display, TRUE);
+  g_free(display);
+
+  ret = TRUE;
+
+out:
+  if (fds[1] >= 0) {
+    close(fds[1]);
+  }
+  close(fds[0]);
+  g_free(fd_arg);
+
+  return ret;
+}
+
+static void on_session_running(GDBusConnection *connection,
+                               const char *sender, const char *path,
+                               const char *interface, const char *signal_name,
+                               GVariant *parameters, gpointer data) {
+  gint64 *running = data;
+
+  if (!session_running) {
+    session_running = TRUE;
+    *running = g_get_monotonic_time();
+  }
+}
+
+static gboolean on_wakeup(gpointer data) { return G_SOURCE_CONTINUE; }
+
+/* Parses the startup trace written by mate-session, one event per line */
+static gboolean read_trace(const char *path, GHashTable *durations,
+                           gint64 *init_ts, int *n_apps) {
+  GHashTable *begins;
+  GRegex *regex;
+  char *contents;
+  char **lines;
+  int i;
+
+  if (!g_file_get_contents(path, &contents, NULL, NULL)) {
+    return FALSE;
+  }
+
+  begins = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  regex = g_regex_new("^\\{\"name\":\"([^\"]*)\",\"cat\":\"([^\"]*)\","
+                      "\"ph\":\"(.)\",\"ts\":(-?[0-9]+)",
+                      0, 0, NULL);
+
+  *init_ts = -1;
+  *n_apps = 0;
+
+  lines = g_strsplit(contents, "\n", -1);
+  for (i = 0; lines[i] != NULL; i++) {
+    GMatchInfo *match;
+    char *name;
+    char *category;
+    char *ph;
+    char *ts_str;
+    gint64 ts;
+
+    if (!g_regex_match(regex, lines[i], 0, &match)) {
+      g_match_info_free(match);
+      continue;
+    }
+
+    name = g_match_info_fetch(match, 1);
+    category = g_match_info_fetch(match, 2);
+    ph = g_match_info_fetch(match, 3);
+    ts_str = g_match_info_fetch(match, 4);
+    ts = g_ascii_strtoll(ts_str, NULL, 10);
+
+    if (strcmp(category, "phase") == 0 && ph[0] == 'B') {
+      gint64 *begin;
+
+      begin = g_new(gint64, 1);
+      *begin = ts;
+      g_hash_table_replace(begins, g_strdup(name), begin);
+    } else if (strcmp(category, "phase") == 0 && ph[0] == 'E') {
+      gint64 *begin;
+
+      begin = g_hash_table_lookup(begins, name);
+      if (begin != NULL) {
+        gint64 *duration;
+
+        duration = g_new(gint64, 1);
+        *duration = ts - *begin;
+        g_hash_table_replace(durations, g_strdup(name), duration);
+      }
+    } else if (strcmp(category, "session") == 0 && ph[0] == 'i' &&
+               strcmp(name, "init") == 0) {
+      *init_ts = ts;
+    } else if (strcmp(category, "app") == 0 && ph[0] == 'b') {
+      (*n_apps)++;
+    }
+
+    g_free(ts_str);
+    g_free(ph);
+    g_free(category);
+    g_free(name);
+    g_match_info_free(match);
+  }
+
+  g_strfreev(lines);
+  g_regex_unref(regex);
+  g_hash_table_destroy(begins);
+  g_free(contents);
+
+  return TRUE;
+}
+
+static void stop_session(GPid pid) {
+  gint64 deadline;
+
+  kill(pid, SIGTERM);
+
+  deadline = g_get_monotonic_time() + (gint64)STOP_TIMEOUT_MS * 1000;
+  while (waitpid(pid, NULL, WNOHANG) == 0) {
+    if (g_get_monotonic_time() > deadline) {
+      g_printerr("mate-session did not exit, killing it\n");
+      kill(pid, SIGKILL);
+      waitpid(pid, NULL, 0);
+      break;
+    }
+    g_usleep(G_USEC_PER_SEC / 100);
+  }
+}
+
+static char **get_session_environment(void) {
+  char **envp;
+  char *value;
+  char *data;
+  const char *data_dirs;
+
+  envp = g_get_environ();
+  envp = g_environ_unsetenv(envp, "SESSION_MANAGER");
+  envp = g_environ_setenv(envp, "GSETTINGS_BACKEND", "memory", TRUE);
+
+  value = tmp_path("config", NULL);
+  envp = g_environ_setenv(envp, "XDG_CONFIG_HOME", value, TRUE);
+  g_free(value);
+  value = tmp_path("cache", NULL);
+  envp = g_environ_setenv(envp, "XDG_CACHE_HOME", value, TRUE);
+  g_free(value);
+  value = tmp_path("home", NULL);
+  envp = g_environ_setenv(envp, "XDG_DATA_HOME", value, TRUE);
+  g_free(value);
+  value = tmp_path("runtime", NULL);
+  envp = g_environ_setenv(envp, "XDG_RUNTIME_DIR", value, TRUE);
+  g_free(value);
+  value = tmp_path("ICEauthority", NULL);
+  envp = g_environ_setenv(envp, "ICEAUTHORITY", value, TRUE);
+  g_free(value);
+
+  /* The component stubs shadow the real desktop files */
+  data_dirs = g_environ_getenv(envp, "XDG_DATA_DIRS");
+  if (data_dirs == NULL || data_dirs[0] == '\0') {
+    data_dirs = "/usr/local/share:/usr/share";
+  }
+  data = tmp_path("data", NULL);
+  value = g_strdup_printf("%s:%s", data, data_dirs);
+  envp = g_environ_setenv(envp, "XDG_DATA_DIRS", value, TRUE);
+  g_free(value);
+  g_free(data);
+
+  return envp;
+}
+
+static void clear_state(gboolean caches) {
+  char *path;
+
+  path = tmp_path("runtime", NULL);
+  remove_tree(path);
+  g_mkdir_with_parents(path, 0700);
+  g_free(path);
+
+  if (caches) {
+    path = tmp_path("cache", NULL);
+    remove_tree(path);
+    g_free(path);
+    path = tmp_path("home", NULL);
+    remove_tree(path);
+    g_free(path);
+  }
+}
+
+static gboolean run_round(int round, gint64 *time_to_running) {
+  GTestDBus *bus;
+  GDBusConnection *control;
+  GError *error = NULL;
+  GHashTable *durations;
+  GString *json;
+  char *services;
+  char *autostart;
+  char *trace;
+  char **envp;
+  char *argv[4];
+  GPid pid;
+  guint signal_id;
+  gint64 start;
+  gint64 running = 0;
+  gint64 deadline;
+  gint64 init_ts = -1;
+  gboolean ok = FALSE;
+  int n_apps = 0;
+  guint p;
+
+  clear_state(cold || round == 0);
+
+  services = tmp_path("services", NULL);
+  autostart = tmp_path("autostart", NULL);
+  trace = tmp_path("runtime", "mate-session", "startup-trace.json", NULL);
+
+  bus = g_test_dbus_new(G_TEST_DBUS_NONE);
+  g_test_dbus_add_service_dir(bus, services);
+  g_test_dbus_up(bus);
+
+  control = g_dbus_connection_new_for_address_sync(
+      g_test_dbus_get_bus_address(bus),
+      G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+          G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+      NULL, NULL, &error);
+  if (control == NULL) {
+    g_printerr("Unable to connect to the private bus: %s\n", error->message);
+    g_error_free(error);
+    g_test_dbus_down(bus);
+    g_object_unref(bus);
+    g_free(trace);
+    g_free(autostart);
+    g_free(services);
+    return FALSE;
+  }
+
+  session_running = FALSE;
+  signal_id = g_dbus_connection_signal_subscribe(
+      control, NULL, SM_DBUS_INTERFACE, "SessionRunning", SM_DBUS_PATH, NULL,
+      G_DBUS_SIGNAL_FLAGS_NONE, on_session_running, &running, NULL);
+
+  envp = get_session_environment();
+  argv[0] = session_path;
+  argv[1] = (char *)"--autostart";
+  argv[2] = autostart;
+  argv[3] = NULL;
+
+  start = g_get_monotonic_time();
+  if (!g_spawn_async(NULL, argv, envp,
+                     G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_SEARCH_PATH, NULL,
+                     NULL, &pid, &error)) {
+    g_printerr("Unable to start %s: %s\n", session_path, error->message);
+    g_error_free(error);
+    goto out;
+  }
+
+  deadline = start + (gint64)timeout * G_USEC_PER_SEC;
+  while (!session_running) {
+    if (waitpid(pid, NULL, WNOHANG) == pid) {
+      g_printerr("%s exited during startup\n", session_path);
+      pid = 0;
+      break;
+    }
+
+    if (g_get_monotonic_time() > deadline) {
+      g_printerr("The session was not running after %d s\n", timeout);
+      break;
+    }
+
+    g_main_context_iteration(NULL, TRUE);
+  }
+
+  if (!session_running) {
+    if (pid != 0) {
+      stop_session(pid);
+    }
+    goto out;
+  }
+
+  /* The trace is written when the running phase starts, right around
+   * the signal.
+   */
+  durations = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  deadline = g_get_monotonic_time() + G_USEC_PER_SEC;
+  while (!read_trace(trace, durations, &init_ts, &n_apps)) {
+    if (g_get_monotonic_time() > deadline) {
+      g_printerr("No startup trace in %s\n", trace);
+      break;
+    }
+    g_usleep(G_USEC_PER_SEC / 100);
+  }
+
+  stop_session(pid);
+
+  *time_to_running = running - start;
+
+  json = g_string_new(NULL);
+  g_string_append_printf(json,
+                         "{\"round\":%d,\"cold\":%s,\"entries_per_phase\":%d,"
+                         "\"apps_launched\":%d,\"time_to_running_ms\":%.3f",
+                         round + 1, cold || round == 0 ? "true" : "false",
+                         n_entries, n_apps, (running - start) / 1000.0);
+  if (init_ts >= 0) {
+    g_string_append_printf(json, ",\"exec_to_init_ms\":%.3f",
+                           (init_ts - start) / 1000.0);
+  }
+  g_string_append(json, ",\"phases_ms\":{");
+  for (p = 0; p < G_N_ELEMENTS(phases); p++) {
+    gint64 *duration;
+
+    duration = g_hash_table_lookup(durations, phases[p].name);
+    g_string_append_printf(json, "%s\"%s\":", p > 0 ? "," : "",
+                           phases[p].name);
+    if (duration != NULL) {
+      g_string_append_printf(json, "%.3f", *duration / 1000.0);
+    } else {
+      g_string_append(json, "null");
+    }
+  }
+  g_string_append(json, "}}");
+  g_print("%s\n", json->str);
+  g_string_free(json, TRUE);
+
+  g_hash_table_destroy(durations);
+  ok = TRUE;
+
+out:
+  g_strfreev(envp);
+  g_dbus_connection_signal_unsubscribe(control, signal_id);
+  g_dbus_connection_close_sync(control, NULL, NULL);
+  g_object_unref(control);
+  g_test_dbus_down(bus);
+  g_object_unref(bus);
+  g_free(trace);
+  g_free(autostart);
+  g_free(services);
+
+  return ok;
+}
+
+int main(int argc, char *argv[]) {
+  GOptionContext *context;
+  GError *error = NULL;
+  GArray *times;
+  gboolean ok = TRUE;
+  int round;
+
+  context = g_option_context_new("- benchmark mate-session startup");
+  g_option_context_add_main_entries(context, entries, NULL);
+  if (!g_option_context_parse(context, &argc, &argv, &error)) {
+    g_printerr("%s\n", error->message);
+    g_error_free(error);
+    return EXIT_FAILURE;
+  }
+  g_option_context_free(context);
+
+  if (n_entries < 0 || n_rounds < 1 || timeout < 1) {
+    g_printerr("Invalid counts\n");
+    return EXIT_FAILURE;
+  }
+
+  if (session_path == NULL) {
+    session_path = g_strdup("mate-session");
+  }
+
+  /* Same defaults as the session we start */
+  g_setenv("GSETTINGS_BACKEND", "memory", TRUE);
+
+  tmpdir = g_dir_make_tmp("test-session-startup-XXXXXX", &error);
+  if (tmpdir == NULL) {
+    g_printerr("Unable to create a temporary directory: %s\n",
+               error->message);
+    g_error_free(error);
+    return EXIT_FAILURE;
+  }
+
+  if (!generate_tree()) {
+    ok = FALSE;
+    goto out;
+  }
+
+  if (xvfb_path != NULL) {
+    if (!start_xvfb()) {
+      ok = FALSE;
+      goto out;
+    }
+  } else if (g_getenv("DISPLAY") == NULL) {
+    g_printerr("No display, use --xvfb\n");
+    ok = FALSE;
+    goto out;
+  }
+
+  g_timeout_add(20, on_wakeup, NULL);
+
+  times = g_array_new(FALSE, FALSE, sizeof(gint64));
+  for (round = 0; ok && round < n_rounds; round++) {
+    gint64 time_to_running;
+
+    ok = run_round(round, &time_to_running);
+    if (ok) {
+      g_array_append_val(times, time_to_running);
+    }
+  }
+
+  if (ok) {
+    g_array_sort(times, test_compare_int64);
+    g_print("{\"summary\":true,\"rounds\":%u,\"time_to_running_ms\":"
+            "{\"min\":%.3f,\"median\":%.3f,\"max\":%.3f}}\n",
+            times->len, g_array_index(times, gint64, 0) / 1000.0,
+            g_array_index(times, gint64, times->len / 2) / 1000.0,
+            g_array_index(times, gint64, times->len - 1) / 1000.0);
+  }
+  g_array_free(times, TRUE);
+
+out:
+  if (xvfb_pid != 0) {
+    kill(xvfb_pid, SIGTERM);
+    waitpid(xvfb_pid, NULL, 0);
+  }
+
+  remove_tree(tmpdir);
+  g_free(tmpdir);
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
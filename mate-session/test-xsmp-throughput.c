@@ -0,0 +1,233 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <X11/ICE/ICElib.h>
+#include <X11/SM/SMlib.h>
+#include <glib.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Measures how fast the session manager handles XSMP messages: every
+ * client sends a burst of SetProperties followed by a GetProperties and
+ * waits for the reply, all clients at the same time. Run it inside a
+ * session, once with xsmp-batch-limit set to 1 and once with the default
+ * to compare per-message and batched dispatch.
+ */
+
+static int n_clients = 50;
+static int n_messages = 100;
+static int n_rounds = 10;
+
+static GOptionEntry entries[] = {
+    {"clients", 'c', 0, G_OPTION_ARG_INT, &n_clients,
+     "Number of XSMP clients", "N"},
+    {"messages", 'm', 0, G_OPTION_ARG_INT, &n_messages,
+     "Messages sent by each client per round", "N"},
+    {"rounds", 'r', 0, G_OPTION_ARG_INT, &n_rounds, "Number of rounds", "N"},
+    {NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL}};
+
+static int n_replies = 0;
+
+static void save_yourself(SmcConn conn, SmPointer data, int save_type,
+                          Bool shutdown, int interact_style, Bool fast) {
+  SmcSaveYourselfDone(conn, True);
+}
+
+static void die(SmcConn conn, SmPointer data) {
+  g_printerr("Asked to die, aborting the benchmark\n");
+  exit(EXIT_FAILURE);
+}
+
+static void save_complete(SmcConn conn, SmPointer data) {}
+
+static void shutdown_cancelled(SmcConn conn, SmPointer data) {}
+
+static void got_properties(SmcConn conn, SmPointer data, int n_props,
+                           SmProp **props) {
+  int i;
+
+  for (i = 0; i < n_props; i++) {
+    SmFreeProperty(props[i]);
+  }
+  free(props);
+
+  n_replies++;
+}
+
+static SmcConn open_client(void) {
+  SmcCallbacks callbacks;
+  SmcConn conn;
+  char *client_id = NULL;
+  char error[256];
+
+  memset(&callbacks, 0, sizeof(callbacks));
+  callbacks.save_yourself.callback = save_yourself;
+  callbacks.die.callback = die;
+  callbacks.save_complete.callback = save_complete;
+  callbacks.shutdown_cancelled.callback = shutdown_cancelled;
+
+  conn = SmcOpenConnection(
+      NULL, NULL, SmProtoMajor, SmProtoMinor,
+      SmcSaveYourselfProcMask | SmcDieProcMask | SmcSaveCompleteProcMask |
+          SmcShutdownCancelledProcMask,
+      &callbacks, NULL, &client_id, sizeof(error), error);
+  if (conn == NULL) {
+    g_printerr("Unable to connect to the session manager: %s\n", error);
+    return NULL;
+  }
+
+  free(client_id);
+
+  return conn;
+}
+
+static void send_burst(SmcConn conn, int round) {
+  SmPropValue value;
+  SmProp prop;
+  SmProp *props[1];
+  char *text;
+  int i;
+
+  prop.name = (char *)"_GSM_Benchmark";
+  prop.type = (char *)SmARRAY8;
+  prop.num_vals = 1;
+  prop.vals = &value;
+  props[0] = &prop;
+
+  for (i = 0; i < n_messages; i++) {
+    text = g_strdup_printf("%d-%d", round, i);
+    value.value = text;
+    value.length = strlen(text);
+    SmcSetProperties(conn, 1, props);
+    g_free(text);
+  }
+
+  SmcGetProperties(conn, got_properties, NULL);
+  IceFlush(SmcGetIceConnection(conn));
+}
+
+static gboolean wait_for_replies(SmcConn *conns, struct pollfd *pfds) {
+  int i;
+
+  while (n_replies < n_clients) {
+    if (poll(pfds, n_clients, 10000) <= 0) {
+      g_printerr("Timed out waiting for the session manager\n");
+      return FALSE;
+    }
+
+    for (i = 0; i < n_clients; i++) {
+      if (pfds[i].revents == 0) {
+        continue;
+      }
+
+      if (IceProcessMessages(SmcGetIceConnection(conns[i]), NULL, NULL) !=
+          IceProcessMessagesSuccess) {
+        g_printerr("Lost the connection to the session manager\n");
+        return FALSE;
+      }
+    }
+  }
+
+  return TRUE;
+}
+
+int main(int argc, char *argv[]) {
+  GOptionContext *context;
+  GError *error = NULL;
+  SmcConn *conns;
+  struct pollfd *pfds;
+  gint64 total = 0;
+  gint64 best = G_MAXINT64;
+  gboolean ok = TRUE;
+  int connected;
+  int round;
+  int i;
+
+  context = g_option_context_new("- benchmark XSMP message handling");
+  g_option_context_add_main_entries(context, entries, NULL);
+  if (!g_option_context_parse(context, &argc, &argv, &error)) {
+    g_printerr("%s\n", error->message);
+    g_error_free(error);
+    return EXIT_FAILURE;
+  }
+  g_option_context_free(context);
+
+  if (n_clients < 1 || n_messages < 1 || n_rounds < 1) {
+    g_printerr("All counts must be positive\n");
+    return EXIT_FAILURE;
+  }
+
+  conns = g_new0(SmcConn, n_clients);
+  pfds = g_new0(struct pollfd, n_clients);
+
+  for (connected = 0; connected < n_clients; connected++) {
+    conns[connected] = open_client();
+    if (conns[connected] == NULL) {
+      ok = FALSE;
+      break;
+    }
+
+    pfds[connected].fd =
+        IceConnectionNumber(SmcGetIceConnection(conns[connected]));
+    pfds[connected].events = POLLIN;
+  }
+
+  for (round = 0; ok && round < n_rounds; round++) {
+    gint64 start;
+    gint64 elapsed;
+
+    n_replies = 0;
+    start = g_get_monotonic_time();
+
+    for (i = 0; i < n_clients; i++) {
+      send_burst(conns[i], round);
+    }
+    ok = wait_for_replies(conns, pfds);
+
+    elapsed = g_get_monotonic_time() - start;
+    total += elapsed;
+    best = MIN(best, elapsed);
+  }
+
+  if (ok) {
+    double messages = (double)n_clients * (n_messages + 1);
+
+    g_print("%d clients, %d messages each per round: best %.2f ms, average "
+            "%.2f ms, %.0f messages/s\n",
+            n_clients, n_messages + 1, best / 1000.0,
+            total / 1000.0 / n_rounds,
+            messages * n_rounds / (total / (double)G_USEC_PER_SEC));
+  }
+
+  for (i = 0; i < connected; i++) {
+    SmcCloseConnection(conns[i], 0, NULL);
+  }
+
+  g_free(pfds);
+  g_free(conns);
+
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2010      Novell, Inc.
+ * Copyright (C) 2006-2009 Red Hat, Inc.
+ * Copyright (C) 2012-2021 MATE Developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __FreeBSD__
+#include <kenv.h>
+#endif
+
+#include "mate-session-check-accelerated-common.h"
+
+#if defined(__linux__)
+int _parse_kcmdline(void) {
+  int ret = CMDLINE_UNSET;
+  GRegex *regex;
+  GMatchInfo *match;
+  char *contents;
+  char *word;
+  const char *arg;
+
+  if (!g_file_get_contents("/proc/cmdline", &contents, NULL, NULL)) return ret;
+
+  regex = g_regex_new("mate.fallback=(\\S+)", 0, G_REGEX_MATCH_NOTEMPTY, NULL);
+  if (!g_regex_match(regex, contents, G_REGEX_MATCH_NOTEMPTY, &match)) goto out;
+
+  word = g_match_info_fetch(match, 0);
+  g_debug("Found command-line match '%s'", word);
+  arg = word + strlen("mate.fallback=");
+  if (*arg != '0' && *arg != '1')
+    fprintf(stderr,
+            "mate-session-check-accelerated: Invalid value '%s' for "
+            "mate.fallback passed in kernel command line.\n",
+            arg);
+  else
+    ret = atoi(arg);
+  g_free(word);
+
+out:
+  g_match_info_free(match);
+  g_regex_unref(regex);
+  g_free(contents);
+
+  g_debug("Command-line parsed to %d", ret);
+
+  return ret;
+}
+#elif defined(__FreeBSD__)
+int _parse_kcmdline(void) {
+  int ret = CMDLINE_UNSET;
+  char value[KENV_MVALLEN];
+
+  /* a compile time check to avoid unexpected stack overflow */
+  _Static_assert(KENV_MVALLEN < 1024 * 1024, "KENV_MVALLEN is too large");
+
+  if (kenv(KENV_GET, "mate.fallback", value, KENV_MVALLEN) == -1) return ret;
+
+  if (*value != '0' && *value != '1')
+    fprintf(stderr,
+            "mate-session-is-accelerated: Invalid value '%s' for mate.fallback "
+            "passed in kernel environment.\n",
+            value);
+  else
+    ret = atoi(value);
+
+  g_debug("Kernel environment parsed to %d", ret);
+
+  return ret;
+}
+#else
+int _parse_kcmdline(void) { return CMDLINE_UNSET; }
+#endif
@@ -30,4 +30,11 @@
 #define HELPER_NO_ACCEL 1
 #define HELPER_SOFTWARE_RENDERING 2
 
+/* Values returned by _parse_kcmdline() for mate.fallback */
+#define CMDLINE_UNSET -1
+#define CMDLINE_NON_FALLBACK_FORCED 0
+#define CMDLINE_FALLBACK_FORCED 1
+
+int _parse_kcmdline(void);
+
 #endif /* __MATE_SESSION_CHECK_ACCELERATED_COMMON_H__ */
@@ -80,10 +80,6 @@
 #include <stdlib.h>
 #include <string.h>
 
-#ifdef __FreeBSD__
-#include <kenv.h>
-#endif
-
 #include <GL/gl.h>
 #include <GL/glx.h>
 #include <X11/Xatom.h>
@@ -102,71 +98,6 @@ static inline void _print_error(const char *str) {
   fprintf(stderr, "mate-session-is-accelerated: %s\n", str);
 }
 
-#define CMDLINE_UNSET -1
-#define CMDLINE_NON_FALLBACK_FORCED 0
-#define CMDLINE_FALLBACK_FORCED 1
-
-#if defined(__linux__)
-static int _parse_kcmdline(void) {
-  int ret = CMDLINE_UNSET;
-  GRegex *regex;
-  GMatchInfo *match;
-  char *contents;
-  char *word;
-  const char *arg;
-
-  if (!g_file_get_contents("/proc/cmdline", &contents, NULL, NULL)) return ret;
-
-  regex = g_regex_new("mate.fallback=(\\S+)", 0, G_REGEX_MATCH_NOTEMPTY, NULL);
-  if (!g_regex_match(regex, contents, G_REGEX_MATCH_NOTEMPTY, &match)) goto out;
-
-  word = g_match_info_fetch(match, 0);
-  g_debug("Found command-line match '%s'", word);
-  arg = word + strlen("mate.fallback=");
-  if (*arg != '0' && *arg != '1')
-    fprintf(stderr,
-            "mate-session-check-accelerated: Invalid value '%s' for "
-            "mate.fallback passed in kernel command line.\n",
-            arg);
-  else
-    ret = atoi(arg);
-  g_free(word);
-
-out:
-  g_match_info_free(match);
-  g_regex_unref(regex);
-  g_free(contents);
-
-  g_debug("Command-line parsed to %d", ret);
-
-  return ret;
-}
-#elif defined(__FreeBSD__)
-static int _parse_kcmdline(void) {
-  int ret = CMDLINE_UNSET;
-  char value[KENV_MVALLEN];
-
-  /* a compile time check to avoid unexpected stack overflow */
-  _Static_assert(KENV_MVALLEN < 1024 * 1024, "KENV_MVALLEN is too large");
-
-  if (kenv(KENV_GET, "mate.fallback", value, KENV_MVALLEN) == -1) return ret;
-
-  if (*value != '0' && *value != '1')
-    fprintf(stderr,
-            "mate-session-is-accelerated: Invalid value '%s' for mate.fallback "
-            "passed in kernel environment.\n",
-            value);
-  else
-    ret = atoi(value);
-
-  g_debug("Kernel environment parsed to %d", ret);
-
-  return ret;
-}
-#else
-static int _parse_kcmdline(void) { return CMDLINE_UNSET; }
-#endif
-
 static gboolean _has_composite(Display *display) {
   int dummy1, dummy2;
 
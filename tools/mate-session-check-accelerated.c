@@ -28,7 +28,9 @@
 
 #include <X11/Xatom.h>
 #include <epoxy/gl.h>
+#include <errno.h>
 #include <gdk/gdkx.h>
+#include <glib/gstdio.h>
 #include <gtk/gtk.h>
 #include <stdlib.h>
 #include <string.h>
@@ -48,6 +50,7 @@
 static Atom is_accelerated_atom;
 static Atom is_software_rendering_atom;
 static Atom renderer_atom;
+static Atom max_screen_size_atom;
 static gboolean property_changed;
 
 static gboolean on_property_notify_timeout(gpointer data) {
@@ -115,6 +118,223 @@ static gboolean is_discrete_gpu_check(void) {
   return TRUE;
 }
 
+/* The result of a successful check is cached together with everything
+ * that could change it: the GPUs and their kernel drivers, the GL
+ * libraries and helpers, the kernel command line override, the
+ * blacklist and the screen size.  When none of them changed since the
+ * last login, the cached answer is used without creating a GL context.
+ */
+static const char *cache_stat_paths[] = {
+    PKGDATADIR "/hardware-compatibility",
+    LIBEXECDIR "/mate-session-check-accelerated-gl-helper",
+#ifdef HAVE_GLESV2
+    LIBEXECDIR "/mate-session-check-accelerated-gles-helper",
+#endif
+    DRI_DRIVERDIR,
+    GL_LIBDIR "/libGL.so.1",
+    GL_LIBDIR "/libGLX_mesa.so.0",
+    GL_LIBDIR "/libEGL_mesa.so.0",
+    NULL};
+
+static char *get_cache_filename(void) {
+  return g_build_filename(g_get_user_cache_dir(), "mate-session",
+                          "accelerated", NULL);
+}
+
+static void append_sysfs_value(GString *key, const char *path) {
+  char *contents;
+
+  if (g_file_get_contents(path, &contents, NULL, NULL)) {
+    g_string_append_printf(key, "%s;", g_strstrip(contents));
+    g_free(contents);
+  } else {
+    g_string_append(key, "-;");
+  }
+}
+
+static gint compare_names(gconstpointer a, gconstpointer b) {
+  return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+static void append_drm_devices(GString *key) {
+  GDir *dir;
+  const char *name;
+  GPtrArray *cards;
+  guint i;
+
+  dir = g_dir_open("/sys/class/drm", 0, NULL);
+  if (dir == NULL) return;
+
+  cards = g_ptr_array_new_with_free_func(g_free);
+  while ((name = g_dir_read_name(dir)) != NULL) {
+    /* Skip the connectors, e.g. card0-HDMI-A-1 */
+    if (g_str_has_prefix(name, "card") && strchr(name, '-') == NULL)
+      g_ptr_array_add(cards, g_strdup(name));
+  }
+  g_dir_close(dir);
+
+  g_ptr_array_sort(cards, compare_names);
+
+  for (i = 0; i < cards->len; i++) {
+    char *base;
+    char *path;
+    char *driver;
+
+    base = g_build_filename("/sys/class/drm", g_ptr_array_index(cards, i),
+                            "device", NULL);
+
+    path = g_build_filename(base, "vendor", NULL);
+    append_sysfs_value(key, path);
+    g_free(path);
+
+    path = g_build_filename(base, "device", NULL);
+    append_sysfs_value(key, path);
+    g_free(path);
+
+    path = g_build_filename(base, "driver", NULL);
+    driver = g_file_read_link(path, NULL);
+    g_free(path);
+
+    if (driver != NULL) {
+      char *module;
+
+      module = g_path_get_basename(driver);
+      g_string_append_printf(key, "%s;", module);
+
+      path = g_build_filename("/sys/module", module, "version", NULL);
+      append_sysfs_value(key, path);
+      g_free(path);
+
+      g_free(module);
+      g_free(driver);
+    }
+
+    g_free(base);
+  }
+
+  g_ptr_array_free(cards, TRUE);
+}
+
+static char *get_cache_key(GdkDisplay *display) {
+  GString *key;
+  GdkScreen *screen;
+  const char *always_software;
+  guint i;
+
+  key = g_string_new(NULL);
+
+  append_drm_devices(key);
+  append_sysfs_value(key, "/proc/sys/kernel/osrelease");
+
+  for (i = 0; cache_stat_paths[i] != NULL; i++) {
+    GStatBuf st;
+
+    if (g_stat(cache_stat_paths[i], &st) == 0)
+      g_string_append_printf(key, "%" G_GINT64_FORMAT ";",
+                             (gint64)st.st_mtime);
+    else
+      g_string_append(key, "-;");
+  }
+
+  always_software = g_getenv("LIBGL_ALWAYS_SOFTWARE");
+  g_string_append_printf(key, "%d;%s;", _parse_kcmdline(),
+                         always_software != NULL ? always_software : "-");
+
+  screen = gdk_display_get_default_screen(display);
+  G_GNUC_BEGIN_IGNORE_DEPRECATIONS
+  g_string_append_printf(key, "%dx%d", gdk_screen_get_width(screen),
+                         gdk_screen_get_height(screen));
+  G_GNUC_END_IGNORE_DEPRECATIONS
+
+  return g_string_free(key, FALSE);
+}
+
+static gboolean read_cached_result(const char *cache_key,
+                                   gboolean *is_software_rendering,
+                                   glong *max_screen_size, char **renderer) {
+  GKeyFile *keyfile;
+  char *filename;
+  char *key = NULL;
+  gboolean ret = FALSE;
+
+  keyfile = g_key_file_new();
+  filename = get_cache_filename();
+
+  if (!g_key_file_load_from_file(keyfile, filename, G_KEY_FILE_NONE, NULL))
+    goto out;
+
+  key = g_key_file_get_string(keyfile, "Cache", "Key", NULL);
+  if (g_strcmp0(key, cache_key) != 0) goto out;
+
+  *renderer = g_key_file_get_string(keyfile, "Cache", "Renderer", NULL);
+  if (*renderer == NULL) goto out;
+
+  *is_software_rendering =
+      g_key_file_get_boolean(keyfile, "Cache", "SoftwareRendering", NULL);
+  *max_screen_size =
+      g_key_file_get_integer(keyfile, "Cache", "MaxScreenSize", NULL);
+  ret = TRUE;
+
+out:
+  g_free(key);
+  g_free(filename);
+  g_key_file_free(keyfile);
+
+  return ret;
+}
+
+static void write_cached_result(const char *cache_key,
+                                gboolean is_software_rendering,
+                                glong max_screen_size, const char *renderer) {
+  GKeyFile *keyfile;
+  char *filename;
+  char *dirname;
+  GError *error = NULL;
+
+  keyfile = g_key_file_new();
+  g_key_file_set_string(keyfile, "Cache", "Key", cache_key);
+  g_key_file_set_string(keyfile, "Cache", "Renderer", renderer);
+  g_key_file_set_boolean(keyfile, "Cache", "SoftwareRendering",
+                         is_software_rendering);
+  g_key_file_set_integer(keyfile, "Cache", "MaxScreenSize", max_screen_size);
+
+  filename = get_cache_filename();
+  dirname = g_path_get_dirname(filename);
+
+  if (g_mkdir_with_parents(dirname, 0700) != 0 ||
+      !g_key_file_save_to_file(keyfile, filename, &error)) {
+    g_printerr("mate-session-check-accelerated: Unable to write %s: %s\n",
+               filename, error ? error->message : g_strerror(errno));
+    g_clear_error(&error);
+  }
+
+  g_free(dirname);
+  g_free(filename);
+  g_key_file_free(keyfile);
+}
+
+/* The GL helper publishes the maximum screen size it found on the root
+ * window, and it has to be published again when the helper is skipped */
+static glong get_max_screen_size(GdkDisplay *display, Window rootwin) {
+  Atom type;
+  gint format;
+  gulong nitems;
+  gulong bytes_after;
+  guchar *data = NULL;
+  glong size = 0;
+
+  gdk_x11_display_error_trap_push(display);
+  XGetWindowProperty(GDK_DISPLAY_XDISPLAY(display), rootwin,
+                     max_screen_size_atom, 0, 1, False, XA_CARDINAL, &type,
+                     &format, &nitems, &bytes_after, &data);
+  gdk_x11_display_error_trap_pop_ignored(display);
+
+  if (type == XA_CARDINAL && nitems == 1) size = *(glong *)data;
+  if (data != NULL) XFree(data);
+
+  return size;
+}
+
 int main(int argc, char **argv) {
   GdkDisplay *display = NULL;
   int estatus;
@@ -133,6 +353,10 @@ int main(int argc, char **argv) {
   gboolean gl_software_rendering = FALSE, gles_software_rendering = FALSE;
   Window rootwin;
   glong is_accelerated, is_software_rendering;
+  gboolean cached_software_rendering;
+  glong max_screen_size;
+  char *cache_key = NULL;
+  gboolean from_cache = FALSE;
   GError *gl_error = NULL;
 
   gtk_init(NULL, NULL);
@@ -172,6 +396,8 @@ int main(int argc, char **argv) {
       display, "_GNOME_IS_SOFTWARE_RENDERING");
   renderer_atom =
       gdk_x11_get_xatom_by_name_for_display(display, "_GNOME_SESSION_RENDERER");
+  max_screen_size_atom =
+      gdk_x11_get_xatom_by_name_for_display(display, "_GNOME_MAX_SCREEN_SIZE");
 
   {
     Atom type;
@@ -212,8 +438,24 @@ int main(int argc, char **argv) {
   }
 
   /* We don't have the property or it's the wrong type.
-   * Try to compute it now.
+   * Try to compute it now, unless nothing changed since the last check.
    */
+  cache_key = get_cache_key(display);
+  if (read_cached_result(cache_key, &cached_software_rendering,
+                         &max_screen_size, &gl_renderer_string)) {
+    is_accelerated = TRUE;
+    is_software_rendering = cached_software_rendering;
+    renderer_string = gl_renderer_string;
+    from_cache = TRUE;
+
+    if (max_screen_size > 0) {
+      XChangeProperty(GDK_DISPLAY_XDISPLAY(display), rootwin,
+                      max_screen_size_atom, XA_CARDINAL, 32, PropModeReplace,
+                      (guchar *)&max_screen_size, 1);
+    }
+
+    goto finish;
+  }
 
   /* First indicate that a test is in progress */
   is_accelerated = ACCEL_CHECK_RUNNING;
@@ -313,6 +555,12 @@ finish:
 
   gdk_display_sync(display);
 
+  if (is_accelerated && renderer_string != NULL && !from_cache) {
+    write_cached_result(cache_key, is_software_rendering,
+                        get_max_screen_size(display, rootwin), renderer_string);
+  }
+
+  g_free(cache_key);
   g_free(gl_renderer_string);
 #ifdef HAVE_GLESV2
   g_free(gles_renderer_string);
@@ -33,6 +33,7 @@
 #endif /* ENABLE_NLS */
 
 #include <gio/gio.h>
+#include <gio/gunixfdlist.h>
 #include <glib.h>
 #include <glib/gi18n.h>
 
@@ -72,11 +73,55 @@ static GsmInhibitorFlags parse_flags(const gchar *arg) {
   return flags;
 }
 
+/* Returns a file descriptor that holds the inhibitor, -1 if the session
+ * manager does not support InhibitFd, or -2 on other errors */
+static int inhibit_fd(GDBusConnection *bus, const gchar *app_id,
+                      const gchar *reason, GsmInhibitorFlags flags) {
+  GUnixFDList *fd_list;
+  GVariant *ret;
+  GError *error = NULL;
+  gint32 handle;
+  int fd;
+
+  fd_list = NULL;
+  ret = g_dbus_connection_call_with_unix_fd_list_sync(
+      bus, "org.gnome.SessionManager", "/org/gnome/SessionManager",
+      "org.gnome.SessionManager", "InhibitFd",
+      g_variant_new("(susu)", app_id, 0, reason, flags),
+      G_VARIANT_TYPE("(hu)"), 0, G_MAXINT, NULL, &fd_list, NULL, &error);
+
+  if (ret == NULL) {
+    if (g_error_matches(error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD)) {
+      fd = -1;
+    } else {
+      g_warning("Failed to call InhibitFd: %s\n", error->message);
+      fd = -2;
+    }
+    g_error_free(error);
+    return fd;
+  }
+
+  g_variant_get(ret, "(hu)", &handle, NULL);
+  fd = g_unix_fd_list_get(fd_list, handle, &error);
+  if (fd < 0) {
+    g_warning("Failed to get inhibitor file descriptor: %s\n",
+              error->message);
+    g_error_free(error);
+    fd = -2;
+  }
+
+  g_object_unref(fd_list);
+  g_variant_unref(ret);
+
+  return fd;
+}
+
 static gboolean inhibit(const gchar *app_id, const gchar *reason,
                         GsmInhibitorFlags flags) {
   GDBusConnection *bus;
   GVariant *ret;
   GError *error = NULL;
+  int fd;
 
   bus = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, &error);
 
@@ -86,6 +131,15 @@ static gboolean inhibit(const gchar *app_id, const gchar *reason,
     return FALSE;
   }
 
+  /* The descriptor is kept open (but not passed to the command) until we
+   * exit, which is when the inhibitor should go away */
+  fd = inhibit_fd(bus, app_id, reason, flags);
+  if (fd >= 0) {
+    return TRUE;
+  } else if (fd == -2) {
+    return FALSE;
+  }
+
   ret = g_dbus_connection_call_sync(
       bus, "org.gnome.SessionManager", "/org/gnome/SessionManager",
       "org.gnome.SessionManager", "Inhibit",
@@ -25,6 +25,7 @@
 #include <config.h>
 #endif
 
+#include <gio/gio.h>
 #include <glib/gi18n.h>
 #include <gtk/gtk.h>
 #include <stdio.h>
@@ -46,6 +47,8 @@ enum {
   GSM_LOGOUT_MODE_FORCE
 };
 
+#define GSM_LOGOUT_FLAG_FAST 4
+
 /* True if killing. This is deprecated, but we keep it for compatibility
  * reasons. */
 static gboolean kill_session = FALSE;
@@ -56,12 +59,18 @@ static gboolean force_logout = FALSE;
 static gboolean logout_dialog = FALSE;
 static gboolean shutdown_dialog = FALSE;
 
+/* True if the logout should be forced once the logout budget is spent */
+static gboolean fast_logout = FALSE;
+
 /* True if we should use dialog boxes */
 static gboolean show_error_dialogs = FALSE;
 
 /* True if we should do the requested action without confirmation */
 static gboolean no_interaction = FALSE;
 
+/* True if we should not wait for the session manager to reply */
+static gboolean no_wait = FALSE;
+
 static char* session_name = NULL;
 
 static GOptionEntry options[] = {
@@ -72,8 +81,12 @@ static GOptionEntry options[] = {
      N_("Show logout dialog"), NULL},
     {"shutdown-dialog", '\0', 0, G_OPTION_ARG_NONE, &shutdown_dialog,
      N_("Show shutdown dialog"), NULL},
+    {"fast", '\0', 0, G_OPTION_ARG_NONE, &fast_logout,
+     N_("Log out within the logout time budget"), NULL},
     {"gui", '\0', 0, G_OPTION_ARG_NONE, &show_error_dialogs,
      N_("Use dialog boxes for errors"), NULL},
+    {"no-wait", '\0', 0, G_OPTION_ARG_NONE, &no_wait,
+     N_("Do not wait for the session manager to handle the request"), NULL},
     /* deprecated options */
     {"session-name", 's', G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_STRING,
      &session_name, N_("Set the current session name"), N_("NAME")},
@@ -84,7 +97,8 @@ static GOptionEntry options[] = {
     {NULL, 0, 0, G_OPTION_ARG_NONE, NULL, NULL, NULL}};
 
 static void display_error(const char* message) {
-  if (show_error_dialogs && !no_interaction) {
+  /* GTK is only brought up when there is something to show */
+  if (show_error_dialogs && !no_interaction && gtk_init_check(NULL, NULL)) {
     GtkWidget* dialog = gtk_message_dialog_new(
         NULL, 0, GTK_MESSAGE_ERROR, GTK_BUTTONS_CLOSE, "%s", message);
 
@@ -97,84 +111,112 @@ static void display_error(const char* message) {
   }
 }
 
-static GDBusProxy* get_sm_proxy(void) {
-  GError* error = NULL;
-  GDBusProxy* sm_proxy = NULL;
+/* Sends @method without waiting for its reply */
+static gboolean send_sm_request(GDBusConnection* connection,
+                                const char* method, GVariant* parameters) {
+  GDBusMessage* message;
+  GError* error;
+  gboolean res;
 
-  sm_proxy = g_dbus_proxy_new_for_bus_sync(
-      G_BUS_TYPE_SESSION, G_DBUS_PROXY_FLAGS_NONE, NULL, GSM_SERVICE_DBUS,
-      GSM_PATH_DBUS, GSM_INTERFACE_DBUS, NULL, &error);
-  if (sm_proxy == NULL) {
-    g_warning("Couldn't create DBus proxy: %s", error->message);
-    g_error_free(error);
+  message = g_dbus_message_new_method_call(GSM_SERVICE_DBUS, GSM_PATH_DBUS,
+                                           GSM_INTERFACE_DBUS, method);
+  g_dbus_message_set_body(message, parameters);
+  g_dbus_message_set_flags(message, G_DBUS_MESSAGE_FLAGS_NO_REPLY_EXPECTED);
 
-    /* Try the old name - for the case when we've just upgraded from 1.10
-     * so the old m-s-m is currently running */
-    sm_proxy = g_dbus_proxy_new_for_bus_sync(
-        G_BUS_TYPE_SESSION, G_DBUS_PROXY_FLAGS_NONE, NULL, GSM_SERVICE_DBUS_OLD,
-        GSM_PATH_DBUS_OLD, GSM_INTERFACE_DBUS_OLD, NULL, NULL);
-    if (sm_proxy == NULL) {
-      /* Okay, it wasn't the upgrade case, so now we can give up. */
-      display_error(_("Could not connect to the session manager"));
-      return NULL;
-    }
+  error = NULL;
+  res = g_dbus_connection_send_message(
+            connection, message, G_DBUS_SEND_MESSAGE_FLAGS_NONE, NULL,
+            &error) &&
+        g_dbus_connection_flush_sync(connection, NULL, &error);
+  g_object_unref(message);
+
+  if (!res) {
+    g_warning("Failed to call %s: %s", method, error->message);
+    g_error_free(error);
   }
 
-  return sm_proxy;
+  return res;
 }
 
-static void do_logout(unsigned int mode) {
-  GDBusProxy* sm_proxy;
+/* Calls @method and waits for the session manager to handle it */
+static gboolean call_sm(GDBusConnection* connection, const char* method,
+                        GVariant* parameters) {
   GError* error;
   GVariant* ret;
 
-  sm_proxy = get_sm_proxy();
-
-  if (sm_proxy == NULL)
-    return;
+  g_variant_ref_sink(parameters);
 
   error = NULL;
-  ret = g_dbus_proxy_call_sync(sm_proxy, "Logout", g_variant_new("(u)", mode),
-                               G_DBUS_CALL_FLAGS_NONE, -1, NULL, &error);
+  ret = g_dbus_connection_call_sync(
+      connection, GSM_SERVICE_DBUS, GSM_PATH_DBUS, GSM_INTERFACE_DBUS, method,
+      parameters, NULL, G_DBUS_CALL_FLAGS_NONE, -1, NULL, &error);
+
+  if (ret == NULL &&
+      g_error_matches(error, G_DBUS_ERROR, G_DBUS_ERROR_SERVICE_UNKNOWN)) {
+    g_clear_error(&error);
+
+    /* Try the old name - for the case when we've just upgraded from 1.10
+     * so the old m-s-m is currently running */
+    ret = g_dbus_connection_call_sync(
+        connection, GSM_SERVICE_DBUS_OLD, GSM_PATH_DBUS_OLD,
+        GSM_INTERFACE_DBUS_OLD, method, parameters, NULL,
+        G_DBUS_CALL_FLAGS_NONE, -1, NULL, &error);
+    if (ret == NULL &&
+        g_error_matches(error, G_DBUS_ERROR, G_DBUS_ERROR_SERVICE_UNKNOWN)) {
+      /* Okay, it wasn't the upgrade case, so now we can give up. */
+      g_error_free(error);
+      g_variant_unref(parameters);
+      display_error(_("Could not connect to the session manager"));
+      return FALSE;
+    }
+  }
+
+  g_variant_unref(parameters);
 
   if (ret == NULL) {
-    g_warning("Failed to call logout: %s", error->message);
+    g_warning("Failed to call %s: %s", method, error->message);
     g_error_free(error);
-  } else {
-    g_variant_unref(ret);
+    return FALSE;
   }
 
-  if (sm_proxy != NULL) {
-    g_object_unref(sm_proxy);
-  }
+  g_variant_unref(ret);
+
+  return TRUE;
 }
 
-static void do_shutdown_dialog(void) {
-  GDBusProxy* sm_proxy;
+static void do_sm_request(const char* method, GVariant* parameters) {
+  GDBusConnection* connection;
   GError* error;
-  GVariant* ret;
-
-  sm_proxy = get_sm_proxy();
-
-  if (sm_proxy == NULL)
-    return;
 
   error = NULL;
-  ret = g_dbus_proxy_call_sync(sm_proxy, "Shutdown", g_variant_new("()"),
-                               G_DBUS_CALL_FLAGS_NONE, -1, NULL, &error);
-  if (ret == NULL) {
-    g_warning("Failed to call shutdown: %s", error->message);
+  connection = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, &error);
+  if (connection == NULL) {
+    g_warning("Couldn't connect to the session bus: %s", error->message);
     g_error_free(error);
-  } else {
-    g_variant_unref(ret);
+    display_error(_("Could not connect to the session manager"));
+    g_variant_unref(g_variant_ref_sink(parameters));
+    return;
   }
 
-  if (sm_proxy != NULL) {
-    g_object_unref(sm_proxy);
+  if (no_wait) {
+    send_sm_request(connection, method, parameters);
+  } else {
+    call_sm(connection, method, parameters);
   }
+
+  g_object_unref(connection);
+}
+
+static void do_logout(unsigned int mode) {
+  do_sm_request("Logout", g_variant_new("(u)", mode));
+}
+
+static void do_shutdown_dialog(void) {
+  do_sm_request("Shutdown", g_variant_new("()"));
 }
 
 int main(int argc, char* argv[]) {
+  GOptionContext* context;
   GError* error;
   int conflicting_options;
 
@@ -187,11 +229,18 @@ int main(int argc, char* argv[]) {
 
   error = NULL;
 
-  if (!gtk_init_with_args(&argc, &argv, NULL, options, NULL, &error)) {
+  /* The GTK options are still accepted, but the display is only opened
+   * if an error dialog has to be shown */
+  context = g_option_context_new(NULL);
+  g_option_context_add_main_entries(context, options, GETTEXT_PACKAGE);
+  g_option_context_add_group(context, gtk_get_option_group(FALSE));
+  if (!g_option_context_parse(context, &argc, &argv, &error)) {
     g_warning("Unable to start: %s", error->message);
     g_error_free(error);
+    g_option_context_free(context);
     exit(EXIT_FAILURE);
   }
+  g_option_context_free(context);
 
   conflicting_options = 0;
   if (kill_session)
@@ -216,9 +265,10 @@ int main(int argc, char* argv[]) {
   }
 
   if (logout) {
-    do_logout(GSM_LOGOUT_MODE_NO_CONFIRMATION);
+    do_logout(GSM_LOGOUT_MODE_NO_CONFIRMATION |
+              (fast_logout ? GSM_LOGOUT_FLAG_FAST : 0));
   } else if (force_logout) {
-    do_logout(GSM_LOGOUT_MODE_FORCE);
+    do_logout(GSM_LOGOUT_MODE_FORCE | (fast_logout ? GSM_LOGOUT_FLAG_FAST : 0));
   } else if (logout_dialog) {
     do_logout(GSM_LOGOUT_MODE_NORMAL);
   } else if (shutdown_dialog) {